@@ -8,6 +8,10 @@
  * of note: `Expr` `Proto` and `Func`. This is modeled from the LLVM Kaleidoscope
  * tutorial (http://llvm.org/docs/tutorial/LangImpl2.HTML).
  *
+ * Codegen emits HLIR constructs into `Codegen::hlir`, the HLIR of
+ * `Codegen::module`: `for` and `map` become parallel constructs, and tasks
+ * become HLIRTasks, whose calls are spawned once the module is lowered.
+ *
  */
 #pragma once
 
@@ -21,6 +25,9 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include "hlir/HLIR.h"
 
 using namespace llvm;
 
@@ -33,6 +40,18 @@ enum NodeType {
   kFunc,
   kIf,
   kFor,
+  kMap,
+  kIndex,
+  kBlock,
+  kRegion,
+  kPartition,
+};
+
+// How a task accesses the partition block passed to one of its parameters.
+enum BlockMode {
+  kIn,
+  kOut,
+  kInOut,
 };
 
 enum BinOp {
@@ -53,8 +72,28 @@ namespace Codegen {
   Value *errorv(const char *str) { std::cerr << str; return 0; }
 
   static Module* module;
+  static ares::HLIRModule* hlir;
   static IRBuilder<> b(getGlobalContext());
   static std::map<std::string, Value*> valueTable;
+
+  // A region is a global pointer to its doubles, allocated before main.
+  // Its pages are placed by its first partition, if any.
+  struct Region {
+    GlobalVariable* base;
+    uint64_t size;
+    uint64_t blockSize;
+  };
+
+  // A partition splits a region into blocks of blockSize doubles, the
+  // partitioner maps an address in the region to its block.
+  struct Partition {
+    std::string region;
+    uint64_t blockSize;
+    Function* partitioner;
+  };
+
+  static std::map<std::string, Region> regions;
+  static std::map<std::string, Partition> partitions;
 }; // namespace
 
 
@@ -119,12 +158,125 @@ struct NameExpr : Expr {
   Value* codegen() {
     // Look this variable up in the function.
     Value *V = Codegen::valueTable[name];
+    if (V && V->getType()->isPointerTy()) {
+      return Codegen::errorv("A block can only be indexed");
+    }
     return V ? V : Codegen::errorv("Unknown variable name");
   }
 
   std::string name;
 };
 
+/**
+ * A task parameter that is a block of a partition, `in a : p`. It is a
+ * pointer to the first double of the block, whose dependence and placement
+ * are those of its mode and partition.
+ */
+struct BlockParam : NameExpr {
+  BlockParam(const std::string& name, BlockMode mode,
+             const std::string& partition)
+    : NameExpr(name), mode(mode), partition(partition) {
+    type = kBlock;
+  };
+
+  void print(const std::string& label, int depth) {
+    const char* modes[] = { "in", "out", "inout" };
+    std::cout << prefix(label, depth) << "BlockParam( " << modes[mode] << " "
+              << name << " : " << partition << " )" << std::endl;
+  };
+
+  BlockMode mode;
+  std::string partition;
+};
+
+/**
+ * name[index] and name[index] <- value
+ *
+ * Reads, or writes and is, the element of a region or of a block parameter.
+ * As a task argument, p[k] of a partition p is the address of its block k.
+ */
+struct IndexExpr : Expr {
+  IndexExpr() : Expr(kIndex), base(nullptr), index(nullptr),
+                value(nullptr) {};
+  IndexExpr(NameExpr* base, Expr* index, Expr* value)
+    : Expr(kIndex), base(base), index(index), value(value) {};
+
+  ~IndexExpr() {
+    delete base;
+    delete index;
+    delete value;
+  }
+
+  void print(const std::string& label, int depth) {
+    std::cout << prefix(label, depth) << "IndexExpr()" << std::endl;
+    base->print("BASE -> ", depth + 1);
+    index->print("INDEX -> ", depth + 1);
+    if (value) {
+      value->print("VALUE -> ", depth + 1);
+    }
+  }
+
+  // The address of element i of the region or block named by base.
+  Value* element(Value* i) {
+    Value* ptr = Codegen::valueTable[base->name];
+    auto itr = Codegen::regions.find(base->name);
+
+    if (ptr == 0 && itr != Codegen::regions.end()) {
+      ptr = Codegen::b.CreateLoad(itr->second.base, base->name);
+    }
+    if (ptr == 0 || !ptr->getType()->isPointerTy()) {
+      return Codegen::errorv("Unknown region or block");
+    }
+
+    Type* i64 = Type::getInt64Ty(getGlobalContext());
+    return Codegen::b.CreateGEP(ptr, Codegen::b.CreateFPToUI(i, i64),
+                                "element");
+  }
+
+  // The address of block index of the partition named by base.
+  Value* blockAddress() {
+    auto itr = Codegen::partitions.find(base->name);
+    if (itr == Codegen::partitions.end() || value) {
+      return Codegen::errorv("Unknown partition");
+    }
+
+    Value* i = index->codegen();
+    if (i == 0) return 0;
+
+    Codegen::Partition& p = itr->second;
+    Value* ptr =
+      Codegen::b.CreateLoad(Codegen::regions[p.region].base, p.region);
+
+    Type* i64 = Type::getInt64Ty(getGlobalContext());
+    Value* offset =
+      Codegen::b.CreateMul(Codegen::b.CreateFPToUI(i, i64),
+                           ConstantInt::get(i64, p.blockSize));
+    return Codegen::b.CreateGEP(ptr, offset, "block");
+  }
+
+  Value* codegen() {
+    Value* i = index->codegen();
+    if (i == 0) return 0;
+
+    Value* ptr = element(i);
+    if (ptr == 0) return 0;
+
+    if (value == 0) {
+      return Codegen::b.CreateLoad(ptr, "loadtmp");
+    }
+
+    Value* v = value->codegen();
+    if (v == 0) return 0;
+
+    Codegen::b.CreateStore(v, ptr);
+    return v;
+  }
+
+  NameExpr* base;
+  Expr* index;
+  Expr* value;
+};
+
 struct BinExpr : Expr {
   BinExpr() : Expr(kBin), lhs(nullptr), rhs(nullptr) {};
   BinExpr(BinOp op) : Expr(kBin), op(op), lhs(nullptr), rhs(nullptr) {};
@@ -189,9 +341,21 @@ struct CallExpr : Expr {
       return Codegen::errorv("Incorrect # arguments passed");
     }
 
+    // Block parameters are passed the address of a partition's block.
     std::vector<Value*> argsv;
+    unsigned idx = 0;
     for(auto arg : args) {
-      argsv.push_back(arg->codegen());
+      Value* v;
+      if (func->getFunctionType()->getParamType(idx++)->isPointerTy()) {
+        if (arg->type != kIndex) {
+          return Codegen::errorv("A block argument must be p[k]");
+        }
+        v = static_cast<IndexExpr*>(arg)->blockAddress();
+      } else {
+        v = arg->codegen();
+      }
+      if (v == 0) return 0;
+      argsv.push_back(v);
     }
 
     return Codegen::b.CreateCall(func, argsv, "calltmp");
@@ -223,10 +387,13 @@ struct Proto : AST {
 
     Function* codegen() {
       // Make the function type:  double(double,double) etc.
-      std::vector<Type*> doubles(args.size(),
-                                 Type::getDoubleTy(getGlobalContext()));
-      FunctionType *ft = FunctionType::get(Type::getDoubleTy(getGlobalContext()),
-                                           doubles, false);
+      // Block parameters are pointers to doubles, the rest doubles.
+      Type* dt = Type::getDoubleTy(getGlobalContext());
+      std::vector<Type*> doubles;
+      for (auto arg : args) {
+        doubles.push_back(arg->type == kBlock ? dt->getPointerTo() : dt);
+      }
+      FunctionType *ft = FunctionType::get(dt, doubles, false);
       Function *f = Function::Create(ft, Function::ExternalLinkage,
                                      name->name, Codegen::module);
 
@@ -276,9 +443,11 @@ struct Proto : AST {
 };
 
 struct Func : AST {
-  Func(bool isTask) : AST(kFunc), isTask(isTask), proto(nullptr), body(nullptr) {};
-  Func(bool isTask, Proto* proto, Expr* body) :
-    AST(kFunc), isTask(isTask), proto(proto), body(body) {};
+  Func(bool isTask) :
+    AST(kFunc), isTask(isTask), memoize(false), proto(nullptr),
+    body(nullptr) {};
+  Func(bool isTask, Proto* proto, Expr* body, bool memoize = false) :
+    AST(kFunc), isTask(isTask), memoize(memoize), proto(proto), body(body) {};
 
   ~Func() {
     delete proto;
@@ -311,6 +480,32 @@ struct Func : AST {
       // Validate the generated code, checking for consistency.
       verifyFunction(*func);
 
+      // Every call of a task is spawned. Doubles are passed by value and
+      // carry no data dependence, blocks are dependences of the call as
+      // their mode says, and place it on the workers of their partition.
+      // The calls of a memoized task share the result of the first made
+      // with the same arguments, unless it writes a block.
+      if (isTask) {
+        ares::HLIRTask* task = Codegen::hlir->createTask();
+        task->setFunction(func);
+        task->setMemoize(memoize);
+        for (auto arg : proto->args) {
+          ares::HLIRTaskParam& param = task->addParam();
+          if (arg->type != kBlock) {
+            continue;
+          }
+
+          auto block = static_cast<BlockParam*>(arg);
+          param.setRead(block->mode != kOut);
+          param.setWrite(block->mode != kIn);
+
+          auto itr = Codegen::partitions.find(block->partition);
+          if (itr != Codegen::partitions.end()) {
+            param.setPartitioner(itr->second.partitioner);
+          }
+        }
+      }
+
       return func;
     }
 
@@ -320,6 +515,7 @@ struct Func : AST {
   }
 
   bool isTask;
+  bool memoize;
   Proto* proto;
   Expr* body;
 };
@@ -347,30 +543,292 @@ struct IfExpr : Expr {
   Expr* cond;
 };
 
-/*
-struct ForExpr : Expr {
-  ForExpr() : Expr(kFor), iter(nullptr), start(nullptr), cond(nullptr),
-              step(nullptr) {};
-  ForExpr(NameExpr* iter, Expr* start, Expr* cond, Expr* step)
-    : Expr(kFunc), iter(iter), start(start), cond(cond), step(step) {};
 
-  void print(const std::string& label, int depth) {
-    std::cout << prefix(label, depth) << "ForExpr( )" << std::endl;
-    iter->print("ITERATOR -> " , depth + 1);
-    start->print("START -> "    , depth + 1);
-    cond ->print("COND -> "     , depth + 1);
-    step ->print("STEP - >"     , depth + 1);
+/**
+ * The common part of `for` and `map`: the body is evaluated once for each
+ * integer in [start, end), with `iter` bound to it. Neither can have side
+ * effects other than those of the calls in the body, so every iteration
+ * is independent and both are emitted as HLIR parallel constructs.
+ */
+struct RangeExpr : Expr {
+  RangeExpr(NodeType type) : Expr(type), iter(nullptr), start(nullptr),
+                             end(nullptr), body(nullptr) {};
+  RangeExpr(NodeType type, NameExpr* iter, Expr* start, Expr* end,
+            Expr* body)
+    : Expr(type), iter(iter), start(start), end(end), body(body) {};
+
+  ~RangeExpr() {
+    delete iter;
+    delete start;
+    delete end;
+    delete body;
   }
 
-  Value* codegen() {
+  void printRange(const std::string& label, int depth) {
+    iter ->print("ITERATOR -> ", depth + 1);
+    start->print("START -> "   , depth + 1);
+    end  ->print("END -> "     , depth + 1);
+    body ->print("BODY -> "    , depth + 1);
+  }
 
-    return 0;
+  // Codegens the body at the builder's insertion point, with `iter` bound
+  // to the double of the integer index loaded from indexPtr.
+  Value* codegenBody(Value* indexPtr) {
+    Value* index = Codegen::b.CreateLoad(indexPtr, "index");
+    Value* prev = Codegen::valueTable[iter->name];
+    Codegen::valueTable[iter->name] =
+      Codegen::b.CreateSIToFP(index, Type::getDoubleTy(getGlobalContext()),
+                              iter->name);
 
+    Value* v = body->codegen();
+
+    Codegen::valueTable[iter->name] = prev;
+    return v;
   }
 
   NameExpr* iter;
   Expr* start;
-  Expr* cond;
-  Expr* step;
+  Expr* end;
+  Expr* body;
 };
-*/
+
+/**
+ * for i in start, end do body end
+ *
+ * Evaluates body for each i, in parallel, and is 0. It is emitted as an
+ * HLIRParallelFor whose outlined body discards the value of each iteration.
+ */
+struct ForExpr : RangeExpr {
+  ForExpr() : RangeExpr(kFor) {};
+  ForExpr(NameExpr* iter, Expr* start, Expr* end, Expr* body)
+    : RangeExpr(kFor, iter, start, end, body) {};
+
+  void print(const std::string& label, int depth) {
+    std::cout << prefix(label, depth) << "ForExpr()" << std::endl;
+    printRange(label, depth);
+  }
+
+  Value* codegen() {
+    Value* s = start->codegen();
+    Value* e = end->codegen();
+    if (s == 0 || e == 0) return 0;
+
+    ares::HLIRParallelFor* pfor = Codegen::hlir->createParallelFor();
+
+    BasicBlock* prevBlock = Codegen::b.GetInsertBlock();
+    BasicBlock::iterator prevPoint = Codegen::b.GetInsertPoint();
+
+    // The body is emitted in place of the insertion placeholder, and
+    // branches to the exit block which advances the index.
+    Instruction* insertion = pfor->insertion();
+    BasicBlock* loopBlock = insertion->getParent();
+    insertion->removeFromParent();
+    Codegen::b.SetInsertPoint(loopBlock);
+
+    Value* v = codegenBody(pfor->index());
+    if (v == 0) return 0;
+
+    Codegen::b.CreateBr(pfor->exitBlock());
+    Codegen::b.SetInsertPoint(prevBlock, prevPoint);
+
+    Type* i32 = Type::getInt32Ty(getGlobalContext());
+    pfor->setRange(Codegen::b.CreateFPToUI(s, i32, "start"),
+                   Codegen::b.CreateFPToUI(e, i32, "end"));
+    pfor->insert(Codegen::b);
+
+    return ConstantFP::get(getGlobalContext(), APFloat(0.0));
+  }
+};
+
+/**
+ * map i in start, end do body end
+ *
+ * Maps body over each i, in parallel, and is the sum of the results. It is
+ * emitted as an HLIRParallelReduce of a single double, whose partials the
+ * outlined body adds the value of each iteration to.
+ */
+struct MapExpr : RangeExpr {
+  MapExpr() : RangeExpr(kMap) {};
+  MapExpr(NameExpr* iter, Expr* start, Expr* end, Expr* body)
+    : RangeExpr(kMap, iter, start, end, body) {};
+
+  void print(const std::string& label, int depth) {
+    std::cout << prefix(label, depth) << "MapExpr()" << std::endl;
+    printRange(label, depth);
+  }
+
+  Value* codegen() {
+    Value* s = start->codegen();
+    Value* e = end->codegen();
+    if (s == 0 || e == 0) return 0;
+
+    Type* dt = Type::getDoubleTy(getGlobalContext());
+
+    ares::HLIRParallelReduce* r = Codegen::hlir->createParallelReduce({dt});
+    r->setOp(0, ares::HLIRParallelReduce::Sum);
+
+    // The reduce stores its result to a local of the enclosing function.
+    Function* f = Codegen::b.GetInsertBlock()->getParent();
+    IRBuilder<> entry(&f->getEntryBlock(), f->getEntryBlock().begin());
+    Value* result = entry.CreateAlloca(dt, nullptr, "map.result");
+    r->setReduceResult(0, result);
+
+    BasicBlock* prevBlock = Codegen::b.GetInsertBlock();
+    BasicBlock::iterator prevPoint = Codegen::b.GetInsertPoint();
+
+    Codegen::b.SetInsertPoint(r->insertion());
+
+    Value* v = codegenBody(r->index());
+    if (v == 0) return 0;
+
+    Value* partial = r->reduceVar(0);
+    Codegen::b.CreateStore(
+      Codegen::b.CreateFAdd(Codegen::b.CreateLoad(partial), v, "addtmp"),
+      partial);
+
+    Codegen::b.SetInsertPoint(prevBlock, prevPoint);
+
+    Type* i64 = Type::getInt64Ty(getGlobalContext());
+    r->setRange(Codegen::b.CreateFPToUI(s, i64, "start"),
+                Codegen::b.CreateFPToUI(e, i64, "end"));
+    r->insert(Codegen::b);
+
+    return Codegen::b.CreateLoad(result, "map");
+  }
+};
+
+/**
+ * region r[n];
+ *
+ * Declares a region of n doubles, a global pointer to a buffer the runtime
+ * allocates before main.
+ */
+struct RegionDecl : AST {
+  RegionDecl() : AST(kRegion), name(nullptr), size(0) {};
+  RegionDecl(NameExpr* name, uint64_t size)
+    : AST(kRegion), name(name), size(size) {};
+
+  ~RegionDecl() { delete name; }
+
+  void print(const std::string& label, int depth) {
+    std::cout << prefix(label, depth) << "RegionDecl( " << size << " )"
+              << std::endl;
+    name->print("NAME -> ", depth + 1);
+  }
+
+  GlobalVariable* codegen() {
+    if (Codegen::regions.count(name->name)) {
+      Codegen::errorv("redefinition of region");
+      return 0;
+    }
+
+    PointerType* pt = Type::getDoubleTy(getGlobalContext())->getPointerTo();
+    auto base = new GlobalVariable(*Codegen::module, pt, false,
+                                   GlobalValue::InternalLinkage,
+                                   ConstantPointerNull::get(pt), name->name);
+
+    Codegen::regions[name->name] = { base, size, 0 };
+    return base;
+  }
+
+  NameExpr* name;
+  uint64_t size;
+};
+
+/**
+ * partition p = r / k;
+ *
+ * Splits region r into k blocks of equal size, but for the last. The first
+ * partition of a region places its blocks on the worker groups, and the
+ * tasks that take one of them on the group it is on.
+ */
+struct PartitionDecl : AST {
+  PartitionDecl() : AST(kPartition), name(nullptr), region(nullptr),
+                    parts(0) {};
+  PartitionDecl(NameExpr* name, NameExpr* region, uint64_t parts)
+    : AST(kPartition), name(name), region(region), parts(parts) {};
+
+  ~PartitionDecl() {
+    delete name;
+    delete region;
+  }
+
+  void print(const std::string& label, int depth) {
+    std::cout << prefix(label, depth) << "PartitionDecl( " << parts << " )"
+              << std::endl;
+    name->print("NAME -> ", depth + 1);
+    region->print("REGION -> ", depth + 1);
+  }
+
+  // i32 partitioner(i8* addr), the block of the region addr is in.
+  Function* codegen() {
+    auto itr = Codegen::regions.find(region->name);
+    if (itr == Codegen::regions.end() || parts == 0) {
+      Codegen::errorv("partition of unknown region");
+      return 0;
+    }
+
+    Codegen::Region& r = itr->second;
+    uint64_t blockSize = std::max(uint64_t(1), (r.size + parts - 1) / parts);
+    if (r.blockSize == 0) {
+      r.blockSize = blockSize;
+    }
+
+    LLVMContext& c = getGlobalContext();
+    Type* i32 = Type::getInt32Ty(c);
+    Type* i64 = Type::getInt64Ty(c);
+    FunctionType* ft =
+      FunctionType::get(i32, { Type::getInt8PtrTy(c) }, false);
+    Function* f =
+      Function::Create(ft, Function::InternalLinkage,
+                       "toy.partition." + name->name, Codegen::module);
+
+    IRBuilder<> b(BasicBlock::Create(c, "entry", f));
+    Value* addr = b.CreatePtrToInt(&*f->arg_begin(), i64);
+    Value* base = b.CreatePtrToInt(b.CreateLoad(r.base), i64);
+    Value* block = b.CreateUDiv(b.CreateSub(addr, base),
+                                ConstantInt::get(i64, blockSize * 8));
+    b.CreateRet(b.CreateTrunc(block, i32));
+
+    Codegen::partitions[name->name] = { region->name, blockSize, f };
+    return f;
+  }
+
+  NameExpr* name;
+  NameExpr* region;
+  uint64_t parts;
+};
+
+namespace Codegen {
+  /**
+   * Allocates every region before main, with __ares_region_alloc(), which
+   * first touches each block of its partition on the workers it is placed
+   * on. Call this once all declarations are generated.
+   */
+  Function* regionInit() {
+    LLVMContext& c = getGlobalContext();
+    Type* i64 = Type::getInt64Ty(c);
+    Type* i8p = Type::getInt8PtrTy(c);
+
+    Function* alloc = cast<Function>(module->getOrInsertFunction(
+      "__ares_region_alloc", FunctionType::get(i8p, { i64, i64 }, false)));
+
+    Function* f =
+      Function::Create(FunctionType::get(Type::getVoidTy(c), false),
+                       Function::InternalLinkage, "toy.regions", module);
+
+    IRBuilder<> b(BasicBlock::Create(c, "entry", f));
+    for (auto& itr : regions) {
+      Region& r = itr.second;
+      uint64_t blockSize = r.blockSize ? r.blockSize : r.size;
+
+      Value* buf = b.CreateCall(alloc, { ConstantInt::get(i64, r.size * 8),
+                                         ConstantInt::get(i64, blockSize * 8) });
+      b.CreateStore(b.CreateBitCast(buf, r.base->getValueType()), r.base);
+    }
+    b.CreateRetVoid();
+
+    appendToGlobalCtors(*module, f, 0);
+    return f;
+  }
+}; // namespace
@@ -35,7 +35,7 @@ namespace parse {
   ////////////////////////////////////////////////////////////////
   // Note that 'elseif' precedes 'else' in order to prevent only matching
   // the "else" part of an "elseif" and running into an error in the
-  // 'keyword' rule.
+  // 'keyword' rule. The same goes for 'inout' and 'in'.
   //
   // These keywords are not all used. I just have theme here as they may be
   // used in the future.
@@ -49,14 +49,23 @@ namespace parse {
   struct str_func    : string< 'f', 'u', 'n', 'c' > {};
   struct str_if      : string< 'i', 'f' > {};
   struct str_in      : string< 'i', 'n' > {};
+  struct str_inout   : string< 'i', 'n', 'o', 'u', 't' > {};
+  struct str_map     : string< 'm', 'a', 'p' > {};
+  struct str_memoize : string< 'm', 'e', 'm', 'o', 'i', 'z', 'e' > {};
+  struct str_out     : string< 'o', 'u', 't' > {};
+  struct str_partition : string< 'p', 'a', 'r', 't', 'i', 't', 'i', 'o', 'n' > {};
+  struct str_region  : string< 'r', 'e', 'g', 'i', 'o', 'n' > {};
   struct str_return  : string< 'r', 'e', 't', 'u', 'r', 'n' > {};
   struct str_task    : string< 't', 'a', 's', 'k' > {};
   struct str_then    : string< 't', 'h', 'e', 'n' > {};
   struct str_true    : string< 't', 'r', 'u', 'e' > {};
 
   struct str_keyword : sor< str_do, str_else, str_elseif, str_end, str_extern,
-                            str_false, str_for, str_func, str_if, str_in,
-                            str_return, str_task, str_then, str_true > {};
+                            str_false, str_for, str_func, str_if, str_inout,
+                            str_in, str_map, str_memoize, str_out,
+                            str_partition,
+                            str_region, str_return, str_task, str_then,
+                            str_true > {};
 
   template< typename Key >
   struct key : seq< Key, not_at< identifier_other > > {};
@@ -71,6 +80,12 @@ namespace parse {
   struct key_func    : key< str_func >   {};
   struct key_if      : key< str_if >     {};
   struct key_in      : key< str_in >     {};
+  struct key_inout   : key< str_inout >  {};
+  struct key_map     : key< str_map >    {};
+  struct key_memoize : key< str_memoize > {};
+  struct key_out     : key< str_out >    {};
+  struct key_partition : key< str_partition > {};
+  struct key_region  : key< str_region > {};
   struct key_return  : key< str_return > {};
   struct key_task    : key< str_task >   {};
   struct key_then    : key< str_then >   {};
@@ -91,6 +106,7 @@ namespace parse {
 
   struct name : seq< not_at< keyword >, identifier > {};
   struct call_name : disable< name > {};
+  struct index_name : disable< name > {};
 
   ////////////////////////////////////////////////////////////////
   // Operators
@@ -124,8 +140,25 @@ namespace parse {
                             key_else, pad< expr, space >,
                             key_end > {};
 
+  // for i in start, end do body end
+  // map i in start, end do body end
+  struct range : seq< pad< name, space >, key_in,
+                      pad< expr, space >, one< ',' >,
+                      pad< expr, space >, key_do,
+                      pad< expr, space >, key_end > {};
+
+  struct for_expr : seq< key_for, range > {};
+
+  struct map_expr : seq< key_map, range > {};
+
+  // name[index], or name[index] <- value to write the element
+  struct index_expr : seq< at< pad< name, space >, one< '[' > >,
+                           pad< index_name, space >, one< '[' >,
+                           pad< expr, space >, one< ']' >,
+                           opt< pad< string< '<', '-' >, space >, expr > > {};
+
   struct expr_0 : pad<
-    sor< ifthen_expr, call, num, name,
+    sor< ifthen_expr, for_expr, map_expr, call, index_expr, num, name,
          seq< one< '(' >,  pad< expr, space >, one< ')' > > >,
     space > {};
 
@@ -134,27 +167,51 @@ namespace parse {
   ////////////////////////////////////////////////////////////////
   // Functions and Blocks
   ////////////////////////////////////////////////////////////////
+  // A block of a partition, `in a : p`, only tasks take them.
+  struct block_mode : sor< key_inout, key_in, key_out > {};
+
+  struct block_param : seq< block_mode,
+                            must< pad< name, space >, one< ':' >,
+                                  pad< name, space > > > {};
+
+  struct param : sor< block_param, name > {};
+
   struct prototype
     : seq< pad< name, space >,
            one< '(' >,
-           pad_opt< list< name, one< ',' >, space >, space >,
+           pad_opt< list< param, one< ',' >, space >, space >,
            one< ')' > > {};
 
   struct func : seq< key_func, pad< prototype, space >,
                      one< '=' >, expr, one<';'> > {};
 
-  struct task : seq< key_task, pad< prototype, space >,
+  // `memoize task f(x) = ...` shares the result of a call among the
+  // calls made with the same arguments.
+  struct task : seq< opt< key_memoize, plus< space > >,
+                     key_task, pad< prototype, space >,
                      one< '=' >, expr, one<';'> > {};
   ////////////////////////////////////////////////////////////////
   // Statements
   ////////////////////////////////////////////////////////////////
   struct extern_stat : seq< key_extern, pad< prototype, space>, one< ';' > > {};
 
+  // region r[n];
+  struct region_decl : seq< key_region, pad< name, space >,
+                            one< '[' >, pad< num, space >, one< ']' >,
+                            one< ';' > > {};
+
+  // partition p = r / k;
+  struct partition_decl : seq< key_partition, pad< name, space >,
+                               one< '=' >, pad< name, space >,
+                               one< '/' >, pad< num, space >,
+                               one< ';' > > {};
+
   ////////////////////////////////////////////////////////////////
   // Root Grammar Node
   ////////////////////////////////////////////////////////////////
   struct grammar
-    : must< star< pad < sor< func, task, extern_stat >, space > > , eof > {};
+    : must< star< pad < sor< func, task, extern_stat, region_decl,
+                             partition_decl >, space > > , eof > {};
 
   ////////////////////////////////////////////////////////////////
   // Parsing Actions
@@ -165,10 +222,13 @@ namespace parse {
    * to work, it is vital the grammar has no backtracking.
    *
    * `funcs` and `externs` are lists of all completed functions/tasks and
-   * externed functions. When parsing is complete, these lists will be
-   * used for further processing.
+   * externed functions, `regions` and `partitions` those of the data
+   * declarations. When parsing is complete, these lists will be used for
+   * further processing.
    *
-   * protoCur contains the prototype for the current function or extern.
+   * protoCur contains the prototype for the current function or extern,
+   * modeCur the mode of the block parameter being parsed, and memoCur
+   * whether the task being parsed is memoized.
    *
    * exprStack is the main workspace for parsing. It acts as a stack of "contexts".
    * Any expression construct that can be nested will push a new context onto
@@ -185,8 +245,12 @@ namespace parse {
   struct parse_state {
     std::vector< Func* > funcs;
     std::vector< Proto* > externs;
+    std::vector< RegionDecl* > regions;
+    std::vector< PartitionDecl* > partitions;
 
     Proto* protoCur;
+    BlockMode modeCur;
+    bool memoCur = false;
 
     std::stack< std::deque<Expr*>* > exprStack;
   };
@@ -377,7 +441,9 @@ namespace parse {
       delete state.exprStack.top();
       state.exprStack.pop();
 
-      state.funcs.push_back(new Func(true, state.protoCur, body));
+      state.funcs.push_back(new Func(true, state.protoCur, body,
+                                     state.memoCur));
+      state.memoCur = false;
     }
   };
 
@@ -400,6 +466,144 @@ namespace parse {
     }
   };
 
+  /**
+   * Rule: for_expr (Removes Context)
+   * Assumes the context list is the iterator name, start, end and body.
+   * Constructs new ForExpr, removes context, and puts ForExpr into next
+   * context list.
+   */
+  template <> struct build_ast < for_expr > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      auto ctx = state.exprStack.top();
+      NameExpr* iter = static_cast<NameExpr*>((*ctx)[0]);
+
+      state.exprStack.pop();
+      state.exprStack.top()->push_back(
+        new ForExpr(iter, (*ctx)[1], (*ctx)[2], (*ctx)[3]));
+      delete ctx;
+    }
+  };
+
+  /**
+   * Rule: map_expr (Removes Context)
+   * As for_expr, but constructs a MapExpr.
+   */
+  template <> struct build_ast < map_expr > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      auto ctx = state.exprStack.top();
+      NameExpr* iter = static_cast<NameExpr*>((*ctx)[0]);
+
+      state.exprStack.pop();
+      state.exprStack.top()->push_back(
+        new MapExpr(iter, (*ctx)[1], (*ctx)[2], (*ctx)[3]));
+      delete ctx;
+    }
+  };
+
+  /**
+   * Rule: index_name (Makes Context)
+   * Make a new Context, and push a NameExpr onto that context.
+   */
+  template <> struct build_ast < index_name > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      state.exprStack.push(new std::deque<Expr*>);
+      state.exprStack.top()->push_back(new NameExpr(in.string()));
+    }
+  };
+
+  /**
+   * Rule: index_expr (Removes Context)
+   * Assumes the context list is the name, the index and, for a write, the
+   * value. Constructs new IndexExpr, removes context, and puts IndexExpr
+   * into next context list.
+   */
+  template <> struct build_ast < index_expr > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      auto ctx = state.exprStack.top();
+      NameExpr* base = static_cast<NameExpr*>((*ctx)[0]);
+      Expr* value = ctx->size() > 2 ? (*ctx)[2] : nullptr;
+
+      state.exprStack.pop();
+      state.exprStack.top()->push_back(new IndexExpr(base, (*ctx)[1], value));
+      delete ctx;
+    }
+  };
+
+  /**
+   * Rule: block_mode
+   * Remember the mode for block_param.
+   */
+  template <> struct build_ast < block_mode > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      std::string inS = in.string();
+      if(inS == "in") {
+        state.modeCur = kIn;
+      } else if(inS == "out") {
+        state.modeCur = kOut;
+      } else {
+        state.modeCur = kInOut;
+      }
+    }
+  };
+
+  /**
+   * Rule: block_param
+   * The last two NameExprs of the context are the parameter and its
+   * partition, replace them by a BlockParam.
+   */
+  template <> struct build_ast < block_param > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      auto ctx = state.exprStack.top();
+      NameExpr* partition = static_cast<NameExpr*>(ctx->back());
+      ctx->pop_back();
+      NameExpr* name = static_cast<NameExpr*>(ctx->back());
+      ctx->pop_back();
+
+      ctx->push_back(
+        new BlockParam(name->name, state.modeCur, partition->name));
+      delete name;
+      delete partition;
+    }
+  };
+
+  /**
+   * Rule: region_decl (Removes Context)
+   * Assumes the context list is the name and the size. Removes context and
+   * puts a new RegionDecl into `regions`.
+   */
+  template <> struct build_ast < region_decl > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      auto ctx = state.exprStack.top();
+      NameExpr* name = static_cast<NameExpr*>((*ctx)[0]);
+      NumExpr* size = static_cast<NumExpr*>((*ctx)[1]);
+
+      state.regions.push_back(new RegionDecl(name, uint64_t(size->val)));
+      delete size;
+      delete ctx;
+      state.exprStack.pop();
+    }
+  };
+
+  /**
+   * Rule: partition_decl (Removes Context)
+   * Assumes the context list is the name, the region and the number of
+   * blocks. Removes context and puts a new PartitionDecl into `partitions`.
+   */
+  template <> struct build_ast < partition_decl > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      auto ctx = state.exprStack.top();
+      NameExpr* name = static_cast<NameExpr*>((*ctx)[0]);
+      NameExpr* region = static_cast<NameExpr*>((*ctx)[1]);
+      NumExpr* parts = static_cast<NumExpr*>((*ctx)[2]);
+
+      state.partitions.push_back(
+        new PartitionDecl(name, region, uint64_t(parts->val)));
+      delete parts;
+      delete ctx;
+      state.exprStack.pop();
+    }
+  };
+
   /**
    * Rule: expr
    * Two cases: Either the last expression was atomic, or a binop. We look at
@@ -471,6 +675,16 @@ namespace parse {
     }
   };
 
+  /**
+   * Rule: key_memoize
+   * Marks the task that follows as memoized.
+   */
+  template <> struct build_ast < key_memoize > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      state.memoCur = true;
+    }
+  };
+
   /**
    * Rule: key_extern (Makes Context)
    * Puts a context on the stack, for prototype.
@@ -494,4 +708,47 @@ namespace parse {
     }
   };
 
+  /**
+   * Rule: key_for (Makes Context)
+   * Puts a context on the stack, which will eventually contain the iterator
+   * name and three expressions. This context will be consumed by for_expr.
+   */
+  template <> struct build_ast < key_for > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      state.exprStack.push(new std::deque<Expr*>());
+    }
+  };
+
+  /**
+   * Rule: key_map (Makes Context)
+   * As key_for, the context will be consumed by map_expr.
+   */
+  template <> struct build_ast < key_map > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      state.exprStack.push(new std::deque<Expr*>());
+    }
+  };
+
+  /**
+   * Rule: key_region (Makes Context)
+   * Puts a context on the stack for the name and size of the region, which
+   * will be consumed by region_decl.
+   */
+  template <> struct build_ast < key_region > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      state.exprStack.push(new std::deque<Expr*>());
+    }
+  };
+
+  /**
+   * Rule: key_partition (Makes Context)
+   * Puts a context on the stack for the names and size of the partition,
+   * which will be consumed by partition_decl.
+   */
+  template <> struct build_ast < key_partition > {
+    static void apply( const pegtl::input & in, parse_state &state) {
+      state.exprStack.push(new std::deque<Expr*>());
+    }
+  };
+
 } // namespace parse
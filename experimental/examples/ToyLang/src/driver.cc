@@ -3,15 +3,20 @@
  * Date: Fri Jun 12 17:15:43 MDT 2015
  * File: driver.cc
  *
- * This is the main file for our toy language compiler. Currently it invokes
- * the parser on the first argument given to it, and returns whether or not
- * the argument was a valid sentence.
+ * This is the main file for our toy language compiler. It invokes the parser
+ * on the first argument given to it, prints the AST, then codegens it and
+ * runs the HLIR pass, which lowers the parallel constructs and tasks to
+ * calls of the ARES runtime, and prints the resulting module.
  *
  */
 #include <iostream>
 #include <stack>
 #include <string>
 
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/ARES/HLIRPass.h>
+
 #include <pegtl.hh>
 #include <pegtl/analyze.hh>
 
@@ -29,12 +34,60 @@ int main( int argc, char * argv[] )
     std::cout << "INSPECTING AST..." << std::endl << std::endl;
     for(auto func : state.funcs) {
       func->print("ROOT", 0);
-      delete func;
     }
     for(auto ext : state.externs) {
       ext->print("ROOT", 0);
+    }
+    for(auto region : state.regions) {
+      region->print("ROOT", 0);
+    }
+    for(auto partition : state.partitions) {
+      partition->print("ROOT", 0);
+    }
+
+    Codegen::module = new Module("toy", getGlobalContext());
+    Codegen::hlir = ares::HLIRModule::getModule(Codegen::module);
+    Codegen::hlir->setName("toy");
+    Codegen::hlir->setLanguage("ToyLang");
+    Codegen::hlir->setVersion("1.0");
+
+    // Data declarations first, which tasks and function bodies refer to,
+    // then externs, so that the calls in function bodies can find them.
+    for(auto region : state.regions) {
+      region->codegen();
+    }
+    for(auto partition : state.partitions) {
+      partition->codegen();
+    }
+    Codegen::regionInit();
+
+    for(auto ext : state.externs) {
+      ext->codegen();
+    }
+    for(auto func : state.funcs) {
+      func->codegen();
+    }
+
+    legacy::PassManager passes;
+    passes.add(createHLIRPass());
+    passes.run(*Codegen::module);
+
+    std::cout << std::endl << "GENERATED MODULE..." << std::endl << std::endl;
+    Codegen::module->print(outs(), nullptr);
+
+    for(auto func : state.funcs) {
+      delete func;
+    }
+    for(auto ext : state.externs) {
       delete ext;
     }
+    for(auto region : state.regions) {
+      delete region;
+    }
+    for(auto partition : state.partitions) {
+      delete partition;
+    }
+    delete Codegen::module;
   } else {
     std::cout << "ISSUES FOUND: " << issues_found << std::endl;
   }
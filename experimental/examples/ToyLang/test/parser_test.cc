@@ -279,6 +279,7 @@ TEST_F(ParseTest, Task_Good) {
   char* task1 = "task id(x) = x;";
   char* task2 = "task wif(c,    t , f ) = if c then t else f end;";
   char* task3 = "task noArg() = 10 + if c then t else f end;";
+  char* task4 = "memoize task sq(x) = x * x;";
 
   EXPECT_GOOD_S
     (parse< must< parse::task, eof > >(0, &task1));
@@ -291,6 +292,10 @@ TEST_F(ParseTest, Task_Good) {
   EXPECT_GOOD_S
     (parse< must< parse::task, eof > >(0, &task3));
   EXPECT_GOOD_E_(task3);
+
+  EXPECT_GOOD_S
+    (parse< must< parse::task, eof > >(0, &task4));
+  EXPECT_GOOD_E_(task4);
 }
 
 TEST_F(ParseTest, Task_Bad) {
@@ -311,12 +316,95 @@ TEST_F(ParseTest, Task_Bad) {
   EXPECT_BAD_E_(task3);
 }
 
+TEST_F(ParseTest, Range_Good) {
+  char* range1 = "for i in 0, 10 do f(i) end";
+  char* range2 = "map i in 0,n do i*i end";
+  char* range3 = "map i in 0, n do map j in 0, i do j end end";
+
+  EXPECT_GOOD_S
+    (parse< must< parse::expr, eof > >(0, &range1));
+  EXPECT_GOOD_E_(range1);
+
+  EXPECT_GOOD_S
+    (parse< must< parse::expr, eof > >(0, &range2));
+  EXPECT_GOOD_E_(range2);
+
+  EXPECT_GOOD_S
+    (parse< must< parse::expr, eof > >(0, &range3));
+  EXPECT_GOOD_E_(range3);
+}
+
+TEST_F(ParseTest, Range_Bad) {
+  char* range1 = "for i in 0 do f(i) end";
+  char* range2 = "map 10 in 0, n do i end";
+  char* range3 = "for i in 0, n do i";
+
+  EXPECT_BAD_S
+    (parse< must< parse::expr, eof > >(0, &range1));
+  EXPECT_BAD_E_(range1);
+
+  EXPECT_BAD_S
+    (parse< must< parse::expr, eof > >(0, &range2));
+  EXPECT_BAD_E_(range2);
+
+  EXPECT_BAD_S
+    (parse< must< parse::expr, eof > >(0, &range3));
+  EXPECT_BAD_E_(range3);
+}
+
+TEST_F(ParseTest, Region_Good) {
+  char* decl1 = "region r[100];";
+  char* decl2 = "partition p = r / 4;";
+  char* task1 = "task f(in a : p, out b : q, x) = b[x] <- a[x] + 1;";
+  char* task2 = "task g(inout a : p) = map i in 0, 25 do a[i] <- a[i]*2 end;";
+
+  EXPECT_GOOD_S
+    (parse< must< parse::region_decl, eof > >(0, &decl1));
+  EXPECT_GOOD_E_(decl1);
+
+  EXPECT_GOOD_S
+    (parse< must< parse::partition_decl, eof > >(0, &decl2));
+  EXPECT_GOOD_E_(decl2);
+
+  EXPECT_GOOD_S
+    (parse< must< parse::task, eof > >(0, &task1));
+  EXPECT_GOOD_E_(task1);
+
+  EXPECT_GOOD_S
+    (parse< must< parse::task, eof > >(0, &task2));
+  EXPECT_GOOD_E_(task2);
+}
+
+TEST_F(ParseTest, Region_Bad) {
+  char* decl1 = "region r[n];";
+  char* decl2 = "partition p = r;";
+  char* task1 = "task f(in a) = a[0];";
+  char* task2 = "task f(inout : p) = 0;";
+
+  EXPECT_BAD_S
+    (parse< must< parse::region_decl, eof > >(0, &decl1));
+  EXPECT_BAD_E_(decl1);
+
+  EXPECT_BAD_S
+    (parse< must< parse::partition_decl, eof > >(0, &decl2));
+  EXPECT_BAD_E_(decl2);
+
+  EXPECT_BAD_S
+    (parse< must< parse::task, eof > >(0, &task1));
+  EXPECT_BAD_E_(task1);
+
+  EXPECT_BAD_S
+    (parse< must< parse::task, eof > >(0, &task2));
+  EXPECT_BAD_E_(task2);
+}
+
 TEST_F(ParseTest, Grammer_Good) {
   char* prog =
     "extern print(x);"
     "task fact(x) = if x < 1 then 1 else fact(x-1)*x end;"
     "func id(x) = x;"
-    "func main() = print(fact(10));";
+    "func sumSq(n) = map i in 0, n do i*i end;"
+    "func main() = print(fact(10)) + for i in 0, 10 do print(i) end;";
   EXPECT_NO_THROW
     (parse< parse::grammar >(0, &prog));
 }
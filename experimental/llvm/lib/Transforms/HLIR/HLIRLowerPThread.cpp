@@ -15,10 +15,12 @@
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 
 #include "llvm/Transforms/HLIR/HLIRLower.h"
 
@@ -26,6 +28,13 @@ using namespace llvm;
 
 namespace {
 
+/// With -hlir-pool, launch calls are queued as tasks of the ARES runtime's
+/// thread pool rather than each given a thread of its own. Link against
+/// libares_runtime.
+cl::opt<bool> UsePool("hlir-pool",
+                      cl::desc("Lower HLIR launch calls to ARES runtime tasks"),
+                      cl::init(false));
+
 class HLIRLowerPThread : public HLIRLower {
 private:
   static const unsigned int RET_OFFSET = 0;
@@ -33,6 +42,11 @@ private:
   static const unsigned int SEM_OFFSET = 2;
   static const unsigned int ARG_OFFSET = 3;
 
+  /// In pool mode the wrapper struct is the runtime's task frame, which
+  /// starts with its future and spawn depth, so the return moves behind
+  /// them. The arguments stay at ARG_OFFSET.
+  static const unsigned int POOL_RET_OFFSET = 2;
+
   /// Common Functions
   Function *pthread_create;
   Function *pthread_exit;
@@ -43,6 +57,13 @@ private:
   Function *sem_post;
   Function *sem_destroy;
 
+  /// Runtime Functions, for -hlir-pool
+  Function *task_alloc;
+  Function *task_queue;
+  Function *task_await_future;
+  Function *task_release_future;
+  Function *task_free;
+
   /// Common Type
   PointerType *PthreadAttrPtrTy;
   Type *PThreadTy;
@@ -166,31 +187,91 @@ private:
     return true;
   }
 
+  /// Make declarations of the ARES runtime's task entry points.
+  bool initPool(Module *M) {
+    LLVMContext &C = M->getContext();
+    Type *VoidTy = Type::getVoidTy(C);
+    Type *VoidPtrTy = Type::getInt8PtrTy(C);
+    Type *Int32Ty = Type::getInt32Ty(C);
+
+    /*
+      void* __ares_task_alloc(uint64_t bytes);
+    */
+    Type *AllocArgsTy[1] = {Type::getInt64Ty(C)};
+    this->task_alloc = cast<Function>(M->getOrInsertFunction(
+        "__ares_task_alloc", FunctionType::get(VoidPtrTy, AllocArgsTy, false)));
+
+    /*
+      void __ares_task_queue(void* func, void* args, uint32_t priority,
+                             void* region);
+    */
+    Type *QueueArgsTy[4] = {VoidPtrTy, VoidPtrTy, Int32Ty, VoidPtrTy};
+    this->task_queue = cast<Function>(M->getOrInsertFunction(
+        "__ares_task_queue", FunctionType::get(VoidTy, QueueArgsTy, false)));
+
+    /*
+      void __ares_task_await_future(void* args);
+      void __ares_task_release_future(void* args);
+      void __ares_task_free(void* args);
+    */
+    Type *ArgsTy[1] = {VoidPtrTy};
+    FunctionType *FTy = FunctionType::get(VoidTy, ArgsTy, false);
+    this->task_await_future = cast<Function>(
+        M->getOrInsertFunction("__ares_task_await_future", FTy));
+    this->task_release_future = cast<Function>(
+        M->getOrInsertFunction("__ares_task_release_future", FTy));
+    this->task_free =
+        cast<Function>(M->getOrInsertFunction("__ares_task_free", FTy));
+
+    return true;
+  }
+
+  /// The index of the return in the wrapper struct.
+  unsigned int RetOffset() const {
+    return UsePool ? POOL_RET_OFFSET : RET_OFFSET;
+  }
+
   /// Get or create a wrapper struct for a given function. Saves structs in the
   /// `FuncToStruct` map.
   ///
   /// Struct will have the following shape:
   ///     struct {
   ///       <return type | int>;
+  ///       Thread;
   ///       Semaphore;
   ///       arg1;
   ///       arg2;
   ///       ...
   ///     }
+  ///
+  /// or with -hlir-pool:
+  ///     struct {
+  ///       Future;
+  ///       Depth;
+  ///       <return type | int>;
+  ///       arg1;
+  ///       ...
+  ///     }
   StructType *GetFuncStruct(Function *F) {
     StructType *WrapTy = NULL;
 
     if (this->FuncToStruct.find(F) == this->FuncToStruct.end()) {
       std::vector<Type *> Members;
 
-      if (StructType::isValidElementType(F->getReturnType())) {
-        Members.push_back(F->getReturnType());
-      } else {
-        Members.push_back(Type::getInt32Ty(F->getContext()));
+      Type *RetTy = F->getReturnType();
+      if (!StructType::isValidElementType(RetTy)) {
+        RetTy = Type::getInt32Ty(F->getContext());
       }
 
-      Members.push_back(this->PThreadTy);
-      Members.push_back(this->SemTy);
+      if (UsePool) {
+        Members.push_back(Type::getInt8PtrTy(F->getContext()));
+        Members.push_back(Type::getInt32Ty(F->getContext()));
+        Members.push_back(RetTy);
+      } else {
+        Members.push_back(RetTy);
+        Members.push_back(this->PThreadTy);
+        Members.push_back(this->SemTy);
+      }
 
       for (auto param : F->getFunctionType()->params()) {
         Members.push_back(param);
@@ -211,8 +292,10 @@ private:
   /// Used almost exclusively by `GetWrapperFunction`.
   Function *DeclareWrapFunc(Function *F, Module *M) {
     Type *Arg[1] = {Type::getInt8PtrTy(F->getContext())};
+    Type *RetTy = UsePool ? Type::getVoidTy(F->getContext())
+                          : Type::getInt8PtrTy(F->getContext());
     Function *WF = Function::Create(
-        FunctionType::get(Type::getInt8PtrTy(F->getContext()), Arg, false),
+        FunctionType::get(RetTy, Arg, false),
         Function::ExternalLinkage, "hlir.pthread.wrapped." + F->getName(), M);
     BasicBlock::Create(M->getContext(), "entry", WF, 0);
 
@@ -282,7 +365,7 @@ private:
     if (StructType::isValidElementType(F->getReturnType())) {
       Value *GEPIndex[2] = {
           ConstantInt::get(Type::getInt64Ty(F->getContext()), 0),
-          ConstantInt::get(Type::getInt32Ty(F->getContext()), RET_OFFSET)};
+          ConstantInt::get(Type::getInt32Ty(F->getContext()), RetOffset())};
       B.CreateStore(RetVal, B.CreateGEP(RetPtr, GEPIndex));
     }
   }
@@ -306,10 +389,19 @@ private:
       // clang-format on
 
       IRBuilder<> B(&WF->getEntryBlock());
-      UnlockCopyMutex(B, PackedArgs);
-      WrapFuncCall(B, F, ArrayRef<Value *>(UnpackedArgs), PackedArgs);
-      B.CreateRet(
-          ConstantPointerNull::get(Type::getInt8PtrTy(M->getContext())));
+
+      // the runtime's frame already holds a copy of the arguments
+      if (UsePool) {
+        WrapFuncCall(B, F, ArrayRef<Value *>(UnpackedArgs), PackedArgs);
+        Value *ReleaseArgs[1] = {&*WF->arg_begin()};
+        B.CreateCall(this->task_release_future, ReleaseArgs);
+        B.CreateRetVoid();
+      } else {
+        UnlockCopyMutex(B, PackedArgs);
+        WrapFuncCall(B, F, ArrayRef<Value *>(UnpackedArgs), PackedArgs);
+        B.CreateRet(
+            ConstantPointerNull::get(Type::getInt8PtrTy(M->getContext())));
+      }
 
       this->FuncToWrapFunc.emplace(F, WF);
     } else {
@@ -385,6 +477,76 @@ private:
     }
   }
 
+  /// As ForceFutures, for a call queued on the pool: the first use awaits
+  /// the task and takes its return out of the frame, which the caller
+  /// then drops. Without uses, it is dropped right after the launch.
+  void ForcePoolFutures(CallInst *I, Value *ArgPtr, IRBuilder<> &B) {
+    Value *VoidArgPtr =
+        B.CreateBitCast(ArgPtr, Type::getInt8PtrTy(I->getContext()));
+
+    for (User *U : I->users()) {
+      if (Instruction *Inst = dyn_cast<Instruction>(U)) {
+        IRBuilder<> ForceRet(Inst);
+        ForceRet.CreateCall(this->task_await_future, VoidArgPtr);
+
+        Value *GEPIndex[2] = {
+            ConstantInt::get(Type::getInt64Ty(I->getContext()), 0),
+            ConstantInt::get(Type::getInt32Ty(I->getContext()),
+                             POOL_RET_OFFSET)};
+
+        Value *RetVal =
+            ForceRet.CreateLoad(ForceRet.CreateGEP(ArgPtr, GEPIndex));
+        ForceRet.CreateCall(this->task_free, VoidArgPtr);
+
+        I->replaceAllUsesWith(RetVal);
+        return;
+      }
+    }
+
+    B.CreateCall(this->task_free, VoidArgPtr);
+  }
+
+  /// Given a function call to lower, will build/lookup a wrapper function,
+  /// copy the arguments into a frame from the runtime, and queue it as a
+  /// task.
+  bool LowerPoolLaunchCall(Module *M, CallInst *I) {
+    if (!this->task_alloc) {
+      initPool(M);
+    }
+
+    Function *F = I->getCalledFunction();
+    StructType *Ty = GetFuncStruct(F);
+    Function *WF = GetWrapperFunction(M, F, Ty);
+
+    IRBuilder<> B(I);
+    uint64_t Size = M->getDataLayout().getTypeAllocSize(Ty);
+    Value *AllocArgs[1] = {
+        ConstantInt::get(Type::getInt64Ty(I->getContext()), Size)};
+    Value *VoidArgPtr = B.CreateCall(this->task_alloc, AllocArgs);
+    Value *ArgPtr = B.CreateBitCast(VoidArgPtr, PointerType::get(Ty, 0));
+
+    int ArgId = 0;
+    for (auto &Arg : I->arg_operands()) {
+      Value *GEPIndex[2] = {
+          ConstantInt::get(Type::getInt64Ty(I->getContext()), 0),
+          ConstantInt::get(Type::getInt32Ty(I->getContext()),
+                           ArgId + ARG_OFFSET)};
+      B.CreateStore(Arg, B.CreateGEP(ArgPtr, GEPIndex));
+      ArgId++;
+    }
+
+    Value *QueueArgs[4] = {
+        B.CreateBitCast(WF, Type::getInt8PtrTy(I->getContext())), VoidArgPtr,
+        ConstantInt::get(Type::getInt32Ty(I->getContext()), 1),
+        ConstantPointerNull::get(Type::getInt8PtrTy(I->getContext()))};
+    B.CreateCall(this->task_queue, QueueArgs);
+
+    ForcePoolFutures(I, ArgPtr, B);
+
+    I->eraseFromParent();
+    return true;
+  }
+
   /// Initializes a mutex, representing whether or not the task has finished
   /// copying its arguments.
   void InitCopyMutex(IRBuilder<> B, Value *TaskPtr) {
@@ -414,6 +576,10 @@ private:
   /// launch a pthread instead. Then this function will find all uses of the old
   /// return value, and replace them with futures.
   bool LowerLaunchCall(Module *M, CallInst *I) {
+    if (UsePool) {
+      return LowerPoolLaunchCall(M, I);
+    }
+
     if (!this->pthread_create) {
       initPthreadCreate(M);
     }
@@ -439,7 +605,7 @@ public:
   static char ID;
   HLIRLowerPThread()
       : HLIRLower(ID), pthread_create(nullptr), pthread_exit(nullptr),
-        pthread_join(nullptr){};
+        pthread_join(nullptr), task_alloc(nullptr){};
 
 }; // class HLIRLower
 } // namespace
@@ -57,9 +57,39 @@
 
 namespace llvm{
 
+class FunctionPass;
+class Loop;
 class ModulePass;
 
-ModulePass* createHLIRPass();
+// whether l is the loop of a lowered Forall body, whose memory accesses
+// the lowering marks as parallel for the loop's ID
+bool isForallLoop(Loop* l);
+
+// with deferTasks, tasks are left as calls and recorded in metadata for
+// the compilation of the bitcode to lower
+ModulePass* createHLIRPass(bool deferTasks=false);
+
+// prefetches the gathers of the loops of lowered Forall and reduce
+// bodies -ares-prefetch-distance iterations ahead
+FunctionPass* createHLIRPrefetchPass();
+
+// lowers ares::atomic_add() to atomic adds, or to plain or once per chunk
+// adds in the loops of lowered Forall and reduce bodies
+FunctionPass* createHLIRAtomicPass();
+
+// hoists the loads and computations that do not depend on the index out
+// of the loops of lowered Forall bodies, relying on their iterations
+// being independent
+FunctionPass* createHLIRHoistPass();
+
+// interchanges the loops of lowered Forall bodies with the serial loop
+// in them if that makes their accesses stride-1, -ares-interchange
+FunctionPass* createHLIRInterchangePass();
+
+// versions the loops of lowered Forall bodies on whether a chunk is in
+// the interior of the iteration space, where its tests of the index
+// against a boundary are folded, -ares-split-interior
+FunctionPass* createHLIRInteriorPass();
 
 } // namespace llvm
 
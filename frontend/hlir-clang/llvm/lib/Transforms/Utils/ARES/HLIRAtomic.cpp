@@ -0,0 +1,431 @@
+/*
+ * ###########################################################################
+ * Copyright (c) 2015, Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ *  Copyright 2015. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#include "llvm/Transforms/ARES/HLIRPass.h"
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace std;
+using namespace llvm;
+
+namespace{
+
+const char* ATOMIC_ADD_PREFIX = "__ares_atomic_add_";
+
+// the ares::atomic_add() that ci calls, which is declared with an asm
+// label that clang marks with a leading \1
+bool isAtomicAdd(const CallInst* ci){
+  Function* callee = ci->getCalledFunction();
+  if(!callee || ci->getNumArgOperands() != 2){
+    return false;
+  }
+
+  StringRef name = callee->getName();
+  if(name.startswith("\1")){
+    name = name.substr(1);
+  }
+
+  return name.startswith(ATOMIC_ADD_PREFIX);
+}
+
+// the SCEVUnknowns of an expression
+struct UnknownCollector{
+  set<Value*> values;
+
+  bool follow(const SCEV* s){
+    if(auto u = dyn_cast<SCEVUnknown>(s)){
+      values.insert(u->getValue());
+    }
+    return true;
+  }
+
+  bool isDone() const{
+    return false;
+  }
+};
+
+// lowers the calls of ares::atomic_add() to atomicrmw add for integers
+// and a compare and swap loop for floating point, both monotonic, since
+// a sum needs no ordering. In the loop of an outlined Forall or reduce
+// body, an add to an address that no two iterations of the range share
+// is made a plain one, and the adds to an address that is the same in
+// every iteration are accumulated in a register and added once after
+// the loop, so each chunk makes one atomic add.
+class HLIRAtomicPass : public FunctionPass{
+public:
+  static char ID;
+
+  HLIRAtomicPass()
+    : FunctionPass(ID){}
+
+  void getAnalysisUsage(AnalysisUsage& AU) const override{
+    AU.addRequired<AAResultsWrapperPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+  }
+
+  const char *getPassName() const override{
+    return "HLIRAtomicPass";
+  }
+
+  bool runOnFunction(Function& F) override{
+    vector<CallInst*> calls;
+
+    for(BasicBlock& bb : F){
+      for(Instruction& ii : bb){
+        auto ci = dyn_cast<CallInst>(&ii);
+        if(ci && isAtomicAdd(ci)){
+          calls.push_back(ci);
+        }
+      }
+    }
+
+    if(calls.empty()){
+      return false;
+    }
+
+    dl_ = &F.getParent()->getDataLayout();
+
+    bool body = F.getName().startswith("hlir.parallel_for.body") ||
+      F.getName().startswith("hlir.parallel_reduce.body");
+
+    vector<CallInst*> atomics;
+
+    if(body){
+      aa_ = &getAnalysis<AAResultsWrapperPass>().getAAResults();
+      dt_ = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+      se_ = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+      LoopInfo& li = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+
+      partials_.clear();
+      vector<AllocaInst*> allocas;
+
+      for(CallInst* ci : calls){
+        Loop* l = li.getLoopFor(ci->getParent());
+
+        if(l && l->empty()){
+          if(distinct_(l, ci)){
+            plainAdd_(ci);
+            continue;
+          }
+
+          if(privatize_(l, ci, allocas, atomics)){
+            continue;
+          }
+        }
+
+        atomics.push_back(ci);
+      }
+
+      // the partials become registers, and reductions the vectorizer
+      // can see
+      if(!allocas.empty()){
+        PromoteMemToReg(allocas, *dt_);
+      }
+    }
+    else{
+      atomics = calls;
+    }
+
+    // the compare and swap loops split blocks, so they come last
+    for(CallInst* ci : atomics){
+      lowerAtomic_(ci);
+    }
+
+    return true;
+  }
+
+private:
+  AAResults* aa_;
+  DominatorTree* dt_;
+  ScalarEvolution* se_;
+  const DataLayout* dl_;
+
+  // the partial of each loop and address
+  map<pair<Loop*, Value*>, AllocaInst*> partials_;
+
+  static Value* pointer_(CallInst* ci){
+    return ci->getArgOperand(0);
+  }
+
+  static Value* value_(CallInst* ci){
+    return ci->getArgOperand(1);
+  }
+
+  static Value* add_(IRBuilder<>& b, Value* x, Value* y){
+    return x->getType()->isFloatingPointTy() ?
+      b.CreateFAdd(x, y) : b.CreateAdd(x, y);
+  }
+
+  // whether the address of ci is start + step * i in the iteration i of
+  // the range, the index of the loop starting at the begin of the chunk
+  // that the runtime passes in the body's RangeArg, step being at least
+  // the size of the value. Then it differs in every iteration of every
+  // chunk, which are disjoint.
+  bool distinct_(Loop* l, CallInst* ci){
+    auto addr = dyn_cast<SCEVAddRecExpr>(se_->getSCEV(pointer_(ci)));
+    if(!addr || !addr->isAffine() || addr->getLoop() != l){
+      return false;
+    }
+
+    auto step = dyn_cast<SCEVConstant>(addr->getStepRecurrence(*se_));
+    uint64_t size = dl_->getTypeStoreSize(value_(ci)->getType());
+    if(!step || step->getValue()->getValue().abs().ult(size)){
+      return false;
+    }
+
+    Function* f = l->getHeader()->getParent();
+    Argument* args = &*f->arg_begin();
+
+    for(Instruction& ii : *l->getHeader()){
+      auto phi = dyn_cast<PHINode>(&ii);
+      if(!phi){
+        break;
+      }
+
+      if(!phi->getType()->isIntegerTy()){
+        continue;
+      }
+
+      auto iv = dyn_cast<SCEVAddRecExpr>(se_->getSCEV(phi));
+      if(!iv || !iv->isAffine() || iv->getLoop() != l ||
+         !iv->getStepRecurrence(*se_)->isOne()){
+        continue;
+      }
+
+      // the begin is the first member of the RangeArg
+      auto start = dyn_cast<SCEVUnknown>(iv->getStart());
+      auto begin = start ? dyn_cast<LoadInst>(start->getValue()) : nullptr;
+      if(!begin){
+        continue;
+      }
+
+      int64_t offset;
+      Value* base =
+        GetPointerBaseWithConstantOffset(begin->getPointerOperand(), offset,
+                                         *dl_);
+      if(base != args || offset != 0){
+        continue;
+      }
+
+      Type* stepTy = step->getType();
+      const SCEV* index = start;
+
+      for(int ext = 0; ext < 2; ++ext){
+        if(index->getType() != stepTy){
+          index = ext == 0 ? se_->getZeroExtendExpr(start, stepTy) :
+            se_->getSignExtendExpr(start, stepTy);
+        }
+
+        // what is left once the begin is taken out
+        const SCEV* rest =
+          se_->getMinusSCEV(addr->getStart(), se_->getMulExpr(step, index));
+
+        UnknownCollector c;
+        visitAll(rest, c);
+
+        if(!c.values.count(begin) && se_->isLoopInvariant(rest, l)){
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  void plainAdd_(CallInst* ci){
+    IRBuilder<> b(ci);
+    Value* v = value_(ci);
+
+    LoadInst* x = b.CreateLoad(pointer_(ci));
+    b.CreateStore(add_(b, x, v), pointer_(ci));
+    ci->eraseFromParent();
+  }
+
+  // accumulates the adds of ci and the others to its address in loop l
+  // in a partial, which is added to the address once, where the loop
+  // exits. Nothing else in the loop may read or write the address, adds
+  // to any other address commuting with it.
+  bool privatize_(Loop* l, CallInst* ci, vector<AllocaInst*>& allocas,
+                  vector<CallInst*>& atomics){
+    Value* ptr = pointer_(ci);
+    Value* v = value_(ci);
+
+    BasicBlock* preheader = l->getLoopPreheader();
+    BasicBlock* exit = l->getUniqueExitBlock();
+
+    if(!l->isLoopInvariant(ptr) || !preheader || !exit ||
+       !l->hasDedicatedExits()){
+      return false;
+    }
+
+    auto key = make_pair(l, ptr);
+    auto itr = partials_.find(key);
+
+    if(itr == partials_.end()){
+      MemoryLocation loc(ptr, dl_->getTypeStoreSize(v->getType()));
+
+      for(BasicBlock* bb : l->getBlocks()){
+        for(Instruction& ii : *bb){
+          auto other = dyn_cast<CallInst>(&ii);
+          if(other && isAtomicAdd(other)){
+            continue;
+          }
+
+          if(ii.mayReadOrWriteMemory() &&
+             aa_->getModRefInfo(&ii, loc) != MRI_NoModRef){
+            return false;
+          }
+        }
+      }
+
+      Function* f = preheader->getParent();
+      Type* ty = v->getType();
+
+      auto partial = new AllocaInst(ty, "hlir.atomic.partial",
+                                    &*f->getEntryBlock().getFirstInsertionPt());
+      allocas.push_back(partial);
+
+      // -0.0, which adding 0.0 to does not change
+      Constant* zero = ty->isFloatingPointTy() ?
+        ConstantFP::getNegativeZero(ty) : Constant::getNullValue(ty);
+      new StoreInst(zero, partial, preheader->getTerminator());
+
+      IRBuilder<> b(&*exit->getFirstInsertionPt());
+      Value* total = b.CreateLoad(partial, "hlir.atomic.total");
+      atomics.push_back(b.CreateCall(ci->getCalledFunction(), {ptr, total}));
+
+      itr = partials_.emplace(key, partial).first;
+    }
+
+    IRBuilder<> b(ci);
+    Value* p = b.CreateLoad(itr->second);
+    b.CreateStore(add_(b, p, v), itr->second);
+    ci->eraseFromParent();
+
+    return true;
+  }
+
+  void lowerAtomic_(CallInst* ci){
+    Value* ptr = pointer_(ci);
+    Value* v = value_(ci);
+    Type* ty = v->getType();
+
+    if(ty->isIntegerTy()){
+      IRBuilder<> b(ci);
+      b.CreateAtomicRMW(AtomicRMWInst::Add, ptr, v, Monotonic);
+      ci->eraseFromParent();
+      return;
+    }
+
+    // there is no atomicrmw fadd, so the bits of the value are swapped
+    // in as an integer of its size until no other thread changed them
+    LLVMContext& c = ci->getContext();
+    unsigned bits = dl_->getTypeSizeInBits(ty);
+    Type* intTy = IntegerType::get(c, bits);
+    unsigned as = cast<PointerType>(ptr->getType())->getAddressSpace();
+
+    BasicBlock* bb = ci->getParent();
+    BasicBlock* done = bb->splitBasicBlock(ci, "hlir.atomic.done");
+    bb->getTerminator()->eraseFromParent();
+
+    BasicBlock* loop = BasicBlock::Create(c, "hlir.atomic.loop",
+                                          bb->getParent(), done);
+
+    IRBuilder<> b(bb);
+    Value* intPtr = b.CreateBitCast(ptr, PointerType::get(intTy, as));
+    LoadInst* first = b.CreateLoad(intPtr, "hlir.atomic.first");
+    first->setAlignment(bits/8);
+    first->setAtomic(Monotonic);
+    b.CreateBr(loop);
+
+    b.SetInsertPoint(loop);
+    PHINode* old = b.CreatePHI(intTy, 2, "hlir.atomic.old");
+    old->addIncoming(first, bb);
+
+    Value* sum = b.CreateBitCast(b.CreateFAdd(b.CreateBitCast(old, ty), v),
+                                 intTy);
+    Value* pair = b.CreateAtomicCmpXchg(intPtr, old, sum, Monotonic,
+                                        Monotonic);
+    old->addIncoming(b.CreateExtractValue(pair, {0}), loop);
+    b.CreateCondBr(b.CreateExtractValue(pair, {1}), done, loop);
+
+    ci->eraseFromParent();
+  }
+};
+
+char HLIRAtomicPass::ID;
+
+} // end namespace
+
+FunctionPass* llvm::createHLIRAtomicPass(){
+  return new HLIRAtomicPass();
+}
@@ -0,0 +1,274 @@
+/*
+ * ###########################################################################
+ * Copyright (c) 2015, Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ *  Copyright 2015. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+#include "llvm/Transforms/ARES/HLIRPass.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Pass.h"
+
+#include <vector>
+
+using namespace std;
+using namespace llvm;
+
+#define DEBUG_TYPE "hlir-hoist"
+
+STATISTIC(NumHoistedLoads, "Number of loads hoisted out of Forall loops");
+STATISTIC(NumHoisted, "Number of instructions hoisted out of Forall loops");
+
+// the accesses of the functions inlined into a body after it was lowered
+// are not marked, so its loop is not annotated parallel as a whole
+bool llvm::isForallLoop(Loop* l){
+  MDNode* id = l->getLoopID();
+  if(!id){
+    return false;
+  }
+
+  for(BasicBlock* bb : l->getBlocks()){
+    for(Instruction& ii : *bb){
+      MDNode* md = ii.getMetadata(LLVMContext::MD_mem_parallel_loop_access);
+      if(!md){
+        continue;
+      }
+
+      // the ID refers to itself, so this finds it either way
+      for(unsigned i = 0; i < md->getNumOperands(); ++i){
+        if(md->getOperand(i) == id){
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+namespace{
+
+// hoists what does not depend on the index out of the loops of outlined
+// Forall bodies into the prologue of the chunk, such as the sizes and
+// base pointers read through captured references and what is computed
+// from them. Each body is called once per chunk, so the loads are only
+// hoisted by LICM if nothing in the loop may alias them, while a store
+// of the same type, say to the field being computed, is enough to stop
+// it. The iterations of a Forall are independent: a location that each
+// iteration reads cannot be written by another, so a load of a fixed
+// address that runs in every iteration is hoisted unless the same
+// iteration may write the location before it, or a call may write it.
+class HLIRHoistPass : public FunctionPass{
+public:
+  static char ID;
+
+  HLIRHoistPass()
+    : FunctionPass(ID){}
+
+  void getAnalysisUsage(AnalysisUsage& AU) const override{
+    AU.setPreservesCFG();
+    AU.addRequired<AAResultsWrapperPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+  }
+
+  const char *getPassName() const override{
+    return "HLIRHoistPass";
+  }
+
+  bool runOnFunction(Function& F) override{
+    if(!F.getName().startswith("hlir.parallel_for.body")){
+      return false;
+    }
+
+    aa_ = &getAnalysis<AAResultsWrapperPass>().getAAResults();
+    dt_ = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    li_ = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+
+    vector<Loop*> loops(li_->begin(), li_->end());
+    bool changed = false;
+
+    while(!loops.empty()){
+      Loop* l = loops.back();
+      loops.pop_back();
+
+      if(isForallLoop(l)){
+        changed |= hoistLoop_(l);
+      }
+
+      loops.insert(loops.end(), l->begin(), l->end());
+    }
+
+    return changed;
+  }
+
+private:
+  AAResults* aa_;
+  DominatorTree* dt_;
+  LoopInfo* li_;
+
+  // whether the load runs in every iteration that completes, the
+  // preheader runs only if the first one does
+  bool runsEveryIteration_(Loop* l, LoadInst* li){
+    SmallVector<BasicBlock*, 4> exiting;
+    l->getExitingBlocks(exiting);
+
+    for(BasicBlock* bb : exiting){
+      if(!dt_->dominates(li->getParent(), bb)){
+        return false;
+      }
+    }
+
+    return !exiting.empty();
+  }
+
+  bool canHoistLoad_(Loop* l, LoadInst* li){
+    if(!li->isUnordered() || !runsEveryIteration_(l, li)){
+      return false;
+    }
+
+    MemoryLocation loc = MemoryLocation::get(li);
+
+    for(BasicBlock* bb : l->getBlocks()){
+      for(Instruction& ii : *bb){
+        if(!ii.mayWriteToMemory() ||
+           !(aa_->getModRefInfo(&ii, loc) & MRI_Mod)){
+          continue;
+        }
+
+        // another iteration's store to it would be a race
+        auto si = dyn_cast<StoreInst>(&ii);
+        if(!si || !si->isUnordered() || !dt_->dominates(li, si)){
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  bool hoistLoop_(Loop* l){
+    BasicBlock* preheader = l->getLoopPreheader();
+    if(!preheader){
+      return false;
+    }
+
+    // a load hoisted above a throw might read what the throw guarded
+    for(BasicBlock* bb : l->getBlocks()){
+      for(Instruction& ii : *bb){
+        if(ii.mayThrow()){
+          return false;
+        }
+      }
+    }
+
+    Instruction* prologue = preheader->getTerminator();
+    bool changed = false;
+    bool more = true;
+
+    // until nothing more is invariant, what is hoisted making its users
+    // invariant in turn
+    while(more){
+      more = false;
+
+      for(BasicBlock* bb : l->getBlocks()){
+        if(li_->getLoopFor(bb) != l){
+          continue;
+        }
+
+        for(auto itr = bb->begin(); itr != bb->end(); ){
+          Instruction* ii = &*itr++;
+
+          if(isa<PHINode>(ii) || ii->isTerminator() ||
+             !l->hasLoopInvariantOperands(ii)){
+            continue;
+          }
+
+          bool hoist;
+          if(auto li = dyn_cast<LoadInst>(ii)){
+            hoist = canHoistLoad_(l, li);
+          }
+          else{
+            hoist = !ii->mayReadOrWriteMemory() &&
+              isSafeToSpeculativelyExecute(ii);
+          }
+
+          if(hoist){
+            ++NumHoisted;
+            if(isa<LoadInst>(ii)){
+              ++NumHoistedLoads;
+            }
+
+            ii->moveBefore(prologue);
+            changed = more = true;
+          }
+        }
+      }
+    }
+
+    return changed;
+  }
+};
+
+char HLIRHoistPass::ID;
+
+} // end namespace
+
+FunctionPass* llvm::createHLIRHoistPass(){
+  return new HLIRHoistPass();
+}
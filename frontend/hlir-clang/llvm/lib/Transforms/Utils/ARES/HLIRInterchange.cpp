@@ -0,0 +1,480 @@
+/*
+ * ###########################################################################
+ * Copyright (c) 2015, Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ *  Copyright 2015. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#include "llvm/Transforms/ARES/HLIRPass.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using namespace llvm;
+
+#define DEBUG_TYPE "hlir-interchange"
+
+STATISTIC(NumInterchanged, "Number of Forall loops interchanged");
+
+namespace{
+
+cl::opt<bool> Interchange("ares-interchange",
+                          cl::desc("Interchange Forall loops with the "
+                                   "serial loop inside them when that "
+                                   "makes its accesses stride-1"),
+                          cl::init(true));
+
+// interchanges the loop of a Forall body with the one serial loop in
+// it, as in Forall(i){ for(j...) A[j][i] }, where each task walks
+// columns of A with a large stride. The iterations of a Forall are
+// independent, so no dependence is carried by its loop and running the
+// serial loop outside of it is always legal. The chunk then runs a row
+// of its indices per j, stride-1 in the new inner loop, which keeps
+// the Forall's loop ID so that it vectorizes too, and the tasks still
+// split the Forall's range. The nest is rebuilt in front of the
+// original, which is kept for chunks in which the serial loop does not
+// run, when the test guarding it is false.
+class HLIRInterchangePass : public FunctionPass{
+public:
+  static char ID;
+
+  HLIRInterchangePass()
+    : FunctionPass(ID){}
+
+  void getAnalysisUsage(AnalysisUsage& AU) const override{
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+  }
+
+  const char *getPassName() const override{
+    return "HLIRInterchangePass";
+  }
+
+  bool runOnFunction(Function& F) override{
+    if(!Interchange || !F.getName().startswith("hlir.parallel_for.body")){
+      return false;
+    }
+
+    dt_ = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    li_ = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    se_ = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+    vector<Loop*> loops(li_->begin(), li_->end());
+    vector<Loop*> foralls;
+
+    while(!loops.empty()){
+      Loop* l = loops.back();
+      loops.pop_back();
+
+      if(l->getSubLoops().size() == 1 && l->getSubLoops()[0]->empty() &&
+         isForallLoop(l)){
+        foralls.push_back(l);
+      }
+
+      loops.insert(loops.end(), l->begin(), l->end());
+    }
+
+    bool changed = false;
+
+    for(Loop* l : foralls){
+      if(interchangeLoop_(l)){
+        dt_->recalculate(F);
+        changed = true;
+      }
+    }
+
+    return changed;
+  }
+
+private:
+  DominatorTree* dt_;
+  LoopInfo* li_;
+  ScalarEvolution* se_;
+
+  // the one phi of l's header, an affine recurrence of l with a constant
+  // step, or null
+  PHINode* findIndex_(Loop* l, const SCEVAddRecExpr*& ar){
+    BasicBlock* header = l->getHeader();
+    auto phi = dyn_cast<PHINode>(&header->front());
+
+    if(!phi || phi->getNextNode() != header->getFirstNonPHI() ||
+       !phi->getType()->isIntegerTy()){
+      return nullptr;
+    }
+
+    ar = dyn_cast<SCEVAddRecExpr>(se_->getSCEV(phi));
+    if(!ar || ar->getLoop() != l || !ar->isAffine() ||
+       !isa<SCEVConstant>(ar->getStepRecurrence(*se_))){
+      return nullptr;
+    }
+
+    return phi;
+  }
+
+  // whether l is a do-while loop in simplified form, that leaves and
+  // repeats at its latch and runs a known number of iterations
+  bool isSimpleLoop_(Loop* l){
+    BasicBlock* latch = l->getLoopLatch();
+    BasicBlock* exit = l->getExitBlock();
+
+    return l->getLoopPreheader() && latch && exit &&
+      l->getExitingBlock() == latch &&
+      exit->getSinglePredecessor() == latch &&
+      se_->hasLoopInvariantBackedgeTakenCount(l);
+  }
+
+  // the accesses of inner that are stride-1 across the iterations of l
+  // but not across its own, less those that are stride-1 in inner
+  int strideGain_(Loop* l, Loop* inner){
+    const DataLayout& dl = l->getHeader()->getModule()->getDataLayout();
+    int gain = 0;
+
+    for(BasicBlock* bb : inner->getBlocks()){
+      for(Instruction& ii : *bb){
+        Value* ptr;
+        Type* t;
+
+        if(auto li = dyn_cast<LoadInst>(&ii)){
+          ptr = li->getPointerOperand();
+          t = li->getType();
+        }
+        else if(auto si = dyn_cast<StoreInst>(&ii)){
+          ptr = si->getPointerOperand();
+          t = si->getValueOperand()->getType();
+        }
+        else{
+          continue;
+        }
+
+        auto ar = dyn_cast<SCEVAddRecExpr>(se_->getSCEV(ptr));
+        if(!ar || ar->getLoop() != inner || !ar->isAffine()){
+          continue;
+        }
+
+        int64_t size = dl.getTypeStoreSize(t);
+
+        auto isUnit = [&](const SCEV* step){
+          auto c = dyn_cast<SCEVConstant>(step);
+          return c && abs(c->getValue()->getSExtValue()) == size;
+        };
+
+        if(isUnit(ar->getStepRecurrence(*se_))){
+          --gain;
+          continue;
+        }
+
+        auto outer = dyn_cast<SCEVAddRecExpr>(ar->getStart());
+        if(outer && outer->getLoop() == l && outer->isAffine() &&
+           isUnit(outer->getStepRecurrence(*se_))){
+          ++gain;
+        }
+      }
+    }
+
+    return gain;
+  }
+
+  bool interchangeLoop_(Loop* l){
+    Loop* inner = l->getSubLoops()[0];
+
+    if(!isSimpleLoop_(l) || !isSimpleLoop_(inner)){
+      return false;
+    }
+
+    const SCEVAddRecExpr* ari;
+    const SCEVAddRecExpr* arj;
+    PHINode* iphi = findIndex_(l, ari);
+    PHINode* jphi = findIndex_(inner, arj);
+
+    if(!iphi || !jphi){
+      return false;
+    }
+
+    const SCEV* lastI = se_->getBackedgeTakenCount(l);
+    const SCEV* lastJ = se_->getBackedgeTakenCount(inner);
+
+    if(isa<SCEVCouldNotCompute>(lastI) || isa<SCEVCouldNotCompute>(lastJ) ||
+       !se_->isLoopInvariant(lastJ, l) ||
+       !se_->isLoopInvariant(arj->getStart(), l)){
+      return false;
+    }
+
+    if(strideGain_(l, inner) <= 0){
+      return false;
+    }
+
+    BasicBlock* preheader = l->getLoopPreheader();
+    BasicBlock* latch = l->getLoopLatch();
+    BasicBlock* exit = l->getExitBlock();
+    BasicBlock* innerPreheader = inner->getLoopPreheader();
+    BasicBlock* innerExit = inner->getExitBlock();
+
+    if(isa<PHINode>(exit->front())){
+      return false;
+    }
+
+    // another iteration of the serial loop may not run after a throw
+    for(BasicBlock* bb : inner->getBlocks()){
+      for(Instruction& ii : *bb){
+        if(ii.mayThrow()){
+          return false;
+        }
+      }
+    }
+
+    // what l does around the serial loop is computed from the index for
+    // it, and dropped otherwise, and the only tests are of values that
+    // l does not change, which go around the serial loop
+    vector<BasicBlock*> prologue;
+    vector<pair<Value*, bool>> guards;
+
+    for(BasicBlock* bb : l->getBlocks()){
+      if(inner->contains(bb)){
+        continue;
+      }
+
+      bool before = dt_->dominates(bb, innerPreheader);
+
+      for(Instruction& ii : *bb){
+        if(&ii == iphi || isa<DbgInfoIntrinsic>(ii)){
+          continue;
+        }
+
+        if(auto phi = dyn_cast<PHINode>(&ii)){
+          if(!phi->use_empty()){
+            return false;
+          }
+          continue;
+        }
+
+        if(auto br = dyn_cast<BranchInst>(&ii)){
+          if(!br->isConditional() || bb == latch){
+            continue;
+          }
+
+          Value* cond = br->getCondition();
+          bool taken = dt_->dominates(BasicBlockEdge(bb, br->getSuccessor(0)),
+                                      innerPreheader);
+          bool notTaken =
+            dt_->dominates(BasicBlockEdge(bb, br->getSuccessor(1)),
+                           innerPreheader);
+
+          if(!before || taken == notTaken || !l->isLoopInvariant(cond)){
+            return false;
+          }
+
+          guards.push_back({cond, taken});
+          continue;
+        }
+
+        if(isa<TerminatorInst>(ii)){
+          return false;
+        }
+
+        if(before ? ii.mayReadOrWriteMemory() ||
+           !isSafeToSpeculativelyExecute(&ii) : ii.mayHaveSideEffects()){
+          return false;
+        }
+      }
+
+      if(before){
+        prologue.push_back(bb);
+      }
+    }
+
+    for(auto itr = innerExit->begin(); isa<PHINode>(itr); ++itr){
+      if(!itr->use_empty()){
+        return false;
+      }
+    }
+
+    // the blocks before the serial loop dominate one another, in order
+    sort(prologue.begin(), prologue.end(),
+         [&](BasicBlock* a, BasicBlock* b){
+           return a != b && dt_->dominates(a, b);
+         });
+
+    auto& c = preheader->getContext();
+    Function* f = preheader->getParent();
+    Type* ti = iphi->getType();
+    Type* tj = jphi->getType();
+
+    const DataLayout& dl = f->getParent()->getDataLayout();
+    SCEVExpander expander(*se_, dl, "hlir.interchange");
+    Instruction* pt = preheader->getTerminator();
+
+    Value* firstI = iphi->getIncomingValueForBlock(preheader);
+    Value* finalI =
+      expander.expandCodeFor(ari->evaluateAtIteration(lastI, *se_), ti, pt);
+    Value* firstJ = expander.expandCodeFor(arj->getStart(), tj, pt);
+    Value* finalN =
+      expander.expandCodeFor(se_->getTruncateOrZeroExtend(lastJ, tj), tj, pt);
+
+    auto stepI = cast<SCEVConstant>(ari->getStepRecurrence(*se_));
+    auto stepJ = cast<SCEVConstant>(arj->getStepRecurrence(*se_));
+
+    IRBuilder<> b(pt);
+
+    Value* run = b.getTrue();
+    for(auto& g : guards){
+      run = b.CreateAnd(run, g.second ? g.first : b.CreateNot(g.first));
+    }
+
+    BasicBlock* outerHeader =
+      BasicBlock::Create(c, "interchange.outer", f, l->getHeader());
+    BasicBlock* innerHeader =
+      BasicBlock::Create(c, "interchange.inner", f, l->getHeader());
+    BasicBlock* innerLatch =
+      BasicBlock::Create(c, "interchange.inner.latch", f, l->getHeader());
+    BasicBlock* outerLatch =
+      BasicBlock::Create(c, "interchange.outer.latch", f, l->getHeader());
+
+    BranchInst::Create(outerHeader, l->getHeader(), run, pt);
+    pt->eraseFromParent();
+
+    // the serial loop, counting its iterations from 0
+    b.SetInsertPoint(outerHeader);
+    PHINode* n = b.CreatePHI(tj, 2, "interchange.n");
+    Value* j = b.CreateAdd(firstJ, b.CreateMul(n, stepJ->getValue()),
+                           jphi->getName());
+    b.CreateBr(innerHeader);
+
+    // the Forall's loop, with the prologue of each iteration
+    b.SetInsertPoint(innerHeader);
+    PHINode* i = b.CreatePHI(ti, 2, iphi->getName());
+
+    ValueToValueMapTy vmap;
+    vmap[iphi] = i;
+
+    for(BasicBlock* bb : prologue){
+      for(Instruction& ii : *bb){
+        if(isa<PHINode>(ii) || isa<TerminatorInst>(ii) ||
+           isa<DbgInfoIntrinsic>(ii)){
+          continue;
+        }
+
+        Instruction* ic = b.Insert(ii.clone(), ii.getName());
+        vmap[&ii] = ic;
+      }
+    }
+
+    for(Instruction& ii : *innerHeader){
+      RemapInstruction(&ii, vmap, RF_IgnoreMissingEntries);
+    }
+
+    // the body of the serial loop runs once per index
+    SmallVector<BasicBlock*, 8> body;
+    for(BasicBlock* bb : inner->getBlocks()){
+      BasicBlock* bc = CloneBasicBlock(bb, vmap, ".interchange", f);
+      vmap[bb] = bc;
+      body.push_back(bc);
+    }
+
+    auto jphiClone = cast<PHINode>(vmap[jphi]);
+    vmap[jphi] = j;
+    remapInstructionsInBlocks(body, vmap);
+    jphiClone->eraseFromParent();
+
+    b.CreateBr(cast<BasicBlock>(vmap[inner->getHeader()]));
+
+    Instruction* bodyLatch =
+      cast<BasicBlock>(vmap[inner->getLoopLatch()])->getTerminator();
+    BranchInst::Create(innerLatch, bodyLatch);
+    bodyLatch->eraseFromParent();
+
+    b.SetInsertPoint(innerLatch);
+    Value* iNext = b.CreateAdd(i, stepI->getValue());
+    Instruction* br =
+      b.CreateCondBr(b.CreateICmpEQ(i, finalI), outerLatch, innerHeader);
+    br->setMetadata("llvm.loop", l->getLoopID());
+
+    i->addIncoming(firstI, outerHeader);
+    i->addIncoming(iNext, innerLatch);
+
+    b.SetInsertPoint(outerLatch);
+    Value* nNext = b.CreateAdd(n, ConstantInt::get(tj, 1));
+    b.CreateCondBr(b.CreateICmpEQ(n, finalN), exit, outerHeader);
+
+    n->addIncoming(ConstantInt::get(tj, 0), preheader);
+    n->addIncoming(nNext, outerLatch);
+
+    se_->forgetLoop(l);
+    ++NumInterchanged;
+
+    return true;
+  }
+};
+
+char HLIRInterchangePass::ID;
+
+} // end namespace
+
+FunctionPass* llvm::createHLIRInterchangePass(){
+  return new HLIRInterchangePass();
+}
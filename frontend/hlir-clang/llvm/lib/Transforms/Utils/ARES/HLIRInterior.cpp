@@ -0,0 +1,391 @@
+/*
+ * ###########################################################################
+ * Copyright (c) 2015, Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ *  Copyright 2015. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+#include "llvm/Transforms/ARES/HLIRPass.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+
+#include <vector>
+
+using namespace std;
+using namespace llvm;
+
+#define DEBUG_TYPE "hlir-interior"
+
+STATISTIC(NumSplit, "Number of Forall loops split into interior and boundary");
+STATISTIC(NumFolded, "Number of boundary tests folded in interior loops");
+
+namespace{
+
+cl::opt<bool> SplitInterior("ares-split-interior",
+                            cl::desc("Run the interior of the chunks of "
+                                     "Forall bodies without their boundary "
+                                     "tests"),
+                            cl::init(true));
+
+// a test of the index against a value of the chunk, and what it is in
+// the interior: a constant for an equality, its value in the first
+// iteration for an order
+struct BoundaryTest{
+  ICmpInst* cmp;
+  Value* interior;
+};
+
+// splits the chunks of a Forall at the boundary of its iteration space,
+// such as the wraparound of a periodic stencil, into those in its
+// interior and those on its boundary. A test of the index against a
+// value that does not change in the loop, x == 0 or x + 1 < n, has the
+// same outcome in every iteration of a chunk that does not reach the
+// value, as is the case for all but the few chunks at the boundary.
+// The loop is versioned on that: the chunks of the interior run a copy
+// of it in which the tests are folded, the selects of the boundary math
+// gone and its accesses affine, so that it vectorizes, and those at the
+// boundary keep the general loop. The tiles of a Forall2D split likewise
+// into interior tiles and the strips of tiles along the edges.
+class HLIRInteriorPass : public FunctionPass{
+public:
+  static char ID;
+
+  HLIRInteriorPass()
+    : FunctionPass(ID){}
+
+  void getAnalysisUsage(AnalysisUsage& AU) const override{
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addPreserved<DominatorTreeWrapperPass>();
+    AU.addPreserved<LoopInfoWrapperPass>();
+  }
+
+  const char *getPassName() const override{
+    return "HLIRInteriorPass";
+  }
+
+  bool runOnFunction(Function& F) override{
+    if(!SplitInterior || !F.getName().startswith("hlir.parallel_for.body")){
+      return false;
+    }
+
+    dt_ = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    li_ = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    se_ = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+    // the loops are gathered first, versioning adds more
+    vector<Loop*> loops(li_->begin(), li_->end());
+    vector<Loop*> foralls;
+
+    while(!loops.empty()){
+      Loop* l = loops.back();
+      loops.pop_back();
+
+      if(l->empty()){
+        if(isForallLoop(l)){
+          foralls.push_back(l);
+        }
+      }
+      else{
+        loops.insert(loops.end(), l->begin(), l->end());
+      }
+    }
+
+    bool changed = false;
+
+    for(Loop* l : foralls){
+      changed |= splitLoop_(l);
+    }
+
+    return changed;
+  }
+
+private:
+  DominatorTree* dt_;
+  LoopInfo* li_;
+  ScalarEvolution* se_;
+
+  // whether cmp tests an affine function of the index of l, which does
+  // not wrap in the loop, against a value that l does not change, with
+  // x the one, r the other, and pred as if x were the first operand
+  bool findTest_(Loop* l, ICmpInst* cmp, const SCEVAddRecExpr*& x,
+                 const SCEV*& r, ICmpInst::Predicate& pred,
+                 bool& isSigned){
+    const SCEV* a = se_->getSCEV(cmp->getOperand(0));
+    const SCEV* b = se_->getSCEV(cmp->getOperand(1));
+    pred = cmp->getPredicate();
+
+    x = dyn_cast<SCEVAddRecExpr>(a);
+    r = b;
+
+    if(!x || x->getLoop() != l){
+      x = dyn_cast<SCEVAddRecExpr>(b);
+      r = a;
+      pred = cmp->getSwappedPredicate();
+    }
+
+    if(!x || x->getLoop() != l || !x->isAffine() ||
+       !isa<SCEVConstant>(x->getStepRecurrence(*se_)) ||
+       !se_->isLoopInvariant(r, l)){
+      return false;
+    }
+
+    bool nuw = x->getNoWrapFlags(SCEV::FlagNUW);
+    bool nsw = x->getNoWrapFlags(SCEV::FlagNSW);
+
+    if(cmp->isEquality()){
+      isSigned = !nuw;
+      return nuw || nsw;
+    }
+
+    isSigned = cmp->isSigned();
+    return isSigned ? nsw : nuw;
+  }
+
+  bool splitLoop_(Loop* l){
+    BasicBlock* preheader = l->getLoopPreheader();
+    BasicBlock* exiting = l->getExitingBlock();
+    BasicBlock* exit = l->getExitBlock();
+
+    if(!preheader || !exiting || !exit || !exit->getSinglePredecessor() ||
+       !se_->hasLoopInvariantBackedgeTakenCount(l)){
+      return false;
+    }
+
+    const SCEV* last = se_->getBackedgeTakenCount(l);
+    if(isa<SCEVCouldNotCompute>(last)){
+      return false;
+    }
+
+    struct Candidate{
+      ICmpInst* cmp;
+      const SCEVAddRecExpr* x;
+      const SCEV* r;
+      ICmpInst::Predicate pred;
+      bool isSigned;
+    };
+
+    // the test of the exit changes in the last iteration
+    auto br = dyn_cast<BranchInst>(exiting->getTerminator());
+    Value* exitTest = br && br->isConditional() ? br->getCondition() : nullptr;
+
+    vector<Candidate> candidates;
+
+    for(BasicBlock* bb : l->getBlocks()){
+      for(Instruction& ii : *bb){
+        auto cmp = dyn_cast<ICmpInst>(&ii);
+        if(!cmp || cmp == exitTest){
+          continue;
+        }
+
+        Candidate c;
+        c.cmp = cmp;
+        if(findTest_(l, cmp, c.x, c.r, c.pred, c.isSigned)){
+          candidates.push_back(c);
+        }
+      }
+    }
+
+    if(candidates.empty()){
+      return false;
+    }
+
+    const DataLayout& dl = preheader->getModule()->getDataLayout();
+    SCEVExpander expander(*se_, dl, "hlir.interior");
+    Instruction* pt = preheader->getTerminator();
+    IRBuilder<> b(pt);
+
+    // the chunk is in the interior if no test changes its outcome over
+    // its iterations, which for an index that moves monotonically is
+    // the case if the value is not between the first and the last, or
+    // the order is the same at both
+    vector<BoundaryTest> tests;
+    Value* interior = b.getTrue();
+
+    for(Candidate& c : candidates){
+      Type* t = c.cmp->getOperand(0)->getType();
+
+      Value* first = expander.expandCodeFor(c.x->getStart(), t, pt);
+      Value* final =
+        expander.expandCodeFor(c.x->evaluateAtIteration(last, *se_), t, pt);
+      Value* r = expander.expandCodeFor(c.r, t, pt);
+
+      b.SetInsertPoint(pt);
+
+      BoundaryTest test;
+      test.cmp = c.cmp;
+
+      if(c.cmp->isEquality()){
+        auto step = cast<SCEVConstant>(c.x->getStepRecurrence(*se_));
+        bool down = step->getValue()->getValue().isNegative();
+
+        Value* lo = down ? final : first;
+        Value* hi = down ? first : final;
+
+        Value* below = c.isSigned ? b.CreateICmpSLT(r, lo) :
+          b.CreateICmpULT(r, lo);
+        Value* above = c.isSigned ? b.CreateICmpSGT(r, hi) :
+          b.CreateICmpUGT(r, hi);
+
+        interior = b.CreateAnd(interior, b.CreateOr(below, above));
+
+        test.interior = c.cmp->getPredicate() == ICmpInst::ICMP_NE ?
+          b.getTrue() : b.getFalse();
+      }
+      else{
+        Value* atFirst = b.CreateICmp(c.pred, first, r);
+        Value* atFinal = b.CreateICmp(c.pred, final, r);
+
+        interior = b.CreateAnd(interior, b.CreateICmpEQ(atFirst, atFinal));
+        test.interior = atFirst;
+      }
+
+      tests.push_back(test);
+    }
+
+    interior->setName("hlir.interior");
+
+    // l becomes the interior loop, a copy of it the boundary loop, the
+    // two joining at the exit
+    BasicBlock* checkBlock = preheader;
+    BasicBlock* ph = SplitBlock(checkBlock, checkBlock->getTerminator(), dt_,
+                                li_);
+    ph->setName(l->getHeader()->getName() + ".interior.ph");
+
+    SmallVector<Instruction*, 8> defsUsedOutside =
+      findDefsUsedOutsideOfLoop(l);
+
+    ValueToValueMapTy vmap;
+    SmallVector<BasicBlock*, 8> boundaryBlocks;
+    Loop* boundary =
+      cloneLoopWithPreheader(ph, checkBlock, l, vmap, ".boundary", li_, dt_,
+                             boundaryBlocks);
+    remapInstructionsInBlocks(boundaryBlocks, vmap);
+
+    Instruction* term = checkBlock->getTerminator();
+    BranchInst::Create(ph, boundary->getLoopPreheader(), interior, term);
+    term->eraseFromParent();
+
+    dt_->changeImmediateDominator(exit, checkBlock);
+
+    for(Instruction* ii : defsUsedOutside){
+      PHINode* phi = nullptr;
+
+      for(auto itr = exit->begin(); (phi = dyn_cast<PHINode>(itr)); ++itr){
+        if(phi->getIncomingValue(0) == ii){
+          break;
+        }
+      }
+
+      if(!phi){
+        phi = PHINode::Create(ii->getType(), 2, ii->getName() + ".interior",
+                              &*exit->begin());
+
+        vector<User*> users(ii->user_begin(), ii->user_end());
+        for(User* user : users){
+          if(!l->contains(cast<Instruction>(user)->getParent())){
+            user->replaceUsesOfWith(ii, phi);
+          }
+        }
+
+        phi->addIncoming(ii, exiting);
+      }
+    }
+
+    // the exit is entered from the copy too
+    BasicBlock* boundaryExiting = boundary->getExitingBlock();
+
+    for(auto itr = exit->begin(); isa<PHINode>(itr); ++itr){
+      auto phi = cast<PHINode>(itr);
+      Value* v = phi->getIncomingValueForBlock(exiting);
+
+      auto mitr = vmap.find(v);
+      if(mitr != vmap.end()){
+        v = mitr->second;
+      }
+
+      phi->addIncoming(v, boundaryExiting);
+    }
+
+    ++NumSplit;
+    NumFolded += tests.size();
+
+    for(BoundaryTest& test : tests){
+      test.cmp->replaceAllUsesWith(test.interior);
+      test.cmp->eraseFromParent();
+    }
+
+    se_->forgetLoop(l);
+
+    return true;
+  }
+};
+
+char HLIRInteriorPass::ID;
+
+} // end namespace
+
+FunctionPass* llvm::createHLIRInteriorPass(){
+  return new HLIRInteriorPass();
+}
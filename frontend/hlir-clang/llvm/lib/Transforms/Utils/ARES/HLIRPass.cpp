@@ -103,6 +103,12 @@ using namespace ares;
 
 namespace{
 
+// bitcode that is run in ares-jit rather than compiled again needs its
+// tasks lowered too
+cl::opt<bool> LowerTasks("hlir-lower-tasks",
+                         cl::desc("Lower tasks when emitting bitcode"),
+                         cl::init(false));
+
 typedef vector<Type*> TypeVec;
 typedef vector<Value*> ValueVec;
 typedef vector<string> StringVec;
@@ -111,7 +117,9 @@ class HLIRPass : public ModulePass{
 public:
   static char ID;
 
-  HLIRPass() : ModulePass(ID){}
+  HLIRPass(bool deferTasks=false)
+    : ModulePass(ID),
+      deferTasks_(deferTasks){}
 
   void getAnalysisUsage(AnalysisUsage& AU) const override{}
 
@@ -122,17 +130,22 @@ public:
   bool runOnModule(Module& M) override{
     HLIRModule* module = HLIRModule::getModule(&M);
     if(module){
-      return module->lowerToIR_();
+      bool changed = module->lowerToIR_(deferTasks_ && !LowerTasks);
+      HLIRModule::releaseModule(&M);
+      return changed;
     }
     
     return false;
   }
+
+private:
+  bool deferTasks_;
 };
 
 char HLIRPass::ID;
 
 } // end namespace
 
-ModulePass* llvm::createHLIRPass(){
-  return new HLIRPass;
+ModulePass* llvm::createHLIRPass(bool deferTasks){
+  return new HLIRPass(deferTasks);
 }
@@ -0,0 +1,307 @@
+/*
+ * ###########################################################################
+ * Copyright (c) 2015, Los Alamos National Security, LLC.
+ * All rights reserved.
+ *
+ *  Copyright 2015. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#include "llvm/Transforms/ARES/HLIRPass.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <vector>
+
+using namespace std;
+using namespace llvm;
+
+namespace{
+
+cl::opt<unsigned> PrefetchDistance("ares-prefetch-distance",
+                                   cl::desc("Iterations ahead that the "
+                                            "gathers of Forall bodies are "
+                                            "prefetched, 0 for none"),
+                                   cl::init(16));
+
+// an access of base[index[i]] in a loop, index[i] being a load of an
+// affine address of the loop, and the casts from it to the operand of
+// the GEP of the access
+struct Gather{
+  GetElementPtrInst* gep;
+  unsigned operand;
+  LoadInst* index;
+  vector<CastInst*> casts;
+  bool write;
+};
+
+// inserts llvm.prefetch for the gathers of the loops of outlined Forall
+// and reduce bodies. Each body runs a contiguous chunk, so the index
+// that an iteration a distance ahead will read is known, and is clamped
+// to the last iteration of the loop to stay within the index array.
+class HLIRPrefetchPass : public FunctionPass{
+public:
+  static char ID;
+
+  HLIRPrefetchPass()
+    : FunctionPass(ID){}
+
+  void getAnalysisUsage(AnalysisUsage& AU) const override{
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addPreserved<DominatorTreeWrapperPass>();
+    AU.addPreserved<LoopInfoWrapperPass>();
+  }
+
+  const char *getPassName() const override{
+    return "HLIRPrefetchPass";
+  }
+
+  bool runOnFunction(Function& F) override{
+    if(PrefetchDistance == 0 ||
+       (!F.getName().startswith("hlir.parallel_for.body") &&
+        !F.getName().startswith("hlir.parallel_reduce.body"))){
+      return false;
+    }
+
+    dt_ = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    se_ = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+    LoopInfo& li = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+
+    vector<Loop*> loops(li.begin(), li.end());
+    bool changed = false;
+
+    while(!loops.empty()){
+      Loop* l = loops.back();
+      loops.pop_back();
+
+      if(l->empty()){
+        changed |= prefetchLoop_(l);
+      }
+      else{
+        loops.insert(loops.end(), l->begin(), l->end());
+      }
+    }
+
+    return changed;
+  }
+
+private:
+  DominatorTree* dt_;
+  ScalarEvolution* se_;
+
+  // the load of index[i] that operand k of gep depends on through
+  // casts, when all of its other operands are invariant in l
+  bool findGather_(Loop* l, GetElementPtrInst* gep, Gather& g){
+    g.gep = gep;
+    g.index = nullptr;
+
+    for(unsigned k = 0; k < gep->getNumOperands(); ++k){
+      Value* op = gep->getOperand(k);
+      if(l->isLoopInvariant(op)){
+        continue;
+      }
+
+      if(g.index || k == 0){
+        return false;
+      }
+
+      vector<CastInst*> casts;
+      while(auto ci = dyn_cast<CastInst>(op)){
+        casts.push_back(ci);
+        op = ci->getOperand(0);
+      }
+
+      auto index = dyn_cast<LoadInst>(op);
+      if(!index || !l->contains(index) || index->isVolatile()){
+        return false;
+      }
+
+      auto addr = dyn_cast<SCEVAddRecExpr>(
+        se_->getSCEV(index->getPointerOperand()));
+      if(!addr || !addr->isAffine() || addr->getLoop() != l){
+        return false;
+      }
+
+      g.operand = k;
+      g.index = index;
+      g.casts.assign(casts.rbegin(), casts.rend());
+    }
+
+    // the index is read on every iteration, so reading the one of the
+    // last iteration early cannot fault
+    BasicBlock* latch = l->getLoopLatch();
+    return g.index && latch && dt_->dominates(g.index->getParent(), latch);
+  }
+
+  bool prefetchLoop_(Loop* l){
+    if(!l->getLoopPreheader() || !se_->hasLoopInvariantBackedgeTakenCount(l)){
+      return false;
+    }
+
+    vector<Gather> gathers;
+
+    for(BasicBlock* bb : l->getBlocks()){
+      for(Instruction& ii : *bb){
+        Value* ptr;
+        bool write;
+
+        if(auto li = dyn_cast<LoadInst>(&ii)){
+          ptr = li->getPointerOperand();
+          write = false;
+        }
+        else if(auto si = dyn_cast<StoreInst>(&ii)){
+          ptr = si->getPointerOperand();
+          write = true;
+        }
+        else{
+          continue;
+        }
+
+        auto gep = dyn_cast<GetElementPtrInst>(ptr);
+        if(!gep || !l->contains(gep)){
+          continue;
+        }
+
+        // a read and a write of the same element share a prefetch
+        bool seen = false;
+        for(Gather& g : gathers){
+          if(g.gep == gep){
+            g.write |= write;
+            seen = true;
+          }
+        }
+
+        Gather g;
+        if(!seen && findGather_(l, gep, g)){
+          g.write = write;
+          gathers.push_back(g);
+        }
+      }
+    }
+
+    if(gathers.empty()){
+      return false;
+    }
+
+    const SCEV* last = se_->getBackedgeTakenCount(l);
+    Type* countTy = last->getType();
+
+    // the iteration PrefetchDistance ahead, or the last
+    const SCEV* iteration =
+      se_->getAddRecExpr(se_->getZero(countTy), se_->getOne(countTy), l,
+                         SCEV::FlagNUW);
+    const SCEV* ahead =
+      se_->getUMinExpr(se_->getAddExpr(iteration,
+                                       se_->getConstant(countTy,
+                                                        PrefetchDistance)),
+                       last);
+
+    Module* m = l->getHeader()->getModule();
+    const DataLayout& dl = m->getDataLayout();
+    LLVMContext& c = m->getContext();
+
+    Function* prefetch = Intrinsic::getDeclaration(m, Intrinsic::prefetch);
+    Type* i32Ty = Type::getInt32Ty(c);
+    Type* i8PtrTy = Type::getInt8PtrTy(c);
+
+    SCEVExpander expander(*se_, dl, "hlir.prefetch");
+
+    for(Gather& g : gathers){
+      auto addr =
+        cast<SCEVAddRecExpr>(se_->getSCEV(g.index->getPointerOperand()));
+
+      const SCEV* aheadAddr = addr->evaluateAtIteration(ahead, *se_);
+
+      Value* indexPtr =
+        expander.expandCodeFor(aheadAddr,
+                               g.index->getPointerOperand()->getType(), g.gep);
+
+      IRBuilder<> b(g.gep);
+
+      Value* v = b.CreateLoad(indexPtr, "hlir.prefetch.index");
+      for(CastInst* ci : g.casts){
+        v = b.CreateCast(ci->getOpcode(), v, ci->getType());
+      }
+
+      auto gep = cast<GetElementPtrInst>(g.gep->clone());
+      gep->setOperand(g.operand, v);
+      b.Insert(gep, "hlir.prefetch.addr");
+
+      // read or write, high temporal locality, data cache
+      b.CreateCall(prefetch,
+                   {b.CreateBitCast(gep, i8PtrTy),
+                    ConstantInt::get(i32Ty, g.write ? 1 : 0),
+                    ConstantInt::get(i32Ty, 3),
+                    ConstantInt::get(i32Ty, 1)});
+    }
+
+    return true;
+  }
+};
+
+char HLIRPrefetchPass::ID;
+
+} // end namespace
+
+FunctionPass* llvm::createHLIRPrefetchPass(){
+  return new HLIRPrefetchPass();
+}
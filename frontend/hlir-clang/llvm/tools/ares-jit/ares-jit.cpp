@@ -0,0 +1,456 @@
+//===- ares-jit.cpp - Run HLIR programs with specialized Forall bodies ----===//
+//
+//                     Project Ares
+//
+// This file is distributed under the expression permission of Los Alamos
+// National laboratory. It is Licensed under the BSD-3 license. For more
+// information, see LICENSE.md in the Ares root directory.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs the main() of a bitcode file emitted by hlir-clang, with its tasks
+// lowered too:
+//
+//   clang++ -c -emit-llvm -O2 -mllvm -hlir-lower-tasks prog.cpp
+//   ares-jit -runtime=libares_runtime.so prog.bc args...
+//
+// The runtime asks the JIT for a body to run each time a Forall is queued.
+// Once a body has been queued -threshold times its captured scalars, which
+// HLIR reads from the args struct with invariant loads, are replaced with
+// the values that the args of that launch hold and the copy is optimized
+// and compiled. The specializations are cached per body by the bytes of
+// those scalars, so parameter studies that run the same kernels with other
+// sizes and constants each get their own code.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace {
+
+cl::opt<std::string> InputFile(cl::desc("<input bitcode>"), cl::Positional,
+                               cl::init("-"));
+
+cl::list<std::string> InputArgv(cl::ConsumeAfter,
+                                cl::desc("<program arguments>..."));
+
+cl::opt<std::string>
+    RuntimeLibrary("runtime", cl::desc("The ARES runtime shared library"),
+                   cl::init("libares_runtime.so"));
+
+cl::opt<unsigned>
+    Threshold("threshold",
+              cl::desc("Launches of a Forall body before it is specialized"),
+              cl::init(2));
+
+cl::opt<unsigned> MaxSpecializations(
+    "max-specializations",
+    cl::desc("Specializations of a body before it stays generic"),
+    cl::init(8));
+
+cl::opt<bool> Verbose("v", cl::desc("Report each specialization"),
+                      cl::init(false));
+
+const char *BODY_PREFIX = "hlir.parallel_for.body";
+
+/// A captured scalar of a Forall body, read from the args struct at
+/// Offset, with Size bytes.
+struct Capture {
+  uint64_t Offset;
+  uint64_t Size;
+};
+
+/// The loads of captured scalars of F. HLIR reads the args pointer from the
+/// range arg with an invariant load that is also dereferenceable, and each
+/// capture from it with an invariant load at a constant offset.
+void findCaptureLoads(Function &F, const DataLayout &DL,
+                      SmallVectorImpl<std::pair<LoadInst *, Capture>> &Loads) {
+  for (BasicBlock &BB : F) {
+    for (Instruction &I : BB) {
+      auto *LI = dyn_cast<LoadInst>(&I);
+      if (!LI || LI->isVolatile() ||
+          !LI->getMetadata(LLVMContext::MD_invariant_load))
+        continue;
+
+      Type *Ty = LI->getType();
+      if (!(Ty->isIntegerTy() && Ty->getIntegerBitWidth() <= 64) &&
+          !Ty->isFloatTy() && !Ty->isDoubleTy())
+        continue;
+
+      int64_t Offset;
+      Value *Base =
+          GetPointerBaseWithConstantOffset(LI->getPointerOperand(), Offset, DL);
+
+      auto *Args = dyn_cast<LoadInst>(Base->stripPointerCasts());
+      if (!Args || Offset < 0 ||
+          !Args->getMetadata(LLVMContext::MD_invariant_load) ||
+          !Args->getMetadata(LLVMContext::MD_dereferenceable))
+        continue;
+
+      Loads.push_back({LI, {uint64_t(Offset), DL.getTypeStoreSize(Ty)}});
+    }
+  }
+}
+
+/// The value of type Ty that Size bytes at P hold.
+Constant *readConstant(Type *Ty, const char *P, uint64_t Size) {
+  if (Ty->isFloatTy()) {
+    float V;
+    std::memcpy(&V, P, sizeof(V));
+    return ConstantFP::get(Ty, V);
+  }
+
+  if (Ty->isDoubleTy()) {
+    double V;
+    std::memcpy(&V, P, sizeof(V));
+    return ConstantFP::get(Ty, V);
+  }
+
+  uint64_t V = 0;
+  std::memcpy(&V, P, Size);
+  return ConstantInt::get(Ty, V);
+}
+
+class AresJIT {
+public:
+  typedef ObjectLinkingLayer<> ObjLayerT;
+  typedef IRCompileLayer<ObjLayerT> CompileLayerT;
+  typedef CompileLayerT::ModuleSetHandleT ModuleHandleT;
+
+  AresJIT(TargetMachine &TM)
+      : TM(TM), DL(TM.createDataLayout()),
+        CompileLayer(ObjectLayer, SimpleCompiler(TM)),
+        Overrides([this](const std::string &S) { return mangle(S); }) {}
+
+  /// Compiles M, which is kept to clone the bodies that are specialized
+  /// from, and records its bodies by their address.
+  ModuleHandleT addProgram(std::unique_ptr<Module> M) {
+    Program = std::move(M);
+    externalize(*Program);
+
+    ModuleHandleT H = addModule(std::unique_ptr<Module>(CloneModule(
+        Program.get())));
+
+    for (Function &F : *Program) {
+      if (F.isDeclaration() || !F.getName().startswith(BODY_PREFIX))
+        continue;
+
+      if (auto Sym = findSymbol(F.getName())) {
+        void *FP = reinterpret_cast<void *>(
+            static_cast<uintptr_t>(Sym.getAddress()));
+        Bodies[FP].F = &F;
+      }
+    }
+
+    return H;
+  }
+
+  JITSymbol findSymbol(StringRef Name) {
+    return CompileLayer.findSymbol(mangle(Name), false);
+  }
+
+  /// Runs the constructors or destructors of the program.
+  void runStructors(ModuleHandleT H, bool Ctors) {
+    std::vector<std::string> Names;
+    for (auto E : Ctors ? getConstructors(*Program) : getDestructors(*Program))
+      if (E.Func)
+        Names.push_back(mangle(E.Func->getName()));
+
+    CtorDtorRunner<CompileLayerT>(std::move(Names), H)
+        .runViaLayer(CompileLayer);
+
+    if (!Ctors)
+      Overrides.runDestructors();
+  }
+
+  /// The body to run a launch of FP over Args in place of it, or null.
+  /// A launch that finds the JIT busy compiling runs FP itself rather
+  /// than wait.
+  void *specialize(void *FP, void *Args) {
+    std::unique_lock<std::mutex> Lock(Mutex, std::try_to_lock);
+    if (!Lock)
+      return nullptr;
+
+    auto Itr = Bodies.find(FP);
+    if (Itr == Bodies.end() || !Args)
+      return nullptr;
+
+    Body &B = Itr->second;
+
+    if (!B.Analyzed) {
+      SmallVector<std::pair<LoadInst *, Capture>, 8> Loads;
+      findCaptureLoads(*B.F, DL, Loads);
+      for (auto &L : Loads)
+        B.Captures.push_back(L.second);
+      B.Analyzed = true;
+    }
+
+    if (B.Captures.empty() || ++B.Launches < Threshold)
+      return nullptr;
+
+    // the signature is the bytes of the captured scalars
+    std::string Key;
+    const char *P = static_cast<const char *>(Args);
+    for (const Capture &C : B.Captures)
+      Key.append(P + C.Offset, C.Size);
+
+    auto SItr = B.Specializations.find(Key);
+    if (SItr != B.Specializations.end())
+      return SItr->second;
+
+    if (B.Specializations.size() >= MaxSpecializations)
+      return nullptr;
+
+    void *SFP = compileSpecialization(*B.F, P);
+    B.Specializations[Key] = SFP;
+    return SFP;
+  }
+
+private:
+  struct Body {
+    Function *F = nullptr;
+    bool Analyzed = false;
+    unsigned Launches = 0;
+    std::vector<Capture> Captures;
+    std::map<std::string, void *> Specializations;
+  };
+
+  TargetMachine &TM;
+  const DataLayout DL;
+  ObjLayerT ObjectLayer;
+  CompileLayerT CompileLayer;
+  LocalCXXRuntimeOverrides Overrides;
+
+  std::unique_ptr<Module> Program;
+  DenseMap<void *, Body> Bodies;
+  unsigned NextId = 0;
+  std::mutex Mutex;
+
+  std::string mangle(StringRef Name) {
+    std::string MangledName;
+    {
+      raw_string_ostream MangledNameStream(MangledName);
+      Mangler::getNameWithPrefix(MangledNameStream, Name, DL);
+    }
+    return MangledName;
+  }
+
+  /// The bodies, their callees and constants are internal, they are given
+  /// external linkage so that the specializations, compiled as modules of
+  /// their own, can refer to them.
+  static void externalize(Module &M) {
+    auto Externalize = [](GlobalValue &GV) {
+      if (GV.isDeclaration() || !GV.hasLocalLinkage())
+        return;
+
+      if (!GV.hasName())
+        GV.setName("__ares_jit.global");
+
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+      GV.setVisibility(GlobalValue::DefaultVisibility);
+    };
+
+    for (Function &F : M)
+      Externalize(F);
+
+    for (GlobalVariable &GV : M.globals())
+      Externalize(GV);
+  }
+
+  ModuleHandleT addModule(std::unique_ptr<Module> M) {
+    auto Resolver = createLambdaResolver(
+        [this](const std::string &Name) {
+          if (auto Sym = CompileLayer.findSymbol(Name, false))
+            return RuntimeDyld::SymbolInfo(Sym.getAddress(), Sym.getFlags());
+          if (auto Sym = Overrides.searchOverrides(Name))
+            return Sym;
+          if (auto Addr = RTDyldMemoryManager::getSymbolAddressInProcess(Name))
+            return RuntimeDyld::SymbolInfo(Addr, JITSymbolFlags::Exported);
+          return RuntimeDyld::SymbolInfo(nullptr);
+        },
+        [](const std::string &Name) { return nullptr; });
+
+    std::vector<std::unique_ptr<Module>> Ms;
+    Ms.push_back(std::move(M));
+    return CompileLayer.addModuleSet(std::move(Ms),
+                                     make_unique<SectionMemoryManager>(),
+                                     std::move(Resolver));
+  }
+
+  /// Compiles a copy of F with its captured scalars read from Args.
+  void *compileSpecialization(Function &F, const char *Args) {
+    ValueToValueMapTy VMap;
+    std::unique_ptr<Module> M(CloneModule(
+        Program.get(), VMap,
+        [&F](const GlobalValue *GV) { return GV == &F; }));
+
+    // the program's constructors are not run again
+    for (const char *Name : {"llvm.global_ctors", "llvm.global_dtors",
+                             "llvm.used", "llvm.compiler.used"})
+      if (GlobalVariable *GV = M->getNamedGlobal(Name))
+        GV->eraseFromParent();
+
+    auto *SF = cast<Function>(VMap[&F]);
+    std::string Name =
+        (F.getName() + ".spec." + Twine(NextId++)).str();
+    SF->setName(Name);
+
+    SmallVector<std::pair<LoadInst *, Capture>, 8> Loads;
+    findCaptureLoads(*SF, DL, Loads);
+
+    for (auto &L : Loads) {
+      LoadInst *LI = L.first;
+      LI->replaceAllUsesWith(
+          readConstant(LI->getType(), Args + L.second.Offset, L.second.Size));
+      LI->eraseFromParent();
+    }
+
+    legacy::PassManager PM;
+    PM.add(createTargetTransformInfoWrapperPass(TM.getTargetIRAnalysis()));
+
+    PassManagerBuilder Builder;
+    Builder.OptLevel = 3;
+    Builder.Inliner = createFunctionInliningPass(3, 0);
+    Builder.LoopVectorize = true;
+    Builder.SLPVectorize = true;
+    Builder.populateModulePassManager(PM);
+    PM.run(*M);
+
+    if (Verbose)
+      errs() << "ares-jit: specialized " << F.getName() << " on "
+             << Loads.size() << " captures as " << Name << "\n";
+
+    addModule(std::move(M));
+
+    auto Sym = findSymbol(Name);
+    return Sym ? reinterpret_cast<void *>(
+                     static_cast<uintptr_t>(Sym.getAddress()))
+               : nullptr;
+  }
+};
+
+AresJIT *TheJIT = nullptr;
+
+void *specializeForall(void *FP, void *Args, const void *Region) {
+  return TheJIT->specialize(FP, Args);
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+
+  cl::ParseCommandLineOptions(argc, argv, "ARES JIT\n");
+
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(InputFile, Err, Context);
+  if (!M) {
+    Err.print(argv[0], errs());
+    return 1;
+  }
+
+  if (M->getNamedMetadata("hlir.tasks")) {
+    errs() << argv[0] << ": " << InputFile << " has deferred tasks, emit it "
+           << "with -mllvm -hlir-lower-tasks\n";
+    return 1;
+  }
+
+  std::string ErrMsg;
+  if (sys::DynamicLibrary::LoadLibraryPermanently(nullptr, &ErrMsg) ||
+      sys::DynamicLibrary::LoadLibraryPermanently(RuntimeLibrary.c_str(),
+                                                  &ErrMsg)) {
+    errs() << argv[0] << ": " << ErrMsg << "\n";
+    return 1;
+  }
+
+  typedef void (*SetSpecializerFn)(void *(*)(void *, void *, const void *));
+  auto SetSpecializer = reinterpret_cast<SetSpecializerFn>(
+      static_cast<uintptr_t>(RTDyldMemoryManager::getSymbolAddressInProcess(
+          "__ares_set_forall_specializer")));
+  if (!SetSpecializer) {
+    errs() << argv[0] << ": " << RuntimeLibrary
+           << " is not the ARES runtime\n";
+    return 1;
+  }
+
+  std::unique_ptr<TargetMachine> TM(EngineBuilder().selectTarget());
+  M->setDataLayout(TM->createDataLayout());
+
+  AresJIT JIT(*TM);
+  TheJIT = &JIT;
+
+  auto H = JIT.addProgram(std::move(M));
+
+  auto MainSym = JIT.findSymbol("main");
+  if (!MainSym) {
+    errs() << argv[0] << ": " << InputFile << " has no main()\n";
+    return 1;
+  }
+
+  typedef int (*MainFn)(int, char **);
+  auto Main =
+      reinterpret_cast<MainFn>(static_cast<uintptr_t>(MainSym.getAddress()));
+
+  std::vector<char *> Argv;
+  Argv.push_back(const_cast<char *>(InputFile.c_str()));
+  for (std::string &Arg : InputArgv)
+    Argv.push_back(const_cast<char *>(Arg.c_str()));
+  Argv.push_back(nullptr);
+
+  JIT.runStructors(H, true);
+  SetSpecializer(specializeForall);
+
+  int Result = Main(Argv.size() - 1, Argv.data());
+
+  SetSpecializer(nullptr);
+  JIT.runStructors(H, false);
+
+  return Result;
+}
@@ -44,7 +44,10 @@
 #include <memory>
 
 // +=== ares
+#include "clang/Basic/Version.h"
 #include "llvm/Transforms/ARES/HLIRPass.h"
+#include "HLIRCache.h"
+#include "HLIRParallel.h"
 // =========
 
 using namespace clang;
@@ -100,10 +103,22 @@ private:
     return PerFunctionPasses;
   }
 
-  void CreatePasses();
+  void CreatePasses(BackendAction Action);
 
   // +=== ares
-  void CreateARESPasses();
+  void CreateARESPasses(BackendAction Action);
+
+  // whether the outlined HLIR bodies go through -ares-hlir-cache
+  bool UsesHLIRCache(BackendAction Action) const;
+
+  // what the optimized code of a body depends on besides its IR
+  std::string HLIRCacheSalt() const;
+
+  // whether the outlined HLIR bodies may be optimized on threads of
+  // -ares-hlir-jobs, apart from the rest of the module
+  bool UsesHLIRJobs(BackendAction Action) const;
+
+  void OptimizeHLIRBodies(Module &M) const;
   // =========
   
   /// Generates the TargetMachine.
@@ -181,6 +196,65 @@ static void addAddDiscriminatorsPass(const PassManagerBuilder &Builder,
   PM.add(createAddDiscriminatorsPass());
 }
 
+// after the loops of the outlined bodies have been optimized, and
+// vectorized where they could be
+static void addHLIRPrefetchPass(const PassManagerBuilder &Builder,
+                                legacy::PassManagerBase &PM) {
+  if (Builder.OptLevel > 0)
+    PM.add(createHLIRPrefetchPass());
+}
+
+// before the vectorizer, which can then vectorize the partials that
+// the adds of a chunk are accumulated in
+static void addHLIRAtomicPass(const PassManagerBuilder &Builder,
+                              legacy::PassManagerBase &PM) {
+  if (Builder.OptLevel > 0)
+    PM.add(createHLIRAtomicPass());
+}
+
+// with the loops of the outlined bodies rotated, before GVN and the last
+// LICM, which clean up after the hoisted loads
+static void addHLIRHoistPass(const PassManagerBuilder &Builder,
+                             legacy::PassManagerBase &PM) {
+  if (Builder.OptLevel > 0)
+    PM.add(createHLIRHoistPass());
+}
+
+// after the hoisting, which moves the loads of the sizes of the serial
+// loops out of the way
+static void addHLIRInterchangePass(const PassManagerBuilder &Builder,
+                                   legacy::PassManagerBase &PM) {
+  if (Builder.OptLevel > 0)
+    PM.add(createHLIRInterchangePass());
+}
+
+// after the hoisting, so that the copy of the loop that versioning makes
+// is of what is left in it
+static void addHLIRInteriorPass(const PassManagerBuilder &Builder,
+                                legacy::PassManagerBase &PM) {
+  if (Builder.OptLevel > 0)
+    PM.add(createHLIRInteriorPass());
+}
+
+// the passes of the outlined bodies, which those optimized on threads
+// of -ares-hlir-jobs go through too
+static void addHLIRExtensions(PassManagerBuilder &PMBuilder) {
+  PMBuilder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
+                         addHLIRHoistPass);
+
+  PMBuilder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
+                         addHLIRInterchangePass);
+
+  PMBuilder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
+                         addHLIRInteriorPass);
+
+  PMBuilder.addExtension(PassManagerBuilder::EP_VectorizerStart,
+                         addHLIRAtomicPass);
+
+  PMBuilder.addExtension(PassManagerBuilder::EP_OptimizerLast,
+                         addHLIRPrefetchPass);
+}
+
 static void addBoundsCheckingPass(const PassManagerBuilder &Builder,
                                     legacy::PassManagerBase &PM) {
   PM.add(createBoundsCheckingPass());
@@ -273,9 +347,9 @@ static void addSymbolRewriterPass(const CodeGenOptions &Opts,
   MPM->add(createRewriteSymbolsPass(DL));
 }
 
-void EmitAssemblyHelper::CreatePasses() {
+void EmitAssemblyHelper::CreatePasses(BackendAction Action) {
   // +=== ares
-  CreateARESPasses();
+  CreateARESPasses(Action);
   // =========
   
   if (CodeGenOpts.DisableLLVMPasses)
@@ -307,6 +381,8 @@ void EmitAssemblyHelper::CreatePasses() {
   PMBuilder.addExtension(PassManagerBuilder::EP_EarlyAsPossible,
                          addAddDiscriminatorsPass);
 
+  addHLIRExtensions(PMBuilder);
+
   // In ObjC ARC mode, add the main ARC optimization passes.
   if (LangOpts.ObjCAutoRefCount) {
     PMBuilder.addExtension(PassManagerBuilder::EP_EarlyAsPossible,
@@ -429,14 +505,142 @@ void EmitAssemblyHelper::CreatePasses() {
     MPM->add(createSampleProfileLoaderPass(CodeGenOpts.SampleProfileFile));
 
   PMBuilder.populateModulePassManager(*MPM);
+
+  // +=== ares
+  if (UsesHLIRJobs(Action))
+    MPM->add(createHLIRJoinPass());
+
+  if (UsesHLIRCache(Action))
+    MPM->add(createHLIRCacheStorePass());
+  // =========
 }
 
-void EmitAssemblyHelper::CreateARESPasses() {
+// HLIR lowering has to run on the IR as emitted by the frontend, which
+// the constructs refer to, and promotes the locals it can itself. When
+// optimizing, the bodies that were outlined are then inlined into their
+// drivers and, like all other code, go through the full pipeline below.
+// Bitcode, as written for -emit-llvm or -flto, keeps its tasks as calls
+// described by metadata and has them lowered when it is compiled, after
+// linking with llvm-link if the calls of other modules are to be
+// spawned too.
+void EmitAssemblyHelper::CreateARESPasses(BackendAction Action) {
+  bool deferTasks = Action == Backend_EmitBC || Action == Backend_EmitLL;
+
   llvm::legacy::PassManager MPM;
-  MPM.add(createHLIRPass());
+  MPM.add(createHLIRPass(deferTasks));
+
+  if (!CodeGenOpts.DisableLLVMPasses && !CodeGenOpts.DisableLLVMOpts &&
+      CodeGenOpts.OptimizationLevel > 0) {
+    MPM.add(createAlwaysInlinerPass());
+    MPM.add(createGlobalDCEPass());
+  }
+
+  if (UsesHLIRCache(Action))
+    MPM.add(createHLIRCacheLoadPass(HLIRCacheSalt()));
+
+  if (UsesHLIRJobs(Action))
+    MPM.add(createHLIRSplitPass(
+        [this](Module &M) { OptimizeHLIRBodies(M); }));
+
   MPM.run(*TheModule);
 }
 
+// The bodies are cached as the optimizer leaves them, which bitcode
+// that is optimized again when it is compiled has no use for.
+bool EmitAssemblyHelper::UsesHLIRCache(BackendAction Action) const {
+  return Action != Backend_EmitBC && Action != Backend_EmitLL &&
+         !CodeGenOpts.DisableLLVMPasses && !CodeGenOpts.DisableLLVMOpts &&
+         CodeGenOpts.OptimizationLevel > 0;
+}
+
+// The options of the optimizer, and those passed on to LLVM, such as
+// those of the HLIR passes themselves. The target's CPU and features
+// are attributes of the bodies that their keys include.
+std::string EmitAssemblyHelper::HLIRCacheSalt() const {
+  std::string Salt;
+  raw_string_ostream OS(Salt);
+
+  OS << getClangFullVersion() << " -O" << CodeGenOpts.OptimizationLevel
+     << " -Os" << CodeGenOpts.OptimizeSize << " " << CodeGenOpts.VectorizeLoop
+     << CodeGenOpts.VectorizeSLP << CodeGenOpts.VectorizeBB
+     << CodeGenOpts.UnrollLoops << CodeGenOpts.RerollLoops
+     << CodeGenOpts.getInlining();
+
+  for (const std::string &BackendOption : CodeGenOpts.BackendOptions)
+    OS << " " << BackendOption;
+
+  return OS.str();
+}
+
+// The instrumentation that the module may otherwise get is module-wide
+// and is not split.
+bool EmitAssemblyHelper::UsesHLIRJobs(BackendAction Action) const {
+  return UsesHLIRCache(Action) && LangOpts.Sanitize.empty() &&
+         !LangOpts.ObjCAutoRefCount && !CodeGenOpts.SanitizeCoverageType &&
+         !CodeGenOpts.SanitizeCoverageIndirectCalls &&
+         !CodeGenOpts.SanitizeCoverageTraceCmp &&
+         !CodeGenOpts.EmitGcovArcs && !CodeGenOpts.EmitGcovNotes &&
+         !CodeGenOpts.ProfileInstrGenerate &&
+         CodeGenOpts.SampleProfileFile.empty() &&
+         CodeGenOpts.RewriteMapFiles.empty();
+}
+
+// Runs on a thread of -ares-hlir-jobs, with M in a context of its own,
+// so it has a target machine of its own too, and only reads the options.
+void EmitAssemblyHelper::OptimizeHLIRBodies(Module &M) const {
+  std::unique_ptr<TargetMachine> BodyTM;
+  if (TM)
+    BodyTM.reset(TM->getTarget().createTargetMachine(
+        TM->getTargetTriple().str(), TM->getTargetCPU(),
+        TM->getTargetFeatureString(), TM->Options,
+        TM->getRelocationModel(), TM->getCodeModel(), TM->getOptLevel()));
+
+  PassManagerBuilder PMBuilder;
+  PMBuilder.OptLevel = CodeGenOpts.OptimizationLevel;
+  PMBuilder.SizeLevel = CodeGenOpts.OptimizeSize;
+  PMBuilder.BBVectorize = CodeGenOpts.VectorizeBB;
+  PMBuilder.SLPVectorize = CodeGenOpts.VectorizeSLP;
+  PMBuilder.LoopVectorize = CodeGenOpts.VectorizeLoop;
+  PMBuilder.DisableUnitAtATime = !CodeGenOpts.UnitAtATime;
+  PMBuilder.DisableUnrollLoops = !CodeGenOpts.UnrollLoops;
+  PMBuilder.RerollLoops = CodeGenOpts.RerollLoops;
+  addHLIRExtensions(PMBuilder);
+
+  Triple TargetTriple(M.getTargetTriple());
+  PMBuilder.LibraryInfo = createTLII(TargetTriple, CodeGenOpts);
+
+  switch (CodeGenOpts.getInlining()) {
+  case CodeGenOptions::NoInlining:
+    break;
+  case CodeGenOptions::NormalInlining:
+    PMBuilder.Inliner = createFunctionInliningPass(
+        CodeGenOpts.OptimizationLevel, CodeGenOpts.OptimizeSize);
+    break;
+  case CodeGenOptions::OnlyAlwaysInlining:
+    PMBuilder.Inliner = createAlwaysInlinerPass();
+    break;
+  }
+
+  TargetIRAnalysis TIRA =
+      BodyTM ? BodyTM->getTargetIRAnalysis() : TargetIRAnalysis();
+
+  legacy::FunctionPassManager FPM(&M);
+  FPM.add(createTargetTransformInfoWrapperPass(TIRA));
+  PMBuilder.populateFunctionPassManager(FPM);
+
+  legacy::PassManager MPM;
+  MPM.add(createTargetTransformInfoWrapperPass(TIRA));
+  PMBuilder.populateModulePassManager(MPM);
+
+  FPM.doInitialization();
+  for (Function &F : M)
+    if (!F.isDeclaration())
+      FPM.run(F);
+  FPM.doFinalization();
+
+  MPM.run(M);
+}
+
 TargetMachine *EmitAssemblyHelper::CreateTargetMachine(bool MustCreateTM) {
   // Create the TargetMachine for generating code.
   std::string Error;
@@ -617,7 +821,7 @@ void EmitAssemblyHelper::EmitAssembly(BackendAction Action,
     return;
   if (TM)
     TheModule->setDataLayout(TM->createDataLayout());
-  CreatePasses();
+  CreatePasses(Action);
 
   switch (Action) {
   case Backend_EmitNothing:
@@ -31,6 +31,8 @@
 // +====== ares =========================
 #include "hlir/HLIR.h"
 #include <iostream>
+#include <map>
+#include <set>
 #include <unordered_set>
 // ======================================
 
@@ -45,7 +47,10 @@ namespace{
 enum class ReduceType{
   None,
   Sum,
-  Product
+  Product,
+  BitAnd,
+  BitOr,
+  BitXor
 };
 
 class ParallelForVisitor : public StmtVisitor<ParallelForVisitor> {
@@ -95,12 +100,8 @@ public:
       break;
     }
 
-    if(reduceVar_){
-      if(auto dr = dyn_cast<DeclRefExpr>(S->getLHS())){
-        if(dr->getDecl() == reduceVar_){
-          reduceOps_.insert(S);
-        }
-      }
+    if(reduceVar_ && isReduceVar_(S->getLHS())){
+      reduceOps_.insert(S);
     }
 
     Visit(S->getLHS());
@@ -116,66 +117,770 @@ public:
       case UO_PostDec:
       case UO_PreInc:
       case UO_PreDec:
-        if(auto dr = dyn_cast<DeclRefExpr>(S->getSubExpr())){
-          if(dr->getDecl() == reduceVar_){
-            reduceOps_.insert(S);
-          }
+        if(isReduceVar_(S->getSubExpr())){
+          reduceOps_.insert(S);
         }
         break;
       default:
         break;
       }
     }
-  }
+  }
+
+  void VisitStmt(Stmt* S){
+    VisitChildren(S);
+  }
+
+  const auto& reduceOps(){
+    return reduceOps_;
+  }
+
+private:
+  using ReduceOpSet = std::unordered_set<const Stmt*>;
+
+  // the reduce variable itself, or an element of it if it is an array
+  bool isReduceVar_(const Expr* E) const{
+    E = E->IgnoreParenImpCasts();
+
+    while(auto as = dyn_cast<ArraySubscriptExpr>(E)){
+      E = as->getBase()->IgnoreParenImpCasts();
+    }
+
+    auto dr = dyn_cast<DeclRefExpr>(E);
+    return dr && dr->getDecl() == reduceVar_;
+  }
+
+  ReduceOpSet reduceOps_;
+
+  const VarDecl* reduceVar_;
+  OpType opType_ = OpType::None;
+};
+
+// the operator of a reduce variable from its updates in the body, all of
+// them must use the same one
+HLIRParallelReduce::ReduceOp inferReduceOp(const Stmt* body,
+                                           const VarDecl* vr){
+  ParallelForVisitor visitor(vr);
+  visitor.VisitStmt(const_cast<Stmt*>(body));
+
+  ReduceType reduceType = ReduceType::None;
+
+  for(auto op : visitor.reduceOps()){
+    ReduceType opType;
+
+    if(auto bo = dyn_cast<BinaryOperator>(op)){
+      switch(bo->getOpcode()){
+      case BO_AddAssign:
+      case BO_SubAssign:
+        opType = ReduceType::Sum;
+        break;
+      case BO_MulAssign:
+        opType = ReduceType::Product;
+        break;
+      case BO_AndAssign:
+        opType = ReduceType::BitAnd;
+        break;
+      case BO_OrAssign:
+        opType = ReduceType::BitOr;
+        break;
+      case BO_XorAssign:
+        opType = ReduceType::BitXor;
+        break;
+      default:
+        assert(false && "invalid reduce type");
+      }
+    }
+    else{
+      opType = ReduceType::Sum;
+    }
+
+    assert((reduceType == ReduceType::None || reduceType == opType) &&
+           "mixed reduce operators");
+
+    reduceType = opType;
+  }
+
+  switch(reduceType){
+  case ReduceType::Sum:
+    return HLIRParallelReduce::Sum;
+  case ReduceType::Product:
+    return HLIRParallelReduce::Product;
+  case ReduceType::BitAnd:
+    return HLIRParallelReduce::BitAnd;
+  case ReduceType::BitOr:
+    return HLIRParallelReduce::BitOr;
+  case ReduceType::BitXor:
+    return HLIRParallelReduce::BitXor;
+  default:
+    assert(false && "failed to find reduce operator");
+    return HLIRParallelReduce::Sum;
+  }
+}
+
+// finds the scalars declared outside of a Forall body that it only
+// updates, each with one associative compound assignment, increment or
+// decrement operator. Every iteration racing on them, the Forall is
+// emitted as a reduction of them instead.
+class ImplicitReduceVisitor : public StmtVisitor<ImplicitReduceVisitor> {
+public:
+  ImplicitReduceVisitor(const VarDecl* indexVar){
+    locals_.insert(indexVar);
+  }
+
+  void VisitStmt(Stmt* S){
+    for(Stmt::child_iterator I = S->child_begin(),
+        E = S->child_end(); I != E; ++I){
+      if(Stmt* child = *I){
+        Visit(child);
+      }
+    }
+  }
+
+  void VisitDeclStmt(DeclStmt* S){
+    for(Decl* d : S->decls()){
+      if(auto vd = dyn_cast<VarDecl>(d)){
+        locals_.insert(vd);
+      }
+    }
+
+    VisitStmt(S);
+  }
+
+  void VisitDeclRefExpr(DeclRefExpr* E){
+    if(auto vd = dyn_cast<VarDecl>(E->getDecl())){
+      Use_& u = use_(vd);
+      ++u.refs;
+    }
+  }
+
+  void VisitCompoundAssignOperator(CompoundAssignOperator* S){
+    ReduceType type;
+
+    switch(S->getOpcode()){
+    case BO_AddAssign:
+    case BO_SubAssign:
+      type = ReduceType::Sum;
+      break;
+    case BO_MulAssign:
+      type = ReduceType::Product;
+      break;
+    case BO_AndAssign:
+      type = ReduceType::BitAnd;
+      break;
+    case BO_OrAssign:
+      type = ReduceType::BitOr;
+      break;
+    case BO_XorAssign:
+      type = ReduceType::BitXor;
+      break;
+    default:
+      type = ReduceType::None;
+      break;
+    }
+
+    update_(S->getLHS(), type, S);
+    VisitStmt(S);
+  }
+
+  void VisitUnaryOperator(UnaryOperator* S){
+    if(S->isIncrementDecrementOp()){
+      update_(S->getSubExpr(), ReduceType::Sum, S);
+    }
+
+    VisitStmt(S);
+  }
+
+  // the variables to reduce, in the order they were first seen, with
+  // the first update of each
+  void reduceVars(std::vector<const VarDecl*>& vars,
+                  std::vector<const Stmt*>& updates) const{
+    for(const VarDecl* vd : order_){
+      const Use_& u = uses_.at(vd);
+
+      if(u.type == ReduceType::None || u.refs != u.updates ||
+         locals_.count(vd) > 0 || !vd->hasLocalStorage()){
+        continue;
+      }
+
+      QualType t = vd->getType();
+
+      if(t.isVolatileQualified() || t->isBooleanType() ||
+         t->isEnumeralType()){
+        continue;
+      }
+
+      bool bitwise = u.type != ReduceType::Sum &&
+        u.type != ReduceType::Product;
+
+      if(t->isIntegerType() || (!bitwise && t->isRealFloatingType())){
+        vars.push_back(vd);
+        updates.push_back(u.first);
+      }
+    }
+  }
+
+private:
+  struct Use_{
+    size_t refs = 0;
+    size_t updates = 0;
+    ReduceType type = ReduceType::None;
+    const Stmt* first = nullptr;
+  };
+
+  Use_& use_(const VarDecl* vd){
+    auto itr = uses_.find(vd);
+    if(itr == uses_.end()){
+      order_.push_back(vd);
+      itr = uses_.emplace(vd, Use_()).first;
+    }
+
+    return itr->second;
+  }
+
+  // an update of the variable itself, an element of an array or member
+  // counts as a read of it
+  void update_(const Expr* E, ReduceType type, const Stmt* S){
+    auto dr = dyn_cast<DeclRefExpr>(E->IgnoreParens());
+    if(!dr){
+      return;
+    }
+
+    auto vd = dyn_cast<VarDecl>(dr->getDecl());
+    if(!vd){
+      return;
+    }
+
+    Use_& u = use_(vd);
+
+    if(u.updates == 0){
+      u.type = type;
+      u.first = S;
+    }
+    else if(u.type != type){
+      u.type = ReduceType::None;
+    }
+
+    ++u.updates;
+  }
+
+  std::set<const VarDecl*> locals_;
+  std::map<const VarDecl*, Use_> uses_;
+  std::vector<const VarDecl*> order_;
+};
+
+// finds the pointer variables declared outside of a Forall body that it
+// reads, in the order they are first seen
+class CapturedPointerVisitor : public StmtVisitor<CapturedPointerVisitor> {
+public:
+  void VisitStmt(Stmt* S){
+    for(Stmt::child_iterator I = S->child_begin(),
+        E = S->child_end(); I != E; ++I){
+      if(Stmt* child = *I){
+        Visit(child);
+      }
+    }
+  }
+
+  void VisitDeclStmt(DeclStmt* S){
+    for(Decl* d : S->decls()){
+      if(auto vd = dyn_cast<VarDecl>(d)){
+        locals_.insert(vd);
+      }
+    }
+
+    VisitStmt(S);
+  }
+
+  void VisitDeclRefExpr(DeclRefExpr* E){
+    auto vd = dyn_cast<VarDecl>(E->getDecl());
+
+    if(vd && vd->hasLocalStorage() && vd->getType()->isPointerType() &&
+       locals_.count(vd) == 0 && seen_.insert(vd).second){
+      pointers_.push_back(vd);
+    }
+  }
+
+  const std::vector<const VarDecl*>& pointers() const{
+    return pointers_;
+  }
+
+private:
+  std::set<const VarDecl*> locals_;
+  std::set<const VarDecl*> seen_;
+  std::vector<const VarDecl*> pointers_;
+};
+
+// the file and line of loc, which the lowering names the outlined
+// body of the construct after
+void setConstructLocation(CodeGenModule& CGM, HLIRConstruct* c,
+                          SourceLocation loc){
+  PresumedLoc ploc = 
+    CGM.getContext().getSourceManager().getPresumedLoc(loc);
+
+  if(ploc.isValid()){
+    c->setLocation(ploc.getFilename(), ploc.getLine());
+  }
+}
+
+// ====================
+
+} // namespace
+
+// +===== ares ==============================
+void CodeGenFunction::EmitParallelFor(const CXXForRangeStmt& S,
+                                      unsigned dims, bool simd){
+  using namespace llvm;
+  using namespace std;
+  
+  auto& B = Builder;
+  LLVMContext& C = getLLVMContext();
+  
+  HLIRModule* mod = HLIRModule::getModule(&CGM.getModule());
+
+  mod->setName("Test");
+  mod->setLanguage("C++");
+  mod->setVersion("1.0");
+  
+  typedef vector<Value*> ValueVec;
+  typedef vector<llvm::Type*> TypeVec;
+
+  const Stmt* body = S.getBody();
+
+  const VarDecl* indexVar = S.getLoopVariable();
+
+  auto ds = dyn_cast<DeclStmt>(S.getRangeStmt());
+  assert(ds);
+
+  auto vd = dyn_cast<VarDecl>(ds->getSingleDecl());
+  assert(vd);
+
+  auto mt = dyn_cast<MaterializeTemporaryExpr>(vd->getAnyInitializer());
+  assert(mt);
+
+  auto ce = dyn_cast<CXXConstructExpr>(mt->GetTemporaryExpr());
+  if(!ce){
+    auto fc = dyn_cast<CXXFunctionalCastExpr>(mt->GetTemporaryExpr());
+    ce = dyn_cast<CXXConstructExpr>(fc->getSubExpr());
+  }
+
+  assert(ce);
+
+  // a distributed Forall runs the local indices of the share of this
+  // rank, each mapped to the global one by base + index * stride. The
+  // share is computed here, ahead of the body that uses it. A strided
+  // Forall is mapped the same way.
+  Value* distBase = nullptr;
+  Value* distStride = nullptr;
+  Value* distCount = nullptr;
+
+  if(dims == 1 && ce->getNumArgs() == 3){
+    QualType thirdType = ce->getArg(2)->getType();
+    auto rd = thirdType->getAsCXXRecordDecl();
+
+    if(thirdType->isIntegerType() && !thirdType->isEnumeralType()){
+      Value* start = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
+      Value* end = EmitAnyExprToTemp(ce->getArg(1)).getScalarVal();
+      Value* step = EmitAnyExprToTemp(ce->getArg(2)).getScalarVal();
+
+      Value* zero = ConstantInt::get(Int32Ty, 0);
+      Value* one = ConstantInt::get(Int32Ty, 1);
+
+      step = B.CreateSelect(B.CreateICmpEQ(step, zero), one, step, "step");
+
+      Value* span = B.CreateSelect(B.CreateICmpUGT(end, start),
+                                   B.CreateSub(end, start), zero);
+
+      // rounded up without overflowing near UINT32_MAX
+      Value* partial = B.CreateICmpNE(B.CreateURem(span, step), zero);
+      distCount = B.CreateAdd(B.CreateUDiv(span, step),
+                              B.CreateZExt(partial, Int32Ty), "step.count");
+      distBase = start;
+      distStride = step;
+    }
+    else if(rd && rd->getName() == "Distribute"){
+      Value* start = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
+      Value* end = EmitAnyExprToTemp(ce->getArg(1)).getScalarVal();
+      Value* dist = EmitLValue(ce->getArg(2)).getAddress().getPointer();
+
+      Address base = CreateTempAlloca(Int32Ty, CharUnits::fromQuantity(4),
+                                      "dist.base");
+      Address stride = CreateTempAlloca(Int32Ty, CharUnits::fromQuantity(4),
+                                        "dist.stride");
+
+      llvm::Function* f = 
+        mod->getFunction("__ares_distribute_range",
+                         {mod->voidPtrTy, Int32Ty, Int32Ty,
+                          Int32Ty->getPointerTo(), Int32Ty->getPointerTo()},
+                         Int32Ty);
+
+      distCount = 
+        B.CreateCall(f, {B.CreateBitCast(dist, mod->voidPtrTy), start, 
+                         end, base.getPointer(), stride.getPointer()},
+                     "dist.count");
+
+      distBase = B.CreateLoad(base);
+      distStride = B.CreateLoad(stride);
+    }
+  }
+
+  HLIRParallelFor* pfor;
+
+  // Forall2D / Forall3D take their extents followed by the tile sizes,
+  // these are evaluated here, before the body which uses them, and the
+  // range of the parallel for is over the tiles
+  Value* numTiles = nullptr;
+
+  if(dims > 1){
+    assert(ce->getNumArgs() == 2*dims && "invalid forall extents");
+
+    ValueVec extents;
+    ValueVec tiles;
+
+    Value* one = ConstantInt::get(Int32Ty, 1);
+
+    for(unsigned k = 0; k < dims; ++k){
+      Value* n = EmitAnyExprToTemp(ce->getArg(k)).getScalarVal();
+      Value* t = EmitAnyExprToTemp(ce->getArg(dims + k)).getScalarVal();
+      t = B.CreateSelect(B.CreateICmpEQ(t, ConstantInt::get(Int32Ty, 0)),
+                         one, t, "tile");
+
+      Value* count = B.CreateUDiv(B.CreateAdd(n, B.CreateSub(t, one)), t);
+      numTiles = numTiles ? B.CreateMul(numTiles, count) : count;
+
+      extents.push_back(n);
+      tiles.push_back(t);
+    }
+
+    auto indexType = cast<StructType>(ConvertTypeForMem(indexVar->getType()));
+    pfor = mod->createParallelFor(indexType, extents, tiles);
+  }
+  else{
+    pfor = mod->createParallelFor();
+  }
+
+  pfor->setSimd(simd);
+
+  setConstructLocation(CGM, pfor, S.getForLoc());
+
+  // the body only sees the values of the pointer variables it reads, so
+  // their align_value and restrict are passed on with their addresses
+  CapturedPointerVisitor pointerVisitor;
+  pointerVisitor.Visit(const_cast<Stmt*>(body));
+
+  for(const VarDecl* pv : pointerVisitor.pointers()){
+    auto itr = LocalDeclMap.find(pv);
+    if(itr == LocalDeclMap.end()){
+      continue;
+    }
+
+    const AlignValueAttr* attr = pv->getAttr<AlignValueAttr>();
+    if(!attr){
+      if(auto tt = dyn_cast<TypedefType>(pv->getType())){
+        attr = tt->getDecl()->getAttr<AlignValueAttr>();
+      }
+    }
+
+    uint64_t align = attr ?
+      attr->getAlignment()->EvaluateKnownConstInt(getContext()).getZExtValue() :
+      0;
+
+    bool noAlias = pv->getType().isRestrictQualified();
+
+    if(align > 0 || noAlias){
+      pfor->addPointer(itr->second.getPointer(), align, noAlias);
+    }
+  }
+  
+  BasicBlock* prevBlock = B.GetInsertBlock();
+  BasicBlock::iterator prevPoint = B.GetInsertPoint();
+  
+  if(!distCount){
+    setAddrOfLocalVar(indexVar, Address(pfor->index(), getPointerAlign()));
+  }
+
+  auto insertion = pfor->insertion();
+
+  auto par = insertion->getParent();
+  insertion->removeFromParent();
+
+  B.SetInsertPoint(par);
+  
+  auto prevAllocaPt = AllocaInsertPt;
+
+  llvm::Function* prevFn = CurFn;
+
+  CurFn = pfor->body();
+
+  AllocaInsertPt = pfor->argsInsertion();
+
+  if(distCount){
+    Address global = CreateTempAlloca(Int32Ty, CharUnits::fromQuantity(4),
+                                      "dist.index");
+    Value* local = 
+      B.CreateLoad(Address(pfor->index(), CharUnits::fromQuantity(4)));
+    B.CreateStore(B.CreateAdd(distBase, B.CreateMul(local, distStride)),
+                  global);
+    setAddrOfLocalVar(indexVar, global);
+  }
+
+  //LexicalScope TestScope(*this, body->getSourceRange());
+
+  EmitStmt(body);
+
+  auto exitBlock = pfor->exitBlock();
+
+  B.CreateBr(exitBlock);
+
+  CurFn = prevFn;
+
+  B.SetInsertPoint(prevBlock, prevPoint);
+
+  Value* start;
+  Value* end;
+
+  if(numTiles){
+    start = ConstantInt::get(Int32Ty, 0);
+    end = numTiles;
+  }
+  else if(distCount){
+    start = ConstantInt::get(Int32Ty, 0);
+    end = distCount;
+  }
+  else if(ce->getNumArgs() == 1){
+    start = ConstantInt::get(Int32Ty, 0);
+    end = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
+  }
+  else if(ce->getNumArgs() >= 2 && ce->getNumArgs() <= 5){
+    start = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
+    end = EmitAnyExprToTemp(ce->getArg(1)).getScalarVal();
+
+    // an ares::Priority comes last
+    unsigned numArgs = ce->getNumArgs();
+    const Expr* last = ce->getArg(numArgs - 1)->IgnoreParenImpCasts();
+
+    if(numArgs > 2 && last->getType()->isEnumeralType()){
+      pfor->setPriority(EmitScalarExpr(last));
+      --numArgs;
+    }
+
+    // then an ares::Schedule, whose kind and chunk are passed on
+    if(numArgs > 2){
+      const Expr* arg = ce->getArg(numArgs - 1);
+      auto rd = arg->getType()->getAsCXXRecordDecl();
+
+      if(rd && rd->getName() == "Schedule"){
+        Address sa = CreateMemTemp(arg->getType(), "schedule");
+        EmitAnyExprToMem(arg, sa, arg->getType().getQualifiers(), true);
+
+        Value* kind = 
+          B.CreateLoad(B.CreateStructGEP(sa, 0, CharUnits::Zero()));
+        Value* chunk = 
+          B.CreateLoad(B.CreateStructGEP(sa, 1, CharUnits::fromQuantity(4)));
+
+        pfor->setSchedule(kind, chunk);
+        --numArgs;
+      }
+    }
+
+    // the ares::Completion handles of a Forall that does not wait
+    if(numArgs > 2){
+      pfor->setCompletion(EmitLValue(ce->getArg(2)).getAddress().getPointer());
+    }
+
+    if(numArgs > 3){
+      pfor->setAfter(EmitLValue(ce->getArg(3)).getAddress().getPointer());
+    }
+  }
+  else{
+    assert(false && "invalid forall range");
+  }
+
+  pfor->setRange(start, end);
+  pfor->insert(B);
+
+  AllocaInsertPt = prevAllocaPt;
+  
+  //std::cout << *mod << std::endl;
+  //std::cout << "+++======================" << std::endl;
+  
+  //CGM.getModule().dump();
+
+  //pfor->body()->dump();
+}
+
+void CodeGenFunction::EmitParallelForBlocked(const CXXForRangeStmt& S){
+  using namespace llvm;
+
+  auto& B = Builder;
+
+  HLIRModule* mod = HLIRModule::getModule(&CGM.getModule());
+
+  auto ds = cast<DeclStmt>(S.getRangeStmt());
+  auto vd = cast<VarDecl>(ds->getSingleDecl());
+
+  auto mt = cast<MaterializeTemporaryExpr>(vd->getAnyInitializer());
+
+  // Forall::blocked(n, block) or ForallBlocked(n, block)
+  const Expr* nArg;
+  const Expr* blockArg;
+
+  if(auto call = dyn_cast<CallExpr>(mt->GetTemporaryExpr())){
+    assert(call->getNumArgs() == 2 && "invalid blocked forall");
+    nArg = call->getArg(0);
+    blockArg = call->getArg(1);
+  }
+  else{
+    auto ce = cast<CXXConstructExpr>(mt->GetTemporaryExpr());
+    assert(ce->getNumArgs() == 2 && "invalid blocked forall");
+    nArg = ce->getArg(0);
+    blockArg = ce->getArg(1);
+  }
+
+  Value* n = EmitAnyExprToTemp(nArg).getScalarVal();
+  Value* block = EmitAnyExprToTemp(blockArg).getScalarVal();
+
+  Value* zero = ConstantInt::get(Int32Ty, 0);
+  Value* one = ConstantInt::get(Int32Ty, 1);
+
+  block = B.CreateSelect(B.CreateICmpEQ(block, zero), one, block, "block");
+
+  Value* partial = B.CreateICmpNE(B.CreateURem(n, block), zero);
+  Value* numBlocks = B.CreateAdd(B.CreateUDiv(n, block),
+                                 B.CreateZExt(partial, Int32Ty), "blocks");
+
+  HLIRParallelFor* pfor = mod->createParallelFor();
+  setConstructLocation(CGM, pfor, S.getForLoc());
+
+  BasicBlock* prevBlock = B.GetInsertBlock();
+  BasicBlock::iterator prevPoint = B.GetInsertPoint();
+
+  auto insertion = pfor->insertion();
+
+  auto par = insertion->getParent();
+  insertion->removeFromParent();
+
+  B.SetInsertPoint(par);
+
+  auto prevAllocaPt = AllocaInsertPt;
+
+  llvm::Function* prevFn = CurFn;
+
+  CurFn = pfor->body();
+
+  AllocaInsertPt = pfor->argsInsertion();
+
+  // the SubRange of each block, the last one cut short at n
+  const VarDecl* rangeVar = S.getLoopVariable();
+
+  Address range = CreateMemTemp(rangeVar->getType(), "blocked.range");
+
+  Value* local =
+    B.CreateLoad(Address(pfor->index(), CharUnits::fromQuantity(4)));
+  Value* begin = B.CreateMul(local, block);
+  Value* end = B.CreateSelect(B.CreateICmpULT(B.CreateSub(n, begin), block),
+                              n, B.CreateAdd(begin, block));
+
+  CharUnits four = CharUnits::fromQuantity(4);
+  B.CreateStore(begin, B.CreateStructGEP(range, 0, CharUnits::Zero()));
+  B.CreateStore(end, B.CreateStructGEP(range, 1, four));
+
+  setAddrOfLocalVar(rangeVar, range);
+
+  EmitStmt(S.getBody());
+
+  B.CreateBr(pfor->exitBlock());
+
+  CurFn = prevFn;
+
+  B.SetInsertPoint(prevBlock, prevPoint);
+
+  pfor->setRange(zero, numBlocks);
+  pfor->insert(B);
+
+  AllocaInsertPt = prevAllocaPt;
+}
+
+void CodeGenFunction::EmitParallelForEach(const CXXForRangeStmt& S,
+                                          bool elements){
+  using namespace llvm;
+
+  auto& B = Builder;
+
+  HLIRModule* mod = HLIRModule::getModule(&CGM.getModule());
+
+  LexicalScope ForScope(*this, S.getSourceRange());
+
+  // the first element or index, and the number of them as an i64
+  Value* first;
+  Value* count;
+  const VarDecl* beginVar = nullptr;
+
+  if(elements){
+    // ForallEach::begin() and end() are pointers into the storage
+    EmitStmt(S.getRangeStmt());
+    EmitStmt(S.getBeginEndStmt());
+
+    auto di = S.getBeginEndStmt()->decl_begin();
+    beginVar = cast<VarDecl>(*di);
+    auto endVar = cast<VarDecl>(*++di);
+
+    first = B.CreateLoad(GetAddrOfLocalVar(beginVar));
+    count = B.CreatePtrDiff(B.CreateLoad(GetAddrOfLocalVar(endVar)), first);
+  }
+  else{
+    auto ds = cast<DeclStmt>(S.getRangeStmt());
+    auto vd = cast<VarDecl>(ds->getSingleDecl());
+
+    auto mt = cast<MaterializeTemporaryExpr>(vd->getAnyInitializer());
+
+    auto ce = dyn_cast<CXXConstructExpr>(mt->GetTemporaryExpr());
+    if(!ce){
+      auto fc = cast<CXXFunctionalCastExpr>(mt->GetTemporaryExpr());
+      ce = cast<CXXConstructExpr>(fc->getSubExpr());
+    }
 
-  void VisitStmt(Stmt* S){
-    VisitChildren(S);
-  }
+    Value* end;
 
-  const auto& reduceOps(){
-    return reduceOps_;
-  }
+    if(ce->getNumArgs() == 1){
+      first = ConstantInt::get(Int64Ty, 0);
+      end = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
+    }
+    else{
+      assert(ce->getNumArgs() == 2 && "invalid forall range");
+      first = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
+      end = EmitAnyExprToTemp(ce->getArg(1)).getScalarVal();
+    }
 
-private:
-  using ReduceOpSet = std::unordered_set<const Stmt*>;
+    count = B.CreateSelect(B.CreateICmpULT(first, end),
+                           B.CreateSub(end, first),
+                           ConstantInt::get(Int64Ty, 0));
+  }
 
-  ReduceOpSet reduceOps_;
+  // the runtime splits 32-bit ranges, so the range is run as parallel
+  // fors of up to 2^30 iterations, each offset by base
+  Value* chunk = ConstantInt::get(Int64Ty, 1 << 30);
 
-  const VarDecl* reduceVar_;
-  OpType opType_ = OpType::None;
-};
+  Address baseAddr =
+    CreateTempAlloca(Int64Ty, CharUnits::fromQuantity(8), "each.base");
+  B.CreateStore(ConstantInt::get(Int64Ty, 0), baseAddr);
 
-// ====================
+  llvm::BasicBlock* condBlock = createBasicBlock("each.cond");
+  llvm::BasicBlock* loopBlock = createBasicBlock("each.loop");
+  llvm::BasicBlock* endBlock = createBasicBlock("each.end");
 
-} // namespace
+  EmitBlock(condBlock);
+  Value* base = B.CreateLoad(baseAddr, "each.base");
+  B.CreateCondBr(B.CreateICmpULT(base, count), loopBlock, endBlock);
 
-// +===== ares ==============================
-void CodeGenFunction::EmitParallelFor(const CXXForRangeStmt& S){
-  using namespace llvm;
-  using namespace std;
-  
-  auto& B = Builder;
-  LLVMContext& C = getLLVMContext();
-  
-  HLIRModule* mod = HLIRModule::getModule(&CGM.getModule());
+  EmitBlock(loopBlock);
+  Value* rest = B.CreateSub(count, base);
+  Value* n = B.CreateSelect(B.CreateICmpULT(rest, chunk), rest, chunk);
 
-  mod->setName("Test");
-  mod->setLanguage("C++");
-  mod->setVersion("1.0");
-  
   HLIRParallelFor* pfor = mod->createParallelFor();
-  
-  typedef vector<Value*> ValueVec;
-  typedef vector<llvm::Type*> TypeVec;
-
-  const Stmt* body = S.getBody();
+  setConstructLocation(CGM, pfor, S.getForLoc());
 
-  const VarDecl* indexVar = S.getLoopVariable();
-  
   BasicBlock* prevBlock = B.GetInsertBlock();
   BasicBlock::iterator prevPoint = B.GetInsertPoint();
-  
-  setAddrOfLocalVar(indexVar, Address(pfor->index(), getPointerAlign()));
 
   auto insertion = pfor->insertion();
 
@@ -183,7 +888,7 @@ void CodeGenFunction::EmitParallelFor(const CXXForRangeStmt& S){
   insertion->removeFromParent();
 
   B.SetInsertPoint(par);
-  
+
   auto prevAllocaPt = AllocaInsertPt;
 
   llvm::Function* prevFn = CurFn;
@@ -192,64 +897,96 @@ void CodeGenFunction::EmitParallelFor(const CXXForRangeStmt& S){
 
   AllocaInsertPt = pfor->argsInsertion();
 
-  //LexicalScope TestScope(*this, body->getSourceRange());
+  Value* local =
+    B.CreateLoad(Address(pfor->index(), CharUnits::fromQuantity(4)));
+  Value* index = B.CreateAdd(base, B.CreateZExt(local, Int64Ty));
 
-  EmitStmt(body);
+  if(elements){
+    // the loop variable is initialized from *__begin as in the serial
+    // loop, with __begin at the element of this iteration
+    Address itr = CreateTempAlloca(first->getType(), getPointerAlign(),
+                                   "each.itr");
+    B.CreateStore(B.CreateInBoundsGEP(first, index), itr);
 
-  auto exitBlock = pfor->exitBlock();
+    LocalDeclMap.erase(beginVar);
+    setAddrOfLocalVar(beginVar, itr);
 
-  B.CreateBr(exitBlock);
+    EmitStmt(S.getLoopVarStmt());
+  }
+  else{
+    Address global = CreateTempAlloca(Int64Ty, CharUnits::fromQuantity(8),
+                                      "each.index");
+    B.CreateStore(B.CreateAdd(first, index), global);
+    setAddrOfLocalVar(S.getLoopVariable(), global);
+  }
+
+  EmitStmt(S.getBody());
+
+  B.CreateBr(pfor->exitBlock());
 
   CurFn = prevFn;
 
   B.SetInsertPoint(prevBlock, prevPoint);
 
-  auto ds = dyn_cast<DeclStmt>(S.getRangeStmt());
-  assert(ds);
+  pfor->setRange(ConstantInt::get(Int32Ty, 0), B.CreateTrunc(n, Int32Ty));
+  pfor->insert(B);
 
-  auto vd = dyn_cast<VarDecl>(ds->getSingleDecl());
-  assert(vd);
+  AllocaInsertPt = prevAllocaPt;
 
-  auto mt = dyn_cast<MaterializeTemporaryExpr>(vd->getAnyInitializer());
-  assert(mt);
+  B.CreateStore(B.CreateAdd(base, chunk), baseAddr);
+  EmitBranch(condBlock);
 
-  auto ce = dyn_cast<CXXConstructExpr>(mt->GetTemporaryExpr());
-  if(!ce){
-    auto fc = dyn_cast<CXXFunctionalCastExpr>(mt->GetTemporaryExpr());
-    ce = dyn_cast<CXXConstructExpr>(fc->getSubExpr());
+  EmitBlock(endBlock, true);
+}
+
+// the call of ares::reduction() that a Forall is constructed with as
+// its last arg, whose args are the reduce variables it declares
+static const CallExpr* getForallReduction(const CXXForRangeStmt& S){
+  auto ds = dyn_cast<DeclStmt>(S.getRangeStmt());
+  auto vd = ds ? dyn_cast_or_null<VarDecl>(ds->getSingleDecl()) : nullptr;
+  auto mt = vd ?
+    dyn_cast_or_null<MaterializeTemporaryExpr>(vd->getAnyInitializer()) :
+    nullptr;
+
+  auto ce = mt ? dyn_cast<CXXConstructExpr>(mt->GetTemporaryExpr()) : nullptr;
+  if(!ce && mt){
+    if(auto fc = dyn_cast<CXXFunctionalCastExpr>(mt->GetTemporaryExpr())){
+      ce = dyn_cast<CXXConstructExpr>(fc->getSubExpr());
+    }
   }
 
-  assert(ce);
+  if(!ce || ce->getNumArgs() < 2){
+    return nullptr;
+  }
 
-  Value* start;
-  Value* end;
+  const Expr* e = ce->getArg(ce->getNumArgs() - 1);
 
-  if(ce->getNumArgs() == 1){
-    start = ConstantInt::get(Int32Ty, 0);
-    end = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
-  }
-  else if(ce->getNumArgs() == 2){
-    start = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
-    end = EmitAnyExprToTemp(ce->getArg(1)).getScalarVal();
-  }
-  else{
-    assert(false && "invalid forall range");
+  for(;;){
+    e = e->IgnoreParenImpCasts();
+
+    if(auto me = dyn_cast<MaterializeTemporaryExpr>(e)){
+      e = me->GetTemporaryExpr();
+    }
+    else if(auto te = dyn_cast<CXXBindTemporaryExpr>(e)){
+      e = te->getSubExpr();
+    }
+    else{
+      break;
+    }
   }
 
-  pfor->setRange(start, end);
-  pfor->insert(B);
+  auto call = dyn_cast<CallExpr>(e);
+  const FunctionDecl* fd = call ? call->getDirectCallee() : nullptr;
 
-  AllocaInsertPt = prevAllocaPt;
-  
-  //std::cout << *mod << std::endl;
-  //std::cout << "+++======================" << std::endl;
-  
-  //CGM.getModule().dump();
+  if(!fd || !fd->getIdentifier() || fd->getName() != "reduction"){
+    return nullptr;
+  }
 
-  //pfor->body()->dump();
+  return call;
 }
 
-void CodeGenFunction::EmitParallelReduce(const CXXForRangeStmt& S){
+void CodeGenFunction::EmitParallelReduce(const CXXForRangeStmt& S, bool scan,
+                                      ArrayRef<const VarDecl*> implicitVars){
   using namespace llvm;
   using namespace std;
   
@@ -266,32 +1003,135 @@ void CodeGenFunction::EmitParallelReduce(const CXXForRangeStmt& S){
   assert(mt);
 
   auto ce = dyn_cast<CXXConstructExpr>(mt->GetTemporaryExpr());
+  if(!ce){
+    auto fc = dyn_cast<CXXFunctionalCastExpr>(mt->GetTemporaryExpr());
+    ce = dyn_cast<CXXConstructExpr>(fc->getSubExpr());
+  }
+
   assert(ce);
-  assert(ce->getNumArgs() == 3);
 
+  // a Forall whose reduce variables were found in its body or declared
+  // by a reduction() after its range, which is (end) or (start, end) of
+  // 32-bit indices
+  bool implicit = !implicitVars.empty();
+
+  const CallExpr* reduction = implicit ? getForallReduction(S) : nullptr;
+
+  unsigned numRangeArgs = ce->getNumArgs() - (reduction ? 1 : 0);
+
+  assert((implicit || ce->getNumArgs() >= 3) && "invalid reduce args");
+
+  // an ares::ReduceOp or combiner function as the fourth arg applies to
+  // a single reduce variable, otherwise every arg after the range is a
+  // reduce variable whose operator is inferred from the body. A scan
+  // takes its variable and output array, then an optional ares::ReduceOp
+  // and ares::ScanKind.
+  const Expr* opArg = nullptr;
+  const Expr* outArg = nullptr;
+  const Expr* kindArg = nullptr;
+
+  if(scan){
+    assert(ce->getNumArgs() >= 4 && "invalid scan args");
+
+    outArg = ce->getArg(3);
+
+    for(unsigned i = 4; i < ce->getNumArgs(); ++i){
+      const Expr* e = ce->getArg(i)->IgnoreParenImpCasts();
+
+      auto et = e->getType()->getAs<EnumType>();
+      assert(et && "invalid scan args");
+
+      if(et->getDecl()->getName() == "ScanKind"){
+        kindArg = e;
+      }
+      else{
+        opArg = e;
+      }
+    }
+  }
+  else if(reduction && reduction->getNumArgs() == 2 &&
+          reduction->getArg(1)->getType()->isEnumeralType()){
+    opArg = reduction->getArg(1)->IgnoreParenImpCasts();
+  }
+  else if(!implicit && ce->getNumArgs() == 4){
+    const Expr* e = ce->getArg(3)->IgnoreParenImpCasts();
+    QualType et = e->getType();
+    if(et->isEnumeralType() || et->isFunctionType() ||
+       et->isFunctionPointerType()){
+      opArg = e;
+    }
+  }
+
+  vector<const VarDecl*> vars;
+  vector<QualType> varTypes;
+  vector<llvm::Type*> types;
+
+  // arrays too large to privatize for each partial are updated in place
+  vector<const VarDecl*> sharedVars;
+  vector<QualType> sharedTypes;
+
+  for(const VarDecl* vr : implicitVars){
+    vars.push_back(vr);
+    varTypes.push_back(vr->getType());
+    types.push_back(ConvertTypeForMem(vr->getType()));
+  }
+
+  unsigned numVarArgs = implicit ? 0 : opArg || scan ? 3 : ce->getNumArgs();
+
+  for(unsigned i = 2; i < numVarArgs; ++i){
+    auto dr = dyn_cast<DeclRefExpr>(ce->getArg(i)->IgnoreParenImpCasts());
+    assert(dr && "reduce variable must be a local variable");
+
+    auto vr = dyn_cast<VarDecl>(dr->getDecl());
+    assert(vr && "reduce variable must be a local variable");
+
+    QualType vt = ce->getArg(i)->getType().getNonReferenceType();
+
+    if(!scan && vt->isConstantArrayType() &&
+       getContext().getTypeSizeInChars(vt).getQuantity() >
+       int64_t(HLIRParallelReduce::maxPrivateArrayBytes)){
+      sharedVars.push_back(vr);
+      sharedTypes.push_back(vt);
+      continue;
+    }
+
+    vars.push_back(vr);
+    varTypes.push_back(vt);
+    types.push_back(ConvertTypeForMem(vt));
+  }
   
   HLIRModule* mod = HLIRModule::getModule(&CGM.getModule());
 
   mod->setName("Test");
   mod->setLanguage("C++");
   mod->setVersion("1.0");
-  
-  llvm::Type* rt = ConvertType(ce->getArg(2)->getType().getNonReferenceType());
 
-  HLIRParallelReduce* r = mod->createParallelReduce(rt);
+  HLIRParallelScan* sr = scan ? mod->createParallelScan(types[0]) : nullptr;
+
+  HLIRParallelReduce* r = sr ? sr : mod->createParallelReduce(types);
+
+  setConstructLocation(CGM, r, S.getForLoc());
+
+  if(kindArg){
+    sr->setExclusive(kindArg->EvaluateKnownConstInt(getContext()) != 0);
+  }
+
+  vector<Address> oldAddrs;
 
-  auto dr = dyn_cast<DeclRefExpr>(ce->getArg(2));
-  assert(dr);
+  for(size_t i = 0; i < vars.size(); ++i){
+    const VarDecl* vr = vars[i];
 
-  auto vr = dyn_cast<VarDecl>(dr->getDecl());
-  assert(vr);
+    r->setSigned(i, 
+      getContext().getBaseElementType(varTypes[i])->isSignedIntegerType());
 
-  Address oldVR = GetAddrOfLocalVar(vr);
+    Address oldVR = GetAddrOfLocalVar(vr);
+    oldAddrs.push_back(oldVR);
 
-  r->setReduceResult(oldVR.getPointer());
+    r->setReduceResult(i, oldVR.getPointer());
 
-  LocalDeclMap.erase(vr);
-  setAddrOfLocalVar(vr, aresAddr(r->reduceVar()));
+    LocalDeclMap.erase(vr);
+    setAddrOfLocalVar(vr, aresAddr(r->reduceVar(i)));
+  }
   
   typedef vector<Value*> ValueVec;
   typedef vector<llvm::Type*> TypeVec;
@@ -303,55 +1143,73 @@ void CodeGenFunction::EmitParallelReduce(const CXXForRangeStmt& S){
   BasicBlock* prevBlock = B.GetInsertBlock();
   BasicBlock::iterator prevPoint = B.GetInsertPoint();
   
-  setAddrOfLocalVar(indexVar, Address(r->index(), getPointerAlign()));
-  
   B.SetInsertPoint(r->insertion());
   
   auto prevAllocaPt = AllocaInsertPt;
 
   AllocaInsertPt = r->entry();
 
+  // the index of a reduction is 64-bit, that of a Forall is not
+  if(implicit){
+    Address index = CreateTempAlloca(Int32Ty, CharUnits::fromQuantity(4),
+                                     "forall.index");
+    Value* index64 =
+      B.CreateLoad(Address(r->index(), CharUnits::fromQuantity(8)));
+    B.CreateStore(B.CreateTrunc(index64, Int32Ty), index);
+    setAddrOfLocalVar(indexVar, index);
+  }
+  else{
+    setAddrOfLocalVar(indexVar, Address(r->index(), getPointerAlign()));
+  }
+
   //r->insertion()->dump();
 
   //LexicalScope TestScope(*this, body->getSourceRange());
 
-  ParallelForVisitor visitor(vr);
-  visitor.VisitStmt(const_cast<Stmt*>(body));
+  // an explicit operator applies to the single reduce variable, which
+  // may be a shared array
+  auto reduceOp = [&](const VarDecl* vr){
+    if(opArg && opArg->getType()->isEnumeralType()){
+      llvm::APSInt op = opArg->EvaluateKnownConstInt(getContext());
+      return HLIRParallelReduce::ReduceOp(op.getZExtValue());
+    }
 
-  ReduceType reduceType = ReduceType::None;
+    return inferReduceOp(body, vr);
+  };
 
-  for(auto op : visitor.reduceOps()){
-    if(auto bo = dyn_cast<BinaryOperator>(op)){
-      if(bo->getOpcode() == BO_AddAssign){
-        
-        assert(reduceType == ReduceType::None || 
-               reduceType == ReduceType::Sum);
-        
-        reduceType = ReduceType::Sum;
-      }
-      else if(bo->getOpcode() == BO_MulAssign){
+  for(size_t i = 0; i < sharedVars.size(); ++i){
+    assert((!opArg || opArg->getType()->isEnumeralType()) &&
+           "a shared reduce array cannot use a combiner");
 
-        assert(reduceType == ReduceType::None || 
-               reduceType == ReduceType::Product);
+    QualType et = getContext().getBaseElementType(sharedTypes[i]);
 
-        reduceType = ReduceType::Product;
-      }
-      else{
-        assert(false && "invalid reduce type");
-      }
-    }
-    else if(auto uo = dyn_cast<UnaryOperator>(op)){
-      (void)uo;
-      assert(reduceType == ReduceType::None || 
-             reduceType == ReduceType::Sum);
-      
-      reduceType = ReduceType::Sum;
-    }
+    r->addAtomicTarget(GetAddrOfLocalVar(sharedVars[i]).getPointer(),
+                       reduceOp(sharedVars[i]), et->isSignedIntegerType());
   }
 
-  assert(reduceType != ReduceType::None && "failed to find reduce operator");
+  if(opArg && !vars.empty()){
+    if(opArg->getType()->isEnumeralType()){
+      r->setOp(0, reduceOp(vars[0]));
+    }
+    else{
+      auto fr = dyn_cast<DeclRefExpr>(opArg);
+      assert(fr && "reduce combiner must name a function");
+
+      auto fd = dyn_cast<FunctionDecl>(fr->getDecl());
+      assert(fd && "reduce combiner must name a function");
+
+      auto cf = 
+        dyn_cast<llvm::Function>(CGM.GetAddrOfFunction(fd)->stripPointerCasts());
+      assert(cf);
 
-  r->setSum(reduceType == ReduceType::Sum);
+      r->setCombiner(cf);
+    }
+  }
+  else{
+    for(size_t i = 0; i < vars.size(); ++i){
+      r->setOp(i, reduceOp(vars[i]));
+    }
+  }
 
   EmitStmt(body);
 
@@ -359,16 +1217,92 @@ void CodeGenFunction::EmitParallelReduce(const CXXForRangeStmt& S){
 
   AllocaInsertPt = prevAllocaPt;
 
-  LocalDeclMap.erase(vr);
-  setAddrOfLocalVar(vr, oldVR);
+  for(size_t i = 0; i < vars.size(); ++i){
+    LocalDeclMap.erase(vars[i]);
+    setAddrOfLocalVar(vars[i], oldAddrs[i]);
+  }
+
+  Value* start;
+  Value* end;
+
+  if(implicit && numRangeArgs == 1){
+    start = ConstantInt::get(Int64Ty, 0);
+    end = B.CreateZExt(EmitAnyExprToTemp(ce->getArg(0)).getScalarVal(),
+                       Int64Ty);
+  }
+  else{
+    start = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
+    end = EmitAnyExprToTemp(ce->getArg(1)).getScalarVal();
 
-  Value* start = EmitAnyExprToTemp(ce->getArg(0)).getScalarVal();
-  Value* end = EmitAnyExprToTemp(ce->getArg(1)).getScalarVal();
+    if(implicit){
+      start = B.CreateZExt(start, Int64Ty);
+      end = B.CreateZExt(end, Int64Ty);
+    }
+  }
   //Value* var = EmitAnyExprToTemp(ce->getArg(2)).getScalarVal();
 
   r->setRange(start, end);
+
+  // the reduction replaces the value of its variables, where a Forall
+  // updated the value they held before it
+  vector<Value*> initVals;
+
+  for(size_t i = 0; implicit && i < vars.size(); ++i){
+    initVals.push_back(B.CreateLoad(oldAddrs[i], "reduce.before"));
+  }
+
+  if(sr){
+    sr->setOutput(EmitAnyExprToTemp(outArg).getScalarVal());
+  }
   //r->setVar(var);
   r->insert(B);
+
+  for(size_t i = 0; i < initVals.size(); ++i){
+    Value* init = initVals[i];
+    Value* v = B.CreateLoad(oldAddrs[i]);
+    bool fp = v->getType()->isFloatingPointTy();
+
+    bool sign = r->isSigned(i);
+
+    switch(r->op(i)){
+    case HLIRParallelReduce::Product:
+      v = fp ? B.CreateFMul(init, v) : B.CreateMul(init, v);
+      break;
+    case HLIRParallelReduce::Min:
+      v = B.CreateSelect(fp ? B.CreateFCmpOLT(v, init) :
+                         sign ? B.CreateICmpSLT(v, init) :
+                         B.CreateICmpULT(v, init), v, init);
+      break;
+    case HLIRParallelReduce::Max:
+      v = B.CreateSelect(fp ? B.CreateFCmpOGT(v, init) :
+                         sign ? B.CreateICmpSGT(v, init) :
+                         B.CreateICmpUGT(v, init), v, init);
+      break;
+    case HLIRParallelReduce::And:
+    case HLIRParallelReduce::Or:{
+      Value* zero = Constant::getNullValue(v->getType());
+      Value* a = B.CreateICmpNE(init, zero);
+      Value* b = B.CreateICmpNE(v, zero);
+      v = B.CreateZExt(r->op(i) == HLIRParallelReduce::And ?
+                       B.CreateAnd(a, b) : B.CreateOr(a, b), v->getType());
+      break;
+    }
+    case HLIRParallelReduce::BitAnd:
+      v = B.CreateAnd(init, v);
+      break;
+    case HLIRParallelReduce::BitOr:
+      v = B.CreateOr(init, v);
+      break;
+    case HLIRParallelReduce::BitXor:
+      v = B.CreateXor(init, v);
+      break;
+    default:
+      v = fp ? B.CreateFAdd(init, v) : B.CreateAdd(init, v);
+      break;
+    }
+
+    B.CreateStore(v, oldAddrs[i]);
+  }
   
   //std::cout << *mod << std::endl;
   
@@ -1213,26 +2147,153 @@ void CodeGenFunction::EmitForStmt(const ForStmt &S,
   EmitBlock(LoopExit.getBlock(), true);
 }
 
+// +====== ares =============================
+void
+CodeGenFunction::FindImplicitReduceVars(const CXXForRangeStmt& S,
+                                        std::vector<const VarDecl*>& vars){
+  ImplicitReduceVisitor visitor(S.getLoopVariable());
+  visitor.Visit(const_cast<Stmt*>(S.getBody()));
+
+  std::vector<const Stmt*> updates;
+  visitor.reduceVars(vars, updates);
+
+  if(vars.empty()){
+    return;
+  }
+
+  // only a Forall over (end) or (start, end) runs as a reduction, the
+  // others with a schedule, completion or distribution are left racing
+  auto ds = cast<DeclStmt>(S.getRangeStmt());
+  auto vd = cast<VarDecl>(ds->getSingleDecl());
+  auto mt = dyn_cast<MaterializeTemporaryExpr>(vd->getAnyInitializer());
+
+  auto ce = mt ? dyn_cast<CXXConstructExpr>(mt->GetTemporaryExpr()) : nullptr;
+  if(!ce && mt){
+    if(auto fc = dyn_cast<CXXFunctionalCastExpr>(mt->GetTemporaryExpr())){
+      ce = dyn_cast<CXXConstructExpr>(fc->getSubExpr());
+    }
+  }
+
+  bool reduce = ce && ce->getNumArgs() >= 1 && ce->getNumArgs() <= 2;
+
+  DiagnosticsEngine& diags = CGM.getDiags();
+
+  unsigned id = reduce ?
+    diags.getCustomDiagID(DiagnosticsEngine::Warning,
+                          "every iteration of the Forall updates %0, "
+                          "which is reduced over private copies instead") :
+    diags.getCustomDiagID(DiagnosticsEngine::Warning,
+                          "every iteration of the Forall updates %0, "
+                          "which races, use a ReduceAll");
+
+  for(size_t i = 0; i < vars.size(); ++i){
+    diags.Report(updates[i]->getLocStart(), id) << vars[i];
+  }
+
+  if(!reduce){
+    vars.clear();
+  }
+}
+
+StringRef CodeGenFunction::GetAresRangeClass(const CXXForRangeStmt& S){
+  auto ds = dyn_cast<DeclStmt>(S.getRangeStmt());
+  if(!ds){
+    return "";
+  }
+
+  auto vd = dyn_cast_or_null<VarDecl>(ds->getSingleDecl());
+  if(!vd){
+    return "";
+  }
+
+  // the record the range variable has after desugaring, so the construct
+  // is found in headers and template instantiations alike
+  const CXXRecordDecl* rd =
+    vd->getType().getNonReferenceType()->getAsCXXRecordDecl();
+
+  if(!rd || !rd->getIdentifier()){
+    return "";
+  }
+
+  auto ns = dyn_cast<NamespaceDecl>(rd->getDeclContext()->getRedeclContext());
+
+  if(!ns || ns->getName() != "ares" ||
+     !ns->getParent()->getRedeclContext()->isTranslationUnit()){
+    return "";
+  }
+
+  return rd->getName();
+}
+// ===========================================
+
 void
 CodeGenFunction::EmitCXXForRangeStmt(const CXXForRangeStmt &S,
                                      ArrayRef<const Attr *> ForAttrs) {
 
   // +====== ares =============================
-  if(isMainStmt(&S)){
-    if(auto ds = dyn_cast<DeclStmt>(S.getRangeStmt())){
-      if(auto vd = dyn_cast_or_null<VarDecl>(ds->getSingleDecl())){
-        std::string name = vd->getType().getNonReferenceType().getAsString();
-
-        if(name == "class ares::Forall"){
-          EmitParallelFor(S);
-          return;
-        }
-        else if(name == "class ares::ReduceAll"){
-          EmitParallelReduce(S);
-          return;
+  StringRef name = GetAresRangeClass(S);
+
+  if(name == "Forall"){
+    std::vector<const VarDecl*> reduceVars;
+
+    if(const CallExpr* reduction = getForallReduction(S)){
+      for(const Expr* arg : reduction->arguments()){
+        if(arg->getType()->isEnumeralType()){
+          continue;
         }
+
+        auto dr = dyn_cast<DeclRefExpr>(arg->IgnoreParenImpCasts());
+        auto vr = dr ? dyn_cast<VarDecl>(dr->getDecl()) : nullptr;
+        assert(vr && vr->hasLocalStorage() &&
+               vr->getType()->isScalarType() &&
+               "reduce variable must be a local scalar");
+
+        reduceVars.push_back(vr);
       }
     }
+    else{
+      FindImplicitReduceVars(S, reduceVars);
+    }
+
+    if(reduceVars.empty()){
+      EmitParallelFor(S);
+    }
+    else{
+      EmitParallelReduce(S, false, reduceVars);
+    }
+    return;
+  }
+  else if(name == "ForallSimd"){
+    EmitParallelFor(S, 1, true);
+    return;
+  }
+  else if(name == "Forall2D"){
+    EmitParallelFor(S, 2);
+    return;
+  }
+  else if(name == "Forall3D"){
+    EmitParallelFor(S, 3);
+    return;
+  }
+  else if(name == "ForallBlocked"){
+    EmitParallelForBlocked(S);
+    return;
+  }
+  else if(name == "ForallEach"){
+    EmitParallelForEach(S, true);
+    return;
+  }
+  else if(name == "Forall64"){
+    EmitParallelForEach(S, false);
+    return;
+  }
+  else if(name == "ReduceAll"){
+    EmitParallelReduce(S);
+    return;
+  }
+  else if(name == "ScanAll"){
+    EmitParallelReduce(S, true);
+    return;
   }
   // ===========================================
 
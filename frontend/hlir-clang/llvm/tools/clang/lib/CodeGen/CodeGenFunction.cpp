@@ -697,13 +697,91 @@ void CodeGenFunction::StartFunction(GlobalDecl GD,
     } else if (!FD->hasAttr<AlwaysInlineAttr>())
       Fn->addFnAttr(llvm::Attribute::NoInline);
     
-    if(FD->isTask()){
+    // a task returning a class in memory would have its caller read the
+    // result before the task has written it, so it runs as a plain call
+    bool indirectRet = FnInfo.getReturnInfo().isIndirect();
+
+    if(FD->isTask() && indirectRet){
+      DiagnosticsEngine& diags = CGM.getDiags();
+      unsigned id =
+        diags.getCustomDiagID(DiagnosticsEngine::Warning,
+                              "task %0 returns its result in memory and is "
+                              "called without spawning");
+      diags.Report(FD->getLocation(), id) << FD;
+    }
+
+    if(FD->isTask() && !indirectRet){
       using namespace ares;
 
       HLIRModule* module = HLIRModule::getModule(&CGM.getModule());
 
       HLIRTask* task = module->createTask();
       task->setFunction(Fn);
+
+      PresumedLoc ploc = 
+        getContext().getSourceManager().getPresumedLoc(FD->getLocation());
+      if(ploc.isValid()){
+        task->setLocation(ploc.getFilename(), ploc.getLine());
+      }
+
+      // __attribute__((annotate("ares_priority=N"))) sets the priority
+      // of the spawned calls, annotate("ares_stack=N") the bytes of stack
+      // they run on as user level threads, with an optional k or m
+      // suffix, enough for them and the calls they run while waiting,
+      // and annotate("ares_memoize") has calls with the same arguments
+      // share the result of the first
+      for(const AnnotateAttr* A : FD->specific_attrs<AnnotateAttr>()){
+        StringRef s = A->getAnnotation();
+        if(s == "ares_memoize"){
+          task->setMemoize(true);
+        }
+
+        StringRef prefix = "ares_priority=";
+        uint32_t priority;
+        if(s.startswith(prefix) && 
+           !s.substr(prefix.size()).getAsInteger(10, priority)){
+          task->setPriority(priority);
+        }
+
+        StringRef stackPrefix = "ares_stack=";
+        if(s.startswith(stackPrefix)){
+          StringRef value = s.substr(stackPrefix.size());
+          unsigned shift = 0;
+          if(value.endswith_lower("k")){
+            shift = 10;
+          }
+          else if(value.endswith_lower("m")){
+            shift = 20;
+          }
+
+          uint32_t stack;
+          if(!value.drop_back(shift ? 1 : 0).getAsInteger(10, stack)){
+            task->setStackSize(uint64_t(stack) << shift);
+          }
+        }
+      }
+
+      // the object of a member function or lambda is its first argument,
+      // read by a const one, else read and written
+      auto MD = dyn_cast<CXXMethodDecl>(FD);
+      if(MD && MD->isInstance()){
+        HLIRTaskParam& param = task->addParam();
+        param.setRead(true);
+        param.setWrite(!MD->isConst());
+      }
+
+      // pointees of pointers to const are inputs of the task, those of
+      // other pointers and references are read and written by it, values
+      // are copied and carry no dependence
+      for(const ParmVarDecl* P : FD->parameters()){
+        HLIRTaskParam& param = task->addParam();
+        QualType T = P->getType();
+
+        if(T->isPointerType() || T->isReferenceType()){
+          param.setRead(true);
+          param.setWrite(!T->getPointeeType().isConstQualified());
+        }
+      }
     }
     // =========
   }
@@ -125,13 +125,32 @@ class CodeGenFunction : public CodeGenTypeCache {
   friend class CGCXXABI;
 public:
   // +====== ares =================================
-  bool isMainStmt(const Stmt* S){
-    return getContext().getSourceManager().isInMainFile(S->getLocStart());
-  }
+  // the name of the class of namespace ares that S ranges over, such as
+  // "Forall", seen through typedefs and aliases, or "" if there is none
+  StringRef GetAresRangeClass(const CXXForRangeStmt& S);
   
-  void EmitParallelFor(const CXXForRangeStmt& S);
+  // with simd, the body of a ForallSimd, to be vectorized
+  void EmitParallelFor(const CXXForRangeStmt& S, unsigned dims=1,
+                       bool simd=false);
+
+  // a Forall::blocked(), whose body is passed a SubRange per block
+  void EmitParallelForBlocked(const CXXForRangeStmt& S);
+
+  // a ForallEach over elements, or a Forall64 over 64-bit indices
+  void EmitParallelForEach(const CXXForRangeStmt& S, bool elements);
   
-  void EmitParallelReduce(const CXXForRangeStmt& S);
+  // a ReduceAll or ScanAll, or a Forall that updates implicitVars as
+  // reductions, declared by a reduction() or found by
+  // FindImplicitReduceVars()
+  void EmitParallelReduce(const CXXForRangeStmt& S, bool scan=false,
+                          ArrayRef<const VarDecl*> implicitVars=None);
+
+  // the scalars declared outside of the body of a Forall that every
+  // iteration updates with the same associative operator, and only so,
+  // warning about each. vars is left empty if the Forall cannot run as
+  // a reduction.
+  void FindImplicitReduceVars(const CXXForRangeStmt& S,
+                              std::vector<const VarDecl*>& vars);
 
   const LambdaExpr* GetLambda(const Expr* E);
   
@@ -0,0 +1,624 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#include "HLIRCache.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+using namespace std;
+using namespace llvm;
+
+#define DEBUG_TYPE "hlir-cache"
+
+STATISTIC(NumHits, "Number of HLIR bodies reused from the cache");
+STATISTIC(NumStored, "Number of HLIR bodies added to the cache");
+
+namespace{
+
+cl::opt<string> CacheDir("ares-hlir-cache",
+                         cl::desc("Directory to keep the optimized Forall "
+                                  "and reduce bodies in, for later builds "
+                                  "to reuse those that have not changed"),
+                         cl::init(""));
+
+// the name of the body in its file, and that it is given while its key
+// is computed, so that a body that has only moved to another line of
+// its file is found too
+const char* const CACHED_NAME = "hlir.cached.body";
+
+// the key that the store pass adds a body that was not found under
+const char* const KEY_ATTR = "hlir-cache-key";
+
+void removeKey(Function& f){
+  AttrBuilder b;
+  b.addAttribute(KEY_ATTR);
+  f.removeAttributes(AttributeSet::FunctionIndex,
+                     AttributeSet::get(f.getContext(),
+                                       AttributeSet::FunctionIndex, b));
+}
+
+// bodies with debug info are left alone, their locations are those of
+// the file as it is now
+bool hasDebugInfo(const Function& f){
+  for(const BasicBlock& bb : f){
+    for(const Instruction& ii : bb){
+      if(ii.getDebugLoc()){
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+string cachePath(StringRef key){
+  SmallString<256> path(CacheDir);
+  sys::path::append(path, key + ".bc");
+  return path.str();
+}
+
+// the bodies that were found in the cache, by their names in the module
+// they are linked back into once it has been optimized
+typedef map<string, unique_ptr<Module>> CachedBodies;
+
+map<const Module*, CachedBodies>& cachedBodies(){
+  static map<const Module*, CachedBodies> m;
+  return m;
+}
+
+// prints what the optimized code of a body depends on: its IR, that of
+// the functions it calls, which may be inlined into it, the globals they
+// refer to, the struct types they use and the metadata they carry
+class KeyPrinter{
+public:
+  KeyPrinter(const Module& m, ModuleSlotTracker& mst, raw_ostream& os)
+    : m_(m),
+      mst_(mst),
+      os_(os){}
+
+  void print(const Function& f){
+    add_(&f);
+
+    while(!work_.empty()){
+      const GlobalValue* gv = work_.back();
+      work_.pop_back();
+
+      gv->print(os_, mst_);
+      os_ << "\n";
+
+      if(auto a = dyn_cast<GlobalAlias>(gv)){
+        value_(a->getAliasee());
+      }
+      else if(auto v = dyn_cast<GlobalVariable>(gv)){
+        type_(v->getValueType());
+        if(v->hasInitializer()){
+          value_(v->getInitializer());
+        }
+      }
+      else{
+        function_(cast<Function>(gv));
+      }
+    }
+  }
+
+private:
+  // function and call attributes are printed as references to the
+  // attribute groups of the module
+  void function_(const Function* f){
+    os_ << f->getAttributes().getAsString(AttributeSet::FunctionIndex) << 
+      "\n";
+    type_(f->getFunctionType());
+
+    for(const BasicBlock& bb : *f){
+      for(const Instruction& ii : bb){
+        type_(ii.getType());
+
+        for(const Value* op : ii.operands()){
+          value_(op);
+        }
+
+        ImmutableCallSite cs(&ii);
+        if(cs){
+          os_ << cs.getAttributes().getAsString(AttributeSet::FunctionIndex)
+              << "\n";
+        }
+
+        SmallVector<pair<unsigned, MDNode*>, 4> mds;
+        ii.getAllMetadata(mds);
+        for(auto& p : mds){
+          metadata_(p.second);
+        }
+      }
+    }
+  }
+
+  void add_(const GlobalValue* gv){
+    if(globals_.insert(gv).second){
+      work_.push_back(gv);
+    }
+  }
+
+  void value_(const Value* v){
+    if(auto gv = dyn_cast<GlobalValue>(v)){
+      add_(gv);
+    }
+    else if(auto c = dyn_cast<Constant>(v)){
+      if(constants_.insert(c).second){
+        type_(c->getType());
+        for(const Value* op : c->operands()){
+          value_(op);
+        }
+      }
+    }
+    else if(auto md = dyn_cast<MetadataAsValue>(v)){
+      metadata_(md->getMetadata());
+    }
+  }
+
+  void metadata_(const Metadata* md){
+    if(auto vm = dyn_cast<ValueAsMetadata>(md)){
+      value_(vm->getValue());
+      return;
+    }
+
+    auto n = dyn_cast<MDNode>(md);
+    if(!n || !nodes_.insert(n).second){
+      return;
+    }
+
+    n->print(os_, mst_, &m_);
+    os_ << "\n";
+
+    for(const MDOperand& op : n->operands()){
+      if(op){
+        metadata_(op.get());
+      }
+    }
+  }
+
+  // the named structs are printed by name, so their elements are too
+  void type_(Type* t){
+    if(!types_.insert(t).second){
+      return;
+    }
+
+    if(auto st = dyn_cast<StructType>(t)){
+      if(st->hasName()){
+        os_ << st->getName() << " = {";
+        for(Type* e : st->elements()){
+          os_ << " ";
+          e->print(os_);
+        }
+        os_ << (st->isPacked() ? " } packed\n" : " }\n");
+      }
+    }
+
+    for(Type* s : t->subtypes()){
+      type_(s);
+    }
+  }
+
+  const Module& m_;
+  ModuleSlotTracker& mst_;
+  raw_ostream& os_;
+  vector<const GlobalValue*> work_;
+  set<const GlobalValue*> globals_;
+  set<const Constant*> constants_;
+  set<const MDNode*> nodes_;
+  set<Type*> types_;
+};
+
+// the globals that v refers to, directly or through constants
+void findGlobals(const Value* v, set<const GlobalValue*>& globals,
+                 set<const Constant*>& seen){
+  if(auto gv = dyn_cast<GlobalValue>(v)){
+    globals.insert(gv);
+  }
+  else if(auto c = dyn_cast<Constant>(v)){
+    if(seen.insert(c).second){
+      for(const Value* op : c->operands()){
+        findGlobals(op, globals, seen);
+      }
+    }
+  }
+  else if(auto md = dyn_cast<MetadataAsValue>(v)){
+    if(auto vm = dyn_cast<ValueAsMetadata>(md->getMetadata())){
+      findGlobals(vm->getValue(), globals, seen);
+    }
+  }
+}
+
+// whether a global that a body refers to is there, as it is now, when
+// the body is linked into a later build: code and data with external
+// linkage, declarations and constants of the module, which are copied
+bool isCacheable(const GlobalValue* gv){
+  if(auto f = dyn_cast<Function>(gv)){
+    return f->isDeclaration() || f->hasExternalLinkage();
+  }
+
+  auto v = dyn_cast<GlobalVariable>(gv);
+  if(!v){
+    return false;
+  }
+
+  if(v->hasExternalLinkage()){
+    return true;
+  }
+
+  if(!v->hasLocalLinkage() || !v->isConstant() || !v->hasInitializer()){
+    return false;
+  }
+
+  set<const GlobalValue*> globals;
+  set<const Constant*> seen;
+  findGlobals(v->getInitializer(), globals, seen);
+  return globals.empty();
+}
+
+// the module of the body cached under key, if there is one that can
+// stand in for f
+unique_ptr<Module> loadBody(StringRef key, const Function& f){
+  auto buf = MemoryBuffer::getFile(cachePath(key));
+  if(!buf){
+    return nullptr;
+  }
+
+  auto c = parseBitcodeFile(buf.get()->getMemBufferRef(), f.getContext());
+  if(!c){
+    return nullptr;
+  }
+
+  Function* body = c.get()->getFunction(CACHED_NAME);
+  if(!body || body->isDeclaration() ||
+     body->getFunctionType() != f.getFunctionType()){
+    return nullptr;
+  }
+
+  return move(c.get());
+}
+
+// written to a file of its own first, so that a build running at the
+// same time never reads half of one
+void storeBody(Function& f, StringRef key){
+  unique_ptr<Module> c = extractHLIRBody(f, CACHED_NAME);
+  if(!c){
+    return;
+  }
+
+  removeKey(*c->getFunction(CACHED_NAME));
+
+  string path = cachePath(key);
+
+  int fd;
+  SmallString<256> tmp;
+  if(sys::fs::createUniqueFile(path + ".%%%%%%", fd, tmp)){
+    return;
+  }
+
+  {
+    raw_fd_ostream os(fd, true);
+    WriteBitcodeToFile(c.get(), os);
+  }
+
+  if(sys::fs::rename(tmp, path)){
+    sys::fs::remove(tmp);
+    return;
+  }
+
+  ++NumStored;
+}
+
+class HLIRCacheLoadPass : public ModulePass{
+public:
+  static char ID;
+
+  HLIRCacheLoadPass(StringRef salt)
+    : ModulePass(ID),
+      salt_(salt){}
+
+  const char *getPassName() const override{
+    return "HLIRCacheLoadPass";
+  }
+
+  bool runOnModule(Module& M) override{
+    if(CacheDir.empty()){
+      return false;
+    }
+
+    if(sys::fs::create_directories(CacheDir.getValue())){
+      return false;
+    }
+
+    vector<Function*> bodies;
+    for(Function& f : M){
+      if(isHLIRBody(f) && !hasDebugInfo(f)){
+        bodies.push_back(&f);
+      }
+    }
+
+    if(bodies.empty()){
+      return false;
+    }
+
+    // all keys are computed before any body is dropped, the slots of the
+    // module are numbered once for them
+    vector<string> keys;
+    {
+      ModuleSlotTracker mst(&M);
+
+      for(Function* f : bodies){
+        keys.push_back(key_(M, mst, *f));
+      }
+    }
+
+    CachedBodies& cached = cachedBodies()[&M];
+
+    for(size_t i = 0; i < bodies.size(); ++i){
+      Function* f = bodies[i];
+
+      unique_ptr<Module> c = loadBody(keys[i], *f);
+      if(!c){
+        f->addFnAttr(KEY_ATTR, keys[i]);
+        continue;
+      }
+
+      // the body is only called through the runtime, the optimizer of
+      // its callers sees an external function until it is linked back
+      f->deleteBody();
+      f->setLinkage(GlobalValue::ExternalLinkage);
+      cached[f->getName()] = move(c);
+      ++NumHits;
+    }
+
+    return true;
+  }
+
+private:
+  string key_(Module& M, ModuleSlotTracker& mst, Function& f){
+    string name = f.getName();
+    f.setName(CACHED_NAME);
+
+    string str;
+    raw_string_ostream os(str);
+    os << salt_ << "\n" << M.getTargetTriple() << "\n" << 
+      M.getDataLayoutStr() << "\n";
+
+    KeyPrinter(M, mst, os).print(f);
+    os.flush();
+
+    f.setName(name);
+
+    MD5 md5;
+    md5.update(str);
+    MD5::MD5Result result;
+    md5.final(result);
+
+    SmallString<32> key;
+    MD5::stringifyResult(result, key);
+    return key.str();
+  }
+
+  string salt_;
+};
+
+char HLIRCacheLoadPass::ID;
+
+class HLIRCacheStorePass : public ModulePass{
+public:
+  static char ID;
+
+  HLIRCacheStorePass()
+    : ModulePass(ID){}
+
+  const char *getPassName() const override{
+    return "HLIRCacheStorePass";
+  }
+
+  bool runOnModule(Module& M) override{
+    bool changed = false;
+
+    auto itr = cachedBodies().find(&M);
+    if(itr != cachedBodies().end()){
+      for(auto& p : itr->second){
+        // unless the optimizer dropped it along with its callers
+        Function* f = M.getFunction(p.first);
+        if(!f || !f->isDeclaration()){
+          continue;
+        }
+
+        p.second->getFunction(CACHED_NAME)->setName(p.first);
+
+        if(Linker::LinkModules(&M, p.second.get())){
+          report_fatal_error("could not link the cached HLIR body " +
+                             p.first);
+        }
+
+        M.getFunction(p.first)->setLinkage(GlobalValue::InternalLinkage);
+        changed = true;
+      }
+
+      cachedBodies().erase(itr);
+    }
+
+    for(Function& f : M){
+      if(!f.hasFnAttribute(KEY_ATTR)){
+        continue;
+      }
+
+      if(!f.isDeclaration()){
+        storeBody(f, f.getFnAttribute(KEY_ATTR).getValueAsString());
+      }
+
+      removeKey(f);
+      changed = true;
+    }
+
+    return changed;
+  }
+};
+
+char HLIRCacheStorePass::ID;
+
+} // end namespace
+
+bool llvm::isHLIRBody(const Function& f){
+  return !f.isDeclaration() &&
+    (f.getName().startswith("hlir.parallel_for.body") ||
+     f.getName().startswith("hlir.parallel_reduce.body"));
+}
+
+unique_ptr<Module> llvm::extractHLIRBody(Function& f, StringRef name){
+  if(hasDebugInfo(f) || f.hasPersonalityFn() || f.hasPrefixData() ||
+     f.hasPrologueData()){
+    return nullptr;
+  }
+
+  set<const GlobalValue*> globals;
+  set<const Constant*> seen;
+
+  for(BasicBlock& bb : f){
+    for(Instruction& ii : bb){
+      for(Value* op : ii.operands()){
+        findGlobals(op, globals, seen);
+      }
+    }
+  }
+
+  for(const GlobalValue* gv : globals){
+    if(!isCacheable(gv)){
+      return nullptr;
+    }
+  }
+
+  Module* m = f.getParent();
+  unique_ptr<Module> c(new Module(name, m->getContext()));
+  c->setTargetTriple(m->getTargetTriple());
+  c->setDataLayout(m->getDataLayout());
+
+  ValueToValueMapTy vmap;
+
+  for(const GlobalValue* gv : globals){
+    if(auto g = dyn_cast<Function>(gv)){
+      Function* d = Function::Create(g->getFunctionType(),
+                                     GlobalValue::ExternalLinkage,
+                                     g->getName(), c.get());
+      d->setAttributes(g->getAttributes());
+      d->setCallingConv(g->getCallingConv());
+      vmap[g] = d;
+      continue;
+    }
+
+    auto v = cast<GlobalVariable>(gv);
+    bool copy = v->hasLocalLinkage();
+
+    auto d = new GlobalVariable(*c, v->getValueType(), v->isConstant(),
+                                copy ? v->getLinkage() :
+                                GlobalValue::ExternalLinkage,
+                                copy ? const_cast<Constant*>(
+                                  v->getInitializer()) : nullptr,
+                                v->getName(), nullptr,
+                                v->getThreadLocalMode(),
+                                v->getType()->getAddressSpace());
+    d->setAlignment(v->getAlignment());
+    d->setUnnamedAddr(v->hasUnnamedAddr());
+    vmap[v] = d;
+  }
+
+  Function* body = Function::Create(f.getFunctionType(),
+                                    GlobalValue::ExternalLinkage,
+                                    name, c.get());
+
+  auto ai = body->arg_begin();
+  for(Argument& a : f.args()){
+    vmap[&a] = &*ai++;
+  }
+
+  SmallVector<ReturnInst*, 8> returns;
+  CloneFunctionInto(body, &f, vmap, true, returns);
+  body->setLinkage(GlobalValue::ExternalLinkage);
+
+  return c;
+}
+
+ModulePass* llvm::createHLIRCacheLoadPass(StringRef salt){
+  return new HLIRCacheLoadPass(salt);
+}
+
+ModulePass* llvm::createHLIRCacheStorePass(){
+  return new HLIRCacheStorePass;
+}
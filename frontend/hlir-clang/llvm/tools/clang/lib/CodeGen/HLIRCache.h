@@ -0,0 +1,89 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_HLIR_CACHE_H__
+#define __ARES_HLIR_CACHE_H__
+
+#include <memory>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm{
+
+class Function;
+class Module;
+class ModulePass;
+
+// whether f is the outlined body of a Forall or reduce that HLIR lowered
+bool isHLIRBody(const Function& f);
+
+// a module of the body f alone, as name, with declarations of the code
+// and data it refers to and copies of its constants, or null if it has
+// debug info or refers to code or data that may not be there when it is
+// linked back, that of the module with internal or linkonce linkage
+std::unique_ptr<Module> extractHLIRBody(Function& f, StringRef name);
+
+// with -ares-hlir-cache=<dir>, the Forall and reduce bodies that HLIR
+// outlined are kept in dir once optimized, under a hash of their
+// lowered IR, so that a rebuild skips the optimization of those that
+// have not changed. Gives each body its key, after lowering, and makes
+// those that are in the cache declarations, which the optimizer skips.
+// salt names what else their optimized code depends on, the compiler
+// and its options.
+ModulePass* createHLIRCacheLoadPass(StringRef salt);
+
+// after the optimizer, links the bodies found in the cache back in and
+// adds the others to it
+ModulePass* createHLIRCacheStorePass();
+
+} // namespace llvm
+
+#endif // __ARES_HLIR_CACHE_H__
@@ -0,0 +1,273 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#include "HLIRParallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/thread.h"
+
+#include "HLIRCache.h"
+
+using namespace std;
+using namespace llvm;
+
+#define DEBUG_TYPE "hlir-parallel"
+
+STATISTIC(NumSplit, "Number of HLIR bodies optimized on threads of their own");
+
+namespace{
+
+cl::opt<unsigned> Jobs("ares-hlir-jobs",
+                       cl::desc("Number of threads to optimize the Forall "
+                                "and reduce bodies on, alongside the rest "
+                                "of the module"),
+                       cl::init(1));
+
+// the bodies of a module that are being optimized, as bitcode, which is
+// all that passes between the contexts. Each thread takes the next body
+// until there are none left, the largest first. The split outlives the
+// pass manager of the pass that made it, so it has its own optimize.
+struct Split{
+  function<void(Module&)> optimize;
+  vector<string> names;
+  vector<SmallVector<char, 0>> bitcode;
+  atomic<size_t> next{0};
+  vector<thread> threads;
+};
+
+map<const Module*, unique_ptr<Split>>& splits(){
+  static map<const Module*, unique_ptr<Split>> m;
+  return m;
+}
+
+size_t numInstructions(const Function& f){
+  size_t n = 0;
+  for(const BasicBlock& bb : f){
+    n += bb.size();
+  }
+  return n;
+}
+
+unique_ptr<Module> parseModule(const SmallVector<char, 0>& bitcode,
+                               LLVMContext& context){
+  auto m = parseBitcodeFile(
+    MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "hlir.body"),
+    context);
+
+  if(!m){
+    report_fatal_error("could not read an HLIR body");
+  }
+
+  return move(m.get());
+}
+
+// the bodies of s from next on, each parsed into a context of its own,
+// optimized and written back in place of its input
+void optimizeBodies(Split* s){
+  for(;;){
+    size_t i = s->next++;
+    if(i >= s->bitcode.size()){
+      return;
+    }
+
+    LLVMContext context;
+    unique_ptr<Module> m = parseModule(s->bitcode[i], context);
+    s->optimize(*m);
+
+    s->bitcode[i].clear();
+    raw_svector_ostream os(s->bitcode[i]);
+    WriteBitcodeToFile(m.get(), os);
+  }
+}
+
+class HLIRSplitPass : public ModulePass{
+public:
+  static char ID;
+
+  HLIRSplitPass(function<void(Module&)> optimize)
+    : ModulePass(ID),
+      optimize_(move(optimize)){}
+
+  const char *getPassName() const override{
+    return "HLIRSplitPass";
+  }
+
+  bool runOnModule(Module& M) override{
+    if(Jobs <= 1){
+      return false;
+    }
+
+    vector<Function*> bodies;
+    for(Function& f : M){
+      if(isHLIRBody(f)){
+        bodies.push_back(&f);
+      }
+    }
+
+    stable_sort(bodies.begin(), bodies.end(), [](Function* a, Function* b){
+      return numInstructions(*a) > numInstructions(*b);
+    });
+
+    unique_ptr<Split> s(new Split);
+    s->optimize = optimize_;
+
+    // written out here, the threads only ever read their own bitcode
+    for(Function* f : bodies){
+      unique_ptr<Module> c = extractHLIRBody(*f, f->getName());
+      if(!c){
+        continue;
+      }
+
+      s->names.push_back(f->getName());
+      s->bitcode.emplace_back();
+
+      raw_svector_ostream os(s->bitcode.back());
+      WriteBitcodeToFile(c.get(), os);
+
+      // the body is only called through the runtime, the optimizer of
+      // its callers sees an external function until it is linked back
+      f->deleteBody();
+      f->setLinkage(GlobalValue::ExternalLinkage);
+      ++NumSplit;
+    }
+
+    if(s->names.empty()){
+      return false;
+    }
+
+    size_t n = min(size_t(Jobs), s->names.size());
+    for(size_t i = 0; i < n; ++i){
+      s->threads.emplace_back(optimizeBodies, s.get());
+    }
+
+    splits()[&M] = move(s);
+    return true;
+  }
+
+private:
+  function<void(Module&)> optimize_;
+};
+
+char HLIRSplitPass::ID;
+
+class HLIRJoinPass : public ModulePass{
+public:
+  static char ID;
+
+  HLIRJoinPass()
+    : ModulePass(ID){}
+
+  const char *getPassName() const override{
+    return "HLIRJoinPass";
+  }
+
+  bool runOnModule(Module& M) override{
+    auto itr = splits().find(&M);
+    if(itr == splits().end()){
+      return false;
+    }
+
+    Split& s = *itr->second;
+
+    for(thread& t : s.threads){
+      t.join();
+    }
+
+    for(size_t i = 0; i < s.names.size(); ++i){
+      // unless the optimizer dropped it along with its callers
+      Function* f = M.getFunction(s.names[i]);
+      if(!f || !f->isDeclaration()){
+        continue;
+      }
+
+      unique_ptr<Module> m = parseModule(s.bitcode[i], M.getContext());
+
+      if(Linker::LinkModules(&M, m.get())){
+        report_fatal_error("could not link the HLIR body " + s.names[i]);
+      }
+
+      M.getFunction(s.names[i])->setLinkage(GlobalValue::InternalLinkage);
+    }
+
+    splits().erase(itr);
+    return true;
+  }
+};
+
+char HLIRJoinPass::ID;
+
+} // end namespace
+
+ModulePass* llvm::createHLIRSplitPass(function<void(Module&)> optimize){
+  return new HLIRSplitPass(move(optimize));
+}
+
+ModulePass* llvm::createHLIRJoinPass(){
+  return new HLIRJoinPass;
+}
@@ -1103,6 +1103,17 @@ ExprResult Parser::ParseLambdaExpressionAfterIntroducer(
     if (TryConsumeToken(tok::kw_mutable, MutableLoc))
       DeclEndLoc = MutableLoc;
 
+    // +==== ares
+    // 'task'[opt], the calls of the lambda are spawned as tasks
+    SourceLocation TaskLoc;
+    if (TryConsumeToken(tok::kw_task, TaskLoc)) {
+      const char *PrevSpec = nullptr;
+      unsigned DiagID = 0;
+      DS.setFunctionSpecTask(TaskLoc, PrevSpec, DiagID);
+      DeclEndLoc = TaskLoc;
+    }
+    // ==========
+
     // Parse exception-specification[opt].
     ExceptionSpecificationType ESpecType = EST_None;
     SourceRange ESpecRange;
@@ -7034,6 +7034,13 @@ static FunctionDecl* CreateNewFunctionDecl(Sema &SemaRef, Declarator &D,
                                                TInfo, SC, isInline,
                                                isConstexpr, SourceLocation());
     IsVirtualOkay = !Ret->isStatic();
+
+    // +=== ares
+    if(D.getDeclSpec().isTaskSpecified()){
+      Ret->setTask(true);
+    }
+    // =========
+
     return Ret;
   } else {
     bool isFriend =
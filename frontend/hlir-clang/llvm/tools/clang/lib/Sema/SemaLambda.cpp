@@ -925,6 +925,12 @@ void Sema::ActOnStartOfLambdaDefinition(LambdaIntroducer &Intro,
   
   // Attributes on the lambda apply to the method.  
   ProcessDeclAttributes(CurScope, Method, ParamInfo);
+
+  // +=== ares
+  if(ParamInfo.getDeclSpec().isTaskSpecified()){
+    Method->setTask(true);
+  }
+  // =========
   
   // Introduce the function call operator as the current declaration context.
   PushDeclContext(CurScope, Method);
@@ -9593,6 +9593,10 @@ TreeTransform<Derived>::TransformLambdaExpr(LambdaExpr *E) {
       NewCallOpTSI->getTypeLoc().castAs<FunctionProtoTypeLoc>().getParams());
   LSI->CallOperator = NewCallOperator;
 
+  // +=== ares
+  NewCallOperator->setTask(E->getCallOperator()->isTask());
+  // =========
+
   getDerived().transformAttrs(E->getCallOperator(), NewCallOperator);
   getDerived().transformedLocalDecl(E->getCallOperator(), NewCallOperator);
 
@@ -0,0 +1,259 @@
+//===- hlir-opt.cpp - Run and time the HLIR passes on bitcode -------------===//
+//
+//                     Project Ares
+//
+// This file is distributed under the expression permission of Los Alamos
+// National laboratory. It is Licensed under the BSD-3 license. For more
+// information, see LICENSE.md in the Ares root directory.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs the HLIR passes on a bitcode file emitted by hlir-clang, so that
+// their cost and the code they produce can be looked at without building
+// and running the frontend again:
+//
+//   clang++ -c -emit-llvm -O2 prog.cpp
+//   hlir-opt -hlir-hoist -hlir-interior -time-passes -stats prog.bc -S
+//
+// The Forall bodies are lowered, fused, collapsed and chunked as clang
+// emits the bitcode, which keeps only its tasks as calls described by
+// !hlir.tasks metadata. -hlir-lower spawns those as compiling the bitcode
+// would. The other passes run on the lowered bodies in the order below,
+// or with -O<n> at the points of the pipeline where clang adds them.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeWriterPass.h"
+#include "llvm/IR/IRPrintingPasses.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/ARES/HLIRPass.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar.h"
+
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+namespace {
+
+cl::opt<std::string> InputFile(cl::desc("<input bitcode>"), cl::Positional,
+                               cl::init("-"));
+
+cl::opt<std::string> OutputFile("o", cl::desc("Output file"),
+                                cl::value_desc("filename"), cl::init("-"));
+
+cl::opt<bool> OutputAssembly("S", cl::desc("Write LLVM assembly"),
+                             cl::init(false));
+
+cl::opt<bool> NoOutput("disable-output", cl::desc("Do not write the result"),
+                       cl::init(false));
+
+cl::opt<bool> NoVerify("disable-verify",
+                       cl::desc("Do not verify the result"), cl::init(false));
+
+cl::opt<unsigned>
+    OptLevel("O",
+             cl::desc("Run the pipeline of clang at this level, with the "
+                      "selected HLIR passes in it"),
+             cl::Prefix, cl::ZeroOrMore, cl::init(0));
+
+cl::opt<bool> Lower("hlir-lower",
+                    cl::desc("Lower the deferred tasks of the bitcode"),
+                    cl::init(true));
+
+cl::opt<bool> Hoist("hlir-hoist",
+                    cl::desc("Hoist what does not depend on the index out "
+                             "of Forall loops"),
+                    cl::init(false));
+
+cl::opt<bool> Interchange("hlir-interchange",
+                          cl::desc("Interchange Forall loops with the serial "
+                                   "loops in them"),
+                          cl::init(false));
+
+cl::opt<bool> Interior("hlir-interior",
+                       cl::desc("Split Forall loops into interior and "
+                                "boundary loops"),
+                       cl::init(false));
+
+cl::opt<bool> Atomic("hlir-atomic",
+                     cl::desc("Lower the atomic adds of Forall loops"),
+                     cl::init(false));
+
+cl::opt<bool> Prefetch("hlir-prefetch",
+                       cl::desc("Prefetch the gathers of Forall loops"),
+                       cl::init(false));
+
+cl::opt<bool> All("hlir-all", cl::desc("Run all of the HLIR passes"),
+                  cl::init(false));
+
+bool selected(const cl::opt<bool> &Pass) { return All || Pass; }
+
+// the same extension points as in clang's BackendUtil.cpp
+void addHoist(const PassManagerBuilder &Builder, legacy::PassManagerBase &PM) {
+  PM.add(createHLIRHoistPass());
+}
+
+void addInterchange(const PassManagerBuilder &Builder,
+                    legacy::PassManagerBase &PM) {
+  PM.add(createHLIRInterchangePass());
+}
+
+void addInterior(const PassManagerBuilder &Builder,
+                 legacy::PassManagerBase &PM) {
+  PM.add(createHLIRInteriorPass());
+}
+
+void addAtomic(const PassManagerBuilder &Builder,
+               legacy::PassManagerBase &PM) {
+  PM.add(createHLIRAtomicPass());
+}
+
+void addPrefetch(const PassManagerBuilder &Builder,
+                 legacy::PassManagerBase &PM) {
+  PM.add(createHLIRPrefetchPass());
+}
+
+/// The target machine of M, which the cost models of the pipeline ask,
+/// or null if the target is not built in.
+std::unique_ptr<TargetMachine> createTargetMachine(Module &M) {
+  std::string Triple = M.getTargetTriple();
+  if (Triple.empty())
+    Triple = sys::getDefaultTargetTriple();
+
+  std::string Error;
+  const Target *T = TargetRegistry::lookupTarget(Triple, Error);
+  if (!T)
+    return nullptr;
+
+  return std::unique_ptr<TargetMachine>(T->createTargetMachine(
+      Triple, sys::getHostCPUName(), "", TargetOptions(), Reloc::Default,
+      CodeModel::Default, OptLevel > 2 ? CodeGenOpt::Aggressive
+                                       : CodeGenOpt::Default));
+}
+
+void addPasses(legacy::PassManager &PM) {
+  if (Lower)
+    PM.add(createHLIRPass());
+
+  if (OptLevel > 0) {
+    PassManagerBuilder Builder;
+    Builder.OptLevel = OptLevel;
+    Builder.Inliner = createFunctionInliningPass(OptLevel, 0);
+    Builder.LoopVectorize = OptLevel > 1;
+    Builder.SLPVectorize = OptLevel > 1;
+
+    if (selected(Hoist))
+      Builder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd, addHoist);
+    if (selected(Interchange))
+      Builder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
+                           addInterchange);
+    if (selected(Interior))
+      Builder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
+                           addInterior);
+    if (selected(Atomic))
+      Builder.addExtension(PassManagerBuilder::EP_VectorizerStart, addAtomic);
+    if (selected(Prefetch))
+      Builder.addExtension(PassManagerBuilder::EP_OptimizerLast, addPrefetch);
+
+    // as after lowering in clang, the outlined bodies are inlined into
+    // their drivers before the rest of the pipeline
+    PM.add(createAlwaysInlinerPass());
+    PM.add(createGlobalDCEPass());
+    Builder.populateModulePassManager(PM);
+    return;
+  }
+
+  // the loop passes need preheaders and LCSSA form, which -O<n> has made
+  if (selected(Hoist) || selected(Interchange) || selected(Interior) ||
+      selected(Atomic) || selected(Prefetch)) {
+    PM.add(createLoopSimplifyPass());
+    PM.add(createLCSSAPass());
+  }
+
+  if (selected(Hoist))
+    PM.add(createHLIRHoistPass());
+  if (selected(Interchange))
+    PM.add(createHLIRInterchangePass());
+  if (selected(Interior))
+    PM.add(createHLIRInteriorPass());
+  if (selected(Atomic))
+    PM.add(createHLIRAtomicPass());
+  if (selected(Prefetch))
+    PM.add(createHLIRPrefetchPass());
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  sys::PrintStackTraceOnErrorSignal();
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+
+  cl::ParseCommandLineOptions(argc, argv, "HLIR optimizer\n");
+
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(InputFile, Err, Context);
+  if (!M) {
+    Err.print(argv[0], errs());
+    return 1;
+  }
+
+  std::unique_ptr<tool_output_file> Out;
+  if (!NoOutput) {
+    std::error_code EC;
+    Out.reset(new tool_output_file(OutputFile, EC, sys::fs::F_None));
+    if (EC) {
+      errs() << argv[0] << ": " << EC.message() << "\n";
+      return 1;
+    }
+  }
+
+  legacy::PassManager PM;
+
+  std::unique_ptr<TargetMachine> TM = createTargetMachine(*M);
+  if (TM)
+    PM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+
+  addPasses(PM);
+
+  if (!NoVerify)
+    PM.add(createVerifierPass());
+
+  if (Out) {
+    if (OutputAssembly)
+      PM.add(createPrintModulePass(Out->os()));
+    else
+      PM.add(createBitcodeWriterPass(Out->os()));
+  }
+
+  PM.run(*M);
+
+  if (Out)
+    Out->keep();
+
+  return 0;
+}
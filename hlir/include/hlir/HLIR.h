@@ -57,6 +57,7 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <cassert>
 #include <sstream>
@@ -134,6 +135,9 @@ namespace ares{
       return false;
     }
 
+    // adds the llvm values this node refers to, recursively
+    virtual void values(std::set<llvm::Value*>& vs) const{}
+
     virtual bool hasValue() const{
       return true;
     }
@@ -406,6 +410,12 @@ namespace ares{
       return new HLIRValue(ptr_);
     }
 
+    virtual void values(std::set<llvm::Value*>& vs) const override{
+      if(ptr_){
+        vs.insert(ptr_);
+      }
+    }
+
     static HLIRValue nullValue(){
       return nullptr;
     }
@@ -450,6 +460,12 @@ namespace ares{
       return new HLIRInstruction(ptr_);
     }
 
+    virtual void values(std::set<llvm::Value*>& vs) const override{
+      if(ptr_){
+        vs.insert(ptr_);
+      }
+    }
+
     static HLIRInstruction nullValue(){
       return nullptr;
     }
@@ -725,6 +741,23 @@ namespace ares{
       return true;
     }
 
+    virtual void values(std::set<llvm::Value*>& vs) const override{
+      for(auto& itr : map_){
+        itr.second->values(vs);
+      }
+    }
+
+  protected:
+    // puts a copy of value under key and returns it. The fields that the
+    // lowering reads most are set with this, and a construct keeps the
+    // typed pointer to read them by rather than a lookup by key.
+    template<class T>
+    T* setField_(const std::string& key, const T& value){
+      T* v = value.copy();
+      put_(key, v);
+      return v;
+    }
+
   private:
     using Map_ = std::map<HLIRSymbol, HLIRNode*>;
 
@@ -827,6 +860,20 @@ namespace ares{
       return ConstProxy_(*this, index); 
     }
 
+    size_t size() const{
+      return vector_.size();
+    }
+
+    template<class T>
+    T& get(size_t index){
+      return get_(index)->as<T>();
+    }
+
+    template<class T>
+    const T& get(size_t index) const{
+      return get_(index)->as<T>();
+    }
+
     template<class T>
     HLIRVector& operator<<(const T& value){
       auto n = HLIRNodeFactory::create(value);
@@ -871,6 +918,14 @@ namespace ares{
       return true;
     }
 
+    virtual void values(std::set<llvm::Value*>& vs) const override{
+      for(HLIRNode* vi : vector_){
+        if(vi){
+          vi->values(vs);
+        }
+      }
+    }
+
   private:
     using Vector_ = std::vector<HLIRNode*>;
 
@@ -903,7 +958,12 @@ namespace ares{
   class HLIRConstruct;
   class HLIRParallelFor;
   class HLIRParallelReduce;
+  class HLIRParallelScan;
   class HLIRTask;
+  class HLIRSend;
+  class HLIRReceive;
+  class HLIRBarrier;
+  class HLIRTeam;
 
   class HLIRModule : public HLIRMap{
   public:
@@ -918,8 +978,13 @@ namespace ares{
     llvm::Type* doubleTy;
     llvm::PointerType* voidPtrTy;
 
+    // the HLIR of module, created on first use. It is kept until
+    // releaseModule(), which the HLIR pass calls once it has lowered it,
+    // and is only seen by the thread that created it.
     static HLIRModule* getModule(llvm::Module* module);
 
+    static void releaseModule(llvm::Module* module);
+
     void setName(const HLIRString& name){
       (*this)["name"] = name;
     }
@@ -964,12 +1029,39 @@ namespace ares{
       return builder_.CreateAlloca(boolTy, nullptr);
     }
 
+    llvm::AllocaInst* createEntryAlloca_(llvm::Function* f,
+                                         llvm::Type* type,
+                                         const std::string& name=""){
+      llvm::BasicBlock& entry = f->getEntryBlock();
+      llvm::IRBuilder<> b(&entry, entry.getFirstInsertionPt());
+      return b.CreateAlloca(type, nullptr, name);
+    }
+
     HLIRParallelFor* createParallelFor();
 
-    HLIRParallelReduce* createParallelReduce(const HLIRType& reduceType);
+    // a parallel for over an iteration space of extents.size() dimensions
+    // split into tiles, its range is over the tile indices and each
+    // iteration of the body walks one tile with indexType as the index
+    HLIRParallelFor* createParallelFor(llvm::StructType* indexType,
+                                       const std::vector<llvm::Value*>& extents,
+                                       const std::vector<llvm::Value*>& tiles);
+
+    HLIRParallelReduce*
+    createParallelReduce(const std::vector<llvm::Type*>& varTypes);
+
+    HLIRParallelScan* createParallelScan(llvm::Type* varType);
 
     HLIRTask* createTask();
 
+    // placed with insert() once their buffer, rank and tag are set
+    HLIRSend* createSend();
+
+    HLIRReceive* createReceive();
+
+    HLIRBarrier* createBarrier();
+
+    HLIRTeam* createTeam();
+
     llvm::Module* module(){
       return module_;
     }
@@ -1002,20 +1094,90 @@ namespace ares{
                              llvm::Function::ExternalLinkage,
                              funcName,
                              module_);
+
+      // the entry points of the runtime do not throw
+      if(funcName.compare(0, 7, "__ares_") == 0){
+        func->setDoesNotThrow();
+      }
       
       return func;
     }
 
-    bool lowerToIR_();
+    // with deferTasks, the tasks are written to !hlir.tasks metadata
+    // rather than lowered, so that the calls of a task made in other
+    // modules are also spawned once they are linked. getModule()
+    // recreates them from it when the bitcode is compiled.
+    bool lowerToIR_(bool deferTasks=false);
+
+    void writeTaskMetadata_();
+
+    void readTaskMetadata_();
+
+    // makes the calls marked !hlir.task, as other frontends and the
+    // experimental passes emit them, spawned calls of tasks
+    void importTaskCalls_();
     
     void lowerParallelFor_(HLIRParallelFor* pfor,
                            llvm::StructType* argsType,
                            std::unordered_map<llvm::Value*, size_t>& capturedMap,
                            std::unordered_map<llvm::Value*, llvm::Value*>& replacedMap);
 
-    void lowerParallelReduce_(HLIRParallelReduce* reduce);
+    // PTX of a kernel running one iteration of the body of pfor per GPU
+    // thread, or null if the body cannot run on the device
+    llvm::Constant* createOffloadKernel_(HLIRParallelFor* pfor);
+
+    // nested if it is emitted within the body of another construct
+    void lowerParallelReduce_(HLIRParallelReduce* reduce, bool nested);
+
+    llvm::Function* createReduceFunc_(HLIRParallelReduce* reduce,
+                                      llvm::StructType* argsType,
+                                      bool final);
+
+    // the RegionDesc passed to the runtime with the outlined functions of
+    // c, see runtime.cpp
+    llvm::Constant* createRegionDesc_(HLIRConstruct* c,
+                                      const std::string& name,
+                                      uint32_t kind,
+                                      uint32_t stack=0);
+
+    // names f prefix.<file>.<line> after the location of c and, with
+    // debug info, gives the outlined body a subprogram of its own
+    void nameRegionFunc_(HLIRConstruct* c, llvm::Function* f,
+                         const std::string& prefix, bool body);
+
+    // scopes the ares::scratch() blocks of body f to its iterations,
+    // latch is the end of each iteration of a parallel for, or null if
+    // f is called once per iteration
+    void lowerScratch_(llvm::Function* f, llvm::BasicBlock* latch);
+
+    // replaces the marker of a send, receive or barrier with its
+    // runtime call
+    void lowerCommunication_(HLIRConstruct* c);
+
+    // inlineCalls are left as direct calls, see findInlineTaskCalls_()
+    void lowerTask_(HLIRTask* task,
+                    const std::set<llvm::CallInst*>& inlineCalls);
+
+    void findInlineTaskCalls_(std::set<llvm::CallInst*>& inlineCalls);
 
-    void lowerTask_(HLIRTask* task);
+    // the bodies of the constructs within f, recursively
+    void promoteLocals_();
+
+    void fuseParallelFors_(
+      std::unordered_map<llvm::Function*, HLIRConstruct*>& bodyMap);
+
+    bool fuseParallelFor_(HLIRParallelFor* a, HLIRParallelFor* b);
+
+    void collapseParallelFors_(
+      std::unordered_map<llvm::Function*, HLIRConstruct*>& bodyMap);
+
+    bool collapseParallelFor_(HLIRParallelFor* outer, HLIRParallelFor* inner);
+
+    void promoteReadOnlyCaptures_(llvm::Instruction* marker,
+                                  const std::set<llvm::Function*>& bodies);
+
+    void findNestedBodies_(llvm::Function* f,
+                           std::set<llvm::Function*>& bodies);
 
     void findExternalValues_(llvm::Function* f,
                              std::vector<llvm::Instruction*>& v,
@@ -1044,7 +1206,8 @@ namespace ares{
     HLIRModule(llvm::Module* module)
       : module_(module),
         context_(module_->getContext()),
-        builder_(context_){
+        builder_(context_),
+        nextId_(0){
 
       voidTy = llvm::Type::getVoidTy(context_);
       boolTy = llvm::Type::getInt1Ty(context_);
@@ -1059,12 +1222,29 @@ namespace ares{
       voidPtrTy = llvm::PointerType::get(i8Ty, 0);
     }
 
+    // unique within the module
+    std::string createName_(const std::string& prefix);
+
+    // drops the construct of marker, which has been merged into another
+    void removeConstruct_(llvm::Instruction* marker);
+
     llvm::Module* module_;
     llvm::LLVMContext& context_;
     llvm::IRBuilder<> builder_;
+    size_t nextId_;
 
     std::unordered_map<llvm::Instruction*, HLIRConstruct*> constructMap_;
+
+    // the same constructs in the order they were added, which is that of
+    // the source, so that they are lowered in an order that does not
+    // depend on addresses and the same input gives the same module
+    std::vector<HLIRConstruct*> constructs_;
     std::vector<HLIRTask*> tasks_;
+    std::unordered_map<HLIRConstruct*, llvm::Constant*> regionDescs_;
+
+    // the functions emitted for the lowering of reductions, which get
+    // the attributes of outlined functions with the bodies
+    std::vector<llvm::Function*> outlined_;
   };
 
   class HLIRTaskParam : public HLIRMap{
@@ -1091,6 +1271,9 @@ namespace ares{
       return get<HLIRBoolean>("write");
     }
 
+    // an i32(i8*) giving the partition of a region the argument points
+    // into, a spawned call is queued on the workers that
+    // __ares_region_alloc() placed that partition on
     void setPartitioner(const HLIRFunction& func){
       (*this)["partitioner"] = func;
     }
@@ -1104,7 +1287,11 @@ namespace ares{
   class HLIRConstruct : public HLIRMap{
   public:
     HLIRConstruct(HLIRModule* module)
-      : module_(module){}
+      : module_(module),
+        marker_(nullptr){
+      (*this)["file"] = HLIRString::nullValue();
+      (*this)["line"] = HLIRInteger::nullValue();
+    }
 
     virtual std::string intrinsic() const{
       HLIR_ERROR("invalid intrinsic");
@@ -1112,17 +1299,38 @@ namespace ares{
 
     template<bool P, class C, class I>
     void insert(llvm::IRBuilder<P, C, I>& builder){
-      (*this)["marker"] = 
-        builder.CreateCall(module_->getIntrinsic(intrinsic()));
-        module_->addConstruct(this);
+      marker_ = setField_("marker", HLIRInstruction(
+        builder.CreateCall(module_->getIntrinsic(intrinsic()))));
+      module_->addConstruct(this);
     }
 
     HLIRInstruction& marker(){
-      return get<HLIRInstruction>("marker"); 
+      if(!marker_){
+        HLIR_ERROR("invalid key: marker");
+      }
+      return *marker_;
+    }
+
+    // where the construct is in the source, the outlined functions it is
+    // lowered to are named after it
+    void setLocation(const HLIRString& file, const HLIRInteger& line){
+      (*this)["file"] = file;
+      (*this)["line"] = line;
+    }
+
+    auto& file() const{
+      return get<HLIRString>("file");
+    }
+
+    auto& line() const{
+      return get<HLIRInteger>("line");
     }
 
   protected:
     HLIRModule* module_;
+
+  private:
+    HLIRInstruction* marker_;
   };
 
   class HLIRTask : public HLIRConstruct{
@@ -1135,28 +1343,46 @@ namespace ares{
 
       (*this)["return"] = ret;
       (*this)["parameters"] = HLIRVector();
-      (*this)["function"] = HLIRFunction::nullValue();
+      function_ = setField_("function", HLIRFunction::nullValue());
+      wrapperFunction_ = nullptr;
+      (*this)["priority"] = HLIRInteger(0);
+      (*this)["stack"] = HLIRInteger(0);
+      (*this)["memoize"] = HLIRBoolean(false);
+      (*this)["calls"] = HLIRVector();
     }
 
     HLIRTaskParam& getReturn(){
       return get<HLIRTaskParam>("return");
     }
 
+    // one per parameter of the function, in order. A pointer parameter
+    // that is read or written is a dependence of the spawned call on the
+    // memory it points to.
     HLIRTaskParam& addParam(){
       HLIRTaskParam* param = new HLIRTaskParam;
-      auto& params = get<HLIRVector>("parameters") << param;
-      params << param;
+      get<HLIRVector>("parameters") << param;
       return *param;
     }
 
+    size_t numParams() const{
+      return get<HLIRVector>("parameters").size();
+    }
+
+    HLIRTaskParam& param(size_t i){
+      return get<HLIRVector>("parameters").get<HLIRTaskParam>(i);
+    }
+
     void setFunction(const HLIRFunction& func);
 
-    auto& function() const{
-      return get<HLIRFunction>("function");
+    const HLIRFunction& function() const{
+      return *function_;
     }
 
-    auto& wrapperFunction() const{
-      return get<HLIRFunction>("wrapperFunction");
+    const HLIRFunction& wrapperFunction() const{
+      if(!wrapperFunction_){
+        HLIR_ERROR("invalid key: wrapperFunction");
+      }
+      return *wrapperFunction_;
     }
 
     void setName(const HLIRString& name){
@@ -1166,33 +1392,215 @@ namespace ares{
     auto& name() const{
       return get<HLIRString>("name");
     }
+
+    // priority of the tasks of spawned calls
+    void setPriority(const HLIRInteger& priority){
+      (*this)["priority"] = priority;
+    }
+
+    auto& priority() const{
+      return get<HLIRInteger>("priority");
+    }
+
+    // bytes of stack that the spawned calls need when the runtime runs
+    // them as user level threads, 0 for its default
+    void setStackSize(const HLIRInteger& bytes){
+      (*this)["stack"] = bytes;
+    }
+
+    auto& stackSize() const{
+      return get<HLIRInteger>("stack");
+    }
+
+    // whether the calls share the result of an earlier call made with
+    // the same arguments, pointers compared by address, rather than
+    // being spawned again. Only honored for a function that writes no
+    // memory through its parameters.
+    void setMemoize(const HLIRBoolean& flag){
+      (*this)["memoize"] = flag;
+    }
+
+    auto& memoize() const{
+      return get<HLIRBoolean>("memoize");
+    }
+
+    // if any are added, only these calls of the function are spawned,
+    // as for calls marked !hlir.task, rather than all of them
+    void addCall(const HLIRInstruction& call){
+      get<HLIRVector>("calls") << call;
+    }
+
+    size_t numCalls() const{
+      return get<HLIRVector>("calls").size();
+    }
+
+    llvm::Instruction* call(size_t i) const{
+      return get<HLIRVector>("calls").get<HLIRInstruction>(i);
+    }
+
+  private:
+    HLIRFunction* function_;
+    HLIRFunction* wrapperFunction_;
   };
 
+  // a handle to a runtime future, whose methods emit the runtime calls at
+  // the builder's insertion point. Each handle is used once, by await()
+  // or as the input of a combinator, none of which but await() blocks.
   class HLIRFuture : public HLIRConstruct{
   public:
-    HLIRFuture(HLIRModule* module, HLIRValue& value)
-      : HLIRConstruct(module){}
+    HLIRFuture(HLIRModule* module, const HLIRValue& value)
+      : HLIRConstruct(module){
+      (*this)["value"] = value;
+    }
 
-    void await(){}
+    auto& value() const{
+      return get<HLIRValue>("value");
+    }
+
+    // a future completed by count calls of release()
+    template<bool P, class C, class I>
+    static HLIRFuture* create(HLIRModule* module,
+                              llvm::IRBuilder<P, C, I>& builder,
+                              uint32_t count=1){
+      llvm::Function* f = 
+        module->getFunction("__ares_future_create", {module->i32Ty},
+                            module->voidPtrTy);
+
+      return new HLIRFuture(module, 
+        builder.CreateCall(f, {builder.getInt32(count)}, "future"));
+    }
+
+    template<bool P, class C, class I>
+    void release(llvm::IRBuilder<P, C, I>& builder){
+      llvm::Function* f = 
+        module_->getFunction("__ares_future_release", {module_->voidPtrTy});
+
+      builder.CreateCall(f, {value()});
+    }
+
+    template<bool P, class C, class I>
+    void await(llvm::IRBuilder<P, C, I>& builder){
+      llvm::Function* f = 
+        module_->getFunction("__ares_future_await", {module_->voidPtrTy});
+
+      builder.CreateCall(f, {value()});
+    }
+
+    // func(args) is queued as a task once this has completed, func is a
+    // void (i8*)
+    template<bool P, class C, class I>
+    HLIRFuture* then(llvm::IRBuilder<P, C, I>& builder,
+                     llvm::Function* func,
+                     llvm::Value* args,
+                     uint32_t priority=1){
+      llvm::Function* f = 
+        module_->getFunction("__ares_future_then",
+                             {module_->voidPtrTy, module_->voidPtrTy,
+                              module_->voidPtrTy, module_->i32Ty},
+                             module_->voidPtrTy);
+
+      llvm::Value* fp = builder.CreateBitCast(func, module_->voidPtrTy);
+      args = builder.CreateBitCast(args, module_->voidPtrTy);
 
-    HLIRValue await(const HLIRValue& microsends){}
+      return new HLIRFuture(module_, 
+        builder.CreateCall(f, {value(), fp, args, builder.getInt32(priority)},
+                           "future"));
+    }
+
+    template<bool P, class C, class I>
+    static HLIRFuture* whenAll(llvm::IRBuilder<P, C, I>& builder,
+                               const std::vector<HLIRFuture*>& futures){
+      return combine_(builder, futures, "__ares_future_when_all");
+    }
+
+    template<bool P, class C, class I>
+    static HLIRFuture* whenAny(llvm::IRBuilder<P, C, I>& builder,
+                               const std::vector<HLIRFuture*>& futures){
+      return combine_(builder, futures, "__ares_future_when_any");
+    }
+
+  private:
+    // the handles are passed in an array allocated in the entry block
+    template<bool P, class C, class I>
+    static HLIRFuture* combine_(llvm::IRBuilder<P, C, I>& builder,
+                                const std::vector<HLIRFuture*>& futures,
+                                const std::string& funcName){
+      assert(!futures.empty() && "no futures to combine");
+
+      HLIRModule* module = futures[0]->module_;
+      llvm::Type* voidPtrTy = module->voidPtrTy;
+
+      llvm::Function* parent = builder.GetInsertBlock()->getParent();
+      llvm::BasicBlock& entry = parent->getEntryBlock();
+      llvm::IRBuilder<> entryBuilder(&entry, entry.begin());
+
+      llvm::Value* array = 
+        entryBuilder.CreateAlloca(voidPtrTy, 
+                                  entryBuilder.getInt32(futures.size()), 
+                                  "futures");
+
+      for(size_t i = 0; i < futures.size(); ++i){
+        llvm::Value* v = futures[i]->value();
+        builder.CreateStore(v, 
+          builder.CreateConstGEP1_32(array, i));
+      }
+
+      llvm::Function* f = 
+        module->getFunction(funcName, 
+                            {llvm::PointerType::get(voidPtrTy, 0),
+                             module->i32Ty}, voidPtrTy);
+
+      return new HLIRFuture(module, 
+        builder.CreateCall(f, {array, builder.getInt32(futures.size())},
+                           "future"));
+    }
   };
 
+  // the memory a message is sent from or received into
   class HLIRBuffer : public HLIRConstruct{
   public:
     HLIRBuffer(HLIRModule* module)
       : HLIRConstruct(module){}
 
     void init(const HLIRValue& buffer,
-              const HLIRValue& size){}
+              const HLIRValue& size){
+      (*this)["buffer"] = buffer;
+      (*this)["size"] = size;
+    }
+
+    auto& buffer() const{
+      return get<HLIRValue>("buffer");
+    }
+
+    // in bytes
+    auto& size() const{
+      return get<HLIRValue>("size");
+    }
   };
 
+  // the ranks that communicate, all of them unless the handle is set to
+  // an ares::CommTeam from ares_team_split(), whose ranks the ranks of the
+  // sends and receives of the team then are
   class HLIRTeam : public HLIRConstruct{
   public:
     HLIRTeam(HLIRModule* module)
-      : HLIRConstruct(module){}
+      : HLIRConstruct(module){
+      (*this)["handle"] = HLIRValue::nullValue();
+    }
+
+    void setHandle(const HLIRValue& handle){
+      (*this)["handle"] = handle;
+    }
+
+    auto& handle() const{
+      return get<HLIRValue>("handle");
+    }
   };
 
+  // sends the buffer to rank with tag, lowered to a call that returns once
+  // the buffer can be reused, or if a future is set, to one that returns
+  // right away and releases the future then, so that the send can be
+  // issued early and waited for late
   class HLIRSend : public HLIRConstruct{
   public:
     virtual std::string intrinsic() const override{
@@ -1200,33 +1608,63 @@ namespace ares{
     }
 
     HLIRSend(HLIRModule* module)
-      : HLIRConstruct(module){}
+      : HLIRConstruct(module){
+      (*this)["future"] = HLIRValue::nullValue();
+    }
 
-    void setFuture(const HLIRFuture& future){
+    // a runtime future handle, from HLIRFuture::create()
+    void setFuture(const HLIRValue& future){
       (*this)["future"] = future;
     }
 
     auto& future() const{
-      return get<HLIRFuture>("future");
+      return get<HLIRValue>("future");
     }
 
-    void setTeam(const HLIRTeam& team){
+    void setTeam(HLIRTeam* team){
       (*this)["team"] = team;
+      team_ = team;
     }
 
     auto& team() const{
       return get<HLIRTeam>("team");
     }
 
-    void setBuffer(const HLIRBuffer& buffer){
+    bool hasTeam() const{
+      return team_;
+    }
+
+    void setBuffer(HLIRBuffer* buffer){
       (*this)["buffer"] = buffer;
     }
 
     auto& buffer() const{
       return get<HLIRBuffer>("buffer");
     }
+
+    // i32 values
+    void setRank(const HLIRValue& rank){
+      (*this)["rank"] = rank;
+    }
+
+    auto& rank() const{
+      return get<HLIRValue>("rank");
+    }
+
+    void setTag(const HLIRValue& tag){
+      (*this)["tag"] = tag;
+    }
+
+    auto& tag() const{
+      return get<HLIRValue>("tag");
+    }
+
+  private:
+    HLIRTeam* team_ = nullptr;
   };
 
+  // receives the next message from rank with tag into the buffer, rank -1
+  // being any of them, split-phase like HLIRSend if a future is set
   class HLIRReceive : public HLIRConstruct{
   public:
     virtual std::string intrinsic() const override{
@@ -1234,31 +1672,57 @@ namespace ares{
     }
 
     HLIRReceive(HLIRModule* module)
-      : HLIRConstruct(module){}
+      : HLIRConstruct(module){
+      (*this)["future"] = HLIRValue::nullValue();
+    }
 
-    void setFuture(const HLIRFuture& future){
+    void setFuture(const HLIRValue& future){
       (*this)["future"] = future;
     }
 
     auto& future() const{
-      return get<HLIRFuture>("future");
+      return get<HLIRValue>("future");
     }
 
-    void setTeam(const HLIRTeam& team){
+    void setTeam(HLIRTeam* team){
       (*this)["team"] = team;
+      team_ = team;
     }
 
     auto& team() const{
       return get<HLIRTeam>("team");
     }
 
-    void setBuffer(const HLIRBuffer& buffer){
+    bool hasTeam() const{
+      return team_;
+    }
+
+    void setBuffer(HLIRBuffer* buffer){
       (*this)["buffer"] = buffer;
     }
 
     auto& buffer() const{
       return get<HLIRBuffer>("buffer");
     }
+
+    void setRank(const HLIRValue& rank){
+      (*this)["rank"] = rank;
+    }
+
+    auto& rank() const{
+      return get<HLIRValue>("rank");
+    }
+
+    void setTag(const HLIRValue& tag){
+      (*this)["tag"] = tag;
+    }
+
+    auto& tag() const{
+      return get<HLIRValue>("tag");
+    }
+
+  private:
+    HLIRTeam* team_ = nullptr;
   };
 
   class HLIRBarrier : public HLIRConstruct{
@@ -1270,13 +1734,21 @@ namespace ares{
     HLIRBarrier(HLIRModule* module)
       : HLIRConstruct(module){}
 
-    void setTeam(const HLIRTeam& team){
+    void setTeam(HLIRTeam* team){
       (*this)["team"] = team;
+      team_ = team;
     }
 
     auto& team() const{
       return get<HLIRTeam>("team");
     }
+
+    bool hasTeam() const{
+      return team_;
+    }
+
+  private:
+    HLIRTeam* team_ = nullptr;
   };
 
   class HLIRParallelFor : public HLIRConstruct{
@@ -1293,24 +1765,24 @@ namespace ares{
       return get<HLIRString>("name");
     }
 
-    auto& index() const{
-      return get<HLIRValue>("index");
+    const HLIRValue& index() const{
+      return *index_;
     }
 
-    auto& insertion() const{
-      return get<HLIRInstruction>("insertion");
+    const HLIRInstruction& insertion() const{
+      return *insertion_;
     }
 
-    auto& argsInsertion() const{
-      return get<HLIRInstruction>("argsInsertion");
+    const HLIRInstruction& argsInsertion() const{
+      return *argsInsertion_;
     }
 
-    auto& args() const{
-      return get<HLIRValue>("args");
+    const HLIRValue& args() const{
+      return *args_;
     }
 
-    auto& exitBlock() const{
-      return get<HLIRBasicBlock>("exitBlock");
+    const HLIRBasicBlock& exitBlock() const{
+      return *exitBlock_;
     }
 
     HLIRFunction& body();
@@ -1323,15 +1795,107 @@ namespace ares{
       return get<HLIRVector>("range");
     }
 
+    size_t dims() const{
+      size_t n = extents_->size();
+      return n == 0 ? 1 : n;
+    }
+
+    const HLIRVector& extents() const{
+      return *extents_;
+    }
+
+    auto& tiles() const{
+      return get<HLIRVector>("tiles");
+    }
+
+    // if set, the lowered parallel for does not wait for its iterations
+    // but stores its synch in the ares::Completion this points to
+    void setCompletion(const HLIRValue& completion){
+      (*this)["completion"] = completion;
+    }
+
+    auto& completion() const{
+      return get<HLIRValue>("completion");
+    }
+
+    // the iterations only start once this ares::Completion has completed
+    void setAfter(const HLIRValue& after){
+      (*this)["after"] = after;
+    }
+
+    auto& after() const{
+      return get<HLIRValue>("after");
+    }
+
+    // i32 priority of the iterations' tasks, 1 if not set
+    void setPriority(const HLIRValue& priority){
+      (*this)["priority"] = priority;
+    }
+
+    auto& priority() const{
+      return get<HLIRValue>("priority");
+    }
+
+    // i32 schedule kind of an ares::Schedule and its i32 chunk, the
+    // runtime's default if not set
+    void setSchedule(const HLIRValue& schedule, const HLIRValue& chunk){
+      (*this)["schedule"] = schedule;
+      (*this)["chunk"] = chunk;
+    }
+
+    auto& schedule() const{
+      return get<HLIRValue>("schedule");
+    }
+
+    auto& chunk() const{
+      return get<HLIRValue>("chunk");
+    }
+
+    // a ForallSimd, whose loop is vectorized at the width of the
+    // target's vector registers
+    void setSimd(bool simd){
+      (*this)["simd"] = HLIRInteger(simd ? 1 : 0);
+    }
+
+    bool simd() const{
+      return get<HLIRInteger>("simd").val() != 0;
+    }
+
+    // a pointer variable the body reads, stored at addr, whose value is
+    // aligned to align bytes if align is not 0, and through which alone
+    // the body reaches what it points to if noAlias
+    void addPointer(const HLIRValue& addr, uint64_t align, bool noAlias){
+      *pointers_ << (HLIRVector() << addr << HLIRInteger(align) <<
+                     HLIRInteger(noAlias ? 1 : 0));
+    }
+
+    const HLIRVector& pointers() const{
+      return *pointers_;
+    }
+
   private:
     friend class HLIRModule;
     friend class HLIRPass;
 
     HLIRParallelFor(HLIRModule* module);
 
+    HLIRParallelFor(HLIRModule* module,
+                    llvm::StructType* indexType,
+                    const std::vector<llvm::Value*>& extents,
+                    const std::vector<llvm::Value*>& tiles);
+
     auto& callMarker() const{
       return get<HLIRInstruction>("callMarker");
     }
+
+    HLIRValue* index_;
+    HLIRInstruction* insertion_;
+    HLIRValue* args_;
+    HLIRInstruction* argsInsertion_;
+    HLIRBasicBlock* exitBlock_;
+    HLIRVector* extents_;
+    HLIRVector* pointers_;
+    HLIRFunction* body_;
   };
 
   class HLIRParallelReduce : public HLIRConstruct{
@@ -1348,75 +1912,191 @@ namespace ares{
       return get<HLIRString>("name");
     }
 
-    auto& index() const{
-      return get<HLIRValue>("index");
+    const HLIRValue& index() const{
+      return *index_;
     }
 
-    auto& reduceType() const{
-      return get<HLIRType>("reduceType");
+    // each thread accumulates its partials of all of the reduce
+    // variables in one struct of this type, field i is variable i
+    const HLIRType& reduceType() const{
+      return *reduceType_;
     }
 
-    auto& sum() const{
-      return get<HLIRBoolean>("sum");
+    size_t numVars() const{
+      return reduceVars_->size();
     }
 
-    void setSum(const HLIRBoolean& flag){
-      (*this)["sum"] = flag;
+    // the order of the first nine matches ares::ReduceOp in frontend.h,
+    // Custom partials are combined by calling the combiner function
+    enum ReduceOp{
+      Sum,
+      Product,
+      Min,
+      Max,
+      And,
+      Or,
+      BitAnd,
+      BitOr,
+      BitXor,
+      Custom
+    };
+
+    ReduceOp op(size_t i) const{
+      return ReduceOp(get<HLIRVector>("ops").get<HLIRInteger>(i).val());
     }
 
-    auto& reduceVar() const{
-      return get<HLIRValue>("reduceVar");
+    void setOp(size_t i, ReduceOp op){
+      get<HLIRVector>("ops")[i] = int64_t(op);
     }
 
-    auto& reduceResult() const{
-      return get<HLIRValue>("reduceResult");
+    bool isSigned(size_t i) const{
+      return get<HLIRVector>("signed").get<HLIRBoolean>(i);
     }
 
-    void setReduceResult(const HLIRValue& value){
-      (*this)["reduceResult"] = value;
+    void setSigned(size_t i, const HLIRBoolean& flag){
+      get<HLIRVector>("signed")[i] = flag;
     }
 
-    auto& insertion() const{
-      return get<HLIRInstruction>("insertion");
+    // a void(T*, const T*) that folds its second argument into the
+    // first, only for a reduce of a single variable
+    auto& combiner() const{
+      return get<HLIRFunction>("combiner");
     }
 
-    auto& entry() const{
-      return get<HLIRInstruction>("entry");
+    void setCombiner(const HLIRFunction& func){
+      if(numVars() != 1){
+        HLIR_ERROR("a combiner requires a single reduce variable");
+      }
+
+      (*this)["combiner"] = func;
+      setOp(0, Custom);
     }
 
-    auto& argsInsertion() const{
-      return get<HLIRInstruction>("argsInsertion");
+    // arrays larger than this many bytes are not privatized, the body
+    // updates them in place with atomic read-modify-writes instead
+    static const uint64_t maxPrivateArrayBytes = 1 << 16;
+
+    size_t numAtomicTargets() const{
+      return get<HLIRVector>("atomicTargets").size();
     }
 
-    auto& args() const{
-      return get<HLIRValue>("args");
+    // array in the enclosing function whose elements the body updates
+    // with op, it is reset to the identity of op before the loop
+    void addAtomicTarget(const HLIRValue& array, ReduceOp op,
+                         const HLIRBoolean& sign){
+      get<HLIRVector>("atomicTargets") << array;
+      get<HLIRVector>("atomicOps") << int64_t(op);
+      get<HLIRVector>("atomicSigned") << sign;
     }
 
-    HLIRFunction& body();
+    llvm::Value* atomicTarget(size_t i) const{
+      return get<HLIRVector>("atomicTargets").get<HLIRValue>(i);
+    }
 
-    void setRange(const HLIRInteger& start, const HLIRInteger& end){
-      if(start > end){
-        HLIR_ERROR("invalid range");
-      }
+    ReduceOp atomicOp(size_t i) const{
+      return 
+        ReduceOp(get<HLIRVector>("atomicOps").get<HLIRInteger>(i).val());
+    }
 
-      (*this)["range"] = HLIRVector() << start << end;
+    bool atomicSigned(size_t i) const{
+      return get<HLIRVector>("atomicSigned").get<HLIRBoolean>(i);
     }
 
+    // address of the partial of variable i within the body
+    llvm::Value* reduceVar(size_t i) const{
+      return reduceVars_->get<HLIRValue>(i);
+    }
+
+    llvm::Value* reduceResult(size_t i) const{
+      return get<HLIRVector>("reduceResults").get<HLIRValue>(i);
+    }
+
+    void setReduceResult(size_t i, const HLIRValue& value){
+      get<HLIRVector>("reduceResults")[i] = value;
+    }
+
+    const HLIRInstruction& insertion() const{
+      return *insertion_;
+    }
 
+    const HLIRInstruction& entry() const{
+      return *entry_;
+    }
+
+    const HLIRInstruction& argsInsertion() const{
+      return *argsInsertion_;
+    }
+
+    const HLIRValue& args() const{
+      return *args_;
+    }
+
+    HLIRFunction& body();
+
+    // runtime values, the index of the body is 64 bit
+    void setRange(const HLIRValue& start, const HLIRValue& end){
+      (*this)["range"] = HLIRVector() << start << end;
+    }
 
     auto& range() const{
       return get<HLIRVector>("range");
     }
 
-  private:
+  protected:
     friend class HLIRModule;
     friend class HLIRPass;
 
-    HLIRParallelReduce(HLIRModule* module, const HLIRType& reduceType);
+    HLIRParallelReduce(HLIRModule* module,
+                       const std::vector<llvm::Type*>& varTypes);
 
     auto& callMarker() const{
       return get<HLIRInstruction>("callMarker");
     }
+
+  private:
+    HLIRValue* index_;
+    HLIRInstruction* insertion_;
+    HLIRInstruction* entry_;
+    HLIRValue* args_;
+    HLIRInstruction* argsInsertion_;
+    HLIRType* reduceType_;
+    HLIRVector* reduceVars_;
+    HLIRFunction* body_;
+  };
+
+  // a reduce of a single variable that also produces its running value
+  // at every index. It is lowered as a reduce over blocks, followed by a
+  // second pass over the same blocks, each starting from the combination
+  // of the blocks before it, so the body runs twice per index.
+  class HLIRParallelScan : public HLIRParallelReduce{
+  public:
+    virtual std::string intrinsic() const override{
+      return "parallel_scan";
+    }
+
+    // if set, the output at index i excludes iteration i
+    bool exclusive() const{
+      return get<HLIRBoolean>("exclusive");
+    }
+
+    void setExclusive(const HLIRBoolean& flag){
+      (*this)["exclusive"] = flag;
+    }
+
+    // the output array, indexed like the body
+    llvm::Value* output() const{
+      return get<HLIRValue>("output");
+    }
+
+    void setOutput(const HLIRValue& value){
+      (*this)["output"] = value;
+    }
+
+  private:
+    friend class HLIRModule;
+    friend class HLIRPass;
+
+    HLIRParallelScan(HLIRModule* module, llvm::Type* varType);
   };
 
 } // namespace ares
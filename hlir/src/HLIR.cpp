@@ -54,9 +54,30 @@
 
 #include "hlir/HLIR.h"
 
-#include <mutex>
-
-//#define USE_ARGOBOTS 1
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <tuple>
+#include <unordered_set>
 
 using namespace std;
 using namespace llvm;
@@ -68,936 +89,4476 @@ namespace{
 
   using ValueVec = vector<Value*>;
 
-  mutex _mutex;
+  // a module is emitted and lowered on one thread, so each thread has
+  // a registry of its own and none is shared with another compilation
+  thread_local unordered_map<Module*, HLIRModule*> _moduleMap;
+
+  // with -mllvm -ares-offload, top-level Foralls whose bodies can run on
+  // the GPU are also compiled to PTX and launched by the runtime when a
+  // device is available
+  cl::opt<bool> _offload("ares-offload",
+                         cl::desc("Offload Forall bodies to NVPTX"),
+                         cl::init(false));
+
+  cl::opt<unsigned> _inlineWork("ares-inline-work",
+                                 cl::desc("Work below which a Forall of "
+                                          "constant bounds runs inline"),
+                                 cl::init(2000));
+
+  // a run with ARES_PROFILE set records the launches of each region and
+  // the cost of their iterations, which -ares-profile-use reads back
+  cl::opt<string> _profileUse("ares-profile-use",
+                              cl::desc("Choose the schedules of Foralls "
+                                       "and reduces from a region profile"),
+                              cl::init(""));
+
+  // with a profile, a region whose launches take less than this many ns
+  // on average is not worth the queuing, a dynamic chunk is sized to
+  // take about PROFILE_CHUNK_NS, and iterations whose cost varies by
+  // more than PROFILE_IMBALANCE of the mean are scheduled dynamically
+  const double PROFILE_SERIAL_NS = 20000;
+  const double PROFILE_CHUNK_NS = 20000;
+  const double PROFILE_IMBALANCE = 0.25;
+
+  const char* OFFLOAD_TRIPLE = "nvptx64-nvidia-cuda";
+
+  const char* OFFLOAD_KERNEL = "ares_offload_kernel";
+
+
+  // the identity of op for values of type t, null for a custom combiner
+  Constant* reduceIdentity(HLIRParallelReduce::ReduceOp op, bool sign,
+                           Type* t){
+    using Op = HLIRParallelReduce::ReduceOp;
+
+    if(op == Op::Custom){
+      return nullptr;
+    }
 
-  map<string, HLIRModule*> _moduleNameMap;
+    if(t->isFloatingPointTy()){
+      switch(op){
+        case Op::Sum:
+          return ConstantFP::get(t, 0.0);
+        case Op::Product:
+          return ConstantFP::get(t, 1.0);
+        case Op::Min:
+          return ConstantFP::getInfinity(t, false);
+        case Op::Max:
+          return ConstantFP::getInfinity(t, true);
+        default:
+          HLIR_ERROR("invalid floating point reduce operator");
+      }
+    }
 
-  map<Module*, HLIRModule*> _moduleMap;
+    auto it = dyn_cast<IntegerType>(t);
+    if(!it){
+      HLIR_ERROR("reduce type requires a combiner");
+    }
 
-  size_t _nextId = 0;
+    unsigned bits = it->getBitWidth();
+
+    switch(op){
+      case Op::Sum:
+      case Op::Or:
+      case Op::BitOr:
+      case Op::BitXor:
+        return ConstantInt::get(t, 0);
+      case Op::Product:
+      case Op::And:
+        return ConstantInt::get(t, 1);
+      case Op::Min:
+        return ConstantInt::get(t, sign ? APInt::getSignedMaxValue(bits) :
+                                APInt::getMaxValue(bits));
+      case Op::Max:
+        return ConstantInt::get(t, sign ? APInt::getSignedMinValue(bits) :
+                                APInt::getMinValue(bits));
+      case Op::BitAnd:
+        return ConstantInt::get(t, APInt::getAllOnesValue(bits));
+      default:
+        HLIR_ERROR("invalid reduce operator");
+    }
+  }
 
-  using Guard = lock_guard<mutex>;
+  // the value the partial of variable i starts from, for an array the
+  // value of each of its elements
+  Constant* reduceIdentity(HLIRParallelReduce* r, size_t i, Type* t){
+    while(auto at = dyn_cast<ArrayType>(t)){
+      t = at->getElementType();
+    }
 
-  size_t createId(){
-    return _nextId++;
+    return reduceIdentity(r->op(i), r->isSigned(i), t);
   }
 
-  string createName(const string& prefix){
-    return prefix + toStr(createId());
+  // combine two values with a built-in reduce operator
+  Value* reduceCombine(IRBuilder<>& b, HLIRParallelReduce::ReduceOp op,
+                       bool sign, Value* v1, Value* v2){
+    using Op = HLIRParallelReduce::ReduceOp;
+
+    bool fp = v1->getType()->isFloatingPointTy();
+
+    switch(op){
+      case Op::Sum:
+        return fp ? b.CreateFAdd(v1, v2) : b.CreateAdd(v1, v2);
+      case Op::Product:
+        return fp ? b.CreateFMul(v1, v2) : b.CreateMul(v1, v2);
+      case Op::Min:{
+        Value* lt = fp ? b.CreateFCmpOLT(v2, v1) :
+          sign ? b.CreateICmpSLT(v2, v1) : b.CreateICmpULT(v2, v1);
+        return b.CreateSelect(lt, v2, v1);
+      }
+      case Op::Max:{
+        Value* gt = fp ? b.CreateFCmpOGT(v2, v1) :
+          sign ? b.CreateICmpSGT(v2, v1) : b.CreateICmpUGT(v2, v1);
+        return b.CreateSelect(gt, v2, v1);
+      }
+      case Op::And:
+      case Op::BitAnd:
+        return b.CreateAnd(v1, v2);
+      case Op::Or:
+      case Op::BitOr:
+        return b.CreateOr(v1, v2);
+      case Op::BitXor:
+        return b.CreateXor(v1, v2);
+      default:
+        HLIR_ERROR("invalid reduce operator");
+    }
   }
 
-  static const size_t REDUCE_THREADS = 8;
+  // combine two partials of variable i, or of two elements of it
+  Value* reduceCombine(IRBuilder<>& b, HLIRParallelReduce* r, size_t i,
+                       Value* v1, Value* v2){
+    return reduceCombine(b, r->op(i), r->isSigned(i), v1, v2);
+  }
 
-} // namespace
+  // the element type of a possibly nested array type t and the number of
+  // elements it holds in total
+  Type* flattenArray(Type* t, uint64_t& n){
+    n = 1;
 
-HLIRModule* HLIRModule::getModule(Module* module){
-  Guard guard(_mutex);
+    while(auto at = dyn_cast<ArrayType>(t)){
+      n *= at->getNumElements();
+      t = at->getElementType();
+    }
 
-  auto itr = _moduleMap.find(module);
-  if(itr == _moduleMap.end()){
-    auto m = new HLIRModule(module);
-    m->setName(createName("module"));
-    _moduleMap[module] = m;
-    _moduleNameMap[m->name()] = m;
-    return m;
+    return t;
   }
 
-  return itr->second;
-}
+  // emits for(i = begin; i < end; ++i) body(i), with the counter in an
+  // alloca of f, and leaves the builder after the loop
+  void emitLoop(IRBuilder<>& b, Function* f, Value* begin, Value* end,
+                const string& name, const function<void(Value*)>& body){
+    LLVMContext& c = f->getContext();
 
-void HLIRModule::addConstruct(HLIRConstruct* c){
-  constructMap_.emplace(c->marker(), c);
-}
+    BasicBlock& entry = f->getEntryBlock();
+    IRBuilder<> eb(&entry, entry.getFirstInsertionPt());
+    Value* iPtr = eb.CreateAlloca(begin->getType(), nullptr, name + ".index");
 
-HLIRParallelFor* HLIRModule::createParallelFor(){
-  auto pf = new HLIRParallelFor(this);
+    b.CreateStore(begin, iPtr);
 
-  string name = createName("pfor");
-  pf->setName(name);
+    BasicBlock* condBlock = BasicBlock::Create(c, name + ".cond", f);
+    BasicBlock* loopBlock = BasicBlock::Create(c, name + ".body", f);
+    BasicBlock* exitBlock = BasicBlock::Create(c, name + ".exit", f);
 
-  (*this)[name] = pf;
-  
-  return pf;
-}
+    b.CreateBr(condBlock);
 
-HLIRParallelReduce* HLIRModule::createParallelReduce(
-  const HLIRType& reduceType){
-  
-  auto r = new HLIRParallelReduce(this, reduceType);
+    b.SetInsertPoint(condBlock);
 
-  string name = createName("reduce");
-  r->setName(name);
+    Value* i = b.CreateLoad(iPtr);
 
-  (*this)[name] = r;
-  
-  return r;
-}
+    b.CreateCondBr(b.CreateICmpULT(i, end), loopBlock, exitBlock);
 
-HLIRTask* HLIRModule::createTask(){
-  auto task = new HLIRTask(this);
-  tasks_.push_back(task);
-  
-  string name = createName("task");
-  task->setName(name);
+    b.SetInsertPoint(loopBlock);
 
-  (*this)[name] = task;
-  
-  return task;
-}
+    body(i);
 
-void HLIRModule::findExternalValues_(Function* f,
-                                     vector<Instruction*>& v,
-                                     bool recursive,
-                                     bool top,
-                                     vector<HLIRParallelFor*>& ps,
-                                     vector<HLIRParallelReduce*>& rs){
-  for(BasicBlock& bi : *f){
-    for(Instruction& ii : bi){
-      bool handled = false;
+    b.CreateStore(b.CreateAdd(i, ConstantInt::get(i->getType(), 1)), iPtr);
 
-      if(CallInst* ci = dyn_cast<CallInst>(&ii)){
-        auto itr = constructMap_.find(ci);
-        
-        if(itr != constructMap_.end()){
-          HLIRConstruct* hc = itr->second;
-          if(auto pf = dynamic_cast<HLIRParallelFor*>(hc)){
-            if(top){
-              ps.push_back(pf);
-            }
-            
-            if(recursive){
-              findExternalValues_(pf->body(), v, recursive, false, ps, rs);
-            }
-          }
-          else if(auto pr = dynamic_cast<HLIRParallelReduce*>(hc)){
-            if(top){
-              rs.push_back(pr);
-            }
+    b.CreateBr(condBlock);
 
-            if(recursive){
-              findExternalValues_(pr->body(), v, recursive, false, ps, rs);
-            }
-          }
-          
-          handled = true;
-        }
+    b.SetInsertPoint(exitBlock);
+  }
+
+  // store the identity of variable i into every element of the array of
+  // type t behind ptr
+  void initArray(IRBuilder<>& b, Function* f, HLIRParallelReduce::ReduceOp op,
+                 bool sign, Type* t, Value* ptr){
+    uint64_t n;
+    Type* et = flattenArray(t, n);
+
+    Value* base = b.CreateBitCast(ptr, PointerType::get(et, 0));
+    Value* initVal = reduceIdentity(op, sign, et);
+
+    Type* i64Ty = Type::getInt64Ty(f->getContext());
+
+    emitLoop(b, f, ConstantInt::get(i64Ty, 0), ConstantInt::get(i64Ty, n),
+             "array.init", [&](Value* e){
+      b.CreateStore(initVal, b.CreateGEP(base, e));
+    });
+  }
+
+  // whether ptr addresses memory within base
+  bool derivesFrom(Value* ptr, Value* base){
+    for(;;){
+      if(ptr == base){
+        return true;
       }
 
-      if(handled){
-        continue;
+      if(auto gep = dyn_cast<GEPOperator>(ptr)){
+        ptr = gep->getPointerOperand();
       }
-      
-      for(Value* vi : ii.operands()){
-        if(Instruction* ij = dyn_cast<Instruction>(vi)){
-          if(ij->getParent()->getParent() != f){
-            v.push_back(ij);
+      else if(auto bc = dyn_cast<BitCastOperator>(ptr)){
+        ptr = bc->getOperand(0);
+      }
+      else{
+        return false;
+      }
+    }
+  }
+
+  // rewrite each x[j] = x[j] op v in f that stores into target as an
+  // atomic read-modify-write, through a compare and swap loop for the
+  // operators that atomicrmw does not have
+  void makeAtomicUpdates(Function* f, Value* target){
+    LLVMContext& c = f->getContext();
+
+    vector<StoreInst*> stores;
+
+    for(BasicBlock& bb : *f){
+      for(Instruction& i : bb){
+        if(auto si = dyn_cast<StoreInst>(&i)){
+          if(derivesFrom(si->getPointerOperand(), target)){
+            stores.push_back(si);
           }
         }
       }
     }
-  }
-}
 
-void HLIRModule::lowerParallelFor_(HLIRParallelFor* pf,
-                                   StructType* argsType,
-                                   unordered_map<Value*, size_t>& capturedMap,
-                                   unordered_map<Value*, Value*>& replacedMap){
+    for(StoreInst* si : stores){
+      Value* p = si->getPointerOperand();
 
-  auto& c = module_->getContext();
-  IRBuilder<> b(c);
+      auto bo = dyn_cast<BinaryOperator>(si->getValueOperand());
 
-  // marker is the caller
-  auto marker = pf->get<HLIRInstruction>("marker");
-  BasicBlock* block = marker->getParent();
+      LoadInst* li = nullptr;
+      Value* v = nullptr;
 
-  // already handled as a nested case
-  if(!block){
-    return;
-  }
+      if(bo){
+        for(size_t k = 0; k < 2 && !li; ++k){
+          auto lk = dyn_cast<LoadInst>(bo->getOperand(k));
+          if(lk && lk->getPointerOperand() == p && 
+             (k == 0 || bo->isCommutative())){
+            li = lk;
+            v = bo->getOperand(1 - k);
+          }
+        }
+      }
 
-  Function* func = block->getParent();
+      if(!li){
+        HLIR_ERROR("a shared reduce array only supports x[i] op= v updates");
+      }
 
-  // top-level parallel for - (not nested)
-  bool top = !func->getName().startswith("hlir.parallel_for.body");
+      IRBuilder<> b(si);
 
-  // this will be handled as a nested parallel for later from the top
-  if(!top && !argsType){
-    return;
-  }
+      AtomicRMWInst::BinOp rmw = AtomicRMWInst::BAD_BINOP;
 
-  vector<Instruction*> rvs;
+      switch(bo->getOpcode()){
+        case Instruction::Add:
+          rmw = AtomicRMWInst::Add;
+          break;
+        case Instruction::And:
+          rmw = AtomicRMWInst::And;
+          break;
+        case Instruction::Or:
+          rmw = AtomicRMWInst::Or;
+          break;
+        case Instruction::Xor:
+          rmw = AtomicRMWInst::Xor;
+          break;
+        case Instruction::Mul:
+        case Instruction::FAdd:
+        case Instruction::FMul:
+          break;
+        default:
+          HLIR_ERROR("invalid update of a shared reduce array");
+      }
 
-  vector<HLIRParallelFor*> rps;
-  vector<HLIRParallelReduce*> rrs;
+      // the waiting thread synchronizes with the workers when the loop
+      // completes, so the updates themselves can be relaxed
+      if(rmw != AtomicRMWInst::BAD_BINOP){
+        b.CreateAtomicRMW(rmw, p, v, Monotonic);
+      }
+      else{
+        Type* t = v->getType();
+        auto it = IntegerType::get(c, t->getPrimitiveSizeInBits());
+        Value* ip = b.CreateBitCast(p, PointerType::get(it, 0));
 
-  findExternalValues_(pf->body(), rvs, true, true, rps, rrs);
+        LoadInst* init = b.CreateLoad(ip);
+        init->setAtomic(Monotonic);
+        init->setAlignment(it->getBitWidth()/8);
 
-  vector<Instruction*> vs;
+        BasicBlock* before = si->getParent();
+        BasicBlock* after = before->splitBasicBlock(si, "atomic.exit");
+        before->getTerminator()->eraseFromParent();
 
-  vector<HLIRParallelFor*> ps;
-  vector<HLIRParallelReduce*> rs;
+        BasicBlock* loop = BasicBlock::Create(c, "atomic.loop", f, after);
 
-  findExternalValues_(pf->body(), vs, false, true, ps, rs);
+        b.SetInsertPoint(before);
+        b.CreateBr(loop);
 
-  // create the struct of all fields used recursively
-  if(top){
-    TypeVec fields;
-    size_t i = 0;
+        b.SetInsertPoint(loop);
 
-    for(auto vi : rvs){
-      fields.push_back(vi->getType()); 
-      capturedMap.emplace(vi, i++);   
+        PHINode* old = b.CreatePHI(it, 2);
+        old->addIncoming(init, before);
+
+        Value* nv = b.CreateBinOp(bo->getOpcode(), b.CreateBitCast(old, t), v);
+
+        Value* pair = 
+          b.CreateAtomicCmpXchg(ip, old, b.CreateBitCast(nv, it),
+                                Monotonic, Monotonic);
+
+        old->addIncoming(b.CreateExtractValue(pair, 0), loop);
+
+        b.CreateCondBr(b.CreateExtractValue(pair, 1), after, loop);
+      }
+
+      si->eraseFromParent();
+
+      if(bo->use_empty()){
+        bo->eraseFromParent();
+      }
+
+      if(li->use_empty()){
+        li->eraseFromParent();
+      }
     }
+  }
 
-    argsType = StructType::create(c, fields, "struct.func_args");
+  // combine the partial struct behind partialPtr into the one behind accPtr
+  void combinePartials(IRBuilder<>& b, HLIRParallelReduce* r,
+                       StructType* rt, Value* accPtr, Value* partialPtr){
+    if(r->numVars() > 0 && r->op(0) == HLIRParallelReduce::Custom){
+      Function* combiner = r->combiner();
+      auto ctype = combiner->getFunctionType();
+
+      Value* acc = b.CreateStructGEP(rt, accPtr, 0);
+      Value* partial = b.CreateStructGEP(rt, partialPtr, 0);
+
+      b.CreateCall(combiner,
+                   {b.CreateBitCast(acc, ctype->getParamType(0)),
+                    b.CreateBitCast(partial, ctype->getParamType(1))});
+      return;
+    }
+
+    // arrays are merged separately, element by element
+    for(size_t k = 0; k < r->numVars(); ++k){
+      if(rt->getElementType(k)->isArrayTy()){
+        continue;
+      }
+
+      Value* ak = b.CreateStructGEP(rt, accPtr, k);
+      Value* acc = b.CreateLoad(ak);
+      Value* partial = b.CreateLoad(b.CreateStructGEP(rt, partialPtr, k));
+      b.CreateStore(reduceCombine(b, r, k, acc, partial), ak);
+    }
   }
- 
-  // the point within the called parallel for to begin codegen / unwrap args
-  auto argsInsertion = pf->get<HLIRInstruction>("argsInsertion");
-  b.SetInsertPoint(argsInsertion); 
 
-  Value* argsStructPtr = 
-    b.CreateBitCast(pf->args(), PointerType::get(argsType, 0));
+  // floating point sums are the ones that compensated accumulation applies to
+  bool isCompensated(HLIRParallelReduce* r, size_t i, Type* t){
+    return r->op(i) == HLIRParallelReduce::Sum && t->isFloatingPointTy();
+  }
 
-  // find the values that need to be remapped from the struct GEP
-  for(Instruction* vi : rvs){
-    bool local = vi->getParent()->getParent() == pf->body();
+  // self-referential loop ID asking the vectorizer to vectorize the loop,
+  // with width lanes if it is not 0
+  MDNode* vectorizeLoopID(LLVMContext& c, unsigned width=0){
+    auto self = MDNode::getTemporary(c, None);
+    SmallVector<Metadata*, 3> ops = {self.get()};
+
+    ops.push_back(
+      MDNode::get(c, {MDString::get(c, "llvm.loop.vectorize.enable"),
+                      ConstantAsMetadata::get(ConstantInt::getTrue(c))}));
+
+    if(width > 0){
+      ops.push_back(
+        MDNode::get(c, {MDString::get(c, "llvm.loop.vectorize.width"),
+                        ConstantAsMetadata::get(
+                          ConstantInt::get(Type::getInt32Ty(c), width))}));
+    }
+
+    MDNode* loopID = MDNode::get(c, ops);
+    loopID->replaceOperandWith(0, loopID);
+    return loopID;
+  }
 
-    Value* ri = nullptr;
+  // the lanes of a ForallSimd body, as many of the widest value it loads
+  // or stores as a vector register of the target of f holds: 64 bytes
+  // with AVX-512, 32 with AVX2 and 16 otherwise. An outer body has no
+  // target attributes, they are those of the functions clang emitted.
+  unsigned simdLanes(Function* f, Function* body){
+    if(!f->hasFnAttribute("target-features")){
+      for(Function& fi : *f->getParent()){
+        if(fi.hasFnAttribute("target-features")){
+          f = &fi;
+          break;
+        }
+      }
+    }
 
-    for(Use& u : vi->uses()){
-      User* user = u.getUser();
+    StringRef features =
+      f->getFnAttribute("target-features").getValueAsString();
 
-      auto inst = dyn_cast<Instruction>(user);
+    Triple::ArchType arch = Triple(f->getParent()->getTargetTriple()).getArch();
+
+    unsigned bytes = 16;
+    if(arch == Triple::x86_64 || arch == Triple::x86){
+      if(features.count("+avx512f")){
+        bytes = 64;
+      }
+      else if(features.count("+avx2")){
+        bytes = 32;
+      }
+    }
 
-      bool found = false;
+    const DataLayout& dl = f->getParent()->getDataLayout();
+    uint64_t widest = 4;
 
-      auto parent = inst->getParent()->getParent();
+    for(BasicBlock& bi : *body){
+      for(Instruction& ii : bi){
+        Type* t;
 
-      if(inst){
-        if(parent == pf->body()){
-          found = true;
+        if(auto li = dyn_cast<LoadInst>(&ii)){
+          t = li->getType();
+        }
+        else if(auto si = dyn_cast<StoreInst>(&ii)){
+          t = si->getValueOperand()->getType();
         }
         else{
-          for(auto pfi : rps){
-            if(parent == pfi->body()){
-              found = true;
-              break;
-            }
+          continue;
+        }
+
+        if(t->isSingleValueType() && !t->isVectorTy()){
+          widest = max(widest, dl.getTypeStoreSize(t));
+        }
+      }
+    }
+
+    return max(uint64_t(2), bytes / widest);
+  }
+
+  // an access of a parallel for body to memory it does not own, as the
+  // GEP indices from its base, null for the iteration index
+  struct BodyAccess{
+    Value* base;
+    vector<Value*> indices;
+    bool known;
+    bool indexed;
+    bool write;
+  };
+
+  void decomposeAccess(Value* ptr, Value* indexPtr, BodyAccess& a){
+    a.known = true;
+    a.indexed = false;
+
+    while(auto gep = dyn_cast<GEPOperator>(ptr)){
+      vector<Value*> indices;
+
+      for(auto itr = gep->idx_begin(), end = gep->idx_end(); itr != end; ++itr){
+        Value* idx = *itr;
+
+        if(isa<ConstantInt>(idx)){
+          indices.push_back(idx);
+          continue;
+        }
+
+        if(auto ci = dyn_cast<CastInst>(idx)){
+          if(isa<ZExtInst>(ci) || isa<SExtInst>(ci)){
+            idx = ci->getOperand(0);
           }
         }
+
+        auto li = dyn_cast<LoadInst>(idx);
+        if(li && li->getPointerOperand() == indexPtr){
+          indices.push_back(nullptr);
+          a.indexed = true;
+        }
+        else{
+          a.known = false;
+          indices.push_back(idx);
+        }
       }
 
-      if(found && !local){
-        if(!ri){
-          Value* vr = vi;
-          for(;;){
-            auto ritr = replacedMap.find(vr);
-            if(ritr != replacedMap.end()){
-              vr = ritr->second;
-            }
-            else{
-              break;
+      a.indices.insert(a.indices.begin(), indices.begin(), indices.end());
+      ptr = gep->getPointerOperand();
+    }
+
+    a.base = ptr;
+  }
+
+  // collects the accesses of a body, false if it has any that are not
+  // plain loads and stores, such as calls that may access memory
+  bool collectAccesses(Function* f, Value* indexPtr, 
+                       vector<BodyAccess>& accesses){
+    const DataLayout& dl = f->getParent()->getDataLayout();
+
+    for(BasicBlock& bi : *f){
+      for(Instruction& ii : bi){
+        if(auto ci = dyn_cast<CallInst>(&ii)){
+          if(isa<DbgInfoIntrinsic>(ci) || ci->doesNotAccessMemory()){
+            continue;
+          }
+
+          if(auto ic = dyn_cast<IntrinsicInst>(ci)){
+            if(ic->getIntrinsicID() == Intrinsic::lifetime_start ||
+               ic->getIntrinsicID() == Intrinsic::lifetime_end){
+              continue;
             }
           }
 
-          auto itr = capturedMap.find(vr);
-          assert(itr != capturedMap.end());
-          size_t index = itr->second;
+          return false;
+        }
+
+        Value* ptr;
+        bool write;
+
+        if(auto li = dyn_cast<LoadInst>(&ii)){
+          if(!li->isSimple()){
+            return false;
+          }
+          ptr = li->getPointerOperand();
+          write = false;
+        }
+        else if(auto si = dyn_cast<StoreInst>(&ii)){
+          if(!si->isSimple()){
+            return false;
+          }
+          ptr = si->getPointerOperand();
+          write = true;
+        }
+        else if(ii.mayReadOrWriteMemory()){
+          return false;
+        }
+        else{
+          continue;
+        }
 
-          Value* gi = b.CreateStructGEP(argsType, argsStructPtr, index);
-          ri = b.CreateLoad(gi, vi->getName());
+        if(ptr == indexPtr){
+          continue;
         }
 
-        user->replaceUsesOfWith(vi, ri);
-        replacedMap.emplace(ri, vi);
+        auto ai = dyn_cast<AllocaInst>(GetUnderlyingObject(ptr, dl));
+        if(ai && ai->getParent()->getParent() == f){
+          continue;
+        }
+
+        BodyAccess a;
+        a.write = write;
+        decomposeAccess(ptr, indexPtr, a);
+        accesses.push_back(a);
       }
     }
+
+    return true;
   }
 
-  b.SetInsertPoint(marker);      
+  bool isIdentified(Value* v){
+    return isa<AllocaInst>(v) || isa<GlobalVariable>(v);
+  }
 
-  Value* argsPtr = b.CreateAlloca(argsType);
+  // true if running the second body right after the first in the same
+  // iteration gives the same result as running it after all of the
+  // iterations of the first. Accesses that may conflict must be to the
+  // same element of the iteration.
+  bool canFuse(const vector<BodyAccess>& as, const vector<BodyAccess>& bs,
+               const DataLayout& dl){
+    for(const BodyAccess& a : as){
+      for(const BodyAccess& b : bs){
+        if(!a.write && !b.write){
+          continue;
+        }
 
-  if(top){
-    for(auto& itr : capturedMap){
-      Instruction* ri = dyn_cast<Instruction>(itr.first);
+        if(a.base == b.base && a.known && b.known && a.indexed && 
+           a.indices == b.indices){
+          continue;
+        }
+
+        Value* oa = GetUnderlyingObject(a.base, dl);
+        Value* ob = GetUnderlyingObject(b.base, dl);
 
-      if(ri && ri->getParent()->getParent() == marker->getParent()->getParent()){
-        Value* pi = b.CreateStructGEP(argsType, argsPtr, itr.second);
-        b.CreateStore(itr.first, pi);
+        if(oa != ob && isIdentified(oa) && isIdentified(ob)){
+          continue;
+        }
+
+        return false;
       }
     }
+
+    return true;
   }
-  else{
-    for(size_t i = 0; i < rvs.size(); ++i){
-      Value* vi = rvs[i];
 
-      Value* ri = vi;
-      for(;;){
-        auto ritr = replacedMap.find(ri);
-        if(ritr != replacedMap.end()){
-          ri = ritr->second;
-        }
-        else{
-          break;
+  // abstract cost of one iteration of a parallel for body, an
+  // instruction count with calls weighted higher. 0 if the body has a
+  // loop of its own besides the one ending in latch, whose trip count
+  // is not known.
+  uint64_t estimateBodyCost(Function* f, BasicBlock* latch){
+    DominatorTree dt(*f);
+
+    uint64_t cost = 0;
+
+    for(BasicBlock& bi : *f){
+      for(BasicBlock* si : successors(&bi)){
+        if(&bi != latch && dt.dominates(si, &bi)){
+          return 0;
         }
       }
 
-      auto itr = capturedMap.find(ri);
-      assert(itr != capturedMap.end());
-      size_t index = itr->second;
+      for(Instruction& ii : bi){
+        if(isa<DbgInfoIntrinsic>(&ii)){
+          continue;
+        }
 
-      Value* pi = b.CreateStructGEP(argsType, argsPtr, index);
-      b.CreateStore(vi, pi);    
+        cost += isa<CallInst>(&ii) && !isa<IntrinsicInst>(&ii) ? 20 : 1;
+      }
     }
+
+    return cost;
   }
 
-  Function* createSynchFunc = 
-    getFunction("__ares_create_synch", {i32Ty}, voidPtrTy);
+  // a body can run on the device if it does not refer to anything in the
+  // host module but target independent intrinsics and functions defined
+  // there that can run on the device themselves, which are added to funcs
+  bool isOffloadable(Function* f, set<Function*>& funcs){
+    if(!funcs.insert(f).second){
+      return true;
+    }
+
+    for(BasicBlock& bi : *f){
+      for(Instruction& ii : bi){
+        if(auto ci = dyn_cast<CallInst>(&ii)){
+          Function* callee = ci->getCalledFunction();
+          if(!callee || callee->getName().startswith("llvm.x86")){
+            return false;
+          }
+
+          if(!callee->isIntrinsic() &&
+             (callee->isDeclaration() || !isOffloadable(callee, funcs))){
+            return false;
+          }
+        }
+        else if(isa<InvokeInst>(&ii)){
+          return false;
+        }
+
+        for(Value* op : ii.operands()){
+          if(isa<GlobalVariable>(op) || isa<ConstantExpr>(op)){
+            return false;
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+
+  // the range args of a body are private to its task and only read
+  void setBodyArgAttrs(Function* f, StructType* argsType){
+    f->setDoesNotAlias(1);
+    f->setDoesNotCapture(1);
+    f->setOnlyReadsMemory(1);
+    f->addDereferenceableAttr(1,
+      f->getParent()->getDataLayout().getTypeAllocSize(argsType));
+  }
+
+  // the attributes of an outlined function once its code is final: it
+  // is called through the runtime with a valid args pointer, and cannot
+  // unwind unless something it calls can. LLVM has no norecurse here,
+  // which a body could not always have anyway, since a worker that waits
+  // for a nested construct runs other tasks, the same body's among them.
+  void setOutlinedAttrs(Function* f){
+    for(Argument& arg : f->args()){
+      if(arg.getType()->isPointerTy()){
+        f->addAttribute(arg.getArgNo() + 1, Attribute::NonNull);
+      }
+    }
+
+    for(BasicBlock& bi : *f){
+      for(Instruction& ii : bi){
+        if(ii.mayThrow()){
+          return;
+        }
+      }
+    }
+
+    f->setDoesNotThrow();
+  }
+
+  // the alignment that an llvm.assume in the function of v holds v to,
+  // as __builtin_assume_aligned() emits it: the low bits of the
+  // ptrtoint of v, or of what it was cast from, compared equal to 0
+  uint64_t assumedAlignment(Value* v){
+    if(!v->getType()->isPointerTy()){
+      return 0;
+    }
+
+    uint64_t align = 0;
+
+    Value* base = v->stripPointerCasts();
+
+    vector<Value*> casts = {base};
+    for(User* ui : base->users()){
+      if(isa<BitCastInst>(ui)){
+        casts.push_back(ui);
+      }
+    }
+
+    vector<PtrToIntInst*> ints;
+    for(Value* vi : casts){
+      for(User* uj : vi->users()){
+        if(auto pi = dyn_cast<PtrToIntInst>(uj)){
+          ints.push_back(pi);
+        }
+      }
+    }
+
+    for(PtrToIntInst* pi : ints){
+      for(User* uj : pi->users()){
+        auto bi = dyn_cast<BinaryOperator>(uj);
+        if(!bi || bi->getOpcode() != Instruction::And){
+          continue;
+        }
+
+        auto mask = dyn_cast<ConstantInt>(bi->getOperand(1));
+        if(!mask || !isPowerOf2_64(mask->getZExtValue() + 1)){
+          continue;
+        }
+
+        for(User* uk : bi->users()){
+          auto ci = dyn_cast<ICmpInst>(uk);
+          auto zero = ci ? dyn_cast<ConstantInt>(ci->getOperand(1)) : nullptr;
+          if(!zero || !zero->isZero() ||
+             ci->getPredicate() != ICmpInst::ICMP_EQ){
+            continue;
+          }
+
+          for(User* ul : ci->users()){
+            auto ai = dyn_cast<IntrinsicInst>(ul);
+            if(ai && ai->getIntrinsicID() == Intrinsic::assume){
+              align = max(align, mask->getZExtValue() + 1);
+            }
+          }
+        }
+      }
+    }
+
+    return align;
+  }
+
+  // puts the loads and stores of f in a scope per restrict pointer of ps
+  // that they are based on. One based on nothing but these and the
+  // locals of f is also marked as not aliasing the pointers it is not
+  // based on, so that the vectorizer needs no runtime checks between
+  // them. Any other access may be based on all of them and is left as
+  // it is.
+  void addRestrictScopes(Function* f, const vector<Value*>& ps,
+                         const DataLayout& dl){
+    if(ps.empty()){
+      return;
+    }
+
+    LLVMContext& c = f->getContext();
+    MDBuilder mb(c);
+
+    MDNode* domain = mb.createAnonymousAliasScopeDomain(f->getName());
+
+    unordered_map<Value*, MDNode*> scopes;
+    for(Value* p : ps){
+      scopes[p] = mb.createAnonymousAliasScope(domain, p->getName());
+    }
+
+    for(BasicBlock& bi : *f){
+      for(Instruction& ii : bi){
+        Value* ptr;
+
+        if(auto li = dyn_cast<LoadInst>(&ii)){
+          ptr = li->getPointerOperand();
+        }
+        else if(auto si = dyn_cast<StoreInst>(&ii)){
+          ptr = si->getPointerOperand();
+        }
+        else{
+          continue;
+        }
+
+        SmallVector<Value*, 4> objects;
+        GetUnderlyingObjects(ptr, objects, dl);
+
+        unordered_set<Value*> based;
+        bool known = true;
+
+        for(Value* o : objects){
+          if(scopes.count(o) > 0){
+            based.insert(o);
+          }
+          else if(!isa<AllocaInst>(o)){
+            known = false;
+          }
+        }
+
+        SmallVector<Metadata*, 4> in;
+        SmallVector<Metadata*, 4> out;
+
+        for(Value* p : ps){
+          if(based.count(p) > 0){
+            in.push_back(scopes[p]);
+          }
+          else if(known){
+            out.push_back(scopes[p]);
+          }
+        }
+
+        if(!in.empty()){
+          ii.setMetadata(LLVMContext::MD_alias_scope,
+            MDNode::concatenate(ii.getMetadata(LLVMContext::MD_alias_scope),
+                                MDNode::get(c, in)));
+        }
+
+        if(!out.empty()){
+          ii.setMetadata(LLVMContext::MD_noalias,
+            MDNode::concatenate(ii.getMetadata(LLVMContext::MD_noalias),
+                                MDNode::get(c, out)));
+        }
+      }
+    }
+  }
+
+  // matches the runtime's TaskDependence bits
+  enum{
+    TASK_DEP_IN = 1,
+    TASK_DEP_OUT = 2
+  };
+
+  // matches the runtime's RegionKind
+  enum{
+    REGION_PARALLEL_FOR = 1,
+    REGION_PARALLEL_REDUCE = 2,
+    REGION_PARALLEL_SCAN = 3,
+    REGION_TASK = 4
+  };
+
+  // one line of a region profile, as written by the runtime's
+  // RegionProfile: kind line launches iterations chunks ns cost cost2
+  // file, cost being the sum of the ns per iteration of each chunk
+  struct ProfileRecord{
+    uint64_t launches = 0;
+    uint64_t iterations = 0;
+    uint64_t chunks = 0;
+    uint64_t ns = 0;
+    double cost = 0.0;
+    double cost2 = 0.0;
+
+    double nsPerLaunch() const{
+      return launches > 0 ? double(ns) / launches : 0.0;
+    }
+
+    double nsPerIteration() const{
+      return iterations > 0 ? double(ns) / iterations : 0.0;
+    }
+
+    // the coefficient of variation of the cost of an iteration across
+    // the chunks
+    double imbalance() const{
+      if(chunks == 0 || cost <= 0.0){
+        return 0.0;
+      }
+
+      double mean = cost / chunks;
+      double var = cost2 / chunks - mean * mean;
+      return var > 0.0 ? sqrt(var) / mean : 0.0;
+    }
+  };
+
+  using ProfileKey = tuple<uint32_t, string, uint32_t>;
+
+  // the profile of -ares-profile-use, read once, empty without one
+  const map<ProfileKey, ProfileRecord>& regionProfile(){
+    static const map<ProfileKey, ProfileRecord> profile = []{
+      map<ProfileKey, ProfileRecord> m;
+
+      if(_profileUse.empty()){
+        return m;
+      }
+
+      ifstream in(_profileUse.c_str());
+      if(!in){
+        HLIR_ERROR("cannot read region profile: " + _profileUse);
+      }
+
+      uint32_t kind;
+      uint32_t line;
+      ProfileRecord r;
+      while(in >> kind >> line >> r.launches >> r.iterations >> r.chunks >>
+            r.ns >> r.cost >> r.cost2){
+        string file;
+        getline(in >> ws, file);
+        m[ProfileKey(kind, file, line)] = r;
+      }
+
+      return m;
+    }();
+
+    return profile;
+  }
+
+  // the record of the region of kind that c is, null if the profile has
+  // none for it or the construct has no source location
+  const ProfileRecord* findProfile(uint32_t kind, HLIRConstruct* c){
+    const map<ProfileKey, ProfileRecord>& profile = regionProfile();
+
+    if(profile.empty() || !c->file().hasValue() || !c->line().hasValue()){
+      return nullptr;
+    }
+
+    auto itr = profile.find(ProfileKey(kind, c->file(), c->line().val()));
+    if(itr == profile.end() || itr->second.launches == 0){
+      return nullptr;
+    }
+
+    return &itr->second;
+  }
+
+  // the value of the enclosing function that v was loaded in place of,
+  // following the loads that replaced it at each level of nesting. The
+  // links followed are pointed at it, so that each is walked once.
+  Value* capturedValue(unordered_map<Value*, Value*>& replacedMap, Value* v){
+    Value* r = v;
+    for(;;){
+      auto itr = replacedMap.find(r);
+      if(itr == replacedMap.end()){
+        break;
+      }
+      r = itr->second;
+    }
+
+    while(v != r){
+      auto itr = replacedMap.find(v);
+      v = itr->second;
+      itr->second = r;
+    }
+
+    return r;
+  }
+
+  // dependence bits of argument i of a task call, 0 unless it is a
+  // pointer whose parameter is annotated as read or written
+  uint32_t taskDependence(HLIRTask* task, size_t i){
+    Function* func = task->function();
+
+    if(task->numParams() != func->arg_size()){
+      return 0;
+    }
+
+    auto aitr = func->arg_begin();
+    advance(aitr, i);
+
+    if(!aitr->getType()->isPointerTy()){
+      return 0;
+    }
+
+    HLIRTaskParam& param = task->param(i);
+
+    uint32_t mode = 0;
+    if(param.read()){
+      mode |= TASK_DEP_IN;
+    }
+    if(param.write()){
+      mode |= TASK_DEP_OUT;
+    }
+    return mode;
+  }
+
+  // whether the calls of a task are memoized, as it asks unless it
+  // writes memory through one of its parameters, which a call that
+  // shares the result of another would not do
+  bool taskMemoized(HLIRTask* task){
+    if(!task->memoize()){
+      return false;
+    }
+
+    Function* func = task->function();
+
+    for(size_t i = 0; i < func->arg_size(); ++i){
+      if(taskDependence(task, i) & TASK_DEP_OUT){
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // the i32 partition of the first pointer argument of a task call whose
+  // parameter has a partitioner, an i32(i8*) of the address, or null
+  Value* taskPartition(HLIRTask* task, const ValueVec& callArgs,
+                       IRBuilder<>& b){
+    if(task->numParams() != callArgs.size()){
+      return nullptr;
+    }
+
+    for(size_t i = 0; i < callArgs.size(); ++i){
+      Function* partitioner = task->param(i).partitioner();
+      if(!partitioner || !callArgs[i]->getType()->isPointerTy()){
+        continue;
+      }
+
+      Type* ptrTy = partitioner->getFunctionType()->getParamType(0);
+      return b.CreateCall(partitioner,
+                          {b.CreateBitCast(callArgs[i], ptrTy)}, "partition");
+    }
+
+    return nullptr;
+  }
+
+  // whether every path on from the task call ci reaches user, where it
+  // is awaited, before the function returns or unwinds and before ci is
+  // made again, so that its frame and result can be on the caller's
+  // stack. A call in between that may throw could leave it as well.
+  bool awaitedInFrame(CallInst* ci, Instruction* user){
+    BasicBlock::iterator next(ci);
+    ++next;
+
+    vector<pair<BasicBlock*, BasicBlock::iterator>> work = 
+      {{ci->getParent(), next}};
+    set<BasicBlock*> visited;
+
+    while(!work.empty()){
+      BasicBlock* bb = work.back().first;
+      BasicBlock::iterator itr = work.back().second;
+      work.pop_back();
+
+      bool reached = false;
+      for(; itr != bb->end(); ++itr){
+        if(&*itr == user){
+          reached = true;
+          break;
+        }
+
+        if(&*itr == ci){
+          return false;
+        }
+
+        auto call = dyn_cast<CallInst>(&*itr);
+        if(call && !call->doesNotThrow()){
+          return false;
+        }
+      }
+
+      if(reached){
+        continue;
+      }
+
+      TerminatorInst* t = bb->getTerminator();
+      if(isa<ReturnInst>(t) || isa<ResumeInst>(t)){
+        return false;
+      }
+
+      for(BasicBlock* s : successors(bb)){
+        if(visited.insert(s).second){
+          work.push_back({s, s->begin()});
+        }
+      }
+    }
+
+    return true;
+  }
+
+} // namespace
+
+HLIRModule* HLIRModule::getModule(Module* module){
+  auto itr = _moduleMap.find(module);
+  if(itr == _moduleMap.end()){
+    auto m = new HLIRModule(module);
+    m->setName(module->getModuleIdentifier());
+    _moduleMap[module] = m;
+    m->readTaskMetadata_();
+    m->importTaskCalls_();
+    return m;
+  }
+
+  return itr->second;
+}
+
+void HLIRModule::releaseModule(Module* module){
+  auto itr = _moduleMap.find(module);
+  if(itr != _moduleMap.end()){
+    delete itr->second;
+    _moduleMap.erase(itr);
+  }
+}
+
+string HLIRModule::createName_(const string& prefix){
+  return prefix + toStr(nextId_++);
+}
+
+void HLIRModule::addConstruct(HLIRConstruct* c){
+  constructMap_.emplace(c->marker(), c);
+  constructs_.push_back(c);
+}
+
+void HLIRModule::removeConstruct_(Instruction* marker){
+  auto itr = constructMap_.find(marker);
+  if(itr == constructMap_.end()){
+    return;
+  }
+
+  constructs_.erase(find(constructs_.begin(), constructs_.end(),
+                         itr->second));
+  constructMap_.erase(itr);
+}
+
+HLIRParallelFor* HLIRModule::createParallelFor(){
+  auto pf = new HLIRParallelFor(this);
+
+  string name = createName_("pfor");
+  pf->setName(name);
+
+  (*this)[name] = pf;
+  
+  return pf;
+}
+
+HLIRParallelFor* HLIRModule::createParallelFor(StructType* indexType,
+                                               const vector<Value*>& extents,
+                                               const vector<Value*>& tiles){
+  auto pf = new HLIRParallelFor(this, indexType, extents, tiles);
+
+  string name = createName_("pfor");
+  pf->setName(name);
+
+  (*this)[name] = pf;
+  
+  return pf;
+}
+
+HLIRParallelReduce* HLIRModule::createParallelReduce(
+  const vector<Type*>& varTypes){
+  
+  auto r = new HLIRParallelReduce(this, varTypes);
+
+  string name = createName_("reduce");
+  r->setName(name);
+
+  (*this)[name] = r;
+  
+  return r;
+}
+
+HLIRParallelScan* HLIRModule::createParallelScan(Type* varType){
+  auto r = new HLIRParallelScan(this, varType);
+
+  string name = createName_("scan");
+  r->setName(name);
+
+  (*this)[name] = r;
+  
+  return r;
+}
+
+HLIRTask* HLIRModule::createTask(){
+  auto task = new HLIRTask(this);
+  tasks_.push_back(task);
+  
+  string name = createName_("task");
+  task->setName(name);
+
+  (*this)[name] = task;
+  
+  return task;
+}
+
+// each task is a node of !hlir.tasks:
+//
+//   !{void (...)* @func, i32 priority, !"file", i32 line, i1 noinline,
+//     i32 stack, i1 memoize, !{i1 read, i1 write}, ...}
+//
+// with one pair per parameter. The function is null once it has been
+// removed as dead. Its calls are spawned by whichever compilation
+// lowers the module next, and so that they are still calls by then,
+// the function is kept from being inlined in the meantime, noinline
+// telling whether it was before.
+void HLIRModule::writeTaskMetadata_(){
+  if(tasks_.empty()){
+    return;
+  }
+
+  auto& c = context();
+
+  NamedMDNode* tasksNode = module_->getOrInsertNamedMetadata("hlir.tasks");
+
+  auto boolMD = [&](bool flag){
+    return ConstantAsMetadata::get(ConstantInt::get(i1Ty, flag));
+  };
+
+  auto intMD = [&](int64_t i){
+    return ConstantAsMetadata::get(ConstantInt::get(i32Ty, i));
+  };
+
+  for(HLIRTask* t : tasks_){
+    Function* func = t->function();
+
+    // the wrapper is recreated with the task
+    Function* wrapperFunc = t->wrapperFunction();
+    if(wrapperFunc->use_empty()){
+      wrapperFunc->eraseFromParent();
+    }
+
+    // a task of only some calls stays as their markers
+    if(t->numCalls() > 0){
+      MDNode* launch = MDNode::get(c, MDString::get(c, "launch"));
+
+      for(size_t i = 0; i < t->numCalls(); ++i){
+        t->call(i)->setMetadata("hlir.task", launch);
+      }
+
+      continue;
+    }
+
+    bool noInline = func->hasFnAttribute(Attribute::NoInline);
+    func->addFnAttr(Attribute::NoInline);
+
+    vector<Metadata*> ops;
+    ops.push_back(ConstantAsMetadata::get(func));
+    ops.push_back(intMD(t->priority()));
+    ops.push_back(MDString::get(c, t->file().val()));
+    ops.push_back(intMD(t->line().hasValue() ? t->line().val() : 0));
+    ops.push_back(boolMD(noInline));
+    ops.push_back(intMD(t->stackSize()));
+    ops.push_back(boolMD(t->memoize()));
+
+    for(size_t i = 0; i < t->numParams(); ++i){
+      HLIRTaskParam& param = t->param(i);
+      vector<Metadata*> pops = {boolMD(param.read()), boolMD(param.write())};
+
+      if(Function* partitioner = param.partitioner()){
+        pops.push_back(ConstantAsMetadata::get(partitioner));
+      }
+
+      ops.push_back(MDNode::get(c, pops));
+    }
+
+    tasksNode->addOperand(MDNode::get(c, ops));
+  }
+
+  tasks_.clear();
+}
+
+void HLIRModule::readTaskMetadata_(){
+  NamedMDNode* tasksNode = module_->getNamedMetadata("hlir.tasks");
+  if(!tasksNode){
+    return;
+  }
+
+  auto toInt = [](const MDOperand& op){
+    return mdconst::extract<ConstantInt>(op)->getSExtValue();
+  };
+
+  for(MDNode* node : tasksNode->operands()){
+    if(node->getNumOperands() < 7){
+      continue;
+    }
+
+    auto func = mdconst::dyn_extract_or_null<Function>(node->getOperand(0));
+    if(!func || func->isDeclaration()){
+      continue;
+    }
+
+    if(!toInt(node->getOperand(4))){
+      func->removeFnAttr(Attribute::NoInline);
+    }
+
+    HLIRTask* task = createTask();
+    task->setFunction(func);
+    task->setPriority(toInt(node->getOperand(1)));
+    task->setStackSize(toInt(node->getOperand(5)));
+    task->setMemoize(toInt(node->getOperand(6)) != 0);
+
+    StringRef file = cast<MDString>(node->getOperand(2))->getString();
+    int64_t line = toInt(node->getOperand(3));
+    if(!file.empty()){
+      task->setLocation(file.str(), line);
+    }
+
+    for(size_t i = 7; i < node->getNumOperands(); ++i){
+      auto pn = cast<MDNode>(node->getOperand(i));
+      HLIRTaskParam& param = task->addParam();
+      param.setRead(toInt(pn->getOperand(0)) != 0);
+      param.setWrite(toInt(pn->getOperand(1)) != 0);
+
+      if(pn->getNumOperands() > 2){
+        auto partitioner = 
+          mdconst::dyn_extract_or_null<Function>(pn->getOperand(2));
+        if(partitioner){
+          param.setPartitioner(partitioner);
+        }
+      }
+    }
+  }
+
+  // lowered or written again from here on
+  tasksNode->eraseFromParent();
+}
+
+// the arguments of a marked call are copied when it is spawned, as in
+// the experimental lowering, so they carry no dependences
+void HLIRModule::importTaskCalls_(){
+  map<Function*, HLIRTask*> taskMap;
+
+  for(Function& f : *module_){
+    for(BasicBlock& bb : f){
+      for(Instruction& i : bb){
+        CallSite cs(&i);
+        if(!cs || !i.getMetadata("hlir.task")){
+          continue;
+        }
+
+        i.setMetadata("hlir.task", nullptr);
+
+        Function* func = cs.getCalledFunction();
+        if(!func || func->isDeclaration() || func->isVarArg()){
+          continue;
+        }
+
+        HLIRTask*& task = taskMap[func];
+
+        if(!task){
+          task = createTask();
+          task->setFunction(func);
+
+          for(size_t j = 0; j < func->arg_size(); ++j){
+            task->addParam();
+          }
+        }
+
+        task->addCall(&i);
+      }
+    }
+  }
+}
+
+HLIRSend* HLIRModule::createSend(){
+  auto send = new HLIRSend(this);
+  (*this)[createName_("send")] = send;
+  return send;
+}
+
+HLIRReceive* HLIRModule::createReceive(){
+  auto receive = new HLIRReceive(this);
+  (*this)[createName_("receive")] = receive;
+  return receive;
+}
+
+HLIRBarrier* HLIRModule::createBarrier(){
+  auto barrier = new HLIRBarrier(this);
+  (*this)[createName_("barrier")] = barrier;
+  return barrier;
+}
+
+HLIRTeam* HLIRModule::createTeam(){
+  auto team = new HLIRTeam(this);
+  (*this)[createName_("team")] = team;
+  return team;
+}
+
+void HLIRModule::findExternalValues_(Function* f,
+                                     vector<Instruction*>& v,
+                                     bool recursive,
+                                     bool top,
+                                     vector<HLIRParallelFor*>& ps,
+                                     vector<HLIRParallelReduce*>& rs){
+  for(BasicBlock& bi : *f){
+    for(Instruction& ii : bi){
+      bool handled = false;
+
+      if(CallInst* ci = dyn_cast<CallInst>(&ii)){
+        auto itr = constructMap_.find(ci);
+        
+        if(itr != constructMap_.end()){
+          HLIRConstruct* hc = itr->second;
+          if(auto pf = dynamic_cast<HLIRParallelFor*>(hc)){
+            if(top){
+              ps.push_back(pf);
+            }
+            
+            if(recursive){
+              findExternalValues_(pf->body(), v, recursive, false, ps, rs);
+            }
+          }
+          else if(auto pr = dynamic_cast<HLIRParallelReduce*>(hc)){
+            if(top){
+              rs.push_back(pr);
+            }
+
+            if(recursive){
+              findExternalValues_(pr->body(), v, recursive, false, ps, rs);
+            }
+          }
+          
+          handled = true;
+        }
+      }
+
+      if(handled){
+        continue;
+      }
+      
+      for(Value* vi : ii.operands()){
+        if(Instruction* ij = dyn_cast<Instruction>(vi)){
+          if(ij->getParent()->getParent() != f){
+            v.push_back(ij);
+          }
+        }
+      }
+    }
+  }
+}
+
+void HLIRModule::lowerParallelFor_(HLIRParallelFor* pf,
+                                   StructType* argsType,
+                                   unordered_map<Value*, size_t>& capturedMap,
+                                   unordered_map<Value*, Value*>& replacedMap){
+
+  auto& c = module_->getContext();
+  IRBuilder<> b(c);
+
+  // marker is the caller
+  auto marker = pf->marker();
+  BasicBlock* block = marker->getParent();
+
+  // already handled as a nested case
+  if(!block){
+    return;
+  }
+
+  Function* func = block->getParent();
+
+  // top-level parallel for - (not nested)
+  bool top = !func->getName().startswith("hlir.parallel_for.body");
+
+  // this will be handled as a nested parallel for later from the top
+  if(!top && !argsType){
+    return;
+  }
+
+  if(top){
+    set<Function*> bodies = {pf->body()};
+    findNestedBodies_(pf->body(), bodies);
+    promoteReadOnlyCaptures_(marker, bodies);
+  }
+
+  vector<Instruction*> rvs;
+
+  vector<HLIRParallelFor*> rps;
+  vector<HLIRParallelReduce*> rrs;
+
+  findExternalValues_(pf->body(), rvs, true, true, rps, rrs);
+
+  // each value is captured once, however many times it is used
+  unordered_set<Instruction*> seen;
+  rvs.erase(remove_if(rvs.begin(), rvs.end(), [&](Instruction* vi){
+    return !seen.insert(vi).second;
+  }), rvs.end());
+
+  // create the struct of all fields used recursively
+  if(top){
+    TypeVec fields;
+    size_t i = 0;
+
+    for(auto vi : rvs){
+      fields.push_back(vi->getType()); 
+      capturedMap.emplace(vi, i++);   
+    }
+
+    argsType = StructType::create(c, fields, "struct.func_args");
+  }
+ 
+  // the point within the called parallel for to begin codegen / unwrap args
+  auto argsInsertion = pf->argsInsertion();
+  b.SetInsertPoint(argsInsertion); 
+
+  Value* argsStructPtr = 
+    b.CreateBitCast(pf->args(), PointerType::get(argsType, 0));
+
+  // the captures are written before the body is queued and only read by
+  // it, so they can be hoisted out of its loop
+  Value* funcArgs = pf->args();
+
+  if(auto li = dyn_cast<LoadInst>(funcArgs)){
+    uint64_t size = module_->getDataLayout().getTypeAllocSize(argsType);
+
+    li->setMetadata(LLVMContext::MD_invariant_load, MDNode::get(c, None));
+    li->setMetadata(LLVMContext::MD_dereferenceable,
+      MDNode::get(c, ConstantAsMetadata::get(ConstantInt::get(i64Ty, size))));
+  }
+
+  // the uses of a capture in the body and the bodies directly nested in
+  // it read it from the args struct, deeper ones are rewritten when
+  // their own parallel for is lowered
+  unordered_set<Function*> readers = {pf->body()};
+  for(HLIRParallelFor* pfi : rps){
+    readers.insert(pfi->body());
+  }
+
+  // the align_value and restrict of the pointer variables the frontend
+  // found the body to read, by their variables. A read-only one is
+  // captured as its value loaded before the marker.
+  unordered_map<Value*, pair<uint64_t, bool>> pointerVars;
+
+  const HLIRVector& pointers = pf->pointers();
+  for(size_t i = 0; i < pointers.size(); ++i){
+    const HLIRVector& pi = pointers.get<HLIRVector>(i);
+
+    auto& pv = pointerVars[pi.get<HLIRValue>(0)];
+    pv.first = max(pv.first, uint64_t(pi.get<HLIRInteger>(1).val()));
+    pv.second = pv.second || pi.get<HLIRInteger>(2).val() != 0;
+  }
+
+  vector<Value*> restricts;
+
+  for(Instruction* vi : rvs){
+    if(vi->getParent()->getParent() == pf->body()){
+      continue;
+    }
+
+    // gathered first, replacing a use unlinks it from the list
+    vector<User*> users;
+    for(User* user : vi->users()){
+      auto inst = dyn_cast<Instruction>(user);
+      if(inst && readers.count(inst->getParent()->getParent()) > 0){
+        users.push_back(user);
+      }
+    }
+
+    if(users.empty()){
+      continue;
+    }
+
+    auto itr = capturedMap.find(capturedValue(replacedMap, vi));
+    assert(itr != capturedMap.end());
+    size_t index = itr->second;
+
+    Value* gi = b.CreateStructGEP(argsType, argsStructPtr, index);
+    LoadInst* li = b.CreateLoad(gi, vi->getName());
+    li->setMetadata(LLVMContext::MD_invariant_load, MDNode::get(c, None));
+
+    // the alignment of a pointer such as the data() of an ares::Field
+    // is assumed again in the body, where the vectorizer can use it
+    Value* cv = capturedValue(replacedMap, vi);
+    uint64_t align = assumedAlignment(cv);
+
+    // as is that of an align_value pointer, and a restrict one keeps
+    // what it does not alias, both of which the body would otherwise
+    // lose with the variable
+    auto ci = dyn_cast<LoadInst>(cv);
+    auto pitr = ci ? pointerVars.find(ci->getPointerOperand()) :
+      pointerVars.end();
+
+    if(pitr != pointerVars.end()){
+      align = max(align, pitr->second.first);
+
+      if(pitr->second.second){
+        restricts.push_back(li);
+      }
+    }
+
+    if(align > 1){
+      b.CreateAlignmentAssumption(module_->getDataLayout(), li, align);
+    }
+
+    for(User* user : users){
+      user->replaceUsesOfWith(vi, li);
+    }
+
+    replacedMap.emplace(li, vi);
+  }
+
+  // a ForallSimd asks for its width, with which the vectorizer turns the
+  // conditionals of the body into masks, and reports a body it fails on
+  BasicBlock* bodyExit = pf->exitBlock();
+  Instruction* latch = bodyExit->getTerminator();
+  if(pf->simd()){
+    latch->setMetadata("llvm.loop",
+                       vectorizeLoopID(c, simdLanes(func, pf->body())));
+  }
+
+  // the iterations of a forall are independent by definition, so the
+  // memory accesses of the body, other than to its own locals, are
+  // marked as parallel for the vectorizer's dependence checks
+  MDNode* loopID = latch->getMetadata("llvm.loop");
+  const DataLayout& dl = module_->getDataLayout();
+  Function* bodyFunc = pf->body();
+
+  for(BasicBlock& bi : *bodyFunc){
+    for(Instruction& ii : bi){
+      Value* ptr;
+
+      if(auto li = dyn_cast<LoadInst>(&ii)){
+        ptr = li->getPointerOperand();
+      }
+      else if(auto si = dyn_cast<StoreInst>(&ii)){
+        ptr = si->getPointerOperand();
+      }
+      else{
+        continue;
+      }
+
+      if(!isa<AllocaInst>(GetUnderlyingObject(ptr, dl))){
+        ii.setMetadata(LLVMContext::MD_mem_parallel_loop_access, loopID);
+      }
+    }
+  }
+
+  addRestrictScopes(bodyFunc, restricts, dl);
+
+  b.SetInsertPoint(marker);      
+
+  nameRegionFunc_(pf, bodyFunc, "hlir.parallel_for.body", true);
+  Constant* region = createRegionDesc_(pf, "forall", REGION_PARALLEL_FOR);
+
+  // a Forall that does not wait reuses its args struct the next time it
+  // runs, so a previous run on the same handle is waited for first
+  Value* completion = pf->completion();
+  Value* after = pf->after();
+
+  Value* priority = pf->priority();
+  if(!priority){
+    priority = ConstantInt::get(i32Ty, 1);
+  }
+
+  Value* completionPtr = nullptr;
+
+  if(completion){
+    Function* waitFunc = getFunction("__ares_wait_completion", {voidPtrTy});
+    b.CreateCall(waitFunc, {b.CreateBitCast(completion, voidPtrTy)});
+
+    completionPtr = 
+      b.CreateBitCast(completion, PointerType::get(voidPtrTy, 0));
+  }
+
+  // a nested marker sits inside the loop of the enclosing body, so the
+  // args struct is allocated once in the entry block
+  Value* argsPtr = createEntryAlloca_(func, argsType, "pfor.args");
+
+  // the captures are stored in the order they were found rather than
+  // that of the map, so that the module does not depend on addresses
+  if(top){
+    for(Instruction* vi : rvs){
+      if(vi->getParent()->getParent() == func){
+        Value* pi = b.CreateStructGEP(argsType, argsPtr, capturedMap[vi]);
+        b.CreateStore(vi, pi);
+      }
+    }
+  }
+  else{
+    for(Instruction* vi : rvs){
+      auto itr = capturedMap.find(capturedValue(replacedMap, vi));
+      assert(itr != capturedMap.end());
+      size_t index = itr->second;
+
+      Value* pi = b.CreateStructGEP(argsType, argsPtr, index);
+      b.CreateStore(vi, pi);    
+    }
+  }
+
+  Function* createSynchFunc = 
+    getFunction("__ares_create_synch", {i32Ty}, voidPtrTy);
+
+  Function* queueFunc = 
+  getFunction("__ares_queue_range",
+              {voidPtrTy, voidPtrTy, voidPtrTy, i32Ty, i32Ty, i32Ty, i32Ty,
+               voidPtrTy});
+
+  Function* awaitFunc = getFunction("__ares_await_synch", {voidPtrTy}, i1Ty);
+
+  auto r = pf->range();
+  Value* start = r[0]->as<HLIRValue>();
+  Value* end = r[1]->as<HLIRValue>();
+
+  // too little work to pay for queuing and awaiting it runs the body
+  // inline over the whole range, the threshold is up to the runtime
+  BasicBlock* serialBlock = nullptr;
+
+  // a top-level Forall that is waited for may be launched on the GPU,
+  // mapped arrays are only current on the device, so none of its
+  // iterations run inline
+  Constant* ptx = nullptr;
+
+  if(_offload && top && pf->dims() == 1 && !after && !completion &&
+     rps.empty() && rrs.empty()){
+    ptx = createOffloadKernel_(pf);
+  }
+
+  uint64_t cost = pf->dims() == 1 && !after && !ptx ?
+    estimateBodyCost(bodyFunc, pf->exitBlock()) : 0;
+
+  // the work of a Forall of constant bounds is known here: one with far
+  // less than any serial threshold always runs inline, its body then
+  // inlined with the bounds known, which drops one without iterations
+  // and lets a short one be unrolled or vectorized. The others are split
+  // into a static block per worker unless they have a schedule.
+  auto startC = dyn_cast<ConstantInt>(start);
+  auto endC = dyn_cast<ConstantInt>(end);
+
+  bool inlined = false;
+
+  Value* schedule = pf->schedule();
+  Value* chunk = pf->chunk();
+
+  if(cost > 0 && startC && endC && !completion){
+    uint64_t n = endC->getZExtValue() > startC->getZExtValue() ?
+      endC->getZExtValue() - startC->getZExtValue() : 0;
+
+    if(n*cost < _inlineWork){
+      inlined = true;
+      bodyFunc->addFnAttr(Attribute::AlwaysInline);
+    }
+    else if(!schedule){
+      schedule = ConstantInt::get(i32Ty, 1);
+      chunk = ConstantInt::get(i32Ty, 0);
+    }
+  }
+
+  // a profiled Forall whose launches were too short to be worth queuing
+  // always runs inline, others get a schedule from the cost of their
+  // iterations unless they have one: static blocks when it is even,
+  // dynamic chunks of about PROFILE_CHUNK_NS when it is not
+  const ProfileRecord* profile = findProfile(REGION_PARALLEL_FOR, pf);
+
+  if(profile && !inlined){
+    if(cost > 0 && !completion &&
+       profile->nsPerLaunch() < PROFILE_SERIAL_NS){
+      inlined = true;
+    }
+    else if(!pf->schedule() && profile->nsPerIteration() > 0.0){
+      if(profile->imbalance() > PROFILE_IMBALANCE){
+        double grain = PROFILE_CHUNK_NS / profile->nsPerIteration();
+        grain = std::max(1.0, std::min(grain, double(UINT32_MAX)));
+
+        schedule = ConstantInt::get(i32Ty, 2);
+        chunk = ConstantInt::get(i32Ty, uint64_t(grain));
+      }
+      else{
+        schedule = ConstantInt::get(i32Ty, 1);
+        chunk = ConstantInt::get(i32Ty, 0);
+      }
+    }
+  }
+
+  if(cost > 0){
+    Function* thresholdFunc = 
+      getFunction("__ares_serial_threshold", TypeVec(), i64Ty);
+
+    Value* n = b.CreateSelect(b.CreateICmpULT(start, end),
+                              b.CreateSub(end, start),
+                              ConstantInt::get(i32Ty, 0));
+
+    Value* work = b.CreateMul(b.CreateZExt(n, i64Ty), 
+                              ConstantInt::get(i64Ty, cost), "pfor.work");
+
+    Value* small = inlined ? b.getTrue() :
+      b.CreateICmpULT(work, b.CreateCall(thresholdFunc));
+
+    serialBlock = BasicBlock::Create(c, "pfor.serial", func);
+    BasicBlock* parallelBlock = BasicBlock::Create(c, "pfor.parallel", func);
+
+    b.CreateCondBr(small, serialBlock, parallelBlock);
+    b.SetInsertPoint(parallelBlock);
+  }
+
+  // the runtime returns where the host's part of the range begins, having
+  // started the kernel on the part before it: end if the GPU ran all of
+  // it, start if there is no device or a captured pointer is not in a
+  // mapped or shared array. The rest is queued as usual and the kernel
+  // joined once it has run.
+  BasicBlock* offloadBlock = nullptr;
+
+  if(ptx){
+    vector<Constant*> offsets;
+
+    const StructLayout* layout = dl.getStructLayout(argsType);
+    for(size_t i = 0; i < argsType->getNumElements(); ++i){
+      if(argsType->getElementType(i)->isPointerTy()){
+        offsets.push_back(
+          ConstantInt::get(i32Ty, layout->getElementOffset(i)));
+      }
+    }
+
+    Value* ptrsPtr = ConstantPointerNull::get(voidPtrTy);
+
+    if(!offsets.empty()){
+      ArrayType* offsetsType = ArrayType::get(i32Ty, offsets.size());
+
+      auto gv = 
+        new GlobalVariable(*module_, offsetsType, true,
+                           GlobalValue::PrivateLinkage,
+                           ConstantArray::get(offsetsType, offsets),
+                           "pfor.ptr.offsets");
+
+      ptrsPtr = b.CreateBitCast(gv, voidPtrTy);
+    }
+
+    Function* splitFunc = 
+      getFunction("__ares_offload_split",
+                  {voidPtrTy, voidPtrTy, i64Ty, voidPtrTy,
+                   i32Ty, i32Ty, i32Ty}, i32Ty);
+
+    Value* hostStart = 
+      b.CreateCall(splitFunc,
+                   {ptx, b.CreateBitCast(argsPtr, voidPtrTy),
+                    ConstantInt::get(i64Ty, dl.getTypeAllocSize(argsType)),
+                    ptrsPtr, ConstantInt::get(i32Ty, offsets.size()),
+                    start, end}, "pfor.host.start");
+
+    offloadBlock = BasicBlock::Create(c, "pfor.offloaded", func);
+    BasicBlock* queueBlock = BasicBlock::Create(c, "pfor.queue", func);
+
+    b.CreateCondBr(b.CreateICmpEQ(hostStart, end), offloadBlock, queueBlock);
+
+    b.SetInsertPoint(queueBlock);
+    start = hostStart;
+  }
+
+  // [start, end) is published as one splittable range task, a grain of
+  // 0 lets the runtime choose, the synch is signaled once when all of
+  // the iterations have run
+  Value* synchPtr = 
+    b.CreateCall(createSynchFunc, {ConstantInt::get(i32Ty, 1)}, "synch.ptr");
+
+  Value* zero = ConstantInt::get(i32Ty, 0);
+
+  // a Forall with a schedule is queued under it, after after if set
+  if(schedule){
+    Function* queueScheduledFunc = 
+      getFunction("__ares_queue_scheduled",
+                  {voidPtrTy, voidPtrTy, voidPtrTy, voidPtrTy,
+                   i32Ty, i32Ty, i32Ty, i32Ty, i32Ty, voidPtrTy});
+
+    Value* afterSynch = ConstantPointerNull::get(voidPtrTy);
+
+    if(after){
+      afterSynch = 
+        b.CreateLoad(b.CreateBitCast(after, PointerType::get(voidPtrTy, 0)),
+                     "after.synch");
+    }
+
+    b.CreateCall(queueScheduledFunc, {afterSynch, synchPtr,
+                                      b.CreateBitCast(argsPtr, voidPtrTy),
+                                      b.CreateBitCast(bodyFunc, voidPtrTy),
+                                      start, end, schedule, chunk,
+                                      priority, region});
+  }
+  else if(after){
+    Function* queueAfterFunc = 
+      getFunction("__ares_queue_range_after",
+                  {voidPtrTy, voidPtrTy, voidPtrTy, voidPtrTy,
+                   i32Ty, i32Ty, i32Ty, i32Ty, voidPtrTy});
+
+    Value* afterSynch = 
+      b.CreateLoad(b.CreateBitCast(after, PointerType::get(voidPtrTy, 0)),
+                   "after.synch");
+
+    b.CreateCall(queueAfterFunc, {afterSynch, synchPtr,
+                                  b.CreateBitCast(argsPtr, voidPtrTy),
+                                  b.CreateBitCast(bodyFunc, voidPtrTy),
+                                  start, end, zero, priority, region});
+  }
+  else{
+    b.CreateCall(queueFunc, {synchPtr,
+                             b.CreateBitCast(argsPtr, voidPtrTy),
+                             b.CreateBitCast(bodyFunc, voidPtrTy),
+                             start, end, zero, priority, region});
+  }
+
+  if(completionPtr){
+    b.CreateStore(synchPtr, completionPtr);
+  }
+
+  BasicBlock* exitBlock = BasicBlock::Create(c, "pfor.queue.exit", func);
+  
+  b.CreateBr(exitBlock);
+  
+  BasicBlock* blockAfter = block->splitBasicBlock(*marker, "pfor.merge");
+
+  block->getTerminator()->removeFromParent();
+
+  marker->removeFromParent();
+
+  if(serialBlock){
+    StructType* rangeType = StructType::get(c, {i32Ty, i32Ty, voidPtrTy});
+    Value* rangePtr = createEntryAlloca_(func, rangeType, "pfor.range");
+
+    b.SetInsertPoint(serialBlock);
+    b.CreateStore(start, b.CreateStructGEP(rangeType, rangePtr, 0));
+    b.CreateStore(end, b.CreateStructGEP(rangeType, rangePtr, 1));
+    b.CreateStore(b.CreateBitCast(argsPtr, voidPtrTy),
+                  b.CreateStructGEP(rangeType, rangePtr, 2));
+    b.CreateCall(bodyFunc, {b.CreateBitCast(rangePtr, voidPtrTy)});
+    b.CreateBr(blockAfter);
+  }
+  
+  if(offloadBlock){
+    b.SetInsertPoint(offloadBlock);
+    b.CreateBr(blockAfter);
+  }
+
+  b.SetInsertPoint(exitBlock);
+
+  // one that does not wait leaves the synch to its handle
+  if(!completionPtr){
+    b.CreateCall(awaitFunc, {synchPtr});
+  }
+
+  if(ptx){
+    Function* joinFunc = getFunction("__ares_offload_join", {});
+    b.CreateCall(joinFunc, {});
+  }
+
+  b.CreateBr(blockAfter);
+
+  for(HLIRParallelFor* pf : rps){
+    lowerParallelFor_(pf, argsType, capturedMap, replacedMap);
+  }
+
+  //pf->body()->dump();
+}
+
+Constant* HLIRModule::createOffloadKernel_(HLIRParallelFor* pf){
+  Function* bodyFunc = pf->body();
+
+  set<Function*> called;
+  if(!isOffloadable(bodyFunc, called)){
+    return nullptr;
+  }
+
+  // cloned in module order, so that the kernel does not depend on
+  // addresses
+  vector<Function*> funcs;
+  for(Function& fi : *module_){
+    if(called.count(&fi) > 0){
+      funcs.push_back(&fi);
+    }
+  }
+
+  // the NVPTX backend is only there if LLVM was built with it
+  string error;
+  const Target* target = TargetRegistry::lookupTarget(OFFLOAD_TRIPLE, error);
+  if(!target){
+    return nullptr;
+  }
+
+  unique_ptr<TargetMachine> tm(
+    target->createTargetMachine(OFFLOAD_TRIPLE, "sm_35", "", TargetOptions(),
+                                Reloc::Default, CodeModel::Default,
+                                CodeGenOpt::Aggressive));
+
+  auto& c = module_->getContext();
+
+  Module m("hlir.offload", c);
+  m.setTargetTriple(OFFLOAD_TRIPLE);
+  m.setDataLayout(tm->createDataLayout());
+
+  // the body and the functions it calls are cloned as they are, without
+  // their host attributes
+  ValueToValueMapTy vmap;
+
+  for(Function* fi : funcs){
+    vmap[fi] = 
+      Function::Create(fi->getFunctionType(), 
+                       llvm::Function::InternalLinkage, fi->getName(), &m);
+
+    for(BasicBlock& bi : *fi){
+      for(Instruction& ii : bi){
+        auto ci = dyn_cast<CallInst>(&ii);
+        if(ci && ci->getCalledFunction()->isIntrinsic()){
+          Function* callee = ci->getCalledFunction();
+          vmap[callee] = 
+            m.getOrInsertFunction(callee->getName(),
+                                  callee->getFunctionType());
+        }
+      }
+    }
+  }
+
+  for(Function* fi : funcs){
+    auto fc = cast<Function>(vmap[fi]);
+
+    auto aitr = fc->arg_begin();
+    for(Argument& ai : fi->args()){
+      vmap[&ai] = &*aitr++;
+    }
+
+    SmallVector<ReturnInst*, 4> returns;
+    CloneFunctionInto(fc, fi, vmap, true, returns);
+    fc->setAttributes(AttributeSet());
+  }
+
+  Function* body = cast<Function>(vmap[bodyFunc]);
+
+  // kernel(args, start, end) runs iteration start + global thread index
+  // through the range args the body expects
+  FunctionType* kernelType = 
+    FunctionType::get(voidTy, {voidPtrTy, i32Ty, i32Ty}, false);
+
+  Function* kernel = 
+    Function::Create(kernelType, llvm::Function::ExternalLinkage,
+                     OFFLOAD_KERNEL, &m);
+
+  auto kitr = kernel->arg_begin();
+  Value* args = &*kitr++;
+  Value* start = &*kitr++;
+  Value* end = &*kitr;
+
+  BasicBlock* entry = BasicBlock::Create(c, "entry", kernel);
+  BasicBlock* runBlock = BasicBlock::Create(c, "run", kernel);
+  BasicBlock* exitBlock = BasicBlock::Create(c, "exit", kernel);
+
+  IRBuilder<> b(entry);
+
+  StructType* rangeType = StructType::get(c, {i32Ty, i32Ty, voidPtrTy});
+  Value* rangePtr = b.CreateAlloca(rangeType, nullptr, "range");
+
+  Value* tid = 
+    b.CreateCall(Intrinsic::getDeclaration(&m,
+      Intrinsic::nvvm_read_ptx_sreg_tid_x));
+
+  Value* ntid = 
+    b.CreateCall(Intrinsic::getDeclaration(&m,
+      Intrinsic::nvvm_read_ptx_sreg_ntid_x));
+
+  Value* ctaid = 
+    b.CreateCall(Intrinsic::getDeclaration(&m,
+      Intrinsic::nvvm_read_ptx_sreg_ctaid_x));
+
+  Value* i = b.CreateAdd(start, b.CreateAdd(b.CreateMul(ctaid, ntid), tid));
+
+  b.CreateCondBr(b.CreateICmpULT(i, end), runBlock, exitBlock);
+
+  b.SetInsertPoint(runBlock);
+  b.CreateStore(i, b.CreateStructGEP(rangeType, rangePtr, 0));
+  b.CreateStore(b.CreateAdd(i, ConstantInt::get(i32Ty, 1)),
+                b.CreateStructGEP(rangeType, rangePtr, 1));
+  b.CreateStore(args, b.CreateStructGEP(rangeType, rangePtr, 2));
+  b.CreateCall(body, {b.CreateBitCast(rangePtr, voidPtrTy)});
+  b.CreateBr(exitBlock);
+
+  b.SetInsertPoint(exitBlock);
+  b.CreateRetVoid();
+
+  NamedMDNode* annotations = m.getOrInsertNamedMetadata("nvvm.annotations");
+  annotations->addOperand(
+    MDNode::get(c, {ValueAsMetadata::get(kernel),
+                    MDString::get(c, "kernel"),
+                    ConstantAsMetadata::get(ConstantInt::get(i32Ty, 1))}));
+
+  // the host debug info refers to the host module
+  StripDebugInfo(m);
+
+  SmallString<0> ptx;
+  raw_svector_ostream ostr(ptx);
+
+  legacy::PassManager pm;
+  if(tm->addPassesToEmitFile(pm, ostr, TargetMachine::CGFT_AssemblyFile)){
+    return nullptr;
+  }
+  pm.run(m);
+
+  // the runtime loads the module from the PTX text
+  Constant* ptxConst = ConstantDataArray::getString(c, ptx.str());
+
+  auto gv = 
+    new GlobalVariable(*module_, ptxConst->getType(), true,
+                       GlobalValue::PrivateLinkage, ptxConst, "pfor.ptx");
+
+  return ConstantExpr::getBitCast(gv, voidPtrTy);
+}
+
+// the function queued over the partial indices of a lowered reduce, each
+// call computes the partials [begin, end) one after the other. For the
+// final pass of a scan, partial k instead starts from the prefix that the
+// partials buffer holds for it and the running value is written to the
+// output array at each index.
+Function* HLIRModule::createReduceFunc_(HLIRParallelReduce* r,
+                                        StructType* argsType,
+                                        bool final){
+  using ValueVec = vector<Value*>;
+  using TypeVec = vector<llvm::Type*>;
+
+  LLVMContext& c = module_->getContext();
+  IRBuilder<> b(c);
+
+  auto rt = cast<StructType>(r->reduceType().val());
+
+  size_t numVars = r->numVars();
+
+  auto scan = dynamic_cast<HLIRParallelScan*>(r);
+
+  TypeVec params = {voidPtrTy};
+
+  auto ft = FunctionType::get(voidTy, params, false);
+
+  auto func =
+    Function::Create(ft,
+                     llvm::Function::InternalLinkage,
+                     final ? "scan" : "reduce",
+                     module_);
+  outlined_.push_back(func);
+
+  auto aitr = func->arg_begin();
+  aitr->setName("args.ptr");
+  Value* funcArgsVoidPtr = aitr;
+
+  BasicBlock* block = BasicBlock::Create(c, "entry", func);
+
+  b.SetInsertPoint(block);
+
+  TypeVec fields2 = {i32Ty, i32Ty, voidPtrTy};
+  StructType* funcArgsType = StructType::create(c, fields2, "struct.range_args");
+  
+  Value* funcArgsPtr = 
+  b.CreateBitCast(funcArgsVoidPtr, PointerType::get(funcArgsType, 0));
+
+  Value* partialBegin = b.CreateStructGEP(nullptr, funcArgsPtr, 0);
+  partialBegin = b.CreateLoad(partialBegin);
+
+  Value* partialEnd = b.CreateStructGEP(nullptr, funcArgsPtr, 1);
+  partialEnd = b.CreateLoad(partialEnd);
+
+  Value* argsVoidPtr = b.CreateStructGEP(nullptr, funcArgsPtr, 2);
+  argsVoidPtr = b.CreateLoad(argsVoidPtr);
+
+  Type* argsPtrType = PointerType::get(argsType, 0);
+
+  Value* argsPtr = b.CreateBitCast(argsVoidPtr, argsPtrType);
+
+  Value* partialSums = b.CreateStructGEP(nullptr, argsPtr, 0);
+  partialSums = b.CreateLoad(partialSums);
+
+  Value* numPartials = b.CreateStructGEP(nullptr, argsPtr, 1);
+  numPartials = b.CreateLoad(numPartials);
+
+  Value* rangeStart = b.CreateStructGEP(nullptr, argsPtr, 2);
+  rangeStart = b.CreateLoad(rangeStart);
+
+  Value* size = b.CreateStructGEP(nullptr, argsPtr, 3);
+  size = b.CreateLoad(size);
+
+  Value* bodyArgs = b.CreateStructGEP(nullptr, argsPtr, 4);
+  bodyArgs = b.CreateLoad(bodyArgs);
+
+  Value* initPtr = b.CreateStructGEP(nullptr, argsPtr, 5);
+  initPtr = b.CreateLoad(initPtr);
+
+  Value* blockSize = b.CreateStructGEP(nullptr, argsPtr, 6);
+  blockSize = b.CreateLoad(blockSize);
+
+  Value* compensated = b.CreateStructGEP(nullptr, argsPtr, 7);
+  compensated = b.CreateLoad(compensated);
+
+  Value* output = nullptr;
+  if(final){
+    output = b.CreateLoad(b.CreateStructGEP(nullptr, argsPtr, 8));
+  }
+
+  Value* zero = ConstantInt::get(i32Ty, 0);
+  Value* one = ConstantInt::get(i32Ty, 1);
+  Value* zero64 = ConstantInt::get(i64Ty, 0);
+  Value* one64 = ConstantInt::get(i64Ty, 1);
+
+  // arrays are accumulated in place in the partials buffer rather than
+  // in a copy on the stack
+  bool privateArrays = false;
+  for(size_t k = 0; k < numVars; ++k){
+    privateArrays |= rt->getElementType(k)->isArrayTy();
+  }
+
+  // the final pass of a scan has to write every running value, so it
+  // is never compensated, and neither is a reduce with arrays, which
+  // would need a fresh copy of them for each iteration
+  bool anyCompensated = false;
+  for(size_t k = 0; k < numVars && !final && !privateArrays; ++k){
+    anyCompensated |= isCompensated(r, k, rt->getElementType(k));
+  }
+
+  Value* rptr = privateArrays ? nullptr : b.CreateAlloca(rt);
+  Value* tptr = anyCompensated ? b.CreateAlloca(rt) : nullptr;
+  Value* cptr = anyCompensated ? b.CreateAlloca(rt) : nullptr;
+
+  Value* iPtr = b.CreateAlloca(i64Ty);
+  Value* kPtr = b.CreateAlloca(i32Ty);
+
+  b.CreateStore(partialBegin, kPtr);
+
+  // a custom reduction has no known identity, its partial starts from
+  // the value the reduce variable holds on entry
+  auto initPartial = [&](Value* p){
+    for(size_t k = 0; k < numVars; ++k){
+      Type* t = rt->getElementType(k);
+
+      if(t->isArrayTy()){
+        initArray(b, func, r->op(k), r->isSigned(k), t,
+                  b.CreateStructGEP(rt, p, k));
+        continue;
+      }
+
+      Value* initVal = reduceIdentity(r, k, t);
+
+      if(!initVal){
+        initVal = b.CreateLoad(initPtr);
+      }
+
+      b.CreateStore(initVal, b.CreateStructGEP(rt, p, k));
+    }
+  };
+
+  BasicBlock* outerCondBlock = BasicBlock::Create(c, "outer.cond", func);
+  BasicBlock* outerBlock = BasicBlock::Create(c, "outer.body", func);
+  BasicBlock* outerExitBlock = BasicBlock::Create(c, "outer.exit", func);
+
+  b.CreateBr(outerCondBlock);
+
+  b.SetInsertPoint(outerCondBlock);
+
+  Value* partialIndex = b.CreateLoad(kPtr);
+
+  b.CreateCondBr(b.CreateICmpULT(partialIndex, partialEnd), outerBlock, outerExitBlock);
+
+  b.SetInsertPoint(outerBlock);
+
+  // each partial covers blockSize iterations, the last one takes the
+  // remainder, everything is computed in 64 bits
+  Value* k64 = b.CreateZExt(partialIndex, i64Ty);
+
+  Value* start = b.CreateAdd(rangeStart, b.CreateMul(blockSize, k64));
+
+  Value* cond = b.CreateICmpEQ(partialIndex, b.CreateSub(numPartials, one));
+
+  Value* end = 
+    b.CreateAdd(rangeStart,
+                b.CreateSelect(cond, size, 
+                               b.CreateMul(blockSize, b.CreateAdd(k64, one64))));
+
+  if(privateArrays){
+    rptr = b.CreateGEP(partialSums, partialIndex);
+  }
+
+  if(final){
+    b.CreateStore(b.CreateLoad(b.CreateGEP(partialSums, partialIndex)), rptr);
+  }
+  else{
+    initPartial(rptr);
+  }
+
+  b.CreateStore(start, iPtr);
+
+  BasicBlock* condBlock5 = BasicBlock::Create(c, "cond.block", func);
+  BasicBlock* loopBlock5 = BasicBlock::Create(c, "loop.block", func);
+  BasicBlock* mergeBlock5 = BasicBlock::Create(c, "merge.block", func);
+
+  BasicBlock* compCondBlock = nullptr;
+  BasicBlock* compBlock = nullptr;
+
+  if(anyCompensated){
+    compCondBlock = BasicBlock::Create(c, "comp.cond", func);
+    compBlock = BasicBlock::Create(c, "comp.block", func);
+
+    for(size_t k = 0; k < numVars; ++k){
+      Type* t = rt->getElementType(k);
+      if(isCompensated(r, k, t)){
+        b.CreateStore(ConstantFP::get(t, 0.0), b.CreateStructGEP(rt, cptr, k));
+      }
+    }
+
+    b.CreateCondBr(b.CreateICmpNE(compensated, zero),
+                   compCondBlock, condBlock5);
+  }
+  else{
+    b.CreateBr(condBlock5);
+  }
+
+  b.SetInsertPoint(condBlock5);
+
+  Value* i = b.CreateLoad(iPtr);
+
+  Value* endCond = b.CreateICmpULT(i, end);
+
+  b.CreateCondBr(endCond, loopBlock5, mergeBlock5);
+
+  b.SetInsertPoint(loopBlock5);
+
+  // the body is called directly and inlined so the partial behind rptr
+  // is promoted to a register and the loop can be vectorized
+  Function* bodyFunc = r->body();
+  bodyFunc->setLinkage(GlobalValue::InternalLinkage);
+  bodyFunc->addFnAttr(Attribute::AlwaysInline);
+
+  auto storeOutput = [&]{
+    b.CreateStore(b.CreateLoad(b.CreateStructGEP(rt, rptr, 0)),
+                  b.CreateGEP(output, i));
+  };
+
+  if(final && scan->exclusive()){
+    storeOutput();
+  }
+
+  ValueVec args2 = {bodyArgs, rptr, i};
+
+  b.CreateCall(bodyFunc, args2);
+
+  if(final && !scan->exclusive()){
+    storeOutput();
+  }
+
+  b.CreateStore(b.CreateAdd(i, one64), iPtr);
+
+  Instruction* latch = b.CreateBr(condBlock5);
+
+  // allow the vectorizer to reassociate the reduction, which it otherwise
+  // refuses to do for floating point. The order within a partial then
+  // only depends on its bounds, so the deterministic mode stays
+  // reproducible for a given binary.
+  if(!final){
+    latch->setMetadata("llvm.loop", vectorizeLoopID(c));
+  }
+
+  if(anyCompensated){
+    // each iteration runs against a fresh partial, which is then added to
+    // the running one with Kahan summation for floating point sums
+    b.SetInsertPoint(compCondBlock);
+
+    Value* ci = b.CreateLoad(iPtr);
+
+    b.CreateCondBr(b.CreateICmpULT(ci, end), compBlock, mergeBlock5);
+
+    b.SetInsertPoint(compBlock);
+
+    initPartial(tptr);
+
+    b.CreateCall(bodyFunc, {bodyArgs, tptr, ci});
+
+    for(size_t k = 0; k < numVars; ++k){
+      Value* sk = b.CreateStructGEP(rt, rptr, k);
+      Value* s = b.CreateLoad(sk);
+      Value* x = b.CreateLoad(b.CreateStructGEP(rt, tptr, k));
+
+      if(!isCompensated(r, k, rt->getElementType(k))){
+        b.CreateStore(reduceCombine(b, r, k, s, x), sk);
+        continue;
+      }
+
+      Value* ck = b.CreateStructGEP(rt, cptr, k);
+      Value* y = b.CreateFSub(x, b.CreateLoad(ck));
+      Value* t = b.CreateFAdd(s, y);
+      b.CreateStore(b.CreateFSub(b.CreateFSub(t, s), y), ck);
+      b.CreateStore(t, sk);
+    }
+
+    b.CreateStore(b.CreateAdd(ci, one64), iPtr);
+
+    b.CreateBr(compCondBlock);
+  }
+
+  b.SetInsertPoint(mergeBlock5);
+
+  // each call only publishes its partials, they are folded by the
+  // waiting thread once the whole range has completed, so no thread
+  // waits for another here
+  if(!final && !privateArrays){
+    Value* res = b.CreateLoad(rptr);
+    Value* idx1 = b.CreateGEP(partialSums, partialIndex);
+    b.CreateStore(res, idx1);
+  }
+
+  b.CreateStore(b.CreateAdd(partialIndex, one), kPtr);
+
+  b.CreateBr(outerCondBlock);
+
+  b.SetInsertPoint(outerExitBlock);
+
+  b.CreateRetVoid();
+
+  return func;
+}
+
+void HLIRModule::lowerParallelReduce_(HLIRParallelReduce* r, bool nested){
+  using ValueVec = vector<Value*>;
+  using TypeVec = vector<llvm::Type*>;
+
+  auto marker = r->marker();
+
+  LLVMContext& c = module_->getContext();
+  IRBuilder<> b(c);
+
+  auto rt = cast<StructType>(r->reduceType().val());
+
+  size_t numVars = r->numVars();
+
+  // the synch and partials are kept between runs in a context of the
+  // call site, so a reduce in a time loop does not allocate
+  Type* sitePtrTy = PointerType::get(voidPtrTy, 0);
+
+  Function* contextFunc = 
+    getFunction("__ares_reduce_context", {sitePtrTy, i64Ty}, voidPtrTy);
+  Function* contextAwaitFunc = 
+    getFunction("__ares_reduce_await", {voidPtrTy});
+  Function* contextReleaseFunc = 
+    getFunction("__ares_reduce_release", {sitePtrTy, voidPtrTy});
+
+  auto scan = dynamic_cast<HLIRParallelScan*>(r);
+
+  for(size_t k = 0; k < numVars; ++k){
+    if(rt->getElementType(k)->isArrayTy() &&
+       (scan || r->op(k) == HLIRParallelReduce::Custom)){
+      HLIR_ERROR("an array cannot be scanned or reduced with a combiner");
+    }
+  }
+
+  // shared arrays are updated in place, this has to happen while the
+  // body still refers to them directly rather than through its captures
+  for(size_t k = 0; k < r->numAtomicTargets(); ++k){
+    makeAtomicUpdates(r->body(), r->atomicTarget(k));
+  }
+
+  // a reduce of shared arrays only may have no partials at all
+  Type* initType = numVars > 0 ? rt->getElementType(0) : i8Ty;
+
+  TypeVec fields;
+  fields.push_back(PointerType::get(rt, 0));
+  fields.push_back(i32Ty);
+  fields.push_back(i64Ty);
+  fields.push_back(i64Ty);
+  fields.push_back(voidPtrTy);
+  fields.push_back(PointerType::get(initType, 0));
+  fields.push_back(i64Ty);
+  fields.push_back(i32Ty);
+
+  // the output array of a scan
+  if(scan){
+    fields.push_back(PointerType::get(rt->getElementType(0), 0));
+  }
+
+  StructType* argsType = StructType::create(c, fields, "struct.args");
+
+  Function* func = createReduceFunc_(r, argsType, false);
+
+  nameRegionFunc_(r, r->body(), "hlir.parallel_reduce.body", true);
+  nameRegionFunc_(r, func, "reduce", false);
+
+  Constant* region = scan ? 
+    createRegionDesc_(r, "scan", REGION_PARALLEL_SCAN) :
+    createRegionDesc_(r, "reduce", REGION_PARALLEL_REDUCE);
+
+  Value* zero = ConstantInt::get(i32Ty, 0);
+  Value* one = ConstantInt::get(i32Ty, 1);
+  Value* zero64 = ConstantInt::get(i64Ty, 0);
+  Value* one64 = ConstantInt::get(i64Ty, 1);
+
+  // =================== invocation / queueing of reduce
+
+  TypeVec captureFields;
+
+  vector<Instruction*> v;
+  vector<Instruction*> rc;
+
+  std::vector<HLIRParallelFor*> ps;
+  std::vector<HLIRParallelReduce*> rs;
+
+  findExternalValues_(r->body(), v, true, true, ps, rs);
+
+  // the values used in constructs nested in the body are captured here
+  // as well, unless they are defined within the body or those constructs
+  set<Function*> bodies = {r->body()};
+  findNestedBodies_(r->body(), bodies);
+
+  set<Instruction*> seen;
+  vector<Instruction*> captured;
+
+  for(Instruction* vi : v){
+    if(!bodies.count(vi->getParent()->getParent()) && seen.insert(vi).second){
+      captured.push_back(vi);
+    }
+  }
+
+  v = move(captured);
+  
+  for(Instruction* vi : v){
+    captureFields.push_back(vi->getType());    
+  }
+
+  Type* captureArgsType = StructType::create(c, captureFields, "struct.func_args");
+
+  auto argsInsertion = r->argsInsertion();
+  b.SetInsertPoint(argsInsertion); 
+
+  Value* argsStructPtr = 
+    b.CreateBitCast(r->args(), PointerType::get(captureArgsType, 0));
+
+  size_t j = 0;
+  for(Instruction* vi : v){
+    Value* gi = b.CreateStructGEP(captureArgsType, argsStructPtr, j);
+    Value* ri = b.CreateLoad(gi, vi->getName());
+
+    vector<User*> users(vi->user_begin(), vi->user_end());
+    
+    for(User* user : users){
+      auto inst = dyn_cast<Instruction>(user);
+      if(inst && bodies.count(inst->getParent()->getParent())){
+        user->replaceUsesOfWith(vi, ri);
+      }
+    }
+
+    ++j;
+  }
+
+  b.SetInsertPoint(marker);
+
+  Function* parentFunc = marker->getParent()->getParent();
+
+  // a nested reduce sits inside the loop of the enclosing body, so its
+  // captures are allocated once in the entry block
+  Value* captureArgsPtr = 
+    createEntryAlloca_(parentFunc, captureArgsType, "preduce.captures");
+
+  for(size_t i = 0; i < v.size(); ++i){
+    Value* vi = v[i];
+    Value* pi = b.CreateStructGEP(captureArgsType, captureArgsPtr, i);
+    b.CreateStore(vi, pi);    
+  }
+
+  // shared arrays start from the identity, like the private partials,
+  // the loop is emitted as a function so that no block is split here
+  for(size_t k = 0; k < r->numAtomicTargets(); ++k){
+    Value* target = r->atomicTarget(k);
+
+    Function* initFunc = 
+      Function::Create(FunctionType::get(voidTy, {target->getType()}, false),
+                       llvm::Function::InternalLinkage,
+                       "reduce.init",
+                       module_);
+    outlined_.push_back(initFunc);
+
+    IRBuilder<> ib(BasicBlock::Create(c, "entry", initFunc));
+
+    initArray(ib, initFunc, r->atomicOp(k), r->atomicSigned(k),
+              target->getType()->getPointerElementType(),
+              &*initFunc->arg_begin());
+
+    ib.CreateRetVoid();
+
+    b.CreateCall(initFunc, {target});
+  }
+
+  Function* queueFunc = 
+  getFunction("__ares_queue_range",
+              {voidPtrTy, voidPtrTy, voidPtrTy, i32Ty, i32Ty, i32Ty, i32Ty,
+               voidPtrTy});
+
+  // the bounds are runtime values, widened to the 64 bit index
+  auto range = r->range();
+  Value* start = b.CreateZExtOrTrunc(range[0]->as<HLIRValue>(), i64Ty);
+  Value* end = b.CreateZExtOrTrunc(range[1]->as<HLIRValue>(), i64Ty);
+
+  Value* n = b.CreateSub(end, start, "n");
+
+  // one partial per worker of the pool the binary ends up running on, or
+  // in the deterministic mode one per block of a fixed size, so that
+  // neither the bounds of the partials nor the shape of the fold below
+  // depend on the number of workers
+  Function* numThreadsFunc = getFunction("__ares_num_threads", TypeVec(), i32Ty);
+
+  Value* numThreads = b.CreateCall(numThreadsFunc, {}, "num.threads");
+
+  // nested within another parallel body and running on a worker, the
+  // enclosing construct already occupies the pool, so a single partial
+  // is computed by this thread, it runs its own task while waiting
+  if(nested){
+    Function* inWorkerFunc = getFunction("__ares_in_worker", TypeVec(), i32Ty);
+
+    Value* inWorker = b.CreateCall(inWorkerFunc, {}, "in.worker");
+
+    numThreads = b.CreateSelect(b.CreateICmpNE(inWorker, zero), 
+                                one, numThreads);
+  }
+
+  // a profiled reduce whose launches were too short to be worth
+  // splitting is computed as a single partial
+  const ProfileRecord* profile = 
+    findProfile(scan ? REGION_PARALLEL_SCAN : REGION_PARALLEL_REDUCE, r);
+
+  if(profile && profile->nsPerLaunch() < PROFILE_SERIAL_NS){
+    numThreads = one;
+  }
+
+  Value* numThreads64 = b.CreateZExt(numThreads, i64Ty);
+
+  Function* blockSizeFunc = 
+    getFunction("__ares_reduce_block_size", TypeVec(), i64Ty);
+
+  Value* reduceBlock = b.CreateCall(blockSizeFunc, {}, "reduce.block");
+
+  Function* compensatedFunc = 
+    getFunction("__ares_reduce_compensated", TypeVec(), i32Ty);
+
+  Value* reduceCompensated = 
+    b.CreateCall(compensatedFunc, {}, "reduce.compensated");
+
+  Value* fixed = b.CreateICmpNE(reduceBlock, zero64);
+
+  Value* divisor = b.CreateSelect(fixed, reduceBlock, one64);
+
+  Value* numBlocks = 
+    b.CreateUDiv(b.CreateAdd(n, b.CreateSub(divisor, one64)), divisor);
+
+  numBlocks = 
+    b.CreateSelect(b.CreateICmpEQ(numBlocks, zero64), one64, numBlocks);
+
+  Value* numPartials64 = b.CreateSelect(fixed, numBlocks, numThreads64);
+
+  Value* partialsCount = b.CreateTrunc(numPartials64, i32Ty, "num.partials");
+
+  Value* partialSize = 
+    b.CreateSelect(fixed, reduceBlock, b.CreateUDiv(n, numThreads64));
+
+  // blocks are grouped by the runtime, thread partials are queued singly
+  Value* grain = b.CreateSelect(fixed, zero, one);
+
+  DataLayout layout(module_);
+
+  Value* bytes = 
+  b.CreateMul(numPartials64, 
+              ConstantInt::get(i64Ty, layout.getTypeAllocSize(rt)));
+
+  auto site = 
+    new GlobalVariable(*module_, voidPtrTy, false,
+                       GlobalValue::InternalLinkage,
+                       ConstantPointerNull::get(voidPtrTy),
+                       "preduce.context");
+
+  Value* context = b.CreateCall(contextFunc, {site, bytes}, "context");
+
+  StructType* contextType = 
+    StructType::create(c, {voidPtrTy, voidPtrTy}, "struct.reduce_context");
+
+  Value* contextPtr = 
+    b.CreateBitCast(context, PointerType::get(contextType, 0));
+
+  Value* synchPtr = 
+    b.CreateLoad(b.CreateStructGEP(contextType, contextPtr, 0), "synch.ptr");
+
+  // each worker writes its own partials, which start on a cache line
+  Value* partialSumsVoidPtr = 
+    b.CreateLoad(b.CreateStructGEP(contextType, contextPtr, 1), "partials");
+  Value* partialSumsPtr = b.CreateBitCast(partialSumsVoidPtr, PointerType::get(rt, 0));
+
+  Value* reduceArgs = createEntryAlloca_(parentFunc, argsType, "reduce.args");
+
+  Value* argsIdx = b.CreateStructGEP(argsType, reduceArgs, 0);
+  b.CreateStore(partialSumsPtr, argsIdx);
+
+  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 1);
+  b.CreateStore(partialsCount, argsIdx);
+
+  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 2);
+  b.CreateStore(start, argsIdx);
+
+  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 3);
+  b.CreateStore(n, argsIdx);
+
+  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 4);
+  Value* captureArgsVoidPtr = b.CreateBitCast(captureArgsPtr, voidPtrTy);
+  b.CreateStore(captureArgsVoidPtr, argsIdx);
+
+  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 5);
+  b.CreateStore(numVars > 0 ? r->reduceResult(0) : 
+                ConstantPointerNull::get(PointerType::get(initType, 0)),
+                argsIdx);
+
+  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 6);
+  b.CreateStore(partialSize, argsIdx);
+
+  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 7);
+  b.CreateStore(reduceCompensated, argsIdx);
+
+  if(scan){
+    argsIdx = b.CreateStructGEP(argsType, reduceArgs, 8);
+    b.CreateStore(b.CreateBitCast(scan->output(), 
+                                  argsType->getElementType(8)), argsIdx);
+  }
+
+  // one range task over the partial indices
+  b.CreateCall(queueFunc, {synchPtr,
+                           b.CreateBitCast(reduceArgs, voidPtrTy),
+                           b.CreateBitCast(func, voidPtrTy),
+                           zero, partialsCount, grain, one, region});
+
+  BasicBlock* exitBlock = BasicBlock::Create(c, "preduce.queue.exit", parentFunc);
+  
+  b.CreateBr(exitBlock);
+
+  BasicBlock* block = marker->getParent();
+  
+  BasicBlock* blockAfter = block->splitBasicBlock(*marker, "preduce.merge");
+
+  block->getTerminator()->removeFromParent();
+  
+  marker->removeFromParent();
+  
+  b.SetInsertPoint(exitBlock);
+
+  b.CreateCall(contextAwaitFunc, {context});
+
+  if(scan){
+    // the partials are the totals of their blocks, replace each with the
+    // combination of all of the ones before it, in index order, the
+    // total of all of them is the final value of the scan variable
+    Value* carryPtr = createEntryAlloca_(parentFunc, rt, "pscan.carry");
+    Value* totalPtr = createEntryAlloca_(parentFunc, rt, "pscan.total");
+
+    for(size_t k = 0; k < numVars; ++k){
+      Value* initVal = reduceIdentity(r, k, rt->getElementType(k));
+
+      if(!initVal){
+        initVal = b.CreateLoad(r->reduceResult(k));
+      }
+
+      b.CreateStore(initVal, b.CreateStructGEP(rt, carryPtr, k));
+    }
+
+    Value* scanIndexPtr = createEntryAlloca_(parentFunc, i32Ty, "pscan.index");
+    b.CreateStore(zero, scanIndexPtr);
+
+    BasicBlock* scanCondBlock = 
+      BasicBlock::Create(c, "pscan.prefix.cond", parentFunc);
+    BasicBlock* scanBlock = 
+      BasicBlock::Create(c, "pscan.prefix.body", parentFunc);
+    BasicBlock* scanExitBlock = 
+      BasicBlock::Create(c, "pscan.prefix.exit", parentFunc);
+
+    b.CreateBr(scanCondBlock);
+
+    b.SetInsertPoint(scanCondBlock);
+
+    Value* scanIndex = b.CreateLoad(scanIndexPtr);
+
+    b.CreateCondBr(b.CreateICmpULT(scanIndex, partialsCount),
+                   scanBlock, scanExitBlock);
+
+    b.SetInsertPoint(scanBlock);
+
+    Value* partialPtr = b.CreateGEP(partialSumsPtr, scanIndex);
+    b.CreateStore(b.CreateLoad(partialPtr), totalPtr);
+    b.CreateStore(b.CreateLoad(carryPtr), partialPtr);
+    combinePartials(b, r, rt, carryPtr, totalPtr);
+
+    b.CreateStore(b.CreateAdd(scanIndex, one), scanIndexPtr);
+
+    b.CreateBr(scanCondBlock);
+
+    b.SetInsertPoint(scanExitBlock);
+
+    for(size_t k = 0; k < numVars; ++k){
+      Value* ck = b.CreateStructGEP(rt, carryPtr, k);
+      b.CreateStore(b.CreateLoad(ck), r->reduceResult(k));
+    }
+
+    // the second pass over the same partition writes the output, with
+    // the synch armed again by the await
+    Function* scanFunc = createReduceFunc_(r, argsType, true);
+    nameRegionFunc_(r, scanFunc, "scan", false);
+
+    b.CreateCall(queueFunc, {synchPtr,
+                             b.CreateBitCast(reduceArgs, voidPtrTy),
+                             b.CreateBitCast(scanFunc, voidPtrTy),
+                             zero, partialsCount, grain, one, region});
+
+    b.CreateCall(contextAwaitFunc, {context});
+
+    b.CreateCall(contextReleaseFunc, {site, context});
+
+    b.CreateBr(blockAfter);
+
+    return;
+  }
+
+  // fold the partials pairwise in place, partial i absorbs partial
+  // i + stride for a doubling stride, so the tree only depends on the
+  // number of partials and the error grows with its depth rather than
+  // with the number of partials
+  Value* stridePtr = createEntryAlloca_(parentFunc, i32Ty, "preduce.fold.stride");
+  b.CreateStore(one, stridePtr);
+
+  Value* foldIndexPtr = createEntryAlloca_(parentFunc, i32Ty, "preduce.fold.index");
+
+  BasicBlock* foldCondBlock = 
+    BasicBlock::Create(c, "preduce.fold.cond", parentFunc);
+  BasicBlock* foldLevelBlock = 
+    BasicBlock::Create(c, "preduce.fold.level", parentFunc);
+  BasicBlock* foldPairBlock = 
+    BasicBlock::Create(c, "preduce.fold.pair", parentFunc);
+  BasicBlock* foldBlock = 
+    BasicBlock::Create(c, "preduce.fold.body", parentFunc);
+  BasicBlock* foldNextBlock = 
+    BasicBlock::Create(c, "preduce.fold.next", parentFunc);
+  BasicBlock* foldExitBlock = 
+    BasicBlock::Create(c, "preduce.fold.exit", parentFunc);
+
+  b.CreateBr(foldCondBlock);
+
+  b.SetInsertPoint(foldCondBlock);
+
+  Value* stride = b.CreateLoad(stridePtr);
+
+  b.CreateCondBr(b.CreateICmpULT(stride, partialsCount),
+                 foldLevelBlock, foldExitBlock);
+
+  b.SetInsertPoint(foldLevelBlock);
+
+  b.CreateStore(zero, foldIndexPtr);
+
+  b.CreateBr(foldPairBlock);
+
+  b.SetInsertPoint(foldPairBlock);
+
+  Value* foldIndex = b.CreateLoad(foldIndexPtr);
+  Value* otherIndex = b.CreateAdd(foldIndex, stride);
+
+  b.CreateCondBr(b.CreateICmpULT(otherIndex, partialsCount),
+                 foldBlock, foldNextBlock);
+
+  b.SetInsertPoint(foldBlock);
+
+  combinePartials(b, r, rt,
+                  b.CreateGEP(partialSumsPtr, foldIndex),
+                  b.CreateGEP(partialSumsPtr, otherIndex));
+
+  b.CreateStore(b.CreateAdd(otherIndex, stride), foldIndexPtr);
+
+  b.CreateBr(foldPairBlock);
+
+  b.SetInsertPoint(foldNextBlock);
+
+  b.CreateStore(b.CreateShl(stride, one), stridePtr);
+
+  b.CreateBr(foldCondBlock);
+
+  b.SetInsertPoint(foldExitBlock);
+  
+  for(size_t k = 0; k < numVars; ++k){
+    if(rt->getElementType(k)->isArrayTy()){
+      continue;
+    }
+
+    Value* pk = b.CreateStructGEP(rt, partialSumsPtr, k);
+    b.CreateStore(b.CreateLoad(pk), r->reduceResult(k));
+  }
+
+  // the private copies of an array are merged into the array itself by a
+  // range task over its elements, each element combines the copies in
+  // index order
+  for(size_t k = 0; k < numVars; ++k){
+    Type* at = rt->getElementType(k);
+
+    if(!at->isArrayTy()){
+      continue;
+    }
+
+    uint64_t numElements;
+    Type* et = flattenArray(at, numElements);
+
+    Type* elementPtrType = PointerType::get(et, 0);
+
+    StructType* rangeArgsType = 
+      StructType::create(c, {i32Ty, i32Ty, voidPtrTy}, "struct.range_args");
+
+    StructType* mergeArgsType = 
+      StructType::create(c, {PointerType::get(rt, 0), i32Ty, elementPtrType},
+                         "struct.merge_args");
+
+    Function* mergeFunc =
+      Function::Create(FunctionType::get(voidTy, {voidPtrTy}, false),
+                       llvm::Function::InternalLinkage,
+                       "reduce.merge",
+                       module_);
+    outlined_.push_back(mergeFunc);
+
+    nameRegionFunc_(r, mergeFunc, "reduce.merge", false);
+
+    IRBuilder<> mb(BasicBlock::Create(c, "entry", mergeFunc));
+
+    Value* rangeArgs = 
+      mb.CreateBitCast(&*mergeFunc->arg_begin(),
+                       PointerType::get(rangeArgsType, 0));
+
+    Value* begin = mb.CreateLoad(mb.CreateStructGEP(nullptr, rangeArgs, 0));
+    Value* end = mb.CreateLoad(mb.CreateStructGEP(nullptr, rangeArgs, 1));
+
+    Value* mergeArgs = 
+      mb.CreateBitCast(mb.CreateLoad(mb.CreateStructGEP(nullptr, rangeArgs, 2)),
+                       PointerType::get(mergeArgsType, 0));
+
+    Value* partials = mb.CreateLoad(mb.CreateStructGEP(nullptr, mergeArgs, 0));
+    Value* count = mb.CreateLoad(mb.CreateStructGEP(nullptr, mergeArgs, 1));
+    Value* dest = mb.CreateLoad(mb.CreateStructGEP(nullptr, mergeArgs, 2));
+
+    Value* accPtr = mb.CreateAlloca(et, nullptr, "merge.acc");
+
+    auto element = [&](Value* p, Value* e){
+      Value* pk = mb.CreateStructGEP(rt, mb.CreateGEP(partials, p), k);
+      return mb.CreateGEP(mb.CreateBitCast(pk, elementPtrType), e);
+    };
+
+    emitLoop(mb, mergeFunc, begin, end, "merge", [&](Value* e){
+      mb.CreateStore(mb.CreateLoad(element(zero, e)), accPtr);
+
+      emitLoop(mb, mergeFunc, one, count, "merge.partial", [&](Value* p){
+        Value* acc = mb.CreateLoad(accPtr);
+        Value* v = mb.CreateLoad(element(p, e));
+        mb.CreateStore(reduceCombine(mb, r, k, acc, v), accPtr);
+      });
+
+      mb.CreateStore(mb.CreateLoad(accPtr), mb.CreateGEP(dest, e));
+    });
+
+    mb.CreateRetVoid();
+
+    Value* mergeArgsPtr = 
+      createEntryAlloca_(parentFunc, mergeArgsType, "preduce.merge.args");
+
+    b.CreateStore(partialSumsPtr, b.CreateStructGEP(mergeArgsType, mergeArgsPtr, 0));
+    b.CreateStore(partialsCount, b.CreateStructGEP(mergeArgsType, mergeArgsPtr, 1));
+    b.CreateStore(b.CreateBitCast(r->reduceResult(k), elementPtrType), 
+                  b.CreateStructGEP(mergeArgsType, mergeArgsPtr, 2));
+
+    b.CreateCall(queueFunc, {synchPtr,
+                             b.CreateBitCast(mergeArgsPtr, voidPtrTy),
+                             b.CreateBitCast(mergeFunc, voidPtrTy),
+                             zero, ConstantInt::get(i32Ty, numElements),
+                             zero, one, region});
+
+    b.CreateCall(contextAwaitFunc, {context});
+  }
+
+  b.CreateCall(contextReleaseFunc, {site, context});
+
+  b.CreateBr(blockAfter);
+
+//  func->getParent()->dump();
+}
+
+// a task call is spawned while the runtime's spawn depth is below its
+// cutoff, deeper calls run a clone of the function whose own task calls
+// are plain calls to the clone, so the recursion below the cutoff pays
+// nothing for the tasking. The calls of a memoized task are always
+// spawned instead, after looking up the frame of an earlier call with
+// the same arguments, which a call found there shares rather than
+// spawning its own, so that each distinct call runs once.
+void HLIRModule::lowerTask_(HLIRTask* task,
+                            const set<CallInst*>& inlineCalls){
+  auto& b = builder();
+  auto& c = context();
+
+  DataLayout layout(module_);
+
+  Function* func = task->function();
+  Function* wrapperFunc = task->wrapperFunction();
+
+  nameRegionFunc_(task, wrapperFunc, "hlir.task_wrapper", false);
+  Constant* region = 
+    createRegionDesc_(task, func->getName().str(), REGION_TASK,
+                      task->stackSize());
+
+  bool memoized = taskMemoized(task);
+
+  Function* serialFunc = nullptr;
+  if(!memoized){
+    ValueToValueMapTy vmap;
+    serialFunc = CloneFunction(func, vmap, false);
+    serialFunc->setName(func->getName() + ".serial");
+    serialFunc->setLinkage(GlobalValue::InternalLinkage);
+    module_->getFunctionList().push_back(serialFunc);
+  }
+
+  vector<CallInst*> calls;
+  vector<InvokeInst*> invokes;
+
+  set<Instruction*> spawnCalls;
+  for(size_t i = 0; i < task->numCalls(); ++i){
+    spawnCalls.insert(task->call(i));
+  }
+
+  for(User* u : func->users()){
+    CallSite cs(u);
+    if(!cs || cs.getCalledValue() != func){
+      continue;
+    }
+
+    Function* parentFunc = cs.getInstruction()->getParent()->getParent();
+
+    if(parentFunc == serialFunc){
+      cs.setCalledFunction(serialFunc);
+    }
+    else if(parentFunc == wrapperFunc || inlineCalls.count(
+              dyn_cast<CallInst>(cs.getInstruction())) > 0){
+      continue;
+    }
+    else if(!spawnCalls.empty() &&
+            spawnCalls.count(cs.getInstruction()) == 0){
+      continue;
+    }
+    else if(auto ii = dyn_cast<InvokeInst>(u)){
+      invokes.push_back(ii);
+    }
+    else{
+      calls.push_back(cast<CallInst>(u));
+    }
+  }
+
+  // a call that may throw, made with invoke, is spawned as the others,
+  // only its serial path keeps the unwind edge. It becomes a call
+  // followed by a branch to its normal destination here, and the
+  // incoming values of the unwind destination are kept for the serial
+  // invoke that replaces it below.
+  struct Unwind{
+    BasicBlock* dest;
+    vector<pair<PHINode*, Value*>> incoming;
+  };
+
+  map<CallInst*, Unwind> unwinds;
+
+  for(InvokeInst* ii : invokes){
+    BasicBlock* parentBlock = ii->getParent();
+
+    ValueVec args(ii->arg_operands().begin(), ii->arg_operands().end());
+    CallInst* ci = CallInst::Create(func, args, "", ii);
+    ci->setCallingConv(ii->getCallingConv());
+    ci->setAttributes(ii->getAttributes());
+    ci->setDebugLoc(ii->getDebugLoc());
+    ci->takeName(ii);
+
+    Unwind& u = unwinds[ci];
+    u.dest = ii->getUnwindDest();
+
+    for(Instruction& i : *u.dest){
+      auto phi = dyn_cast<PHINode>(&i);
+      if(!phi){
+        break;
+      }
+
+      u.incoming.push_back({phi, phi->getIncomingValueForBlock(parentBlock)});
+    }
+
+    u.dest->removePredecessor(parentBlock);
+
+    ii->replaceAllUsesWith(ci);
+    BranchInst::Create(ii->getNormalDest(), ii);
+    ii->eraseFromParent();
+
+    calls.push_back(ci);
+  }
+
+  Type* retType = func->getReturnType();
+  bool isVoid = retType->isVoidTy();
+
+  if(isVoid){
+    retType = i8Ty;
+  }
+
+  // the instruction each call is awaited at, its first use
+  map<CallInst*, Instruction*> awaits;
+
+  for(CallInst* ci : calls){
+    for(User* u : ci->users()){
+      if(auto i = dyn_cast<Instruction>(u)){
+        awaits[ci] = i;
+        break;
+      }
+    }
+  }
+
+  // a call awaited on every way out of its caller has its frame on the
+  // caller's stack and the task writes its result straight to the
+  // caller's, unless it has dependences, which the runtime may hold on
+  // to after the caller returns, or is memoized, when the runtime keeps
+  // the frame for later calls
+  bool dependent = false;
+  for(size_t i = 0; i < func->arg_size(); ++i){
+    dependent = dependent || taskDependence(task, i) != 0;
+  }
+
+  set<CallInst*> stackCalls;
+
+  for(auto& ai : awaits){
+    if(!dependent && !memoized && awaitedInFrame(ai.first, ai.second)){
+      stackCalls.insert(ai.first);
+    }
+  }
+
+  for(CallInst* ci : calls){
+    BasicBlock* parentBlock = ci->getParent();
+    Function* parentFunc = parentBlock->getParent();
+
+    bool onStack = stackCalls.count(ci) > 0;
+    bool keepsResult = !isVoid && !ci->use_empty();
+
+    b.SetInsertPoint(&*parentFunc->getEntryBlock().begin());
+    Value* taskRetPtr = b.CreateAlloca(retType, nullptr, "task.ret");
+
+    BasicBlock* mergeBlock = parentBlock->splitBasicBlock(ci, "task.merge");
+    parentBlock->getTerminator()->eraseFromParent();
+
+    BasicBlock* spawnBlock = 
+      BasicBlock::Create(c, "task.spawn", parentFunc, mergeBlock);
+
+    ValueVec callArgs(ci->arg_operands().begin(), ci->arg_operands().end());
+
+    BasicBlock* serialBlock = nullptr;
+
+    b.SetInsertPoint(parentBlock);
+
+    if(memoized){
+      b.CreateBr(spawnBlock);
+    }
+    else{
+      Function* spawnFunc = 
+        getFunction("__ares_task_spawn", TypeVec(), i32Ty);
+      Value* spawn = b.CreateCall(spawnFunc, ValueVec(), "spawn");
+      spawn = b.CreateICmpNE(spawn, ConstantInt::get(i32Ty, 0));
+
+      serialBlock = 
+        BasicBlock::Create(c, "task.serial", parentFunc, mergeBlock);
+
+      b.CreateCondBr(spawn, spawnBlock, serialBlock);
+
+      b.SetInsertPoint(serialBlock);
+
+      Value* serialRet;
+      auto uitr = unwinds.find(ci);
+
+      if(uitr != unwinds.end()){
+        BasicBlock* contBlock =
+          BasicBlock::Create(c, "task.serial.cont", parentFunc, mergeBlock);
+
+        Unwind& u = uitr->second;
+        serialRet = b.CreateInvoke(serialFunc, contBlock, u.dest, callArgs);
+
+        for(auto& pi : u.incoming){
+          pi.first->addIncoming(pi.second, serialBlock);
+        }
+
+        b.SetInsertPoint(contBlock);
+      }
+      else{
+        serialRet = b.CreateCall(serialFunc, callArgs);
+      }
+
+      if(!isVoid){
+        b.CreateStore(serialRet, taskRetPtr);
+      }
+
+      b.CreateBr(mergeBlock);
+    }
+
+    b.SetInsertPoint(spawnBlock);
+
+    // the result is written through the pointer in field 2, to the
+    // caller's storage or, for a frame that may outlive the caller, to
+    // a last field of its own, which that of a memoized call always has
+    // for the calls that share it
+    TypeVec fields;
+    fields.push_back(voidPtrTy);
+    fields.push_back(i32Ty);
+    fields.push_back(PointerType::get(retType, 0));
+
+    for(auto pitr = func->arg_begin(), pitrEnd = func->arg_end();
+      pitr != pitrEnd; ++pitr){
+      fields.push_back(pitr->getType());
+    }
+
+    size_t retIdx = fields.size();
+    bool retField = (keepsResult && !onStack) || (memoized && !isVoid);
+    if(retField){
+      fields.push_back(retType);
+    }
+
+    StructType* argsType = StructType::create(c, fields, "struct.func_args");
+
+    size_t size = layout.getTypeAllocSize(argsType);
+
+    ValueVec args;
+    Value* argsVoidPtr;
+
+    if(onStack){
+      IRBuilder<> eb(&*parentFunc->getEntryBlock().begin());
+
+      Function* frameSizeFunc =
+        getFunction("__ares_task_frame_size", TypeVec(), i64Ty);
+
+      Value* frameSize = 
+        eb.CreateAdd(eb.CreateCall(frameSizeFunc, ValueVec()),
+                     ConstantInt::get(i64Ty, size));
+
+      AllocaInst* frame = eb.CreateAlloca(i8Ty, frameSize, "task.frame");
+      frame->setAlignment(16);
+
+      Function* initFunc = 
+        getFunction("__ares_task_init", {voidPtrTy}, voidPtrTy);
+
+      args = {frame};
+      argsVoidPtr = b.CreateCall(initFunc, args, "args.void.ptr");
+    }
+    else{
+      Function* allocFunc = 
+        getFunction("__ares_task_alloc", {i64Ty}, voidPtrTy);
+
+      args = {ConstantInt::get(i64Ty, size)};
+      argsVoidPtr = b.CreateCall(allocFunc, args, "args.void.ptr");
+    }
+
+    Value* argsPtr = 
+      b.CreateBitCast(argsVoidPtr, PointerType::get(argsType, 0), "args.ptr");
+
+    Value* destPtr = ConstantPointerNull::get(PointerType::get(retType, 0));
+    if(keepsResult && onStack){
+      destPtr = taskRetPtr;
+    }
+    else if(retField){
+      destPtr = b.CreateStructGEP(nullptr, argsPtr, retIdx, "ret.ptr");
+    }
+
+    b.CreateStore(destPtr, b.CreateStructGEP(nullptr, argsPtr, 2));
+
+    size_t idx = 3;
+    for(Value* arg : callArgs){
+      Value* argPtr = b.CreateStructGEP(nullptr, argsPtr, idx, "arg.ptr");
+      b.CreateStore(arg, argPtr);
+      ++idx;
+    }
+
+    Value* funcVoidPtr = b.CreateBitCast(wrapperFunc, voidPtrTy, "funcVoidPtr");
+
+    // the frame is released by the runtime once the task is done and by
+    // the caller, here if it never awaits the result
+    Function* freeFunc = getFunction("__ares_task_free", {voidPtrTy});
+
+    // a memoized call is keyed by its arguments packed, without the
+    // padding of the frame, and the one that the runtime finds with the
+    // same key is shared in place of this one, which is then not queued
+    Value* memoArgs = nullptr;
+    BasicBlock* sharedBlock = nullptr;
+
+    if(memoized){
+      TypeVec keyFields;
+      for(Value* arg : callArgs){
+        keyFields.push_back(arg->getType());
+      }
+
+      StructType* keyType =
+        StructType::create(c, keyFields, "struct.task_key", true);
+
+      IRBuilder<> eb(&*parentFunc->getEntryBlock().begin());
+      Value* keyPtr = eb.CreateAlloca(keyType, nullptr, "task.key");
+
+      for(size_t i = 0; i < callArgs.size(); ++i){
+        b.CreateStore(callArgs[i],
+                      b.CreateStructGEP(nullptr, keyPtr, i, "key.ptr"));
+      }
+
+      Function* memoFunc =
+        getFunction("__ares_task_memo",
+                    {voidPtrTy, voidPtrTy, voidPtrTy, i64Ty}, voidPtrTy);
+
+      args = {argsVoidPtr, funcVoidPtr, b.CreateBitCast(keyPtr, voidPtrTy),
+              ConstantInt::get(i64Ty, layout.getTypeAllocSize(keyType))};
+      memoArgs = b.CreateCall(memoFunc, args, "memo.args");
+
+      BasicBlock* queueBlock =
+        BasicBlock::Create(c, "task.queue", parentFunc, mergeBlock);
+
+      sharedBlock =
+        BasicBlock::Create(c, "task.shared", parentFunc, mergeBlock);
+
+      b.CreateCondBr(b.CreateICmpEQ(memoArgs, argsVoidPtr),
+                     queueBlock, sharedBlock);
+
+      b.SetInsertPoint(sharedBlock);
+
+      if(ci->use_empty()){
+        args = {memoArgs};
+        b.CreateCall(freeFunc, args);
+      }
+
+      b.CreateBr(mergeBlock);
+
+      b.SetInsertPoint(queueBlock);
+    }
+
+    // the runtime holds the call back until the calls spawned before it
+    // by the same caller that conflict on these have completed
+    Function* dependFunc = 
+      getFunction("__ares_task_depend", {voidPtrTy, voidPtrTy, i32Ty});
+
+    for(size_t i = 0; i < callArgs.size(); ++i){
+      uint32_t mode = taskDependence(task, i);
+      if(mode != 0){
+        args = {argsVoidPtr, b.CreateBitCast(callArgs[i], voidPtrTy),
+                ConstantInt::get(i32Ty, mode)};
+        b.CreateCall(dependFunc, args);
+      }
+    }
+
+    // the call runs on the workers of the partition that the first
+    // partitioned argument is in
+    if(Value* part = taskPartition(task, callArgs, b)){
+      Function* placeFunc =
+        getFunction("__ares_task_place", {voidPtrTy, i32Ty});
+      args = {argsVoidPtr, part};
+      b.CreateCall(placeFunc, args);
+    }
+
+    Function* queueFunc = 
+      getFunction("__ares_task_queue", 
+                  {voidPtrTy, voidPtrTy, i32Ty, voidPtrTy});
+
+    args = {funcVoidPtr, argsVoidPtr, 
+            ConstantInt::get(i32Ty, task->priority()), region};
+    b.CreateCall(queueFunc, args);
+
+    if(ci->use_empty()){
+      args = {argsVoidPtr};
+      b.CreateCall(freeFunc, args);
+    }
+
+    BasicBlock* queuedBlock = b.GetInsertBlock();
+    b.CreateBr(mergeBlock);
+
+    // null if the call ran serially
+    b.SetInsertPoint(ci);
+    PHINode* spawnedArgs = b.CreatePHI(voidPtrTy, 2, "task.args");
+    spawnedArgs->addIncoming(argsVoidPtr, queuedBlock);
+
+    if(sharedBlock){
+      spawnedArgs->addIncoming(memoArgs, sharedBlock);
+    }
+
+    if(serialBlock){
+      spawnedArgs->addIncoming(ConstantPointerNull::get(voidPtrTy),
+                               serialBlock);
+    }
+
+    for(auto itr = ci->use_begin(), itrEnd = ci->use_end();
+      itr != itrEnd; ++itr){
+
+      if(Instruction* i = dyn_cast<Instruction>(itr->getUser())){
+        BasicBlock* splitBlock = i->getParent();
+        BasicBlock* splitAfter = splitBlock->splitBasicBlock(i, "split.after");
+
+        splitBlock->getTerminator()->eraseFromParent();
+
+        BasicBlock* awaitBlock = 
+          BasicBlock::Create(c, "task.await", parentFunc, splitAfter);
+
+        b.SetInsertPoint(splitBlock);
+        Value* spawned = b.CreateICmpNE(spawnedArgs, 
+          ConstantPointerNull::get(voidPtrTy));
+        b.CreateCondBr(spawned, awaitBlock, splitAfter);
 
-  Function* queueFunc = 
-  getFunction("__ares_queue_func",
-              {voidPtrTy, voidPtrTy, voidPtrTy, i32Ty, i32Ty});
+        b.SetInsertPoint(awaitBlock);
 
-  Function* awaitFunc = getFunction("__ares_await_synch", {voidPtrTy}, i1Ty);
+        Function* awaitFunc = 
+          getFunction("__ares_task_await_future", {voidPtrTy});
 
-  FunctionType* ft =
-    FunctionType::get(voidTy, {voidPtrTy}, false);
+        args = {spawnedArgs};
+        b.CreateCall(awaitFunc, args);
 
-  auto r = pf->range();
-  Value* start = r[0]->as<HLIRValue>();
-  Value* end = r[1]->as<HLIRValue>();
+        // one on the stack has its result in place already
+        if(keepsResult && !onStack){
+          Value* spawnedPtr = 
+            b.CreateBitCast(spawnedArgs, PointerType::get(argsType, 0));
+          Value* retPtr = 
+            b.CreateStructGEP(nullptr, spawnedPtr, retIdx, "retPtr");
+          b.CreateStore(b.CreateLoad(retPtr), taskRetPtr);
+        }
 
-  Value* n = b.CreateSub(end, start, "n");
+        args = {spawnedArgs};
+        b.CreateCall(freeFunc, args);
 
-  Value* synchPtr = b.CreateCall(createSynchFunc, {n}, "synch.ptr");
+        b.CreateBr(splitAfter);
 
-  Value* indexPtr = b.CreateAlloca(i32Ty, nullptr, "index.ptr");
-  b.CreateStore(start, indexPtr);
+        b.SetInsertPoint(i);
+        Value* retVal = b.CreateLoad(taskRetPtr, "retVal");
 
-  BasicBlock* loopBlock = BasicBlock::Create(c, "pfor.queue.loop", func);
-  b.CreateBr(loopBlock);
-  b.SetInsertPoint(loopBlock);
+        ci->replaceAllUsesWith(retVal);
 
-  Value* bodyFunc = pf->body();
+        break;
+      }
+    }
 
-  Value* one = ConstantInt::get(i32Ty, 1);      
-  
-  Value* index = b.CreateLoad(indexPtr);
+    ci->eraseFromParent();
+  }
+}
 
-  b.CreateCall(queueFunc, {synchPtr,
-                           b.CreateBitCast(argsPtr, voidPtrTy),
-                           b.CreateBitCast(bodyFunc, voidPtrTy),
-                           index, one});
+// of several task calls in a block which are made before any of their
+// results is used, as in fib(n - 1) + fib(n - 2), the last is run
+// directly by the caller rather than spawned and then awaited, unless
+// it has dependences or is memoized
+void HLIRModule::findInlineTaskCalls_(set<CallInst*>& inlineCalls){
+  set<Function*> taskFuncs;
+  set<Function*> wrapperFuncs;
+  set<Function*> dependentFuncs;
 
-  Value* nextIndex = b.CreateAdd(index, one);
-  
-  b.CreateStore(nextIndex, indexPtr);
-  
-  Value* cond = b.CreateICmpULT(nextIndex, end);
-  
-  BasicBlock* exitBlock = BasicBlock::Create(c, "pfor.queue.exit", func);
-  
-  b.CreateCondBr(cond, loopBlock, exitBlock);
-  
-  BasicBlock* blockAfter = block->splitBasicBlock(*marker, "pfor.merge");
+  for(HLIRTask* t : tasks_){
+    taskFuncs.insert(t->function());
+    wrapperFuncs.insert(t->wrapperFunction());
 
-  block->getTerminator()->removeFromParent();
+    for(size_t i = 0; i < t->numParams(); ++i){
+      if(taskDependence(t, i) != 0){
+        dependentFuncs.insert(t->function());
+      }
+    }
 
-  marker->removeFromParent();
-  
-  b.SetInsertPoint(exitBlock);
+    if(taskMemoized(t)){
+      dependentFuncs.insert(t->function());
+    }
+  }
 
-#ifdef USE_ARGOBOTS
-  BasicBlock* mergeBlock = BasicBlock::Create(c, "merge.block", func);
-  BasicBlock* yieldBlock = BasicBlock::Create(c, "yield.block", func);
-  BasicBlock* yieldLoopBlock = BasicBlock::Create(c, "yield.loop.block", func);
-  
-  b.CreateBr(yieldLoopBlock);
+  for(Function* f : taskFuncs){
+    for(User* u : f->users()){
+      auto ci = dyn_cast<CallInst>(u);
+      if(!ci || wrapperFuncs.count(ci->getParent()->getParent()) > 0){
+        continue;
+      }
 
-  b.SetInsertPoint(yieldLoopBlock);
+      BasicBlock* bb = ci->getParent();
 
-  Value* done = b.CreateCall(awaitFunc, {synchPtr});
+      // look at each block once, from the first task call in it
+      bool first = true;
+      for(Instruction& ii : *bb){
+        if(&ii == ci){
+          break;
+        }
+        auto prev = dyn_cast<CallInst>(&ii);
+        if(prev && taskFuncs.count(prev->getCalledFunction()) > 0){
+          first = false;
+          break;
+        }
+      }
 
-  cond = b.CreateICmpNE(done, ConstantInt::get(i1Ty, 0));
+      if(!first){
+        continue;
+      }
 
-  b.CreateCondBr(cond, mergeBlock, yieldBlock);
+      vector<CallInst*> pending;
 
-  b.SetInsertPoint(yieldBlock);
+      auto flush = [&]{
+        // a call with dependences has to be ordered after its siblings
+        // by the runtime, and a memoized one looked up by it
+        if(pending.size() > 1 &&
+           dependentFuncs.count(pending.back()->getCalledFunction()) == 0){
+          inlineCalls.insert(pending.back());
+        }
+        pending.clear();
+      };
+
+      for(Instruction& ii : *bb){
+        for(Value* op : ii.operands()){
+          if(find(pending.begin(), pending.end(), op) != pending.end()){
+            flush();
+            break;
+          }
+        }
 
-  Function* yieldFunc = getFunction("__ares_thread_yield", TypeVec());
-    
-  b.CreateCall(yieldFunc);
+        auto call = dyn_cast<CallInst>(&ii);
+        if(call && taskFuncs.count(call->getCalledFunction()) > 0){
+          pending.push_back(call);
+        }
+      }
 
-  b.CreateBr(yieldLoopBlock);
+      flush();
+    }
+  }
+}
 
-  b.SetInsertPoint(mergeBlock);
-#else
-  b.CreateCall(awaitFunc, {synchPtr});
-#endif
+// promotes the locals of the functions that constructs are emitted in
+// and of their bodies before these are lowered, so that the captures
+// see SSA values rather than the frontend's alloca / load chains. The
+// allocas that HLIR refers to are left alone, as are ones used from
+// another function, which are captured by address.
+void HLIRModule::promoteLocals_(){
+  set<Value*> pinned;
+  set<Function*> funcs;
 
-  b.CreateBr(blockAfter);
+  for(HLIRConstruct* c : constructs_){
+    c->values(pinned);
 
-  for(HLIRParallelFor* pf : ps){
-    lowerParallelFor_(pf, argsType, capturedMap, replacedMap);
+    funcs.insert(c->marker()->getParent()->getParent());
+
+    if(auto pf = dynamic_cast<HLIRParallelFor*>(c)){
+      funcs.insert(pf->body());
+    }
+    else if(auto r = dynamic_cast<HLIRParallelReduce*>(c)){
+      funcs.insert(r->body());
+    }
   }
 
-  //pf->body()->dump();
-}
+  for(HLIRTask* t : tasks_){
+    t->values(pinned);
+  }
 
-void HLIRModule::lowerParallelReduce_(HLIRParallelReduce* r){
-  using ValueVec = vector<Value*>;
-  using TypeVec = vector<llvm::Type*>;
+  for(Function* f : funcs){
+    vector<AllocaInst*> allocas;
 
-  auto marker = r->get<HLIRInstruction>("marker");
+    for(Instruction& ii : f->getEntryBlock()){
+      auto ai = dyn_cast<AllocaInst>(&ii);
+      if(!ai || pinned.count(ai) > 0 || !isAllocaPromotable(ai)){
+        continue;
+      }
 
-  LLVMContext& c = module_->getContext();
-  IRBuilder<> b(c);
+      bool local = true;
+      for(User* u : ai->users()){
+        if(cast<Instruction>(u)->getParent()->getParent() != f){
+          local = false;
+          break;
+        }
+      }
 
-  Type* rt = r->reduceType();
+      if(local){
+        allocas.push_back(ai);
+      }
+    }
 
-  Function* allocFunc = getFunction("__ares_alloc", {i64Ty}, voidPtrTy);
-  Function* freeFunc = getFunction("__ares_free", {voidPtrTy});
+    if(!allocas.empty()){
+      DominatorTree dt(*f);
+      PromoteMemToReg(allocas, dt);
+    }
+  }
+}
 
-  TypeVec params = {voidPtrTy, PointerType::get(rt, 0), i32Ty};
+// the blocks a body takes with ares::scratch() are given back when
+// each iteration ends: a mark taken on entry is released before each
+// return, and where f loops over its iterations, another is taken and
+// released around each iteration that still allocates. A call made
+// once per iteration with a size that all of them share is hoisted
+// ahead of the loop instead, so the iterations reuse one block without
+// a runtime call each.
+void HLIRModule::lowerScratch_(Function* f, BasicBlock* latch){
+  vector<CallInst*> calls;
 
-  auto bft = FunctionType::get(voidTy, params, false);
+  for(BasicBlock& bi : *f){
+    for(Instruction& ii : bi){
+      if(auto ci = dyn_cast<CallInst>(&ii)){
+        Function* callee = ci->getCalledFunction();
+        if(!callee){
+          continue;
+        }
 
-  params = {voidPtrTy};
+        // ares::scratch() is declared with an asm label, which clang
+        // marks with a leading \1
+        StringRef name = callee->getName();
+        if(name.startswith("\1")){
+          name = name.substr(1);
+        }
 
-  auto ft = FunctionType::get(voidTy, params, false);
+        if(name == "__ares_scratch"){
+          calls.push_back(ci);
+        }
+      }
+    }
+  }
 
-  // =================== top-level reduce func
+  if(calls.empty()){
+    return;
+  }
 
-  auto func =
-    Function::Create(ft,
-                     llvm::Function::ExternalLinkage,
-                     "reduce",
-                     module_);
+  Function* markFunc = getFunction("__ares_scratch_mark", TypeVec(), i64Ty);
+  Function* releaseFunc = getFunction("__ares_scratch_release", {i64Ty});
 
-  auto aitr = func->arg_begin();
-  aitr->setName("args.ptr");
-  Value* funcArgsVoidPtr = aitr;
+  BasicBlock& entry = f->getEntryBlock();
 
-  BasicBlock* block = BasicBlock::Create(c, "entry", func);
+  IRBuilder<> b(entry.getTerminator());
+  Value* mark = b.CreateCall(markFunc, {}, "scratch.mark");
 
-  b.SetInsertPoint(block);
+  for(BasicBlock& bi : *f){
+    if(isa<ReturnInst>(bi.getTerminator())){
+      b.SetInsertPoint(bi.getTerminator());
+      b.CreateCall(releaseFunc, {mark});
+    }
+  }
 
-  TypeVec fields2 = {voidPtrTy, i32Ty, voidPtrTy};
-  StructType* funcArgsType = StructType::create(c, fields2, "struct.func_args");
-  
-  Value* funcArgsPtr = 
-  b.CreateBitCast(funcArgsVoidPtr, PointerType::get(funcArgsType, 0));
+  if(!latch){
+    return;
+  }
 
-  Value* argsVoidPtr = b.CreateStructGEP(nullptr, funcArgsPtr, 2);
-  argsVoidPtr = b.CreateLoad(argsVoidPtr);
+  DominatorTree dt(*f);
+  LoopInfo li(dt);
 
-  TypeVec fields;
-  fields.push_back(PointerType::get(rt, 0));
-  fields.push_back(voidPtrTy);
-  fields.push_back(voidPtrTy);
-  fields.push_back(i32Ty);
-  fields.push_back(i32Ty);
-  fields.push_back(i32Ty);
-  fields.push_back(PointerType::get(bft, 0));
-  fields.push_back(voidPtrTy);
+  // the loop over the iterations is entered from the entry block and
+  // each iteration starts in the one block its header branches to
+  Loop* loop = li.getLoopFor(latch);
 
-  StructType* argsType = StructType::create(c, fields, "struct.args");
+  if(!loop || loop->getLoopLatch() != latch ||
+     loop->getLoopPreheader() != &entry){
+    return;
+  }
 
-  Type* argsPtrType = PointerType::get(argsType, 0);
+  BasicBlock* iterBlock = nullptr;
 
-  Value* argsPtr = b.CreateBitCast(argsVoidPtr, argsPtrType);
+  for(BasicBlock* si : successors(loop->getHeader())){
+    if(loop->contains(si)){
+      iterBlock = iterBlock ? nullptr : si;
+    }
+  }
 
-  Value* partialSums = b.CreateStructGEP(nullptr, argsPtr, 0);
-  partialSums = b.CreateLoad(partialSums);
+  if(!iterBlock || !iterBlock->getSinglePredecessor()){
+    return;
+  }
 
-  Value* barrier = b.CreateStructGEP(nullptr, argsPtr, 1);
-  barrier = b.CreateLoad(barrier);
+  bool remaining = false;
 
-  Value* synch = b.CreateStructGEP(nullptr, argsPtr, 2);
-  synch = b.CreateLoad(synch);
+  for(CallInst* ci : calls){
+    bool changed;
 
-  Value* threadIndex = b.CreateStructGEP(nullptr, argsPtr, 3);
-  threadIndex = b.CreateLoad(threadIndex);
+    if(li.getLoopFor(ci->getParent()) == loop &&
+       loop->makeLoopInvariant(ci->getArgOperand(0), changed,
+                               entry.getTerminator())){
+      ci->moveBefore(entry.getTerminator());
+    }
+    else{
+      remaining = true;
+    }
+  }
 
-  Value* numThreads = b.CreateStructGEP(nullptr, argsPtr, 4);
-  numThreads = b.CreateLoad(numThreads);
+  if(remaining){
+    b.SetInsertPoint(&*iterBlock->getFirstInsertionPt());
+    Value* iterMark = b.CreateCall(markFunc, {}, "scratch.iter.mark");
 
-  Value* size = b.CreateStructGEP(nullptr, argsPtr, 5);
-  size = b.CreateLoad(size);
+    b.SetInsertPoint(latch->getTerminator());
+    b.CreateCall(releaseFunc, {iterMark});
+  }
+}
 
-  Value* bodyFunc = b.CreateStructGEP(nullptr, argsPtr, 6);
-  bodyFunc = b.CreateLoad(bodyFunc);
+// a scalar local of the function a parallel for is called from which
+// does not escape it and which the bodies only load is passed by value:
+// it is loaded once before the marker and the loads in the bodies are
+// replaced by that value, which is then captured like any other
+void HLIRModule::promoteReadOnlyCaptures_(Instruction* marker,
+                                          const set<Function*>& bodies){
+  Function* f = marker->getParent()->getParent();
 
-  Value* bodyArgs = b.CreateStructGEP(nullptr, argsPtr, 7);
-  bodyArgs = b.CreateLoad(bodyArgs);
+  vector<AllocaInst*> allocas;
 
-  Value* zero = ConstantInt::get(i32Ty, 0);
-  Value* one = ConstantInt::get(i32Ty, 1);
-  Value* two = ConstantInt::get(i32Ty, 2);
+  for(BasicBlock& bi : *f){
+    for(Instruction& ii : bi){
+      if(auto ai = dyn_cast<AllocaInst>(&ii)){
+        if(!ai->isArrayAllocation() && 
+           ai->getAllocatedType()->isSingleValueType()){
+          allocas.push_back(ai);
+        }
+      }
+    }
+  }
 
-  Value* q = b.CreateUDiv(size, numThreads);
+  for(AllocaInst* ai : allocas){
+    vector<LoadInst*> loads;
+    bool readOnly = true;
 
-  Value* start = b.CreateMul(q, threadIndex);
+    for(User* u : ai->users()){
+      auto inst = cast<Instruction>(u);
+      Function* parent = inst->getParent()->getParent();
 
-  Value* cond = b.CreateICmpEQ(threadIndex, b.CreateSub(numThreads, one));
+      if(parent == f){
+        if(isa<LoadInst>(inst)){
+          continue;
+        }
 
-  Value* end = 
-    b.CreateSelect(cond, size, b.CreateMul(q, b.CreateAdd(threadIndex, one)));
+        auto si = dyn_cast<StoreInst>(inst);
+        if(si && si->getValueOperand() != ai){
+          continue;
+        }
 
-  Value* rptr = b.CreateAlloca(rt);
+        readOnly = false;
+        break;
+      }
 
-  Value* initVal;
+      auto li = dyn_cast<LoadInst>(inst);
+      if(!li || !li->isSimple() || bodies.count(parent) == 0){
+        readOnly = false;
+        break;
+      }
 
-  if(rt->isFloatingPointTy()){
-    if(r->sum()){
-      initVal = ConstantFP::get(rt, 0.0);
+      loads.push_back(li);
     }
-    else{
-      initVal = ConstantFP::get(rt, 1.0);
-    }
-  }
-  else{
-    if(r->sum()){
-      initVal = ConstantInt::get(rt, 0);
+
+    if(!readOnly || loads.empty()){
+      continue;
     }
-    else{
-      initVal = ConstantInt::get(rt, 1);
+
+    Value* v = new LoadInst(ai, ai->getName() + ".val", marker);
+
+    for(LoadInst* li : loads){
+      li->replaceAllUsesWith(v);
+      li->eraseFromParent();
     }
   }
+}
 
-  b.CreateStore(initVal, rptr);
+// fuses b into a if they have the same range and nothing between them
+// other than side effect free code, which is moved above a. The body of
+// b then runs at the end of each iteration of the body of a.
+bool HLIRModule::fuseParallelFor_(HLIRParallelFor* a, HLIRParallelFor* b){
+  if(a->dims() != 1 || b->dims() != 1 || a->simd() != b->simd()){
+    return false;
+  }
 
-  Value* iPtr = b.CreateAlloca(i32Ty);
+  Value* ca = a->completion();
+  Value* cb = b->completion();
 
-  b.CreateStore(start, iPtr);
+  if(ca || cb){
+    return false;
+  }
 
-  BasicBlock* condBlock5 = BasicBlock::Create(c, "cond.block", func);
-  b.CreateBr(condBlock5);
+  Value* pa = a->priority();
+  Value* pb = b->priority();
 
-  b.SetInsertPoint(condBlock5);
+  if(pa != pb){
+    return false;
+  }
 
-  Value* i = b.CreateLoad(iPtr);
+  Value* sa = a->schedule();
+  Value* sb = b->schedule();
+  Value* ka = a->chunk();
+  Value* kb = b->chunk();
 
-  Value* endCond = b.CreateICmpULT(i, end);
+  if(sa != sb || ka != kb){
+    return false;
+  }
 
-  BasicBlock* loopBlock5 = BasicBlock::Create(c, "loop.block", func);
+  auto ra = a->range();
+  auto rb = b->range();
 
-  BasicBlock* mergeBlock5 = BasicBlock::Create(c, "merge.block", func);
+  if(ra[0]->as<HLIRValue>() != rb[0]->as<HLIRValue>() ||
+     ra[1]->as<HLIRValue>() != rb[1]->as<HLIRValue>()){
+    return false;
+  }
 
-  b.CreateCondBr(endCond, loopBlock5, mergeBlock5);
+  Instruction* markerA = a->marker();
+  Instruction* markerB = b->marker();
 
-  b.SetInsertPoint(loopBlock5);
+  vector<Instruction*> between;
 
-  ValueVec args2 = {bodyArgs, rptr, i};
+  for(Instruction* i = markerA->getNextNode(); i != markerB; 
+      i = i->getNextNode()){
+    if(!i || isa<TerminatorInst>(i) || isa<PHINode>(i) || 
+       i->mayHaveSideEffects() || i->mayReadFromMemory()){
+      return false;
+    }
+    between.push_back(i);
+  }
 
-  Value* bi = b.CreateCall(bodyFunc, args2);
+  Function* fa = a->body();
+  Function* fb = b->body();
 
-  b.CreateStore(b.CreateAdd(i, one), iPtr);
+  BasicBlock* exitA = a->exitBlock();
+  BasicBlock* exitB = b->exitBlock();
 
-  b.CreateBr(condBlock5);
+  BasicBlock* condB = exitB->getTerminator()->getSuccessor(0);
+  BasicBlock* loopB = condB->getTerminator()->getSuccessor(0);
+  BasicBlock* retB = condB->getTerminator()->getSuccessor(1);
 
-  b.SetInsertPoint(mergeBlock5);
+  BasicBlock* condA = exitA->getTerminator()->getSuccessor(0);
+
+  for(BasicBlock* bi : {exitA, condA, exitB, condB, loopB}){
+    if(isa<PHINode>(bi->front())){
+      return false;
+    }
+  }
 
-  Value* res = b.CreateLoad(rptr);
+  vector<BodyAccess> as;
+  vector<BodyAccess> bs;
 
-  Value* idx1 = b.CreateGEP(partialSums, threadIndex);
-  b.CreateStore(res, idx1);
+  if(!collectAccesses(fa, a->index(), as) || 
+     !collectAccesses(fb, b->index(), bs) ||
+     !canFuse(as, bs, module_->getDataLayout())){
+    return false;
+  }
 
-  Function* barrierFunc = getFunction("__ares_wait_barrier", {voidPtrTy});
+  for(Instruction* i : between){
+    i->moveBefore(markerA);
+  }
 
-  ValueVec args = {barrier};
+  // the locals of b, which the frontend placed in its entry block
+  Instruction* argsInsertionB = b->argsInsertion();
+  vector<Instruction*> locals;
 
-  b.CreateCall(barrierFunc, args);
+  for(Instruction& ii : fb->getEntryBlock()){
+    if(isa<AllocaInst>(&ii) && &ii != b->index() && &ii != argsInsertionB){
+      locals.push_back(&ii);
+    }
+  }
 
-  Value* p2Ptr = b.CreateAlloca(i32Ty);
+  for(Instruction* i : locals){
+    i->moveBefore(a->argsInsertion());
+  }
 
-  b.CreateStore(two, p2Ptr);
+  vector<BasicBlock*> blocks;
+  for(BasicBlock& bi : *fb){
+    if(&bi != &fb->getEntryBlock() && &bi != condB && &bi != exitB && 
+       &bi != retB){
+      blocks.push_back(&bi);
+    }
+  }
 
-  b.CreateStore(one, iPtr);
+  for(BasicBlock* bi : blocks){
+    bi->moveBefore(exitA);
+  }
 
-  BasicBlock* condBlock = BasicBlock::Create(c, "cond.block", func);
-  b.CreateBr(condBlock);
+  Value* indexB = b->index();
+  indexB->replaceAllUsesWith(a->index());
 
-  b.SetInsertPoint(condBlock);
+  vector<BasicBlock*> preds(pred_begin(exitA), pred_end(exitA));
+  for(BasicBlock* bi : preds){
+    bi->getTerminator()->replaceUsesOfWith(exitA, loopB);
+  }
 
-  i = b.CreateLoad(iPtr);
+  preds.assign(pred_begin(exitB), pred_end(exitB));
+  for(BasicBlock* bi : preds){
+    bi->getTerminator()->replaceUsesOfWith(exitB, exitA);
+  }
 
-  Value* cond2 = b.CreateICmpULE(i, numThreads);
+  // the pointers that the body of b reads are now read by that of a
+  const HLIRVector& pointersB = b->pointers();
+  for(size_t i = 0; i < pointersB.size(); ++i){
+    *a->pointers_ << pointersB.get<HLIRVector>(i);
+  }
 
-  BasicBlock* loopBlock = BasicBlock::Create(c, "loop.block", func);
+  removeConstruct_(markerB);
+  markerB->eraseFromParent();
+  fb->eraseFromParent();
 
-  BasicBlock* mergeBlock = BasicBlock::Create(c, "merge.block", func);
+  (*this)[b->name()] = HLIRFunction::nullValue();
 
-  b.CreateCondBr(cond2, loopBlock, mergeBlock);
+  return true;
+}
 
-  b.SetInsertPoint(loopBlock);
+// collapses a parallel for whose body does nothing but run inner, over a
+// range that does not depend on the outer index, into inner over the
+// linearized range of both. The outer and inner indices are recomputed
+// from the collapsed one, so there is a single queue and join instead of
+// one per outer iteration. The ranges have to be constants so that the
+// collapsed range is known to fit.
+bool HLIRModule::collapseParallelFor_(HLIRParallelFor* outer,
+                                      HLIRParallelFor* inner){
+  // the lanes of a ForallSimd are its own indices, not those collapsed
+  if(outer->dims() != 1 || inner->dims() != 1 || outer->simd() ||
+     inner->simd()){
+    return false;
+  }
 
-  Value* p2 = b.CreateLoad(p2Ptr);
+  Value* c1 = outer->completion();
+  Value* c2 = outer->after();
+  Value* c3 = inner->completion();
+  Value* c4 = inner->after();
 
-  Value* mod = b.CreateURem(threadIndex, p2);
+  if(c1 || c2 || c3 || c4){
+    return false;
+  }
 
-  Value* cond3 = b.CreateICmpEQ(mod, zero);
+  // the collapsed loop is queued from where the outer one was, with its
+  // priority
+  Value* pi = inner->priority();
+  if(pi){
+    return false;
+  }
 
-  Value* ti1 = b.CreateAdd(threadIndex, i);
+  // so is its schedule, which is per loop
+  Value* so = outer->schedule();
+  Value* si = inner->schedule();
 
-  Value* cond4 = b.CreateICmpULT(ti1, numThreads);
+  if(so || si){
+    return false;
+  }
 
-  Value* cond5 = b.CreateAnd(cond3, cond4);
+  auto ro = outer->range();
+  auto ri = inner->range();
 
-  BasicBlock* condBlock2 = BasicBlock::Create(c, "cond.block", func);
+  Value* vs[] = {ro[0]->as<HLIRValue>(), ro[1]->as<HLIRValue>(),
+                 ri[0]->as<HLIRValue>(), ri[1]->as<HLIRValue>()};
 
-  BasicBlock* mergeBlock2 = BasicBlock::Create(c, "merge.block", func);
+  auto startO = dyn_cast<ConstantInt>(vs[0]);
+  auto endO = dyn_cast<ConstantInt>(vs[1]);
+  auto startI = dyn_cast<ConstantInt>(vs[2]);
+  auto endI = dyn_cast<ConstantInt>(vs[3]);
 
-  b.CreateCondBr(cond5, condBlock2, mergeBlock2);
+  if(!startO || !endO || !startI || !endI){
+    return false;
+  }
 
-  b.SetInsertPoint(condBlock2);
+  uint64_t no = endO->getZExtValue() > startO->getZExtValue() ? 
+    endO->getZExtValue() - startO->getZExtValue() : 0;
 
-  Value* idx2 = b.CreateGEP(partialSums, ti1);
-  Value* v1 = b.CreateLoad(idx1);
-  Value* v2 = b.CreateLoad(idx2);
-  Value* va;
+  uint64_t ni = endI->getZExtValue() > startI->getZExtValue() ?
+    endI->getZExtValue() - startI->getZExtValue() : 0;
 
-  if(rt->isFloatingPointTy()){
-    va = b.CreateFAdd(v1, v2);
-  }
-  else{
-    va = b.CreateAdd(v1, v2);
+  if(ni == 0 || no * ni > UINT32_MAX){
+    return false;
   }
 
-  b.CreateStore(va, idx1);
+  Function* fo = outer->body();
+  Function* fi = inner->body();
 
-  b.CreateBr(mergeBlock2);
+  BasicBlock* exitO = outer->exitBlock();
+  BasicBlock* condO = exitO->getTerminator()->getSuccessor(0);
+  BasicBlock* loopO = condO->getTerminator()->getSuccessor(0);
 
-  b.SetInsertPoint(mergeBlock2);
+  // entry, cond, body, exit and return, the body being a single block
+  if(fo->size() != 5 || loopO->getTerminator()->getNumSuccessors() != 1 ||
+     loopO->getTerminator()->getSuccessor(0) != exitO){
+    return false;
+  }
 
-  p2 = b.CreateMul(p2, two);
-  b.CreateStore(p2, p2Ptr);
+  Instruction* markerI = inner->marker();
+  Value* indexO = outer->index();
 
-  b.CreateCall(barrierFunc, args);
+  vector<Instruction*> pure;
 
-  i = b.CreateMul(i, two);
-  b.CreateStore(i, iPtr);
+  for(Instruction& ii : *loopO){
+    if(&ii == markerI || &ii == loopO->getTerminator() || 
+       isa<DbgInfoIntrinsic>(&ii)){
+      continue;
+    }
 
-  b.CreateBr(condBlock);
+    auto li = dyn_cast<LoadInst>(&ii);
+    if(li && li->isSimple() && li->getPointerOperand() == indexO){
+      pure.push_back(li);
+      continue;
+    }
 
-  b.SetInsertPoint(mergeBlock);
+    if(ii.mayHaveSideEffects() || ii.mayReadFromMemory()){
+      return false;
+    }
 
-  Function* signalFunc = getFunction("__ares_signal_synch", {voidPtrTy});
-  args = {synch};
+    pure.push_back(&ii);
+  }
 
-  b.CreateCall(signalFunc, args);
+  // the inner body can only refer to the outer body's values in its loop
+  set<Instruction*> pureSet(pure.begin(), pure.end());
 
-  b.CreateRetVoid();
+  for(BasicBlock& bi : *fi){
+    for(Instruction& ii : bi){
+      for(Value* op : ii.operands()){
+        auto oi = dyn_cast<Instruction>(op);
+        if(oi && oi->getParent()->getParent() == fo && 
+           pureSet.count(oi) == 0){
+          return false;
+        }
+      }
+    }
+  }
 
-  // =================== invocation / queueing of reduce
+  BasicBlock* exitI = inner->exitBlock();
+  BasicBlock* condI = exitI->getTerminator()->getSuccessor(0);
+  BasicBlock* loopI = condI->getTerminator()->getSuccessor(0);
 
-  TypeVec captureFields;
+  Value* indexI = inner->index();
 
-  vector<Instruction*> v;
-  vector<Instruction*> rc;
+  vector<LoadInst*> indexLoads;
+  for(User* u : indexI->users()){
+    auto li = dyn_cast<LoadInst>(u);
+    if(li && li->getParent() != condI && li->getParent() != exitI){
+      indexLoads.push_back(li);
+    }
+  }
 
-  std::vector<HLIRParallelFor*> ps;
-  std::vector<HLIRParallelReduce*> rs;
+  IRBuilder<> b(loopI, loopI->getFirstInsertionPt());
 
-  findExternalValues_(r->body(), v, true, true, ps, rs);
-  
-  for(Instruction* vi : v){
-    captureFields.push_back(vi->getType());    
-  }
+  Value* k = b.CreateLoad(indexI, "collapsed.index");
+  Value* n = ConstantInt::get(i32Ty, ni);
 
-  Type* captureArgsType = StructType::create(c, captureFields, "struct.func_args");
+  Value* i = b.CreateAdd(startO, b.CreateUDiv(k, n), "outer.index");
+  Value* j = b.CreateAdd(startI, b.CreateURem(k, n), "inner.index");
 
-  auto argsInsertion = r->get<HLIRInstruction>("argsInsertion");
-  b.SetInsertPoint(argsInsertion); 
+  for(LoadInst* li : indexLoads){
+    li->replaceAllUsesWith(j);
+    li->eraseFromParent();
+  }
 
-  Value* argsStructPtr = 
-    b.CreateBitCast(r->args(), PointerType::get(captureArgsType, 0));
+  // the outer body's values are recomputed from the outer index
+  unordered_map<Value*, Value*> vm;
 
-  size_t j = 0;
-  for(Instruction* vi : v){
-    Value* gi = b.CreateStructGEP(captureArgsType, argsStructPtr, j);
-    Value* ri = b.CreateLoad(gi, vi->getName());
-    
-    for(Use& u : vi->uses()){
-      User* user = u.getUser();
-      auto inst = dyn_cast<Instruction>(user);
-      if(inst && inst->getParent()->getParent() == r->body()){
-        user->replaceUsesOfWith(vi, ri);
+  for(Instruction* pi : pure){
+    Value* v;
+
+    auto li = dyn_cast<LoadInst>(pi);
+    if(li && li->getPointerOperand() == indexO){
+      v = i;
+    }
+    else{
+      Instruction* ci = pi->clone();
+      for(Use& u : ci->operands()){
+        auto itr = vm.find(u.get());
+        if(itr != vm.end()){
+          u.set(itr->second);
+        }
       }
+      b.Insert(ci, pi->getName());
+      v = ci;
     }
 
-    ++j;
+    vm[pi] = v;
+
+    vector<User*> users(pi->user_begin(), pi->user_end());
+    for(User* u : users){
+      auto ui = cast<Instruction>(u);
+      if(ui->getParent()->getParent() == fi){
+        ui->replaceUsesOfWith(pi, v);
+      }
+    }
   }
 
-  b.SetInsertPoint(marker);
+  Instruction* markerO = outer->marker();
+  markerI->moveBefore(markerO);
 
-  Function* parentFunc = marker->getParent()->getParent();
+  inner->setRange(ConstantInt::get(i32Ty, 0), 
+                  ConstantInt::get(i32Ty, no * ni));
+  inner->setPriority(outer->priority());
 
-  Value* captureArgsPtr = b.CreateAlloca(captureArgsType);
+  removeConstruct_(markerO);
+  markerO->eraseFromParent();
+  fo->eraseFromParent();
 
-  for(size_t i = 0; i < v.size(); ++i){
-    Value* vi = v[i];
-    Value* pi = b.CreateStructGEP(captureArgsType, captureArgsPtr, i);
-    b.CreateStore(vi, pi);    
-  }
+  (*this)[outer->name()] = HLIRFunction::nullValue();
 
-  Function* createSynchFunc = 
-    getFunction("__ares_create_synch", {i32Ty}, voidPtrTy);
+  return true;
+}
 
-  Function* createBarrierFunc = 
-    getFunction("__ares_create_barrier", {i32Ty}, voidPtrTy);
+void HLIRModule::collapseParallelFors_(
+  unordered_map<Function*, HLIRConstruct*>& bodyMap){
 
-  Function* queueFunc = 
-  getFunction("__ares_queue_func",
-              {voidPtrTy, voidPtrTy, voidPtrTy, i32Ty, i32Ty});
+  bool changed = true;
+
+  while(changed){
+    changed = false;
+
+    for(HLIRConstruct* c : constructs_){
+      auto inner = dynamic_cast<HLIRParallelFor*>(c);
+      if(!inner){
+        continue;
+      }
 
-  ft = FunctionType::get(voidTy, {voidPtrTy}, false);
+      Function* f = inner->marker()->getParent()->getParent();
 
-  auto range = r->range();
-  start = toInt32(range[0]->as<HLIRInteger>());
-  end = toInt32(range[1]->as<HLIRInteger>());
+      auto oitr = bodyMap.find(f);
+      if(oitr == bodyMap.end()){
+        continue;
+      }
 
-  Value* n = b.CreateSub(end, start, "n");
+      auto outer = dynamic_cast<HLIRParallelFor*>(oitr->second);
 
-  numThreads = ConstantInt::get(i32Ty, REDUCE_THREADS);
+      if(outer && collapseParallelFor_(outer, inner)){
+        bodyMap.erase(f);
+        changed = true;
+        break;
+      }
+    }
+  }
+}
 
-  Value* synchPtr = b.CreateCall(createSynchFunc, {numThreads}, "synch.ptr");
+// adjacent parallel fors over the same range are fused so that they
+// are queued and awaited once and stream through memory together
+void HLIRModule::fuseParallelFors_(
+  unordered_map<Function*, HLIRConstruct*>& bodyMap){
 
-  Value* barrierPtr = b.CreateCall(createBarrierFunc, {numThreads}, "barrier.ptr");
+  bool changed = true;
 
-  Value* indexPtr = b.CreateAlloca(i32Ty, nullptr, "index.ptr");
-  b.CreateStore(start, indexPtr);
+  while(changed){
+    changed = false;
 
-  Value* bytes = 
-  b.CreateMul(numThreads, ConstantInt::get(i32Ty, rt->getPrimitiveSizeInBits()/8));
-  bytes = b.CreateZExt(bytes, i64Ty);
+    for(HLIRConstruct* c : constructs_){
+      auto a = dynamic_cast<HLIRParallelFor*>(c);
+      if(!a){
+        continue;
+      }
 
-  Value* partialSumsVoidPtr = b.CreateCall(allocFunc, {bytes});
-  Value* partialSumsPtr = b.CreateBitCast(partialSumsVoidPtr, PointerType::get(rt, 0));
+      Instruction* i = a->marker()->getNextNode();
+      while(i && !isa<TerminatorInst>(i) && !i->mayHaveSideEffects() && 
+            !i->mayReadFromMemory()){
+        i = i->getNextNode();
+      }
 
-  loopBlock = BasicBlock::Create(c, "preduce.queue.loop", parentFunc);
-  b.CreateBr(loopBlock);
-  b.SetInsertPoint(loopBlock);
+      auto bitr = constructMap_.find(i);
+      if(bitr == constructMap_.end()){
+        continue;
+      }
 
-  Value* reduceArgs = b.CreateAlloca(argsType, nullptr, "reduce.args");
+      auto b = dynamic_cast<HLIRParallelFor*>(bitr->second);
+      if(!b){
+        continue;
+      }
 
-  Value* index = b.CreateLoad(indexPtr, "index");
+      Function* fb = b->body();
 
-  Value* argsIdx = b.CreateStructGEP(argsType, reduceArgs, 0);
-  b.CreateStore(partialSumsPtr, argsIdx);
+      if(fuseParallelFor_(a, b)){
+        bodyMap.erase(fb);
+        changed = true;
+        break;
+      }
+    }
+  }
+}
 
-  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 1);
-  b.CreateStore(barrierPtr, argsIdx);
+void HLIRModule::findNestedBodies_(Function* f, set<Function*>& bodies){
+  for(BasicBlock& bi : *f){
+    for(Instruction& ii : bi){
+      auto itr = constructMap_.find(&ii);
+      if(itr == constructMap_.end()){
+        continue;
+      }
 
-  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 2);
-  b.CreateStore(synchPtr, argsIdx);
+      Function* body = nullptr;
 
-  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 3);
-  b.CreateStore(index, argsIdx);
+      if(auto pf = dynamic_cast<HLIRParallelFor*>(itr->second)){
+        body = pf->body();
+      }
+      else if(auto pr = dynamic_cast<HLIRParallelReduce*>(itr->second)){
+        body = pr->body();
+      }
 
-  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 4);
-  b.CreateStore(numThreads, argsIdx);
+      if(body && bodies.insert(body).second){
+        findNestedBodies_(body, bodies);
+      }
+    }
+  }
+}
 
-  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 5);
-  b.CreateStore(n, argsIdx);
+void HLIRModule::lowerCommunication_(HLIRConstruct* c){
+  Instruction* marker = c->marker();
+  IRBuilder<> b(marker);
 
-  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 6);
-  b.CreateStore(r->body(), argsIdx);
+  // the team variants take the ares::CommTeam first and team ranks
+  if(auto barrier = dynamic_cast<HLIRBarrier*>(c)){
+    Value* handle = nullptr;
+    if(barrier->hasTeam()){
+      handle = barrier->team().handle();
+    }
 
-  argsIdx = b.CreateStructGEP(argsType, reduceArgs, 7);
-  Value* captureArgsVoidPtr = b.CreateBitCast(captureArgsPtr, voidPtrTy);
-  b.CreateStore(captureArgsVoidPtr, argsIdx);
+    if(handle){
+      b.CreateCall(getFunction("__ares_comm_team_barrier", {voidPtrTy}),
+                   {b.CreateBitCast(handle, voidPtrTy)});
+    }
+    else{
+      b.CreateCall(getFunction("__ares_comm_barrier", {}));
+    }
 
-  b.CreateCall(queueFunc, {synchPtr,
-                           b.CreateBitCast(reduceArgs, voidPtrTy),
-                           b.CreateBitCast(func, voidPtrTy),
-                           index, one});
+    marker->eraseFromParent();
+    return;
+  }
 
-  Value* nextIndex = b.CreateAdd(index, one, "next.index");
-  
-  b.CreateStore(nextIndex, indexPtr);
-  
-  cond = b.CreateICmpULT(nextIndex, numThreads, "cond");
-  
-  BasicBlock* exitBlock = BasicBlock::Create(c, "preduce.queue.exit", parentFunc);
-  
-  b.CreateCondBr(cond, loopBlock, exitBlock);
+  const HLIRBuffer* buffer;
+  Value* rank;
+  Value* tag;
+  Value* future;
+  Value* handle = nullptr;
+  string funcName;
+
+  if(auto send = dynamic_cast<HLIRSend*>(c)){
+    buffer = &send->buffer();
+    rank = send->rank();
+    tag = send->tag();
+    future = send->future();
+    if(send->hasTeam()){
+      handle = send->team().handle();
+    }
+    funcName = future ? "isend" : "send";
+  }
+  else{
+    auto receive = static_cast<HLIRReceive*>(c);
+    buffer = &receive->buffer();
+    rank = receive->rank();
+    tag = receive->tag();
+    future = receive->future();
+    if(receive->hasTeam()){
+      handle = receive->team().handle();
+    }
+    funcName = future ? "ireceive" : "receive";
+  }
 
-  block = marker->getParent();
-  
-  BasicBlock* blockAfter = block->splitBasicBlock(*marker, "preduce.merge");
+  TypeVec params;
+  ValueVec args;
 
-  block->getTerminator()->removeFromParent();
-  
-  marker->removeFromParent();
-  
-  b.SetInsertPoint(exitBlock);
+  if(handle){
+    funcName = "__ares_comm_team_" + funcName;
+    params.push_back(voidPtrTy);
+    args.push_back(b.CreateBitCast(handle, voidPtrTy));
+  }
+  else{
+    funcName = "__ares_comm_" + funcName;
+  }
 
-  Function* awaitFunc = getFunction("__ares_await_synch", {voidPtrTy}, i1Ty);
+  params.insert(params.end(), {i32Ty, i32Ty, voidPtrTy, i64Ty});
 
-  b.CreateCall(awaitFunc, {synchPtr});
-  
-  b.CreateStore(b.CreateLoad(partialSumsPtr), r->reduceResult());
+  args.insert(args.end(),
+              {b.CreateSExtOrTrunc(rank, i32Ty),
+               b.CreateZExtOrTrunc(tag, i32Ty),
+               b.CreateBitCast(buffer->buffer(), voidPtrTy),
+               b.CreateZExtOrTrunc(buffer->size(), i64Ty)});
 
-  b.CreateCall(freeFunc, {partialSumsVoidPtr});
+  if(future){
+    params.push_back(voidPtrTy);
+    args.push_back(b.CreateBitCast(future, voidPtrTy));
+  }
 
-  b.CreateBr(blockAfter);
+  b.CreateCall(getFunction(funcName, params), args);
 
-//  func->getParent()->dump();
+  marker->eraseFromParent();
 }
 
-void HLIRModule::lowerTask_(HLIRTask* task){
-  auto& b = builder();
-  auto& c = context();
-
-  DataLayout layout(module_);
+Constant* HLIRModule::createRegionDesc_(HLIRConstruct* c,
+                                        const string& name,
+                                        uint32_t kind,
+                                        uint32_t stack){
+  auto itr = regionDescs_.find(c);
+  if(itr != regionDescs_.end()){
+    return itr->second;
+  }
 
-  Function* func = task->function();
-  Function* wrapperFunc = task->wrapperFunction();
+  auto createString = [&](const string& str){
+    Constant* cs = ConstantDataArray::getString(context_, str);
 
-  for(auto itr = func->use_begin(), itrEnd = func->use_end();
-    itr != itrEnd; ++itr){
-    if(CallInst* ci = dyn_cast<CallInst>(itr->getUser())){
-      BasicBlock* parentBlock = ci->getParent();
-      Function* parentFunc = parentBlock->getParent();
-      
-      if(parentFunc == wrapperFunc){
-        continue;
-      }
+    auto gv = new GlobalVariable(*module_, cs->getType(), true,
+                                 GlobalValue::PrivateLinkage, cs,
+                                 "region.str");
+    gv->setUnnamedAddr(true);
 
-      b.SetInsertPoint(ci);
+    return ConstantExpr::getBitCast(gv, voidPtrTy);
+  };
 
-      TypeVec fields;
-      fields.push_back(voidPtrTy);
-      fields.push_back(i32Ty);
-      fields.push_back(func->getReturnType());
+  int64_t line = c->line().hasValue() ? c->line().val() : 0;
 
-      for(auto pitr = func->arg_begin(), pitrEnd = func->arg_end();
-        pitr != pitrEnd; ++pitr){
-        fields.push_back(pitr->getType());
-      }
+  StructType* descType = 
+    StructType::get(context_, {voidPtrTy, voidPtrTy, i32Ty, i32Ty, i32Ty});
 
-      StructType* argsType = StructType::create(c, fields, "struct.func_args");
+  Constant* desc = 
+    ConstantStruct::get(descType, {createString(name),
+                                   createString(c->file()),
+                                   ConstantInt::get(i32Ty, line),
+                                   ConstantInt::get(i32Ty, kind),
+                                   ConstantInt::get(i32Ty, stack)});
 
-      size_t size = layout.getTypeAllocSize(argsType);
+  // the runtime tags the address in its low bit
+  auto gv = new GlobalVariable(*module_, descType, true,
+                               GlobalValue::PrivateLinkage, desc,
+                               "region.desc");
+  gv->setAlignment(8);
 
-      Function* allocFunc = getFunction("__ares_alloc", {i64Ty}, voidPtrTy);
+  Constant* ptr = ConstantExpr::getBitCast(gv, voidPtrTy);
+  regionDescs_[c] = ptr;
 
-      ValueVec args = {ConstantInt::get(i64Ty, size)};
+  return ptr;
+}
 
-      Value* argsVoidPtr = b.CreateCall(allocFunc, args, "args.void.ptr");
+void HLIRModule::nameRegionFunc_(HLIRConstruct* c, Function* f,
+                                 const string& prefix, bool body){
+  const string& file = c->file();
 
-      Value* argsPtr = 
-        b.CreateBitCast(argsVoidPtr, PointerType::get(argsType, 0), "args.ptr");
+  if(file.empty() || !c->line().hasValue()){
+    return;
+  }
 
-      Value* depth = b.CreateStructGEP(nullptr, argsPtr, 1, "depth.ptr");
-      depth = b.CreateLoad(depth, "depth");
+  // the file name without its directory or extension, as an identifier
+  string stem = file.substr(file.find_last_of('/') + 1);
+  stem = stem.substr(0, stem.find('.'));
 
-      size_t idx = 3;
-      for(auto& arg : ci->arg_operands()){
-        Value* argPtr = b.CreateStructGEP(nullptr, argsPtr, idx, "arg.ptr");
-        b.CreateStore(arg, argPtr);
-        ++idx;
-      }
+  for(char& ch : stem){
+    if(!isalnum(ch)){
+      ch = '_';
+    }
+  }
 
-      Function* queueFunc = 
-        getFunction("__ares_task_queue", {voidPtrTy, voidPtrTy});
+  unsigned line = c->line().val();
 
-      Value* funcVoidPtr = b.CreateBitCast(wrapperFunc, voidPtrTy, "funcVoidPtr");
+  // a suffix is added by LLVM to the second construct on a line
+  f->setName(prefix + "." + stem + "." + toStr(line));
 
-      args = {funcVoidPtr, argsVoidPtr};
-      b.CreateCall(queueFunc, args);
+  NamedMDNode* cus = module_->getNamedMetadata("llvm.dbg.cu");
 
-      for(auto itr = ci->use_begin(), itrEnd = ci->use_end();
-        itr != itrEnd; ++itr){
+  if(!body || !cus || cus->getNumOperands() == 0){
+    return;
+  }
 
-        if(Instruction* i = dyn_cast<Instruction>(itr->getUser())){
-          b.SetInsertPoint(i);
+  // the body is emitted with the locations of the function the construct
+  // is in, it is given a subprogram of its own so that debuggers and
+  // profilers see it as a function at the line of the construct
+  DIFile* df = nullptr;
 
-          BasicBlock* splitBlock = i->getParent();
-          BasicBlock* splitAfter = splitBlock->splitBasicBlock(i, "split.after");
+  for(BasicBlock& bi : *f){
+    for(Instruction& ii : bi){
+      if(DILocation* loc = ii.getDebugLoc()){
+        df = loc->getScope()->getFile();
+        break;
+      }
+    }
 
-          splitBlock->getTerminator()->removeFromParent();
+    if(df){
+      break;
+    }
+  }
 
-          b.SetInsertPoint(splitBlock);
+  if(!df){
+    return;
+  }
 
-#ifdef USE_ARGOBOTS
+  auto cu = cast<DICompileUnit>(cus->getOperand(0));
 
-          BasicBlock* loopBlock = BasicBlock::Create(c, "loop.block", parentFunc);
+  DIBuilder db(*module_);
 
-          b.CreateBr(loopBlock);
+  DISubroutineType* ft = 
+    db.createSubroutineType(df, db.getOrCreateTypeArray(None));
 
-          BasicBlock* mergeBlock = BasicBlock::Create(c, "merge.block", parentFunc);
-          BasicBlock* yieldBlock = BasicBlock::Create(c, "yield.block", parentFunc);
-          
-          b.SetInsertPoint(loopBlock);
+  DISubprogram* sp = 
+    db.createFunction(df, f->getName(), f->getName(), df, line, ft,
+                      true, true, line, DINode::FlagArtificial,
+                      cu->isOptimized(), f);
 
-          Function* awaitFunc = 
-            getFunction("__ares_task_try_await_future", {voidPtrTy}, i1Ty);
+  SmallVector<Metadata*, 16> sps;
+  for(DISubprogram* spi : cu->getSubprograms()){
+    sps.push_back(spi);
+  }
+  sps.push_back(sp);
+  cu->replaceSubprograms(MDTuple::get(context_, sps));
 
-          args = {argsVoidPtr};
-          Value* done = b.CreateCall(awaitFunc, args);
+  // the variables of the enclosing function are not in scope in the new
+  // subprogram, so their declarations are dropped from the body
+  vector<Instruction*> dbgs;
 
-          Value* cond = b.CreateICmpNE(done, ConstantInt::get(i1Ty, 0));
+  for(BasicBlock& bi : *f){
+    for(Instruction& ii : bi){
+      if(isa<DbgInfoIntrinsic>(ii)){
+        dbgs.push_back(&ii);
+      }
+      else if(DILocation* loc = ii.getDebugLoc()){
+        ii.setDebugLoc(DebugLoc::get(loc->getLine(), loc->getColumn(), sp));
+      }
+    }
+  }
 
-          b.CreateCondBr(cond, mergeBlock, yieldBlock);
+  for(Instruction* ii : dbgs){
+    ii->eraseFromParent();
+  }
+}
 
-          b.SetInsertPoint(yieldBlock);
+bool HLIRModule::lowerToIR_(bool deferTasks){
+  promoteLocals_();
 
-          Function* yieldFunc = getFunction("__ares_thread_yield", TypeVec());
-            
-          b.CreateCall(yieldFunc);
+  // the body each construct is emitted in, and the bodies in program
+  // order
+  unordered_map<Function*, HLIRConstruct*> bodyMap;
+  vector<Function*> bodies;
 
-          b.CreateBr(loopBlock);
+  vector<HLIRParallelReduce*> reduces;
+  vector<HLIRConstruct*> comms;
 
-          b.SetInsertPoint(mergeBlock);
-#else
-          Function* awaitFunc = 
-            getFunction("__ares_task_await_future", {voidPtrTy});
+  for(HLIRConstruct* c : constructs_){
+    if(auto pfor = dynamic_cast<HLIRParallelFor*>(c)){
+      bodyMap.emplace(pfor->body(), pfor);
+      bodies.push_back(pfor->body());
+    }
+    else if(auto r = dynamic_cast<HLIRParallelReduce*>(c)){
+      bodyMap.emplace(r->body(), r);
+      bodies.push_back(r->body());
+      reduces.push_back(r);
+    }
+    else if(dynamic_cast<HLIRSend*>(c) || dynamic_cast<HLIRReceive*>(c) ||
+            dynamic_cast<HLIRBarrier*>(c)){
+      comms.push_back(c);
+    }
+    else{
+      assert(false && "unknown HLIR construct");
+    }
+  }
 
-          args = {argsVoidPtr};
-          b.CreateCall(awaitFunc, args);
-#endif
-          Value* retPtr = b.CreateStructGEP(nullptr, argsPtr, 2, "retPtr");
-          Value* retVal = b.CreateLoad(retPtr, "retVal"); 
+  // the runtime calls are plain code by the time the bodies they are in
+  // are lowered
+  for(HLIRConstruct* c : comms){
+    Instruction* marker = c->marker();
+    removeConstruct_(marker);
+    lowerCommunication_(c);
+  }
 
-          ci->replaceAllUsesWith(retVal);
+  // reductions are lowered first and innermost first. Each one leaves
+  // behind plain code in the body that encloses it, which the lowering
+  // of that construct then captures like any other.
+  unordered_map<HLIRParallelReduce*, size_t> depth;
 
-          b.CreateBr(splitAfter);
-          b.SetInsertPoint(splitAfter);
+  for(HLIRParallelReduce* r : reduces){
+    size_t d = 0;
+    Function* f = r->marker()->getParent()->getParent();
 
-          break;
-        }
+    for(;;){
+      auto itr = bodyMap.find(f);
+      if(itr == bodyMap.end()){
+        break;
       }
 
-      ci->eraseFromParent();
+      ++d;
+      f = itr->second->marker()->getParent()->getParent();
+    }
 
-      //parentFunc->dump();
-    }    
+    depth[r] = d;
   }
-}
 
-bool HLIRModule::lowerToIR_(){
-  for(auto& itr : constructMap_){
-    HLIRConstruct* c = itr.second;
+  stable_sort(reduces.begin(), reduces.end(), 
+    [&](HLIRParallelReduce* a, HLIRParallelReduce* b){
+      return depth[a] > depth[b];
+    });
+
+  for(HLIRParallelReduce* r : reduces){
+    lowerParallelReduce_(r, depth[r] > 0);
+  }
+
+  collapseParallelFors_(bodyMap);
+  fuseParallelFors_(bodyMap);
+
+  for(HLIRConstruct* c : constructs_){
     if(auto pfor = dynamic_cast<HLIRParallelFor*>(c)){
       unordered_map<Value*, size_t> m;
       unordered_map<Value*, Value*> rm;
       lowerParallelFor_(pfor, nullptr, m, rm);
     }
-    else if(auto r = dynamic_cast<HLIRParallelReduce*>(c)){
-      lowerParallelReduce_(r);
+  }
+
+  if(deferTasks){
+    writeTaskMetadata_();
+  }
+  else{
+    set<CallInst*> inlineCalls;
+    findInlineTaskCalls_(inlineCalls);
+
+    for(HLIRTask* t : tasks_){
+      lowerTask_(t, inlineCalls);
+      setOutlinedAttrs(t->wrapperFunction());
     }
-    else{
-      assert(false && "unknown HLIR construct");
+  }
+
+  // the bodies that collapsing and fusing erased are gone from bodyMap
+  for(Function* f : bodies){
+    auto itr = bodyMap.find(f);
+    if(itr == bodyMap.end()){
+      continue;
     }
+
+    auto pfor = dynamic_cast<HLIRParallelFor*>(itr->second);
+    lowerScratch_(f, pfor && pfor->dims() == 1 ? pfor->exitBlock() : nullptr);
+
+    // the bodies are only called through the runtime from this module
+    f->setLinkage(GlobalValue::InternalLinkage);
+    setOutlinedAttrs(f);
   }
 
-  for(HLIRTask* t : tasks_){
-    lowerTask_(t);
+  for(Function* f : outlined_){
+    setOutlinedAttrs(f);
   }
+  outlined_.clear();
 
   //cerr << "---------- final module" << endl;
   //module_->dump();  
@@ -1017,74 +4578,296 @@ HLIRParallelFor::HLIRParallelFor(HLIRModule* module)
 
   Function* func =
     Function::Create(funcType,
-                     llvm::Function::ExternalLinkage,
+                     llvm::Function::InternalLinkage,
                      "hlir.parallel_for.body",
                      module_->module());
 
-  Function* finishFunc = 
-    module_->getFunction("__ares_finish_func", {module_->voidPtrTy});
-
   auto aitr = func->arg_begin();
   aitr->setName("args.ptr");
   Value* argsVoidPtr = aitr++;
     
   BasicBlock* entry = BasicBlock::Create(c, "entry", func);
   b.SetInsertPoint(entry);
-    
-  TypeVec fields = {module_->voidPtrTy, module_->i32Ty, module_->voidPtrTy};
-  StructType* argsType = StructType::create(c, fields, "struct.func_args");
+  
+  // the body is called once per range task and iterates over [begin, end)
+  TypeVec fields = {module_->i32Ty, module_->i32Ty, module_->voidPtrTy};
+  StructType* argsType = StructType::create(c, fields, "struct.range_args");
     
   Value* argsPtr = b.CreateBitCast(argsVoidPtr, llvm::PointerType::get(argsType, 0), "args.ptr");
 
-  Value* synchPtr = b.CreateStructGEP(argsType, argsPtr, 0);
-  synchPtr = b.CreateLoad(synchPtr, "synch.ptr");
+  Value* begin = b.CreateStructGEP(argsType, argsPtr, 0);
+  begin = b.CreateLoad(begin, "begin");
 
-  Value* indexPtr = b.CreateStructGEP(argsType, argsPtr, 1, "index.ptr");
+  Value* end = b.CreateStructGEP(argsType, argsPtr, 1);
+  end = b.CreateLoad(end, "end");
   
   Value* funcArgsPtr = b.CreateStructGEP(argsType, argsPtr, 2, "funcArgs.ptr");
   funcArgsPtr = b.CreateLoad(funcArgsPtr);
+
+  Value* indexPtr = b.CreateAlloca(module_->i32Ty, nullptr, "index.ptr");
    
   Instruction* placeholder = module_->createNoOp();
-  Instruction* insertion = module_->createNoOp();
 
+  b.CreateStore(begin, indexPtr);
+
+  BasicBlock* condBlock = BasicBlock::Create(c, "loop.cond", func);
+  BasicBlock* loopBlock = BasicBlock::Create(c, "loop.body", func);
   BasicBlock* exitBlock = BasicBlock::Create(c, "exit.block", func);
+  BasicBlock* retBlock = BasicBlock::Create(c, "loop.exit", func);
+
+  b.CreateBr(condBlock);
+
+  b.SetInsertPoint(condBlock);
+  Value* index = b.CreateLoad(indexPtr, "index");
+  b.CreateCondBr(b.CreateICmpULT(index, end), loopBlock, retBlock);
+
+  b.SetInsertPoint(loopBlock);
+  Instruction* insertion = module_->createNoOp();
+
+  // the body emitted by the frontend branches here at the end of each
+  // iteration
   b.SetInsertPoint(exitBlock);
+  index = b.CreateLoad(indexPtr);
+  b.CreateStore(b.CreateAdd(index, ConstantInt::get(module_->i32Ty, 1)),
+                indexPtr);
+  Instruction* latch = b.CreateBr(condBlock);
+  latch->setMetadata("llvm.loop", vectorizeLoopID(c));
+
+  b.SetInsertPoint(retBlock);
+  b.CreateRetVoid();
+
+  setBodyArgAttrs(func, argsType);
+
+  index_ = setField_("index", HLIRValue(indexPtr));
+  insertion_ = setField_("insertion", HLIRInstruction(insertion));
+  args_ = setField_("args", HLIRValue(funcArgsPtr));
+  argsInsertion_ =
+    setField_("argsInsertion", HLIRInstruction(placeholder));
+  exitBlock_ = setField_("exitBlock", HLIRBasicBlock(exitBlock));
+  extents_ = setField_("extents", HLIRVector());
+  (*this)["tiles"] = HLIRVector();
+  (*this)["completion"] = HLIRValue::nullValue();
+  (*this)["after"] = HLIRValue::nullValue();
+  (*this)["priority"] = HLIRValue::nullValue();
+  (*this)["schedule"] = HLIRValue::nullValue();
+  (*this)["chunk"] = HLIRValue::nullValue();
+  (*this)["simd"] = HLIRInteger(0);
+  pointers_ = setField_("pointers", HLIRVector());
+
+  body_ = setField_("body", HLIRFunction(func));
+}
+
+HLIRParallelFor::HLIRParallelFor(HLIRModule* module,
+                                 StructType* indexType,
+                                 const vector<Value*>& extents,
+                                 const vector<Value*>& tiles)
+  : HLIRConstruct(module){
+
+  auto& b = module_->builder();
+  auto& c = module_->context();
+
+  size_t dims = extents.size();
+
+  if(dims < 2 || tiles.size() != dims || 
+     indexType->getNumElements() != dims){
+    HLIR_ERROR("invalid tiled parallel for");
+  }
+    
+  TypeVec params = {module_->voidPtrTy};
+  
+  auto funcType = FunctionType::get(module_->voidTy, params, false);
+
+  Function* func =
+    Function::Create(funcType,
+                     llvm::Function::InternalLinkage,
+                     "hlir.parallel_for.body",
+                     module_->module());
+
+  auto aitr = func->arg_begin();
+  aitr->setName("args.ptr");
+  Value* argsVoidPtr = aitr++;
+    
+  BasicBlock* entry = BasicBlock::Create(c, "entry", func);
+  b.SetInsertPoint(entry);
+  
+  // the range is over tile indices, tiles are numbered with the first
+  // dimension moving fastest
+  TypeVec fields = {module_->i32Ty, module_->i32Ty, module_->voidPtrTy};
+  StructType* argsType = StructType::create(c, fields, "struct.range_args");
+    
+  Value* argsPtr = b.CreateBitCast(argsVoidPtr, llvm::PointerType::get(argsType, 0), "args.ptr");
+
+  Value* begin = b.CreateStructGEP(argsType, argsPtr, 0);
+  begin = b.CreateLoad(begin, "begin");
+
+  Value* end = b.CreateStructGEP(argsType, argsPtr, 1);
+  end = b.CreateLoad(end, "end");
+  
+  Value* funcArgsPtr = b.CreateStructGEP(argsType, argsPtr, 2, "funcArgs.ptr");
+  funcArgsPtr = b.CreateLoad(funcArgsPtr);
+
+  Value* indexPtr = b.CreateAlloca(indexType, nullptr, "index.ptr");
+  Value* tilePtr = b.CreateAlloca(module_->i32Ty, nullptr, "tile.ptr");
+   
+  Instruction* placeholder = module_->createNoOp();
+
+  Value* one = ConstantInt::get(module_->i32Ty, 1);
+
+  // the extents and tile sizes are values of the enclosing function,
+  // which are captured like any other
+  vector<Value*> counts;
+  for(size_t k = 0; k + 1 < dims; ++k){
+    counts.push_back(
+      b.CreateUDiv(b.CreateAdd(extents[k], b.CreateSub(tiles[k], one)),
+                   tiles[k], "tile.count"));
+  }
+
+  vector<Value*> indexPtrs;
+  for(size_t k = 0; k < dims; ++k){
+    indexPtrs.push_back(b.CreateStructGEP(indexType, indexPtr, k));
+  }
+
+  b.CreateStore(begin, tilePtr);
+
+  BasicBlock* tileCondBlock = BasicBlock::Create(c, "tile.cond", func);
+  BasicBlock* tileBlock = BasicBlock::Create(c, "tile.body", func);
+  BasicBlock* tileNextBlock = BasicBlock::Create(c, "tile.next", func);
+  BasicBlock* retBlock = BasicBlock::Create(c, "loop.exit", func);
+
+  b.CreateBr(tileCondBlock);
+
+  b.SetInsertPoint(tileCondBlock);
+  Value* tile = b.CreateLoad(tilePtr, "tile");
+  b.CreateCondBr(b.CreateICmpULT(tile, end), tileBlock, retBlock);
+
+  // the bounds of the tile are computed once, the loops over it then
+  // only increment their index
+  b.SetInsertPoint(tileBlock);
+
+  vector<Value*> lo;
+  vector<Value*> hi;
+
+  Value* rest = tile;
+  for(size_t k = 0; k < dims; ++k){
+    Value* tk = rest;
+
+    if(k + 1 < dims){
+      tk = b.CreateURem(rest, counts[k]);
+      rest = b.CreateUDiv(rest, counts[k]);
+    }
+
+    Value* l = b.CreateMul(tk, tiles[k], "tile.begin");
+    Value* remaining = b.CreateSub(extents[k], l);
+    Value* size = 
+      b.CreateSelect(b.CreateICmpULT(remaining, tiles[k]), remaining, tiles[k]);
+
+    lo.push_back(l);
+    hi.push_back(b.CreateAdd(l, size, "tile.end"));
+  }
+
+  // one loop per dimension, the first is innermost so that a tile is
+  // walked in row-major order
+  vector<BasicBlock*> condBlocks(dims);
+  vector<BasicBlock*> enterBlocks(dims);
+  vector<BasicBlock*> nextBlocks(dims);
+
+  for(size_t k = 0; k < dims; ++k){
+    condBlocks[k] = BasicBlock::Create(c, "loop.cond", func);
+    enterBlocks[k] = BasicBlock::Create(c, "loop.enter", func);
+    nextBlocks[k] = BasicBlock::Create(c, k == 0 ? "exit.block" : "loop.next",
+                                       func);
+  }
+
+  BasicBlock* loopBlock = BasicBlock::Create(c, "loop.body", func);
+
+  b.CreateBr(enterBlocks[dims - 1]);
+
+  for(size_t k = 0; k < dims; ++k){
+    Value* ik = indexPtrs[k];
+
+    b.SetInsertPoint(enterBlocks[k]);
+    b.CreateStore(lo[k], ik);
+    b.CreateBr(condBlocks[k]);
+
+    b.SetInsertPoint(condBlocks[k]);
+    Value* index = b.CreateLoad(ik, "index");
+    b.CreateCondBr(b.CreateICmpULT(index, hi[k]),
+                   k == 0 ? loopBlock : enterBlocks[k - 1],
+                   k + 1 == dims ? tileNextBlock : nextBlocks[k + 1]);
+
+    // the body emitted by the frontend branches to the first of these
+    // at the end of each iteration
+    b.SetInsertPoint(nextBlocks[k]);
+    index = b.CreateLoad(ik);
+    b.CreateStore(b.CreateAdd(index, one), ik);
+    Instruction* latch = b.CreateBr(condBlocks[k]);
+
+    if(k == 0){
+      latch->setMetadata("llvm.loop", vectorizeLoopID(c));
+    }
+  }
 
-  Value* synchVoidPtr = b.CreateBitCast(synchPtr, module_->voidPtrTy);
+  b.SetInsertPoint(loopBlock);
+  Instruction* insertion = module_->createNoOp();
 
-  b.CreateCall(finishFunc, {argsVoidPtr});
+  b.SetInsertPoint(tileNextBlock);
+  b.CreateStore(b.CreateAdd(tile, one), tilePtr);
+  b.CreateBr(tileCondBlock);
 
+  b.SetInsertPoint(retBlock);
   b.CreateRetVoid();
 
-  (*this)["index"] = HLIRValue(indexPtr);
-  (*this)["insertion"] = HLIRInstruction(insertion); 
-  (*this)["args"] = HLIRValue(funcArgsPtr);
-  (*this)["argsInsertion"] = HLIRInstruction(placeholder); 
-  (*this)["exitBlock"] = HLIRBasicBlock(exitBlock); 
+  setBodyArgAttrs(func, argsType);
 
-  HLIRFunction f(func);
-  (*this)["body"] = f;  
+  HLIRVector ev;
+  HLIRVector tv;
+
+  for(size_t k = 0; k < dims; ++k){
+    ev << HLIRValue(extents[k]);
+    tv << HLIRValue(tiles[k]);
+  }
+
+  index_ = setField_("index", HLIRValue(indexPtr));
+  insertion_ = setField_("insertion", HLIRInstruction(insertion));
+  args_ = setField_("args", HLIRValue(funcArgsPtr));
+  argsInsertion_ =
+    setField_("argsInsertion", HLIRInstruction(placeholder));
+  exitBlock_ = setField_("exitBlock", HLIRBasicBlock(nextBlocks[0]));
+  extents_ = setField_("extents", ev);
+  (*this)["tiles"] = tv;
+  (*this)["completion"] = HLIRValue::nullValue();
+  (*this)["after"] = HLIRValue::nullValue();
+  (*this)["priority"] = HLIRValue::nullValue();
+  (*this)["schedule"] = HLIRValue::nullValue();
+  (*this)["chunk"] = HLIRValue::nullValue();
+  (*this)["simd"] = HLIRInteger(0);
+  pointers_ = setField_("pointers", HLIRVector());
+
+  body_ = setField_("body", HLIRFunction(func));
 }
 
 HLIRFunction& HLIRParallelFor::body(){
-  return get<HLIRFunction>("body");
+  return *body_;
 }
 
 HLIRParallelReduce::HLIRParallelReduce(HLIRModule* module,
-  const HLIRType& reduceType)
+  const vector<Type*>& varTypes)
   : HLIRConstruct(module){
 
   auto& b = module_->builder();
   auto& c = module_->context();
+
+  StructType* reduceType = 
+    StructType::create(c, varTypes, "struct.reduce_partials");
     
   TypeVec params = 
-  {module_->voidPtrTy, PointerType::get(reduceType, 0), module_->i32Ty};
+  {module_->voidPtrTy, PointerType::get(reduceType, 0), module_->i64Ty};
   
   auto funcType = FunctionType::get(module_->voidTy, params, false);
 
   Function* func =
     Function::Create(funcType,
-                     llvm::Function::ExternalLinkage,
+                     llvm::Function::InternalLinkage,
                      "hlir.parallel_reduce.body",
                      module_->module());
 
@@ -1093,14 +4876,30 @@ HLIRParallelReduce::HLIRParallelReduce(HLIRModule* module,
   aitr->setName("args.ptr");
   Value* argsVoidPtr = aitr++;
 
+  // the partials of the chunk that the caller accumulates
   aitr->setName("partial.ptr");
   Value* partial = aitr++;
+  func->setDoesNotAlias(2);
 
   aitr->setName("index");
   Value* index = aitr++;
     
   BasicBlock* entry = BasicBlock::Create(c, "entry", func);
   b.SetInsertPoint(entry);
+
+  HLIRVector vars;
+  HLIRVector ops;
+  HLIRVector sign;
+
+  for(size_t i = 0; i < varTypes.size(); ++i){
+    vars << HLIRValue(b.CreateStructGEP(reduceType, partial, i, "partial"));
+    ops << int64_t(Sum);
+    sign << HLIRBoolean(true);
+  }
+
+  // the body addresses the loop variable through memory
+  Value* indexPtr = b.CreateAlloca(module_->i64Ty, nullptr, "index.ptr");
+  b.CreateStore(index, indexPtr);
       
   Instruction* entryPlaceholder = module_->createNoOp();
 
@@ -1110,27 +4909,42 @@ HLIRParallelReduce::HLIRParallelReduce(HLIRModule* module,
 
   Instruction* ret = ReturnInst::Create(c, entry);
 
-  (*this)["entry"] = HLIRInstruction(entryPlaceholder);
-  (*this)["index"] = HLIRValue(index);
-  (*this)["insertion"] = HLIRInstruction(insertionPlaceholder); 
-  (*this)["args"] = HLIRValue(argsVoidPtr);
-  (*this)["argsInsertion"] = HLIRInstruction(argsPlaceholder); 
-  (*this)["reduceVar"] = HLIRValue(partial);
-  (*this)["reduceType"] = reduceType;
-
-  HLIRFunction f(func);
-  (*this)["body"] = f;  
+  entry_ = setField_("entry", HLIRInstruction(entryPlaceholder));
+  index_ = setField_("index", HLIRValue(indexPtr));
+  insertion_ =
+    setField_("insertion", HLIRInstruction(insertionPlaceholder));
+  args_ = setField_("args", HLIRValue(argsVoidPtr));
+  argsInsertion_ =
+    setField_("argsInsertion", HLIRInstruction(argsPlaceholder));
+  reduceType_ = setField_("reduceType", HLIRType(reduceType));
+  reduceVars_ = setField_("reduceVars", vars);
+  (*this)["reduceResults"] = HLIRVector();
+  (*this)["ops"] = ops;
+  (*this)["signed"] = sign;
+  (*this)["combiner"] = HLIRFunction::nullValue();
+  (*this)["atomicTargets"] = HLIRVector();
+  (*this)["atomicOps"] = HLIRVector();
+  (*this)["atomicSigned"] = HLIRVector();
+
+  body_ = setField_("body", HLIRFunction(func));
 }
 
 HLIRFunction& HLIRParallelReduce::body(){
-  return get<HLIRFunction>("body");
+  return *body_;
+}
+
+HLIRParallelScan::HLIRParallelScan(HLIRModule* module, Type* varType)
+  : HLIRParallelReduce(module, {varType}){
+
+  (*this)["exclusive"] = HLIRBoolean(false);
+  (*this)["output"] = HLIRValue::nullValue();
 }
 
 void HLIRTask::setFunction(const HLIRFunction& func){
   auto& b = module_->builder();
   auto& c = module_->context();
 
-  (*this)["function"] = func;
+  function_ = setField_("function", func);
 
   TypeVec params = {module_->voidPtrTy};
 
@@ -1138,7 +4952,7 @@ void HLIRTask::setFunction(const HLIRFunction& func){
 
   Function* wrapperFunc =
     Function::Create(funcType,
-                     llvm::Function::ExternalLinkage,
+                     llvm::Function::InternalLinkage,
                      "hlir.task_wrapper",
                      module_->module());
 
@@ -1149,10 +4963,15 @@ void HLIRTask::setFunction(const HLIRFunction& func){
   BasicBlock* entry = BasicBlock::Create(c, "entry", wrapperFunc);
   b.SetInsertPoint(entry);
 
+  // the result is stored through a pointer the caller set, null when it
+  // is not used, a void task's is an unused i8*
+  Type* retType = func->getReturnType();
+
   TypeVec fields;
   fields.push_back(module_->voidPtrTy);
   fields.push_back(module_->i32Ty);
-  fields.push_back(func->getReturnType());
+  fields.push_back(
+    PointerType::get(retType->isVoidTy() ? module_->i8Ty : retType, 0));
 
   for(auto pitr = func->arg_begin(), pitrEnd = func->arg_end();
     pitr != pitrEnd; ++pitr){
@@ -1174,9 +4993,25 @@ void HLIRTask::setFunction(const HLIRFunction& func){
     ++idx;
   }
 
-  Value* ret = b.CreateCall(func, args, "ret");
-  Value* retPtr = b.CreateStructGEP(nullptr, argsPtr, 2, "retPtr");
-  b.CreateStore(ret, retPtr);
+  if(retType->isVoidTy()){
+    b.CreateCall(func, args);
+  }
+  else{
+    Value* ret = b.CreateCall(func, args, "ret");
+    Value* retPtr = 
+      b.CreateLoad(b.CreateStructGEP(nullptr, argsPtr, 2), "retPtr");
+
+    BasicBlock* storeBlock = BasicBlock::Create(c, "store", wrapperFunc);
+    BasicBlock* releaseBlock = BasicBlock::Create(c, "release", wrapperFunc);
+
+    b.CreateCondBr(b.CreateIsNotNull(retPtr), storeBlock, releaseBlock);
+
+    b.SetInsertPoint(storeBlock);
+    b.CreateStore(ret, retPtr);
+    b.CreateBr(releaseBlock);
+
+    b.SetInsertPoint(releaseBlock);
+  }
 
   Function* releaseFunc = 
     module_->getFunction("__ares_task_release_future", {module_->voidPtrTy});
@@ -1186,5 +5021,6 @@ void HLIRTask::setFunction(const HLIRFunction& func){
 
   b.CreateRetVoid();
 
-  (*this)["wrapperFunction"] = HLIRFunction(wrapperFunc);
+  wrapperFunction_ =
+    setField_("wrapperFunction", HLIRFunction(wrapperFunc));
 }
@@ -0,0 +1,400 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_ALGORITHM_H__
+#define __ARES_ALGORITHM_H__
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ares/parallel.h"
+
+ namespace ares{
+
+   // parallel versions of the algorithms of <algorithm> over random
+   // access ranges, run on the pool of the runtime through parallel_for()
+   // and parallel_reduce(), so that they share its workers with the
+   // Foralls rather than starting a pool of their own. Ranges of fewer
+   // than ALGORITHM_SERIAL elements run the std:: algorithm, ranges of
+   // 2^32 elements or more are not supported. The callables must not
+   // throw.
+
+   const size_t ALGORITHM_SERIAL = 1 << 14;
+
+   namespace detail{
+
+     // the blocks that a range is cut into, a few per worker, each of at
+     // least ALGORITHM_SERIAL/4 elements so that a block's counters and
+     // writes stay local to its worker's cache
+     inline uint32_t numBlocks(size_t n){
+       size_t perWorker = ares_num_workers() * 4;
+       size_t blocks = n/(ALGORITHM_SERIAL/4);
+       blocks = blocks < perWorker ? blocks : perWorker;
+       return uint32_t(blocks > 0 ? blocks : 1);
+     }
+
+     inline size_t blockBegin(size_t n, uint32_t numBlocks, uint32_t b){
+       return n * b / numBlocks;
+     }
+
+     // uninitialized storage for n T, of which those up to the size
+     // given to resize() are constructed by the phases that write them
+     template<typename T>
+     class Buffer{
+     public:
+       Buffer(size_t n)
+       : data_(static_cast<T*>(::operator new(n * sizeof(T)))),
+       size_(n){}
+
+       ~Buffer(){
+         if(!std::is_trivially_destructible<T>::value){
+           T* d = data_;
+           parallel_for(0, uint32_t(size_), [&](uint32_t i){
+             d[i].~T();
+           });
+         }
+
+         ::operator delete(data_);
+       }
+
+       Buffer(const Buffer&) = delete;
+
+       Buffer& operator=(const Buffer&) = delete;
+
+       T* data(){
+         return data_;
+       }
+
+       void resize(size_t n){
+         size_ = n;
+       }
+
+     private:
+       T* data_;
+       size_t size_;
+     };
+
+     // moves the elements of first for which keep(i) holds to out, in
+     // order, each block counting them then writing its own at the sum
+     // of the counts before it, and returns how many there were
+     template<typename RandomIt, typename K, typename OutputAt>
+     size_t compact(RandomIt first, size_t n, K&& keep, OutputAt&& out){
+       uint32_t nb = numBlocks(n);
+       std::vector<size_t> offsets(nb + 1, 0);
+
+       parallel_for(0, nb, [&](uint32_t b){
+         size_t count = 0;
+         for(size_t i = blockBegin(n, nb, b);
+             i < blockBegin(n, nb, b + 1); ++i){
+           count += keep(i) ? 1 : 0;
+         }
+         offsets[b + 1] = count;
+       });
+
+       for(uint32_t b = 0; b < nb; ++b){
+         offsets[b + 1] += offsets[b];
+       }
+
+       parallel_for(0, nb, [&](uint32_t b){
+         size_t k = offsets[b];
+         for(size_t i = blockBegin(n, nb, b);
+             i < blockBegin(n, nb, b + 1); ++i){
+           if(keep(i)){
+             out(k++, first[i]);
+           }
+         }
+       });
+
+       return offsets[nb];
+     }
+
+   } // end namespace detail
+
+   // reduce(init, transform(x)...) over [first, last), with reduce
+   // associative and commutative
+   template<typename RandomIt, typename T, typename R, typename U>
+   T parallel_transform_reduce(RandomIt first, RandomIt last, T init,
+                               R&& reduce, U&& transform){
+     size_t n = last - first;
+
+     if(n < ALGORITHM_SERIAL){
+       for(; first != last; ++first){
+         init = reduce(init, transform(*first));
+       }
+       return init;
+     }
+
+     // the identity is not known, so each block starts from its first
+     uint32_t nb = detail::numBlocks(n);
+     std::vector<T> partials(nb, init);
+
+     parallel_for(0, nb, [&](uint32_t b){
+       size_t i = detail::blockBegin(n, nb, b);
+       size_t end = detail::blockBegin(n, nb, b + 1);
+
+       T r = transform(first[i]);
+       for(++i; i < end; ++i){
+         r = reduce(r, transform(first[i]));
+       }
+       partials[b] = r;
+     }, schedule::static_());
+
+     for(const T& p : partials){
+       init = reduce(init, p);
+     }
+
+     return init;
+   }
+
+   template<typename RandomIt, typename T>
+   T parallel_transform_reduce(RandomIt first, RandomIt last, T init){
+     return parallel_transform_reduce(first, last, init, std::plus<T>(),
+       [](const typename std::iterator_traits<RandomIt>::value_type& x){
+         return x;
+       });
+   }
+
+   // copies the elements for which pred holds to out, in order, and
+   // returns the end of what it wrote
+   template<typename RandomIt, typename OutputIt, typename P>
+   OutputIt parallel_copy_if(RandomIt first, RandomIt last, OutputIt out,
+                             P&& pred){
+     size_t n = last - first;
+
+     if(n < ALGORITHM_SERIAL){
+       return std::copy_if(first, last, out, pred);
+     }
+
+     size_t count = detail::compact(first, n,
+       [&](size_t i){ return pred(first[i]); },
+       [&](size_t k, const typename std::iterator_traits<RandomIt>::
+           value_type& x){ out[k] = x; });
+
+     return out + count;
+   }
+
+   // moves the elements for which pred holds ahead of the others, both
+   // in their order, and returns the first of the others
+   template<typename RandomIt, typename P>
+   RandomIt parallel_stable_partition(RandomIt first, RandomIt last,
+                                      P&& pred){
+     using T = typename std::iterator_traits<RandomIt>::value_type;
+
+     size_t n = last - first;
+
+     if(n < ALGORITHM_SERIAL){
+       return std::stable_partition(first, last, pred);
+     }
+
+     // the predicate is evaluated once per element
+     std::vector<char> flags(n);
+     parallel_for(0, uint32_t(n), [&](uint32_t i){
+       flags[i] = pred(first[i]) ? 1 : 0;
+     }, schedule::static_());
+
+     detail::Buffer<T> tmp(n);
+     T* t = tmp.data();
+
+     size_t head = detail::compact(first, n,
+       [&](size_t i){ return flags[i] != 0; },
+       [&](size_t k, T& x){ new (t + k) T(std::move(x)); });
+
+     detail::compact(first, n,
+       [&](size_t i){ return flags[i] == 0; },
+       [&](size_t k, T& x){ new (t + head + k) T(std::move(x)); });
+
+     parallel_for(0, uint32_t(n), [&](uint32_t i){
+       first[i] = std::move(t[i]);
+     }, schedule::static_());
+
+     return first + head;
+   }
+
+   // keeps the first of each run of elements equal by eq, moving them to
+   // the front, and returns the end of those kept
+   template<typename RandomIt, typename E>
+   RandomIt parallel_unique(RandomIt first, RandomIt last, E&& eq){
+     using T = typename std::iterator_traits<RandomIt>::value_type;
+
+     size_t n = last - first;
+
+     if(n < ALGORITHM_SERIAL){
+       return std::unique(first, last, eq);
+     }
+
+     std::vector<char> keep(n);
+     parallel_for(0, uint32_t(n), [&](uint32_t i){
+       keep[i] = i == 0 || !eq(first[i - 1], first[i]) ? 1 : 0;
+     }, schedule::static_());
+
+     detail::Buffer<T> tmp(n);
+     T* t = tmp.data();
+
+     size_t count = detail::compact(first, n,
+       [&](size_t i){ return keep[i] != 0; },
+       [&](size_t k, T& x){ new (t + k) T(std::move(x)); });
+
+     tmp.resize(count);
+
+     parallel_for(0, uint32_t(count), [&](uint32_t i){
+       first[i] = std::move(t[i]);
+     }, schedule::static_());
+
+     return first + count;
+   }
+
+   template<typename RandomIt>
+   RandomIt parallel_unique(RandomIt first, RandomIt last){
+     return parallel_unique(first, last, std::equal_to<
+       typename std::iterator_traits<RandomIt>::value_type>());
+   }
+
+   // sorts by comp, not stably, with a sample sort: splitters taken from
+   // a sorted sample cut the range into about as many buckets as
+   // blocks, each block counts and scatters its elements to the buckets,
+   // then the buckets are sorted at once and moved back
+   template<typename RandomIt, typename C>
+   void parallel_sort(RandomIt first, RandomIt last, C&& comp){
+     using T = typename std::iterator_traits<RandomIt>::value_type;
+
+     size_t n = last - first;
+     uint32_t nb = detail::numBlocks(n);
+
+     if(n < ALGORITHM_SERIAL || nb < 2){
+       std::sort(first, last, comp);
+       return;
+     }
+
+     // an oversampled, evenly spaced sample, so that buckets are within a
+     // small factor of n / nb
+     const size_t OVERSAMPLE = 32;
+
+     size_t numSamples = nb * OVERSAMPLE;
+     std::vector<T> sample;
+     sample.reserve(numSamples);
+     for(size_t k = 0; k < numSamples; ++k){
+       sample.push_back(first[(k * n + n/2)/numSamples]);
+     }
+     std::sort(sample.begin(), sample.end(), comp);
+
+     std::vector<T> splitters;
+     splitters.reserve(nb - 1);
+     for(uint32_t b = 1; b < nb; ++b){
+       splitters.push_back(sample[b * OVERSAMPLE]);
+     }
+
+     // the bucket of each element, and counts[b * nb + k] of block b in
+     // bucket k
+     std::vector<uint32_t> bucket(n);
+     std::vector<size_t> counts(size_t(nb) * nb, 0);
+
+     parallel_for(0, nb, [&](uint32_t b){
+       size_t* c = &counts[size_t(b) * nb];
+       for(size_t i = detail::blockBegin(n, nb, b);
+           i < detail::blockBegin(n, nb, b + 1); ++i){
+         uint32_t k = uint32_t(std::upper_bound(splitters.begin(),
+                                                splitters.end(), first[i],
+                                                comp) - splitters.begin());
+         bucket[i] = k;
+         ++c[k];
+       }
+     }, schedule::static_());
+
+     // bucket major, so that each bucket is contiguous
+     std::vector<size_t> offsets(size_t(nb) * nb);
+     std::vector<size_t> bucketBegin(nb + 1);
+
+     size_t pos = 0;
+     for(uint32_t k = 0; k < nb; ++k){
+       bucketBegin[k] = pos;
+       for(uint32_t b = 0; b < nb; ++b){
+         offsets[size_t(b) * nb + k] = pos;
+         pos += counts[size_t(b) * nb + k];
+       }
+     }
+     bucketBegin[nb] = pos;
+
+     detail::Buffer<T> tmp(n);
+     T* t = tmp.data();
+
+     parallel_for(0, nb, [&](uint32_t b){
+       size_t* o = &offsets[size_t(b) * nb];
+       for(size_t i = detail::blockBegin(n, nb, b);
+           i < detail::blockBegin(n, nb, b + 1); ++i){
+         new (t + o[bucket[i]]++) T(std::move(first[i]));
+       }
+     }, schedule::static_());
+
+     // buckets vary in size, so they are taken dynamically
+     parallel_for(0, nb, [&](uint32_t k){
+       T* begin = t + bucketBegin[k];
+       T* end = t + bucketBegin[k + 1];
+       std::sort(begin, end, comp);
+       std::move(begin, end, first + bucketBegin[k]);
+     }, schedule::dynamic(1));
+   }
+
+   template<typename RandomIt>
+   void parallel_sort(RandomIt first, RandomIt last){
+     parallel_sort(first, last, std::less<
+       typename std::iterator_traits<RandomIt>::value_type>());
+   }
+
+ } // namespace ares
+
+#endif // __ARES_ALGORITHM_H__
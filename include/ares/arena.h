@@ -0,0 +1,127 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+
+#ifndef __ARES_ARENA_H__
+#define __ARES_ARENA_H__
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "ares/frontend.h"
+#include "ares/runtime.h"
+
+ namespace ares{
+
+   // an isolated scheduling domain, as TBB's task_arena, for a library
+   // whose short loops must not wait behind the long tasks of another.
+   // Each name stands for one arena with a pool of its own of up to
+   // max_concurrency() workers, created by the first task_arena of that
+   // name. Work only crosses into it through execute() and enqueue(),
+   // and what its workers spawn stays in it. An idle arena's workers
+   // sleep, leaving their cores to the other arenas.
+   class task_arena{
+   public:
+     explicit task_arena(const std::string& name, size_t maxConcurrency=0,
+                         Priority priority=Priority::Normal)
+     : arena_(ares_arena(name, maxConcurrency,
+                         static_cast<uint32_t>(priority))){}
+
+     size_t max_concurrency() const{
+       return ares_arena_max_concurrency(arena_);
+     }
+
+     // calls f() on the calling thread, whose Foralls, reductions and
+     // tasks meanwhile run on the arena's workers, and returns its result
+     template<typename F>
+     auto execute(F&& f) -> decltype(f()){
+       Scope_ scope(arena_);
+       return f();
+     }
+
+     // runs f() on one of the arena's workers without waiting for it. It
+     // must not throw.
+     template<typename F>
+     void enqueue(F&& f, Priority priority=Priority::Normal){
+       auto g = new std::function<void()>(std::forward<F>(f));
+       ares_arena_enqueue(arena_, &run_, g, static_cast<uint32_t>(priority));
+     }
+
+   private:
+     // leaves the arena on the way out of execute(), also by an exception
+     class Scope_{
+     public:
+       Scope_(void* arena)
+       : prev_(ares_arena_enter(arena)){}
+
+       ~Scope_(){
+         ares_arena_enter(prev_);
+       }
+
+     private:
+       void* prev_;
+     };
+
+     static void run_(void* arg){
+       auto g = static_cast<std::function<void()>*>(arg);
+       (*g)();
+       delete g;
+     }
+
+     void* arena_;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_ARENA_H__
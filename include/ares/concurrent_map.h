@@ -0,0 +1,444 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_CONCURRENT_MAP_H__
+#define __ARES_CONCURRENT_MAP_H__
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+extern "C"{
+  void* __ares_alloc_aligned(uint64_t bytes, uint64_t align);
+  void __ares_free(void* ptr);
+}
+
+ namespace ares{
+
+   namespace detail{
+
+     // a std allocator over the runtime's thread caching allocator
+     template<typename T>
+     struct RuntimeAllocator{
+       using value_type = T;
+
+       RuntimeAllocator() = default;
+
+       template<typename U>
+       RuntimeAllocator(const RuntimeAllocator<U>&){}
+
+       T* allocate(size_t n){
+         return static_cast<T*>(__ares_alloc_aligned(n * sizeof(T),
+                                                     alignof(T)));
+       }
+
+       void deallocate(T* p, size_t){
+         __ares_free(p);
+       }
+
+       template<typename U>
+       bool operator==(const RuntimeAllocator<U>&) const{
+         return true;
+       }
+
+       template<typename U>
+       bool operator!=(const RuntimeAllocator<U>&) const{
+         return false;
+       }
+     };
+
+   } // end namespace detail
+
+   // a hash map that parallel bodies insert into and look up at once.
+   // The buckets are a fixed power of two, each a list of nodes linked
+   // through atomic pointers, so find() is lock-free and insert() pushes
+   // a node onto its bucket with one compare and swap. Nodes are only
+   // removed by clear() and the destructor, which must not run
+   // concurrently with anything else, so a node that a pointer was
+   // returned to stays valid. Nodes come from the runtime's thread caching
+   // allocator.
+   //
+   // A buffer gathers the inserts of one worker, combining those of the
+   // same key, and merge() adds them a bucket at a time, linking the
+   // nodes a bucket needs with one compare and swap and combining into
+   // the values already there under a striped lock. Values that merges
+   // combine into must not be read until the merges are done.
+   template<typename K, typename V, typename Hash=std::hash<K>,
+            typename Eq=std::equal_to<K>>
+   class concurrent_map{
+   private:
+     struct Node;
+
+   public:
+     class buffer{
+     public:
+       buffer(size_t capacity=4096)
+       : capacity_(capacity){
+         entries_.reserve(capacity);
+       }
+
+       void insert(const K& key, const V& value){
+         entries_.push_back(Entry{Hash()(key), key, value});
+       }
+
+       // true once the buffer should be merged
+       bool full() const{
+         return entries_.size() >= capacity_;
+       }
+
+       size_t size() const{
+         return entries_.size();
+       }
+
+       bool empty() const{
+         return entries_.empty();
+       }
+
+       void clear(){
+         entries_.clear();
+       }
+
+     private:
+       friend class concurrent_map;
+
+       struct Entry{
+         size_t hash;
+         K key;
+         V value;
+       };
+
+       size_t capacity_;
+       std::vector<Entry, detail::RuntimeAllocator<Entry>> entries_;
+     };
+
+     explicit concurrent_map(size_t buckets=1 << 16)
+     : shift_(64),
+     size_(0){
+       size_t n = 1;
+       while(n < buckets){
+         n <<= 1;
+         --shift_;
+       }
+
+       numBuckets_ = n;
+       buckets_.reset(new std::atomic<Node*>[n]);
+       for(size_t i = 0; i < n; ++i){
+         buckets_[i].store(nullptr, std::memory_order_relaxed);
+       }
+
+       for(auto& s : stripes_){
+         s.store(false, std::memory_order_relaxed);
+       }
+     }
+
+     ~concurrent_map(){
+       clear();
+     }
+
+     concurrent_map(const concurrent_map&) = delete;
+
+     concurrent_map& operator=(const concurrent_map&) = delete;
+
+     // the value of key, or null if it has not been inserted
+     V* find(const K& key) const{
+       size_t h = Hash()(key);
+       return value_(find_(buckets_[bucket_(h)].load(
+         std::memory_order_acquire), nullptr, h, key));
+     }
+
+     bool contains(const K& key) const{
+       return find(key) != nullptr;
+     }
+
+     // the value of key and true if this inserted it, or the value
+     // already there and false
+     std::pair<V*, bool> insert(const K& key, const V& value){
+       size_t h = Hash()(key);
+       std::atomic<Node*>& head = buckets_[bucket_(h)];
+
+       Node* first = head.load(std::memory_order_acquire);
+       if(Node* n = find_(first, nullptr, h, key)){
+         return {&n->value, false};
+       }
+
+       Node* node = newNode_(h, key, value);
+
+       for(;;){
+         node->next.store(first, std::memory_order_relaxed);
+         Node* seen = first;
+
+         if(head.compare_exchange_weak(first, node,
+                                       std::memory_order_release,
+                                       std::memory_order_acquire)){
+           size_.fetch_add(1, std::memory_order_relaxed);
+           return {&node->value, true};
+         }
+
+         // only the nodes pushed since need to be searched
+         if(Node* n = find_(first, seen, h, key)){
+           deleteNode_(node);
+           return {&n->value, false};
+         }
+       }
+     }
+
+     // merges the entries of b, with combine(V& value, const V& other)
+     // applied to those of a key already here and to those of the same
+     // key in b, then clears it
+     template<typename C>
+     void merge(buffer& b, C&& combine){
+       auto& e = b.entries_;
+
+       std::sort(e.begin(), e.end(),
+                 [&](const typename buffer::Entry& x,
+                     const typename buffer::Entry& y){
+                   return bucket_(x.hash) < bucket_(y.hash);
+                 });
+
+       for(size_t i = 0; i < e.size();){
+         size_t bucket = bucket_(e[i].hash);
+         size_t end = i;
+         while(end < e.size() && bucket_(e[end].hash) == bucket){
+           ++end;
+         }
+
+         mergeBucket_(bucket, &e[i], &e[end], combine);
+         i = end;
+       }
+
+       b.clear();
+     }
+
+     // keeps the value already here
+     void merge(buffer& b){
+       merge(b, [](V&, const V&){});
+     }
+
+     size_t size() const{
+       return size_.load(std::memory_order_relaxed);
+     }
+
+     bool empty() const{
+       return size() == 0;
+     }
+
+     size_t bucket_count() const{
+       return numBuckets_;
+     }
+
+     // calls f(key, value) for each entry, those inserted while it runs
+     // may or may not be seen
+     template<typename F>
+     void for_each(F&& f) const{
+       for(size_t i = 0; i < numBuckets_; ++i){
+         for(Node* n = buckets_[i].load(std::memory_order_acquire); n;
+             n = n->next.load(std::memory_order_acquire)){
+           f(static_cast<const K&>(n->key), n->value);
+         }
+       }
+     }
+
+     void clear(){
+       for(size_t i = 0; i < numBuckets_; ++i){
+         Node* n = buckets_[i].load(std::memory_order_relaxed);
+         while(n){
+           Node* next = n->next.load(std::memory_order_relaxed);
+           deleteNode_(n);
+           n = next;
+         }
+         buckets_[i].store(nullptr, std::memory_order_relaxed);
+       }
+
+       size_.store(0, std::memory_order_relaxed);
+     }
+
+   private:
+     static const size_t STRIPES = 256;
+
+     struct Node{
+       Node(size_t hash, const K& key, const V& value)
+       : hash(hash),
+       key(key),
+       value(value),
+       next(nullptr){}
+
+       size_t hash;
+       K key;
+       V value;
+       std::atomic<Node*> next;
+     };
+
+     // the high bits of a Fibonacci hash, so that an identity hash of
+     // strided keys still spreads over the buckets
+     size_t bucket_(size_t h) const{
+       return shift_ == 64 ? 0 :
+         size_t((uint64_t(h) * 0x9e3779b97f4a7c15ull) >> shift_);
+     }
+
+     static V* value_(Node* n){
+       return n ? &n->value : nullptr;
+     }
+
+     // the node of key from n up to end
+     static Node* find_(Node* n, Node* end, size_t h, const K& key){
+       for(; n != end; n = n->next.load(std::memory_order_acquire)){
+         if(n->hash == h && Eq()(n->key, key)){
+           return n;
+         }
+       }
+       return nullptr;
+     }
+
+     static Node* newNode_(size_t h, const K& key, const V& value){
+       void* p = __ares_alloc_aligned(sizeof(Node), alignof(Node));
+       return new (p) Node(h, key, value);
+     }
+
+     static void deleteNode_(Node* n){
+       n->~Node();
+       __ares_free(n);
+     }
+
+     template<typename C>
+     void combine_(Node* n, const V& value, C& combine){
+       std::atomic<bool>& s =
+         stripes_[(reinterpret_cast<uintptr_t>(n) >> 4) % STRIPES];
+
+       while(s.exchange(true, std::memory_order_acquire)){
+         while(s.load(std::memory_order_relaxed)){}
+       }
+
+       combine(n->value, value);
+       s.store(false, std::memory_order_release);
+     }
+
+     // the entries [begin, end) all of one bucket
+     template<typename Entry, typename C>
+     void mergeBucket_(size_t bucket, Entry* begin, Entry* end, C& combine){
+       std::atomic<Node*>& head = buckets_[bucket];
+       Node* first = head.load(std::memory_order_acquire);
+
+       // the new keys, chained ahead of first
+       Node* chain = nullptr;
+       Node* last = nullptr;
+       size_t added = 0;
+
+       for(Entry* e = begin; e != end; ++e){
+         Node* n = find_(first, nullptr, e->hash, e->key);
+         if(n){
+           combine_(n, e->value, combine);
+         }
+         else if((n = find_(chain, nullptr, e->hash, e->key))){
+           combine(n->value, e->value);
+         }
+         else{
+           n = newNode_(e->hash, e->key, e->value);
+           n->next.store(chain, std::memory_order_relaxed);
+           chain = n;
+           last = last ? last : n;
+           ++added;
+         }
+       }
+
+       while(chain){
+         last->next.store(first, std::memory_order_relaxed);
+         Node* seen = first;
+
+         if(head.compare_exchange_weak(first, chain,
+                                       std::memory_order_release,
+                                       std::memory_order_acquire)){
+           size_.fetch_add(added, std::memory_order_relaxed);
+           return;
+         }
+
+         // the keys pushed since are combined into and dropped from the
+         // chain, which is relinked
+         Node* kept = nullptr;
+         last = nullptr;
+         added = 0;
+
+         for(Node* n = chain; n != seen;){
+           Node* next = n->next.load(std::memory_order_relaxed);
+
+           if(Node* m = find_(first, seen, n->hash, n->key)){
+             combine_(m, n->value, combine);
+             deleteNode_(n);
+           }
+           else{
+             n->next.store(kept, std::memory_order_relaxed);
+             kept = n;
+             last = last ? last : n;
+             ++added;
+           }
+
+           n = next;
+         }
+
+         chain = kept;
+       }
+     }
+
+     size_t numBuckets_;
+     unsigned shift_;
+     std::unique_ptr<std::atomic<Node*>[]> buckets_;
+     std::atomic<size_t> size_;
+     std::atomic<bool> stripes_[STRIPES];
+   };
+
+ } // namespace ares
+
+#endif // __ARES_CONCURRENT_MAP_H__
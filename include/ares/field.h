@@ -0,0 +1,470 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_FIELD_H__
+#define __ARES_FIELD_H__
+
+#include <cerrno>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ares/parallel.h"
+
+extern "C"{
+  void* __ares_alloc_aligned(uint64_t bytes, uint64_t align);
+  void __ares_free(void* ptr);
+}
+
+ namespace ares{
+
+   // where the storage of a Field starts. HugePage aligns it to a 2 MB
+   // page, which the runtime backs with transparent huge pages, Auto
+   // does so for fields of at least one such page.
+   enum class FieldAlign{
+     CacheLine,
+     HugePage,
+     Auto
+   };
+
+   // the future of an ares_snapshot(), waited on by the destructor if
+   // wait() was not called
+   class Snapshot{
+   public:
+     Snapshot(void* handle=nullptr)
+     : handle_(handle),
+     ok_(false){}
+
+     Snapshot(Snapshot&& s)
+     : handle_(s.handle_),
+     ok_(s.ok_){
+       s.handle_ = nullptr;
+     }
+
+     ~Snapshot(){
+       wait();
+     }
+
+     Snapshot(const Snapshot&) = delete;
+
+     Snapshot& operator=(const Snapshot&) = delete;
+
+     Snapshot& operator=(Snapshot&& s){
+       wait();
+       std::swap(handle_, s.handle_);
+       ok_ = s.ok_;
+       return *this;
+     }
+
+     bool ready() const{
+       return !handle_ || ares_snapshot_ready(handle_);
+     }
+
+     // true once the snapshot is on disk, false if writing it failed
+     bool wait(){
+       if(handle_){
+         ok_ = ares_snapshot_wait(handle_);
+         handle_ = nullptr;
+       }
+
+       return ok_;
+     }
+
+   private:
+     void* handle_;
+     bool ok_;
+   };
+
+   // a dense row-major array of Dims dimensions that is meant to be
+   // the data of Foralls. Its elements are constructed by a parallel
+   // first touch with the schedule that the loops over it use, static
+   // by default, so that each page is local to the node of the worker
+   // that computes on it. data() is __restrict and assumes its
+   // alignment, which HLIR assumes again where a Forall captures it.
+   //
+   // A Field can instead be mapped from a file, for restarts and for
+   // problems larger than memory: its pages are read in as the Foralls
+   // first touch them, and written back by the kernel or flush().
+   template<typename T, size_t Dims=1>
+   class Field{
+   public:
+     static_assert(Dims > 0, "a Field has at least one dimension");
+
+     static const size_t CACHE_LINE = 64;
+     static const size_t HUGE_PAGE = size_t(2) << 20;
+
+     Field(const uint32_t (&extents)[Dims], const T& value=T(),
+           Schedule schedule=schedule::static_(),
+           FieldAlign align=FieldAlign::Auto){
+       init_(extents, value, schedule, align);
+     }
+
+     Field(uint32_t n, const T& value=T(),
+           Schedule schedule=schedule::static_(),
+           FieldAlign align=FieldAlign::Auto){
+       static_assert(Dims == 1, "the extents of each dimension are needed");
+       init_(&n, value, schedule, align);
+     }
+
+     // maps the file at path shared, creating it or extending it with
+     // zeros to the size of the field, the elements already in it are
+     // kept. Throws std::system_error if it cannot be opened or mapped.
+     Field(const std::string& path, const uint32_t (&extents)[Dims]){
+       map_(path, extents);
+     }
+
+     Field(const std::string& path, uint32_t n){
+       static_assert(Dims == 1, "the extents of each dimension are needed");
+       map_(path, &n);
+     }
+
+     Field(Field&& f)
+     : data_(nullptr),
+     size_(0),
+     align_(CACHE_LINE),
+     fd_(-1){
+       for(size_t d = 0; d < Dims; ++d){
+         extents_[d] = 0;
+       }
+
+       swap(f);
+     }
+
+     ~Field(){
+       if(fd_ >= 0){
+         if(data_){
+           munmap(data_, size_ * sizeof(T));
+         }
+         close(fd_);
+         return;
+       }
+
+       if(!std::is_trivially_destructible<T>::value){
+         for(size_t i = 0; i < size_; ++i){
+           data_[i].~T();
+         }
+       }
+
+       __ares_free(data_);
+     }
+
+     Field(const Field&) = delete;
+
+     Field& operator=(const Field&) = delete;
+
+     Field& operator=(Field&& f){
+       swap(f);
+       return *this;
+     }
+
+     // exchanges the storage of two fields, as a time step does with the
+     // field it reads and the one it writes
+     void swap(Field& f){
+       std::swap(data_, f.data_);
+       std::swap(size_, f.size_);
+       std::swap(align_, f.align_);
+       std::swap(fd_, f.fd_);
+       for(size_t d = 0; d < Dims; ++d){
+         std::swap(extents_[d], f.extents_[d]);
+       }
+     }
+
+     T* __restrict data(){
+       return static_cast<T*>(__builtin_assume_aligned(data_, CACHE_LINE));
+     }
+
+     const T* __restrict data() const{
+       return static_cast<const T*>(
+         __builtin_assume_aligned(data_, CACHE_LINE));
+     }
+
+     size_t size() const{
+       return size_;
+     }
+
+     uint32_t extent(size_t d) const{
+       return extents_[d];
+     }
+
+     // the alignment of data() in bytes
+     size_t alignment() const{
+       return align_;
+     }
+
+     bool mapped() const{
+       return fd_ >= 0;
+     }
+
+     // starts writing the dirty pages of a mapped field back to its file
+     // without waiting for them, as a checkpoint wants between steps
+     void flush_async(){
+       if(fd_ >= 0 && size_ > 0){
+         msync(data_, size_ * sizeof(T), MS_ASYNC);
+       }
+     }
+
+     // writes the dirty pages back and waits until they are on disk,
+     // false if that failed
+     bool flush(){
+       if(fd_ < 0 || size_ == 0){
+         return true;
+       }
+
+       return msync(data_, size_ * sizeof(T), MS_SYNC) == 0;
+     }
+
+     // writes the field to path while the Foralls of the next steps go
+     // on, as ares_snapshot() does with its elements
+     Snapshot snapshot(const std::string& path, bool compress=false) const{
+       static_assert(std::is_trivially_copyable<T>::value,
+                     "a snapshot holds the bytes of the elements");
+
+       return Snapshot(ares_snapshot(data_, size_ * sizeof(T), path,
+                                     compress));
+     }
+
+     // reads back a snapshot of a field of the same size, false if path
+     // does not hold one
+     bool restore(const std::string& path){
+       return ares_snapshot_read(path, data_, size_ * sizeof(T));
+     }
+
+     // drops the pages of a mapped field from memory once they are
+     // written back, they are read in again when next touched. For
+     // fields larger than memory, between the phases that use them.
+     void evict(){
+       if(fd_ >= 0 && size_ > 0 &&
+          msync(data_, size_ * sizeof(T), MS_SYNC) == 0){
+         madvise(data_, size_ * sizeof(T), MADV_DONTNEED);
+       }
+     }
+
+     T& operator[](size_t i){
+       return data_[i];
+     }
+
+     const T& operator[](size_t i) const{
+       return data_[i];
+     }
+
+     // the element at one index per dimension, the last varying fastest
+     template<typename... I>
+     T& operator()(I... is){
+       return data_[offset_(is...)];
+     }
+
+     template<typename... I>
+     const T& operator()(I... is) const{
+       return data_[offset_(is...)];
+     }
+
+   private:
+     T* data_;
+     size_t size_;
+     size_t align_;
+     uint32_t extents_[Dims];
+     int fd_;
+
+     void setExtents_(const uint32_t* extents){
+       size_ = 1;
+       for(size_t d = 0; d < Dims; ++d){
+         extents_[d] = extents[d];
+         size_ *= extents[d];
+       }
+
+       // Forall ranges are 32 bit
+       if(size_ > UINT32_MAX){
+         throw std::length_error("ares::Field: too many elements");
+       }
+     }
+
+     void init_(const uint32_t* extents, const T& value, Schedule schedule,
+                FieldAlign align){
+       fd_ = -1;
+       setExtents_(extents);
+
+       size_t bytes = size_ * sizeof(T);
+
+       align_ = align == FieldAlign::HugePage ||
+         (align == FieldAlign::Auto && bytes >= HUGE_PAGE) ?
+         HUGE_PAGE : CACHE_LINE;
+
+       data_ = static_cast<T*>(__ares_alloc_aligned(bytes, align_));
+       if(!data_){
+         throw std::bad_alloc();
+       }
+
+       T* d = data_;
+       parallel_for(0, uint32_t(size_), [&](uint32_t i){
+         new (&d[i]) T(value);
+       }, schedule);
+     }
+
+     void map_(const std::string& path, const uint32_t* extents){
+       static_assert(std::is_trivially_copyable<T>::value,
+                     "a mapped Field is stored as the bytes of its elements");
+
+       data_ = nullptr;
+       align_ = sysconf(_SC_PAGESIZE);
+       setExtents_(extents);
+
+       fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+       if(fd_ < 0){
+         throw std::system_error(errno, std::generic_category(),
+                                 "ares::Field: " + path);
+       }
+
+       size_t bytes = size_ * sizeof(T);
+
+       struct stat st;
+       if(fstat(fd_, &st) != 0 ||
+          (size_t(st.st_size) < bytes && ftruncate(fd_, bytes) != 0)){
+         fail_(path);
+       }
+
+       if(bytes == 0){
+         return;
+       }
+
+       void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd_, 0);
+       if(p == MAP_FAILED){
+         fail_(path);
+       }
+
+       data_ = static_cast<T*>(p);
+     }
+
+     [[noreturn]] void fail_(const std::string& path){
+       int e = errno;
+       close(fd_);
+       fd_ = -1;
+       throw std::system_error(e, std::generic_category(),
+                               "ares::Field: " + path);
+     }
+
+     template<typename... I>
+     size_t offset_(I... is) const{
+       static_assert(sizeof...(I) == Dims, "one index per dimension");
+
+       const size_t index[] = {size_t(is)...};
+
+       size_t k = index[0];
+       for(size_t d = 1; d < Dims; ++d){
+         k = k * extents_[d] + index[d];
+       }
+
+       return k;
+     }
+   };
+
+   // the field that a time step reads and the one it writes, exchanged
+   // after each step by swapping their storage rather than copying the
+   // new values back, which would be a whole extra pass over memory
+   template<typename T, size_t Dims=1>
+   class double_buffer{
+   public:
+     double_buffer(const uint32_t (&extents)[Dims], const T& value=T(),
+                   Schedule schedule=schedule::static_(),
+                   FieldAlign align=FieldAlign::Auto)
+     : current_(extents, value, schedule, align),
+     next_(extents, value, schedule, align){}
+
+     double_buffer(uint32_t n, const T& value=T(),
+                   Schedule schedule=schedule::static_(),
+                   FieldAlign align=FieldAlign::Auto)
+     : current_(n, value, schedule, align),
+     next_(n, value, schedule, align){}
+
+     // the values of the last step
+     Field<T, Dims>& current(){
+       return current_;
+     }
+
+     const Field<T, Dims>& current() const{
+       return current_;
+     }
+
+     // the values the next step writes
+     Field<T, Dims>& next(){
+       return next_;
+     }
+
+     void swap(){
+       current_.swap(next_);
+     }
+
+     // one step, f(current, next), after which next is current
+     template<typename F>
+     void step(F&& f){
+       f(static_cast<const Field<T, Dims>&>(current_), next_);
+       swap();
+     }
+
+   private:
+     Field<T, Dims> current_;
+     Field<T, Dims> next_;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_FIELD_H__
@@ -52,19 +52,276 @@
 #ifndef __ARES_FRONTEND_H__
 #define __ARES_FRONTEND_H__
 
+#include <cstdlib>
 #include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "ares/runtime.h"
 
  namespace ares{
 
+   // handle of a Forall that is queued without waiting for it, set by
+   // the compiler. It has to be waited on before the function that
+   // queued the Forall returns or runs the same Forall again, which the
+   // destructor does if wait() was not called.
+   class Completion{
+   public:
+     Completion()
+     : synch_(nullptr){}
+
+     ~Completion(){
+       wait();
+     }
+
+     Completion(const Completion&) = delete;
+
+     Completion& operator=(const Completion&) = delete;
+
+     void wait(){
+       ares_wait_completion(&synch_);
+     }
+
+   private:
+     void* synch_;
+   };
+
+   // joins the task calls spawned in its scope, void ones included, with
+   // one wait rather than one per result. Calls spawned by those tasks
+   // are not part of it. The destructor waits if wait() was not called,
+   // calls spawned after it are no longer joined.
+   class TaskGroup{
+   public:
+     TaskGroup()
+     : group_(ares_task_group_begin()){}
+
+     ~TaskGroup(){
+       wait();
+     }
+
+     TaskGroup(const TaskGroup&) = delete;
+
+     TaskGroup& operator=(const TaskGroup&) = delete;
+
+     void wait(){
+       if(group_){
+         ares_task_group_wait(group_);
+         group_ = nullptr;
+       }
+     }
+
+   private:
+     void* group_;
+   };
+
+   // an array of a DeviceData region, the n elements at data
+   struct DeviceArray{
+     template<typename T>
+     DeviceArray(T* data, size_t n,
+                 OffloadAccess access=OffloadAccess::InOut)
+     : data(const_cast<void*>(static_cast<const void*>(data))),
+     bytes(n * sizeof(T)),
+     access(access){}
+
+     void* data;
+     size_t bytes;
+     OffloadAccess access;
+   };
+
+   // a data region for the offloaded Foralls in its scope, which keeps
+   // its arrays on the device from one Forall to the next rather than
+   // each launch finding them mapped or not. The copies in are all
+   // started as it begins and the copies out as it ends, so they
+   // overlap, see ares_offload_enter(). Without a device, or for an
+   // array mapped already, it does nothing for the array and the
+   // Foralls that capture it run on the host.
+   class DeviceData{
+   public:
+     DeviceData(std::initializer_list<DeviceArray> arrays){
+       for(const DeviceArray& a : arrays){
+         if(ares_offload_enter(a.data, a.bytes, a.access)){
+           entered_.push_back(a.data);
+         }
+       }
+     }
+
+     ~DeviceData(){
+       for(void* p : entered_){
+         ares_offload_exit(p);
+       }
+
+       for(void* p : entered_){
+         ares_offload_wait(p);
+       }
+     }
+
+     DeviceData(const DeviceData&) = delete;
+
+     DeviceData& operator=(const DeviceData&) = delete;
+
+   private:
+     std::vector<void*> entered_;
+   };
+
+   // scheduling priority of the tasks of a Forall, higher priority work
+   // is taken first by idle workers
+   enum class Priority : uint32_t{
+     Low = 0,
+     Normal = 1,
+     High = 2
+   };
+
+   // how the iterations of a Forall are handed to the workers, made by
+   // the functions of namespace schedule. A Forall without one follows
+   // ARES_SCHEDULE.
+   struct Schedule{
+     uint32_t kind;
+     uint32_t chunk;
+   };
+
+   namespace schedule{
+
+     // one contiguous block per worker, for uniform work
+     inline Schedule static_(){
+       return {1, 0};
+     }
+
+     // chunks of chunk iterations taken by the workers in turn, 0 picks
+     // one from the range and the number of workers
+     inline Schedule dynamic(uint32_t chunk=0){
+       return {2, chunk};
+     }
+
+     // chunks that shrink with the iterations left, of at least chunk
+     inline Schedule guided(uint32_t chunk=0){
+       return {3, chunk};
+     }
+
+     // split on demand with a grain the runtime sizes from the time the
+     // earlier runs of the loop took, for imbalanced work
+     inline Schedule auto_(){
+       return {4, 0};
+     }
+
+     // split with a grain that the runtime looks for online, probing a
+     // few on the first runs of the loop and again when it slows down,
+     // for loops that run many times
+     inline Schedule tune(){
+       return {5, 0};
+     }
+
+   } // end namespace schedule
+
+   // splits the range of a Forall across the ranks of the group of
+   // ares_init_comm(), each of which runs its share on its local pool
+   class Distribute : public Distribution{
+   public:
+     Distribute(Partition partition=Partition::Block, uint32_t ghost=0){
+       this->partition = partition;
+       this->partitioner = nullptr;
+       this->ghost = ghost;
+       this->offsets = nullptr;
+     }
+
+     Distribute(Partitioner partitioner, uint32_t ghost=0){
+       this->partition = Partition::Block;
+       this->partitioner = partitioner;
+       this->ghost = ghost;
+       this->offsets = nullptr;
+     }
+
+     // the shares of ares_partition(), over the vertices as it renumbered
+     // them, which must outlive the Distribute
+     Distribute(const GraphPartition& graphPartition, uint32_t ghost=0){
+       this->partition = Partition::Block;
+       this->partitioner = nullptr;
+       this->ghost = ghost;
+       this->offsets = graphPartition.offsets.data();
+     }
+
+     // the share of rank, whose read range is what the halo exchange
+     // has to fill in
+     RangeShare share(uint32_t start, uint32_t end, int rank) const{
+       return ares_share(*this, start, end, rank);
+     }
+   };
+
+   // a block of the indices of a Forall::blocked(), [begin, end)
+   struct SubRange{
+     uint32_t begin;
+     uint32_t end;
+   };
+
+   // iterates in parallel over [0, n) in blocks of up to block indices,
+   // each passed to the body as a SubRange. Made by Forall::blocked().
+   class ForallBlocked{
+   public:
+      class Iterator_{
+      public:
+        Iterator_(uint32_t n, uint32_t block, uint32_t begin)
+        : n_(n),
+        block_(block){
+          range_.begin = begin;
+          range_.end = n - begin < block ? n : begin + block;
+        }
+
+        Iterator_& operator++(){
+          range_.begin = range_.end;
+          range_.end = n_ - range_.end < block_ ? n_ : range_.end + block_;
+          return *this;
+        }
+
+        SubRange operator*() {
+          return range_;
+        }
+
+        bool operator==(const Iterator_& itr) const{
+          return range_.begin == itr.range_.begin;
+        }
+
+        bool operator!=(const Iterator_& itr) const{
+          return !(*this == itr);
+        }
+
+      private:
+        uint32_t n_;
+        uint32_t block_;
+        SubRange range_;
+      };
+
+      ForallBlocked(uint32_t n, uint32_t block)
+      : n_(n),
+      block_(block == 0 ? 1 : block){}
+
+      Iterator_ begin() const{
+        return Iterator_(n_, block_, 0);
+      }
+
+      Iterator_ end() const{
+        return Iterator_(n_, block_, n_);
+      }
+
+   private:
+    uint32_t n_;
+    uint32_t block_;
+   };
+
+   // the reduce variables of a Forall, made by reduction()
+   class Reduction{};
+
    class Forall{
    public:
       class Iterator_{
       public:
-        Iterator_(uint32_t index)
-        : index_(index){}
+        Iterator_(uint32_t index, uint32_t stride=1)
+        : index_(index),
+        stride_(stride){}
 
         Iterator_& operator++(){
-          ++index_;
+          index_ += stride_;
           return *this;
         }
 
@@ -82,21 +339,150 @@
 
         Iterator_& operator=(const Iterator_& itr) {
           index_ = itr.index_;
+          stride_ = itr.stride_;
           return *this;
         }
 
       private:
         uint32_t index_;
+        uint32_t stride_;
       };
 
       Forall(uint32_t start, uint32_t end)
       : start_(start),
       end_(end){}
 
+      // runs the share of this rank of the range
+      Forall(uint32_t start, uint32_t end, const Distribute& distribute){
+        RangeShare share = ares_share(distribute, start, end);
+        start_ = share.base;
+        end_ = share.base + share.count * share.stride;
+        stride_ = share.stride;
+      }
+
       Forall(uint32_t end)
       : start_(0),
       end_(end){}
 
+      // every step-th index of [start, end), starting at start
+      Forall(uint32_t start, uint32_t end, uint32_t step)
+      : start_(start),
+      stride_(step == 0 ? 1 : step){
+        uint32_t span = end > start ? end - start : 0;
+        end_ = start + (span / stride_ + (span % stride_ != 0)) * stride_;
+      }
+
+      // a body that both updates data and reduces into the variables of
+      // reduce, such as a time step and its residual, in one traversal
+      Forall(uint32_t end, const Reduction& reduce)
+      : start_(0),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, const Reduction& reduce)
+      : start_(start),
+      end_(end){}
+
+      static ForallBlocked blocked(uint32_t n, uint32_t block){
+        return ForallBlocked(n, block);
+      }
+
+      // returns once queued, done completes when all iterations have
+      // run and they start only once after has completed
+      Forall(uint32_t start, uint32_t end, Completion& done)
+      : start_(start),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, Completion& done, Completion& after)
+      : start_(start),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, Priority priority)
+      : start_(start),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, Completion& done, Priority priority)
+      : start_(start),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, Completion& done, Completion& after,
+             Priority priority)
+      : start_(start),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, Schedule schedule)
+      : start_(start),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, Schedule schedule,
+             Priority priority)
+      : start_(start),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, Completion& done,
+             Schedule schedule)
+      : start_(start),
+      end_(end){}
+
+      Forall(uint32_t start, uint32_t end, Completion& done, Completion& after,
+             Schedule schedule)
+      : start_(start),
+      end_(end){}
+
+      Iterator_ begin() const{
+        return Iterator_(start_, stride_);
+      }
+
+      Iterator_ end() const{
+        return Iterator_(end_, stride_);
+      }
+
+   private:
+    uint32_t start_;
+    uint32_t end_;
+    uint32_t stride_ = 1;
+   };
+
+   // iterates in parallel over [start, end) like a Forall, but the body
+   // is compiled as vector code, with consecutive indices as the lanes
+   // of the target's vector registers: AVX-512 or AVX2 on X86. Its
+   // conditionals become masks and a body that cannot be vectorized is
+   // reported. Compiled serially, it is a plain loop.
+   class ForallSimd{
+   public:
+      class Iterator_{
+      public:
+        Iterator_(uint32_t index)
+        : index_(index){}
+
+        Iterator_& operator++(){
+          ++index_;
+          return *this;
+        }
+
+        uint32_t operator*() {
+          return index_;
+        }
+
+        bool operator==(const Iterator_& itr) const{
+          return index_ == itr.index_;
+        }
+
+        bool operator!=(const Iterator_& itr) const{
+          return index_ != itr.index_;
+        }
+
+      private:
+        uint32_t index_;
+      };
+
+      ForallSimd(uint32_t start, uint32_t end)
+      : start_(start),
+      end_(end < start ? start : end){}
+
+      ForallSimd(uint32_t end)
+      : start_(0),
+      end_(end){}
+
       Iterator_ begin() const{
         return Iterator_(start_);
       }
@@ -110,11 +496,265 @@
     uint32_t end_;
    };
 
+   // index of a 2D / 3D iteration space, x moves fastest
+   struct Index2D{
+     uint32_t x;
+     uint32_t y;
+   };
+
+   struct Index3D{
+     uint32_t x;
+     uint32_t y;
+     uint32_t z;
+   };
+
+   // iterates over nx * ny in parallel, split into tiles of tileX * tileY
+   // that are each walked in row-major order by one task. Compiled
+   // serially, it is a plain row-major loop.
+   class Forall2D{
+   public:
+      class Iterator_{
+      public:
+        Iterator_(uint32_t nx, uint32_t x, uint32_t y)
+        : nx_(nx){
+          index_.x = x;
+          index_.y = y;
+        }
+
+        Iterator_& operator++(){
+          if(++index_.x == nx_){
+            index_.x = 0;
+            ++index_.y;
+          }
+          return *this;
+        }
+
+        Index2D operator*() {
+          return index_; 
+        }
+
+        bool operator==(const Iterator_& itr) const{
+          return index_.x == itr.index_.x && index_.y == itr.index_.y;
+        }
+
+        bool operator!=(const Iterator_& itr) const{
+          return !(*this == itr);
+        }
+
+      private:
+        uint32_t nx_;
+        Index2D index_;
+      };
+
+      Forall2D(uint32_t nx, uint32_t ny, uint32_t tileX=64, uint32_t tileY=8)
+      : nx_(nx),
+      ny_(ny){}
+
+      Iterator_ begin() const{
+        return Iterator_(nx_, 0, nx_ == 0 ? ny_ : 0);
+      }
+
+      Iterator_ end() const{
+        return Iterator_(nx_, 0, ny_);
+      }
+
+   private:
+    uint32_t nx_;
+    uint32_t ny_;
+   };
+
+   class Forall3D{
+   public:
+      class Iterator_{
+      public:
+        Iterator_(uint32_t nx, uint32_t ny, uint32_t x, uint32_t y, uint32_t z)
+        : nx_(nx),
+        ny_(ny){
+          index_.x = x;
+          index_.y = y;
+          index_.z = z;
+        }
+
+        Iterator_& operator++(){
+          if(++index_.x == nx_){
+            index_.x = 0;
+            if(++index_.y == ny_){
+              index_.y = 0;
+              ++index_.z;
+            }
+          }
+          return *this;
+        }
+
+        Index3D operator*() {
+          return index_; 
+        }
+
+        bool operator==(const Iterator_& itr) const{
+          return index_.x == itr.index_.x && index_.y == itr.index_.y &&
+            index_.z == itr.index_.z;
+        }
+
+        bool operator!=(const Iterator_& itr) const{
+          return !(*this == itr);
+        }
+
+      private:
+        uint32_t nx_;
+        uint32_t ny_;
+        Index3D index_;
+      };
+
+      Forall3D(uint32_t nx, uint32_t ny, uint32_t nz,
+               uint32_t tileX=32, uint32_t tileY=8, uint32_t tileZ=4)
+      : nx_(nx),
+      ny_(ny),
+      nz_(nz){}
+
+      Iterator_ begin() const{
+        return Iterator_(nx_, ny_, 0, 0, nx_ == 0 || ny_ == 0 ? nz_ : 0);
+      }
+
+      Iterator_ end() const{
+        return Iterator_(nx_, ny_, 0, 0, nz_);
+      }
+
+   private:
+    uint32_t nx_;
+    uint32_t ny_;
+    uint32_t nz_;
+   };
+
+   // a Forall over 64-bit indices, for ranges too large for a uint32_t
+   class Forall64{
+   public:
+      class Iterator_{
+      public:
+        Iterator_(uint64_t index)
+        : index_(index){}
+
+        Iterator_& operator++(){
+          ++index_;
+          return *this;
+        }
+
+        uint64_t operator*() {
+          return index_; 
+        }
+
+        bool operator==(const Iterator_& itr) const{
+          return index_ == itr.index_;
+        }
+
+        bool operator!=(const Iterator_& itr) const{
+          return index_ != itr.index_;
+        }
+
+      private:
+        uint64_t index_;
+      };
+
+      Forall64(uint64_t start, uint64_t end)
+      : start_(start),
+      end_(end < start ? start : end){}
+
+      Forall64(uint64_t end)
+      : start_(0),
+      end_(end){}
+
+      Iterator_ begin() const{
+        return Iterator_(start_);
+      }
+
+      Iterator_ end() const{
+        return Iterator_(end_);
+      }
+
+   private:
+    uint64_t start_;
+    uint64_t end_;
+   };
+
+   // iterates in parallel over elements in contiguous storage, the loop
+   // variable is each element as in a serial range-for. Made by Each().
+   template<typename T>
+   class ForallEach{
+   public:
+      ForallEach(T* first, T* last)
+      : first_(first),
+      last_(last){}
+
+      T* begin() const{
+        return first_;
+      }
+
+      T* end() const{
+        return last_;
+      }
+
+   private:
+    T* first_;
+    T* last_;
+   };
+
+   // the elements of a container with data() and size(), such as a
+   // std::vector or std::array
+   template<typename C>
+   auto Each(C& c)
+   -> ForallEach<typename std::remove_pointer<decltype(c.data())>::type>{
+     return {c.data(), c.data() + c.size()};
+   }
+
+   // the elements of [first, last), pointers or random-access iterators
+   // of contiguous storage
+   template<typename I>
+   auto Each(I first, I last)
+   -> ForallEach<typename std::remove_reference<decltype(*first)>::type>{
+     static_assert(std::is_base_of<std::random_access_iterator_tag,
+                   typename std::iterator_traits<I>::iterator_category>::value,
+                   "Each() needs random-access iterators");
+
+     if(first == last){
+       return {nullptr, nullptr};
+     }
+
+     return {&*first, &*first + (last - first)};
+   }
+
+   // explicit reduce operator, for operators that the compiler cannot
+   // infer from a +=, *=, &=, |= or ^= on the reduce variable
+   enum class ReduceOp{
+     Sum,
+     Product,
+     Min,
+     Max,
+     And,
+     Or,
+     BitAnd,
+     BitOr,
+     BitXor
+   };
+
+   // declares r and rs as the reduce variables of a Forall, each reduced
+   // over private copies, which start from the identity of its operator
+   // and are combined with the value it held before the Forall. The
+   // operator of each is inferred from its updates in the body unless
+   // given for a single variable.
+   template<typename T, typename... Ts>
+   Reduction reduction(T& r, Ts&... rs){
+     return Reduction();
+   }
+
+   template<typename T>
+   Reduction reduction(T& r, ReduceOp op){
+     return Reduction();
+   }
+
    class ReduceAll{
    public:
       class Iterator_{
       public:
-        Iterator_(uint32_t index)
+        Iterator_(uint64_t index)
         : index_(index){}
 
         Iterator_& operator++(){
@@ -122,7 +762,7 @@
           return *this;
         }
 
-        uint32_t operator*() {
+        uint64_t operator*() {
           return index_; 
         }
 
@@ -140,11 +780,38 @@
         }
 
       private:
-        uint32_t index_;
+        uint64_t index_;
       };
 
+      // r may also be a fixed-size array such as a histogram, reduced
+      // element by element. Small arrays get a private copy per partial,
+      // larger ones are updated in place with atomics, so their updates
+      // must take the form r[j] op= v.
+      template<typename T>
+      ReduceAll(uint64_t start, uint64_t end, T& r)
+      : start_(start),
+      end_(end){}
+
+      template<typename T>
+      ReduceAll(uint64_t start, uint64_t end, T& r, ReduceOp op)
+      : start_(start),
+      end_(end){}
+
+      // several reduce variables in a single pass, the operator of each
+      // is inferred from its updates in the body
+      template<typename T1, typename T2, typename... Ts,
+               typename = typename std::enable_if<
+                 !std::is_function<T2>::value>::type>
+      ReduceAll(uint64_t start, uint64_t end, T1& r1, T2& r2, Ts&... rs)
+      : start_(start),
+      end_(end){}
+
+      // combiner folds its second argument into the first, the partial
+      // of each thread starts from the initial value of r, which must
+      // therefore be the identity of the combiner
       template<typename T>
-      ReduceAll(uint32_t start, uint32_t end, T& r)
+      ReduceAll(uint64_t start, uint64_t end, T& r,
+                void (*combiner)(T&, const T&))
       : start_(start),
       end_(end){}
 
@@ -157,8 +824,153 @@
       }
 
    private:
-    uint32_t start_;
-    uint32_t end_;
+    uint64_t start_;
+    uint64_t end_;
+   };
+
+   enum class ScanKind{
+     Inclusive,
+     Exclusive
+   };
+
+   // prefix scan of r into out, out[i] receives the value of r after
+   // iteration i, or before it for an exclusive scan, and r ends up
+   // holding the total. The body runs twice per index, so it should only
+   // update r.
+   class ScanAll{
+   public:
+      using Iterator_ = ReduceAll::Iterator_;
+
+      template<typename T>
+      ScanAll(uint64_t start, uint64_t end, T& r, T* out,
+              ScanKind kind=ScanKind::Inclusive)
+      : start_(start),
+      end_(end){}
+
+      template<typename T>
+      ScanAll(uint64_t start, uint64_t end, T& r, T* out, ReduceOp op,
+              ScanKind kind=ScanKind::Inclusive)
+      : start_(start),
+      end_(end){}
+
+      Iterator_ begin() const{
+        return Iterator_(start_);
+      }
+
+      Iterator_ end() const{
+        return Iterator_(end_);
+      }
+
+   private:
+    uint64_t start_;
+    uint64_t end_;
+   };
+
+   // adds v to x atomically but without ordering, for the scatter adds
+   // of a Forall body. The compiler makes it an atomic add, a compare
+   // and swap loop for floating point, and in the loop of a body drops
+   // the atomic where no two iterations of the range add to the same
+   // address, or accumulates the adds to one address in a register and
+   // adds that once per chunk. Otherwise it calls the runtime.
+   void atomic_add(int32_t& x, int32_t v) __asm__("__ares_atomic_add_i32");
+   void atomic_add(uint32_t& x, uint32_t v) __asm__("__ares_atomic_add_u32");
+   void atomic_add(int64_t& x, int64_t v) __asm__("__ares_atomic_add_i64");
+   void atomic_add(uint64_t& x, uint64_t v) __asm__("__ares_atomic_add_u64");
+   void atomic_add(float& x, float v) __asm__("__ares_atomic_add_f32");
+   void atomic_add(double& x, double v) __asm__("__ares_atomic_add_f64");
+
+   // called in the body of a Forall, has the chunks of its range that
+   // have not started skipped, so that it is waited for once the chunks
+   // already running have returned, as a search does once it found what
+   // it looked for. It ends the innermost Forall queued to the pool, one
+   // that runs inline under ARES_SERIAL_THRESHOLD runs to its end.
+   void cancel() __asm__("__ares_cancel");
+
+   // whether the Forall that the calling body runs in was cancelled, for
+   // a body to end its own chunk early
+   bool cancelled() __asm__("__ares_cancelled");
+
+   // bytes of the calling thread's scratch arena, aligned to a cache
+   // line. A block taken in the body of a Forall or ReduceAll lasts
+   // until the end of its iteration, the compiler taking it once ahead
+   // of the iterations of a task where its size does not change between
+   // them. Anywhere else a ScratchScope bounds it.
+   void* scratch(size_t bytes) __asm__("__ares_scratch");
+
+   // gives back the scratch blocks taken while it lives
+   class ScratchScope{
+   public:
+     ScratchScope()
+     : mark_(ares_scratch_mark()){}
+
+     ~ScratchScope(){
+       ares_scratch_release(mark_);
+     }
+
+     ScratchScope(const ScratchScope&) = delete;
+
+     ScratchScope& operator=(const ScratchScope&) = delete;
+
+   private:
+     uint64_t mark_;
+   };
+
+   // a T for each worker of the pool, and one shared by the threads
+   // that are not, each on cache lines of its own, e.g. to accumulate
+   // into from a Forall body and combine afterwards. Tasks that a worker
+   // runs while it waits share its T with the one it waits in.
+   template<typename T>
+   class WorkerLocal{
+   public:
+     WorkerLocal(const T& value=T())
+     : size_(ares_num_workers() + 1){
+       if(posix_memalign(reinterpret_cast<void**>(&slots_),
+                         sizeof(Slot_), size_ * sizeof(Slot_)) != 0){
+         throw std::bad_alloc();
+       }
+
+       for(size_t i = 0; i < size_; ++i){
+         new (&slots_[i].value) T(value);
+       }
+     }
+
+     ~WorkerLocal(){
+       for(size_t i = 0; i < size_; ++i){
+         slots_[i].value.~T();
+       }
+
+       free(slots_);
+     }
+
+     WorkerLocal(const WorkerLocal&) = delete;
+
+     WorkerLocal& operator=(const WorkerLocal&) = delete;
+
+     // the T of the calling thread
+     T& local(){
+       int i = ares_worker_index();
+       return slots_[i < 0 ? size_ - 1 : i].value;
+     }
+
+     size_t size() const{
+       return size_;
+     }
+
+     T& operator[](size_t i){
+       return slots_[i].value;
+     }
+
+     const T& operator[](size_t i) const{
+       return slots_[i].value;
+     }
+
+   private:
+     struct alignas(64) Slot_{
+       T value;
+     };
+
+     Slot_* slots_;
+     size_t size_;
    };
 
  } // namespace ares
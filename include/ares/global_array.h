@@ -0,0 +1,510 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+
+#ifndef __ARES_GLOBAL_ARRAY_H__
+#define __ARES_GLOBAL_ARRAY_H__
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "ares/frontend.h"
+#include "ares/runtime.h"
+
+extern "C"{
+  void* __ares_create_synch(uint32_t count);
+  void __ares_await_synch(void* synch);
+  void __ares_signal_synch(void* synch);
+}
+
+ namespace ares{
+
+   namespace detail{
+
+     // what the owner does with the elements of a batch
+     enum class GlobalOp : uint32_t{
+       Get,
+       Put,
+       Accumulate
+     };
+
+     // an active message to the owner of count elements of array, whose
+     // local offsets follow it, then for a Put or Accumulate their values
+     struct GlobalRequest{
+       uint32_t array;
+       GlobalOp op;
+       CommOp combine;
+       uint32_t count;
+       uint64_t pending;
+     };
+
+     // the answer of owner to a request, followed by the values of a Get
+     struct GlobalReply{
+       uint32_t array;
+       int32_t owner;
+       uint32_t count;
+       uint64_t pending;
+     };
+
+     class GlobalArrayBase{
+     public:
+       virtual ~GlobalArrayBase(){}
+
+       virtual void serve(int source, const GlobalRequest& request,
+                          const char* body) = 0;
+
+       virtual void answer(const GlobalReply& reply, const char* values) = 0;
+     };
+
+     // the arrays by id, which is the same on every rank because they
+     // are made collectively and in the same order, and the active
+     // handlers that they share, registered along with the first one
+     struct GlobalArrays{
+       std::mutex mutex;
+       std::vector<GlobalArrayBase*> arrays;
+       uint32_t request;
+       uint32_t reply;
+     };
+
+     inline GlobalArrays& globalArrays();
+
+     inline GlobalArrayBase* globalArray(uint32_t id){
+       GlobalArrays& g = globalArrays();
+       std::lock_guard<std::mutex> lock(g.mutex);
+       return id < g.arrays.size() ? g.arrays[id] : nullptr;
+     }
+
+     inline void serveGlobalRequest(int source, void* args, size_t size){
+       GlobalRequest request;
+       memcpy(&request, args, sizeof(request));
+
+       if(GlobalArrayBase* a = globalArray(request.array)){
+         a->serve(source, request,
+                  static_cast<const char*>(args) + sizeof(request));
+       }
+     }
+
+     inline void answerGlobalRequest(int source, void* args, size_t size){
+       GlobalReply reply;
+       memcpy(&reply, args, sizeof(reply));
+
+       if(GlobalArrayBase* a = globalArray(reply.array)){
+         a->answer(reply, static_cast<const char*>(args) + sizeof(reply));
+       }
+     }
+
+     inline GlobalArrays& globalArrays(){
+       static GlobalArrays* g = []{
+         auto g = new GlobalArrays;
+         g->request = ares_register_handler(serveGlobalRequest);
+         g->reply = ares_register_handler(answerGlobalRequest);
+         return g;
+       }();
+
+       return *g;
+     }
+
+   } // namespace detail
+
+   // an array of size elements in blocks across the group, the share of
+   // each rank as that of a Distribute(Partition::Block) Forall of the
+   // same size, which is why local() takes global indices. Ranges are
+   // read and written with ares_get() and ares_put(), so with RDMA where
+   // the peer is connected over verbs. Gathers, scatters and
+   // accumulates of arbitrary indices send one active message per owner
+   // rank and wait for its answer. Every call returns once it is done,
+   // a barrier orders them with the local accesses of the other ranks.
+   // Arrays are made and destroyed collectively, in the same order on
+   // every rank, which also has to be so for the first of them relative
+   // to the other ares_register_handler() calls.
+   template<class T>
+   class GlobalArray : public detail::GlobalArrayBase{
+   public:
+     static_assert(std::is_trivially_copyable<T>::value,
+                   "global arrays hold trivially copyable elements");
+
+     explicit GlobalArray(uint32_t size)
+     : size_(size),
+     rank_(ares_rank()),
+     groupSize_(ares_group_size()),
+     starts_(groupSize_ + 1),
+     keys_(groupSize_){
+       for(size_t r = 0; r < groupSize_; ++r){
+         starts_[r] = distribution().share(0, size, int(r)).base;
+       }
+       starts_[groupSize_] = size;
+
+       local_.resize(starts_[rank_ + 1] - starts_[rank_]);
+       local_.reserve(1);
+
+       RemoteMemoryKey key;
+       bool registered =
+         ares_register_memory(local_.data(), local_.size() * sizeof(T), key);
+       assert(registered && "failed to register a global array");
+       (void)registered;
+
+       // registered before its key is sent, so that no request can
+       // arrive ahead of it
+       detail::GlobalArrays& g = detail::globalArrays();
+       {
+         std::lock_guard<std::mutex> lock(g.mutex);
+         id_ = uint32_t(g.arrays.size());
+         g.arrays.push_back(this);
+       }
+
+       ares_allgather(&key, sizeof(key), keys_.data());
+     }
+
+     GlobalArray(const GlobalArray&) = delete;
+
+     GlobalArray& operator=(const GlobalArray&) = delete;
+
+     ~GlobalArray(){
+       ares_barrier();
+
+       detail::GlobalArrays& g = detail::globalArrays();
+       {
+         std::lock_guard<std::mutex> lock(g.mutex);
+         g.arrays[id_] = nullptr;
+       }
+
+       ares_deregister_memory(local_.data());
+     }
+
+     uint32_t size() const{
+       return size_;
+     }
+
+     // the partition of the array, for a Forall over local()
+     Distribute distribution() const{
+       return Distribute(Partition::Block);
+     }
+
+     int owner(uint32_t i) const{
+       assert(i < size_ && "index outside of the global array");
+       return int(std::upper_bound(starts_.begin(), starts_.end(), i) -
+                  starts_.begin()) - 1;
+     }
+
+     // the global indices [localStart(), localEnd()) of this rank
+     uint32_t localStart() const{
+       return starts_[rank_];
+     }
+
+     uint32_t localEnd() const{
+       return starts_[rank_ + 1];
+     }
+
+     T* localData(){
+       return local_.data();
+     }
+
+     // the element of this rank at global index i
+     T& local(uint32_t i){
+       assert(i >= localStart() && i < localEnd() && "not a local element");
+       return local_[i - localStart()];
+     }
+
+     // copies [start, start + n) into out
+     void get(uint32_t start, uint32_t n, T* out){
+       forEachOwner_(start, n, [&](int r, uint32_t s, uint32_t e){
+         T* buf = out + (s - start);
+         size_t bytes = (e - s) * sizeof(T);
+         size_t offset = (s - starts_[r]) * sizeof(T);
+
+         if(r == rank_){
+           memcpy(buf, &local_[s - starts_[r]], bytes);
+           return;
+         }
+
+         RemoteMemoryKey key;
+         ares_register_memory(buf, bytes, key);
+         bool ok = ares_get(r, buf, bytes, keys_[r], offset);
+         assert(ok && "global array get failed");
+         (void)ok;
+         ares_deregister_memory(buf);
+       });
+     }
+
+     // copies values into [start, start + n)
+     void put(uint32_t start, uint32_t n, const T* values){
+       forEachOwner_(start, n, [&](int r, uint32_t s, uint32_t e){
+         const T* buf = values + (s - start);
+         size_t bytes = (e - s) * sizeof(T);
+         size_t offset = (s - starts_[r]) * sizeof(T);
+
+         if(r == rank_){
+           memcpy(&local_[s - starts_[r]], buf, bytes);
+           return;
+         }
+
+         RemoteMemoryKey key;
+         ares_register_memory(const_cast<T*>(buf), bytes, key);
+         bool ok = ares_put(r, buf, bytes, keys_[r], offset);
+         assert(ok && "global array put failed");
+         (void)ok;
+         ares_deregister_memory(const_cast<T*>(buf));
+       });
+     }
+
+     // combines values into [start, start + n) on their owners, each
+     // element atomically with respect to the other accumulates
+     void accumulate(uint32_t start, uint32_t n, const T* values,
+                     CommOp op=CommOp::Sum){
+       std::vector<uint32_t> indices(n);
+       for(uint32_t i = 0; i < n; ++i){
+         indices[i] = start + i;
+       }
+       accumulate(indices, values, op);
+     }
+
+     // out[k] receives the element at indices[k]
+     void get(const std::vector<uint32_t>& indices, T* out){
+       batch_(detail::GlobalOp::Get, indices, nullptr, out, CommOp::Sum);
+     }
+
+     void put(const std::vector<uint32_t>& indices, const T* values){
+       batch_(detail::GlobalOp::Put, indices, values, nullptr, CommOp::Sum);
+     }
+
+     void accumulate(const std::vector<uint32_t>& indices, const T* values,
+                     CommOp op=CommOp::Sum){
+       batch_(detail::GlobalOp::Accumulate, indices, values, nullptr, op);
+     }
+
+     void serve(int source, const detail::GlobalRequest& request,
+                const char* body) override{
+       bool get = request.op == detail::GlobalOp::Get;
+       const char* values = body + request.count * sizeof(uint32_t);
+
+       std::vector<char> reply(sizeof(detail::GlobalReply) +
+                               (get ? request.count * sizeof(T) : 0));
+       char* out = reply.data() + sizeof(detail::GlobalReply);
+
+       {
+         std::lock_guard<std::mutex> lock(mutex_);
+
+         for(uint32_t i = 0; i < request.count; ++i){
+           uint32_t offset;
+           memcpy(&offset, body + i * sizeof(uint32_t), sizeof(offset));
+           apply_(request.op, local_[offset], values + i * sizeof(T),
+                  out + i * sizeof(T), request.combine);
+         }
+       }
+
+       detail::GlobalReply r = {id_, rank_, get ? request.count : 0,
+                                request.pending};
+       memcpy(reply.data(), &r, sizeof(r));
+       ares_spawn(source, detail::globalArrays().reply, reply.data(),
+                  reply.size());
+     }
+
+     void answer(const detail::GlobalReply& reply,
+                 const char* values) override{
+       auto p = reinterpret_cast<Pending_*>(uintptr_t(reply.pending));
+       const std::vector<size_t>& positions = p->positions[reply.owner];
+
+       for(uint32_t i = 0; i < reply.count; ++i){
+         memcpy(&p->out[positions[i]], values + i * sizeof(T), sizeof(T));
+       }
+
+       __ares_signal_synch(p->synch);
+     }
+
+   private:
+     // a batch waiting for the answers of the ranks it was sent to, the
+     // positions in out of what each of them owns
+     struct Pending_{
+       T* out;
+       std::vector<std::vector<size_t>> positions;
+       void* synch;
+     };
+
+     // calls f(rank, s, e) for the part [s, e) of [start, start + n) of
+     // each rank that owns some of it
+     template<class F>
+     void forEachOwner_(uint32_t start, uint32_t n, F f){
+       assert(n <= size_ - start && "range outside of the global array");
+
+       uint32_t end = start + n;
+       uint32_t s = start;
+
+       while(s < end){
+         int r = owner(s);
+         uint32_t e = std::min(end, starts_[r + 1]);
+         f(r, s, e);
+         s = e;
+       }
+     }
+
+     void batch_(detail::GlobalOp op, const std::vector<uint32_t>& indices,
+                 const T* values, T* out, CommOp combine){
+       Pending_ pending;
+       pending.out = out;
+       pending.positions.resize(groupSize_);
+
+       for(size_t k = 0; k < indices.size(); ++k){
+         pending.positions[owner(indices[k])].push_back(k);
+       }
+
+       uint32_t remote = 0;
+       for(size_t r = 0; r < groupSize_; ++r){
+         remote += int(r) != rank_ && !pending.positions[r].empty();
+       }
+
+       pending.synch = remote > 0 ? __ares_create_synch(remote) : nullptr;
+
+       bool get = op == detail::GlobalOp::Get;
+       std::vector<char> msg;
+
+       for(size_t r = 0; r < groupSize_; ++r){
+         const std::vector<size_t>& positions = pending.positions[r];
+         if(positions.empty()){
+           continue;
+         }
+
+         if(int(r) == rank_){
+           std::lock_guard<std::mutex> lock(mutex_);
+
+           for(size_t k : positions){
+             apply_(op, local_[indices[k] - starts_[r]],
+                    reinterpret_cast<const char*>(values ? values + k : 
+                                                  nullptr),
+                    reinterpret_cast<char*>(out ? out + k : nullptr),
+                    combine);
+           }
+           continue;
+         }
+
+         uint32_t count = uint32_t(positions.size());
+         detail::GlobalRequest request = 
+           {id_, op, combine, count, uint64_t(uintptr_t(&pending))};
+
+         msg.resize(sizeof(request) + count * sizeof(uint32_t) +
+                    (get ? 0 : count * sizeof(T)));
+         memcpy(msg.data(), &request, sizeof(request));
+
+         char* offsets = msg.data() + sizeof(request);
+         char* data = offsets + count * sizeof(uint32_t);
+
+         for(uint32_t i = 0; i < count; ++i){
+           uint32_t offset = indices[positions[i]] - starts_[r];
+           memcpy(offsets + i * sizeof(uint32_t), &offset, sizeof(offset));
+           if(!get){
+             memcpy(data + i * sizeof(T), &values[positions[i]], sizeof(T));
+           }
+         }
+
+         ares_spawn(int(r), detail::globalArrays().request, msg.data(),
+                    msg.size());
+       }
+
+       if(pending.synch){
+         __ares_await_synch(pending.synch);
+       }
+     }
+
+     void apply_(detail::GlobalOp op, T& element, const char* value,
+                 char* out, CommOp combine){
+       switch(op){
+       case detail::GlobalOp::Get:
+         memcpy(out, &element, sizeof(T));
+         break;
+       case detail::GlobalOp::Put:
+         memcpy(&element, value, sizeof(T));
+         break;
+       case detail::GlobalOp::Accumulate:{
+         T v;
+         memcpy(&v, value, sizeof(T));
+         combine_(element, v, combine, std::is_arithmetic<T>());
+         break;
+       }
+       }
+     }
+
+     static void combine_(T& a, const T& b, CommOp op, std::true_type){
+       switch(op){
+       case CommOp::Sum:
+         a = a + b;
+         break;
+       case CommOp::Min:
+         a = b < a ? b : a;
+         break;
+       case CommOp::Max:
+         a = a < b ? b : a;
+         break;
+       }
+     }
+
+     static void combine_(T& a, const T& b, CommOp op, std::false_type){
+       assert(false && "only arithmetic elements are accumulated");
+     }
+
+     uint32_t size_;
+     int rank_;
+     size_t groupSize_;
+     std::vector<uint32_t> starts_;
+     std::vector<RemoteMemoryKey> keys_;
+     std::vector<T> local_;
+     std::mutex mutex_;
+     uint32_t id_;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_GLOBAL_ARRAY_H__
@@ -0,0 +1,410 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+
+#ifndef __ARES_GRAPH_H__
+#define __ARES_GRAPH_H__
+
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ares/frontend.h"
+
+extern "C"{
+  void* __ares_create_synch(uint32_t count);
+  void __ares_await_synch(void* synch);
+  void __ares_signal_synch(void* synch);
+  void __ares_queue_func(void* synch, void* args, void* fp,
+                         uint32_t index, uint32_t priority, void* region);
+  uint32_t __ares_num_threads();
+}
+
+ namespace ares{
+
+   // the fewest indices that a chunk of a captured forall() is given
+   // when it picks its own grain
+   const uint32_t GRAPH_GRAIN = 1024;
+
+   class graph_capture;
+
+   // the Foralls, reductions and tasks of one time step, recorded once by
+   // a graph_capture and then run by each launch(). The order they run in
+   // and the chunks of each range are fixed when they are captured, and
+   // everything a launch needs is allocated by then, so a launch only
+   // resets counters and queues the chunks, much as a CUDA graph replays
+   // its kernels. The bodies see the state of the variables they captured
+   // by reference at the time of each launch.
+   class TaskGraph{
+   public:
+     using Node = uint32_t;
+
+     TaskGraph()
+     : remaining_(0),
+     synch_(nullptr),
+     capturing_(false){}
+
+     TaskGraph(const TaskGraph&) = delete;
+
+     TaskGraph& operator=(const TaskGraph&) = delete;
+
+     size_t size() const{
+       return nodes_.size();
+     }
+
+     bool empty() const{
+       return nodes_.empty();
+     }
+
+     // runs every node once, each after those it depends on, and returns
+     // when all of them have. A graph is launched by one caller at a time
+     // and not while it is being captured.
+     void launch(){
+       assert(!capturing_ && "launch of a graph being captured");
+
+       if(nodes_.empty()){
+         return;
+       }
+
+       for(auto& n : nodes_){
+         n->deps.store(uint32_t(n->after.size()), std::memory_order_relaxed);
+       }
+
+       remaining_.store(uint32_t(nodes_.size()), std::memory_order_relaxed);
+
+       synch_ = __ares_create_synch(1);
+       void* synch = synch_;
+
+       for(Node r : roots_){
+         start_(*nodes_[r]);
+       }
+
+       __ares_await_synch(synch);
+     }
+
+   private:
+     friend class graph_capture;
+
+     struct Chunk{
+       uint32_t begin;
+       uint32_t end;
+     };
+
+     struct NodeDesc{
+       TaskGraph* graph;
+
+       // runs chunk k, [begin, end), then finish() once all have run
+       std::function<void(uint32_t k, uint32_t begin, uint32_t end)> run;
+       std::function<void()> finish;
+
+       std::vector<Chunk> chunks;
+       std::vector<Node> after;
+       std::vector<Node> successors;
+
+       std::atomic<uint32_t> deps;
+       std::atomic<uint32_t> chunksLeft;
+     };
+
+     // the argument the runtime passes to a queued function
+     struct NodeArg{
+       void* synch;
+       uint32_t n;
+       void* args;
+     };
+
+     static void task_(void* arg){
+       auto a = static_cast<NodeArg*>(arg);
+       auto& n = *static_cast<NodeDesc*>(a->args);
+
+       const Chunk& c = n.chunks[a->n];
+       n.run(a->n, c.begin, c.end);
+
+       if(n.chunksLeft.fetch_sub(1, std::memory_order_acq_rel) == 1){
+         n.graph->finish_(n);
+       }
+     }
+
+     void start_(NodeDesc& n){
+       uint32_t k = uint32_t(n.chunks.size());
+
+       if(k == 0){
+         finish_(n);
+         return;
+       }
+
+       n.chunksLeft.store(k, std::memory_order_relaxed);
+
+       for(uint32_t i = 0; i < k; ++i){
+         __ares_queue_func(synch_, &n, reinterpret_cast<void*>(&task_), i,
+                           static_cast<uint32_t>(Priority::Normal), nullptr);
+       }
+     }
+
+     void finish_(NodeDesc& n){
+       if(n.finish){
+         n.finish();
+       }
+
+       for(Node s : n.successors){
+         NodeDesc& m = *nodes_[s];
+         if(m.deps.fetch_sub(1, std::memory_order_acq_rel) == 1){
+           start_(m);
+         }
+       }
+
+       // the synch is read first, the graph may be launched again once
+       // the last node is done
+       void* synch = synch_;
+       if(remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1){
+         __ares_signal_synch(synch);
+       }
+     }
+
+     std::vector<std::unique_ptr<NodeDesc>> nodes_;
+     std::vector<Node> roots_;
+     std::atomic<uint32_t> remaining_;
+     void* synch_;
+     bool capturing_;
+   };
+
+   // records the nodes of a TaskGraph, replacing any it had, until it goes
+   // out of scope. Each node runs after the one captured before it unless
+   // after() names the nodes it waits for instead, which lets independent
+   // work of a step overlap. Capturing runs nothing, and the bodies must
+   // not throw.
+   class graph_capture{
+   public:
+     using Node = TaskGraph::Node;
+
+     explicit graph_capture(TaskGraph& graph)
+     : graph_(graph),
+     explicit_(false){
+       assert(!graph.capturing_ && "graph is already being captured");
+
+       graph.nodes_.clear();
+       graph.roots_.clear();
+       graph.capturing_ = true;
+     }
+
+     graph_capture(const graph_capture&) = delete;
+
+     graph_capture& operator=(const graph_capture&) = delete;
+
+     ~graph_capture(){
+       for(size_t i = 0; i < graph_.nodes_.size(); ++i){
+         TaskGraph::NodeDesc& n = *graph_.nodes_[i];
+
+         if(n.after.empty()){
+           graph_.roots_.push_back(Node(i));
+         }
+
+         for(Node a : n.after){
+           graph_.nodes_[a]->successors.push_back(Node(i));
+         }
+       }
+
+       graph_.capturing_ = false;
+     }
+
+     // the nodes that the next node waits for, none making it start as
+     // soon as the graph is launched
+     void after(std::initializer_list<Node> nodes){
+       for(Node n : nodes){
+         assert(n < graph_.nodes_.size() && "unknown node");
+         (void)n;
+       }
+
+       after_.assign(nodes.begin(), nodes.end());
+       explicit_ = true;
+     }
+
+     // calls body(i) for each i of [start, end), split into the same
+     // chunks of grain indices in every launch, or into a few per worker
+     // if grain is 0
+     template<typename F>
+     Node forall(uint32_t start, uint32_t end, F&& body, uint32_t grain=0){
+       using Body = typename std::decay<F>::type;
+
+       Body f(std::forward<F>(body));
+
+       return add_(plan_(start, end, grain),
+                   [f](uint32_t, uint32_t begin, uint32_t end) mutable{
+                     for(uint32_t i = begin; i < end; ++i){
+                       f(i);
+                     }
+                   }, nullptr);
+     }
+
+     // f() on one worker
+     template<typename F>
+     Node task(F&& f){
+       using Body = typename std::decay<F>::type;
+
+       Body g(std::forward<F>(f));
+
+       return add_({{0, 1}}, [g](uint32_t, uint32_t, uint32_t) mutable{
+         g();
+       }, nullptr);
+     }
+
+     // body(i, partial) for each i of [start, end), each chunk folding
+     // into a partial of its own that starts as identity. Once all chunks
+     // have run, r is set to the combination of identity and the
+     // partials in chunk order by combine(into, from), as a ReduceAll
+     // replaces the value of its reduce variable.
+     template<typename T, typename F, typename C>
+     Node reduce(uint32_t start, uint32_t end, T& r, const T& identity,
+                 F&& body, C&& combine, uint32_t grain=0){
+       using Body = typename std::decay<F>::type;
+       using Combine = typename std::decay<C>::type;
+
+       std::vector<TaskGraph::Chunk> chunks = plan_(start, end, grain);
+
+       // partials a cache line apart, since each is written by a
+       // different worker
+       size_t stride = sizeof(T) >= 64 ? 1 : (64 + sizeof(T) - 1)/sizeof(T);
+
+       auto partials = std::make_shared<std::vector<T>>(
+         chunks.size() * stride, identity);
+
+       Body f(std::forward<F>(body));
+       Combine g(std::forward<C>(combine));
+       T* result = &r;
+
+       return add_(std::move(chunks),
+                   [f, partials, stride, identity]
+                   (uint32_t k, uint32_t begin, uint32_t end) mutable{
+                     T& p = (*partials)[k * stride];
+                     p = identity;
+                     for(uint32_t i = begin; i < end; ++i){
+                       f(i, p);
+                     }
+                   },
+                   [g, partials, stride, identity, result]() mutable{
+                     T v = identity;
+                     for(size_t k = 0; k < partials->size(); k += stride){
+                       g(v, (*partials)[k]);
+                     }
+                     *result = v;
+                   });
+     }
+
+   private:
+     std::vector<TaskGraph::Chunk> plan_(uint32_t start, uint32_t end,
+                                         uint32_t grain){
+       std::vector<TaskGraph::Chunk> chunks;
+
+       if(start >= end){
+         return chunks;
+       }
+
+       uint32_t n = end - start;
+       uint32_t count;
+
+       if(grain > 0){
+         count = n/grain + (n % grain != 0);
+       }
+       else{
+         uint32_t perWorker = __ares_num_threads() * 4;
+         count = n/GRAPH_GRAIN;
+         count = count < perWorker ? count : perWorker;
+         count = count > 0 ? count : 1;
+       }
+
+       chunks.reserve(count);
+       for(uint32_t k = 0; k < count; ++k){
+         chunks.push_back({start + uint32_t(uint64_t(n) * k / count),
+                           start + uint32_t(uint64_t(n) * (k + 1) / count)});
+       }
+
+       return chunks;
+     }
+
+     template<typename R, typename D>
+     Node add_(std::vector<TaskGraph::Chunk> chunks, R&& run, D&& finish){
+       Node id = Node(graph_.nodes_.size());
+
+       std::unique_ptr<TaskGraph::NodeDesc> n(new TaskGraph::NodeDesc);
+       n->graph = &graph_;
+       n->run = std::forward<R>(run);
+       n->finish = std::forward<D>(finish);
+       n->chunks = std::move(chunks);
+       n->deps.store(0, std::memory_order_relaxed);
+       n->chunksLeft.store(0, std::memory_order_relaxed);
+
+       if(explicit_){
+         n->after = after_;
+         explicit_ = false;
+       }
+       else if(id > 0){
+         n->after.push_back(id - 1);
+       }
+
+       graph_.nodes_.push_back(std::move(n));
+
+       return id;
+     }
+
+     TaskGraph& graph_;
+     std::vector<Node> after_;
+     bool explicit_;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_GRAPH_H__
@@ -0,0 +1,400 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_HALO_H__
+#define __ARES_HALO_H__
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "ares/runtime.h"
+
+ namespace ares{
+
+   // tags from here up to ARES_COLLECTIVE_TAG are taken by halo exchanges,
+   // eight for each field id
+   const uint32_t ARES_HALO_TAG = 0xfffe0000;
+
+   // cells [x0, x1) x [y0, y1)
+   struct Box{
+     int x0;
+     int x1;
+     int y0;
+     int y1;
+   };
+
+   // an nx by ny grid split into blocks over px by py ranks, rank
+   // by * px + bx owns block (bx, by), the first blocks of each row and
+   // column taking the remainder
+   class GridDecomposition{
+   public:
+     GridDecomposition(uint32_t nx, uint32_t ny, uint32_t px, uint32_t py,
+                       int rank, bool periodic=true)
+     : nx_(nx),
+     ny_(ny),
+     px_(px),
+     py_(py),
+     rank_(rank),
+     periodic_(periodic){
+       assert(rank >= 0 && uint32_t(rank) < px * py && 
+              "rank outside of the grid");
+     }
+
+     // over groupSize ranks, as close to square blocks as they divide
+     static GridDecomposition split(uint32_t nx, uint32_t ny,
+                                    size_t groupSize, int rank,
+                                    bool periodic=true){
+       uint32_t px = bestPx_(nx, ny, groupSize);
+       return GridDecomposition(nx, ny, px, groupSize / px, rank, periodic);
+     }
+
+     uint32_t nx() const{
+       return nx_;
+     }
+
+     uint32_t ny() const{
+       return ny_;
+     }
+
+     int rank() const{
+       return rank_;
+     }
+
+     // the global cells of the block of this rank
+     Box block() const{
+       Box b;
+       split_(nx_, px_, rank_ % px_, b.x0, b.x1);
+       split_(ny_, py_, rank_ / px_, b.y0, b.y1);
+       return b;
+     }
+
+     // the rank owning the block dx, dy away, -1 off the edge of a grid
+     // that is not periodic
+     int neighbor(int dx, int dy) const{
+       int bx = int(rank_ % px_) + dx;
+       int by = int(rank_ / px_) + dy;
+
+       if(periodic_){
+         bx = (bx + px_) % px_;
+         by = (by + py_) % py_;
+       }
+       else if(bx < 0 || by < 0 || bx >= int(px_) || by >= int(py_)){
+         return -1;
+       }
+
+       return by * px_ + bx;
+     }
+
+   private:
+     static void split_(uint32_t n, uint32_t parts, uint32_t i, int& start,
+                        int& end){
+       uint32_t q = n / parts;
+       uint32_t r = n % parts;
+       start = i * q + (i < r ? i : r);
+       end = start + q + (i < r ? 1 : 0);
+     }
+
+     // the least boundary per block
+     static uint32_t bestPx_(uint32_t nx, uint32_t ny, size_t groupSize){
+       uint32_t best = 1;
+       double bestCost = -1;
+
+       for(uint32_t px = 1; px <= groupSize; ++px){
+         if(groupSize % px != 0){
+           continue;
+         }
+
+         double cost = double(nx) / px + double(ny) / (groupSize / px);
+         if(bestCost < 0 || cost < bestCost){
+           best = px;
+           bestCost = cost;
+         }
+       }
+
+       return best;
+     }
+
+     uint32_t nx_;
+     uint32_t ny_;
+     uint32_t px_;
+     uint32_t py_;
+     int rank_;
+     bool periodic_;
+   };
+
+   // the block of a rank with ghost cells around it, filled from the
+   // neighbors by exchange(), including the corners. Cells are addressed
+   // in block coordinates, the ghosts being the ones below 0 and from the
+   // width or height up to ghost beyond.
+   template<class T>
+   class HaloField{
+   public:
+     HaloField(const GridDecomposition& grid, uint32_t ghost=1,
+               uint32_t id=0)
+     : grid_(grid),
+     block_(grid.block()),
+     ghost_(ghost),
+     width_(block_.x1 - block_.x0),
+     height_(block_.y1 - block_.y0),
+     stride_(width_ + 2 * ghost),
+     tag_(ARES_HALO_TAG + 8 * id),
+     data_(size_t(stride_) * (height_ + 2 * ghost)){
+       assert(width_ >= int(ghost) && height_ >= int(ghost) &&
+              "blocks narrower than the ghost layer");
+     }
+
+     ~HaloField(){
+       if(exchanging_){
+         finishExchange();
+       }
+     }
+
+     HaloField(const HaloField&) = delete;
+
+     HaloField& operator=(const HaloField&) = delete;
+
+     T& operator()(int x, int y){
+       return data_[size_t(y + ghost_) * stride_ + x + ghost_];
+     }
+
+     const T& operator()(int x, int y) const{
+       return data_[size_t(y + ghost_) * stride_ + x + ghost_];
+     }
+
+     int width() const{
+       return width_;
+     }
+
+     int height() const{
+       return height_;
+     }
+
+     uint32_t ghost() const{
+       return ghost_;
+     }
+
+     // where the block lies in the grid
+     const Box& block() const{
+       return block_;
+     }
+
+     // the cells whose stencil, up to ghost wide, reads no ghost cells,
+     // which can be updated while the exchange is in flight
+     Box interior() const{
+       int g = ghost_;
+       return {g, width_ - g, g, height_ - g};
+     }
+
+     // the rest of the block, up to four strips
+     std::vector<Box> boundary() const{
+       int g = ghost_;
+       std::vector<Box> boxes;
+
+       if(g == 0){
+         return boxes;
+       }
+
+       boxes.push_back({0, width_, 0, g});
+       if(height_ > g){
+         boxes.push_back({0, width_, height_ - g, height_});
+       }
+       if(height_ > 2 * g){
+         boxes.push_back({0, g, g, height_ - g});
+         if(width_ > g){
+           boxes.push_back({width_ - g, width_, g, height_ - g});
+         }
+       }
+
+       return boxes;
+     }
+
+     // posts the receives of the ghost cells and sends the edges of the
+     // block, without waiting for either
+     void startExchange(){
+       assert(!exchanging_ && "exchange already started");
+       exchanging_ = true;
+
+       if(ghost_ == 0){
+         return;
+       }
+
+       for(int d = 0; d < 8; ++d){
+         int dx = DX_[d];
+         int dy = DY_[d];
+
+         int peer = grid_.neighbor(dx, dy);
+         if(peer < 0){
+           continue;
+         }
+
+         // the ghosts toward dx, dy are the edge that the neighbor there
+         // sent toward -dx, -dy
+         receives_[d] = ares_irecv(peer, tag_ + opposite_(d));
+
+         Box edge = edge_(dx, dy);
+         std::vector<T>& buf = sendBufs_[d];
+         buf.resize(size_t(edge.x1 - edge.x0) * (edge.y1 - edge.y0));
+         pack_(edge, buf.data());
+
+         sends_[d] = ares_isend(peer, tag_ + d, 
+                                reinterpret_cast<const char*>(buf.data()),
+                                buf.size() * sizeof(T));
+       }
+     }
+
+     // waits for the ghost cells and copies them in, and for the sends
+     void finishExchange(){
+       assert(exchanging_ && "exchange not started");
+       exchanging_ = false;
+
+       for(int d = 0; d < 8; ++d){
+         size_t size;
+
+         if(receives_[d]){
+           char* buf = ares_wait(receives_[d], size);
+           receives_[d] = nullptr;
+
+           Box g = ghosts_(DX_[d], DY_[d]);
+           assert(size == size_t(g.x1 - g.x0) * (g.y1 - g.y0) * sizeof(T) &&
+                  "ghost region of a different size");
+
+           unpack_(g, reinterpret_cast<const T*>(buf));
+           ares_release(buf);
+         }
+
+         if(sends_[d]){
+           ares_wait(sends_[d], size);
+           sends_[d] = nullptr;
+         }
+       }
+     }
+
+     void exchange(){
+       startExchange();
+       finishExchange();
+     }
+
+   private:
+     // the eight directions, a direction and its opposite are 7 - d
+     static constexpr int DX_[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+     static constexpr int DY_[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+     static int opposite_(int d){
+       return 7 - d;
+     }
+
+     // the cells [start, end) along a side of length n toward step
+     void range_(int step, int n, int& start, int& end) const{
+       int g = ghost_;
+       start = step < 0 ? -g : step == 0 ? 0 : n;
+       end = step < 0 ? 0 : step == 0 ? n : n + g;
+     }
+
+     Box ghosts_(int dx, int dy) const{
+       Box b;
+       range_(dx, width_, b.x0, b.x1);
+       range_(dy, height_, b.y0, b.y1);
+       return b;
+     }
+
+     // the owned cells that are the neighbor's ghosts dx, dy away
+     Box edge_(int dx, int dy) const{
+       int g = ghost_;
+       Box b = ghosts_(dx, dy);
+       b.x0 = dx < 0 ? 0 : dx > 0 ? width_ - g : b.x0;
+       b.x1 = dx < 0 ? g : dx > 0 ? width_ : b.x1;
+       b.y0 = dy < 0 ? 0 : dy > 0 ? height_ - g : b.y0;
+       b.y1 = dy < 0 ? g : dy > 0 ? height_ : b.y1;
+       return b;
+     }
+
+     // rows are contiguous, so each is a single copy
+     void pack_(const Box& b, T* out) const{
+       size_t n = b.x1 - b.x0;
+       for(int y = b.y0; y < b.y1; ++y){
+         memcpy(out, &(*this)(b.x0, y), n * sizeof(T));
+         out += n;
+       }
+     }
+
+     void unpack_(const Box& b, const T* in){
+       size_t n = b.x1 - b.x0;
+       for(int y = b.y0; y < b.y1; ++y){
+         memcpy(&(*this)(b.x0, y), in, n * sizeof(T));
+         in += n;
+       }
+     }
+
+     GridDecomposition grid_;
+     Box block_;
+     uint32_t ghost_;
+     int width_;
+     int height_;
+     int stride_;
+     uint32_t tag_;
+     std::vector<T> data_;
+     std::vector<T> sendBufs_[8];
+     CommRequest* receives_[8] = {};
+     CommRequest* sends_[8] = {};
+     bool exchanging_ = false;
+   };
+
+   template<class T>
+   constexpr int HaloField<T>::DX_[8];
+
+   template<class T>
+   constexpr int HaloField<T>::DY_[8];
+
+ } // namespace ares
+
+#endif // __ARES_HALO_H__
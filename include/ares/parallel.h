@@ -0,0 +1,213 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_PARALLEL_H__
+#define __ARES_PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "ares/frontend.h"
+
+// the entry points that HLIR lowers Forall to, called directly here
+extern "C"{
+  void* __ares_create_synch(uint32_t count);
+  void __ares_await_synch(void* synch);
+  void __ares_queue_scheduled(void* after, void* synch, void* args,
+                              void* fp, uint32_t start, uint32_t end,
+                              uint32_t schedule, uint32_t chunk,
+                              uint32_t priority, void* region);
+  uint64_t __ares_reduce_block_size();
+}
+
+ namespace ares{
+
+   // parallel_for() and parallel_reduce() run on the same pool and
+   // schedules as Forall and ReduceAll, but as plain templates, for code
+   // that is not compiled with hlir-clang. The body is called once per
+   // index and must not throw.
+
+   namespace detail{
+
+     // the argument the runtime passes to the body of each sub-range
+     struct RangeArg{
+       uint32_t begin;
+       uint32_t end;
+       void* args;
+     };
+
+     template<typename F>
+     void rangeBody(void* arg){
+       auto r = static_cast<RangeArg*>(arg);
+       F& f = *static_cast<F*>(r->args);
+
+       for(uint32_t i = r->begin; i < r->end; ++i){
+         f(i);
+       }
+     }
+
+   } // end namespace detail
+
+   // calls f(i) for each i in [start, end) and waits for all of them
+   template<typename F>
+   void parallel_for(uint32_t start, uint32_t end, F&& f,
+                     Schedule schedule={0, 0},
+                     Priority priority=Priority::Normal){
+     using Body = typename std::remove_reference<F>::type;
+
+     void* synch = __ares_create_synch(1);
+
+     __ares_queue_scheduled(nullptr, synch, &f,
+                            reinterpret_cast<void*>(&detail::rangeBody<Body>),
+                            start, end, schedule.kind, schedule.chunk,
+                            static_cast<uint32_t>(priority), nullptr);
+
+     __ares_await_synch(synch);
+   }
+
+   template<typename F>
+   void parallel_for(uint32_t n, F&& f){
+     parallel_for(0, n, std::forward<F>(f));
+   }
+
+   // an i in [start, end) for which pred(i) holds, not necessarily the
+   // first, or end if there is none. The range is cancelled once one is
+   // found, so the chunks that have not started are skipped and those
+   // running end early.
+   template<typename P>
+   uint32_t parallel_find_if(uint32_t start, uint32_t end, P&& pred,
+                             Schedule schedule=schedule::dynamic()){
+     std::atomic<uint32_t> found(end);
+
+     parallel_for(start, end, [&](uint32_t i){
+       if(found.load(std::memory_order_relaxed) != end){
+         return;
+       }
+
+       if(pred(i)){
+         found.store(i, std::memory_order_relaxed);
+         cancel();
+       }
+     }, schedule);
+
+     return found.load(std::memory_order_relaxed);
+   }
+
+   // calls f(i) for each iteration of an ares_inspect() plan, in its
+   // order. The chunks are scheduled statically, so that each runs on
+   // the same worker every time the plan does.
+   template<typename F>
+   void parallel_for(const IterationPlan& plan, F&& f){
+     const uint32_t* order = plan.order.data();
+     const uint32_t* chunks = plan.chunks.data();
+
+     parallel_for(0, uint32_t(plan.chunks.size() - 1), [&](uint32_t c){
+       for(uint32_t j = chunks[c]; j < chunks[c + 1]; ++j){
+         f(order[j]);
+       }
+     }, schedule::static_());
+   }
+
+   // combines identity and map(i) for each i in [start, end) with the
+   // associative combine(a, b). The range is split into a few blocks
+   // per worker, or into those of a deterministic ARES_REDUCE, and their
+   // partials are combined in order, so the result does not depend on
+   // how the blocks were scheduled.
+   template<typename T, typename M, typename C>
+   T parallel_reduce(uint32_t start, uint32_t end, const T& identity,
+                     M&& map, C&& combine){
+     if(start >= end){
+       return identity;
+     }
+
+     uint32_t n = end - start;
+
+     uint64_t blockSize = __ares_reduce_block_size();
+     if(blockSize == 0){
+       blockSize = (n + ares_num_workers() * 4 - 1)/(ares_num_workers() * 4);
+     }
+
+     uint32_t numBlocks = uint32_t((n + blockSize - 1)/blockSize);
+
+     std::vector<T> partials(numBlocks, identity);
+
+     parallel_for(0, numBlocks, [&](uint32_t b){
+       uint32_t i = start + uint32_t(b * blockSize);
+       uint32_t blockEnd = uint32_t(std::min(uint64_t(end), i + blockSize));
+
+       T r = identity;
+       for(; i < blockEnd; ++i){
+         r = combine(r, map(i));
+       }
+       partials[b] = r;
+     }, schedule::dynamic(1));
+
+     T r = identity;
+     for(const T& p : partials){
+       r = combine(r, p);
+     }
+
+     return r;
+   }
+
+   // sums map(i) over [start, end)
+   template<typename T, typename M>
+   T parallel_reduce(uint32_t start, uint32_t end, const T& identity,
+                     M&& map){
+     return parallel_reduce(start, end, identity, std::forward<M>(map),
+                            [](const T& a, const T& b){ return a + b; });
+   }
+
+ } // namespace ares
+
+#endif // __ARES_PARALLEL_H__
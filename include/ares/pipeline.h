@@ -0,0 +1,498 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_PIPELINE_H__
+#define __ARES_PIPELINE_H__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ares/frontend.h"
+
+// the entry points that HLIR lowers tasks and Forall to, called directly
+extern "C"{
+  void* __ares_create_synch(uint32_t count);
+  void __ares_await_synch(void* synch);
+  void __ares_signal_synch(void* synch);
+  void __ares_queue_func(void* synch, void* args, void* fp,
+                         uint32_t index, uint32_t priority, void* region);
+  uint32_t __ares_num_threads();
+}
+
+ namespace ares{
+
+   namespace detail{
+
+     // the argument the runtime passes to a queued function
+     struct FuncArg{
+       void* synch;
+       uint32_t n;
+       void* args;
+     };
+
+     // Vyukov's bounded queue, which any number of threads may push to
+     // and pop from, each cell's sequence telling whose turn it is
+     class TokenRing{
+     public:
+       explicit TokenRing(uint32_t capacity)
+       : cells_(roundUp_(capacity)),
+       mask_(cells_.size() - 1),
+       head_(0),
+       tail_(0){
+         for(size_t i = 0; i < cells_.size(); ++i){
+           cells_[i].seq.store(i, std::memory_order_relaxed);
+         }
+       }
+
+       TokenRing(const TokenRing&) = delete;
+
+       // false if the ring is full
+       bool push(uint32_t value){
+         size_t pos = tail_.load(std::memory_order_relaxed);
+         for(;;){
+           Cell& c = cells_[pos & mask_];
+           size_t seq = c.seq.load(std::memory_order_acquire);
+
+           if(seq == pos){
+             if(tail_.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)){
+               c.value = value;
+               c.seq.store(pos + 1, std::memory_order_release);
+               return true;
+             }
+           }
+           else if(seq < pos){
+             return false;
+           }
+           else{
+             pos = tail_.load(std::memory_order_relaxed);
+           }
+         }
+       }
+
+       // false if the ring is empty
+       bool pop(uint32_t& value){
+         size_t pos = head_.load(std::memory_order_relaxed);
+         for(;;){
+           Cell& c = cells_[pos & mask_];
+           size_t seq = c.seq.load(std::memory_order_acquire);
+
+           if(seq == pos + 1){
+             if(head_.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)){
+               value = c.value;
+               c.seq.store(pos + mask_ + 1, std::memory_order_release);
+               return true;
+             }
+           }
+           else if(seq < pos + 1){
+             return false;
+           }
+           else{
+             pos = head_.load(std::memory_order_relaxed);
+           }
+         }
+       }
+
+       bool empty() const{
+         size_t pos = head_.load(std::memory_order_relaxed);
+         return cells_[pos & mask_].seq.load(std::memory_order_acquire) !=
+           pos + 1;
+       }
+
+     private:
+       struct Cell{
+         std::atomic<size_t> seq;
+         uint32_t value;
+       };
+
+       static size_t roundUp_(uint32_t n){
+         size_t r = 1;
+         while(r < n){
+           r <<= 1;
+         }
+         return r;
+       }
+
+       static const size_t CACHE_LINE = 64;
+
+       std::vector<Cell> cells_;
+       size_t mask_;
+
+       char pad0_[CACHE_LINE];
+       std::atomic<size_t> head_;
+       char pad1_[CACHE_LINE - sizeof(std::atomic<size_t>)];
+       std::atomic<size_t> tail_;
+       char pad2_[CACHE_LINE - sizeof(std::atomic<size_t>)];
+     };
+
+   } // end namespace detail
+
+   // a streaming pipeline of stages over items of T, run on the pool of
+   // the runtime. A serial source fills items one at a time, in order,
+   // and each then passes through the stages in the order they were
+   // added. A parallel stage runs on any number of items at once, a
+   // serial one on one at a time and in the order of the source. A stage
+   // returning bool drops the item when it returns false, the later
+   // stages skipping it.
+   //
+   // There are as many items as tokens, default constructed once and
+   // reused, so the source is only called when an item has retired from
+   // the last stage and memory stays bounded while the stages overlap.
+   // An item is carried through the parallel stages by the task that
+   // took it from the one before, and waits for its turn at a serial
+   // stage in a bounded ring, without a lock. The stages must not throw.
+   template<typename T>
+   class Pipeline{
+   public:
+     // 0 tokens is 4 per worker
+     explicit Pipeline(uint32_t tokens=0)
+     : tokens_(tokens > 0 ? tokens : 4 * __ares_num_threads()),
+     items_(tokens_),
+     free_(tokens_),
+     synch_(nullptr){}
+
+     Pipeline(const Pipeline&) = delete;
+
+     Pipeline& operator=(const Pipeline&) = delete;
+
+     template<typename F>
+     Pipeline& parallel(F&& f){
+       add_(std::forward<F>(f), false);
+       return *this;
+     }
+
+     template<typename F>
+     Pipeline& serial(F&& f){
+       add_(std::forward<F>(f), true);
+       return *this;
+     }
+
+     uint32_t tokens() const{
+       return tokens_;
+     }
+
+     // runs the pipeline until source(T&), which is called serially,
+     // returns false, and all of the items it filled have retired
+     template<typename S>
+     void run(S&& source){
+       source_ = std::forward<S>(source);
+
+       for(auto& s : stages_){
+         s->next = 0;
+       }
+
+       for(uint32_t i = 0; i < tokens_; ++i){
+         free_.push(i);
+       }
+
+       seq_ = 0;
+       exhausted_ = false;
+
+       // one for the source, until it is exhausted
+       active_.store(1, std::memory_order_relaxed);
+       feeding_.store(false, std::memory_order_relaxed);
+
+       void* synch = __ares_create_synch(1);
+       synch_ = synch;
+       queue_(FEED);
+       __ares_await_synch(synch);
+
+       uint32_t n;
+       while(free_.pop(n)){}
+       source_ = nullptr;
+     }
+
+   private:
+     static const uint32_t NONE = UINT32_MAX;
+     static const uint32_t FEED = UINT32_MAX - 1;
+
+     struct Item{
+       T value;
+       size_t seq;
+       size_t stage;
+       bool keep;
+     };
+
+     struct Stage{
+       Stage(uint32_t tokens, bool serial)
+       : serial(serial),
+       ring(serial ? tokens : 0),
+       next(0),
+       busy(false){}
+
+       std::function<bool(T&)> f;
+       bool serial;
+
+       // slot seq % tokens holds the item of that seq plus 1, once it
+       // has arrived, as fewer than tokens are in flight
+       std::vector<std::atomic<uint32_t>> ring;
+
+       // the seq to run next, changed only by whoever holds busy
+       size_t next;
+       std::atomic<bool> busy;
+     };
+
+     template<typename F>
+     static bool call_(F& f, T& x, std::true_type){
+       f(x);
+       return true;
+     }
+
+     template<typename F>
+     static bool call_(F& f, T& x, std::false_type){
+       return f(x);
+     }
+
+     template<typename F>
+     void add_(F&& f, bool serial){
+       using Body = typename std::decay<F>::type;
+       using Void = std::is_void<decltype(std::declval<Body&>()(
+         std::declval<T&>()))>;
+
+       std::unique_ptr<Stage> s(new Stage(tokens_, serial));
+       for(auto& r : s->ring){
+         r.store(0, std::memory_order_relaxed);
+       }
+
+       Body body(std::forward<F>(f));
+       s->f = [body](T& x) mutable{
+         return call_(body, x, Void());
+       };
+
+       stages_.push_back(std::move(s));
+     }
+
+     static void task_(void* arg){
+       auto a = static_cast<detail::FuncArg*>(arg);
+       auto p = static_cast<Pipeline*>(a->args);
+
+       if(a->n == FEED){
+         uint32_t slot = p->feed_();
+         if(slot != NONE){
+           p->work_(slot, 0);
+         }
+         return;
+       }
+
+       p->work_(a->n, p->items_[a->n].stage);
+     }
+
+     // the synch is not released per task but once the last item retires
+     void queue_(uint32_t slot, size_t stage=0){
+       if(slot != FEED){
+         items_[slot].stage = stage;
+       }
+
+       __ares_queue_func(synch_, this, reinterpret_cast<void*>(&task_), slot,
+                         static_cast<uint32_t>(Priority::Normal), nullptr);
+     }
+
+     void release_(){
+       void* synch = synch_;
+       if(active_.fetch_sub(1, std::memory_order_acq_rel) == 1){
+         __ares_signal_synch(synch);
+       }
+     }
+
+     // fills as many items as there are tokens free, queueing all but the
+     // last, which is returned for the caller to carry on with
+     uint32_t feed_(){
+       uint32_t pending = NONE;
+       bool exhausted = false;
+
+       for(;;){
+         if(feeding_.exchange(true)){
+           break;
+         }
+
+         uint32_t n;
+         while(!exhausted_ && free_.pop(n)){
+           Item& item = items_[n];
+
+           if(!source_(item.value)){
+             exhausted_ = exhausted = true;
+             free_.push(n);
+             break;
+           }
+
+           item.seq = seq_++;
+           item.keep = true;
+           active_.fetch_add(1, std::memory_order_relaxed);
+
+           if(pending != NONE){
+             queue_(pending);
+           }
+           pending = n;
+         }
+
+         bool done = exhausted_;
+         feeding_.store(false);
+
+         // against a token freed while this held the source
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if(done || free_.empty()){
+           break;
+         }
+       }
+
+       // an item still in flight, or the caller's, keeps active_ above 0
+       if(exhausted){
+         release_();
+       }
+
+       return pending;
+     }
+
+     // runs the items of serial stage k that are next in order, queueing
+     // all but the last, which is returned, NONE if this found the stage
+     // held or had none to run
+     uint32_t drain_(size_t k){
+       Stage& s = *stages_[k];
+       uint32_t pending = NONE;
+
+       for(;;){
+         if(s.busy.exchange(true)){
+           break;
+         }
+
+         for(;;){
+           uint32_t n = s.ring[s.next % tokens_].exchange(0);
+           if(n == 0){
+             break;
+           }
+
+           if(pending != NONE){
+             queue_(pending, k + 1);
+           }
+
+           Item& item = items_[n - 1];
+           if(item.keep){
+             item.keep = s.f(item.value);
+           }
+
+           ++s.next;
+           pending = n - 1;
+         }
+
+         size_t next = s.next;
+         s.busy.store(false);
+
+         if(s.ring[next % tokens_].load() == 0){
+           break;
+         }
+       }
+
+       return pending;
+     }
+
+     // carries slot on from stage k, then whatever item that frees up,
+     // until an item waits for a serial stage held by another task
+     void work_(uint32_t slot, size_t k){
+       for(;;){
+         for(; k < stages_.size(); ++k){
+           Stage& s = *stages_[k];
+           Item& item = items_[slot];
+
+           if(!s.serial){
+             if(item.keep){
+               item.keep = s.f(item.value);
+             }
+             continue;
+           }
+
+           s.ring[item.seq % tokens_].store(slot + 1);
+
+           slot = drain_(k);
+           if(slot == NONE){
+             return;
+           }
+         }
+
+         free_.push(slot);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+
+         // the retired item is counted until here, so the pipeline
+         // outlives the feed
+         slot = feed_();
+         release_();
+
+         if(slot == NONE){
+           return;
+         }
+
+         k = 0;
+       }
+     }
+
+     uint32_t tokens_;
+     std::vector<Item> items_;
+     std::vector<std::unique_ptr<Stage>> stages_;
+     std::function<bool(T&)> source_;
+     detail::TokenRing free_;
+     void* synch_;
+
+     // the source is held by whoever sets feeding_
+     size_t seq_;
+     bool exhausted_;
+     std::atomic<bool> feeding_;
+     std::atomic<size_t> active_;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_PIPELINE_H__
@@ -0,0 +1,172 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_REGION_H__
+#define __ARES_REGION_H__
+
+#include <utility>
+
+#include "ares/parallel.h"
+
+extern "C"{
+  void* __ares_create_barrier(uint32_t count);
+  void __ares_wait_barrier(void* barrier);
+  void __ares_delete_barrier(void* barrier);
+  uint32_t __ares_num_threads();
+  uint32_t __ares_in_worker();
+}
+
+ namespace ares{
+
+   // one of the members of a parallel_region(), each running the same
+   // code as in OpenMP's parallel. A forall() in it runs the member's
+   // static block of the range and ends with a barrier of all of them,
+   // forall_nowait() without it, so the inner loops of a time step cost
+   // a barrier each rather than queueing and waiting for their tasks.
+   class ParallelRegion{
+   public:
+     ParallelRegion(uint32_t rank, uint32_t size, void* barrier)
+     : rank_(rank),
+     size_(size),
+     barrier_(barrier){}
+
+     ParallelRegion(const ParallelRegion&) = delete;
+
+     ParallelRegion& operator=(const ParallelRegion&) = delete;
+
+     uint32_t rank() const{
+       return rank_;
+     }
+
+     uint32_t size() const{
+       return size_;
+     }
+
+     // waits for all of the members to reach it
+     void barrier(){
+       if(barrier_){
+         __ares_wait_barrier(barrier_);
+       }
+     }
+
+     // calls f(i) for the member's block of [start, end), the same one
+     // in every forall() of the same range, so it works on the memory it
+     // first touched
+     template<typename F>
+     void forall_nowait(uint32_t start, uint32_t end, F&& f){
+       if(start >= end){
+         return;
+       }
+
+       uint64_t n = end - start;
+       uint32_t begin = start + uint32_t(n * rank_ / size_);
+       uint32_t last = start + uint32_t(n * (rank_ + 1) / size_);
+
+       for(uint32_t i = begin; i < last; ++i){
+         f(i);
+       }
+     }
+
+     template<typename F>
+     void forall(uint32_t start, uint32_t end, F&& f){
+       forall_nowait(start, end, std::forward<F>(f));
+       barrier();
+     }
+
+     // f() run by one member, which the others wait for
+     template<typename F>
+     void single(F&& f){
+       if(rank_ == 0){
+         f();
+       }
+       barrier();
+     }
+
+   private:
+     uint32_t rank_;
+     uint32_t size_;
+     void* barrier_;
+   };
+
+   // runs f(region) on one member per worker of the pool at once, each
+   // with its own ParallelRegion, and returns once all have returned.
+   // The members stay on their workers for the whole of f, a time loop
+   // in it paying only for the barriers between its phases. Called from
+   // a worker, as in the body of a Forall, there is one member, the
+   // caller, since the other workers may not be free to join it. f must
+   // not throw, and every member must reach the same barriers.
+   template<typename F>
+   void parallel_region(F&& f){
+     uint32_t size = __ares_num_threads();
+
+     if(size <= 1 || __ares_in_worker()){
+       ParallelRegion region(0, 1, nullptr);
+       f(region);
+       return;
+     }
+
+     void* barrier = __ares_create_barrier(size);
+
+     // a static schedule of one iteration per worker queues one task to
+     // each worker's mailbox, from which another takes it if it is busy
+     parallel_for(0, size, [&](uint32_t rank){
+       ParallelRegion region(rank, size, barrier);
+       f(region);
+     }, schedule::static_());
+
+     __ares_delete_barrier(barrier);
+   }
+
+ } // namespace ares
+
+#endif // __ARES_REGION_H__
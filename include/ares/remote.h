@@ -0,0 +1,385 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_REMOTE_H__
+#define __ARES_REMOTE_H__
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ares/frontend.h"
+#include "ares/runtime.h"
+
+extern "C"{
+  void* __ares_create_synch(uint32_t count);
+  void __ares_await_synch(void* synch);
+  void __ares_signal_synch(void* synch);
+  void __ares_finish_func(void* arg);
+  void __ares_queue_func(void* synch, void* args, void* fp,
+                         uint32_t index, uint32_t priority, void* region);
+}
+
+ namespace ares{
+
+   namespace detail{
+
+     // the arguments and results of remote calls are trivially copyable
+     // values, vectors of them and strings, packed one after the other
+     template<class T>
+     void remotePack(std::vector<char>& buf, const T& value){
+       static_assert(std::is_trivially_copyable<T>::value,
+                     "only trivially copyable values are sent as they are");
+       auto p = reinterpret_cast<const char*>(&value);
+       buf.insert(buf.end(), p, p + sizeof(T));
+     }
+
+     template<class T>
+     void remotePackArray(std::vector<char>& buf, const T* data, size_t n){
+       static_assert(std::is_trivially_copyable<T>::value,
+                     "only trivially copyable arrays are sent as they are");
+       remotePack(buf, uint64_t(n));
+       auto p = reinterpret_cast<const char*>(data);
+       buf.insert(buf.end(), p, p + n * sizeof(T));
+     }
+
+     template<class T>
+     void remotePack(std::vector<char>& buf, const std::vector<T>& v){
+       remotePackArray(buf, v.data(), v.size());
+     }
+
+     inline void remotePack(std::vector<char>& buf, const std::string& s){
+       remotePackArray(buf, s.data(), s.size());
+     }
+
+     template<class T>
+     void remoteUnpack(const char*& p, T& value){
+       memcpy(&value, p, sizeof(T));
+       p += sizeof(T);
+     }
+
+     template<class T>
+     void remoteUnpack(const char*& p, std::vector<T>& v){
+       uint64_t n;
+       remoteUnpack(p, n);
+       v.resize(n);
+       memcpy(v.data(), p, n * sizeof(T));
+       p += n * sizeof(T);
+     }
+
+     inline void remoteUnpack(const char*& p, std::string& s){
+       uint64_t n;
+       remoteUnpack(p, n);
+       s.assign(p, n);
+       p += n;
+     }
+
+     // the active message that asks a rank to make a call, followed by
+     // the packed arguments, and its answer, followed by the result
+     struct RemoteRequest{
+       uint32_t function;
+       uint64_t state;
+     };
+
+     struct RemoteReply{
+       uint64_t state;
+     };
+
+     class RemoteFunctionBase{
+     public:
+       virtual ~RemoteFunctionBase(){}
+
+       // the packed result of the call with the packed args
+       virtual std::vector<char> call(const char* args) = 0;
+     };
+
+     // where a call's result arrives, held by its future: the synch is
+     // released once it has, and for a call run on the calling rank,
+     // the function and args are those of its task
+     struct RemoteState{
+       void* synch;
+       std::vector<char> result;
+       RemoteFunctionBase* function;
+       std::vector<char> args;
+     };
+
+     // the functions by id, the same on every rank because they are
+     // made in the same order, and the active handlers they share,
+     // registered along with the first one
+     struct RemoteFunctions{
+       std::mutex mutex;
+       std::vector<RemoteFunctionBase*> functions;
+       uint32_t request;
+       uint32_t reply;
+     };
+
+     inline RemoteFunctions& remoteFunctions();
+
+     inline RemoteFunctionBase* remoteFunction(uint32_t id){
+       RemoteFunctions& r = remoteFunctions();
+       std::lock_guard<std::mutex> lock(r.mutex);
+       return id < r.functions.size() ? r.functions[id] : nullptr;
+     }
+
+     // run as a task of the pool, which may itself spawn remote calls and
+     // wait for them
+     inline void serveRemoteCall(int source, void* args, size_t size){
+       RemoteRequest request;
+       memcpy(&request, args, sizeof(request));
+
+       RemoteFunctionBase* f = remoteFunction(request.function);
+       assert(f && "remote call of a function this rank has not made");
+
+       std::vector<char> reply(sizeof(RemoteReply));
+       RemoteReply r = {request.state};
+       memcpy(reply.data(), &r, sizeof(r));
+
+       std::vector<char> result =
+         f->call(static_cast<const char*>(args) + sizeof(request));
+       reply.insert(reply.end(), result.begin(), result.end());
+
+       ares_spawn(source, remoteFunctions().reply, reply.data(),
+                  reply.size());
+     }
+
+     inline void answerRemoteCall(int source, void* args, size_t size){
+       RemoteReply reply;
+       memcpy(&reply, args, sizeof(reply));
+
+       auto s = reinterpret_cast<RemoteState*>(uintptr_t(reply.state));
+       auto p = static_cast<const char*>(args);
+       s->result.assign(p + sizeof(reply), p + size);
+
+       __ares_signal_synch(s->synch);
+     }
+
+     // the argument the runtime passes to a queued function
+     struct RemoteTaskArg{
+       void* synch;
+       uint32_t n;
+       void* args;
+     };
+
+     inline void runLocalCall(void* arg){
+       auto s = static_cast<RemoteState*>(
+         static_cast<RemoteTaskArg*>(arg)->args);
+
+       s->result = s->function->call(s->args.data());
+       __ares_finish_func(arg);
+     }
+
+     inline RemoteFunctions& remoteFunctions(){
+       static RemoteFunctions* r = []{
+         auto r = new RemoteFunctions;
+         r->request = ares_register_handler(serveRemoteCall);
+         r->reply = ares_register_handler(answerRemoteCall);
+         return r;
+       }();
+
+       return *r;
+     }
+
+   } // namespace detail
+
+   // the result of a RemoteFunction::spawn(), which arrives as an active
+   // message from the rank that made the call. get() waits for it, a
+   // worker running other tasks meanwhile, as it does awaiting a task.
+   // A future that is dropped first waits for it too.
+   template<typename R>
+   class RemoteFuture{
+   public:
+     explicit RemoteFuture(std::unique_ptr<detail::RemoteState> state)
+     : state_(std::move(state)){}
+
+     RemoteFuture(RemoteFuture&&) = default;
+
+     RemoteFuture& operator=(RemoteFuture&& f){
+       wait();
+       state_ = std::move(f.state_);
+       return *this;
+     }
+
+     ~RemoteFuture(){
+       wait();
+     }
+
+     void wait(){
+       if(state_ && state_->synch){
+         __ares_await_synch(state_->synch);
+         state_->synch = nullptr;
+       }
+     }
+
+     // the result, which can be taken once
+     R get(){
+       wait();
+       return get_(std::is_void<R>());
+     }
+
+   private:
+     R get_(std::false_type){
+       typename std::decay<R>::type r;
+       const char* p = state_->result.data();
+       detail::remoteUnpack(p, r);
+       return r;
+     }
+
+     void get_(std::true_type){}
+
+     std::unique_ptr<detail::RemoteState> state_;
+   };
+
+   // f made callable on any rank by the others with spawn(), e.g. to
+   // divide work across the group without sending and receiving it.
+   // Every rank makes its remote functions in the same order, before
+   // any of them is spawned, which has to hold for the first of them
+   // relative to the other ares_register_handler() calls too. A call to
+   // the calling rank runs as a task of its pool.
+   template<typename R, typename... Args>
+   class RemoteFunction : public detail::RemoteFunctionBase{
+   public:
+     explicit RemoteFunction(std::function<R(Args...)> f)
+     : f_(std::move(f)){
+       detail::RemoteFunctions& r = detail::remoteFunctions();
+       std::lock_guard<std::mutex> lock(r.mutex);
+       id_ = uint32_t(r.functions.size());
+       r.functions.push_back(this);
+     }
+
+     RemoteFunction(const RemoteFunction&) = delete;
+
+     RemoteFunction& operator=(const RemoteFunction&) = delete;
+
+     ~RemoteFunction(){
+       detail::RemoteFunctions& r = detail::remoteFunctions();
+       std::lock_guard<std::mutex> lock(r.mutex);
+       r.functions[id_] = nullptr;
+     }
+
+     // has rank call f(args...) and returns the future of its result
+     RemoteFuture<R> spawn(int rank, const Args&... args){
+       std::unique_ptr<detail::RemoteState> s(new detail::RemoteState);
+       s->synch = __ares_create_synch(1);
+
+       std::vector<char> buf;
+       int dummy[] = {0, (detail::remotePack(buf, args), 0)...};
+       (void)dummy;
+
+       if(ares_group_size() <= 1 || rank == ares_rank()){
+         s->function = this;
+         s->args = std::move(buf);
+
+         __ares_queue_func(s->synch, s.get(),
+                           reinterpret_cast<void*>(&detail::runLocalCall),
+                           0, static_cast<uint32_t>(Priority::Normal),
+                           nullptr);
+
+         return RemoteFuture<R>(std::move(s));
+       }
+
+       detail::RemoteRequest request = {id_, uint64_t(uintptr_t(s.get()))};
+
+       std::vector<char> msg(sizeof(request));
+       memcpy(msg.data(), &request, sizeof(request));
+       msg.insert(msg.end(), buf.begin(), buf.end());
+
+       ares_spawn(rank, detail::remoteFunctions().request, msg.data(),
+                  msg.size());
+
+       return RemoteFuture<R>(std::move(s));
+     }
+
+     std::vector<char> call(const char* args) override{
+       return call_(args, std::index_sequence_for<Args...>());
+     }
+
+   private:
+     template<size_t... I>
+     std::vector<char> call_(const char* args, std::index_sequence<I...>){
+       std::tuple<typename std::decay<Args>::type...> t;
+       int dummy[] = {0, (detail::remoteUnpack(args, std::get<I>(t)), 0)...};
+       (void)dummy;
+
+       return invoke_(t, std::index_sequence<I...>(), std::is_void<R>());
+     }
+
+     template<class T, size_t... I>
+     std::vector<char> invoke_(T& t, std::index_sequence<I...>,
+                               std::false_type){
+       std::vector<char> result;
+       detail::remotePack(result, f_(std::get<I>(t)...));
+       return result;
+     }
+
+     template<class T, size_t... I>
+     std::vector<char> invoke_(T& t, std::index_sequence<I...>,
+                               std::true_type){
+       f_(std::get<I>(t)...);
+       return std::vector<char>();
+     }
+
+     std::function<R(Args...)> f_;
+     uint32_t id_;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_REMOTE_H__
@@ -53,6 +53,10 @@
 #define __ARES_RUNTIME_H__
 
 #include <functional>
+#include <vector>
+#include <ostream>
+#include <string>
+#include <cstdint>
 
  namespace ares{
 
@@ -64,14 +68,693 @@
 
    bool ares_connect(const std::string& sendPath, const std::string& receivePath);
 
-   void ares_send(char* buf, size_t size);
+   // connects a group of groupSize processes through the directory dir,
+   // which they can all see, in place of listening and connecting, each
+   // has its rank set with ARES_RANK, see SocketCommunicator::bootstrap()
+   bool ares_bootstrap(const char* dir, size_t groupSize);
 
+   // receives from any rank
+   const int ARES_ANY_RANK = -1;
+
+   // the rank of this process in its group, set with ARES_RANK, otherwise
+   // a listener is 0 and assigns ranks to the peers that connect to it
+   int ares_rank();
+
+   // false if the send queue was full and ARES_SEND_FULL=fail or the
+   // handler of ares_on_send_full() failed it, buf is freed either way
+   bool ares_send(char* buf, size_t size);
+
+   // sends to the peer of rank, waiting until it has connected, with a
+   // tag that the receiver selects the message by
+   bool ares_send(int rank, uint32_t tag, char* buf, size_t size);
+
+   // the buffer is recycled by the runtime once it is passed to
+   // ares_release(), it must not be freed
    char* ares_receive(size_t& size);
 
+   // the next message sent with tag by rank, or by any rank with
+   // ARES_ANY_RANK, in the order that each rank sent them
+   char* ares_receive(int rank, uint32_t tag, size_t& size);
+
+   void ares_release(char* buf);
+
+   // sends buf, which the runtime takes over like with ares_send(), so
+   // that the receiver can read it in chunks as it arrives
+   bool ares_send_stream(char* buf, size_t size);
+
+   bool ares_send_stream(int rank, uint32_t tag, char* buf, size_t size);
+
+   // waits for the header of the next message and returns a handle that
+   // ares_stream_next() reads its body from, size is that of the body
+   void* ares_receive_stream(size_t& size);
+
+   void* ares_receive_stream(int rank, uint32_t tag, size_t& size);
+
+   // the next chunk of the body, valid until the next call, null once
+   // all of it has been read, which releases the stream
+   char* ares_stream_next(void* stream, size_t& size);
+
+   class CommRequest;
+
+   // sends size bytes of buf to rank without waiting for them to be
+   // written, buf stays the caller's and must not be changed until the
+   // request has completed, null if the send failed as with ares_send()
+   CommRequest* ares_isend(int rank, uint32_t tag, const char* buf,
+                           size_t size);
+
+   // a piece of a message that ares_isendv() writes from where it is
+   struct CommSegment{
+     const void* data;
+     size_t size;
+   };
+
+   // sends n segments as one message of their total size, each written
+   // with writev() or RDMA from the caller's memory, which must not be
+   // changed until the request has completed, as with ares_isend()
+   CommRequest* ares_isendv(int rank, uint32_t tag,
+                            const CommSegment* segments, size_t n);
+
+   // receives the next message from rank with tag, or from any rank with
+   // ARES_ANY_RANK, ahead of ares_receive()
+   CommRequest* ares_irecv(int rank, uint32_t tag);
+
+   // the same into size bytes of buf, which must not be touched until
+   // the request has completed, ares_wait() then returns buf itself. A
+   // raw message of ARES_RENDEZVOUS bytes or more is only sent once it
+   // has been matched and is read into buf as it arrives, a smaller one
+   // is copied. The sender holds such a message until then.
+   CommRequest* ares_recv_into(int rank, uint32_t tag, char* buf,
+                               size_t size);
+
+   // the same into fd, a file or socket, ares_wait() then returns null
+   // with the bytes that fd took. On a connection through named pipes
+   // a message sent by rendezvous is spliced to fd without passing
+   // through the process, others are written to it.
+   CommRequest* ares_recv_to_fd(int rank, uint32_t tag, int fd);
+
+   // true once the request has completed, for a stream that is once its
+   // header has arrived
+   bool ares_test(CommRequest* request);
+
+   // waits for the request and frees it, returning the received buffer,
+   // released with ares_release(), or null for a send
+   char* ares_wait(CommRequest* request, size_t& size);
+
+   // waits for n requests, bufs and sizes receive what ares_wait() would
+   // return and may be null if all of them are sends
+   void ares_waitall(size_t n, CommRequest** requests, char** bufs,
+                     size_t* sizes);
+
+   // queues func as a task once the request has completed, so that work
+   // on the data can start meanwhile, the request is still waited for
+   void ares_on_complete(CommRequest* request, std::function<void()> func);
+
+   // runs on the receiving rank as a task of its pool, args is valid until
+   // it returns
+   using ActiveHandler = void (*)(int source, void* args, size_t size);
+
+   // the id that ares_spawn() runs handler by, every rank has to register
+   // the same handlers in the same order
+   uint32_t ares_register_handler(ActiveHandler handler);
+
+   // has rank run the handler on a copy of the size bytes of args
+   void ares_spawn(int rank, uint32_t handler, const void* args, size_t size);
+
+   // runs on the progress thread that a message arrived on, so it must
+   // not block, buf is released once it returns
+   using InlineMessageHandler = void (*)(int source, uint32_t tag, char* buf,
+                                         size_t size);
+
+   // has handler take the messages with tag, sent other than as a stream,
+   // ahead of ares_irecv() and ares_receive(), saving the hand-off to
+   // the receiving thread, null removes it
+   void ares_on_message(uint32_t tag, InlineMessageHandler handler);
+
+   // ARES_SEND_QUEUE_BYTES and ARES_SEND_QUEUE_MESSAGES bound what is
+   // queued to each connection and not yet written, a send that would
+   // go over them waits for room, or with ARES_SEND_FULL=fail fails.
+   // The handler is called in place of either on the sending thread with
+   // what is queued to the rank, returning true to send anyway or false
+   // to fail the send, null removes it. Collectives and active messages
+   // always wait.
+   using SendFullHandler = bool (*)(int rank, size_t bytes, 
+                                    size_t messages);
+
+   void ares_on_send_full(SendFullHandler handler);
+
+   // the messages queued to rank and not yet written and their bytes
+   void ares_send_queue(int rank, size_t& bytes, size_t& messages);
+
+   // the group is made of the ranks 0 to groupSize - 1
    void ares_init_comm(size_t groupSize);
 
+   // the groupSize of ares_init_comm(), 1 before it or without peers
+   size_t ares_group_size();
+
    void ares_barrier();
 
+   // the two halves of ares_barrier(), the barrier makes progress in
+   // between, so work that does not depend on it can be done meanwhile
+   void ares_barrier_arrive();
+
+   void ares_barrier_wait();
+
+   // tags from here up are taken by the collectives
+   const uint32_t ARES_COLLECTIVE_TAG = 0xffff0000;
+
+   enum class CommType{
+     Int32,
+     UInt32,
+     Int64,
+     UInt64,
+     Float,
+     Double
+   };
+
+   enum class CommOp{
+     Sum,
+     Min,
+     Max
+   };
+
+   template<class T>
+   struct CommTypeOf;
+
+   template<> struct CommTypeOf<int32_t>{
+     static const CommType type = CommType::Int32;
+   };
+
+   template<> struct CommTypeOf<uint32_t>{
+     static const CommType type = CommType::UInt32;
+   };
+
+   template<> struct CommTypeOf<int64_t>{
+     static const CommType type = CommType::Int64;
+   };
+
+   template<> struct CommTypeOf<uint64_t>{
+     static const CommType type = CommType::UInt64;
+   };
+
+   template<> struct CommTypeOf<float>{
+     static const CommType type = CommType::Float;
+   };
+
+   template<> struct CommTypeOf<double>{
+     static const CommType type = CommType::Double;
+   };
+
+   // the collectives are called by every rank of the group in the same
+   // order, buf holds the size bytes of root on return
+   void ares_bcast(int root, void* buf, size_t size);
+
+   // reduces the count elements of buf across the group, in place
+   void ares_allreduce(void* buf, size_t count, CommType type, CommOp op);
+
+   template<class T>
+   void ares_allreduce(T* buf, size_t count, CommOp op){
+     ares_allreduce(buf, count, CommTypeOf<T>::type, op);
+   }
+
+   // out holds the size bytes of in from each rank, in rank order
+   void ares_allgather(const void* in, size_t size, void* out);
+
+   // a subset of the ranks with ranks of its own from 0, whose
+   // collectives are called by each of its members in the same order
+   class CommTeam;
+
+   // all of the ranks, in rank order
+   CommTeam* ares_team_world();
+
+   // collective over parent, each rank joins the team of the ranks of
+   // the same color, ranked by key then by rank in parent, or none and
+   // gets null if color is negative
+   CommTeam* ares_team_split(CommTeam* parent, int color, int key);
+
+   void ares_team_free(CommTeam* team);
+
+   int ares_team_rank(CommTeam* team);
+
+   int ares_team_size(CommTeam* team);
+
+   // the rank in the whole group of team rank rank
+   int ares_team_world_rank(CommTeam* team, int rank);
+
+   void ares_team_barrier(CommTeam* team);
+
+   // as the collectives of the whole group, with root a team rank
+   void ares_team_bcast(CommTeam* team, int root, void* buf, size_t size);
+
+   void ares_team_allreduce(CommTeam* team, void* buf, size_t count,
+                            CommType type, CommOp op);
+
+   template<class T>
+   void ares_team_allreduce(CommTeam* team, T* buf, size_t count,
+                            CommOp op){
+     ares_team_allreduce(team, buf, count, CommTypeOf<T>::type, op);
+   }
+
+   void ares_team_allgather(CommTeam* team, const void* in, size_t size,
+                            void* out);
+
+   // as ares_send() and ares_receive(), with rank a team rank
+   bool ares_team_send(CommTeam* team, int rank, uint32_t tag, char* buf,
+                       size_t size);
+
+   char* ares_team_receive(CommTeam* team, int rank, uint32_t tag,
+                           size_t& size);
+
+   // what a peer needs to access registered memory, passed to it in a
+   // message
+   struct RemoteMemoryKey{
+     uint64_t addr;
+     uint32_t rkey;
+   };
+
+   // makes buf available to ares_put() and ares_get() of the peers,
+   // registered with the adapter if there is one, the local buffers of
+   // those calls have to be registered too
+   bool ares_register_memory(void* buf, size_t size, RemoteMemoryKey& key);
+
+   void ares_deregister_memory(void* buf);
+
+   // writes size bytes of buf to offset in the memory of rank that key
+   // refers to, returning once they are there, with RDMA if rank is
+   // connected over verbs, otherwise the peer copies them
+   bool ares_put(int rank, const void* buf, size_t size,
+                 const RemoteMemoryKey& key, size_t offset);
+
+   bool ares_get(int rank, void* buf, size_t size,
+                 const RemoteMemoryKey& key, size_t offset);
+
+   // how the range of a distributed Forall is split across the group
+   enum class Partition : uint32_t{
+     // a contiguous block per rank, the first ones taking the remainder
+     Block,
+     // every groupSize-th iteration, starting at the rank's
+     Cyclic
+   };
+
+   // sets the contiguous share [rankStart, rankEnd) of rank
+   using Partitioner = void (*)(uint32_t start, uint32_t end, int rank,
+                                size_t groupSize, uint32_t& rankStart,
+                                uint32_t& rankEnd);
+
+   // a partitioner, if set, is used instead of the partition, and
+   // offsets, if set, instead of either, the share of rank r then being
+   // offsets[r] to offsets[r + 1] past the start of the range, as of a
+   // GraphPartition. ghost is how far outside of its share an iteration
+   // reads.
+   struct Distribution{
+     Partition partition;
+     Partitioner partitioner;
+     uint32_t ghost;
+     const uint32_t* offsets;
+   };
+
+   // the share of a rank, the iterations base + i * stride for i below
+   // count, and the range that they read, the share and its ghost cells
+   // clipped to the full range. A cyclic share reads all of it.
+   struct RangeShare{
+     uint32_t base;
+     uint32_t stride;
+     uint32_t count;
+     uint32_t readStart;
+     uint32_t readEnd;
+   };
+
+   RangeShare ares_share(const Distribution& distribution, uint32_t start,
+                         uint32_t end, int rank);
+
+   // the share of this process, all of the range without a communicator
+   RangeShare ares_share(const Distribution& distribution, uint32_t start,
+                         uint32_t end);
+
+   // the plan of an irregular Forall that the inspector made, the
+   // iterations reordered for locality and cut into chunks of about
+   // the same work, chunk c being order[chunks[c]] to
+   // order[chunks[c + 1]]. parallel_for() runs a plan.
+   struct IterationPlan{
+     std::vector<uint32_t> order;
+     std::vector<uint32_t> chunks;
+   };
+
+   // the plan of the n iterations of a Forall, iteration i of which
+   // reads the elements that neighbors names from offsets[i] to
+   // offsets[i + 1], or from i * arity to (i + 1) * arity. It is made on
+   // the first call for the arrays and returned from a cache on later
+   // ones, until ares_inspect_forget() is called after the connectivity
+   // changed.
+   const IterationPlan& ares_inspect(const uint32_t* offsets,
+                                     const uint32_t* neighbors, uint32_t n);
+
+   const IterationPlan& ares_inspect(const uint32_t* neighbors,
+                                     uint32_t arity, uint32_t n);
+
+   void ares_inspect_forget(const uint32_t* neighbors);
+
+   // a graph to split across the group, such as the cells of an
+   // unstructured mesh and their neighbors, in the layout of
+   // ares_inspect(): the neighbors of vertex v are neighbors[offsets[v]]
+   // to neighbors[offsets[v + 1]]. weights, if set, is the work of each
+   // vertex, and coords, for the partitioners that need them, dim
+   // coordinates per vertex.
+   struct PartitionGraph{
+     uint32_t n;
+     const uint32_t* offsets;
+     const uint32_t* neighbors;
+     const float* weights;
+     const double* coords;
+     uint32_t dim;
+   };
+
+   // assigns each vertex v of a graph a part[v] below parts. The same
+   // graph has to be given the same parts on every rank that partitions
+   // it.
+   class GraphPartitioner{
+   public:
+     virtual ~GraphPartitioner(){}
+
+     virtual void partition(const PartitionGraph& graph, uint32_t parts,
+                            uint32_t* part) = 0;
+   };
+
+   using PartitionerFactory = GraphPartitioner* (*)();
+
+   // makes a partitioner, such as an adapter of METIS or Scotch, known to
+   // ares_partition() as name. Built in are "block", runs of consecutive
+   // vertices, "rcb", recursive coordinate bisection, which needs the
+   // coordinates, and "multilevel", which cuts few edges.
+   void ares_register_partitioner(const char* name,
+                                  PartitionerFactory factory);
+
+   // a partition of a graph into a share per rank, the vertices being
+   // renumbered so that those of each rank are contiguous and keep their
+   // order. Vertex v is part[v]'s and becomes index[v], order[i] is the
+   // vertex that became i, and rank r's share is offsets[r] to
+   // offsets[r + 1] of the new numbering. cutEdges counts the neighbors
+   // of vertices that are in another share, imbalance is the heaviest
+   // share's weight over the mean.
+   struct GraphPartition{
+     std::vector<uint32_t> part;
+     std::vector<uint32_t> index;
+     std::vector<uint32_t> order;
+     std::vector<uint32_t> offsets;
+     uint64_t cutEdges;
+     double imbalance;
+   };
+
+   // partitions graph into parts shares, those of the group of
+   // ares_init_comm() if 0, with the partitioner name, by default that of
+   // ARES_PARTITIONER or else "multilevel". A Distribute of the result has
+   // a Forall over the renumbered vertices run each rank's share.
+   GraphPartition ares_partition(const PartitionGraph& graph,
+                                 const char* name=nullptr,
+                                 uint32_t parts=0);
+
+   // the renumbered vertices outside of the share of rank that its
+   // vertices have as neighbors, in order, which its halo exchange has
+   // to fetch
+   std::vector<uint32_t> ares_partition_halo(const PartitionGraph& graph,
+                                             const GraphPartition& partition,
+                                             int rank);
+
+   struct RuntimeWorkerStats{
+     uint64_t tasksExecuted;
+     uint64_t tasksPushed;
+     uint64_t stealAttempts;
+     uint64_t steals;
+     uint64_t remoteSteals;
+     int numaNode;
+     uint64_t peakQueueDepth;
+     double idleTime;
+     double busyTime;
+   };
+
+   // latency[i] counts the received messages taken by a receive or
+   // handler within 2^i microseconds of arriving, and more than 2^(i-1)
+   struct RuntimePeerStats{
+     int rank;
+     uint64_t messagesSent;
+     uint64_t bytesSent;
+     uint64_t messagesReceived;
+     uint64_t bytesReceived;
+     uint64_t queueDepth;
+     uint64_t queuedBytes;
+     uint64_t peakQueueDepth;
+     std::vector<uint64_t> latency;
+   };
+
+   // hardware counters of one region's outlined body, summed over the
+   // threads that ran it, with ARES_PERF_COUNTERS. The name is that of
+   // its construct and source location when HLIR passed a region
+   // descriptor, else that of the body's symbol, or its address.
+   struct RuntimeRegionStats{
+     std::string name;
+     uint64_t calls;
+     double time;
+     uint64_t cycles;
+     uint64_t instructions;
+     uint64_t cacheReferences;
+     uint64_t cacheMisses;
+     // the workers that ARES_THROTTLE has it run on, 0 if not throttled
+     uint32_t workers;
+   };
+
+   // the large blocks of __ares_alloc() that are mapped on their own,
+   // see ARES_HUGE_PAGES and ARES_MLOCK, those of them that came from
+   // hugetlbfs or fell back from it to transparent huge pages, and the
+   // anonymous memory that the kernel backs with transparent huge pages
+   // in the whole process, which confirms that madvise() got them
+   struct RuntimeAllocatorStats{
+     uint64_t mappedBlocks;
+     uint64_t mappedBytes;
+     uint64_t hugetlbBytes;
+     uint64_t hugetlbFallbacks;
+     uint64_t lockedBytes;
+     uint64_t transparentHugeBytes;
+   };
+
+   // the bytes in use of the runtime's own allocations: the descriptors
+   // of queued tasks, the frames of spawned task calls, the buffers of
+   // __ares_alloc() such as reduction partials, message buffers and the
+   // stacks of user level threads. Each thread's share lags by up to 64
+   // KB. peak is that of their sum, limit the soft limit on it, 0 if
+   // none, and inlinedSpawns the task calls that a limit had run inline.
+   struct RuntimeMemoryStats{
+     uint64_t queueItems;
+     uint64_t taskFrames;
+     uint64_t partials;
+     uint64_t messages;
+     uint64_t stacks;
+     uint64_t peak;
+     uint64_t limit;
+     uint64_t inlinedSpawns;
+   };
+
+   // a phase of ares_region_begin(): how many times it ended, the
+   // seconds between its begins and ends on the threads that marked it,
+   // and those of the tasks and Forall chunks queued inside it, summed
+   // over the threads that ran them
+   struct RuntimeUserRegionStats{
+     std::string name;
+     uint64_t calls;
+     double time;
+     double work;
+   };
+
+   struct RuntimeStats{
+     std::vector<RuntimeWorkerStats> workers;
+     uint64_t externalPushes;
+     std::vector<RuntimePeerStats> peers;
+     std::vector<RuntimeRegionStats> regions;
+     std::vector<RuntimeUserRegionStats> userRegions;
+     RuntimeAllocatorStats allocator;
+     RuntimeMemoryStats memory;
+   };
+
+   // snapshot of the worker pool counters, empty if the pool has not
+   // been started, of the traffic with each peer and of the counters of
+   // each region, slowest first. Setting ARES_STATS
+   // prints them at exit, ARES_STATS_INTERVAL every that many seconds.
+   // ARES_METRICS serves them in the Prometheus text format on a port of
+   // the loopback interface, or a unix socket as unix:path, where %p in
+   // path is the pid.
+   RuntimeStats ares_runtime_stats();
+
+   void ares_print_runtime_stats(std::ostream& ostr);
+
+   // marks a phase of the application, such as "assemble" or "solve",
+   // until the matching end on the same thread. Phases nest, and the
+   // tasks and Foralls started inside one count towards it on whichever
+   // threads run them. ARES_TRACE shows them as spans, and with
+   // ARES_STATS, ARES_STATS_INTERVAL or ARES_METRICS they are timed in
+   // the stats. A call costs a few ns, most of all with a name whose
+   // pointer, as that of a string literal, stays the same.
+   void ares_region_begin(const char* name);
+
+   void ares_region_end();
+
+   // a phase for the scope of the object
+   class ScopedRegion{
+   public:
+     ScopedRegion(const char* name){
+       ares_region_begin(name);
+     }
+
+     ~ScopedRegion(){
+       ares_region_end();
+     }
+
+     ScopedRegion(const ScopedRegion&) = delete;
+
+     ScopedRegion& operator=(const ScopedRegion&) = delete;
+   };
+
+   enum class MemoryCategory : uint32_t{
+     QueueItems,
+     TaskFrames,
+     Partials,
+     Messages,
+     Stacks
+   };
+
+   // a soft limit on the bytes of RuntimeMemoryStats, in total or of one
+   // category, 0 lifts it. Once one is reached, task calls run inline
+   // in their caller instead of being spawned, until the runtime's
+   // memory is back under it. ARES_MEMORY_LIMIT sets the total's, in
+   // bytes or with a k, m or g suffix.
+   void ares_set_memory_limit(uint64_t bytes);
+
+   void ares_set_memory_limit(MemoryCategory category, uint64_t bytes);
+
+   // opens a group on the calling thread, which the task calls it spawns
+   // until the matching wait join, that returns once all of them have
+   // completed. Groups nest, each is waited for once.
+   void* ares_task_group_begin();
+
+   void ares_task_group_wait(void* group);
+
+   // drops the results kept for the calls of memoized tasks, and returns
+   // how many there were, so that the calls made from then on run again,
+   // as they must once the memory a memoized task reads through its
+   // pointer arguments has changed. Calls still running complete for
+   // the callers that share them.
+   size_t ares_task_memo_clear();
+
+   // waits for the lowered construct whose synch *handle holds, if any,
+   // and clears it
+   void ares_wait_completion(void** handle);
+
+   // the number of workers of the pool, which this starts, and the
+   // index of the calling one among them, -1 on any other thread
+   size_t ares_num_workers();
+
+   int ares_worker_index();
+
+   // has the first n of the workers, at least one and at most
+   // ares_num_workers(), take part in what is queued from now on and
+   // returns how many do. The others park, without holding a core, once
+   // nothing queued is left for them, and rejoin when n grows again.
+   // Backends that cannot be resized keep all of their workers.
+   size_t ares_set_num_workers(size_t n);
+
+   // the workers that take part, which the ranges are split across
+   size_t ares_active_workers();
+
+   // the arena of that name, created with a pool of maxConcurrency
+   // workers of its own, 0 for one per CPU, on the first call. The
+   // Foralls, reductions and tasks of a thread that entered it are
+   // queued to its pool, as are all that its workers queue, so they
+   // never contend with those of another arena. priority is that of an
+   // ares::Priority, a low one making the arena's workers nicer to the
+   // rest of the process. Arenas last until the process exits.
+   void* ares_arena(const std::string& name, size_t maxConcurrency,
+                    uint32_t priority);
+
+   // has the calling thread queue its constructs to arena, or to the
+   // pool that it is a worker of or the default one if that is null,
+   // and returns the arena it was in
+   void* ares_arena_enter(void* arena);
+
+   // queues f(arg) to arena without entering it
+   void ares_arena_enqueue(void* arena, void (*f)(void*), void* arg,
+                           uint32_t priority);
+
+   size_t ares_arena_max_concurrency(void* arena);
+
+   // the position of the calling thread's scratch arena, the blocks
+   // taken after it are given back by releasing it
+   uint64_t ares_scratch_mark();
+
+   void ares_scratch_release(uint64_t mark);
+
+   // copies bytes at ptr to the GPU for Foralls compiled with
+   // -mllvm -ares-offload, false if there is no device. Offloaded
+   // Foralls only run on the device when every pointer they capture lies
+   // in a mapped array, and the host copy is only current again once the
+   // array is unmapped or updated.
+   bool ares_offload_map(void* ptr, size_t bytes);
+
+   // copies the array back to ptr and releases the device copy
+   void ares_offload_unmap(void* ptr);
+
+   void ares_offload_update_host(void* ptr);
+
+   void ares_offload_update_device(void* ptr);
+
+   // how the offloaded Foralls of a data region use an array: In is
+   // copied to the device as the region begins, Out back to the host
+   // as it ends, Scratch neither
+   enum class OffloadAccess : uint32_t{
+     Scratch = 0,
+     In = 1,
+     Out = 2,
+     InOut = 3
+   };
+
+   // enters the bytes at ptr into a data region, where they stay on the
+   // device for the offloaded Foralls until ares_offload_exit(), false
+   // if there is no device or it is mapped already. The copy to the
+   // device is only started, each array's on a stream of its own, and a
+   // Forall waits for those of the arrays it captures alone, so the
+   // copies overlap with each other and with the kernels on other
+   // arrays. The host copy must not be touched until it has exited.
+   bool ares_offload_enter(void* ptr, size_t bytes, OffloadAccess access);
+
+   // maps the bytes at ptr into the device's address space without
+   // copying them, false if there is no device or it is mapped already.
+   // An offloaded Forall whose arrays are all shared is split between
+   // the GPU and the host's workers, in the proportion of the rates each
+   // last ran it at, while one that captures an entered or mapped array
+   // runs on the GPU alone. The host copy stays current, it is released
+   // with ares_offload_exit() and ares_offload_wait().
+   bool ares_offload_share(void* ptr, size_t bytes);
+
+   // starts copying an entered array back for Out, the device copy is
+   // released and the host copy current once ares_offload_wait() returns
+   void ares_offload_exit(void* ptr);
+
+   // waits for the copies of an entered or exited array
+   void ares_offload_wait(void* ptr);
+
+   // writes a copy of the bytes at data to path on the runtime's I/O
+   // threads, compressed with zstd when compress is set and the runtime
+   // was built with it. data may be written again as soon as this
+   // returns. The handle is waited on once with ares_snapshot_wait(),
+   // which is false if the write failed.
+   void* ares_snapshot(const void* data, size_t bytes,
+                       const std::string& path, bool compress=false);
+
+   bool ares_snapshot_ready(void* snapshot);
+
+   bool ares_snapshot_wait(void* snapshot);
+
+   // reads a snapshot of exactly bytes back into data, false if path
+   // holds none of that size
+   bool ares_snapshot_read(const std::string& path, void* data,
+                           size_t bytes);
+
  } // namespace ares
  
 #endif // __ARES_RUNTIME_H__
@@ -0,0 +1,283 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+
+#ifndef __ARES_SERIALIZE_H__
+#define __ARES_SERIALIZE_H__
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ares/runtime.h"
+
+ namespace ares{
+
+   // a typed array inside a received message, valid while its
+   // MessageReader is
+   template<class T>
+   class MessageView{
+   public:
+     MessageView(const T* data=nullptr, size_t size=0)
+     : data_(data),
+     size_(size){}
+
+     const T* data() const{
+       return data_;
+     }
+
+     size_t size() const{
+       return size_;
+     }
+
+     const T& operator[](size_t i) const{
+       return data_[i];
+     }
+
+     const T* begin() const{
+       return data_;
+     }
+
+     const T* end() const{
+       return data_ + size_;
+     }
+
+   private:
+     const T* data_;
+     size_t size_;
+   };
+
+   // gathers trivially copyable values, arrays and strings into one
+   // message without packing them into a buffer first. Arrays of at
+   // least COPY_SIZE bytes are written from the caller's memory, the rest
+   // is copied into the writer, and each element is aligned within the
+   // message so that a MessageReader can view arrays in place. The
+   // writer, and what it references, must stay until the send completes.
+   class MessageWriter{
+   public:
+     static const size_t COPY_SIZE = 256;
+
+     template<class T>
+     MessageWriter& operator<<(const T& value){
+       static_assert(std::is_trivially_copyable<T>::value,
+                     "only trivially copyable values are sent as they are");
+       align_(alignof(T));
+       copy_(&value, sizeof(T));
+       return *this;
+     }
+
+     template<class T>
+     MessageWriter& operator<<(const std::vector<T>& v){
+       return write(v.data(), v.size());
+     }
+
+     MessageWriter& operator<<(const std::string& s){
+       return write(s.data(), s.size());
+     }
+
+     // n elements preceded by their count, read back with view() or into
+     // a vector
+     template<class T>
+     MessageWriter& write(const T* data, size_t n){
+       static_assert(std::is_trivially_copyable<T>::value,
+                     "only trivially copyable arrays are sent as they are");
+       *this << uint64_t(n);
+       align_(alignof(T));
+
+       size_t bytes = n * sizeof(T);
+       if(bytes >= COPY_SIZE){
+         pieces_.push_back({reinterpret_cast<const char*>(data), 0, bytes});
+         size_ += bytes;
+       }
+       else{
+         copy_(data, bytes);
+       }
+       return *this;
+     }
+
+     uint64_t size() const{
+       return size_;
+     }
+
+     CommRequest* isend(int rank, uint32_t tag){
+       std::vector<CommSegment> segments;
+       segments.reserve(pieces_.size());
+
+       for(const Piece& p : pieces_){
+         const char* data = p.data ? p.data : staged_.data() + p.offset;
+         segments.push_back({data, p.size});
+       }
+
+       return ares_isendv(rank, tag, segments.data(), segments.size());
+     }
+
+     void send(int rank, uint32_t tag){
+       size_t n;
+       ares_wait(isend(rank, tag), n);
+     }
+
+   private:
+     // referenced memory, or null for the bytes at offset in staged_
+     struct Piece{
+       const char* data;
+       size_t offset;
+       size_t size;
+     };
+
+     void align_(size_t alignment){
+       static const char zeros[alignof(std::max_align_t)] = {};
+       size_t pad = (alignment - size_ % alignment) % alignment;
+       copy_(zeros, pad);
+     }
+
+     // extends the last piece if it is staged too
+     void copy_(const void* data, size_t bytes){
+       if(bytes == 0){
+         return;
+       }
+
+       if(pieces_.empty() || pieces_.back().data){
+         pieces_.push_back({nullptr, staged_.size(), 0});
+       }
+
+       auto p = static_cast<const char*>(data);
+       staged_.insert(staged_.end(), p, p + bytes);
+       pieces_.back().size += bytes;
+       size_ += bytes;
+     }
+
+     std::vector<char> staged_;
+     std::vector<Piece> pieces_;
+     uint64_t size_ = 0;
+   };
+
+   // reads what a MessageWriter sent, in the same order, from the pooled
+   // buffer of the received message, which it releases when it goes
+   class MessageReader{
+   public:
+     MessageReader(int rank, uint32_t tag)
+     : buf_(ares_receive(rank, tag, size_)){}
+
+     explicit MessageReader(CommRequest* request)
+     : buf_(ares_wait(request, size_)){}
+
+     MessageReader(const MessageReader&) = delete;
+
+     MessageReader& operator=(const MessageReader&) = delete;
+
+     ~MessageReader(){
+       if(buf_){
+         ares_release(buf_);
+       }
+     }
+
+     template<class T>
+     MessageReader& operator>>(T& value){
+       static_assert(std::is_trivially_copyable<T>::value,
+                     "only trivially copyable values are sent as they are");
+       align_(alignof(T));
+       memcpy(&value, take_(sizeof(T)), sizeof(T));
+       return *this;
+     }
+
+     template<class T>
+     MessageReader& operator>>(std::vector<T>& v){
+       MessageView<T> a = view<T>();
+       v.assign(a.begin(), a.end());
+       return *this;
+     }
+
+     MessageReader& operator>>(std::string& s){
+       MessageView<char> a = view<char>();
+       s.assign(a.begin(), a.end());
+       return *this;
+     }
+
+     // the next array, without copying it
+     template<class T>
+     MessageView<T> view(){
+       uint64_t n;
+       *this >> n;
+       align_(alignof(T));
+       return MessageView<T>(
+         reinterpret_cast<const T*>(take_(n * sizeof(T))), n);
+     }
+
+     size_t remaining() const{
+       return size_ - pos_;
+     }
+
+   private:
+     void align_(size_t alignment){
+       take_((alignment - pos_ % alignment) % alignment);
+     }
+
+     const char* take_(size_t bytes){
+       assert(bytes <= size_ - pos_ && "read past the end of the message");
+       const char* p = buf_ + pos_;
+       pos_ += bytes;
+       return p;
+     }
+
+     size_t size_ = 0;
+     char* buf_;
+     size_t pos_ = 0;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_SERIALIZE_H__
@@ -0,0 +1,329 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_SOA_H__
+#define __ARES_SOA_H__
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "ares/parallel.h"
+
+extern "C"{
+  void* __ares_alloc_aligned(uint64_t bytes, uint64_t align);
+  void __ares_free(void* ptr);
+}
+
+// ARES_SOA(T, field, ...) describes the fields of the struct T to
+// soa_vector, at global scope and with T fully qualified, e.g.
+//
+//   struct Particle{ double x, y, vx, vy; int cell; };
+//   ARES_SOA(Particle, x, y, vx, vy, cell)
+//
+// which generates the soa_traits<T> that the container is built on. Up
+// to 16 fields are supported, and T is default constructible and
+// trivially copyable.
+
+#define ARES_SOA_NARGS_(...) ARES_SOA_NARGS_I_(__VA_ARGS__, 16, 15, 14, \
+  13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define ARES_SOA_NARGS_I_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, \
+  _12, _13, _14, _15, _16, N, ...) N
+
+#define ARES_SOA_CAT_(a, b) ARES_SOA_CAT_I_(a, b)
+#define ARES_SOA_CAT_I_(a, b) a##b
+
+#define ARES_SOA_EACH_(M, T, ...) \
+  ARES_SOA_CAT_(ARES_SOA_EACH_, ARES_SOA_NARGS_(__VA_ARGS__))(M, T, \
+    __VA_ARGS__)
+#define ARES_SOA_EACH_1(M, T, a) M(T, a)
+#define ARES_SOA_EACH_2(M, T, a, ...) M(T, a) ARES_SOA_EACH_1(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_3(M, T, a, ...) M(T, a) ARES_SOA_EACH_2(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_4(M, T, a, ...) M(T, a) ARES_SOA_EACH_3(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_5(M, T, a, ...) M(T, a) ARES_SOA_EACH_4(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_6(M, T, a, ...) M(T, a) ARES_SOA_EACH_5(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_7(M, T, a, ...) M(T, a) ARES_SOA_EACH_6(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_8(M, T, a, ...) M(T, a) ARES_SOA_EACH_7(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_9(M, T, a, ...) M(T, a) ARES_SOA_EACH_8(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_10(M, T, a, ...) M(T, a) \
+  ARES_SOA_EACH_9(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_11(M, T, a, ...) M(T, a) \
+  ARES_SOA_EACH_10(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_12(M, T, a, ...) M(T, a) \
+  ARES_SOA_EACH_11(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_13(M, T, a, ...) M(T, a) \
+  ARES_SOA_EACH_12(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_14(M, T, a, ...) M(T, a) \
+  ARES_SOA_EACH_13(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_15(M, T, a, ...) M(T, a) \
+  ARES_SOA_EACH_14(M, T, __VA_ARGS__)
+#define ARES_SOA_EACH_16(M, T, a, ...) M(T, a) \
+  ARES_SOA_EACH_15(M, T, __VA_ARGS__)
+
+#define ARES_SOA_PTR_(T, f) decltype(T::f)* f;
+#define ARES_SOA_REF_(T, f) decltype(T::f)& f;
+#define ARES_SOA_CREF_(T, f) const decltype(T::f)& f;
+#define ARES_SOA_AT_(T, f) a.f[i],
+#define ARES_SOA_SET_(T, f) f = v.f;
+#define ARES_SOA_GET_(T, f) v.f = f;
+#define ARES_SOA_APPLY_(T, f) fn(a.f, b.f);
+
+#define ARES_SOA(T, ...) \
+  namespace ares{ \
+    template<> \
+    struct soa_traits<T>{ \
+      struct arrays{ \
+        ARES_SOA_EACH_(ARES_SOA_PTR_, T, __VA_ARGS__) \
+      }; \
+      struct const_ref{ \
+        ARES_SOA_EACH_(ARES_SOA_CREF_, T, __VA_ARGS__) \
+        operator T() const{ \
+          T v; \
+          ARES_SOA_EACH_(ARES_SOA_GET_, T, __VA_ARGS__) \
+          return v; \
+        } \
+      }; \
+      struct ref{ \
+        ARES_SOA_EACH_(ARES_SOA_REF_, T, __VA_ARGS__) \
+        ref& operator=(const T& v){ \
+          ARES_SOA_EACH_(ARES_SOA_SET_, T, __VA_ARGS__) \
+          return *this; \
+        } \
+        ref& operator=(const ref& r){ \
+          return *this = T(r); \
+        } \
+        operator T() const{ \
+          T v; \
+          ARES_SOA_EACH_(ARES_SOA_GET_, T, __VA_ARGS__) \
+          return v; \
+        } \
+      }; \
+      static ref at(arrays& a, size_t i){ \
+        return ref{ARES_SOA_EACH_(ARES_SOA_AT_, T, __VA_ARGS__)}; \
+      } \
+      static const_ref at(const arrays& a, size_t i){ \
+        return const_ref{ARES_SOA_EACH_(ARES_SOA_AT_, T, __VA_ARGS__)}; \
+      } \
+      template<typename F> \
+      static void each(arrays& a, arrays& b, F&& fn){ \
+        ARES_SOA_EACH_(ARES_SOA_APPLY_, T, __VA_ARGS__) \
+      } \
+    }; \
+  }
+
+ namespace ares{
+
+   // specialized by ARES_SOA()
+   template<typename T>
+   struct soa_traits;
+
+   // a vector of T that stores each field of T in an array of its own,
+   // so that a Forall that reads a few of the fields of a large struct
+   // loads only those. p[i] is a proxy of references into the arrays,
+   // p[i].x reads and writes element i of the array of x, which after
+   // inlining is a unit-stride access the vectorizer can widen.
+   // data().x is that array. Arrays are cache-line aligned, and resize()
+   // first touches new elements with the static schedule of a Forall.
+   template<typename T>
+   class soa_vector{
+   public:
+     static_assert(std::is_trivially_copyable<T>::value,
+                   "the fields of a soa_vector are copied as bytes");
+
+     using traits = soa_traits<T>;
+     using arrays = typename traits::arrays;
+     using reference = typename traits::ref;
+     using const_reference = typename traits::const_ref;
+
+     static const size_t CACHE_LINE = 64;
+
+     soa_vector()
+     : size_(0),
+     capacity_(0){
+       each_([](auto& p, auto&){
+         p = nullptr;
+       });
+     }
+
+     explicit soa_vector(size_t n, const T& value=T())
+     : soa_vector(){
+       resize(n, value);
+     }
+
+     soa_vector(soa_vector&& v)
+     : soa_vector(){
+       swap(v);
+     }
+
+     ~soa_vector(){
+       each_([](auto& p, auto&){
+         __ares_free(p);
+       });
+     }
+
+     soa_vector(const soa_vector&) = delete;
+
+     soa_vector& operator=(const soa_vector&) = delete;
+
+     soa_vector& operator=(soa_vector&& v){
+       swap(v);
+       return *this;
+     }
+
+     void swap(soa_vector& v){
+       traits::each(arrays_, v.arrays_, [](auto& p, auto& q){
+         std::swap(p, q);
+       });
+
+       std::swap(size_, v.size_);
+       std::swap(capacity_, v.capacity_);
+     }
+
+     size_t size() const{
+       return size_;
+     }
+
+     size_t capacity() const{
+       return capacity_;
+     }
+
+     bool empty() const{
+       return size_ == 0;
+     }
+
+     arrays& data(){
+       return arrays_;
+     }
+
+     const arrays& data() const{
+       return arrays_;
+     }
+
+     reference operator[](size_t i){
+       return traits::at(arrays_, i);
+     }
+
+     const_reference operator[](size_t i) const{
+       return traits::at(arrays_, i);
+     }
+
+     void reserve(size_t n){
+       if(n <= capacity_){
+         return;
+       }
+
+       size_t size = size_;
+
+       each_([&](auto& p, auto&){
+         using U = typename std::remove_reference<decltype(*p)>::type;
+
+         auto q = static_cast<U*>(
+           __ares_alloc_aligned(n * sizeof(U), CACHE_LINE));
+         if(!q){
+           throw std::bad_alloc();
+         }
+
+         if(p){
+           memcpy(q, p, size * sizeof(U));
+           __ares_free(p);
+         }
+
+         p = q;
+       });
+
+       capacity_ = n;
+     }
+
+     void resize(size_t n, const T& value=T()){
+       if(n > capacity_){
+         reserve(n);
+       }
+
+       if(n > size_){
+         arrays& a = arrays_;
+         parallel_for(uint32_t(size_), uint32_t(n), [&](uint32_t i){
+           traits::at(a, i) = value;
+         }, schedule::static_());
+       }
+
+       size_ = n;
+     }
+
+     void push_back(const T& value){
+       if(size_ == capacity_){
+         reserve(capacity_ == 0 ? 16 : capacity_ * 2);
+       }
+
+       traits::at(arrays_, size_++) = value;
+     }
+
+     void clear(){
+       size_ = 0;
+     }
+
+   private:
+     arrays arrays_;
+     size_t size_;
+     size_t capacity_;
+
+     template<typename F>
+     void each_(F&& f){
+       traits::each(arrays_, arrays_, f);
+     }
+   };
+
+ } // namespace ares
+
+#endif // __ARES_SOA_H__
@@ -0,0 +1,405 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_SPARSE_H__
+#define __ARES_SPARSE_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "ares/parallel.h"
+
+ namespace ares{
+
+   // sparse matrix kernels on the pool of the runtime, for matrices whose
+   // rows are too skewed for a Forall over the rows: a few rows of
+   // millions of nonzeros or many empty ones would leave the workers that
+   // get the short rows idle. The CSR kernels instead cut the merge of
+   // the row ends with the nonzeros into partitions of equal length
+   // (merge-path), so that each does about as much work whatever the
+   // lengths of its rows, and a row that is split between partitions is
+   // finished from the partials they carry out. The ELL kernels are for
+   // rows of nearly the same length, whose slots they run unit stride.
+   // Sizes are of fewer than 2^32 rows and nonzeros.
+
+   // the fewest rows plus nonzeros that a partition is given
+   const uint32_t SPARSE_GRAIN = 1 << 12;
+
+   // the rows that an ELL kernel runs per chunk
+   const uint32_t SPARSE_ELL_BLOCK = 1 << 10;
+
+   // compressed sparse rows: the nonzeros of row r are those of
+   // columns and values in [offsets[r], offsets[r + 1]), which has
+   // rows + 1 entries
+   template<typename T>
+   struct CsrMatrix{
+     uint32_t rows = 0;
+     uint32_t cols = 0;
+     std::vector<uint32_t> offsets;
+     std::vector<uint32_t> columns;
+     std::vector<T> values;
+
+     uint32_t nnz() const{
+       return uint32_t(columns.size());
+     }
+   };
+
+   // ELLPACK: each row padded to width slots, slot s of row r at
+   // s * rows + r so that a slot of consecutive rows is contiguous. The
+   // padding is of value 0 and column 0.
+   template<typename T>
+   struct EllMatrix{
+     uint32_t rows = 0;
+     uint32_t cols = 0;
+     uint32_t width = 0;
+     std::vector<uint32_t> columns;
+     std::vector<T> values;
+   };
+
+   // a in ELL, padded to its longest row, which is as much larger than a
+   // as that row is longer than its average one
+   template<typename T>
+   EllMatrix<T> to_ell(const CsrMatrix<T>& a){
+     EllMatrix<T> e;
+     e.rows = a.rows;
+     e.cols = a.cols;
+
+     for(uint32_t r = 0; r < a.rows; ++r){
+       e.width = std::max(e.width, a.offsets[r + 1] - a.offsets[r]);
+     }
+
+     size_t size = size_t(e.width) * a.rows;
+     e.columns.assign(size, 0);
+     e.values.assign(size, T());
+
+     for(uint32_t r = 0; r < a.rows; ++r){
+       size_t s = r;
+       for(uint32_t i = a.offsets[r]; i < a.offsets[r + 1]; ++i){
+         e.columns[s] = a.columns[i];
+         e.values[s] = a.values[i];
+         s += a.rows;
+       }
+     }
+
+     return e;
+   }
+
+   namespace detail{
+
+     // the point of the merge path of a CSR matrix on diagonal d: the
+     // rows it has finished and the nonzeros it has consumed, their sum
+     // being d. A row is finished once all of its nonzeros are consumed.
+     struct MergePoint{
+       uint32_t row;
+       uint32_t nz;
+     };
+
+     inline MergePoint mergePoint(const uint32_t* offsets, uint32_t rows,
+                                  uint32_t nnz, uint64_t d){
+       uint64_t lo = d > nnz ? d - nnz : 0;
+       uint64_t hi = std::min(d, uint64_t(rows));
+
+       // the fewest rows whose next row end is past the nonzeros left
+       while(lo < hi){
+         uint64_t mid = (lo + hi)/2;
+         if(offsets[mid + 1] <= d - mid - 1){
+           lo = mid + 1;
+         }
+         else{
+           hi = mid;
+         }
+       }
+
+       return {uint32_t(lo), uint32_t(d - lo)};
+     }
+
+     // a few per worker, each of at least SPARSE_GRAIN
+     inline uint32_t numPartitions(uint64_t length){
+       uint64_t perWorker = uint64_t(ares_num_workers()) * 4;
+       uint64_t parts = std::min(perWorker, length/SPARSE_GRAIN);
+       return uint32_t(parts > 0 ? parts : 1);
+     }
+
+     // the sum of values[i] * x[columns[i]] over [begin, end), in four
+     // partials so that the products do not wait on one add each and
+     // the compiler can widen them into gathers where there are any
+     template<typename T>
+     inline T dot(const T* __restrict values,
+                  const uint32_t* __restrict columns,
+                  const T* __restrict x, uint32_t begin, uint32_t end){
+       T s0 = T();
+       T s1 = T();
+       T s2 = T();
+       T s3 = T();
+
+       uint32_t i = begin;
+       for(; i + 4 <= end; i += 4){
+         s0 += values[i] * x[columns[i]];
+         s1 += values[i + 1] * x[columns[i + 1]];
+         s2 += values[i + 2] * x[columns[i + 2]];
+         s3 += values[i + 3] * x[columns[i + 3]];
+       }
+
+       for(; i < end; ++i){
+         s0 += values[i] * x[columns[i]];
+       }
+
+       return (s0 + s1) + (s2 + s3);
+     }
+
+     // y[0, k) = the sum of values[i] * x[columns[i] * k, + k) over
+     // [begin, end), unit stride in k
+     template<typename T>
+     inline void axpyRows(T* __restrict y, const T* __restrict values,
+                          const uint32_t* __restrict columns,
+                          const T* __restrict x, uint32_t begin,
+                          uint32_t end, uint32_t k){
+       for(uint32_t j = 0; j < k; ++j){
+         y[j] = T();
+       }
+
+       for(uint32_t i = begin; i < end; ++i){
+         T v = values[i];
+         const T* __restrict xr = x + size_t(columns[i]) * k;
+         for(uint32_t j = 0; j < k; ++j){
+           y[j] += v * xr[j];
+         }
+       }
+     }
+
+   } // end namespace detail
+
+   // y = a x, x of a.cols and y of a.rows elements
+   template<typename T>
+   void spmv(const CsrMatrix<T>& a, const T* x, T* y){
+     uint32_t rows = a.rows;
+     uint32_t nnz = a.nnz();
+     const uint32_t* offsets = a.offsets.data();
+     const uint32_t* columns = a.columns.data();
+     const T* values = a.values.data();
+
+     uint64_t length = uint64_t(rows) + nnz;
+     uint32_t numParts = detail::numPartitions(length);
+
+     // the row that each partition leaves unfinished and its partial
+     std::vector<uint32_t> carryRows(numParts);
+     std::vector<T> carries(numParts);
+
+     auto partition = [&](uint32_t p){
+       detail::MergePoint b =
+         detail::mergePoint(offsets, rows, nnz, length * p/numParts);
+       detail::MergePoint e =
+         detail::mergePoint(offsets, rows, nnz, length * (p + 1)/numParts);
+
+       uint32_t nz = b.nz;
+       for(uint32_t r = b.row; r < e.row; ++r){
+         uint32_t end = offsets[r + 1];
+         y[r] = detail::dot(values, columns, x, nz, end);
+         nz = end;
+       }
+
+       carryRows[p] = e.row;
+       carries[p] = detail::dot(values, columns, x, nz, e.nz);
+     };
+
+     if(numParts == 1){
+       partition(0);
+     }
+     else{
+       parallel_for(0, numParts, partition, schedule::dynamic(1));
+     }
+
+     // a row is written by the partition that finishes it, those before
+     // it that it spans add what they carried
+     for(uint32_t p = 0; p < numParts; ++p){
+       if(carryRows[p] < rows){
+         y[carryRows[p]] += carries[p];
+       }
+     }
+   }
+
+   // y = a x for k vectors, x of a.cols x k and y of a.rows x k elements,
+   // both row-major
+   template<typename T>
+   void spmm(const CsrMatrix<T>& a, const T* x, T* y, uint32_t k){
+     uint32_t rows = a.rows;
+     uint32_t nnz = a.nnz();
+     const uint32_t* offsets = a.offsets.data();
+     const uint32_t* columns = a.columns.data();
+     const T* values = a.values.data();
+
+     // as many partitions as the k products of each nonzero call for,
+     // cut along the same merge path as spmv()
+     uint64_t length = uint64_t(rows) + uint64_t(nnz) * k;
+     uint32_t numParts = detail::numPartitions(length);
+     uint64_t pathLength = uint64_t(rows) + nnz;
+
+     std::vector<uint32_t> carryRows(numParts);
+     std::vector<T> carries(size_t(numParts) * k);
+
+     auto partition = [&](uint32_t p){
+       detail::MergePoint b =
+         detail::mergePoint(offsets, rows, nnz, pathLength * p/numParts);
+       detail::MergePoint e = detail::mergePoint(
+         offsets, rows, nnz, pathLength * (p + 1)/numParts);
+
+       uint32_t nz = b.nz;
+       for(uint32_t r = b.row; r < e.row; ++r){
+         uint32_t end = offsets[r + 1];
+         detail::axpyRows(y + size_t(r) * k, values, columns, x, nz, end, k);
+         nz = end;
+       }
+
+       carryRows[p] = e.row;
+       detail::axpyRows(carries.data() + size_t(p) * k, values, columns, x,
+                        nz, e.nz, k);
+     };
+
+     if(numParts == 1){
+       partition(0);
+     }
+     else{
+       parallel_for(0, numParts, partition, schedule::dynamic(1));
+     }
+
+     for(uint32_t p = 0; p < numParts; ++p){
+       if(carryRows[p] < rows){
+         T* yr = y + size_t(carryRows[p]) * k;
+         const T* c = carries.data() + size_t(p) * k;
+         for(uint32_t j = 0; j < k; ++j){
+           yr[j] += c[j];
+         }
+       }
+     }
+   }
+
+   // y = a x, each chunk of rows a slot at a time, so that the
+   // innermost loop is unit stride in y and in the slots
+   template<typename T>
+   void spmv(const EllMatrix<T>& a, const T* x, T* y){
+     uint32_t rows = a.rows;
+     uint32_t width = a.width;
+     const uint32_t* columns = a.columns.data();
+     const T* values = a.values.data();
+
+     uint32_t numBlocks = (rows + SPARSE_ELL_BLOCK - 1)/SPARSE_ELL_BLOCK;
+
+     auto block = [&](uint32_t b){
+       uint32_t begin = b * SPARSE_ELL_BLOCK;
+       uint32_t end = std::min(rows, begin + SPARSE_ELL_BLOCK);
+
+       T* __restrict yb = y;
+       for(uint32_t r = begin; r < end; ++r){
+         yb[r] = T();
+       }
+
+       for(uint32_t s = 0; s < width; ++s){
+         const T* __restrict vs = values + size_t(s) * rows;
+         const uint32_t* __restrict cs = columns + size_t(s) * rows;
+         for(uint32_t r = begin; r < end; ++r){
+           yb[r] += vs[r] * x[cs[r]];
+         }
+       }
+     };
+
+     if(numBlocks == 1){
+       block(0);
+     }
+     else{
+       parallel_for(0, numBlocks, block, schedule::dynamic(1));
+     }
+   }
+
+   // y = a x for k row-major vectors, as spmm() of a CsrMatrix
+   template<typename T>
+   void spmm(const EllMatrix<T>& a, const T* x, T* y, uint32_t k){
+     uint32_t rows = a.rows;
+     uint32_t width = a.width;
+     const uint32_t* columns = a.columns.data();
+     const T* values = a.values.data();
+
+     uint32_t numBlocks = (rows + SPARSE_ELL_BLOCK - 1)/SPARSE_ELL_BLOCK;
+
+     auto block = [&](uint32_t b){
+       uint32_t begin = b * SPARSE_ELL_BLOCK;
+       uint32_t end = std::min(rows, begin + SPARSE_ELL_BLOCK);
+
+       for(uint32_t r = begin; r < end; ++r){
+         T* __restrict yr = y + size_t(r) * k;
+         for(uint32_t j = 0; j < k; ++j){
+           yr[j] = T();
+         }
+
+         for(uint32_t s = 0; s < width; ++s){
+           size_t i = size_t(s) * rows + r;
+           T v = values[i];
+           const T* __restrict xr = x + size_t(columns[i]) * k;
+           for(uint32_t j = 0; j < k; ++j){
+             yr[j] += v * xr[j];
+           }
+         }
+       }
+     };
+
+     if(numBlocks == 1){
+       block(0);
+     }
+     else{
+       parallel_for(0, numBlocks, block, schedule::dynamic(1));
+     }
+   }
+
+ } // namespace ares
+
+#endif // __ARES_SPARSE_H__
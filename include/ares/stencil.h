@@ -0,0 +1,283 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_STENCIL_H__
+#define __ARES_STENCIL_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "ares/parallel.h"
+
+ namespace ares{
+
+   // how a Stencil2D finds the neighbours of a point past an edge of the
+   // grid: those of the point on the edge, or those of the opposite edge
+   enum class StencilBoundary{
+     Clamp,
+     Periodic
+   };
+
+   // the values of the last step around the point (x(), y()) that the
+   // body of a Stencil2D computes, v(dx, dy) that of (x + dx, y + dy)
+   template<typename T>
+   class StencilView{
+   public:
+     StencilView(const T* p, size_t stride, uint32_t x, uint32_t y)
+     : p_(p),
+     stride_(ptrdiff_t(stride)),
+     x_(x),
+     y_(y){}
+
+     const T& operator()(int dx, int dy) const{
+       return p_[dy * stride_ + dx];
+     }
+
+     uint32_t x() const{
+       return x_;
+     }
+
+     uint32_t y() const{
+       return y_;
+     }
+
+   private:
+     const T* p_;
+     ptrdiff_t stride_;
+     uint32_t x_;
+     uint32_t y_;
+   };
+
+   // the time steps of a stencil of radius over an nx * ny row-major
+   // grid, a step computing each point from the points of the last one
+   // no more than radius away. Rather than streaming the whole grid
+   // through memory every step as a Forall2D per step does, the steps are
+   // taken depth at a time on tiles of tileX * tileY that stay in cache:
+   // a task copies its tile and a halo of radius * depth into scratch,
+   // advances it depth steps, the part computed shrinking by radius each
+   // step, and writes back the tile. The halos of neighbouring tiles are
+   // computed by both of them (overlapped trapezoids), so the tiles of a
+   // block of steps do not wait for each other, and the grid is read and
+   // written once per depth steps. The result is that of stepping the
+   // whole grid, bit for bit, for a body that depends only on its view
+   // and the point it is at.
+   class Stencil2D{
+   public:
+      Stencil2D(uint32_t nx, uint32_t ny, uint32_t radius=1,
+                StencilBoundary boundaryX=StencilBoundary::Clamp,
+                StencilBoundary boundaryY=StencilBoundary::Clamp,
+                uint32_t depth=4, uint32_t tileX=128, uint32_t tileY=64)
+      : nx_(nx),
+      ny_(ny),
+      radius_(radius),
+      boundaryX_(boundaryX),
+      boundaryY_(boundaryY),
+      depth_(depth == 0 ? 1 : depth),
+      tileX_(tileX == 0 ? 1 : tileX),
+      tileY_(tileY == 0 ? 1 : tileY){}
+
+      // takes steps steps from the grid in cur, each point the value of
+      // body(const StencilView<T>&), using next as the other grid of a
+      // step, and returns whichever of the two holds the last one
+      template<typename T, typename F>
+      T* run(T* cur, T* next, uint32_t steps, F&& body) const{
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "a Stencil2D copies its points into scratch");
+
+        if(nx_ == 0 || ny_ == 0){
+          return cur;
+        }
+
+        uint32_t tilesX = (nx_ + tileX_ - 1)/tileX_;
+        uint32_t numTiles = tilesX * ((ny_ + tileY_ - 1)/tileY_);
+
+        while(steps > 0){
+          uint32_t depth = std::min(steps, depth_);
+          const T* in = cur;
+          T* out = next;
+
+          parallel_for(0, numTiles, [&](uint32_t t){
+            block_(in, out, t % tilesX, t / tilesX, depth, body);
+          }, schedule::dynamic(1));
+
+          std::swap(cur, next);
+          steps -= depth;
+        }
+
+        return cur;
+      }
+
+   private:
+      // the local indices of a tile whose points a step with margin m
+      // computes, [begin, end), of which those of [lo, hi) are in the
+      // grid and the others past a clamped edge
+      struct Span_{
+        int64_t begin;
+        int64_t end;
+        int64_t lo;
+        int64_t hi;
+      };
+
+      // for a tile at origin of width local indices in a grid of size
+      static Span_ span_(int64_t origin, int64_t width, int64_t m,
+                         int64_t size, StencilBoundary b){
+        Span_ s{m, width - m, m, width - m};
+
+        if(b == StencilBoundary::Clamp){
+          s.lo = std::max(m, -origin);
+          s.hi = std::min(width - m, size - origin);
+        }
+
+        return s;
+      }
+
+      // the point of the grid that local index i of a tile at origin is
+      static uint32_t map_(int64_t origin, int64_t i, uint32_t size,
+                           StencilBoundary b){
+        int64_t g = origin + i;
+        if(b == StencilBoundary::Clamp){
+          return uint32_t(std::min(std::max(g, int64_t(0)),
+                                   int64_t(size) - 1));
+        }
+
+        g %= int64_t(size);
+        return uint32_t(g < 0 ? g + size : g);
+      }
+
+      template<typename T, typename F>
+      void block_(const T* in, T* out, uint32_t tx, uint32_t ty,
+                  uint32_t depth, F& body) const{
+        uint32_t x0 = tx * tileX_;
+        uint32_t y0 = ty * tileY_;
+        uint32_t w = std::min(nx_ - x0, tileX_);
+        uint32_t h = std::min(ny_ - y0, tileY_);
+
+        int64_t halo = int64_t(radius_) * depth;
+        int64_t lw = w + 2 * halo;
+        int64_t lh = h + 2 * halo;
+        int64_t ox = int64_t(x0) - halo;
+        int64_t oy = int64_t(y0) - halo;
+
+        ScratchScope scope;
+        T* a = static_cast<T*>(scratch(size_t(lw * lh) * sizeof(T)));
+        T* b = static_cast<T*>(scratch(size_t(lw * lh) * sizeof(T)));
+
+        for(int64_t ly = 0; ly < lh; ++ly){
+          const T* row = in + size_t(map_(oy, ly, ny_, boundaryY_)) * nx_;
+          T* local = a + ly * lw;
+          for(int64_t lx = 0; lx < lw; ++lx){
+            local[lx] = row[map_(ox, lx, nx_, boundaryX_)];
+          }
+        }
+
+        for(uint32_t s = 1; s <= depth; ++s){
+          int64_t m = int64_t(radius_) * s;
+          Span_ sx = span_(ox, lw, m, nx_, boundaryX_);
+          Span_ sy = span_(oy, lh, m, ny_, boundaryY_);
+
+          for(int64_t ly = sy.lo; ly < sy.hi; ++ly){
+            uint32_t gy = map_(oy, ly, ny_, boundaryY_);
+            uint32_t gx = map_(ox, sx.lo, nx_, boundaryX_);
+            T* local = b + ly * lw;
+
+            for(int64_t lx = sx.lo; lx < sx.hi; ++lx){
+              local[lx] = body(StencilView<T>(a + ly * lw + lx, size_t(lw),
+                                              gx, gy));
+              if(++gx == nx_){
+                gx = 0;
+              }
+            }
+
+            // the points past a clamped edge repeat the edge
+            for(int64_t lx = sx.begin; lx < sx.lo; ++lx){
+              local[lx] = local[sx.lo];
+            }
+            for(int64_t lx = sx.hi; lx < sx.end; ++lx){
+              local[lx] = local[sx.hi - 1];
+            }
+          }
+
+          for(int64_t ly = sy.begin; ly < sy.lo; ++ly){
+            std::copy(b + sy.lo * lw + sx.begin, b + sy.lo * lw + sx.end,
+                      b + ly * lw + sx.begin);
+          }
+          for(int64_t ly = sy.hi; ly < sy.end; ++ly){
+            std::copy(b + (sy.hi - 1) * lw + sx.begin,
+                      b + (sy.hi - 1) * lw + sx.end, b + ly * lw + sx.begin);
+          }
+
+          std::swap(a, b);
+        }
+
+        for(uint32_t y = 0; y < h; ++y){
+          const T* local = a + (y + halo) * lw + halo;
+          std::copy(local, local + w, out + size_t(y0 + y) * nx_ + x0);
+        }
+      }
+
+    uint32_t nx_;
+    uint32_t ny_;
+    uint32_t radius_;
+    StencilBoundary boundaryX_;
+    StencilBoundary boundaryY_;
+    uint32_t depth_;
+    uint32_t tileX_;
+    uint32_t tileY_;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_STENCIL_H__
@@ -0,0 +1,125 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_THPOOL_H__
+#define __ARES_THPOOL_H__
+
+/*
+ * The API of threadpool/c-thread-pool on the pool of the ARES runtime, so
+ * that C code using it shares the work-stealing workers rather than
+ * starting threads of its own. A threadpool is a group of jobs on those
+ * workers, not a set of threads: its jobs run alongside the Foralls and
+ * tasks of the program, and thpool_wait() waits only for its own jobs.
+ *
+ * Including this in place of thpool.h maps the thpool_ names to the
+ * ares_thpool_ ones, unless ARES_THPOOL_NO_COMPAT is defined.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+typedef struct ares_thpool_* ares_threadpool;
+
+/* num_threads is ignored, the workers are those of the runtime, set with
+   ARES_NUM_THREADS */
+ares_threadpool ares_thpool_init(int num_threads);
+
+/* queues function_p(arg_p), 0 on success as in thpool */
+int ares_thpool_add_work(ares_threadpool pool, void* (*function_p)(void*),
+                         void* arg_p);
+
+/* queues function_p(args[i]) for each of the n args, published to the
+   workers at once, which is cheaper than n calls of
+   ares_thpool_add_work() */
+int ares_thpool_add_work_batch(ares_threadpool pool,
+                               void* (*function_p)(void*), void** args,
+                               size_t n);
+
+/* waits until all of the jobs of pool have run, including those they
+   added, a worker runs other jobs meanwhile */
+void ares_thpool_wait(ares_threadpool pool);
+
+/* jobs added while paused are held back until ares_thpool_resume(), those
+   already queued still run */
+void ares_thpool_pause(ares_threadpool pool);
+
+void ares_thpool_resume(ares_threadpool pool);
+
+/* waits for the jobs of pool, held ones included, then frees it */
+void ares_thpool_destroy(ares_threadpool pool);
+
+/* the jobs of pool that are running */
+int ares_thpool_num_threads_working(ares_threadpool pool);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#ifndef ARES_THPOOL_NO_COMPAT
+
+#define threadpool ares_threadpool
+#define thpool_init ares_thpool_init
+#define thpool_add_work ares_thpool_add_work
+#define thpool_add_work_batch ares_thpool_add_work_batch
+#define thpool_wait ares_thpool_wait
+#define thpool_pause ares_thpool_pause
+#define thpool_resume ares_thpool_resume
+#define thpool_destroy ares_thpool_destroy
+#define thpool_num_threads_working ares_thpool_num_threads_working
+
+#endif
+
+#endif // __ARES_THPOOL_H__
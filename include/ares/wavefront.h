@@ -0,0 +1,243 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_WAVEFRONT_H__
+#define __ARES_WAVEFRONT_H__
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+
+#include "ares/frontend.h"
+
+extern "C"{
+  void* __ares_create_synch(uint32_t count);
+  void __ares_await_synch(void* synch);
+  void __ares_signal_synch(void* synch);
+  void __ares_queue_func(void* synch, void* args, void* fp,
+                         uint32_t index, uint32_t priority, void* region);
+}
+
+ namespace ares{
+
+   // the tile [x0, x1) * [y0, y1) of a Wavefront2D
+   struct Tile2D{
+     uint32_t x0;
+     uint32_t x1;
+     uint32_t y0;
+     uint32_t y1;
+   };
+
+   // iterates over nx * ny as a Forall2D does, but with each index
+   // after (x - 1, y) and (x, y - 1), as a Gauss-Seidel or upwind sweep
+   // needs. The tiles run along the anti-diagonals of the grid of tiles,
+   // each walked in row-major order by one task. Rather than a barrier
+   // between diagonals, each tile counts the neighbours it waits for and
+   // is started by the last of them to finish, so that it starts as
+   // soon as it can. Of the tiles that a tile makes ready, it runs one
+   // itself and queues the other. The bodies must not throw.
+   class Wavefront2D{
+   public:
+      Wavefront2D(uint32_t nx, uint32_t ny, uint32_t tileX=64,
+                  uint32_t tileY=8)
+      : nx_(nx),
+      ny_(ny),
+      tileX_(tileX == 0 ? 1 : tileX),
+      tileY_(tileY == 0 ? 1 : tileY){}
+
+      // calls body(Index2D) for each index and waits for all of them
+      template<typename F>
+      void run(F&& body) const{
+        tiles([&](const Tile2D& t){
+          for(uint32_t y = t.y0; y < t.y1; ++y){
+            for(uint32_t x = t.x0; x < t.x1; ++x){
+              body(Index2D{x, y});
+            }
+          }
+        });
+      }
+
+      // calls body(Tile2D) for each tile, for a body that walks the
+      // tile itself, and waits for all of them
+      template<typename F>
+      void tiles(F&& body) const{
+        using Body = typename std::remove_reference<F>::type;
+
+        uint32_t tx = (nx_ + tileX_ - 1)/tileX_;
+        uint32_t ty = (ny_ + tileY_ - 1)/tileY_;
+
+        if(tx == 0 || ty == 0){
+          return;
+        }
+
+        State_<Body> s(body, *this, tx, ty);
+
+        if(tx == 1 || ty == 1){
+          // a single row or column of tiles has nothing to overlap
+          for(uint32_t t = 0; t < tx * ty; ++t){
+            s.body(s.tile(t));
+          }
+          return;
+        }
+
+        s.synch = __ares_create_synch(1);
+        void* synch = s.synch;
+
+        __ares_queue_func(synch, &s, reinterpret_cast<void*>(&task_<Body>),
+                          0, static_cast<uint32_t>(Priority::Normal),
+                          nullptr);
+
+        __ares_await_synch(synch);
+      }
+
+   private:
+      // the argument the runtime passes to a queued function
+      struct TileArg_{
+        void* synch;
+        uint32_t n;
+        void* args;
+      };
+
+      template<typename F>
+      struct State_{
+        State_(F& f, const Wavefront2D& w, uint32_t tx, uint32_t ty)
+        : body(f),
+        wavefront(w),
+        tilesX(tx),
+        tilesY(ty),
+        deps(new std::atomic<uint32_t>[size_t(tx) * ty]),
+        remaining(tx * ty),
+        synch(nullptr){
+          for(uint32_t y = 0; y < ty; ++y){
+            for(uint32_t x = 0; x < tx; ++x){
+              deps[size_t(y) * tx + x].store(uint32_t(x > 0) + uint32_t(y > 0),
+                                             std::memory_order_relaxed);
+            }
+          }
+        }
+
+        Tile2D tile(uint32_t t) const{
+          const Wavefront2D& w = wavefront;
+          uint32_t x0 = (t % tilesX) * w.tileX_;
+          uint32_t y0 = (t / tilesX) * w.tileY_;
+          return Tile2D{x0, w.nx_ - x0 < w.tileX_ ? w.nx_ : x0 + w.tileX_,
+                        y0, w.ny_ - y0 < w.tileY_ ? w.ny_ : y0 + w.tileY_};
+        }
+
+        // whether finishing a neighbour of tile t made it ready
+        bool ready(uint32_t t){
+          return deps[t].fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+
+        F& body;
+        const Wavefront2D& wavefront;
+        uint32_t tilesX;
+        uint32_t tilesY;
+        std::unique_ptr<std::atomic<uint32_t>[]> deps;
+        std::atomic<uint32_t> remaining;
+        void* synch;
+      };
+
+      template<typename F>
+      static void task_(void* arg){
+        auto a = static_cast<TileArg_*>(arg);
+        auto& s = *static_cast<State_<F>*>(a->args);
+
+        uint32_t t = a->n;
+
+        for(;;){
+          s.body(s.tile(t));
+
+          uint32_t x = t % s.tilesX;
+          uint32_t y = t / s.tilesX;
+
+          bool right = x + 1 < s.tilesX && s.ready(t + 1);
+          bool down = y + 1 < s.tilesY && s.ready(t + s.tilesX);
+
+          // the synch is read first, the state is gone once the last
+          // tile is done
+          void* synch = s.synch;
+          if(s.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            __ares_signal_synch(synch);
+            return;
+          }
+
+          if(right && down){
+            __ares_queue_func(synch, &s,
+                              reinterpret_cast<void*>(&task_<F>),
+                              t + s.tilesX,
+                              static_cast<uint32_t>(Priority::Normal),
+                              nullptr);
+          }
+
+          if(right){
+            t = t + 1;
+          }
+          else if(down){
+            t = t + s.tilesX;
+          }
+          else{
+            return;
+          }
+        }
+      }
+
+    uint32_t nx_;
+    uint32_t ny_;
+    uint32_t tileX_;
+    uint32_t tileY_;
+   };
+
+ } // namespace ares
+
+#endif // __ARES_WAVEFRONT_H__
@@ -0,0 +1,294 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_WORKLIST_H__
+#define __ARES_WORKLIST_H__
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "ares/parallel.h"
+
+extern "C"{
+  uint32_t __ares_num_threads();
+  void __ares_thread_yield();
+}
+
+ namespace ares{
+
+   // the items a worker gathers before its bag makes them stealable
+   const size_t WORKLIST_CHUNK = 64;
+
+   namespace detail{
+
+     template<typename T>
+     class WorklistRun;
+
+   } // end namespace detail
+
+   // the bag of one worker of a parallel_while(), which the body pushes
+   // the items it discovers to
+   template<typename T>
+   class Worklist{
+   public:
+     Worklist(const Worklist&) = delete;
+
+     Worklist& operator=(const Worklist&) = delete;
+
+     void push(const T& item){
+       push(T(item));
+     }
+
+     void push(T&& item){
+       local_.push_back(std::move(item));
+       ++pushed_;
+
+       if(local_.size() >= WORKLIST_CHUNK){
+         publish_();
+       }
+     }
+
+     // the index of this bag, in [0, number of workers)
+     uint32_t index() const{
+       return index_;
+     }
+
+   private:
+     friend class detail::WorklistRun<T>;
+
+     using Chunk = std::vector<T>;
+
+     Worklist(detail::WorklistRun<T>& run, uint32_t index)
+     : run_(run),
+     index_(index),
+     pushed_(0),
+     done_(0){
+       local_.reserve(WORKLIST_CHUNK);
+     }
+
+     // the pushes are counted before others can see them, the items done
+     // may be counted later, so that the count only reaches 0 once every
+     // item is done
+     void flush_();
+
+     void publish_();
+
+     detail::WorklistRun<T>& run_;
+     uint32_t index_;
+     Chunk local_;
+     int64_t pushed_;
+     int64_t done_;
+
+     // the chunks of this bag that may be stolen, the owner taking the
+     // newest and thieves the oldest
+     std::mutex mutex_;
+     std::deque<Chunk> shared_;
+   };
+
+   namespace detail{
+
+     template<typename T>
+     class WorklistRun{
+     public:
+       WorklistRun(uint32_t numBags)
+       : pending_(0){
+         for(uint32_t i = 0; i < numBags; ++i){
+           bags_.emplace_back(new Worklist<T>(*this, i));
+         }
+       }
+
+       ~WorklistRun(){
+         for(Worklist<T>* bag : bags_){
+           delete bag;
+         }
+       }
+
+       // the seeds, dealt out a chunk at a time
+       void seed(std::vector<T>&& items){
+         pending_.store(int64_t(items.size()), std::memory_order_relaxed);
+
+         size_t b = 0;
+         for(size_t i = 0; i < items.size(); i += WORKLIST_CHUNK){
+           size_t end = std::min(items.size(), i + WORKLIST_CHUNK);
+           Worklist<T>& bag = *bags_[b++ % bags_.size()];
+
+           bag.shared_.emplace_back(std::make_move_iterator(&items[i]),
+                                    std::make_move_iterator(&items[0] + end));
+         }
+       }
+
+       // runs the items of bag b, then steals, until none are left
+       template<typename F>
+       void work(uint32_t b, F& body){
+         Worklist<T>& bag = *bags_[b];
+         size_t idle = 0;
+
+         for(;;){
+           while(!bag.local_.empty()){
+             T item = std::move(bag.local_.back());
+             bag.local_.pop_back();
+
+             body(item, bag);
+             ++bag.done_;
+           }
+
+           bag.flush_();
+
+           if(take_(b) || steal_(b)){
+             idle = 0;
+             continue;
+           }
+
+           if(pending_.load(std::memory_order_acquire) == 0){
+             return;
+           }
+
+           if(++idle > 16){
+             __ares_thread_yield();
+           }
+         }
+       }
+
+       size_t numBags() const{
+         return bags_.size();
+       }
+
+     private:
+       friend class Worklist<T>;
+
+       // the newest of bag b's own chunks
+       bool take_(uint32_t b){
+         Worklist<T>& bag = *bags_[b];
+         std::lock_guard<std::mutex> lock(bag.mutex_);
+
+         if(bag.shared_.empty()){
+           return false;
+         }
+
+         bag.local_.swap(bag.shared_.back());
+         bag.shared_.pop_back();
+         return true;
+       }
+
+       // the oldest chunk of the next bag that has one
+       bool steal_(uint32_t b){
+         for(size_t k = 1; k < bags_.size(); ++k){
+           Worklist<T>& victim = *bags_[(b + k) % bags_.size()];
+           std::lock_guard<std::mutex> lock(victim.mutex_);
+
+           if(!victim.shared_.empty()){
+             bags_[b]->local_.swap(victim.shared_.front());
+             victim.shared_.pop_front();
+             return true;
+           }
+         }
+
+         return false;
+       }
+
+       std::vector<Worklist<T>*> bags_;
+       std::atomic<int64_t> pending_;
+     };
+
+   } // end namespace detail
+
+   template<typename T>
+   void Worklist<T>::flush_(){
+     if(pushed_ != done_){
+       run_.pending_.fetch_add(pushed_ - done_, std::memory_order_acq_rel);
+     }
+
+     pushed_ = 0;
+     done_ = 0;
+   }
+
+   template<typename T>
+   void Worklist<T>::publish_(){
+     flush_();
+
+     Chunk chunk;
+     chunk.reserve(WORKLIST_CHUNK);
+     chunk.swap(local_);
+
+     std::lock_guard<std::mutex> lock(mutex_);
+     shared_.push_back(std::move(chunk));
+   }
+
+   // calls body(item, bag) for each of the seeds and for each item that
+   // the bodies push to their bag, in no particular order, and returns
+   // once there are none left. Each worker runs the items of its own
+   // bag, newest first, and steals the oldest chunk of another's once
+   // its own is empty, so that rounds of Foralls and barriers are not
+   // needed to find the end. The body must not throw.
+   template<typename T, typename F>
+   void parallel_while(std::vector<T> seeds, F&& body){
+     if(seeds.empty()){
+       return;
+     }
+
+     detail::WorklistRun<T> run(__ares_num_threads());
+     run.seed(std::move(seeds));
+
+     parallel_for(0, uint32_t(run.numBags()), [&](uint32_t b){
+       run.work(b, body);
+     }, schedule::static_());
+   }
+
+ } // namespace ares
+
+#endif // __ARES_WORKLIST_H__
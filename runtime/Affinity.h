@@ -0,0 +1,233 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_AFFINITY_H__
+#define __ARES_AFFINITY_H__
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#endif
+
+namespace ares{
+
+enum class BindPolicy{
+  None,
+  Compact,
+  Scatter
+};
+
+class Affinity{
+public:
+  // CPUs the process is allowed to run on
+  static std::vector<int> allowedCpus(){
+    std::vector<int> cpus;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0){
+      for(int i = 0; i < CPU_SETSIZE; ++i){
+        if(CPU_ISSET(i, &set)){
+          cpus.push_back(i);
+        }
+      }
+    }
+#endif
+
+    if(cpus.empty()){
+      size_t n = std::thread::hardware_concurrency();
+      for(size_t i = 0; i < n; ++i){
+        cpus.push_back(i);
+      }
+    }
+
+    return cpus;
+  }
+
+  // order CPUs in which consecutive workers are bound, compact fills
+  // the SMT siblings and cores of one NUMA node and package before moving
+  // on, scatter spreads consecutive workers across packages then cores
+  static std::vector<int> bindOrder(BindPolicy policy){
+    std::vector<int> cpus = allowedCpus();
+
+    if(policy == BindPolicy::None){
+      return cpus;
+    }
+
+    std::vector<Cpu_> v;
+    for(int cpu : cpus){
+      v.push_back(topology_(cpu));
+    }
+
+    // rank of each CPU among the SMT siblings of its core
+    for(Cpu_& ci : v){
+      for(const Cpu_& cj : v){
+        if(cj.package == ci.package && cj.core == ci.core && cj.id < ci.id){
+          ++ci.sibling;
+        }
+      }
+    }
+
+    if(policy == BindPolicy::Compact){
+      std::sort(v.begin(), v.end(), [](const Cpu_& a, const Cpu_& b){
+        if(a.node != b.node){
+          return a.node < b.node;
+        }
+        if(a.package != b.package){
+          return a.package < b.package;
+        }
+        if(a.core != b.core){
+          return a.core < b.core;
+        }
+        return a.id < b.id;
+      });
+    }
+    else{
+      std::sort(v.begin(), v.end(), [](const Cpu_& a, const Cpu_& b){
+        if(a.sibling != b.sibling){
+          return a.sibling < b.sibling;
+        }
+        if(a.core != b.core){
+          return a.core < b.core;
+        }
+        if(a.package != b.package){
+          return a.package < b.package;
+        }
+        return a.id < b.id;
+      });
+    }
+
+    cpus.clear();
+    for(const Cpu_& c : v){
+      cpus.push_back(c.id);
+    }
+
+    return cpus;
+  }
+
+  // NUMA node of cpu, 0 if the topology cannot be read
+  static int numaNode(int cpu){
+    int node = 0;
+
+#ifdef __linux__
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+
+    if(DIR* dir = opendir(path.c_str())){
+      while(dirent* e = readdir(dir)){
+        if(strncmp(e->d_name, "node", 4) == 0 && isdigit(e->d_name[4])){
+          node = atoi(e->d_name + 4);
+          break;
+        }
+      }
+      closedir(dir);
+    }
+#endif
+
+    return node;
+  }
+
+  static bool pinCurrentThread(int cpu){
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+private:
+  struct Cpu_{
+    int id;
+    int node;
+    int package;
+    int core;
+    int sibling;
+  };
+
+  static int readInt_(const std::string& path, int defaultValue){
+    std::ifstream in(path);
+    int value;
+    if(in >> value){
+      return value;
+    }
+    return defaultValue;
+  }
+
+  static Cpu_ topology_(int cpu){
+    std::string path =
+      "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+
+    Cpu_ c;
+    c.id = cpu;
+    c.node = numaNode(cpu);
+    c.package = readInt_(path + "physical_package_id", 0);
+    c.core = readInt_(path + "core_id", cpu);
+    c.sibling = 0;
+    return c;
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_AFFINITY_H__
@@ -0,0 +1,540 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_ALLOCATOR_H__
+#define __ARES_ALLOCATOR_H__
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "MemoryAccount.h"
+
+namespace ares{
+
+// the allocator behind __ares_alloc(), for the buffers lowered code
+// allocates on every parallel construct, such as reduction partials.
+// Small blocks come in power of two size classes from per-thread
+// freelists, as with the FramePool, but blocks may be freed on another
+// thread than the one that allocated them, so a freelist that grows too
+// long hands a batch to a shared list that other threads refill from.
+// Blocks of HUGE_SIZE and more are mapped separately and backed by
+// transparent huge pages where the system has them.
+//
+// ARES_HUGE_THRESHOLD raises the size from which blocks are mapped.
+// ARES_HUGE_PAGES=2m or 1g maps them from the hugetlbfs pool of that
+// page size instead, falling back to transparent huge pages when the
+// pool has none left, and off leaves them to the kernel's default.
+// ARES_MLOCK=1 locks mapped blocks in memory, for buffers that the
+// communication layer sends from.
+class Allocator{
+public:
+  static const size_t ALIGN = 16;
+
+  static const size_t HUGE_SIZE = size_t(2) << 20;
+
+  // of the blocks mapped now, transparentHugeBytes is for the whole
+  // process, as the kernel reports it
+  struct Stats{
+    uint64_t mappedBlocks;
+    uint64_t mappedBytes;
+    uint64_t hugetlbBytes;
+    uint64_t hugetlbFallbacks;
+    uint64_t lockedBytes;
+    uint64_t transparentHugeBytes;
+  };
+
+  static Stats stats(){
+    Counters_& c = counters_();
+
+    Stats s;
+    s.mappedBlocks = c.mappedBlocks.load(std::memory_order_relaxed);
+    s.mappedBytes = c.mappedBytes.load(std::memory_order_relaxed);
+    s.hugetlbBytes = c.hugetlbBytes.load(std::memory_order_relaxed);
+    s.hugetlbFallbacks = c.hugetlbFallbacks.load(std::memory_order_relaxed);
+    s.lockedBytes = c.lockedBytes.load(std::memory_order_relaxed);
+    s.transparentHugeBytes = transparentHugeBytes_();
+    return s;
+  }
+
+  static void* allocate(size_t bytes){
+    uint32_t sizeClass = sizeClass_(bytes + ALIGN);
+
+    Header_* h;
+
+    if(sizeClass < NUM_CLASSES){
+      Cache_& cache = cache_();
+      Free_*& head = cache.head[sizeClass];
+
+      if(!head){
+        refill_(cache, sizeClass);
+      }
+
+      h = reinterpret_cast<Header_*>(head);
+      head = head->next;
+      --cache.size[sizeClass];
+    }
+    else if(bytes + ALIGN < config_().threshold){
+      h = static_cast<Header_*>(malloc(bytes + ALIGN));
+      sizeClass = MALLOCED;
+      h->size = bytes + ALIGN;
+    }
+    else{
+      void* ptr = allocateHuge_(bytes + ALIGN);
+      if(ptr){
+        MemoryAccount::add(MemoryAccount::Partials, header_(ptr)->size);
+      }
+      return ptr;
+    }
+
+    h->sizeClass = sizeClass;
+    MemoryAccount::add(MemoryAccount::Partials, size_(h));
+
+    return reinterpret_cast<char*>(h) + ALIGN;
+  }
+
+  // align is a power of two, blocks are always aligned to ALIGN
+  static void* allocateAligned(size_t bytes, size_t align){
+    if(align <= ALIGN){
+      return allocate(bytes);
+    }
+
+    // the block is ALIGN aligned, so its first aligned address past its
+    // own header is at most align bytes in, and leaves room for another
+    // header that leads back to it
+    char* block = static_cast<char*>(allocate(bytes + align));
+    uintptr_t p = (reinterpret_cast<uintptr_t>(block) + ALIGN + align - 1) &
+      ~uintptr_t(align - 1);
+
+    auto h = reinterpret_cast<Header_*>(p - ALIGN);
+    h->sizeClass = ALIGNED;
+    h->offset = uint32_t(p - reinterpret_cast<uintptr_t>(block));
+
+    return reinterpret_cast<void*>(p);
+  }
+
+  static void release(void* ptr){
+    if(!ptr){
+      return;
+    }
+
+    Header_* h = header_(ptr);
+
+    if(h->sizeClass == ALIGNED){
+      release(static_cast<char*>(ptr) - h->offset);
+      return;
+    }
+
+    MemoryAccount::remove(MemoryAccount::Partials, size_(h));
+
+    switch(h->sizeClass){
+      case MALLOCED:
+        free(h);
+        return;
+      case MAPPED:
+        releaseHuge_(h);
+        return;
+    }
+
+    uint32_t sizeClass = h->sizeClass;
+
+    Cache_& cache = cache_();
+
+    auto f = reinterpret_cast<Free_*>(h);
+    f->next = cache.head[sizeClass];
+    cache.head[sizeClass] = f;
+
+    if(++cache.size[sizeClass] >= 2 * BATCH_SIZE){
+      flush_(cache, sizeClass);
+    }
+  }
+
+private:
+  static const size_t MIN_SIZE = 32;
+  static const uint32_t NUM_CLASSES = 11;
+
+  // blocks of a class are moved between threads this many at a time, and
+  // at most MAX_SHARED batches of each are kept, the rest are freed
+  static const size_t BATCH_SIZE = 64;
+  static const size_t MAX_SHARED = 64;
+
+  static const uint32_t MALLOCED = NUM_CLASSES;
+  static const uint32_t MAPPED = NUM_CLASSES + 1;
+  static const uint32_t ALIGNED = NUM_CLASSES + 2;
+
+  // the offset of a MAPPED header holds how it was mapped
+  static const uint32_t HUGETLB = 1;
+  static const uint32_t LOCKED = 2;
+
+  enum HugePages_{
+    HUGE_THP,
+    HUGE_2M,
+    HUGE_1G,
+    HUGE_OFF
+  };
+
+  struct Config_{
+    size_t threshold;
+    HugePages_ hugePages;
+    bool lock;
+  };
+
+  struct Counters_{
+    std::atomic<uint64_t> mappedBlocks{0};
+    std::atomic<uint64_t> mappedBytes{0};
+    std::atomic<uint64_t> hugetlbBytes{0};
+    std::atomic<uint64_t> hugetlbFallbacks{0};
+    std::atomic<uint64_t> lockedBytes{0};
+  };
+
+  // MAPPED and MALLOCED blocks keep their size in the header
+  struct Header_{
+    uint32_t sizeClass;
+    uint32_t offset;
+    uint64_t size;
+  };
+
+  static_assert(sizeof(Header_) == ALIGN, "header must keep alignment");
+
+  struct Free_{
+    Free_* next;
+  };
+
+  struct Cache_{
+    ~Cache_(){
+      for(uint32_t i = 0; i < NUM_CLASSES; ++i){
+        while(head[i]){
+          flush_(*this, i);
+        }
+      }
+    }
+
+    Free_* head[NUM_CLASSES] = {};
+    size_t size[NUM_CLASSES] = {};
+  };
+
+  struct Batch_{
+    Free_* head;
+    size_t size;
+  };
+
+  struct Shared_{
+    std::mutex mutex;
+    std::vector<Batch_> batches[NUM_CLASSES];
+  };
+
+  static Header_* header_(void* ptr){
+    return reinterpret_cast<Header_*>(static_cast<char*>(ptr) - ALIGN);
+  }
+
+  // the bytes of a block as it is accounted, those of its size class
+  // for the cached ones
+  static size_t size_(const Header_* h){
+    return h->sizeClass < NUM_CLASSES ? MIN_SIZE << h->sizeClass : h->size;
+  }
+
+  static Cache_& cache_(){
+    static thread_local Cache_ cache;
+    return cache;
+  }
+
+  static Shared_& shared_(){
+    static Shared_* shared = new Shared_;
+    return *shared;
+  }
+
+  static const Config_& config_(){
+    static Config_ config = []{
+      Config_ c;
+
+      const char* s = getenv("ARES_HUGE_THRESHOLD");
+      size_t threshold = s ? size_t(atoll(s)) : 0;
+      c.threshold = threshold > HUGE_SIZE ? threshold : HUGE_SIZE;
+
+      std::string mode = getenv("ARES_HUGE_PAGES") ?
+        getenv("ARES_HUGE_PAGES") : "";
+      c.hugePages = mode == "2m" ? HUGE_2M : mode == "1g" ? HUGE_1G :
+        mode == "off" ? HUGE_OFF : HUGE_THP;
+
+      s = getenv("ARES_MLOCK");
+      c.lock = s && atoi(s) != 0;
+
+      return c;
+    }();
+
+    return config;
+  }
+
+  static Counters_& counters_(){
+    static Counters_* counters = new Counters_;
+    return *counters;
+  }
+
+  // the AnonHugePages of the process, 0 where the kernel does not say
+  static uint64_t transparentHugeBytes_(){
+#ifdef __linux__
+    std::ifstream istr("/proc/self/smaps_rollup");
+    std::string key;
+
+    while(istr >> key){
+      if(key == "AnonHugePages:"){
+        uint64_t kb;
+        return istr >> kb ? kb << 10 : 0;
+      }
+      istr.ignore(256, '\n');
+    }
+#endif
+
+    return 0;
+  }
+
+  static uint32_t sizeClass_(size_t bytes){
+    uint32_t c = 0;
+    size_t size = MIN_SIZE;
+
+    while(size < bytes && c < NUM_CLASSES){
+      size <<= 1;
+      ++c;
+    }
+
+    return c;
+  }
+
+  static void refill_(Cache_& cache, uint32_t sizeClass){
+    Shared_& shared = shared_();
+
+    shared.mutex.lock();
+    std::vector<Batch_>& batches = shared.batches[sizeClass];
+    if(!batches.empty()){
+      Batch_ batch = batches.back();
+      batches.pop_back();
+      shared.mutex.unlock();
+      cache.head[sizeClass] = batch.head;
+      cache.size[sizeClass] = batch.size;
+      return;
+    }
+    shared.mutex.unlock();
+
+    // blocks are malloc'ed singly so that any of them can be freed again
+    size_t size = MIN_SIZE << sizeClass;
+    for(size_t i = 0; i < BATCH_SIZE; ++i){
+      auto f = static_cast<Free_*>(malloc(size));
+      f->next = cache.head[sizeClass];
+      cache.head[sizeClass] = f;
+    }
+    cache.size[sizeClass] = BATCH_SIZE;
+  }
+
+  // hands one batch of at most BATCH_SIZE blocks to the shared list
+  static void flush_(Cache_& cache, uint32_t sizeClass){
+    Free_* batch = cache.head[sizeClass];
+    Free_* last = batch;
+    size_t n = 1;
+
+    while(n < BATCH_SIZE && last->next){
+      last = last->next;
+      ++n;
+    }
+
+    cache.head[sizeClass] = last->next;
+    cache.size[sizeClass] -= n;
+    last->next = nullptr;
+
+    Shared_& shared = shared_();
+
+    shared.mutex.lock();
+    std::vector<Batch_>& batches = shared.batches[sizeClass];
+    if(batches.size() < MAX_SHARED){
+      batches.push_back({batch, n});
+      batch = nullptr;
+    }
+    shared.mutex.unlock();
+
+    while(batch){
+      Free_* f = batch;
+      batch = f->next;
+      free(f);
+    }
+  }
+
+  // maps whole huge pages, from hugetlbfs if so configured, else
+  // aligned to one so that the kernel can back them with huge pages
+  static void* allocateHuge_(size_t bytes){
+    const Config_& config = config_();
+    Counters_& counters = counters_();
+
+    size_t size = (bytes + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+    uint32_t flags = 0;
+    Header_* h = nullptr;
+
+#ifdef __linux__
+    if(config.hugePages == HUGE_2M || config.hugePages == HUGE_1G){
+      h = static_cast<Header_*>(mapHugetlb_(bytes, config.hugePages, size));
+      if(h){
+        flags |= HUGETLB;
+        counters.hugetlbBytes += size;
+      }
+      else{
+        ++counters.hugetlbFallbacks;
+        size = (bytes + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+      }
+    }
+
+    if(!h){
+      h = static_cast<Header_*>(mapAligned_(size, config.hugePages));
+      if(!h){
+        return nullptr;
+      }
+    }
+
+    if(config.lock && mlock(h, size) == 0){
+      flags |= LOCKED;
+      counters.lockedBytes += size;
+    }
+#else
+    h = static_cast<Header_*>(malloc(size));
+#endif
+
+    ++counters.mappedBlocks;
+    counters.mappedBytes += size;
+
+    h->sizeClass = MAPPED;
+    h->offset = flags;
+    h->size = size;
+    return reinterpret_cast<char*>(h) + ALIGN;
+  }
+
+#ifdef __linux__
+  // sets size to that of the mapping, a multiple of the page size
+  static void* mapHugetlb_(size_t bytes, HugePages_ hugePages,
+                           size_t& size){
+#ifdef MAP_HUGETLB
+    // blocks smaller than a gigabyte page take 2 MB ones
+    int shift = hugePages == HUGE_1G && bytes >= size_t(1) << 30 ? 30 : 21;
+    size_t pageSize = size_t(1) << shift;
+    size = (bytes + pageSize - 1) & ~(pageSize - 1);
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+    flags |= shift << MAP_HUGE_SHIFT;
+#endif
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+#else
+    return nullptr;
+#endif
+  }
+
+  static void* mapAligned_(size_t size, HugePages_ hugePages){
+    void* p = mmap(nullptr, size + HUGE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED){
+      return nullptr;
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(p);
+    uintptr_t aligned = (start + HUGE_SIZE - 1) & ~uintptr_t(HUGE_SIZE - 1);
+
+    if(aligned > start){
+      munmap(p, aligned - start);
+    }
+
+    size_t tail = start + HUGE_SIZE - aligned;
+    if(tail > 0){
+      munmap(reinterpret_cast<void*>(aligned + size), tail);
+    }
+
+#ifdef MADV_HUGEPAGE
+    if(hugePages != HUGE_OFF){
+      madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+    }
+#endif
+
+    return reinterpret_cast<void*>(aligned);
+  }
+#endif
+
+  static void releaseHuge_(Header_* h){
+    Counters_& counters = counters_();
+
+    --counters.mappedBlocks;
+    counters.mappedBytes -= h->size;
+
+    if(h->offset & HUGETLB){
+      counters.hugetlbBytes -= h->size;
+    }
+
+    if(h->offset & LOCKED){
+      counters.lockedBytes -= h->size;
+    }
+
+#ifdef __linux__
+    munmap(h, h->size);
+#else
+    free(h);
+#endif
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_ALLOCATOR_H__
@@ -1,85 +1,166 @@
 // ArgoPool.cpp
 
 #include "ArgoPool.hpp"
-// abt.h does the extern "C" wrapping
-#include "abt.h"
-#include <assert.h>
-#include <stdlib.h>
+
+#include <cstdlib>
+#include <iostream>
 
 namespace ares {
 
-  ABT_xstream *ArgoPool::xstreams;
-  ABT_pool *ArgoPool::pools;
-  int ArgoPool::numStreams;
-  int ArgoPool::nextPool;
-
-  ArgoPool::ArgoPool(int argc, char *argv[], int _numStreams)
-  //    : numStreams(numStreams) // in addition to the "main" stream
-  {
-    numStreams = _numStreams;
-
-    assert(numStreams >= 1);
-    // can only have one instance of ArgoPool
-    assert(ABT_initialized() == ABT_ERR_UNINITIALIZED);
-    // start ArgoBots
-    assert(ABT_init(argc, argv) == ABT_SUCCESS);
-
-    // populate xstreams, numStreams is in addition to "main" stream
-    xstreams = 
-      (ABT_xstream *)malloc(sizeof(ABT_xstream) * (numStreams + 1));
-    // we are the main ES and ULT, stream already exists
-    assert(ABT_xstream_self(&xstreams[0]) == ABT_SUCCESS);
-    // and numStreams new ones
-    for (int i = 1; i != numStreams + 1; i++) {
-      assert(ABT_xstream_create(ABT_SCHED_NULL, // round robin?
-				&xstreams[i]) == ABT_SUCCESS);
+  namespace {
+
+    // the calls are made for their effect, so they are not asserted
+    void check(int ret, const char* what){
+      if(ret != ABT_SUCCESS){
+        std::cerr << "ares: argobots " << what << " failed: " << ret <<
+          std::endl;
+        abort();
+      }
+    }
+
+  } // namespace
+
+  ArgoPool::ArgoPool(size_t numStreams){
+    if(numStreams == 0){
+      numStreams = 1;
+    }
+
+    check(ABT_init(0, nullptr), "init");
+
+    pools_.resize(numStreams);
+    for(size_t i = 0; i < numStreams; ++i){
+      check(ABT_pool_create_basic(ABT_POOL_FIFO, ABT_POOL_ACCESS_MPMC,
+                                  ABT_TRUE, &pools_[i]), "pool create");
+    }
+
+    xstreams_.resize(numStreams);
+    streams_.resize(numStreams);
+
+    // the basic scheduler takes work from the first non-empty one of its
+    // pools, so each runs its own pool first and then steals from the
+    // others, starting with its neighbour
+    for(size_t i = 0; i < numStreams; ++i){
+      std::vector<ABT_pool> order;
+      for(size_t j = 0; j < numStreams; ++j){
+        order.push_back(pools_[(i + j) % numStreams]);
+      }
+
+      ABT_sched sched;
+      check(ABT_sched_create_basic(ABT_SCHED_BASIC, int(numStreams),
+                                   order.data(), ABT_SCHED_CONFIG_NULL,
+                                   &sched), "sched create");
+
+      if(i == 0){
+        check(ABT_xstream_self(&xstreams_[0]), "xstream self");
+        check(ABT_xstream_set_main_sched(xstreams_[0], sched),
+              "set main sched");
+      }
+      else{
+        check(ABT_xstream_create(sched, &xstreams_[i]), "xstream create");
+      }
     }
+  }
 
-    // populate pools, one per total number of streams
-    pools = (ABT_pool *)malloc(sizeof(ABT_pool) * (numStreams + 1));
-    // get the pools in which to allocate threads
-    for (int i = 0; i != numStreams + 1; i++) {
-      assert(ABT_xstream_get_main_pools(xstreams[i], 
-					1, // just the first such pool
-					&pools[i]) 
-	   == ABT_SUCCESS);
+  void ArgoPool::run_(void* arg){
+    auto task = static_cast<Task*>(arg);
+    {
+      UserRegion::TaskScope scope(task->region);
+      task->run();
     }
-    // first pool in which to allocate thread
-    nextPool = 1;
+    TaskPool::release(task);
   }
 
-  ArgoPool::~ArgoPool() {
-    // initialized?
-    assert(ABT_initialized() == ABT_SUCCESS);
+  void ArgoPool::runOnStack_(void* arg){
+    auto u = static_cast<Ult_*>(arg);
+    ArgoPool* pool = u->pool;
+    pool->reap_();
 
-    // join user-created ES with main ES
-    assert(ABT_xstream_join(xstreams[1]) == ABT_SUCCESS);
-    // free user-created ES
-    assert(ABT_xstream_free(&xstreams[1]) == ABT_SUCCESS);
+    run_(u->task);
 
-    // finalize
-    assert(ABT_finalize() == ABT_SUCCESS);
+    // the task may have moved to another stream while it waited
+    int rank = pool->workerIndex();
+    Stream_& s = pool->streams_[rank];
+    u->next = s.finished;
+    s.finished = u;
   }
 
-  void ArgoPool::AP_push(FuncPtr func, void* argp, uint32_t priority) {
-    // new thread on ES[nextPool] via POOL[nextPool]
-    assert(ABT_thread_create(pools[nextPool],
-			     func,
-			     argp,
-			     ABT_THREAD_ATTR_NULL,
-			     NULL)
-	   == ABT_SUCCESS);
-    nextPool = ((nextPool + 1) % numStreams) + 1;
-    // threadId++;
-    // assert(ABT_thread_free... not needed since NULL passed to ABT_thread_create()
+  bool ArgoPool::pushOnStack_(ABT_pool pool, Task* task, size_t bytes){
+    reap_();
+
+    size_t size = StackPool::classSize(bytes);
+    char* stack = StackPool::acquire(size);
+    if(!stack){
+      return false;
+    }
+
+    auto u = reinterpret_cast<Ult_*>(stack + size - ULT_SIZE);
+    u->task = task;
+    u->pool = this;
+    u->stack = stack;
+    u->size = size;
+
+    // the attributes are copied into the ULT, the stack stays ours
+    ABT_thread_attr attr;
+    check(ABT_thread_attr_create(&attr), "thread attr create");
+    check(ABT_thread_attr_set_stack(attr, stack, size - ULT_SIZE),
+          "thread attr set stack");
+    check(ABT_thread_create(pool, runOnStack_, u, attr, nullptr),
+          "thread create");
+    ABT_thread_attr_free(&attr);
+
+    return true;
+  }
+
+  void ArgoPool::reap_(){
+    int rank = workerIndex();
+    if(rank < 0){
+      return;
+    }
+
+    Stream_& s = streams_[rank];
+    while(Ult_* u = s.finished){
+      s.finished = u->next;
+      StackPool::release(u->stack, u->size);
+    }
+  }
+
+  void ArgoPool::push(Task* task){
+    int rank = workerIndex();
+
+    size_t i;
+    if(rank >= 0){
+      i = rank;
+    }
+    else{
+      i = externalPushes_.fetch_add(1, std::memory_order_relaxed) %
+        pools_.size();
+    }
+
+    size_t bytes = task->stack > 0 ? size_t(task->stack) << 10 :
+      StackPool::defaultSize();
+    if(bytes > 0 && pushOnStack_(pools_[i], task, bytes)){
+      return;
+    }
+
+    // a null handle lets Argobots free the ULT once it has finished
+    check(ABT_thread_create(pools_[i], run_, task, ABT_THREAD_ATTR_NULL,
+                            nullptr), "thread create");
+  }
+
+  int ArgoPool::workerIndex() const{
+    int rank;
+    if(ABT_xstream_self_rank(&rank) != ABT_SUCCESS){
+      return -1;
+    }
+    return rank;
   }
 
-  void ArgoPool::AP_yield() {
-    assert(ABT_thread_yield() == ABT_SUCCESS);
+  bool ArgoPool::tryRunOne(){
+    return ABT_thread_yield() == ABT_SUCCESS;
   }
 
-  void ArgoPool::AP_finish() {
-    // nothing to do?  ABT told to free thread on termination, we'll see.
+  void ArgoPool::yield(){
+    ABT_thread_yield();
   }
 
 } // namespace ares
@@ -49,49 +49,87 @@
  * #####
  */
 
-// export PATH=/home/kei/projects/gcc-5.3.0-install/bin:$PATH
-
-// use gcc-5.3.0 libraries?  see /home/kei/project/gcc-5.3.0-install/README-libs.txt
-
-// g++ -c ArgoPool.cpp -std=c++14 -I../argobots/install/include
-
 #ifndef __ARES_ARGO_POOL_H__
 #define __ARES_ARGO_POOL_H__
 
+#include <vector>
+#include <atomic>
+
 #include "abt.h"
-#include <stdint.h>
+
+#include "Executor.h"
+#include "StackPool.h"
 
 namespace ares {
 
-  using FuncPtr = void(*)(void*);
-  
-  class ArgoPool {
+  // executor on Argobots user level threads, one execution stream per
+  // worker, the first being the thread that created the pool. Each stream
+  // has its own pool that it pushes to and runs from, and steals from
+  // the others when it is empty. Tasks run as ULTs so that a wait yields
+  // to other ULTs on the same stream rather than blocking it.
+  //
+  // A task with a stack hint, or any with ARES_STACK_SIZE set, runs on a
+  // stack of the StackPool rather than one of Argobots' own, so that
+  // many suspended tasks hold little memory. The stack is handed back
+  // by the next ULT that starts on the stream the task finished on.
+  class ArgoPool : public Executor {
   public:
-    
-    // initialize an argbots pool and perform any argobots initialization needed
-    // assume for now that this class is a singleton - the ARES runtime will
-    // create exactly one ArgoPool
-    ArgoPool(int argc, char *argv[], int numStreams);
-    ~ArgoPool();
-    
-    // queue a function pointer for execution with args
-    // we will ignore priority for now
-    static void AP_push(FuncPtr func, void* argp, uint32_t priority);
-    
-    // called by an argobots thread to yield
-    static void AP_yield();
-    
-    // called when the argobots thread finishes to perform any cleanup needed
-    static void AP_finish();
-    
+    explicit ArgoPool(size_t numStreams);
+
+    using Executor::push;
+
+    void push(Task* task) override;
+
+    size_t numThreads() const override{
+      return xstreams_.size();
+    }
+
+    int workerIndex() const override;
+
+    // switches to another ULT of this stream, if any
+    bool tryRunOne() override;
+
+    void yield() override;
+
+    uint64_t externalPushes() const override{
+      return externalPushes_;
+    }
+
   private:
+    // the task of a ULT on a pool stack, kept at the top of that stack
+    struct Ult_{
+      Task* task;
+      ArgoPool* pool;
+      char* stack;
+      size_t size;
+      Ult_* next;
+    };
+
+    // the ULTs that have finished on a stream, touched only by it
+    struct alignas(64) Stream_{
+      Ult_* finished = nullptr;
+    };
+
+    static const size_t ULT_SIZE = 64;
+
+    static_assert(sizeof(Ult_) <= ULT_SIZE, "ULT record too large");
+
+    static void run_(void* arg);
+
+    static void runOnStack_(void* arg);
+
+    bool pushOnStack_(ABT_pool pool, Task* task, size_t bytes);
+
+    // returns the stacks of the ULTs that finished on the calling stream,
+    // all of which have switched off them by the time it runs again
+    void reap_();
+
+    std::vector<ABT_xstream> xstreams_;
+    std::vector<ABT_pool> pools_;
+    std::vector<Stream_> streams_;
     
-    // this could be static since only one instance of ArgoPool may exist
-    //    int threadId;
-    static ABT_xstream *xstreams;
-    static ABT_pool *pools;
-    static int numStreams;
-    static int nextPool;  // creating threads round robin in pools
+    // external pushes are spread round robin
+    std::atomic<uint64_t> externalPushes_{0};
   };
   
 } // namespace ares
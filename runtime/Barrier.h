@@ -49,51 +49,160 @@
  * #####
  */
 
+
 #ifndef __ARES_BARRIER_H__
 #define __ARES_BARRIER_H__
 
-#include <mutex>
-#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "Futex.h"
 
 namespace ares{
 
+  // a combining tree of counters, each shared by at most FAN_IN threads
+  // or nodes, so no counter sees all of the arrivals, the last to arrive
+  // at the root moves the barrier to its next episode, which the waiters
+  // spin on, backing off to yielding and then to sleeping on a futex.
+  // The episode is the sense, counted rather than flipped.
   class Barrier{
   public:
-      Barrier(size_t count)
-      : initialCount_(count), 
-      count_(count),
-      ready_(false){}
-
-      void wait(){
-        std::unique_lock<std::mutex> lock(mutex_);
-
-        if(ready_){
-          if(++count_ == initialCount_) {
-            ready_ = false;
-            cond_.notify_all();
+    using Token = int32_t;
+
+    static const size_t FAN_IN = 4;
+
+    Barrier(size_t count)
+    : count_(count),
+    spin_(count <= std::thread::hardware_concurrency()){
+      size_t width = count;
+      int32_t first = 0;
+
+      do{
+        size_t parents = (width + FAN_IN - 1) / FAN_IN;
+        int32_t next = first + int32_t(parents);
+
+        for(size_t i = 0; i < parents; ++i){
+          Node node;
+          size_t children = width - i * FAN_IN;
+          node.expected = uint32_t(std::min(children, size_t(FAN_IN)));
+          node.parent = parents > 1 ? next + int32_t(i / FAN_IN) : -1;
+          nodes_.push_back(node);
+        }
+
+        first = next;
+        width = parents;
+      } while(width > 1);
+    }
+
+    Barrier(const Barrier&) = delete;
+
+    void wait(){
+      wait(arrive());
+    }
+
+    // the first half of wait(), work that does not depend on the other
+    // threads can be done before waiting with the token
+    Token arrive(){
+      return arrive(tickets_.fetch_add(1, std::memory_order_relaxed) % 
+                    count_);
+    }
+
+    // id is unique among the threads of an episode, such as a worker
+    // index, and saves taking a ticket
+    Token arrive(size_t id){
+      Token episode = episode_.load(std::memory_order_acquire);
+
+      int32_t i = int32_t(id / FAN_IN);
+      for(;;){
+        Node& node = nodes_[i];
+        if(node.count.fetch_add(1, std::memory_order_acq_rel) + 1 <
+           node.expected){
+          return episode;
+        }
+
+        // the last one in resets it for the next episode
+        node.count.store(0, std::memory_order_relaxed);
+
+        if(node.parent < 0){
+          break;
+        }
+        i = node.parent;
+      }
+
+      episode_.fetch_add(1);
+      if(sleepers_.load() > 0){
+        futexWake(&episode_);
+      }
+
+      return episode;
+    }
+
+    // with more threads than CPUs, the one being waited for may need
+    // the CPU, so the waiters go straight to yielding it
+    void wait(Token token){
+      uint32_t spins = spin_ ? 0 : SPINS;
+
+      while(episode_.load(std::memory_order_acquire) == token){
+        if(spins < SPINS){
+          for(uint32_t j = 0; j < (1u << std::min(spins / 8, 6u)); ++j){
+            cpuRelax();
           }
-          else{
-            cond_.wait(lock, [&]{ return !ready_; });
-          } 
+        }
+        else if(spins < SPINS + YIELDS){
+          std::this_thread::yield();
         }
         else{
-          if(--count_ == 0){
-            ready_ = true;
-            cond_.notify_all();
-          }
-          else{
-            cond_.wait(lock, [&]{ return ready_; });
-          }
+          sleepers_.fetch_add(1);
+          futexWait(&episode_, token);
+          sleepers_.fetch_sub(1);
         }
+        ++spins;
       }
+    }
+
+    // true once the episode of token has completed
+    bool test(Token token) const{
+      return episode_.load(std::memory_order_acquire) != token;
+    }
 
   private:
-    std::condition_variable cond_;
-    std::mutex mutex_;
+    // turns of the backoff spent spinning, with a growing pause, and then
+    // yielding before sleeping
+    static const uint32_t SPINS = 64;
+    static const uint32_t YIELDS = 64;
+
+    static const size_t CACHE_LINE = 64;
+
+    // padded rather than aligned, which the allocator need not honour,
+    // so that the counters of two nodes are never on the same line
+    struct Node{
+      std::atomic<uint32_t> count{0};
+      uint32_t expected;
+      int32_t parent;
+      char pad[CACHE_LINE - 12];
+
+      Node() = default;
+
+      Node(const Node& node)
+      : count(0),
+      expected(node.expected),
+      parent(node.parent){}
+    };
 
-    size_t initialCount_;
     size_t count_;
-    bool ready_;
+    bool spin_;
+    std::vector<Node> nodes_;
+    char pad0_[CACHE_LINE];
+    std::atomic<Token> episode_{0};
+    char pad1_[CACHE_LINE];
+    std::atomic<uint32_t> sleepers_{0};
+    char pad2_[CACHE_LINE];
+    std::atomic<size_t> tickets_{0};
+    char pad3_[CACHE_LINE];
   }; 
 
 } // namespace ares
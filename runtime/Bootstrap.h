@@ -0,0 +1,169 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_BOOTSTRAP_H__
+#define __ARES_BOOTSTRAP_H__
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace ares{
+
+// a key-value store shared by the processes of a job through a directory
+// they can all see, each key is a file, written under a temporary name
+// and renamed so a reader never sees it half written
+class Bootstrap{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit Bootstrap(const std::string& dir)
+  : dir_(dir){
+    mkdir(dir_.c_str(), 0700);
+  }
+
+  const std::string& dir() const{
+    return dir_;
+  }
+
+  // replaces any value left from an earlier run
+  bool put(const std::string& key, const std::string& value){
+    std::string path = path_(key);
+
+    std::ostringstream tmp;
+    tmp << path << ".tmp." << getpid();
+
+    {
+      std::ofstream out(tmp.str());
+      out << value;
+      if(!out){
+        return false;
+      }
+    }
+
+    return rename(tmp.str().c_str(), path.c_str()) == 0;
+  }
+
+  // the value of key if it is there
+  bool tryGet(const std::string& key, std::string& value) const{
+    std::ifstream in(path_(key));
+    if(!in){
+      return false;
+    }
+
+    std::ostringstream s;
+    s << in.rdbuf();
+    value = s.str();
+    return true;
+  }
+
+  // waits until key is there, polling less often the longer it takes,
+  // false if it is not by the deadline
+  bool get(const std::string& key, std::string& value,
+           Clock::time_point deadline) const{
+    auto backoff = std::chrono::milliseconds(1);
+
+    while(!tryGet(key, value)){
+      if(Clock::now() >= deadline){
+        return false;
+      }
+
+      std::this_thread::sleep_for(backoff);
+      backoff = std::min(backoff * 2,
+                         std::chrono::milliseconds(int(MAX_POLL)));
+    }
+
+    return true;
+  }
+
+  // the host and port that rank listens on
+  void publish(int rank, const std::string& host, int port){
+    std::ostringstream value;
+    value << host << " " << port;
+    put(endpointKey_(rank), value.str());
+  }
+
+  bool lookup(int rank, std::string& host, int& port,
+              Clock::time_point deadline) const{
+    std::string value;
+    if(!get(endpointKey_(rank), value, deadline)){
+      return false;
+    }
+
+    std::istringstream in(value);
+    return bool(in >> host >> port);
+  }
+
+private:
+  // milliseconds between polls at most
+  static const int MAX_POLL = 100;
+
+  std::string path_(const std::string& key) const{
+    return dir_ + "/" + key;
+  }
+
+  static std::string endpointKey_(int rank){
+    return "rank-" + std::to_string(rank);
+  }
+
+  std::string dir_;
+};
+
+} // namespace ares
+
+#endif // __ARES_BOOTSTRAP_H__
@@ -0,0 +1,201 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_BUFFER_POOL_H__
+#define __ARES_BUFFER_POOL_H__
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+#include "MemoryAccount.h"
+
+namespace ares{
+
+// message buffers in power of two size classes, recycled through shared
+// freelists since a buffer is filled by a receive thread and released by
+// whichever thread consumed the message. Buffers of a page or more are
+// page aligned so that they can later be registered with a NIC. Each
+// class caches up to MAX_CACHED_BYTES, buffers beyond that and larger
+// than the biggest class go back to the system.
+class BufferPool{
+public:
+  static const size_t PAGE_SIZE = 4096;
+
+  static void* allocate(size_t bytes){
+    uint32_t sizeClass = sizeClass_(bytes);
+    size_t offset = offset_(sizeClass, bytes);
+
+    char* base = nullptr;
+
+    if(sizeClass < NUM_CLASSES){
+      Class_& c = classes_()[sizeClass];
+      std::lock_guard<std::mutex> lock(c.mutex);
+
+      if(c.head){
+        base = reinterpret_cast<char*>(c.head);
+        c.head = c.head->next;
+        --c.size;
+      }
+    }
+
+    if(!base){
+      size_t size = size_(sizeClass, bytes);
+
+      void* ptr;
+      if(posix_memalign(&ptr, offset, offset + size) != 0){
+        return nullptr;
+      }
+      base = static_cast<char*>(ptr);
+    }
+
+    auto h = reinterpret_cast<Header_*>(base + offset - sizeof(Header_));
+    h->sizeClass = sizeClass;
+    h->base = base;
+    h->size = size_(sizeClass, bytes);
+    MemoryAccount::add(MemoryAccount::Messages, h->size);
+
+    return base + offset;
+  }
+
+  static void release(void* ptr){
+    if(!ptr){
+      return;
+    }
+
+    auto h = reinterpret_cast<Header_*>(static_cast<char*>(ptr) -
+                                        sizeof(Header_));
+    uint32_t sizeClass = h->sizeClass;
+    char* base = h->base;
+    MemoryAccount::remove(MemoryAccount::Messages, h->size);
+
+    if(sizeClass < NUM_CLASSES){
+      Class_& c = classes_()[sizeClass];
+      std::lock_guard<std::mutex> lock(c.mutex);
+
+      if(c.size < maxCached_(sizeClass)){
+        auto f = reinterpret_cast<Free_*>(base);
+        f->next = c.head;
+        c.head = f;
+        ++c.size;
+        return;
+      }
+    }
+
+    free(base);
+  }
+
+private:
+  static const size_t MIN_SIZE = 64;
+  static const uint32_t NUM_CLASSES = 21;
+  static const size_t MAX_CACHED_BYTES = 64 << 20;
+
+  struct Header_{
+    char* base;
+    size_t size;
+    uint32_t sizeClass;
+  };
+
+  // a buffer smaller than a page starts this far into its allocation,
+  // right after its header
+  static const size_t HEADER_OFFSET = 32;
+
+  static_assert(sizeof(Header_) <= HEADER_OFFSET, "header does not fit");
+
+  struct Free_{
+    Free_* next;
+  };
+
+  struct Class_{
+    std::mutex mutex;
+    Free_* head = nullptr;
+    size_t size = 0;
+  };
+
+  // never destroyed, buffers may be released while the process exits
+  static Class_* classes_(){
+    static Class_* classes = new Class_[NUM_CLASSES];
+    return classes;
+  }
+
+  static size_t maxCached_(uint32_t sizeClass){
+    size_t n = MAX_CACHED_BYTES/(MIN_SIZE << sizeClass);
+    return n > 0 ? n : 1;
+  }
+
+  // the header sits right before the buffer, which a page sized buffer
+  // starts a page in
+  static size_t offset_(uint32_t sizeClass, size_t bytes){
+    return size_(sizeClass, bytes) >= PAGE_SIZE ? PAGE_SIZE : HEADER_OFFSET;
+  }
+
+  static size_t size_(uint32_t sizeClass, size_t bytes){
+    return sizeClass < NUM_CLASSES ? MIN_SIZE << sizeClass : bytes;
+  }
+
+  static uint32_t sizeClass_(size_t bytes){
+    uint32_t c = 0;
+    size_t size = MIN_SIZE;
+
+    while(size < bytes && c < NUM_CLASSES){
+      size <<= 1;
+      ++c;
+    }
+
+    return c;
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_BUFFER_POOL_H__
@@ -0,0 +1,140 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_CHANNEL_H__
+#define __ARES_CHANNEL_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+
+namespace ares{
+
+// one end of a connection on a non-blocking descriptor, whose calls do
+// what they can right away and are otherwise retried by the dispatcher
+// once its progress engine sees the descriptor ready
+class Channel{
+public:
+  Channel(int fd)
+  : fd_(fd){
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+  }
+
+  virtual ~Channel(){}
+
+  int fd() const{
+    return fd_;
+  }
+
+  // what the kernel took of the pieces, or -1 with errno set to EAGAIN
+  // if it has no room
+  virtual ssize_t write(const iovec* iov, int n) = 0;
+
+  virtual ssize_t read(char* buf, size_t size) = 0;
+
+  // called by the engine each time the descriptor is ready, before the
+  // channel is written or read
+  virtual void poll(){}
+
+  // data has arrived without the descriptor becoming ready, which is
+  // how a busy polling engine finds it
+  virtual bool pending() const{
+    return false;
+  }
+
+  // like write() but without copying the pieces if the channel can,
+  // each call that takes any of them counts in zeroCopySent()
+  virtual ssize_t writeZeroCopy(const iovec* iov, int n){
+    return write(iov, n);
+  }
+
+  virtual bool zeroCopy() const{
+    return false;
+  }
+
+  virtual uint64_t zeroCopySent() const{
+    return 0;
+  }
+
+  // bodies of at least Compression::threshold() bytes are compressed on
+  // channels over a network
+  virtual bool compress() const{
+    return false;
+  }
+
+  // how many of the zero copy writes the kernel is done with, so that
+  // their pieces may be reused
+  virtual uint64_t zeroCopyDone(){
+    return 0;
+  }
+
+  // moves up to size bytes that have arrived to fd, a file or a socket,
+  // without them passing through the process, on channels where
+  // canSplice(), otherwise -1 with errno set to ENOTSUP
+  virtual ssize_t spliceTo(int fd, size_t size){
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  virtual bool canSplice() const{
+    return false;
+  }
+
+protected:
+  int fd_;
+};
+
+} // namespace ares
+
+#endif // __ARES_CHANNEL_H__
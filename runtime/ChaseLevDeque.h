@@ -0,0 +1,229 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_CHASE_LEV_DEQUE_H__
+#define __ARES_CHASE_LEV_DEQUE_H__
+
+#include <atomic>
+#include <cstdint>
+
+#include "Epoch.h"
+
+namespace ares{
+
+// Chase-Lev work-stealing deque, following Le et al. "Correct and
+// Efficient Work-Stealing for Weak Memory Models". Only the owning thread
+// may push() and pop(), at the bottom, any thread may steal() from the top.
+// The array grows when full and shrinks back when mostly empty, the ones
+// it replaces are retired to the Epoch, as thieves may still be reading
+// them.
+template<class T>
+class ChaseLevDeque{
+public:
+  ChaseLevDeque(size_t logSize=8)
+  : top_(0),
+  bottom_(0),
+  minLogSize_(logSize){
+    array_ = new Array_(logSize);
+  }
+
+  ~ChaseLevDeque(){
+    delete array_.load(std::memory_order_relaxed);
+  }
+
+  // returns the number of items in the deque after the push
+  int64_t push(T x){
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Array_* a = array_.load(std::memory_order_relaxed);
+
+    if(b - t > a->size() - 1){
+      a = resize_(a, a->logSize() + 1, b, t);
+    }
+    else if(shrinks_(a, b - t)){
+      a = resize_(a, a->logSize() - 1, b, t);
+    }
+
+    a->put(b, x);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+
+    return b + 1 - t;
+  }
+
+  bool pop(T& x){
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array_* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+
+    if(t > b){
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    x = a->get(b);
+
+    if(t == b){
+      // last item, race against stealers for it
+      bool won = top_.compare_exchange_strong(t, t + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+
+    if(shrinks_(a, b - t)){
+      resize_(a, a->logSize() - 1, b, t);
+    }
+
+    return true;
+  }
+
+  bool steal(T& x){
+    Epoch::Guard guard;
+
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+
+    if(t >= b){
+      return false;
+    }
+
+    Array_* a = array_.load(std::memory_order_acquire);
+    x = a->get(t);
+
+    return top_.compare_exchange_strong(t, t + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed);
+  }
+
+  bool empty() const{
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return b <= t;
+  }
+
+  ChaseLevDeque& operator=(const ChaseLevDeque&) = delete;
+
+  ChaseLevDeque(const ChaseLevDeque&) = delete;
+
+private:
+  class Array_;
+
+  // an eighth full, so that a deque hovering around a size does not
+  // resize back and forth
+  bool shrinks_(Array_* a, int64_t n) const{
+    return a->logSize() > minLogSize_ && n < a->size() / 8;
+  }
+
+  // only the owner resizes, thieves that loaded the old array may still
+  // be reading it
+  Array_* resize_(Array_* a, size_t logSize, int64_t b, int64_t t){
+    Array_* c = a->copy(logSize, b, t);
+    array_.store(c, std::memory_order_release);
+    Epoch::retire(a);
+    return c;
+  }
+
+  class Array_{
+  public:
+    Array_(size_t logSize)
+    : logSize_(logSize),
+    buf_(new std::atomic<T>[size_t(1) << logSize]){}
+
+    ~Array_(){
+      delete[] buf_;
+    }
+
+    size_t logSize() const{
+      return logSize_;
+    }
+
+    int64_t size() const{
+      return int64_t(1) << logSize_;
+    }
+
+    T get(int64_t i) const{
+      return buf_[i & (size() - 1)].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, T x){
+      buf_[i & (size() - 1)].store(x, std::memory_order_relaxed);
+    }
+
+    Array_* copy(size_t logSize, int64_t bottom, int64_t top) const{
+      Array_* a = new Array_(logSize);
+      for(int64_t i = top; i < bottom; ++i){
+        a->put(i, get(i));
+      }
+      return a;
+    }
+
+  private:
+    size_t logSize_;
+    std::atomic<T>* buf_;
+  };
+
+  // keep the ends on separate cache lines, owner and thieves write to
+  // different ones
+  std::atomic<int64_t> top_;
+  char pad_[64];
+  std::atomic<int64_t> bottom_;
+  std::atomic<Array_*> array_;
+  size_t minLogSize_;
+};
+
+} // namespace ares
+
+#endif // __ARES_CHASE_LEV_DEQUE_H__
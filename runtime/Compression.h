@@ -0,0 +1,123 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_COMPRESSION_H__
+#define __ARES_COMPRESSION_H__
+
+#include <cstdlib>
+#include <cstddef>
+
+#ifdef ARES_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace ares{
+
+// compresses the bodies of large messages sent over slow links, with
+// zstd if it was found at build time and otherwise never
+class Compression{
+public:
+  // ARES_COMPRESS is the size from which bodies are compressed, unset or
+  // 0 turns it off
+  static size_t threshold(){
+#ifdef ARES_HAVE_ZSTD
+    static size_t size = []{
+      const char* s = getenv("ARES_COMPRESS");
+      return s ? size_t(atoll(s)) : 0;
+    }();
+    return size;
+#else
+    return 0;
+#endif
+  }
+
+  // the largest that size bytes compress to
+  static size_t bound(size_t size){
+#ifdef ARES_HAVE_ZSTD
+    return ZSTD_compressBound(size);
+#else
+    return size;
+#endif
+  }
+
+  // the size of what was written to out, 0 if it did not fit, the
+  // higher ARES_COMPRESS_LEVEL the smaller and slower, 1 by default
+  static size_t compress(const char* in, size_t size, char* out,
+                         size_t capacity){
+#ifdef ARES_HAVE_ZSTD
+    static int level = []{
+      const char* s = getenv("ARES_COMPRESS_LEVEL");
+      return s ? atoi(s) : 1;
+    }();
+
+    size_t n = ZSTD_compress(out, capacity, in, size, level);
+    return ZSTD_isError(n) ? 0 : n;
+#else
+    return 0;
+#endif
+  }
+
+  // false unless in decompresses to exactly size bytes
+  static bool decompress(const char* in, size_t inSize, char* out,
+                         size_t size){
+#ifdef ARES_HAVE_ZSTD
+    size_t n = ZSTD_decompress(out, size, in, inSize);
+    return !ZSTD_isError(n) && n == size;
+#else
+    return false;
+#endif
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_COMPRESSION_H__
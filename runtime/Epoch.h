@@ -0,0 +1,235 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_EPOCH_H__
+#define __ARES_EPOCH_H__
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace ares{
+
+// epoch based reclamation, after Fraser's "Practical Lock-Freedom", for
+// memory that lock-free readers may still hold a pointer into after it
+// has been unlinked. Readers run inside a Guard, and an unlinked object
+// is retire()d rather than deleted, to be freed once every thread that
+// was in a Guard when it was retired has left it. The global epoch
+// advances only when every thread in a Guard has seen the current one,
+// so what was retired two epochs ago can no longer be reached.
+class Epoch{
+  struct Record_;
+
+public:
+  using Deleter = void (*)(void*);
+
+  // guards may nest, only the outermost one announces the thread
+  class Guard{
+  public:
+    Guard()
+    : record_(local_().record){
+      if(record_->depth++ == 0){
+        record_->epoch.store(epoch_().load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+        // the announcement is seen before any of the reads it protects
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+    }
+
+    ~Guard(){
+      if(--record_->depth == 0){
+        record_->epoch.store(QUIESCENT, std::memory_order_release);
+      }
+    }
+
+    Guard(const Guard&) = delete;
+
+    Guard& operator=(const Guard&) = delete;
+
+  private:
+    Record_* record_;
+  };
+
+  // frees obj with deleter once no Guard can still reach it
+  static void retire(void* obj, Deleter deleter){
+    Record_& r = *local_().record;
+    uint64_t e = epoch_().load(std::memory_order_acquire);
+
+    if(r.retired.size() >= COLLECT_THRESHOLD){
+      collect_(r, e);
+      e = epoch_().load(std::memory_order_acquire);
+    }
+
+    r.retired.push_back({obj, deleter, e});
+  }
+
+  template<class T>
+  static void retire(T* obj){
+    retire(obj, [](void* p){ delete static_cast<T*>(p); });
+  }
+
+  // tries to advance the epoch and frees what the calling thread has
+  // retired that is safe to, done by threads about to go idle so that
+  // memory does not wait for the next retire()
+  static void collect(){
+    Record_& r = *local_().record;
+    if(!r.retired.empty()){
+      collect_(r, epoch_().load(std::memory_order_acquire));
+    }
+  }
+
+private:
+  static const uint64_t QUIESCENT = 0;
+
+  static const size_t COLLECT_THRESHOLD = 64;
+
+  struct Retired_{
+    void* obj;
+    Deleter deleter;
+    uint64_t epoch;
+  };
+
+  // records are never freed, a thread that exits gives its record up
+  // for another to claim, along with anything it retired that could not
+  // be freed yet
+  struct Record_{
+    std::atomic<uint64_t> epoch{QUIESCENT};
+    std::atomic<bool> owned{true};
+    Record_* next = nullptr;
+    uint32_t depth = 0;
+    std::vector<Retired_> retired;
+    char pad_[64];
+  };
+
+  struct Local_{
+    Local_()
+    : record(claim_()){}
+
+    ~Local_(){
+      collect();
+      record->owned.store(false, std::memory_order_release);
+    }
+
+    Record_* record;
+  };
+
+  // the epoch starts at 1 so it is never QUIESCENT
+  static std::atomic<uint64_t>& epoch_(){
+    static std::atomic<uint64_t> epoch(1);
+    return epoch;
+  }
+
+  static std::atomic<Record_*>& records_(){
+    static std::atomic<Record_*> records(nullptr);
+    return records;
+  }
+
+  static Local_& local_(){
+    static thread_local Local_ local;
+    return local;
+  }
+
+  static Record_* claim_(){
+    auto& records = records_();
+
+    for(Record_* r = records.load(std::memory_order_acquire); r; 
+        r = r->next){
+      bool owned = false;
+      if(!r->owned.load(std::memory_order_relaxed) &&
+         r->owned.compare_exchange_strong(owned, true,
+                                          std::memory_order_acquire)){
+        return r;
+      }
+    }
+
+    Record_* r = new Record_;
+    r->next = records.load(std::memory_order_relaxed);
+    while(!records.compare_exchange_weak(r->next, r,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)){}
+    return r;
+  }
+
+  // the epoch moves on from e if every thread in a Guard has seen e
+  static void tryAdvance_(uint64_t e){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for(Record_* r = records_().load(std::memory_order_acquire); r;
+        r = r->next){
+      uint64_t re = r->epoch.load(std::memory_order_acquire);
+      if(re != QUIESCENT && re != e){
+        return;
+      }
+    }
+
+    epoch_().compare_exchange_strong(e, e + 1, std::memory_order_acq_rel,
+                                     std::memory_order_relaxed);
+  }
+
+  static void collect_(Record_& r, uint64_t e){
+    tryAdvance_(e);
+    e = epoch_().load(std::memory_order_acquire);
+
+    // retired in order, so the ones that are safe to free come first
+    size_t n = 0;
+    while(n < r.retired.size() && r.retired[n].epoch + 2 <= e){
+      r.retired[n].deleter(r.retired[n].obj);
+      ++n;
+    }
+    r.retired.erase(r.retired.begin(), r.retired.begin() + n);
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_EPOCH_H__
@@ -0,0 +1,194 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_EXECUTOR_H__
+#define __ARES_EXECUTOR_H__
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <cstdint>
+
+#include "TaskPool.h"
+
+namespace ares{
+
+// the scheduler the runtime queues its tasks on, one is chosen when the
+// runtime starts. Tasks are released to the TaskPool by the executor
+// once they have run.
+class Executor{
+public:
+  // snapshot of one worker's counters, idle time is spent waiting for
+  // work, busy time is the rest of the worker's lifetime
+  struct WorkerStats{
+    uint64_t tasksExecuted;
+    uint64_t tasksPushed;
+    uint64_t stealAttempts;
+    uint64_t steals;
+    // steals from workers on another NUMA node, and this one's node
+    uint64_t remoteSteals;
+    int numaNode;
+    uint64_t peakQueueDepth;
+    double idleTime;
+    double busyTime;
+  };
+
+  virtual ~Executor(){}
+
+  virtual void push(Task* task) = 0;
+
+  void push(FuncPtr func, void* arg, uint32_t priority){
+    push(TaskPool::allocate(func, arg, priority));
+  }
+
+  // the tasks of one range, which an executor may publish at once
+  virtual void pushRange(Task** tasks, size_t n){
+    for(size_t i = 0; i < n; ++i){
+      push(tasks[i]);
+    }
+  }
+
+  // task i is meant for worker i % numThreads(), so that identical
+  // ranges run the same chunks on the same workers every time. It is a
+  // preference, executors without per-worker queues push them as usual.
+  virtual void pushToWorkers(Task** tasks, size_t n){
+    pushRange(tasks, n);
+  }
+
+  // task is meant for worker, again a preference, which the others only
+  // take from it once they have run out of work of their own
+  virtual void pushToWorker(Task* task, size_t worker){
+    push(task);
+  }
+
+  // the workers are split into this many groups, those of one NUMA node,
+  // which the partitions of a region are placed on
+  virtual size_t numGroups() const{
+    return 1;
+  }
+
+  // task is meant for a worker of group % numGroups(), again a
+  // preference, executors without groups push it as usual
+  virtual void pushToGroup(Task* task, size_t group){
+    push(task);
+  }
+
+  // runs body over [start, end) split into pieces no larger than grain
+  using RangeBody = std::function<void(uint32_t begin, uint32_t end)>;
+
+  // executors with their own loop dispatch run the whole range before
+  // returning true, false has it split into tasks as usual
+  virtual bool runRange(uint32_t start, uint32_t end, uint32_t grain,
+                        const RangeBody& body){
+    return false;
+  }
+
+  virtual size_t numThreads() const = 0;
+
+  // the workers there are, which worker indices stay below, those that
+  // do not take part after setNumThreads() included
+  virtual size_t maxThreads() const{
+    return numThreads();
+  }
+
+  // has n workers take part from now on and returns the number that do,
+  // which stays the same for executors that cannot be resized
+  virtual size_t setNumThreads(size_t n){
+    return numThreads();
+  }
+
+  // ends the workers for the end of the process, queued tasks are dropped
+  virtual void stop(){}
+
+  // index of the calling worker, or -1 if it is not one of ours
+  virtual int workerIndex() const = 0;
+
+  // run one queued task on the calling worker, if any is available
+  virtual bool tryRunOne() = 0;
+
+  // take task back if it was the calling worker's last push and has not
+  // started, see ThreadPool::tryTakeBack()
+  virtual bool tryTakeBack(Task* task){
+    return false;
+  }
+
+  // whether the workers have run out of queued work to take, which
+  // bundles of tasks are split for
+  virtual bool starving() const{
+    return false;
+  }
+
+  // let other work run on the calling worker while it waits
+  virtual void yield(){
+    std::this_thread::yield();
+  }
+
+  virtual std::vector<WorkerStats> stats() const{
+    return {};
+  }
+
+  // pushes made by threads that are not workers
+  virtual uint64_t externalPushes() const{
+    return 0;
+  }
+};
+
+using ExecutorFactory = Executor* (*)(size_t numThreads);
+
+// makes an executor selectable at startup with ARES_BACKEND=name, it has
+// to be registered before the runtime first queues work, for instance
+// from a static initializer of the library that provides it
+void registerExecutor(const std::string& name, ExecutorFactory factory);
+
+} // namespace ares
+
+#endif // __ARES_EXECUTOR_H__
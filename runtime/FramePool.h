@@ -0,0 +1,174 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_FRAME_POOL_H__
+#define __ARES_FRAME_POOL_H__
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+#include "MemoryAccount.h"
+
+namespace ares{
+
+// variable sized frames for the argument structs of spawned task calls,
+// carved from power of two size classes and recycled through per-thread
+// freelists. A frame is normally released by the thread that spawned it
+// once it has read the result, so the freelists are unsynchronized and
+// capped, frames beyond the cap and larger than the biggest class go
+// back to malloc.
+class FramePool{
+public:
+  static const size_t ALIGN = 16;
+
+  static void* allocate(size_t bytes){
+    uint32_t sizeClass = sizeClass_(bytes + ALIGN);
+
+    Header_* h;
+    size_t size = MIN_SIZE << sizeClass;
+
+    if(sizeClass == NUM_CLASSES){
+      size = bytes + ALIGN;
+      h = static_cast<Header_*>(malloc(size));
+    }
+    else{
+      Cache_& cache = cache_();
+      Free_*& head = cache.head[sizeClass];
+
+      if(head){
+        h = reinterpret_cast<Header_*>(head);
+        head = head->next;
+        --cache.size[sizeClass];
+      }
+      else{
+        h = static_cast<Header_*>(malloc(size));
+      }
+    }
+
+    h->sizeClass = sizeClass;
+    h->size = size;
+    MemoryAccount::add(MemoryAccount::TaskFrames, size);
+
+    return reinterpret_cast<char*>(h) + ALIGN;
+  }
+
+  static void release(void* ptr){
+    auto h = reinterpret_cast<Header_*>(static_cast<char*>(ptr) - ALIGN);
+    uint32_t sizeClass = h->sizeClass;
+    MemoryAccount::remove(MemoryAccount::TaskFrames, h->size);
+
+    Cache_& cache = cache_();
+
+    if(sizeClass == NUM_CLASSES || cache.size[sizeClass] >= MAX_CACHED){
+      free(h);
+      return;
+    }
+
+    auto f = reinterpret_cast<Free_*>(h);
+    f->next = cache.head[sizeClass];
+    cache.head[sizeClass] = f;
+    ++cache.size[sizeClass];
+  }
+
+private:
+  static const size_t MIN_SIZE = 64;
+  static const uint32_t NUM_CLASSES = 8;
+  static const size_t MAX_CACHED = 256;
+
+  // the size of the block, as it is accounted
+  struct Header_{
+    uint32_t sizeClass;
+    size_t size;
+  };
+
+  static_assert(sizeof(Header_) <= ALIGN, "header must keep alignment");
+
+  struct Free_{
+    Free_* next;
+  };
+
+  struct Cache_{
+    ~Cache_(){
+      for(uint32_t i = 0; i < NUM_CLASSES; ++i){
+        while(head[i]){
+          Free_* f = head[i];
+          head[i] = f->next;
+          free(f);
+        }
+      }
+    }
+
+    Free_* head[NUM_CLASSES] = {};
+    size_t size[NUM_CLASSES] = {};
+  };
+
+  static Cache_& cache_(){
+    static thread_local Cache_ cache;
+    return cache;
+  }
+
+  static uint32_t sizeClass_(size_t bytes){
+    uint32_t c = 0;
+    size_t size = MIN_SIZE;
+
+    while(size < bytes && c < NUM_CLASSES){
+      size <<= 1;
+      ++c;
+    }
+
+    return c;
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_FRAME_POOL_H__
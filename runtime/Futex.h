@@ -0,0 +1,118 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_FUTEX_H__
+#define __ARES_FUTEX_H__
+
+#include <atomic>
+#include <cstdint>
+#include <climits>
+
+#include <thread>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
+#endif
+
+namespace ares{
+
+inline void cpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// one turn of a spin wait, the thread yields every so often in case the
+// one it waits for shares its core
+inline void spinWait(uint32_t& spins){
+  if(++spins % 1024 == 0){
+    std::this_thread::yield();
+  }
+  else{
+    cpuRelax();
+  }
+}
+
+// block while *addr == expected, for at most timeoutNs if that is not
+// negative, spurious returns are possible so callers must re-check their
+// condition
+inline void futexWait(std::atomic<int32_t>* addr, int32_t expected,
+                      int64_t timeoutNs=-1){
+#ifdef __linux__
+  timespec ts;
+  ts.tv_sec = timeoutNs / 1000000000;
+  ts.tv_nsec = timeoutNs % 1000000000;
+
+  syscall(SYS_futex, reinterpret_cast<int32_t*>(addr),
+          FUTEX_WAIT_PRIVATE, expected, timeoutNs < 0 ? nullptr : &ts,
+          nullptr, 0);
+#else
+  if(addr->load(std::memory_order_acquire) == expected){
+    std::this_thread::yield();
+  }
+#endif
+}
+
+inline void futexWake(std::atomic<int32_t>* addr, int32_t count=INT_MAX){
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<int32_t*>(addr),
+          FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#endif
+}
+
+} // namespace ares
+
+#endif // __ARES_FUTEX_H__
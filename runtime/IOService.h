@@ -0,0 +1,154 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_IO_SERVICE_H__
+#define __ARES_IO_SERVICE_H__
+
+#include <cstdlib>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ares{
+
+// a few threads of their own, outside of the worker pool, that run
+// blocking I/O such as the writes of snapshots, so that the Foralls of
+// the next step keep every worker. ARES_IO_THREADS of them, 1 by
+// default, started on the first submit() and niced by ARES_IO_NICE, 10
+// by default, so that they yield the CPU to the workers.
+class IOService{
+public:
+  static IOService& get(){
+    static IOService* service = new IOService;
+    return *service;
+  }
+
+  void submit(std::function<void()> job){
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+    ++pending_;
+
+    if(!started_){
+      started_ = true;
+      start_();
+    }
+
+    lock.unlock();
+    cv_.notify_one();
+  }
+
+  // the jobs submitted and not yet finished
+  size_t pending(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_;
+  }
+
+  IOService& operator=(const IOService&) = delete;
+
+  IOService(const IOService&) = delete;
+
+private:
+  IOService()
+  : started_(false),
+  pending_(0){}
+
+  void start_(){
+    const char* s = getenv("ARES_IO_THREADS");
+    int n = s ? atoi(s) : 1;
+
+    s = getenv("ARES_IO_NICE");
+    int nice = s ? atoi(s) : 10;
+
+    for(int i = 0; i < (n > 0 ? n : 1); ++i){
+      std::thread([this, nice]{
+#ifdef __linux__
+        setpriority(PRIO_PROCESS, pid_t(syscall(SYS_gettid)), nice);
+#endif
+        run_();
+      }).detach();
+    }
+  }
+
+  void run_(){
+    for(;;){
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]{ return !jobs_.empty(); });
+
+      std::function<void()> job = std::move(jobs_.front());
+      jobs_.pop_front();
+      lock.unlock();
+
+      job();
+
+      lock.lock();
+      --pending_;
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> jobs_;
+  bool started_;
+  size_t pending_;
+};
+
+} // namespace ares
+
+#endif // __ARES_IO_SERVICE_H__
@@ -0,0 +1,204 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_IDLE_SEMAPHORE_H__
+#define __ARES_IDLE_SEMAPHORE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "Futex.h"
+
+namespace ares{
+
+// how long an idle worker stays awake before parking. A worker first
+// spins, doubling its pause backoff up to maxBackoff, for spinCount
+// rounds, then yields for yieldCount rounds, and only then sleeps
+struct IdlePolicy{
+  enum Kind{
+    Latency,
+    Balanced,
+    Power
+  };
+
+  IdlePolicy(Kind kind=Balanced){
+    switch(kind){
+      case Latency:
+        spinCount = 1 << 14;
+        maxBackoff = 16;
+        yieldCount = 256;
+        break;
+      case Balanced:
+        spinCount = 1 << 10;
+        maxBackoff = 64;
+        yieldCount = 16;
+        break;
+      case Power:
+        spinCount = 0;
+        maxBackoff = 1;
+        yieldCount = 0;
+        break;
+    }
+  }
+
+  uint32_t spinCount;
+  uint32_t maxBackoff;
+  uint32_t yieldCount;
+
+  // how long a worker sleeps without work before it parks until a push
+  // needs it, which fewer of the pushes then wake, negative for never
+  int64_t parkAfterNs = -1;
+};
+
+// counting semaphore whose release() costs a single atomic increment
+// unless a thread is parked, and whose acquire() follows an IdlePolicy
+class IdleSemaphore{
+public:
+  IdleSemaphore(int32_t count=0)
+  : count_(count),
+  sleepers_(0){}
+
+  bool tryAcquire(){
+    int32_t c = count_.load(std::memory_order_seq_cst);
+
+    while(c > 0){
+      if(count_.compare_exchange_weak(c, c - 1,
+                                      std::memory_order_acquire)){
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // false only if it slept for timeoutNs, when that is not negative,
+  // without a token coming
+  bool acquire(const IdlePolicy& policy, int64_t timeoutNs=-1){
+    uint32_t backoff = 1;
+
+    for(uint32_t i = 0; i < policy.spinCount; ++i){
+      if(tryAcquire()){
+        return true;
+      }
+
+      for(uint32_t j = 0; j < backoff; ++j){
+        cpuRelax();
+      }
+
+      if(backoff < policy.maxBackoff){
+        backoff <<= 1;
+      }
+    }
+
+    for(uint32_t i = 0; i < policy.yieldCount; ++i){
+      if(tryAcquire()){
+        return true;
+      }
+
+      std::this_thread::yield();
+    }
+
+    // the seq_cst increment of sleepers_ and load of count_ pair with
+    // the increment of count_ and load of sleepers_ in release(), so
+    // either we see the new token or the releaser sees us and wakes us
+    sleepers_.fetch_add(1, std::memory_order_seq_cst);
+
+    auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::nanoseconds(timeoutNs);
+
+    while(!tryAcquire()){
+      if(timeoutNs < 0){
+        futexWait(&count_, 0);
+        continue;
+      }
+
+      int64_t left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        deadline - std::chrono::steady_clock::now()).count();
+
+      if(left <= 0){
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      futexWait(&count_, 0, left);
+    }
+
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // the tokens not yet acquired
+  int32_t count() const{
+    return count_.load(std::memory_order_seq_cst);
+  }
+
+  void release(int32_t n=1){
+    count_.fetch_add(n, std::memory_order_seq_cst);
+
+    if(sleepers_.load(std::memory_order_seq_cst) > 0){
+      futexWake(&count_, n);
+    }
+  }
+
+  IdleSemaphore& operator=(const IdleSemaphore&) = delete;
+
+  IdleSemaphore(const IdleSemaphore&) = delete;
+
+private:
+  std::atomic<int32_t> count_;
+  std::atomic<int32_t> sleepers_;
+};
+
+} // namespace ares
+
+#endif // __ARES_IDLE_SEMAPHORE_H__
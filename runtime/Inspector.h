@@ -0,0 +1,165 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_INSPECTOR_H__
+#define __ARES_INSPECTOR_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace ares{
+
+// the inspector of an irregular Forall, iteration i of which reads the
+// elements that its row of a connectivity array names. The iterations
+// are reordered by reverse Cuthill-McKee, so that iterations that read
+// the same elements are close in the order, and the order is cut into
+// chunks of about the same work, the iterations plus the elements they
+// name, a few per worker. Run with a static schedule, each chunk goes
+// to the same worker on every step and keeps its elements in its cache.
+class Inspector{
+public:
+  static const size_t CHUNKS_PER_WORKER = 4;
+
+  // row(i, begin, end) sets the row of iteration i, the entries from
+  // begin to end of neighbors
+  template<class Row>
+  static void plan(const uint32_t* neighbors, uint32_t n, Row&& row,
+                   size_t numWorkers, std::vector<uint32_t>& order,
+                   std::vector<uint32_t>& chunks){
+    order.clear();
+    order.reserve(n);
+
+    std::vector<uint32_t> degree(n);
+    for(uint32_t i = 0; i < n; ++i){
+      uint64_t begin, end;
+      row(i, begin, end);
+      degree[i] = uint32_t(end - begin);
+    }
+
+    // each component from one of its vertices of least degree
+    std::vector<uint32_t> starts(n);
+    for(uint32_t i = 0; i < n; ++i){
+      starts[i] = i;
+    }
+
+    std::stable_sort(starts.begin(), starts.end(),
+                     [&](uint32_t a, uint32_t b){
+                       return degree[a] < degree[b];
+                     });
+
+    std::vector<bool> visited(n, false);
+    std::vector<uint32_t> next;
+
+    for(uint32_t s : starts){
+      if(visited[s]){
+        continue;
+      }
+
+      visited[s] = true;
+      size_t head = order.size();
+      order.push_back(s);
+
+      while(head < order.size()){
+        uint32_t v = order[head++];
+
+        uint64_t begin, end;
+        row(v, begin, end);
+
+        next.clear();
+        for(uint64_t k = begin; k < end; ++k){
+          uint32_t u = neighbors[k];
+          if(u < n && !visited[u]){
+            visited[u] = true;
+            next.push_back(u);
+          }
+        }
+
+        std::stable_sort(next.begin(), next.end(),
+                         [&](uint32_t a, uint32_t b){
+                           return degree[a] < degree[b];
+                         });
+
+        order.insert(order.end(), next.begin(), next.end());
+      }
+    }
+
+    std::reverse(order.begin(), order.end());
+
+    uint64_t work = 0;
+    for(uint32_t i = 0; i < n; ++i){
+      work += degree[i] + 1;
+    }
+
+    size_t numChunks = std::max(size_t(1), numWorkers * CHUNKS_PER_WORKER);
+    numChunks = std::min(numChunks, std::max(size_t(1), size_t(n)));
+
+    chunks.clear();
+    chunks.push_back(0);
+
+    uint64_t done = 0;
+    for(uint32_t j = 0; j < n; ++j){
+      done += degree[order[j]] + 1;
+
+      if(done * numChunks >= work * chunks.size() && j + 1 < n &&
+         chunks.size() < numChunks){
+        chunks.push_back(j + 1);
+      }
+    }
+
+    chunks.push_back(n);
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_INSPECTOR_H__
@@ -0,0 +1,121 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_KOKKOS_EXECUTOR_H__
+#define __ARES_KOKKOS_EXECUTOR_H__
+
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+
+#include <Kokkos_Core.hpp>
+
+#include "ThreadPool.h"
+
+namespace ares{
+
+// parallel fors and the partials of reduces queued from outside the pool
+// run as a Kokkos::parallel_for on the default host execution space, so
+// they use the team and affinity of the OpenMP or Threads backend Kokkos
+// was built with. Tasks, and ranges queued from a task or from within a
+// Kokkos region, which Kokkos cannot nest, go to the work-stealing pool,
+// whose workers park rather than spin against the Kokkos team.
+class KokkosExecutor : public ThreadPool{
+public:
+  using Space = Kokkos::DefaultHostExecutionSpace;
+
+  KokkosExecutor(size_t numThreads)
+  : ThreadPool(numThreads, {}, IdlePolicy(IdlePolicy::Power)){
+    if(!Space::is_initialized()){
+      Kokkos::InitArguments args;
+      args.num_threads = int(numThreads);
+      Kokkos::initialize(args);
+
+      // the runtime never deletes its executor
+      atexit(finalize_);
+    }
+  }
+
+  bool runRange(uint32_t start, uint32_t end, uint32_t grain,
+                const RangeBody& body) override{
+    if(workerIndex() >= 0 || Space::in_parallel()){
+      return false;
+    }
+
+    // a host space runs one parallel dispatch at a time
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if(!lock.owns_lock()){
+      return false;
+    }
+
+    uint32_t n = (end - start + grain - 1)/grain;
+
+    Kokkos::parallel_for(Kokkos::RangePolicy<Space>(0, n),
+      [&](int i){
+        uint32_t begin = start + uint32_t(i) * grain;
+        body(begin, std::min(begin + grain, end));
+      });
+
+    return true;
+  }
+
+private:
+  static void finalize_(){
+    Kokkos::finalize();
+  }
+
+  std::mutex mutex_;
+};
+
+} // namespace ares
+
+#endif // __ARES_KOKKOS_EXECUTOR_H__
@@ -0,0 +1,132 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_LATCH_H__
+#define __ARES_LATCH_H__
+
+#include <atomic>
+#include <cstdint>
+
+#include "Futex.h"
+
+namespace ares{
+
+// countdown latch, single-use unless reset(). The count and a waiting flag share one word
+// so that countDown() touches the latch exactly once, with one atomic
+// decrement, and the waiter may delete it as soon as wait() returns. Only
+// the final decrement issues a wake-up, and only if someone is parked.
+class Latch{
+public:
+  Latch(int32_t count)
+  : word_(count > 0 ? count : 0){}
+
+  void countDown(){
+    int32_t prev = word_.fetch_sub(1, std::memory_order_acq_rel);
+
+    if(prev == (WAITING | 1)){
+      futexWake(&word_);
+    }
+  }
+
+  // arms the latch again with count, once it has opened and its waiter
+  // has returned. A wake-up still due from the last countDown() is only
+  // spurious to the next wait().
+  void reset(int32_t count){
+    word_.store(count > 0 ? count : 0, std::memory_order_release);
+  }
+
+  bool tryWait() const{
+    return (word_.load(std::memory_order_acquire) & COUNT_MASK) == 0;
+  }
+
+  void wait(){
+    for(size_t i = 0; i < SPIN_COUNT; ++i){
+      if(tryWait()){
+        return;
+      }
+      cpuRelax();
+    }
+
+    int32_t w = word_.load(std::memory_order_acquire);
+
+    for(;;){
+      if((w & COUNT_MASK) == 0){
+        return;
+      }
+
+      if(!(w & WAITING)){
+        if(!word_.compare_exchange_weak(w, w | WAITING,
+                                        std::memory_order_acq_rel)){
+          continue;
+        }
+        w |= WAITING;
+      }
+
+      futexWait(&word_, w);
+      w = word_.load(std::memory_order_acquire);
+    }
+  }
+
+  Latch& operator=(const Latch&) = delete;
+
+  Latch(const Latch&) = delete;
+
+private:
+  static const int32_t WAITING = 0x40000000;
+  static const int32_t COUNT_MASK = WAITING - 1;
+  static const size_t SPIN_COUNT = 4000;
+
+  std::atomic<int32_t> word_;
+};
+
+} // namespace ares
+
+#endif // __ARES_LATCH_H__
@@ -0,0 +1,252 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_LOCK_FREE_QUEUE_H__
+#define __ARES_LOCK_FREE_QUEUE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace ares{
+
+// Michael and Scott's "Simple, Fast, and Practical Non-Blocking and
+// Blocking Concurrent Queue Algorithms", which any number of threads may
+// push to and pop from, grown out of the Queue of
+// threadpool/threadpool/nodepool.h. The nodes are a fixed array, free
+// ones on a lock-free stack, so the queue is bounded and a link is an
+// index. An index and a count of its changes fit in 64 bits, so every
+// compare and swap is of one word and needs no cmpxchg16b, the count
+// guarding against ABA as the 128 bit Pointer did.
+template<class T>
+class LockFreeQueue{
+public:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "a value may be read while its node is reused");
+
+  explicit LockFreeQueue(uint32_t capacity)
+  : nodes_(size_t(capacity) + 1){
+    // node 0 is the dummy the queue starts with, the rest are free
+    for(uint32_t i = 1; i <= capacity; ++i){
+      nodes_[i].free.store(i < capacity ? i + 1 : NIL, 
+                           std::memory_order_relaxed);
+    }
+
+    head_.store(link_(0, 0), std::memory_order_relaxed);
+    tail_.store(link_(0, 0), std::memory_order_relaxed);
+    free_.store(link_(capacity > 0 ? 1 : NIL, 0), std::memory_order_relaxed);
+  }
+
+  LockFreeQueue(const LockFreeQueue&) = delete;
+
+  uint32_t capacity() const{
+    return uint32_t(nodes_.size() - 1);
+  }
+
+  // false if the queue is full
+  bool push(const T& value){
+    uint32_t n = take_();
+    if(n == NIL){
+      return false;
+    }
+
+    Node& node = nodes_[n];
+    node.value.store(value, std::memory_order_relaxed);
+
+    uint64_t next = node.next.load(std::memory_order_relaxed);
+    node.next.store(link_(NIL, count_(next) + 1), std::memory_order_relaxed);
+
+    uint64_t tail;
+    for(;;){
+      tail = tail_.load(std::memory_order_acquire);
+      Node& last = nodes_[index_(tail)];
+      next = last.next.load(std::memory_order_acquire);
+
+      if(tail != tail_.load(std::memory_order_acquire)){
+        continue;
+      }
+
+      if(index_(next) == NIL){
+        // publishes the value along with the link
+        if(last.next.compare_exchange_weak(next, 
+                                           link_(n, count_(next) + 1),
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)){
+          break;
+        }
+      }
+      else{
+        // the tail lags behind, helped along
+        tail_.compare_exchange_weak(tail, 
+                                    link_(index_(next), count_(tail) + 1),
+                                    std::memory_order_release,
+                                    std::memory_order_relaxed);
+      }
+    }
+
+    tail_.compare_exchange_strong(tail, link_(n, count_(tail) + 1),
+                                  std::memory_order_release,
+                                  std::memory_order_relaxed);
+    return true;
+  }
+
+  // false if the queue is empty
+  bool pop(T& value){
+    uint64_t head;
+    for(;;){
+      head = head_.load(std::memory_order_acquire);
+      uint64_t tail = tail_.load(std::memory_order_acquire);
+      uint64_t next = 
+        nodes_[index_(head)].next.load(std::memory_order_acquire);
+
+      if(head != head_.load(std::memory_order_acquire)){
+        continue;
+      }
+
+      if(index_(head) == index_(tail)){
+        if(index_(next) == NIL){
+          return false;
+        }
+
+        tail_.compare_exchange_weak(tail, 
+                                    link_(index_(next), count_(tail) + 1),
+                                    std::memory_order_release,
+                                    std::memory_order_relaxed);
+        continue;
+      }
+
+      // read before the node can be freed, and thrown away if another
+      // thread takes it first
+      value = nodes_[index_(next)].value.load(std::memory_order_relaxed);
+
+      if(head_.compare_exchange_weak(head, 
+                                     link_(index_(next), count_(head) + 1),
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_relaxed)){
+        break;
+      }
+    }
+
+    // the old dummy is done with, next is the dummy now
+    release_(index_(head));
+    return true;
+  }
+
+  bool empty() const{
+    uint64_t head = head_.load(std::memory_order_acquire);
+    return index_(nodes_[index_(head)].next.load(
+      std::memory_order_acquire)) == NIL;
+  }
+
+private:
+  static const uint32_t NIL = UINT32_MAX;
+
+  struct Node{
+    std::atomic<T> value;
+    std::atomic<uint64_t> next{link_(NIL, 0)};
+    std::atomic<uint32_t> free{NIL};
+  };
+
+  static constexpr uint64_t link_(uint32_t index, uint32_t count){
+    return uint64_t(count) << 32 | index;
+  }
+
+  static uint32_t index_(uint64_t link){
+    return uint32_t(link);
+  }
+
+  static uint32_t count_(uint64_t link){
+    return uint32_t(link >> 32);
+  }
+
+  uint32_t take_(){
+    uint64_t top = free_.load(std::memory_order_acquire);
+    while(index_(top) != NIL){
+      uint32_t next = 
+        nodes_[index_(top)].free.load(std::memory_order_relaxed);
+      if(free_.compare_exchange_weak(top, link_(next, count_(top) + 1),
+                                     std::memory_order_acquire,
+                                     std::memory_order_acquire)){
+        return index_(top);
+      }
+    }
+    return NIL;
+  }
+
+  void release_(uint32_t n){
+    uint64_t top = free_.load(std::memory_order_relaxed);
+    do{
+      nodes_[n].free.store(index_(top), std::memory_order_relaxed);
+    } while(!free_.compare_exchange_weak(top, link_(n, count_(top) + 1),
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed));
+  }
+
+  static const size_t CACHE_LINE = 64;
+
+  std::vector<Node> nodes_;
+
+  // each on a line of its own, as all of the threads contend for them,
+  // padded rather than aligned, which new need not honour
+  char pad0_[CACHE_LINE];
+  std::atomic<uint64_t> head_;
+  char pad1_[CACHE_LINE - sizeof(std::atomic<uint64_t>)];
+  std::atomic<uint64_t> tail_;
+  char pad2_[CACHE_LINE - sizeof(std::atomic<uint64_t>)];
+  std::atomic<uint64_t> free_;
+  char pad3_[CACHE_LINE - sizeof(std::atomic<uint64_t>)];
+};
+
+} // namespace ares
+
+#endif // __ARES_LOCK_FREE_QUEUE_H__
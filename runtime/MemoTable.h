@@ -0,0 +1,125 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_MEMO_TABLE_H__
+#define __ARES_MEMO_TABLE_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ares{
+
+// the values kept for the calls of memoized functions, keyed by the
+// function and the bytes of the arguments of the call. The keys are
+// spread over shards by their hash, each with a lock of its own, so
+// that calls made with different arguments rarely contend.
+class MemoTable{
+public:
+  // the value stored for func and the size bytes at key, which hit is
+  // passed while it is still held, or if there is none stores value
+  // for them and returns it
+  template<class F>
+  void* claim(const void* func, const void* key, size_t size, void* value,
+              F&& hit){
+    std::string k(reinterpret_cast<const char*>(&func), sizeof(func));
+    k.append(static_cast<const char*>(key), size);
+
+    Shard_& s = shards_[std::hash<std::string>()(k) % NUM_SHARDS];
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto r = s.values.emplace(std::move(k), value);
+    if(!r.second){
+      hit(r.first->second);
+    }
+
+    return r.first->second;
+  }
+
+  // removes every value, passing each to drop, and returns how many
+  // there were
+  template<class F>
+  size_t clear(F&& drop){
+    size_t n = 0;
+
+    for(Shard_& s : shards_){
+      std::unordered_map<std::string, void*> values;
+      {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        values.swap(s.values);
+      }
+
+      for(auto& itr : values){
+        drop(itr.second);
+      }
+      n += values.size();
+    }
+
+    return n;
+  }
+
+private:
+  static const size_t NUM_SHARDS = 64;
+
+  struct alignas(64) Shard_{
+    std::mutex mutex;
+    std::unordered_map<std::string, void*> values;
+  };
+
+  Shard_ shards_[NUM_SHARDS];
+};
+
+} // namespace ares
+
+#endif // __ARES_MEMO_TABLE_H__
@@ -0,0 +1,241 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+
+#ifndef __ARES_MEMORY_ACCOUNT_H__
+#define __ARES_MEMORY_ACCOUNT_H__
+
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+namespace ares{
+
+// the bytes in use of the runtime's own allocations, by category: the
+// task descriptors of the queues, the frames of spawned task calls, the
+// buffers of __ares_alloc() such as reduction partials, message buffers
+// and the stacks of user level threads. Each thread counts what it allocates and releases in counters
+// of its own, and adds them to the shared totals once they have moved by
+// FLUSH_BYTES, so the totals lag by at most that much per thread. The
+// totals are checked against soft limits as they are updated, which the
+// spawn path reads with overLimit() to run new work inline once one has
+// been reached.
+//
+// ARES_MEMORY_LIMIT sets the limit on the sum of the categories, in
+// bytes or with a k, m or g suffix, unlimited if unset or 0.
+class MemoryAccount{
+public:
+  enum Category{
+    QueueItems,
+    TaskFrames,
+    Partials,
+    Messages,
+    Stacks,
+    NUM_CATEGORIES
+  };
+
+  static const int64_t FLUSH_BYTES = 64 << 10;
+
+  static void add(Category c, size_t bytes){
+    change_(c, int64_t(bytes));
+  }
+
+  static void remove(Category c, size_t bytes){
+    change_(c, -int64_t(bytes));
+  }
+
+  // whether the total or a category has reached its limit
+  static bool overLimit(){
+    return shared_().over.load(std::memory_order_relaxed);
+  }
+
+  static uint64_t bytes(Category c){
+    int64_t b = shared_().bytes[c].load(std::memory_order_relaxed);
+    return b > 0 ? uint64_t(b) : 0;
+  }
+
+  // the largest the total has been
+  static uint64_t peak(){
+    return shared_().peak.load(std::memory_order_relaxed);
+  }
+
+  // 0 lifts a limit, c of NUM_CATEGORIES is the total's
+  static void setLimit(Category c, uint64_t bytes){
+    Shared_& s = shared_();
+    s.limits[c].store(bytes, std::memory_order_relaxed);
+    check_(s);
+  }
+
+  static uint64_t limit(Category c){
+    return shared_().limits[c].load(std::memory_order_relaxed);
+  }
+
+  // a spawn that ran inline because of a limit
+  static void inlined(){
+    shared_().inlined.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static uint64_t inlinedSpawns(){
+    return shared_().inlined.load(std::memory_order_relaxed);
+  }
+
+private:
+  // the shared totals, zero initialized, limits[NUM_CATEGORIES] is that
+  // of the sum
+  struct Shared_{
+    std::atomic<int64_t> bytes[NUM_CATEGORIES];
+    std::atomic<uint64_t> limits[NUM_CATEGORIES + 1];
+    std::atomic<uint64_t> peak;
+    std::atomic<uint64_t> inlined;
+    std::atomic<bool> over;
+  };
+
+  // trivially destructible, so that blocks released while the thread
+  // exits are still counted, after the Flusher_ has run
+  struct Local_{
+    int64_t pending[NUM_CATEGORIES];
+    bool registered;
+  };
+
+  // hands what the thread has not yet added to the totals as it exits
+  struct Flusher_{
+    ~Flusher_(){
+      Local_& l = local_();
+      for(uint32_t c = 0; c < NUM_CATEGORIES; ++c){
+        flush_(l, Category(c));
+      }
+    }
+  };
+
+  // never destroyed, blocks may be released while the process exits
+  static Shared_& shared_(){
+    static Shared_* shared = []{
+      auto s = new Shared_();
+
+      if(const char* e = getenv("ARES_MEMORY_LIMIT")){
+        char* end;
+        uint64_t limit = strtoull(e, &end, 10);
+        char unit = char(tolower(*end));
+        limit <<= unit == 'k' ? 10 : unit == 'm' ? 20 : unit == 'g' ? 30 : 0;
+        s->limits[NUM_CATEGORIES].store(limit, std::memory_order_relaxed);
+      }
+
+      return s;
+    }();
+
+    return *shared;
+  }
+
+  static Local_& local_(){
+    static thread_local Local_ local;
+    return local;
+  }
+
+  static void change_(Category c, int64_t delta){
+    Local_& l = local_();
+
+    int64_t& p = l.pending[c];
+    p += delta;
+
+    if(p >= FLUSH_BYTES || p <= -FLUSH_BYTES){
+      if(!l.registered){
+        l.registered = true;
+        static thread_local Flusher_ flusher;
+        (void)flusher;
+      }
+      flush_(l, c);
+    }
+  }
+
+  static void flush_(Local_& l, Category c){
+    if(l.pending[c] == 0){
+      return;
+    }
+
+    Shared_& s = shared_();
+    s.bytes[c].fetch_add(l.pending[c], std::memory_order_relaxed);
+    l.pending[c] = 0;
+    check_(s);
+  }
+
+  // raises the peak and sets over from the totals
+  static void check_(Shared_& s){
+    int64_t total = 0;
+    bool over = false;
+
+    for(uint32_t c = 0; c < NUM_CATEGORIES; ++c){
+      int64_t b = s.bytes[c].load(std::memory_order_relaxed);
+      uint64_t limit = s.limits[c].load(std::memory_order_relaxed);
+
+      over = over || (limit > 0 && b >= int64_t(limit));
+      total += b;
+    }
+
+    uint64_t limit = s.limits[NUM_CATEGORIES].load(std::memory_order_relaxed);
+    over = over || (limit > 0 && total >= int64_t(limit));
+
+    uint64_t peak = s.peak.load(std::memory_order_relaxed);
+    while(total > int64_t(peak) &&
+          !s.peak.compare_exchange_weak(peak, uint64_t(total),
+                                        std::memory_order_relaxed)){}
+
+    if(s.over.load(std::memory_order_relaxed) != over){
+      s.over.store(over, std::memory_order_relaxed);
+    }
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_MEMORY_ACCOUNT_H__
@@ -0,0 +1,315 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_METRICS_H__
+#define __ARES_METRICS_H__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+namespace ares{
+
+// the time spent in the chunks of each parallel region, for the metrics
+// endpoint that ARES_METRICS opens. A region takes a slot of a fixed
+// table the first time one of its chunks ends, after which a chunk adds
+// to it with relaxed atomics, so neither the workers nor the exporter
+// reading the table take a lock. Regions past the table's capacity are
+// counted as dropped.
+class RegionMetrics{
+public:
+  static const size_t CAPACITY = 1024;
+
+  static bool enabled(){
+    static const bool enabled = getenv("ARES_METRICS") != nullptr;
+    return enabled;
+  }
+
+  // a chunk of n iterations of the region described by desc that ran
+  // for ns
+  static void chunk(const void* desc, uint64_t n, uint64_t ns){
+    Entry_* e = find_(desc);
+    if(!e){
+      dropped_().fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    e->chunks.fetch_add(1, std::memory_order_relaxed);
+    e->iterations.fetch_add(n, std::memory_order_relaxed);
+    e->ns.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  // calls f(desc, chunks, iterations, ns) for each region that has run
+  template<class F>
+  static void forEach(F&& f){
+    Entry_* table = table_();
+
+    for(size_t i = 0; i < CAPACITY; ++i){
+      const void* desc = table[i].key.load(std::memory_order_acquire);
+      if(desc){
+        f(desc, table[i].chunks.load(std::memory_order_relaxed),
+          table[i].iterations.load(std::memory_order_relaxed),
+          table[i].ns.load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+  // the chunks of the regions that found the table full
+  static uint64_t dropped(){
+    return dropped_().load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Entry_{
+    std::atomic<const void*> key;
+    std::atomic<uint64_t> chunks;
+    std::atomic<uint64_t> iterations;
+    std::atomic<uint64_t> ns;
+  };
+
+  // zero initialized, as a static of trivially constructed entries
+  static Entry_* table_(){
+    static Entry_ table[CAPACITY];
+    return table;
+  }
+
+  static std::atomic<uint64_t>& dropped_(){
+    static std::atomic<uint64_t> dropped(0);
+    return dropped;
+  }
+
+  // the slot of desc, claimed by the first chunk of the region, open
+  // addressing from its hash
+  static Entry_* find_(const void* desc){
+    Entry_* table = table_();
+
+    uint64_t h = (reinterpret_cast<uintptr_t>(desc) >> 3) *
+      0x9e3779b97f4a7c15ull;
+
+    for(size_t i = 0; i < CAPACITY; ++i){
+      Entry_& e = table[(h + i) & (CAPACITY - 1)];
+
+      const void* key = e.key.load(std::memory_order_acquire);
+      if(key == desc){
+        return &e;
+      }
+
+      if(!key){
+        if(e.key.compare_exchange_strong(key, desc,
+                                         std::memory_order_acq_rel) ||
+           key == desc){
+          return &e;
+        }
+      }
+    }
+
+    return nullptr;
+  }
+};
+
+// serves what render returns as the body of an HTTP response, in the
+// text format that Prometheus scrapes, from a thread of its own. The
+// endpoint is a TCP port on the loopback interface or unix:path for a
+// Unix socket, in whose path a %p is replaced by the pid. A request is
+// answered in full and the connection closed before the next is taken.
+class MetricsServer{
+public:
+  using Render = std::function<std::string()>;
+
+  // false if the endpoint could not be listened on
+  static bool start(const std::string& endpoint, Render render){
+    int fd = listen_(endpoint);
+    if(fd < 0){
+      return false;
+    }
+
+    std::thread([=]{
+      for(;;){
+        int conn = accept(fd, nullptr, nullptr);
+        if(conn < 0){
+          continue;
+        }
+
+        serve_(conn, render);
+        close(conn);
+      }
+    }).detach();
+
+    return true;
+  }
+
+private:
+  static int listen_(const std::string& endpoint){
+    int fd;
+
+    if(endpoint.compare(0, 5, "unix:") == 0){
+      std::string path = endpoint.substr(5);
+
+      size_t pos = path.find("%p");
+      if(pos != std::string::npos){
+        path.replace(pos, 2, std::to_string(getpid()));
+      }
+
+      sockaddr_un addr;
+      if(path.empty() || path.size() >= sizeof(addr.sun_path)){
+        return -1;
+      }
+
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      strcpy(addr.sun_path, path.c_str());
+
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(fd < 0){
+        return -1;
+      }
+
+      // left behind by an earlier run
+      unlink(path.c_str());
+
+      if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0){
+        close(fd);
+        return -1;
+      }
+    }
+    else{
+      int port = atoi(endpoint.c_str());
+      if(port <= 0 || port > 65535){
+        return -1;
+      }
+
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      if(fd < 0){
+        return -1;
+      }
+
+      int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+      sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(uint16_t(port));
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+      if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0){
+        close(fd);
+        return -1;
+      }
+    }
+
+    if(listen(fd, 8) < 0){
+      close(fd);
+      return -1;
+    }
+
+    return fd;
+  }
+
+  // reads the request head and answers a GET of / or /metrics with the
+  // metrics, giving up on a client that stalls for a second
+  static void serve_(int conn, const Render& render){
+    timeval timeout = {1, 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buf[1024];
+
+    while(request.find("\r\n\r\n") == std::string::npos &&
+          request.size() < 8192){
+      ssize_t n = read(conn, buf, sizeof(buf));
+      if(n <= 0){
+        break;
+      }
+      request.append(buf, n);
+    }
+
+    std::string response;
+
+    if(request.compare(0, 13, "GET /metrics ") == 0 ||
+       request.compare(0, 6, "GET / ") == 0){
+      std::string body = render();
+      response = "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+    }
+    else{
+      response = "HTTP/1.0 404 Not Found\r\n"
+        "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+
+    for(size_t sent = 0; sent < response.size();){
+      ssize_t n = send(conn, response.data() + sent, response.size() - sent,
+                       MSG_NOSIGNAL);
+      if(n <= 0){
+        break;
+      }
+      sent += n;
+    }
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_METRICS_H__
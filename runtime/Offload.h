@@ -0,0 +1,640 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_OFFLOAD_H__
+#define __ARES_OFFLOAD_H__
+
+#include <dlfcn.h>
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <iostream>
+
+namespace ares{
+
+// launches the PTX kernels HLIR emits for offloaded Foralls through the
+// CUDA driver API. The driver is loaded at run time, so the runtime needs
+// neither CUDA to build nor a GPU to run, without one every range stays
+// on the host. Arrays are moved explicitly: map() copies an array to the
+// device, where it stays current until it is unmapped or updated.
+//
+// The arrays of a data region are entered and exited instead, each
+// copied on a stream of its own, from host memory pinned while it is on
+// the device, so that the copies of different arrays overlap with each
+// other and with the kernels. A kernel waits only for the copies of the
+// arrays it captures, and runs on a stream that the copies do not block.
+//
+// Shared arrays are not copied at all, the device reads and writes the
+// pinned host memory, which the host can use all along. A Forall whose
+// arrays are all shared is split between the two: the kernel runs the
+// front of the range while the host's workers run the rest, in the
+// proportion of the rates the two last ran that kernel at. One that
+// captures an array with a device copy runs on the device alone, the
+// host's copy is not current.
+class Offload{
+public:
+  // kernel threads per block
+  static const unsigned BLOCK_SIZE = 256;
+
+  // how the Foralls of a region use an array, as ares::OffloadAccess:
+  // IN is copied to the device on entry, OUT back to the host on exit
+  static const uint32_t IN = 1;
+  static const uint32_t OUT = 2;
+
+  static Offload& get(){
+    static Offload offload;
+    return offload;
+  }
+
+  bool available() const{
+    return context_ != nullptr;
+  }
+
+  bool map(void* host, size_t bytes){
+    if(!enter(host, bytes, IN | OUT)){
+      return false;
+    }
+
+    wait(host);
+    return true;
+  }
+
+  void unmap(void* host){
+    exit(host);
+    wait(host);
+  }
+
+  // allocates the device copy of an array and starts copying it there
+  // if access has IN, false if there is no device or it is already on
+  // it. The host copy is the device's until the array has exited.
+  bool enter(void* host, size_t bytes, uint32_t access){
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(!available() || arrays_.count(host)){
+      return false;
+    }
+    ctxSetCurrent_(context_);
+
+    Array a{bytes, 0, access, nullptr, nullptr, false, false, false};
+
+    if(memAlloc_(&a.dev, bytes) != 0){
+      return false;
+    }
+
+    if(streamCreate_(&a.stream, STREAM_NON_BLOCKING) != 0 ||
+       eventCreate_(&a.event, EVENT_DISABLE_TIMING) != 0){
+      release_(a);
+      return false;
+    }
+
+    // unpinned memory is still copied, only not asynchronously
+    a.pinned = memHostRegister_(host, bytes, 0) == 0;
+
+    if((access & IN) &&
+       (memcpyHtoDAsync_(a.dev, host, bytes, a.stream) != 0 ||
+        eventRecord_(a.event, a.stream) != 0)){
+      release_(a);
+      return false;
+    }
+
+    arrays_.emplace(host, a);
+    return true;
+  }
+
+  // pins an array and maps it into the device's address space, false if
+  // there is no device, it is already on it or cannot be mapped
+  bool share(void* host, size_t bytes){
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(!available() || arrays_.count(host)){
+      return false;
+    }
+    ctxSetCurrent_(context_);
+
+    Array a{bytes, 0, IN | OUT, nullptr, nullptr, true, false, true};
+
+    if(memHostRegister_(host, bytes, MEMHOSTREGISTER_DEVICEMAP) != 0){
+      return false;
+    }
+
+    if(memHostGetDevicePointer_(&a.dev, host, 0) != 0){
+      memHostUnregister_(host);
+      return false;
+    }
+
+    arrays_.emplace(host, a);
+    return true;
+  }
+
+  // starts copying an entered array back if its access has OUT, its
+  // device copy is released by wait()
+  void exit(void* host){
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto itr = arrays_.find(host);
+    if(itr == arrays_.end() || itr->second.exiting){
+      return;
+    }
+    ctxSetCurrent_(context_);
+
+    Array& a = itr->second;
+    if((a.access & OUT) && !a.shared){
+      memcpyDtoHAsync_(host, a.dev, a.bytes, a.stream);
+    }
+    a.exiting = true;
+  }
+
+  // waits for the copies of an array, then releases it if it exited
+  void wait(void* host){
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    auto itr = arrays_.find(host);
+    if(itr == arrays_.end()){
+      return;
+    }
+    ctxSetCurrent_(context_);
+
+    void* stream = itr->second.stream;
+    lock.unlock();
+
+    // a shared array has no copies, the kernels that use it are joined
+    if(stream){
+      streamSynchronize_(stream);
+    }
+
+    lock.lock();
+    itr = arrays_.find(host);
+    if(itr != arrays_.end() && itr->second.exiting &&
+       itr->second.stream == stream){
+      if(itr->second.pinned){
+        memHostUnregister_(host);
+      }
+      release_(itr->second);
+      arrays_.erase(itr);
+    }
+  }
+
+  // copies a mapped array back to the host, or out to the device
+  void update(void* host, bool toHost){
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    auto itr = arrays_.find(host);
+    if(itr == arrays_.end()){
+      return;
+    }
+    ctxSetCurrent_(context_);
+
+    Array& a = itr->second;
+    if(a.shared){
+      return;
+    }
+
+    if(toHost){
+      memcpyDtoHAsync_(host, a.dev, a.bytes, a.stream);
+    }
+    else{
+      memcpyHtoDAsync_(a.dev, host, a.bytes, a.stream);
+      eventRecord_(a.event, a.stream);
+    }
+
+    void* stream = a.stream;
+    lock.unlock();
+
+    streamSynchronize_(stream);
+  }
+
+  // runs the kernel of ptx over [start, end) with a device copy of args
+  // whose pointers at ptrOffsets are translated, false if it cannot
+  bool launch(const char* ptx, const void* args, size_t argsSize,
+              const uint32_t* ptrOffsets, uint32_t numPtrs,
+              uint32_t start, uint32_t end){
+    if(start_(ptx, args, argsSize, ptrOffsets, numPtrs,
+              start, end, false) == start){
+      return false;
+    }
+
+    join();
+    return true;
+  }
+
+  // starts the kernel of ptx on the front of [start, end) and returns
+  // where the part left to the host begins, start if the kernel cannot
+  // run and end if it runs all of it, in which case it has been joined.
+  // The caller runs the rest and then calls join().
+  uint32_t split(const char* ptx, const void* args, size_t argsSize,
+                 const uint32_t* ptrOffsets, uint32_t numPtrs,
+                 uint32_t start, uint32_t end){
+    uint32_t hostStart =
+      start_(ptx, args, argsSize, ptrOffsets, numPtrs, start, end, true);
+
+    if(hostStart == end){
+      join();
+    }
+
+    return hostStart;
+  }
+
+  // waits for the kernel the calling thread last split or launched, and
+  // from the time each side took on its part updates the rates of ptx
+  void join(){
+    Pending& p = pending_();
+    if(!p.active){
+      return;
+    }
+    p.active = false;
+
+    double hostNs = std::chrono::duration<double, std::nano>(
+      Clock::now() - p.hostStart).count();
+
+    ctxSetCurrent_(context_);
+
+    int ret = streamSynchronize_(stream_);
+    if(ret != 0){
+      std::cerr << "ares: offloaded kernel failed: " << ret << std::endl;
+      abort();
+    }
+
+    // only split ranges are measured, the host's rate would be unknown
+    float ms;
+    if(p.hostIters == 0 ||
+       eventElapsedTime_(&ms, p.begin, p.end) != 0){
+      return;
+    }
+
+    double deviceNs = ms * 1e6/p.deviceIters;
+    hostNs /= p.hostIters;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Rates& r = rates_[p.ptx];
+    r.deviceNs = r.deviceNs > 0 ? (r.deviceNs + deviceNs)/2 : deviceNs;
+    r.hostNs = r.hostNs > 0 ? (r.hostNs + hostNs)/2 : hostNs;
+  }
+
+private:
+  // CU_STREAM_NON_BLOCKING, CU_EVENT_DISABLE_TIMING and
+  // CU_MEMHOSTREGISTER_DEVICEMAP
+  static const unsigned STREAM_NON_BLOCKING = 1;
+  static const unsigned EVENT_DISABLE_TIMING = 2;
+  static const unsigned MEMHOSTREGISTER_DEVICEMAP = 2;
+
+  // the smallest part of a split range either side is given, so that
+  // the slower one is still measured
+  static constexpr double MIN_SHARE = 1.0/32;
+
+  using Clock = std::chrono::steady_clock;
+
+  // an array on the device, whose copies are issued on stream, event
+  // marking the end of the last one to the device. A shared one is the
+  // host's memory mapped, without a stream or copies.
+  struct Array{
+    size_t bytes;
+    uint64_t dev;
+    uint32_t access;
+    void* stream;
+    void* event;
+    bool pinned;
+    bool exiting;
+    bool shared;
+  };
+
+  // the nanoseconds per iteration the device and the host last ran a
+  // kernel at, 0 until it has been split
+  struct Rates{
+    double deviceNs = 0;
+    double hostNs = 0;
+  };
+
+  // the kernel a thread started and has not joined, timed between begin
+  // and end on the device and from hostStart on the host
+  struct Pending{
+    bool active = false;
+    const char* ptx;
+    uint32_t deviceIters;
+    uint32_t hostIters;
+    Clock::time_point hostStart;
+    void* begin = nullptr;
+    void* end = nullptr;
+  };
+
+  // ARES_OFFLOAD=0 keeps everything on the host
+  Offload(){
+    const char* s = getenv("ARES_OFFLOAD");
+    if(s && atoi(s) == 0){
+      return;
+    }
+
+    void* lib = dlopen("libcuda.so.1", RTLD_NOW | RTLD_LOCAL);
+    if(!lib){
+      return;
+    }
+
+    if(!load_(lib, "cuInit", init_) ||
+       !load_(lib, "cuDeviceGet", deviceGet_) ||
+       !load_(lib, "cuCtxCreate_v2", ctxCreate_) ||
+       !load_(lib, "cuCtxSetCurrent", ctxSetCurrent_) ||
+       !load_(lib, "cuModuleLoadData", moduleLoadData_) ||
+       !load_(lib, "cuModuleGetFunction", moduleGetFunction_) ||
+       !load_(lib, "cuMemAlloc_v2", memAlloc_) ||
+       !load_(lib, "cuMemFree_v2", memFree_) ||
+       !load_(lib, "cuMemcpyHtoDAsync_v2", memcpyHtoDAsync_) ||
+       !load_(lib, "cuMemcpyDtoHAsync_v2", memcpyDtoHAsync_) ||
+       !load_(lib, "cuMemHostRegister_v2", memHostRegister_) ||
+       !load_(lib, "cuMemHostUnregister", memHostUnregister_) ||
+       !load_(lib, "cuMemHostGetDevicePointer_v2",
+              memHostGetDevicePointer_) ||
+       !load_(lib, "cuStreamCreate", streamCreate_) ||
+       !load_(lib, "cuStreamDestroy_v2", streamDestroy_) ||
+       !load_(lib, "cuStreamSynchronize", streamSynchronize_) ||
+       !load_(lib, "cuStreamWaitEvent", streamWaitEvent_) ||
+       !load_(lib, "cuEventCreate", eventCreate_) ||
+       !load_(lib, "cuEventDestroy_v2", eventDestroy_) ||
+       !load_(lib, "cuEventRecord", eventRecord_) ||
+       !load_(lib, "cuEventElapsedTime", eventElapsedTime_) ||
+       !load_(lib, "cuLaunchKernel", launchKernel_)){
+      return;
+    }
+
+    int device;
+    void* context;
+    if(init_(0) != 0 || deviceGet_(&device, 0) != 0 ||
+       ctxCreate_(&context, 0, device) != 0){
+      return;
+    }
+
+    if(streamCreate_(&stream_, STREAM_NON_BLOCKING) != 0){
+      return;
+    }
+
+    context_ = context;
+  }
+
+  void release_(Array& a){
+    if(a.event){
+      eventDestroy_(a.event);
+    }
+    if(a.stream){
+      streamDestroy_(a.stream);
+    }
+    if(!a.shared){
+      memFree_(a.dev);
+    }
+  }
+
+  static Pending& pending_(){
+    static thread_local Pending pending;
+    return pending;
+  }
+
+  // queues the kernel of ptx on a front part of [start, end) and returns
+  // where the rest begins, start if it cannot run. With split set, a
+  // range whose arrays are all shared is divided by the rates of ptx.
+  uint32_t start_(const char* ptx, const void* args, size_t argsSize,
+                  const uint32_t* ptrOffsets, uint32_t numPtrs,
+                  uint32_t start, uint32_t end, bool split){
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if(!available() || start >= end){
+      return start;
+    }
+    ctxSetCurrent_(context_);
+
+    std::vector<char> devArgs(static_cast<const char*>(args),
+                              static_cast<const char*>(args) + argsSize);
+    std::vector<void*> waits;
+    bool shared = numPtrs > 0;
+
+    for(uint32_t i = 0; i < numPtrs; ++i){
+      char* field = devArgs.data() + ptrOffsets[i];
+
+      void* ptr;
+      memcpy(&ptr, field, sizeof(ptr));
+
+      uint64_t dev;
+      const Array* a = translate_(ptr, dev);
+      if(!a || a->exiting){
+        return start;
+      }
+      memcpy(field, &dev, sizeof(dev));
+
+      if(a->shared){
+        continue;
+      }
+      shared = false;
+      waits.push_back(a->event);
+    }
+
+    void* func = kernel_(ptx);
+    if(!func){
+      return start;
+    }
+
+    // even halves until the kernel has been measured
+    uint32_t deviceEnd = end;
+    if(split && shared){
+      const Rates& r = rates_[ptx];
+      double share = r.deviceNs > 0 && r.hostNs > 0 ?
+        r.hostNs/(r.hostNs + r.deviceNs) : 0.5;
+      share = std::min(std::max(share, MIN_SHARE), 1 - MIN_SHARE);
+
+      deviceEnd = start + uint32_t((end - start) * share);
+      if(deviceEnd == start){
+        return start;
+      }
+    }
+
+    Pending& p = pending_();
+    if(!p.begin &&
+       (eventCreate_(&p.begin, 0) != 0 || eventCreate_(&p.end, 0) != 0)){
+      return start;
+    }
+
+    // the args are copied into a buffer that is kept between launches,
+    // ordered after the kernels before them by the stream
+    if(argsSize > argsCapacity_){
+      // the kernels queued before may still read the old one
+      if(argsDev_){
+        streamSynchronize_(stream_);
+        memFree_(argsDev_);
+        argsDev_ = 0;
+        argsCapacity_ = 0;
+      }
+
+      if(memAlloc_(&argsDev_, argsSize) != 0){
+        return start;
+      }
+      argsCapacity_ = argsSize;
+    }
+
+    uint64_t argsDev = argsDev_;
+    if(argsSize > 0){
+      memcpyHtoDAsync_(argsDev, devArgs.data(), argsSize, stream_);
+    }
+
+    // only the copies of the arrays that the kernel captures
+    for(void* event : waits){
+      streamWaitEvent_(stream_, event, 0);
+    }
+
+    void* params[] = {&argsDev, &start, &deviceEnd};
+
+    unsigned n = deviceEnd - start;
+    unsigned blocks = (n + BLOCK_SIZE - 1)/BLOCK_SIZE;
+
+    eventRecord_(p.begin, stream_);
+
+    int ret = launchKernel_(func, blocks, 1, 1, BLOCK_SIZE, 1, 1,
+                            0, stream_, params, nullptr);
+    if(ret != 0){
+      std::cerr << "ares: offloaded kernel failed: " << ret << std::endl;
+      abort();
+    }
+
+    eventRecord_(p.end, stream_);
+
+    p.active = true;
+    p.ptx = ptx;
+    p.deviceIters = n;
+    p.hostIters = end - deviceEnd;
+    p.hostStart = Clock::now();
+
+    return deviceEnd;
+  }
+
+  template<class F>
+  static bool load_(void* lib, const char* name, F& f){
+    f = reinterpret_cast<F>(dlsym(lib, name));
+    return f != nullptr;
+  }
+
+  // the device address of ptr and its array if it lies within one
+  const Array* translate_(void* ptr, uint64_t& dev){
+    auto itr = arrays_.upper_bound(ptr);
+    if(itr == arrays_.begin()){
+      return nullptr;
+    }
+    --itr;
+
+    size_t offset = static_cast<char*>(ptr) - static_cast<char*>(itr->first);
+    if(offset >= itr->second.bytes){
+      return nullptr;
+    }
+
+    dev = itr->second.dev + offset;
+    return &itr->second;
+  }
+
+  // the module of each PTX string is loaded once
+  void* kernel_(const char* ptx){
+    auto itr = kernels_.find(ptx);
+    if(itr != kernels_.end()){
+      return itr->second;
+    }
+
+    void* module;
+    void* func = nullptr;
+    if(moduleLoadData_(&module, ptx) != 0 ||
+       moduleGetFunction_(&func, module, "ares_offload_kernel") != 0){
+      std::cerr << "ares: failed to load offloaded kernel" << std::endl;
+      func = nullptr;
+    }
+
+    kernels_.emplace(ptx, func);
+    return func;
+  }
+
+  // the driver API entry points used, with its handles as void*
+  int (*init_)(unsigned);
+  int (*deviceGet_)(int*, int);
+  int (*ctxCreate_)(void**, unsigned, int);
+  int (*ctxSetCurrent_)(void*);
+  int (*moduleLoadData_)(void**, const void*);
+  int (*moduleGetFunction_)(void**, void*, const char*);
+  int (*memAlloc_)(uint64_t*, size_t);
+  int (*memFree_)(uint64_t);
+  int (*memcpyHtoDAsync_)(uint64_t, const void*, size_t, void*);
+  int (*memcpyDtoHAsync_)(void*, uint64_t, size_t, void*);
+  int (*memHostRegister_)(void*, size_t, unsigned);
+  int (*memHostUnregister_)(void*);
+  int (*memHostGetDevicePointer_)(uint64_t*, void*, unsigned);
+  int (*streamCreate_)(void**, unsigned);
+  int (*streamDestroy_)(void*);
+  int (*streamSynchronize_)(void*);
+  int (*streamWaitEvent_)(void*, void*, unsigned);
+  int (*eventCreate_)(void**, unsigned);
+  int (*eventDestroy_)(void*);
+  int (*eventRecord_)(void*, void*);
+  int (*eventElapsedTime_)(float*, void*, void*);
+  int (*launchKernel_)(void*, unsigned, unsigned, unsigned,
+                       unsigned, unsigned, unsigned,
+                       unsigned, void*, void**, void**);
+
+  void* context_ = nullptr;
+  // the stream the kernels run on, and their args
+  void* stream_ = nullptr;
+  uint64_t argsDev_ = 0;
+  size_t argsCapacity_ = 0;
+  std::mutex mutex_;
+  std::map<void*, Array> arrays_;
+  std::map<const char*, void*> kernels_;
+  std::map<const char*, Rates> rates_;
+};
+
+} // namespace ares
+
+#endif // __ARES_OFFLOAD_H__
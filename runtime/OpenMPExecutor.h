@@ -0,0 +1,108 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_OPENMP_EXECUTOR_H__
+#define __ARES_OPENMP_EXECUTOR_H__
+
+#include <omp.h>
+
+#include <mutex>
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+namespace ares{
+
+// parallel fors and the partials of reduces queued from outside the pool
+// run as a statically scheduled loop on the OpenMP thread team, so code
+// that mixes ARES and OpenMP loops uses one set of threads, sized and
+// bound by OMP_NUM_THREADS and OMP_PROC_BIND. Tasks, and ranges queued
+// from a task or from within an OpenMP parallel region, go to the
+// work-stealing pool, whose workers park rather than spin against the
+// team.
+class OpenMPExecutor : public ThreadPool{
+public:
+  OpenMPExecutor(size_t numThreads)
+  : ThreadPool(numThreads, {}, IdlePolicy(IdlePolicy::Power)),
+  teamSize_(omp_get_max_threads()){}
+
+  bool runRange(uint32_t start, uint32_t end, uint32_t grain,
+                const RangeBody& body) override{
+    if(workerIndex() >= 0 || omp_in_parallel()){
+      return false;
+    }
+
+    // one team is forked at a time, a concurrent caller uses the pool
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if(!lock.owns_lock()){
+      return false;
+    }
+
+    int64_t n = (int64_t(end) - start + grain - 1)/grain;
+
+#pragma omp parallel for schedule(static) num_threads(teamSize_)
+    for(int64_t i = 0; i < n; ++i){
+      uint32_t begin = start + uint32_t(i) * grain;
+      body(begin, std::min(begin + grain, end));
+    }
+
+    return true;
+  }
+
+private:
+  int teamSize_;
+  std::mutex mutex_;
+};
+
+} // namespace ares
+
+#endif // __ARES_OPENMP_EXECUTOR_H__
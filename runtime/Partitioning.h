@@ -0,0 +1,777 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_PARTITIONING_H__
+#define __ARES_PARTITIONING_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace ares{
+
+// the built-in partitioners of ares_partition(), on a graph whose
+// neighbors of vertex v are neighbors[offsets[v]] to
+// neighbors[offsets[v + 1]], as for the Inspector. Each sets part[v] to
+// one of parts parts for every vertex, a vertex weighing weights[v], or
+// 1 without weights. They are deterministic, so that each rank that
+// partitions the same graph gets the same partition.
+class Partitioning{
+public:
+  // runs of consecutive vertices of about the same weight
+  static void block(uint32_t n, const float* weights, uint32_t parts,
+                    uint32_t* part){
+    double total = 0.0;
+    for(uint32_t v = 0; v < n; ++v){
+      total += weight_(weights, v);
+    }
+
+    double prefix = 0.0;
+    for(uint32_t v = 0; v < n; ++v){
+      double w = weight_(weights, v);
+      uint32_t p = total > 0.0 ? uint32_t((prefix + w/2) * parts / total) :
+        uint32_t(uint64_t(v) * parts / n);
+      part[v] = std::min(p, parts - 1);
+      prefix += w;
+    }
+  }
+
+  // recursive coordinate bisection, coords holding dim coordinates per
+  // vertex. The vertices are split at the weighted median of the axis
+  // along which they spread the widest, in proportion to the parts on
+  // either side, and each side is split the same way.
+  static void rcb(uint32_t n, const double* coords, uint32_t dim,
+                  const float* weights, uint32_t parts, uint32_t* part){
+    std::vector<uint32_t> vs(n);
+    std::iota(vs.begin(), vs.end(), 0);
+    rcb_(coords, dim, weights, vs.data(), n, 0, parts, part);
+  }
+
+  // multilevel partitioning as by METIS: the graph is coarsened by
+  // merging the vertices along its heaviest edges until it is a few
+  // times as large as parts, the coarsest graph is split by recursive
+  // bisection, growing one half breadth first from a vertex, and the
+  // parts are carried back through the finer graphs, moving the
+  // vertices on their boundaries to the part they have the most edges
+  // to while that keeps the parts within 3% of the same weight. The
+  // neighbors are taken both ways, those of n or more are ignored.
+  static void multilevel(uint32_t n, const uint32_t* offsets,
+                         const uint32_t* neighbors, const float* weights,
+                         uint32_t parts, uint32_t* part){
+    if(parts <= 1 || n == 0){
+      std::fill(part, part + n, 0);
+      return;
+    }
+
+    std::vector<Graph_> levels(1);
+    symmetrize_(n, offsets, neighbors, weights, levels[0]);
+
+    size_t coarsestSize = std::max(size_t(COARSEST_PER_PART) * parts,
+                                   size_t(MIN_COARSEST));
+    double maxWeight = 1.5 * levels[0].totalWeight / coarsestSize;
+
+    while(levels.back().size() > coarsestSize){
+      Graph_ coarse;
+      if(!coarsen_(levels.back(), maxWeight, coarse)){
+        break;
+      }
+      levels.push_back(std::move(coarse));
+    }
+
+    // the coarsest graph is small, so it is split a few ways and the
+    // one that cuts the fewest edges kept
+    const Graph_& coarsest = levels.back();
+    std::vector<uint32_t> p;
+    double bestCut = 0.0;
+
+    for(uint32_t t = 0; t < INITIAL_TRIES; ++t){
+      std::vector<uint32_t> tp;
+      bisect_(coarsest, parts, double(t) / INITIAL_TRIES, tp);
+      refine_(coarsest, parts, tp);
+
+      double cut = cut_(coarsest, tp);
+      if(t == 0 || cut < bestCut){
+        p.swap(tp);
+        bestCut = cut;
+      }
+    }
+
+    for(size_t l = levels.size() - 1; l > 0; --l){
+      const Graph_& fine = levels[l - 1];
+
+      std::vector<uint32_t> fp(fine.size());
+      for(uint32_t v = 0; v < fine.size(); ++v){
+        fp[v] = p[fine.coarse[v]];
+      }
+
+      p.swap(fp);
+      refine_(fine, parts, p);
+    }
+
+    std::copy(p.begin(), p.end(), part);
+  }
+
+private:
+  static const uint32_t NONE = ~uint32_t(0);
+  static const uint32_t COARSEST_PER_PART = 16;
+  static const uint32_t MIN_COARSEST = 64;
+  static const uint32_t INITIAL_TRIES = 8;
+  static const uint32_t REFINE_PASSES = 8;
+  static const size_t CLIMB_MOVES = 64;
+
+  // a level of the multilevel partitioner, undirected, its edges listed
+  // from both ends with their weights, and the vertex each of its
+  // vertices was merged into on the next coarser level
+  struct Graph_{
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> adjacency;
+    std::vector<uint32_t> edgeWeights;
+    std::vector<double> weights;
+    std::vector<uint32_t> coarse;
+    double totalWeight = 0.0;
+
+    uint32_t size() const{
+      return uint32_t(weights.size());
+    }
+  };
+
+  static double weight_(const float* weights, uint32_t v){
+    return weights ? double(weights[v]) : 1.0;
+  }
+
+  // the weight of the edges between parts
+  static double cut_(const Graph_& g, const std::vector<uint32_t>& part){
+    double cut = 0.0;
+
+    for(uint32_t v = 0; v < g.size(); ++v){
+      for(uint32_t k = g.offsets[v]; k < g.offsets[v + 1]; ++k){
+        if(part[g.adjacency[k]] != part[v]){
+          cut += g.edgeWeights[k];
+        }
+      }
+    }
+
+    return cut/2;
+  }
+
+  static void rcb_(const double* coords, uint32_t dim, const float* weights,
+                   uint32_t* vs, size_t count, uint32_t first,
+                   uint32_t parts, uint32_t* part){
+    if(parts == 1 || count <= 1 || !coords || dim == 0){
+      for(size_t i = 0; i < count; ++i){
+        part[vs[i]] = first;
+      }
+      return;
+    }
+
+    uint32_t axis = 0;
+    double widest = -1.0;
+
+    for(uint32_t d = 0; d < dim; ++d){
+      double lo = coords[size_t(vs[0]) * dim + d];
+      double hi = lo;
+
+      for(size_t i = 1; i < count; ++i){
+        double x = coords[size_t(vs[i]) * dim + d];
+        lo = std::min(lo, x);
+        hi = std::max(hi, x);
+      }
+
+      if(hi - lo > widest){
+        widest = hi - lo;
+        axis = d;
+      }
+    }
+
+    std::sort(vs, vs + count, [&](uint32_t a, uint32_t b){
+      double xa = coords[size_t(a) * dim + axis];
+      double xb = coords[size_t(b) * dim + axis];
+      return xa < xb || (xa == xb && a < b);
+    });
+
+    uint32_t left = parts/2;
+
+    double total = 0.0;
+    for(size_t i = 0; i < count; ++i){
+      total += weight_(weights, vs[i]);
+    }
+
+    double target = total * left / parts;
+    double taken = 0.0;
+    size_t cut = 0;
+
+    while(cut < count && taken + weight_(weights, vs[cut])/2 < target){
+      taken += weight_(weights, vs[cut++]);
+    }
+
+    rcb_(coords, dim, weights, vs, cut, first, left, part);
+    rcb_(coords, dim, weights, vs + cut, count - cut, first + left,
+         parts - left, part);
+  }
+
+  // the graph of the neighbors listed either way, without duplicates or
+  // self loops, every edge weighing 1
+  static void symmetrize_(uint32_t n, const uint32_t* offsets,
+                          const uint32_t* neighbors, const float* weights,
+                          Graph_& g){
+    std::vector<uint32_t> degree(n + 1, 0);
+
+    for(uint32_t v = 0; v < n; ++v){
+      for(uint32_t k = offsets[v]; k < offsets[v + 1]; ++k){
+        uint32_t u = neighbors[k];
+        if(u < n && u != v){
+          ++degree[v];
+          ++degree[u];
+        }
+      }
+    }
+
+    std::vector<uint32_t> start(n + 1, 0);
+    for(uint32_t v = 0; v < n; ++v){
+      start[v + 1] = start[v] + degree[v];
+    }
+
+    std::vector<uint32_t> both(start[n]);
+    std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+
+    for(uint32_t v = 0; v < n; ++v){
+      for(uint32_t k = offsets[v]; k < offsets[v + 1]; ++k){
+        uint32_t u = neighbors[k];
+        if(u < n && u != v){
+          both[fill[v]++] = u;
+          both[fill[u]++] = v;
+        }
+      }
+    }
+
+    g.offsets.assign(1, 0);
+    g.offsets.reserve(n + 1);
+    g.adjacency.reserve(both.size());
+    g.weights.resize(n);
+
+    for(uint32_t v = 0; v < n; ++v){
+      auto begin = both.begin() + start[v];
+      auto end = both.begin() + start[v + 1];
+      std::sort(begin, end);
+      g.adjacency.insert(g.adjacency.end(), begin, std::unique(begin, end));
+      g.offsets.push_back(uint32_t(g.adjacency.size()));
+
+      g.weights[v] = weight_(weights, v);
+      g.totalWeight += g.weights[v];
+    }
+
+    g.edgeWeights.assign(g.adjacency.size(), 1);
+  }
+
+  // heavy edge matching, each vertex merged with the unmatched neighbor
+  // it has the heaviest edge to, unless they would weigh more than
+  // maxWeight together. False if that would not shrink the graph much,
+  // when it is as coarse as it gets.
+  static bool coarsen_(Graph_& fine, double maxWeight, Graph_& coarse){
+    uint32_t n = fine.size();
+
+    std::vector<uint32_t> match(n, uint32_t(NONE));
+    std::vector<uint32_t> firsts;
+    fine.coarse.assign(n, uint32_t(NONE));
+
+    // the lightest first, so that they are not left without any
+    // unmatched neighbor and the coarse vertices stay of similar weight
+    std::vector<uint32_t> visit(n);
+    std::iota(visit.begin(), visit.end(), 0);
+    std::stable_sort(visit.begin(), visit.end(), [&](uint32_t a, uint32_t b){
+      return fine.weights[a] < fine.weights[b];
+    });
+
+    for(uint32_t v : visit){
+      if(match[v] != NONE){
+        continue;
+      }
+
+      uint32_t best = v;
+      uint32_t bestWeight = 0;
+
+      for(uint32_t k = fine.offsets[v]; k < fine.offsets[v + 1]; ++k){
+        uint32_t u = fine.adjacency[k];
+        if(match[u] != NONE ||
+           fine.weights[v] + fine.weights[u] > maxWeight){
+          continue;
+        }
+
+        if(fine.edgeWeights[k] > bestWeight ||
+           (fine.edgeWeights[k] == bestWeight &&
+            fine.weights[u] < fine.weights[best])){
+          best = u;
+          bestWeight = fine.edgeWeights[k];
+        }
+      }
+
+      match[v] = best;
+      match[best] = v;
+      fine.coarse[v] = fine.coarse[best] = uint32_t(firsts.size());
+      firsts.push_back(v);
+    }
+
+    uint32_t nc = uint32_t(firsts.size());
+    if(nc > n - n/20){
+      fine.coarse.clear();
+      return false;
+    }
+
+    coarse.offsets.assign(1, 0);
+    coarse.weights.assign(nc, 0.0);
+    coarse.totalWeight = fine.totalWeight;
+
+    // where the row being built has its edge to each coarse vertex, a
+    // slot before the row's start being that of an earlier row
+    std::vector<size_t> slot(nc, ~size_t(0));
+
+    for(uint32_t c = 0; c < nc; ++c){
+      size_t rowStart = coarse.adjacency.size();
+      uint32_t v = firsts[c];
+      uint32_t members[] = {v, match[v]};
+      uint32_t numMembers = match[v] == v ? 1 : 2;
+
+      for(uint32_t i = 0; i < numMembers; ++i){
+        uint32_t m = members[i];
+        coarse.weights[c] += fine.weights[m];
+
+        for(uint32_t k = fine.offsets[m]; k < fine.offsets[m + 1]; ++k){
+          uint32_t cu = fine.coarse[fine.adjacency[k]];
+          if(cu == c){
+            continue;
+          }
+
+          size_t s = slot[cu];
+          if(s != ~size_t(0) && s >= rowStart){
+            coarse.edgeWeights[s] += fine.edgeWeights[k];
+          }
+          else{
+            slot[cu] = coarse.adjacency.size();
+            coarse.adjacency.push_back(cu);
+            coarse.edgeWeights.push_back(fine.edgeWeights[k]);
+          }
+        }
+      }
+
+      coarse.offsets.push_back(uint32_t(coarse.adjacency.size()));
+    }
+
+    return true;
+  }
+
+  // the state of the recursive bisection of a graph, the vertices of
+  // the current call being those whose set is its stamp. Each half is
+  // grown from the vertex of the set that is the given fraction of the
+  // way through it, or at 0 from a peripheral one.
+  struct Bisection_{
+    const Graph_& g;
+    std::vector<uint32_t>& part;
+    std::vector<uint32_t> set;
+    std::vector<uint32_t> seen;
+    std::vector<uint32_t> queue;
+    uint32_t stamp;
+    double seed;
+  };
+
+  static void bisect_(const Graph_& g, uint32_t parts, double seed,
+                      std::vector<uint32_t>& part){
+    uint32_t n = g.size();
+    part.assign(n, 0);
+
+    Bisection_ b{g, part, std::vector<uint32_t>(n, uint32_t(NONE)),
+                 std::vector<uint32_t>(n, uint32_t(NONE)), {}, 0, seed};
+
+    std::vector<uint32_t> vs(n);
+    std::iota(vs.begin(), vs.end(), 0);
+    bisect_(b, vs.data(), n, 0, parts);
+  }
+
+  static void bisect_(Bisection_& b, uint32_t* vs, size_t count,
+                      uint32_t first, uint32_t parts){
+    if(parts == 1 || count <= 1){
+      for(size_t i = 0; i < count; ++i){
+        b.part[vs[i]] = first;
+      }
+      return;
+    }
+
+    uint32_t left = parts/2;
+
+    uint32_t set = b.stamp++;
+    double total = 0.0;
+    for(size_t i = 0; i < count; ++i){
+      b.set[vs[i]] = set;
+      total += b.g.weights[vs[i]];
+    }
+
+    // the last vertex that a search reaches is as far from where it
+    // started as any
+    uint32_t seed = vs[size_t(b.seed * count)];
+    if(b.seed == 0.0){
+      grow_(b, vs, count, seed, set, total);
+      seed = b.queue.back();
+    }
+
+    grow_(b, vs, count, seed, set, total * left / parts);
+
+    // the grown half first, then the rest in their order
+    std::vector<uint32_t> rest;
+    size_t cut = b.queue.size();
+    uint32_t grown = b.stamp++;
+
+    for(uint32_t v : b.queue){
+      b.seen[v] = grown;
+    }
+
+    for(size_t i = 0; i < count; ++i){
+      if(b.seen[vs[i]] != grown){
+        rest.push_back(vs[i]);
+      }
+    }
+
+    std::copy(b.queue.begin(), b.queue.end(), vs);
+    std::copy(rest.begin(), rest.end(), vs + cut);
+
+    bisect_(b, vs, cut, first, left);
+    bisect_(b, vs + cut, count - cut, first + left, parts - left);
+  }
+
+  // leaves in the queue the vertices of set in breadth first order from
+  // start, until they weigh about target, going on from the next vertex
+  // of vs that has not been reached when a component runs out
+  static void grow_(Bisection_& b, const uint32_t* vs, size_t count,
+                    uint32_t start, uint32_t set, double target){
+    const Graph_& g = b.g;
+    uint32_t visit = b.stamp++;
+
+    b.queue.clear();
+    double taken = 0.0;
+    size_t next = 0;
+    size_t head = 0;
+
+    auto reach = [&](uint32_t v){
+      if(taken + g.weights[v]/2 >= target && !b.queue.empty()){
+        return false;
+      }
+
+      b.seen[v] = visit;
+      b.queue.push_back(v);
+      taken += g.weights[v];
+      return true;
+    };
+
+    if(!reach(start)){
+      return;
+    }
+
+    for(;;){
+      if(head == b.queue.size()){
+        while(next < count && b.seen[vs[next]] == visit){
+          ++next;
+        }
+        if(next == count || !reach(vs[next])){
+          return;
+        }
+      }
+
+      uint32_t v = b.queue[head++];
+
+      for(uint32_t k = g.offsets[v]; k < g.offsets[v + 1]; ++k){
+        uint32_t u = g.adjacency[k];
+        if(b.set[u] == set && b.seen[u] != visit && !reach(u)){
+          return;
+        }
+      }
+    }
+  }
+
+  // greedy boundary refinement, each pass moving the vertices to the
+  // part that they have the heaviest edges to, when that cuts fewer
+  // edges or as many and evens the weights, and the part can take them,
+  // followed by passes of climb_(). A vertex of a part that is too heavy
+  // moves even at a loss.
+  static void refine_(const Graph_& g, uint32_t parts,
+                      std::vector<uint32_t>& part){
+    uint32_t n = g.size();
+
+    std::vector<double> partWeights(parts, 0.0);
+    double heaviest = 0.0;
+
+    for(uint32_t v = 0; v < n; ++v){
+      partWeights[part[v]] += g.weights[v];
+      heaviest = std::max(heaviest, g.weights[v]);
+    }
+
+    double mean = g.totalWeight / parts;
+    double maxWeight = std::max(mean * 1.03, mean + heaviest);
+
+    std::vector<double> edges(parts, 0.0);
+    std::vector<uint32_t> touched;
+
+    for(uint32_t pass = 0; pass < REFINE_PASSES; ++pass){
+      uint32_t moved = 0;
+
+      for(uint32_t v = 0; v < n; ++v){
+        uint32_t p = part[v];
+        double w = g.weights[v];
+
+        touched.clear();
+        for(uint32_t k = g.offsets[v]; k < g.offsets[v + 1]; ++k){
+          uint32_t q = part[g.adjacency[k]];
+          if(edges[q] == 0.0){
+            touched.push_back(q);
+          }
+          edges[q] += g.edgeWeights[k];
+        }
+
+        bool heavy = partWeights[p] > maxWeight;
+        uint32_t best = p;
+        double bestGain = heavy ? -1e300 : 0.0;
+
+        for(uint32_t q : touched){
+          if(q == p || partWeights[q] + w > maxWeight){
+            continue;
+          }
+
+          double gain = edges[q] - edges[p];
+          bool evens = partWeights[q] + w < partWeights[p];
+
+          if(gain > bestGain || (gain == bestGain && best == p && evens) ||
+             (gain == bestGain && best != p &&
+              partWeights[q] < partWeights[best])){
+            best = q;
+            bestGain = gain;
+          }
+        }
+
+        for(uint32_t q : touched){
+          edges[q] = 0.0;
+        }
+
+        // an isolated vertex, or one among parts as heavy, goes to the
+        // lightest part
+        if(heavy && best == p){
+          best = uint32_t(std::min_element(partWeights.begin(),
+                                           partWeights.end()) -
+                          partWeights.begin());
+        }
+
+        if(best != p){
+          partWeights[p] -= w;
+          partWeights[best] += w;
+          part[v] = best;
+          ++moved;
+        }
+      }
+
+      if(moved == 0){
+        break;
+      }
+    }
+
+    for(uint32_t pass = 0; pass < REFINE_PASSES; ++pass){
+      if(!climb_(g, part, partWeights, maxWeight, edges, touched)){
+        break;
+      }
+    }
+  }
+
+  // how many fewer edges moving v cuts, to target, the part other than
+  // its own that it has the heaviest edges to, NONE if it has no edges
+  // to another part
+  static double gain_(const Graph_& g, const std::vector<uint32_t>& part,
+                      const std::vector<double>& partWeights, uint32_t v,
+                      std::vector<double>& edges,
+                      std::vector<uint32_t>& touched, uint32_t& target){
+    uint32_t p = part[v];
+
+    touched.clear();
+    for(uint32_t k = g.offsets[v]; k < g.offsets[v + 1]; ++k){
+      uint32_t q = part[g.adjacency[k]];
+      if(edges[q] == 0.0){
+        touched.push_back(q);
+      }
+      edges[q] += g.edgeWeights[k];
+    }
+
+    target = NONE;
+    double gain = 0.0;
+
+    for(uint32_t q : touched){
+      if(q == p){
+        continue;
+      }
+
+      double gq = edges[q] - edges[p];
+      if(target == NONE || gq > gain ||
+         (gq == gain && partWeights[q] < partWeights[target])){
+        target = q;
+        gain = gq;
+      }
+    }
+
+    for(uint32_t q : touched){
+      edges[q] = 0.0;
+    }
+
+    return gain;
+  }
+
+  // a pass of Fiduccia-Mattheyses: the boundary vertices are moved one
+  // at a time, each to where it gains the most even when that is a
+  // loss, and not again, until CLIMB_MOVES moves have not improved on
+  // the fewest edges cut so far, and those after the move that cut the
+  // fewest are undone. This climbs out of the local minima where no
+  // single move gains. False if the pass improved nothing.
+  static bool climb_(const Graph_& g, std::vector<uint32_t>& part,
+                     std::vector<double>& partWeights, double maxWeight,
+                     std::vector<double>& edges,
+                     std::vector<uint32_t>& touched){
+    uint32_t n = g.size();
+
+    struct Candidate{
+      double gain;
+      uint32_t v;
+
+      bool operator<(const Candidate& c) const{
+        return gain < c.gain || (gain == c.gain && v > c.v);
+      }
+    };
+
+    std::priority_queue<Candidate> heap;
+    std::vector<bool> locked(n, false);
+
+    for(uint32_t v = 0; v < n; ++v){
+      uint32_t target;
+      double gain = gain_(g, part, partWeights, v, edges, touched, target);
+      if(target != NONE){
+        heap.push({gain, v});
+      }
+    }
+
+    // the moved vertices and the parts they came from
+    std::vector<std::pair<uint32_t, uint32_t>> moves;
+    double cut = 0.0;
+    double bestCut = 0.0;
+    size_t bestMoves = 0;
+
+    while(!heap.empty() && moves.size() - bestMoves < CLIMB_MOVES){
+      Candidate c = heap.top();
+      heap.pop();
+
+      uint32_t v = c.v;
+      if(locked[v]){
+        continue;
+      }
+
+      // entries are left behind as the neighbors move, so a stale one
+      // is queued again as it now is
+      uint32_t target;
+      double gain = gain_(g, part, partWeights, v, edges, touched, target);
+      if(target == NONE){
+        continue;
+      }
+
+      if(gain != c.gain){
+        heap.push({gain, v});
+        continue;
+      }
+
+      double w = g.weights[v];
+      if(partWeights[target] + w > maxWeight){
+        continue;
+      }
+
+      uint32_t p = part[v];
+      partWeights[p] -= w;
+      partWeights[target] += w;
+      part[v] = target;
+      locked[v] = true;
+      moves.emplace_back(v, p);
+
+      cut -= gain;
+      if(cut < bestCut){
+        bestCut = cut;
+        bestMoves = moves.size();
+      }
+
+      for(uint32_t k = g.offsets[v]; k < g.offsets[v + 1]; ++k){
+        uint32_t u = g.adjacency[k];
+        if(!locked[u]){
+          uint32_t t;
+          double gu = gain_(g, part, partWeights, u, edges, touched, t);
+          if(t != NONE){
+            heap.push({gu, u});
+          }
+        }
+      }
+    }
+
+    while(moves.size() > bestMoves){
+      uint32_t v = moves.back().first;
+      uint32_t p = moves.back().second;
+      moves.pop_back();
+
+      partWeights[part[v]] -= g.weights[v];
+      partWeights[p] += g.weights[v];
+      part[v] = p;
+    }
+
+    return bestMoves > 0;
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_PARTITIONING_H__
@@ -0,0 +1,292 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_PERF_COUNTERS_H__
+#define __ARES_PERF_COUNTERS_H__
+
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ares{
+
+// hardware counters attributed to parallel regions, enabled by setting
+// ARES_PERF_COUNTERS. Each thread opens one perf_event group of cycles,
+// instructions, cache references and misses, for itself and in user
+// space only, and reads it around every piece of a region it runs,
+// keyed by the region's outlined body. Reading the group is a system
+// call, so it is a tool for finding memory bound regions rather than
+// for production runs.
+class PerfCounters{
+public:
+  enum Counter{
+    Cycles,
+    Instructions,
+    CacheReferences,
+    CacheMisses,
+    NUM_COUNTERS
+  };
+
+  struct Totals{
+    uint64_t calls = 0;
+    uint64_t ns = 0;
+    uint64_t counts[NUM_COUNTERS] = {};
+
+    void add(const Totals& t){
+      calls += t.calls;
+      ns += t.ns;
+      for(size_t i = 0; i < NUM_COUNTERS; ++i){
+        counts[i] += t.counts[i];
+      }
+    }
+  };
+
+  using RegionMap = std::unordered_map<const void*, Totals>;
+
+  class Scope;
+
+private:
+  struct Sample_{
+    uint64_t counts[NUM_COUNTERS];
+    std::chrono::steady_clock::time_point time;
+  };
+
+  struct Thread_{
+    // the group leader, -1 if the counters are not available
+    int fd = -1;
+
+    std::mutex mutex;
+    RegionMap regions;
+
+    // the innermost scope, which is paused by the ones nested in it
+    Scope* current = nullptr;
+
+    bool read(Sample_& s){
+#ifdef __linux__
+      // PERF_FORMAT_GROUP, the number of counters then their values
+      uint64_t buf[1 + NUM_COUNTERS];
+      if(fd < 0 || ::read(fd, buf, sizeof(buf)) != ssize_t(sizeof(buf))){
+        return false;
+      }
+      memcpy(s.counts, buf + 1, sizeof(s.counts));
+      s.time = std::chrono::steady_clock::now();
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    void add(const void* region, const Sample_& start, const Sample_& end,
+             bool call){
+      std::lock_guard<std::mutex> lock(mutex);
+      Totals& t = regions[region];
+      t.calls += call;
+      t.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        end.time - start.time).count();
+      for(size_t i = 0; i < NUM_COUNTERS; ++i){
+        t.counts[i] += end.counts[i] - start.counts[i];
+      }
+    }
+  };
+
+public:
+  static bool enabled(){
+    static const bool enabled = getenv("ARES_PERF_COUNTERS") != nullptr;
+    return enabled;
+  }
+
+  // counts what runs between its construction and destruction against
+  // region, if the counters could be opened. Scopes nest, what an inner
+  // one counts is not counted by the outer ones again.
+  class Scope{
+  public:
+    Scope(const void* region)
+    : thread_(enabled() ? &PerfCounters::thread_() : nullptr),
+    region_(region){
+      if(!thread_ || !thread_->read(start_)){
+        thread_ = nullptr;
+        return;
+      }
+
+      outer_ = thread_->current;
+      if(outer_){
+        thread_->add(outer_->region_, outer_->start_, start_, false);
+      }
+      thread_->current = this;
+    }
+
+    ~Scope(){
+      if(!thread_){
+        return;
+      }
+
+      Sample_ end;
+      if(thread_->read(end)){
+        thread_->add(region_, start_, end, true);
+        if(outer_){
+          outer_->start_ = end;
+        }
+      }
+      thread_->current = outer_;
+    }
+
+    Scope(const Scope&) = delete;
+
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    Thread_* thread_;
+    const void* region_;
+    Scope* outer_ = nullptr;
+    Sample_ start_;
+  };
+
+  // totals of every thread, by region
+  static RegionMap totals(){
+    Shared_& shared = shared_();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+
+    RegionMap m;
+    for(Thread_* t : shared.threads){
+      std::lock_guard<std::mutex> threadLock(t->mutex);
+      for(auto& p : t->regions){
+        m[p.first].add(p.second);
+      }
+    }
+    return m;
+  }
+
+  // false if ARES_PERF_COUNTERS is set but the counters could not be
+  // opened, e.g. because of perf_event_paranoid
+  static bool available(){
+    return enabled() && thread_().fd >= 0;
+  }
+
+private:
+  // threads are kept once they have exited, with their counts
+  struct Shared_{
+    std::mutex mutex;
+    std::vector<Thread_*> threads;
+  };
+
+  static Shared_& shared_(){
+    static Shared_* shared = new Shared_;
+    return *shared;
+  }
+
+  static Thread_& thread_(){
+    static thread_local Thread_* thread = []{
+      auto t = new Thread_;
+      open_(*t);
+
+      Shared_& shared = shared_();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      shared.threads.push_back(t);
+      return t;
+    }();
+
+    return *thread;
+  }
+
+  static void open_(Thread_& t){
+#ifdef __linux__
+    static const uint64_t configs[NUM_COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_REFERENCES,
+      PERF_COUNT_HW_CACHE_MISSES
+    };
+
+    int fds[NUM_COUNTERS];
+
+    for(size_t i = 0; i < NUM_COUNTERS; ++i){
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.disabled = i == 0;
+
+      fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, 
+                           i == 0 ? -1 : fds[0], 0));
+
+      if(fds[i] < 0){
+        while(i-- > 0){
+          close(fds[i]);
+        }
+        return;
+      }
+    }
+
+    t.fd = fds[0];
+    ioctl(t.fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_PERF_COUNTERS_H__
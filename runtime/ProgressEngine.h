@@ -0,0 +1,389 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_PROGRESS_ENGINE_H__
+#define __ARES_PROGRESS_ENGINE_H__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Affinity.h"
+#include "Trace.h"
+
+namespace ares{
+
+// a thread multiplexing the non-blocking descriptors of any number of
+// handlers with edge triggered epoll, so communication needs a fixed
+// number of threads however many peers there are. A handler is called
+// on the engine's thread whenever one of its descriptors changes state
+// or it is woken, and does all the I/O it can without blocking.
+//
+// With ARES_BUSY_POLL set the engines never sleep, they poll epoll and
+// their handlers on every turn, so a message is picked up without the
+// wake up of a blocked thread, at the cost of a core for each engine.
+class ProgressEngine{
+public:
+  class Handler{
+  public:
+    virtual ~Handler(){}
+
+    virtual void handleEvent() = 0;
+
+    // work that arrived without any descriptor changing state, checked
+    // on every turn of a busy polling engine
+    virtual bool pending(){
+      return false;
+    }
+
+  private:
+    friend class ProgressEngine;
+
+    std::atomic<bool> woken_{false};
+  };
+
+  // the engine's thread is pinned to cpu unless it is -1
+  explicit ProgressEngine(int cpu = -1)
+  : epollFD_(epoll_create1(EPOLL_CLOEXEC)),
+  wakeFD_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+  cpu_(cpu){
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epollFD_, EPOLL_CTL_ADD, wakeFD_, &ev);
+
+    thread_ = std::thread(&ProgressEngine::run_, this);
+  }
+
+  ~ProgressEngine(){
+    stop_ = true;
+    signal_();
+    thread_.join();
+
+    close(wakeFD_);
+    close(epollFD_);
+  }
+
+  // the engines of the process, ARES_COMM_THREADS of them, one by
+  // default, handed out round robin, ARES_PROGRESS_CPUS is a comma
+  // separated list of the CPUs they are pinned to in turn
+  static ProgressEngine* next(){
+    static std::vector<ProgressEngine*> engines = []{
+      size_t n = 1;
+      if(const char* s = getenv("ARES_COMM_THREADS")){
+        n = std::max(atoi(s), 1);
+      }
+
+      std::vector<int> cpus;
+      if(const char* s = getenv("ARES_PROGRESS_CPUS")){
+        std::istringstream in(s);
+        std::string cpu;
+        while(std::getline(in, cpu, ',')){
+          cpus.push_back(atoi(cpu.c_str()));
+        }
+      }
+
+      std::vector<ProgressEngine*> e;
+      for(size_t i = 0; i < n; ++i){
+        e.push_back(new ProgressEngine(cpus.empty() ? -1 :
+                                       cpus[i % cpus.size()]));
+      }
+      return e;
+    }();
+
+    static std::atomic<size_t> i{0};
+    return engines[i++ % engines.size()];
+  }
+
+  // true on the thread of an engine, which must not wait for the
+  // engines to make progress
+  static bool onEngine(){
+    return engineThread_();
+  }
+
+  // microseconds that sockets busy poll the device for, ARES_BUSY_POLL,
+  // 0 if the engines block
+  static int busyPoll(){
+    static int usec = []{
+      const char* s = getenv("ARES_BUSY_POLL");
+      return s ? std::max(atoi(s), 0) : 0;
+    }();
+    return usec;
+  }
+
+  void add(Handler* handler, int fd, uint32_t events){
+    epoll_event ev = {};
+    ev.events = events | EPOLLET;
+    ev.data.ptr = handler;
+    epoll_ctl(epollFD_, EPOLL_CTL_ADD, fd, &ev);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(std::find(handlers_.begin(), handlers_.end(), handler) == 
+       handlers_.end()){
+      handlers_.push_back(handler);
+      handlersChanged_ = true;
+    }
+  }
+
+  void remove(int fd){
+    epoll_ctl(epollFD_, EPOLL_CTL_DEL, fd, nullptr);
+  }
+
+  // has handler called soon for work that did not come from its
+  // descriptors, such as a message queued by another thread
+  void wake(Handler* handler){
+    if(handler->woken_.exchange(true)){
+      return;
+    }
+
+    mutex_.lock();
+    woken_.push_back(handler);
+    mutex_.unlock();
+
+    // a busy polling engine looks for it on its next turn
+    if(busy_){
+      wakePending_.store(true, std::memory_order_release);
+      return;
+    }
+
+    signal_();
+  }
+
+  // has handler called once deadline has passed, epoll rounds it up to
+  // the millisecond
+  void wakeAt(Handler* handler, std::chrono::steady_clock::time_point deadline){
+    mutex_.lock();
+    timers_.emplace_back(deadline, handler);
+    mutex_.unlock();
+
+    if(!busy_){
+      signal_();
+    }
+  }
+
+  // drops the timers of a handler about to go away, and stops polling it
+  void cancel(Handler* handler){
+    std::lock_guard<std::mutex> lock(mutex_);
+    timers_.erase(std::remove_if(timers_.begin(), timers_.end(),
+                                 [&](const Timer& t){
+                                   return t.second == handler;
+                                 }), timers_.end());
+
+    handlers_.erase(std::remove(handlers_.begin(), handlers_.end(), handler),
+                    handlers_.end());
+    handlersChanged_ = true;
+  }
+
+private:
+  using Timer = std::pair<std::chrono::steady_clock::time_point, Handler*>;
+
+  static const int MAX_EVENTS = 64;
+
+  static bool& engineThread_(){
+    static thread_local bool on = false;
+    return on;
+  }
+
+  // milliseconds until the first timer, rounded up, or -1 without any
+  int timeout_(){
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(timers_.empty()){
+      return -1;
+    }
+
+    auto first = std::min_element(timers_.begin(), timers_.end())->first;
+    auto wait = first - std::chrono::steady_clock::now();
+    if(wait <= std::chrono::steady_clock::duration::zero()){
+      return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+      wait + std::chrono::microseconds(999)).count();
+  }
+
+  void runTimers_(std::vector<Handler*>& due){
+    auto now = std::chrono::steady_clock::now();
+
+    mutex_.lock();
+    auto end = std::partition(timers_.begin(), timers_.end(), 
+                              [&](const Timer& t){
+                                return t.first > now;
+                              });
+    for(auto itr = end; itr != timers_.end(); ++itr){
+      due.push_back(itr->second);
+    }
+    timers_.erase(end, timers_.end());
+    mutex_.unlock();
+
+    for(Handler* h : due){
+      h->handleEvent();
+    }
+    due.clear();
+  }
+
+  void signal_(){
+    uint64_t one = 1;
+    ssize_t ret = ::write(wakeFD_, &one, sizeof(one));
+    (void)ret;
+  }
+
+  // the woken handlers, after the ones with pending work, false if
+  // there was nothing to do
+  bool poll_(std::vector<Handler*>& polled, std::vector<Handler*>& woken){
+    mutex_.lock();
+    if(handlersChanged_){
+      polled = handlers_;
+      handlersChanged_ = false;
+    }
+    mutex_.unlock();
+
+    bool any = false;
+    for(Handler* h : polled){
+      if(h->pending()){
+        h->handleEvent();
+        any = true;
+      }
+    }
+
+    if(!wakePending_.exchange(false, std::memory_order_acquire)){
+      return any;
+    }
+
+    mutex_.lock();
+    woken.swap(woken_);
+    mutex_.unlock();
+
+    for(Handler* h : woken){
+      h->woken_ = false;
+      h->handleEvent();
+    }
+    woken.clear();
+    return true;
+  }
+
+  void run_(){
+    if(cpu_ >= 0){
+      Affinity::pinCurrentThread(cpu_);
+    }
+
+    Trace::nameThread("progress");
+    engineThread_() = true;
+
+    epoll_event events[MAX_EVENTS];
+    std::vector<Handler*> woken;
+    std::vector<Handler*> polled;
+
+    while(!stop_){
+      int n = epoll_wait(epollFD_, events, MAX_EVENTS, 
+                         busy_ ? 0 : timeout_());
+
+      for(int i = 0; i < n; ++i){
+        auto handler = static_cast<Handler*>(events[i].data.ptr);
+
+        if(handler){
+          handler->handleEvent();
+          continue;
+        }
+
+        uint64_t count;
+        ssize_t ret = ::read(wakeFD_, &count, sizeof(count));
+        (void)ret;
+
+        mutex_.lock();
+        woken.swap(woken_);
+        mutex_.unlock();
+
+        // cleared first so that a wake during the call is not lost
+        for(Handler* h : woken){
+          h->woken_ = false;
+          h->handleEvent();
+        }
+        woken.clear();
+      }
+
+      // an idle turn gives the core up to any other thread that wants
+      // it, which costs little when there is none
+      if(busy_ && !poll_(polled, woken) && n == 0){
+        std::this_thread::yield();
+      }
+
+      runTimers_(woken);
+    }
+  }
+
+  int epollFD_;
+  int wakeFD_;
+  int cpu_;
+  bool busy_ = busyPoll() > 0;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> wakePending_{false};
+  std::mutex mutex_;
+  std::vector<Handler*> woken_;
+  std::vector<Handler*> handlers_;
+  bool handlersChanged_ = false;
+  std::vector<Timer> timers_;
+  std::thread thread_;
+};
+
+} // namespace ares
+
+#endif // __ARES_PROGRESS_ENGINE_H__
@@ -0,0 +1,270 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_REGION_PROFILE_H__
+#define __ARES_REGION_PROFILE_H__
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+namespace ares{
+
+// the profile of the parallel regions of an instrumented run, enabled by
+// setting ARES_PROFILE to the path of the file that it is merged into at
+// exit, in which a %r is replaced by the rank of the process. hlir-clang
+// reads it back with -mllvm -ares-profile-use to choose the schedule and
+// grain of each region, or to run it serially. Regions are identified by
+// the kind and source location of their descriptors, so the profile
+// stays valid across builds of the same source. Each line of the file
+// is one region:
+//
+//   kind line launches iterations chunks ns cost cost2 file
+//
+// with the iterations over all launches, the chunks that they were run
+// in and the ns spent in them, the sum of the ns per iteration of each
+// chunk and the sum of its squares, which give the imbalance.
+class RegionProfile{
+public:
+  struct Record{
+    uint64_t launches = 0;
+    uint64_t iterations = 0;
+    uint64_t chunks = 0;
+    uint64_t ns = 0;
+    double cost = 0.0;
+    double cost2 = 0.0;
+
+    void add(const Record& r){
+      launches += r.launches;
+      iterations += r.iterations;
+      chunks += r.chunks;
+      ns += r.ns;
+      cost += r.cost;
+      cost2 += r.cost2;
+    }
+  };
+
+  static bool enabled(){
+    static const bool enabled = init_();
+    return enabled;
+  }
+
+  // a launch of n iterations of the region described by desc, which is
+  // at line of file and of kind
+  static void launch(const void* desc, uint32_t kind, const char* file,
+                     uint32_t line, uint64_t n){
+    Thread_& t = thread_();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    Entry_& e = t.regions[desc];
+    e.kind = kind;
+    e.file = file;
+    e.line = line;
+    e.record.launches += 1;
+    e.record.iterations += n;
+  }
+
+  // a chunk of n iterations of the region that ran for ns
+  static void chunk(const void* desc, uint64_t n, uint64_t ns){
+    Thread_& t = thread_();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    Record& r = t.regions[desc].record;
+    r.chunks += 1;
+    r.ns += ns;
+    if(n > 0){
+      double c = double(ns) / n;
+      r.cost += c;
+      r.cost2 += c * c;
+    }
+  }
+
+  static void setRank(int rank){
+    shared_().rank.store(rank, std::memory_order_relaxed);
+  }
+
+  using Key = std::tuple<uint32_t, std::string, uint32_t>;
+
+  using RecordMap = std::map<Key, Record>;
+
+  // adds the records of the file at path to m, false if it could not be
+  // read
+  static bool read(const std::string& path, RecordMap& m){
+    std::ifstream in(path);
+    if(!in){
+      return false;
+    }
+
+    uint32_t kind;
+    uint32_t line;
+    Record r;
+    while(in >> kind >> line >> r.launches >> r.iterations >> r.chunks >>
+          r.ns >> r.cost >> r.cost2){
+      std::string file;
+      std::getline(in >> std::ws, file);
+      m[Key(kind, file, line)].add(r);
+    }
+
+    return true;
+  }
+
+  // merges the records of every thread into the file
+  static void flush(){
+    Shared_& shared = shared_();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+
+    std::string path = shared.path;
+    size_t pos = path.find("%r");
+    if(pos != std::string::npos){
+      path.replace(pos, 2, std::to_string(
+        shared.rank.load(std::memory_order_relaxed)));
+    }
+
+    // chunks are recorded by the threads that ran them, the location by
+    // the one that launched the region
+    std::unordered_map<const void*, Entry_> regions;
+    for(Thread_* t : shared.threads){
+      std::lock_guard<std::mutex> threadLock(t->mutex);
+      for(auto& p : t->regions){
+        Entry_& e = regions[p.first];
+        if(p.second.file){
+          e.kind = p.second.kind;
+          e.file = p.second.file;
+          e.line = p.second.line;
+        }
+        e.record.add(p.second.record);
+      }
+    }
+
+    RecordMap m;
+    read(path, m);
+
+    for(auto& p : regions){
+      const Entry_& e = p.second;
+      if(e.file){
+        m[Key(e.kind, e.file, e.line)].add(e.record);
+      }
+    }
+
+    std::ofstream out(path);
+    out.precision(17);
+
+    for(auto& p : m){
+      const Record& r = p.second;
+      out << std::get<0>(p.first) << " " << std::get<2>(p.first) << " " <<
+        r.launches << " " << r.iterations << " " << r.chunks << " " <<
+        r.ns << " " << r.cost << " " << r.cost2 << " " <<
+        std::get<1>(p.first) << "\n";
+    }
+  }
+
+private:
+  struct Entry_{
+    uint32_t kind = 0;
+    const char* file = nullptr;
+    uint32_t line = 0;
+    Record record;
+  };
+
+  struct Thread_{
+    std::mutex mutex;
+    std::unordered_map<const void*, Entry_> regions;
+  };
+
+  // threads are kept once they have exited, with their records
+  struct Shared_{
+    std::mutex mutex;
+    std::vector<Thread_*> threads;
+    std::string path;
+    std::atomic<int> rank{-1};
+  };
+
+  static Shared_& shared_(){
+    static Shared_* shared = new Shared_;
+    return *shared;
+  }
+
+  static bool init_(){
+    const char* s = getenv("ARES_PROFILE");
+    if(!s || !*s){
+      return false;
+    }
+
+    shared_().path = s;
+
+    atexit(flush);
+    return true;
+  }
+
+  static Thread_& thread_(){
+    static thread_local Thread_* thread = []{
+      auto t = new Thread_;
+
+      Shared_& shared = shared_();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      shared.threads.push_back(t);
+      return t;
+    }();
+
+    return *thread;
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_REGION_PROFILE_H__
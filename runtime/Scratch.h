@@ -0,0 +1,164 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_SCRATCH_H__
+#define __ARES_SCRATCH_H__
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace ares{
+
+// the per-thread arena behind ares::scratch(), for the temporaries of
+// Forall bodies. Blocks are bumped from the current chunk, cache line
+// aligned, and freed all at once by releasing a mark taken before them,
+// which lowered bodies do around each task and iteration. A chunk that
+// is too small is retired rather than moved, since blocks from it may
+// still be in use, and a larger one takes its place. The retired chunks
+// are freed once the outermost mark is released, so the arena settles
+// on a single chunk that fits its tasks.
+class Scratch{
+public:
+  static const size_t ALIGN = 64;
+
+  static const size_t MIN_CHUNK = size_t(64) << 10;
+
+  static void* allocate(size_t bytes){
+    Arena_& a = arena_();
+
+    size_t size = (bytes + ALIGN - 1) & ~(ALIGN - 1);
+
+    if(a.used + size > a.capacity){
+      grow_(a, size);
+    }
+
+    char* p = a.chunk + a.used;
+    a.used += size;
+    return p;
+  }
+
+  // the generation of the current chunk and the offset into it
+  static uint64_t mark(){
+    Arena_& a = arena_();
+    ++a.depth;
+    return (uint64_t(a.generation) << 32) | a.used;
+  }
+
+  // frees the blocks allocated since m was taken, marks are released in
+  // the reverse order they were taken in
+  static void release(uint64_t m){
+    Arena_& a = arena_();
+
+    // a chunk added since then holds nothing from before the mark
+    a.used = uint32_t(m >> 32) == a.generation ? uint32_t(m) : 0;
+
+    if(--a.depth == 0){
+      for(char* c : a.retired){
+        free(c);
+      }
+      a.retired.clear();
+    }
+  }
+
+private:
+  struct Arena_{
+    ~Arena_(){
+      for(char* c : retired){
+        free(c);
+      }
+      free(chunk);
+    }
+
+    char* chunk = nullptr;
+    size_t used = 0;
+    size_t capacity = 0;
+    uint32_t generation = 0;
+    uint32_t depth = 0;
+    std::vector<char*> retired;
+  };
+
+  static Arena_& arena_(){
+    static thread_local Arena_ arena;
+    return arena;
+  }
+
+  static void grow_(Arena_& a, size_t size){
+    size_t capacity = a.capacity < MIN_CHUNK ? MIN_CHUNK : a.capacity;
+
+    while(capacity < a.used + size){
+      capacity *= 2;
+    }
+
+    void* chunk;
+    if(posix_memalign(&chunk, ALIGN, capacity) != 0){
+      abort();
+    }
+
+    // nothing can point into a chunk with nothing in use
+    if(a.used == 0){
+      free(a.chunk);
+    }
+    else{
+      a.retired.push_back(a.chunk);
+    }
+
+    a.chunk = static_cast<char*>(chunk);
+    a.used = 0;
+    a.capacity = capacity;
+    ++a.generation;
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_SCRATCH_H__
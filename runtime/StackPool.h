@@ -0,0 +1,222 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_STACK_POOL_H__
+#define __ARES_STACK_POOL_H__
+
+#include <cctype>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "MemoryAccount.h"
+
+namespace ares{
+
+// stacks for the user level threads of an executor, mapped in power of
+// two size classes from 16 KB and recycled through per-thread freelists
+// like the frames of FramePool. A stack is normally acquired by the
+// worker that queues its task and released by the one that ran it, the
+// freelists are unsynchronized and hold up to ARES_STACK_CACHE bytes
+// each, 16 MB by default, stacks beyond that are unmapped.
+//
+// ARES_STACK_SIZE is the size of the stack of a task without a hint of
+// its own, in bytes or with a k or m suffix, unset or 0 leaves those to
+// the executor. With ARES_STACK_GUARD=1, each stack has an inaccessible
+// page below it, so that an overflow faults rather than running into
+// the memory beneath.
+class StackPool{
+public:
+  static const size_t MIN_SIZE = 16 << 10;
+  static const uint32_t NUM_CLASSES = 10;
+  static const size_t MAX_SIZE = MIN_SIZE << (NUM_CLASSES - 1);
+
+  static size_t defaultSize(){
+    static size_t size = []{
+      size_t bytes = bytesEnv_("ARES_STACK_SIZE", 0);
+      return bytes < MAX_SIZE ? bytes : MAX_SIZE;
+    }();
+    return size;
+  }
+
+  // the size of the stack that acquire(bytes) returns
+  static size_t classSize(size_t bytes){
+    return MIN_SIZE << sizeClass_(bytes);
+  }
+
+  // the lowest address of a stack of classSize(bytes), null if it could
+  // not be mapped
+  static char* acquire(size_t bytes){
+    uint32_t sizeClass = sizeClass_(bytes);
+    Cache_& cache = cache_();
+    Free_*& head = cache.head[sizeClass];
+
+    if(head){
+      Free_* f = head;
+      head = f->next;
+      cache.bytes -= MIN_SIZE << sizeClass;
+      return reinterpret_cast<char*>(f);
+    }
+
+    return map_(MIN_SIZE << sizeClass);
+  }
+
+  static void release(char* stack, size_t bytes){
+    uint32_t sizeClass = sizeClass_(bytes);
+    size_t size = MIN_SIZE << sizeClass;
+    Cache_& cache = cache_();
+
+    if(cache.bytes + size > cacheBytes_()){
+      unmap_(stack, size);
+      return;
+    }
+
+    auto f = reinterpret_cast<Free_*>(stack);
+    f->next = cache.head[sizeClass];
+    cache.head[sizeClass] = f;
+    cache.bytes += size;
+  }
+
+private:
+  struct Free_{
+    Free_* next;
+  };
+
+  struct Cache_{
+    ~Cache_(){
+      for(uint32_t i = 0; i < NUM_CLASSES; ++i){
+        while(head[i]){
+          Free_* f = head[i];
+          head[i] = f->next;
+          unmap_(reinterpret_cast<char*>(f), MIN_SIZE << i);
+        }
+      }
+    }
+
+    Free_* head[NUM_CLASSES] = {};
+    size_t bytes = 0;
+  };
+
+  static Cache_& cache_(){
+    static thread_local Cache_ cache;
+    return cache;
+  }
+
+  static uint32_t sizeClass_(size_t bytes){
+    uint32_t c = 0;
+    size_t size = MIN_SIZE;
+
+    while(size < bytes && c < NUM_CLASSES - 1){
+      size <<= 1;
+      ++c;
+    }
+
+    return c;
+  }
+
+  static size_t bytesEnv_(const char* name, size_t otherwise){
+    const char* e = getenv(name);
+    if(!e){
+      return otherwise;
+    }
+
+    char* end;
+    size_t bytes = strtoull(e, &end, 10);
+    char unit = char(tolower(*end));
+    return bytes << (unit == 'k' ? 10 : unit == 'm' ? 20 : 0);
+  }
+
+  static size_t cacheBytes_(){
+    static size_t bytes = bytesEnv_("ARES_STACK_CACHE", 16 << 20);
+    return bytes;
+  }
+
+  static size_t guardSize_(){
+    static size_t size = []{
+      const char* s = getenv("ARES_STACK_GUARD");
+      return s && atoi(s) != 0 ? size_t(sysconf(_SC_PAGESIZE)) : 0;
+    }();
+    return size;
+  }
+
+  // the stacks are reserved without swap, only the pages a thread has
+  // touched take memory
+  static char* map_(size_t size){
+    size_t guard = guardSize_();
+
+    void* p = mmap(nullptr, guard + size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                   -1, 0);
+    if(p == MAP_FAILED){
+      return nullptr;
+    }
+
+    if(guard > 0){
+      mprotect(p, guard, PROT_NONE);
+    }
+
+    MemoryAccount::add(MemoryAccount::Stacks, size);
+    return static_cast<char*>(p) + guard;
+  }
+
+  static void unmap_(char* stack, size_t size){
+    size_t guard = guardSize_();
+    munmap(stack - guard, guard + size);
+    MemoryAccount::remove(MemoryAccount::Stacks, size);
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_STACK_POOL_H__
@@ -0,0 +1,224 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_TASK_POOL_H__
+#define __ARES_TASK_POOL_H__
+
+#include <mutex>
+#include <vector>
+#include <new>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#include "MemoryAccount.h"
+#include "UserRegion.h"
+
+namespace ares{
+
+using FuncPtr = void (*)(void*);
+
+// intrusive task descriptor, small argument structs such as the runtime's
+// FuncArg are constructed in place in its inline storage
+class Task{
+public:
+  static const size_t INLINE_SIZE = 64;
+
+  template<class T, class... Args>
+  T* emplace(Args&&... args){
+    static_assert(sizeof(T) <= INLINE_SIZE, "task argument too large");
+    T* a = new (data_) T(std::forward<Args>(args)...);
+    arg = a;
+    return a;
+  }
+
+  void run(){
+    func(arg);
+  }
+
+  FuncPtr func;
+  void* arg;
+  uint32_t priority;
+  // the UserRegion that the task was queued in, which it runs in
+  uint16_t region;
+  // the KB of stack that an executor running it as a user level thread
+  // gives it, 0 for its default
+  uint16_t stack;
+  Task* next;
+
+private:
+  alignas(16) char data_[INLINE_SIZE];
+};
+
+static_assert(UserRegion::CAPACITY <= 1 << 16, "region ids must fit a task");
+
+// tasks are allocated in slabs and recycled through per-thread freelists,
+// full batches are exchanged with a shared list so tasks created on one
+// thread and finished on another do not accumulate on the consumer side
+class TaskPool{
+public:
+  static Task* allocate(FuncPtr func, void* arg, uint32_t priority){
+    Cache_& cache = cache_();
+
+    if(!cache.head){
+      refill_(cache);
+    }
+
+    Task* task = cache.head;
+    cache.head = task->next;
+    --cache.size;
+
+    task->func = func;
+    task->arg = arg;
+    task->priority = priority;
+    task->region = uint16_t(UserRegion::current());
+    task->stack = 0;
+    task->next = nullptr;
+
+    MemoryAccount::add(MemoryAccount::QueueItems, sizeof(Task));
+    return task;
+  }
+
+  static void release(Task* task){
+    MemoryAccount::remove(MemoryAccount::QueueItems, sizeof(Task));
+
+    Cache_& cache = cache_();
+    task->next = cache.head;
+    cache.head = task;
+
+    if(++cache.size >= 2 * BATCH_SIZE){
+      flush_(cache);
+    }
+  }
+
+private:
+  static const size_t BATCH_SIZE = 256;
+
+  struct Cache_{
+    ~Cache_(){
+      while(head){
+        flush_(*this);
+      }
+    }
+
+    Task* head = nullptr;
+    size_t size = 0;
+  };
+
+  struct Batch_{
+    Task* head;
+    size_t size;
+  };
+
+  struct Shared_{
+    std::mutex mutex;
+    std::vector<Batch_> batches;
+  };
+
+  static Cache_& cache_(){
+    static thread_local Cache_ cache;
+    return cache;
+  }
+
+  static Shared_& shared_(){
+    static Shared_* shared = new Shared_;
+    return *shared;
+  }
+
+  static void refill_(Cache_& cache){
+    Shared_& shared = shared_();
+
+    shared.mutex.lock();
+    if(!shared.batches.empty()){
+      Batch_ batch = shared.batches.back();
+      shared.batches.pop_back();
+      shared.mutex.unlock();
+      cache.head = batch.head;
+      cache.size = batch.size;
+      return;
+    }
+    shared.mutex.unlock();
+
+    Task* slab = new Task[BATCH_SIZE];
+    for(size_t i = 0; i < BATCH_SIZE - 1; ++i){
+      slab[i].next = &slab[i + 1];
+    }
+    slab[BATCH_SIZE - 1].next = nullptr;
+
+    cache.head = slab;
+    cache.size = BATCH_SIZE;
+  }
+
+  // hand one batch of at most BATCH_SIZE tasks to the shared list
+  static void flush_(Cache_& cache){
+    Task* batch = cache.head;
+    Task* last = batch;
+    size_t n = 1;
+
+    while(n < BATCH_SIZE && last->next){
+      last = last->next;
+      ++n;
+    }
+
+    cache.head = last->next;
+    cache.size -= n;
+    last->next = nullptr;
+
+    Shared_& shared = shared_();
+    shared.mutex.lock();
+    shared.batches.push_back({batch, n});
+    shared.mutex.unlock();
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_TASK_POOL_H__
@@ -0,0 +1,455 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_TASK_SPAN_H__
+#define __ARES_TASK_SPAN_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+#include "Trace.h"
+
+namespace ares{
+
+// the work and span of the graph of spawned task calls, measured as
+// Cilkview does while tracing with ARES_TRACE and printed at exit. A
+// call's path starts where it was spawned, or where the last of the
+// calls it depends on returned, and an await continues from the longer
+// of the awaiting path and the path on which the awaited calls returned,
+// so the span is the longest chain of strands however the calls were
+// scheduled. The work is the time of all the strands, that of the calls
+// run sequentially below ARES_TASK_DEPTH counted in their caller's, and
+// the overhead the time spent queueing and finishing calls. The
+// burdened span charges each call on a path a burden for migrating it,
+// ARES_TASK_BURDEN microseconds, or the overhead measured per call.
+// Strands are timed by the clock, so the workers should not outnumber
+// the cores.
+class TaskSpan{
+public:
+  // the length of a path through the graph in ns, plain and burdened
+  struct Path{
+    uint64_t span = 0;
+    uint64_t burdened = 0;
+
+    void maxWith(const Path& p){
+      span = std::max(span, p.span);
+      burdened = std::max(burdened, p.burdened);
+    }
+  };
+
+  // where a call was spawned, carried to whichever thread runs it
+  struct Edge{
+    Path path;
+    uint32_t id = 0;
+  };
+
+  // the longest of the paths that arrive at it, those on which the calls
+  // a synch waits for returned
+  class Join{
+  public:
+    void arrive(const Path& p){
+      maxTo_(span_, p.span);
+      maxTo_(burdened_, p.burdened);
+    }
+
+    Path path() const{
+      Path p;
+      p.span = span_.load(std::memory_order_acquire);
+      p.burdened = burdened_.load(std::memory_order_acquire);
+      return p;
+    }
+
+  private:
+    static void maxTo_(std::atomic<uint64_t>& a, uint64_t v){
+      uint64_t c = a.load(std::memory_order_relaxed);
+      while(c < v && !a.compare_exchange_weak(c, v,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)){}
+    }
+
+    std::atomic<uint64_t> span_{0};
+    std::atomic<uint64_t> burdened_{0};
+  };
+
+  static bool enabled(){
+    static const bool enabled = Trace::enabled() && init_();
+    return enabled;
+  }
+
+  // the calling thread starts queueing a call, until spawned(). Outside
+  // of calls, root is whether the thread is one whose code is a strand
+  // of the graph, rather than a worker.
+  static Edge spawn(bool root){
+    uint64_t t = now_();
+    Thread_& th = thread_();
+
+    Edge e;
+    e.id = shared_().nextId.fetch_add(1, std::memory_order_relaxed);
+
+    th.spawnStart = t;
+    th.spawnResume = false;
+
+    if(Frame_* f = top_(th, root, t)){
+      th.spawnResume = pause_(th, *f, t);
+      e.path = f->path;
+    }
+
+    e.path.burdened += burden_(th);
+    ++th.spawns;
+
+    Trace::record(Trace::Spawn, e.id);
+    return e;
+  }
+
+  // the time spent queueing is overhead, but on the burdened path
+  static void spawned(){
+    uint64_t t = now_();
+    Thread_& th = thread_();
+
+    th.overhead += t - th.spawnStart;
+    ++th.events;
+
+    if(!th.frames.empty()){
+      Frame_& f = th.frames.back();
+      f.path.burdened += t - th.spawnStart;
+      if(th.spawnResume){
+        resume_(f, t);
+      }
+    }
+  }
+
+  // a spawned call starts running on the calling thread, after the path
+  // on which the calls it depends on returned
+  static void begin(const Edge& e, const Path& after){
+    uint64_t t = now_();
+    Thread_& th = thread_();
+
+    Frame_ f;
+    f.path = e.path;
+    f.path.maxWith(after);
+    f.start = t;
+    f.running = true;
+    f.id = e.id;
+
+    if(!th.frames.empty()){
+      f.parentRunning = pause_(th, th.frames.back(), t);
+    }
+
+    th.frames.push_back(f);
+
+    Trace::record(Trace::Run, e.id);
+  }
+
+  // the running call returns, its path arrives at join
+  static void end(Join& join){
+    Thread_& th = thread_();
+    if(th.frames.empty() || th.frames.back().root){
+      return;
+    }
+
+    uint64_t t = now_();
+    Frame_& f = th.frames.back();
+    pause_(th, f, t);
+    f.returned = t;
+
+    join.arrive(f.path);
+    th.longest.maxWith(f.path);
+
+    Trace::record(Trace::Return, f.id);
+  }
+
+  // the path of the call that returned also arrives at join, that of the
+  // task group it was spawned in
+  static void arrive(Join& join){
+    Thread_& th = thread_();
+    if(!th.frames.empty()){
+      join.arrive(th.frames.back().path);
+    }
+  }
+
+  // the returned call is done with, the thread goes back to what it was
+  // running before it
+  static void finish(){
+    Thread_& th = thread_();
+    if(th.frames.empty() || th.frames.back().root){
+      return;
+    }
+
+    uint64_t t = now_();
+    Frame_ f = th.frames.back();
+    th.frames.pop_back();
+
+    if(f.returned){
+      th.overhead += t - f.returned;
+      ++th.events;
+    }
+
+    if(f.parentRunning && !th.frames.empty()){
+      resume_(th.frames.back(), t);
+    }
+  }
+
+  // the calling thread waits for calls, in awaitEnd() it continues after
+  // them. The calls the thread runs meanwhile are strands of their own.
+  static void awaitBegin(bool root){
+    uint64_t t = now_();
+    Thread_& th = thread_();
+
+    if(Frame_* f = top_(th, root, t)){
+      f->awaitResume = pause_(th, *f, t);
+    }
+  }
+
+  // id is the awaited call, for the trace, or 0 for a task group
+  static void awaitEnd(const Join& join, uint32_t id){
+    Thread_& th = thread_();
+    if(th.frames.empty()){
+      return;
+    }
+
+    Frame_& f = th.frames.back();
+    f.path.maxWith(join.path());
+    th.longest.maxWith(f.path);
+
+    if(f.awaitResume){
+      resume_(f, now_());
+    }
+
+    if(id){
+      Trace::record(Trace::Join, id);
+    }
+  }
+
+  // prints the analysis, nothing if no call was spawned. The calling
+  // thread's strand up to now is included, threads that are still
+  // running calls may be missing their last strands.
+  static void print(std::ostream& out){
+    uint64_t t = now_();
+    Thread_& self = thread_();
+    if(!self.frames.empty() && self.frames.front().root){
+      Frame_& f = self.frames.front();
+      if(pause_(self, f, t)){
+        resume_(f, t);
+      }
+      self.longest.maxWith(f.path);
+    }
+
+    Shared_& shared = shared_();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+
+    uint64_t work = 0;
+    uint64_t overhead = 0;
+    uint64_t spawns = 0;
+    Path longest;
+
+    for(Thread_* th : shared.threads){
+      work += th->work;
+      overhead += th->overhead;
+      spawns += th->spawns;
+      longest.maxWith(th->longest);
+    }
+
+    if(spawns == 0){
+      return;
+    }
+
+    double span = std::max(longest.span, uint64_t(1));
+    double burdened = std::max(longest.burdened, uint64_t(1));
+    double perCall = double(overhead)/spawns;
+    double burden = shared.burden >= 0 ? shared.burden : perCall;
+
+    out << "ares task graph: " << spawns << " calls, " << std::fixed <<
+      std::setprecision(3) << "work " << work/1e6 << " ms, span " <<
+      span/1e6 << " ms, parallelism " << std::setprecision(2) <<
+      work/span << std::endl;
+
+    out << "  " << std::setprecision(3) << work/1e3/spawns <<
+      " us of work and " << perCall/1e3 <<
+      " us of overhead per call, burden " << burden/1e3 << " us" <<
+      std::endl;
+
+    out << "  burdened span " << burdened/1e6 << " ms, " <<
+      "burdened parallelism " << std::setprecision(2) <<
+      work/burdened << std::endl;
+  }
+
+private:
+  // a call the thread is running, or the thread's own code for a root.
+  // A call run while another waits or spawns is pushed above it.
+  struct Frame_{
+    Path path;
+    // when the running strand started
+    uint64_t start = 0;
+    // when the call returned, 0 until it has
+    uint64_t returned = 0;
+    uint32_t id = 0;
+    bool running = false;
+    bool parentRunning = false;
+    bool awaitResume = false;
+    bool root = false;
+  };
+
+  // written only by its thread, and read at exit like the trace rings.
+  // Threads outlive their state so that their work is still counted.
+  struct Thread_{
+    std::vector<Frame_> frames;
+    Path longest;
+    uint64_t work = 0;
+    uint64_t overhead = 0;
+    // queueings and finishings the overhead was spent in
+    uint64_t events = 0;
+    uint64_t spawns = 0;
+    uint64_t spawnStart = 0;
+    bool spawnResume = false;
+  };
+
+  struct Shared_{
+    std::mutex mutex;
+    std::vector<Thread_*> threads;
+    std::atomic<uint32_t> nextId{1};
+    // ns, negative to use the overhead measured
+    double burden = -1;
+  };
+
+  static Shared_& shared_(){
+    static Shared_* shared = new Shared_;
+    return *shared;
+  }
+
+  static bool init_(){
+    if(const char* s = getenv("ARES_TASK_BURDEN")){
+      shared_().burden = atof(s) * 1e3;
+    }
+
+    atexit([]{
+      print(std::cerr);
+    });
+
+    return true;
+  }
+
+  static Thread_& thread_(){
+    static thread_local Thread_* thread = []{
+      Shared_& shared = shared_();
+      auto th = new Thread_;
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      shared.threads.push_back(th);
+      return th;
+    }();
+
+    return *thread;
+  }
+
+  static Frame_* top_(Thread_& th, bool root, uint64_t t){
+    if(th.frames.empty()){
+      if(!root){
+        return nullptr;
+      }
+
+      Frame_ f;
+      f.start = t;
+      f.running = true;
+      f.root = true;
+      th.frames.push_back(f);
+    }
+
+    return &th.frames.back();
+  }
+
+  // ends the running strand of f, if it has one, and returns whether it
+  // had
+  static bool pause_(Thread_& th, Frame_& f, uint64_t t){
+    if(!f.running){
+      return false;
+    }
+
+    uint64_t d = t - f.start;
+    f.path.span += d;
+    f.path.burdened += d;
+    th.work += d;
+    f.running = false;
+
+    return true;
+  }
+
+  static void resume_(Frame_& f, uint64_t t){
+    f.start = t;
+    f.running = true;
+  }
+
+  // the burden charged a call spawned by the thread
+  static uint64_t burden_(const Thread_& th){
+    double b = shared_().burden;
+    if(b >= 0){
+      return uint64_t(b);
+    }
+
+    // a call is queued once and finished once
+    return th.events ? 2 * th.overhead / th.events : 0;
+  }
+
+  static uint64_t now_(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_TASK_SPAN_H__
@@ -0,0 +1,131 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_THPOOL_EXECUTOR_H__
+#define __ARES_THPOOL_EXECUTOR_H__
+
+#include <atomic>
+
+extern "C"{
+#include "thpool.h"
+}
+
+#include "Executor.h"
+
+namespace ares{
+
+// executor on the c-thread-pool library in threadpool/c-thread-pool, a
+// single shared FIFO without work stealing. Its workers cannot run other
+// tasks while they wait, so it suits flat parallel loops rather than
+// nested or recursive task codes.
+class ThpoolExecutor : public Executor{
+public:
+  ThpoolExecutor(size_t numThreads)
+  : numThreads_(numThreads > 0 ? numThreads : 1),
+  pool_(thpool_init(int(numThreads_))){}
+
+  using Executor::push;
+
+  void push(Task* task) override{
+    if(index_() < 0){
+      externalPushes_.fetch_add(1, std::memory_order_relaxed);
+    }
+    thpool_add_work(pool_, run_, task);
+  }
+
+  size_t numThreads() const override{
+    return numThreads_;
+  }
+
+  int workerIndex() const override{
+    return index_();
+  }
+
+  bool tryRunOne() override{
+    return false;
+  }
+
+  uint64_t externalPushes() const override{
+    return externalPushes_.load(std::memory_order_relaxed);
+  }
+
+private:
+  // workers are numbered as they run their first task
+  static int& index_(){
+    static thread_local int index = -1;
+    return index;
+  }
+
+  static void* run_(void* arg){
+    static std::atomic<int> next{0};
+
+    int& index = index_();
+    if(index < 0){
+      index = next++;
+    }
+
+    auto task = static_cast<Task*>(arg);
+    {
+      UserRegion::TaskScope scope(task->region);
+      task->run();
+    }
+    TaskPool::release(task);
+    return nullptr;
+  }
+
+  size_t numThreads_;
+  threadpool pool_;
+  std::atomic<uint64_t> externalPushes_{0};
+};
+
+} // namespace ares
+
+#endif // __ARES_THPOOL_EXECUTOR_H__
@@ -53,107 +53,742 @@
 #define __ARES_THREAD_POOL_H__
 
 #include <vector>
+#include <string>
 #include <mutex>
-#include <functional>
 #include <thread>
-#include <queue>
+#include <algorithm>
+#include <cstdlib>
 #include <cassert>
 #include <cmath>
+#include <atomic>
+#include <chrono>
 
 #include <pthread.h>
+#include <unistd.h>
 
-#include "CVSemaphore.h"
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include "IdleSemaphore.h"
+#include "Affinity.h"
+#include "ChaseLevDeque.h"
+#include "Epoch.h"
+#include "Executor.h"
+#include "LockFreeQueue.h"
+#include "TaskPool.h"
+#include "Trace.h"
 
  //#define np(X) std::cout << __FILE__ << ":" << __LINE__ << ": " << \
  __PRETTY_FUNCTION__ << ": " << #X << " = " << (X) << std::endl
 
 namespace ares{
 
-using Func = std::function<void(void*)>;
-using FuncPtr = void (*)(void*);
-
-class ThreadPool{
+class ThreadPool : public Executor{
  public:
+   // the injection queue for threads that are not workers, a lock-free
+   // queue for each priority level of the deques, of at most
+   // ARES_INJECTION_CAPACITY tasks each, 16384 by default
    class Queue{
    public:
+     using Item = Task;
 
-     class Item{
-     public:
-       Item(Func func, void* arg, uint32_t priority)
-       : func(func),
-       arg(arg),
-       priority(priority){}
-
-       Func func;
-       void* arg;
-       uint32_t priority;
-     };
-
-     void push(Func func, void* arg, uint32_t priority){
-       mutex_.lock();
-       queue_.push(new Item(func, arg, priority));
-       mutex_.unlock();
-       
-       sem_.release();
+     Queue(){
+       for(uint32_t l = 0; l < PRIORITY_LEVELS; ++l){
+         levels_.push_back(new LockFreeQueue<Item*>(capacity_()));
+       }
      }
-     
-     Item* get(){
-       if(!sem_.acquire()){
-         return nullptr;
+
+     ~Queue(){
+       for(auto q : levels_){
+         delete q;
        }
+     }
 
-       mutex_.lock();
-       Item* item = queue_.top();
-       queue_.pop();
-       mutex_.unlock();
-       return item;
+     // false if the item's level is full
+     bool push(Item* item){
+       return levels_[level_(item->priority)]->push(item);
+     }
+     
+     // from the highest priority level down to that of minPriority
+     Item* tryGet(uint32_t minPriority=0){
+       Item* item;
+       for(uint32_t l = PRIORITY_LEVELS; l-- > level_(minPriority);){
+         if(levels_[l]->pop(item)){
+           return item;
+         }
+       }
+       return nullptr;
      }
 
    private:
-     struct Compare_{
-       bool operator()(const Item* i1, const Item* i2) const{
-         return i1->priority < i2->priority;
-       }
-     };
-     
-     typedef std::priority_queue<Item*, std::vector<Item*>, Compare_> Queue_;
+     static uint32_t capacity_(){
+       const char* s = getenv("ARES_INJECTION_CAPACITY");
+       return s ? uint32_t(std::max(atoi(s), 1)) : 16384;
+     }
 
-     Queue_ queue_;
-     CVSemaphore sem_;
-     std::mutex mutex_;
+     std::vector<LockFreeQueue<Item*>*> levels_;
    };
 
-   ThreadPool(size_t numThreads){
+   // if cpus is non-empty, worker i is pinned to cpus[i % cpus.size()],
+   // idle decides how long workers without work spin before parking.
+   // The workers are named name and their index in traces, and run at
+   // niceness if it is not 0, as far as the process may set it.
+   ThreadPool(size_t numThreads, const std::vector<int>& cpus={},
+              const IdlePolicy& idle=IdlePolicy(),
+              const std::string& name="worker", int niceness=0)
+   : cpus_(cpus),
+   idle_(idle),
+   name_(name),
+   niceness_(niceness){
      start(numThreads);
    }
 
-   void push(Func func, void* arg, uint32_t priority){
-     queue_.push(func, arg, priority);
+   ~ThreadPool(){
+     stop();
+   }
+
+   using Executor::push;
+
+   // pushes from a worker of this pool go to the bottom of its own deque
+   // for the item's priority level, all others to the shared injection
+   // queue
+   void push(Task* item) override{
+     push_(&item, 1);
+   }
+
+   void pushRange(Task** items, size_t n) override{
+     push_(items, n);
+   }
+
+   // item i goes to the mailbox of worker i % numThreads(), which it
+   // checks right after its own deque. Other workers only take from it
+   // once they have found nothing else, so the worker keeps its chunk of
+   // a range, and the memory it first touched, unless it falls behind.
+   void pushToWorkers(Task** items, size_t n) override{
+     size_t numWorkers = active_.load(std::memory_order_relaxed);
+     size_t mailed = 0;
+
+     for(size_t i = 0; i < n; ++i){
+       if(mailbox_(i % numWorkers, items[i]->priority).push(items[i])){
+         ++mailed;
+       }
+       else{
+         push_(&items[i], 1);
+       }
+     }
+
+     sem_.release(int32_t(mailed));
+
+     // a parked worker is woken for its own mailbox
+     if(parked_.load(std::memory_order_seq_cst) > 0){
+       for(size_t i = 0; i < n && i < numWorkers; ++i){
+         wake_(i);
+       }
+     }
+   }
+
+   size_t numGroups() const override{
+     return groupVec_.empty() ? 1 : groupVec_.size();
+   }
+
+   // the group's workers take turns, so the tasks of one partition are
+   // spread over its node
+   void pushToGroup(Task* item, size_t group) override{
+     if(groupVec_.empty()){
+       push_(&item, 1);
+       return;
+     }
+
+     const std::vector<size_t>& workers = groupVec_[group % groupVec_.size()];
+     size_t i = groupNext_.fetch_add(1, std::memory_order_relaxed);
+     pushToWorker(item, workers[i % workers.size()]);
+   }
+
+   // into the mailbox of worker, as for pushToWorkers(), unless it does
+   // not take part or its mailbox is full
+   void pushToWorker(Task* item, size_t worker) override{
+     if(worker < active_.load(std::memory_order_relaxed) &&
+        mailbox_(worker, item->priority).push(item)){
+       sem_.release(1);
+
+       if(parked_.load(std::memory_order_seq_cst) > 0){
+         wake_(worker);
+       }
+     }
+     else{
+       push_(&item, 1);
+     }
+   }
+
+   // the workers that take part, those from setNumThreads() on are parked
+   size_t numThreads() const override{
+     return active_.load(std::memory_order_relaxed);
+   }
+
+   size_t maxThreads() const override{
+     return threadVec_.size();
+   }
+
+   // the first n workers take part in what is queued from now on, the
+   // others park once there is nothing left for them to take, so what
+   // they were given before still runs. n is at most the number the pool
+   // was started with.
+   size_t setNumThreads(size_t n) override{
+     n = std::max(size_t(1), std::min(n, threadVec_.size()));
+
+     size_t old = active_.exchange(n, std::memory_order_seq_cst);
+
+     for(size_t i = old; i < n; ++i){
+       wake_(i);
+     }
+
+     return n;
+   }
+
+   // wakes every worker and has it exit between tasks, waiting briefly
+   // for those still running one. Tasks that are still queued are
+   // dropped, so it is only for the end of the process, as at exit.
+   void stop() override{
+     if(stopping_.exchange(true, std::memory_order_seq_cst) ||
+        getpid() != pid_){
+       return;
+     }
+
+     for(size_t i = 0; i < threadVec_.size(); ++i){
+       wake_(i);
+     }
+
+     sem_.release(int32_t(threadVec_.size()));
+
+     // a worker exiting the process waits for the others only
+     Worker_& w = worker_();
+     size_t self = w.pool == this ? 1 : 0;
+
+     auto deadline = Clock_::now() + std::chrono::seconds(1);
+     while(live_.load(std::memory_order_acquire) > self &&
+           Clock_::now() < deadline){
+       std::this_thread::sleep_for(std::chrono::microseconds(100));
+     }
+
+     for(size_t i = 0; i < threadVec_.size(); ++i){
+       if(counterVec_[i]->exited.load(std::memory_order_acquire)){
+         threadVec_[i]->join();
+       }
+     }
+   }
+
+   // the pool the calling thread is a worker of, if any
+   static ThreadPool* current(){
+     return worker_().pool;
+   }
+
+   // index of the calling worker thread, or -1 if not a worker of this pool
+   int workerIndex() const override{
+     Worker_& w = worker_();
+     return w.pool == this ? int(w.index) : -1;
+   }
+
+   // run one queued item on the calling worker, if any is available. Used
+   // by workers to help while waiting, the item is taken from their own
+   // deque first, which holds the most recently spawned children.
+   bool tryRunOne() override{
+     Worker_& w = worker_();
+     if(w.pool != this || !sem_.tryAcquire()){
+       return false;
+     }
+
+     Queue::Item* item;
+     size_t passes = 0;
+     while(!(item = findWork_(w.index, ++passes))){
+       if(stopping_.load(std::memory_order_acquire)){
+         return false;
+       }
+       std::this_thread::yield();
+     }
+
+     runItem_(item);
+     TaskPool::release(item);
+     bump_(counterVec_[w.index]->tasksExecuted);
+     return true;
+   }
+
+   // takes item back if it is still at the bottom of the calling worker's
+   // deque, i.e. it was the last push and has not been stolen, so that
+   // its pusher can run it directly. The caller then releases it.
+   bool tryTakeBack(Queue::Item* item) override{
+     Worker_& w = worker_();
+     if(w.pool != this || !sem_.tryAcquire()){
+       return false;
+     }
+
+     Deque_& d = deque_(w.index, item->priority);
+
+     Queue::Item* bottom;
+     if(d.pop(bottom)){
+       if(bottom == item){
+         return true;
+       }
+       d.push(bottom);
+     }
+
+     sem_.release();
+     return false;
+   }
+
+   // every queued item has been claimed by a worker
+   bool starving() const override{
+     return sem_.count() <= 0;
+   }
+
+   // counters are only written by their worker and are summed up here,
+   // so the values are approximate while the workers are running
+   std::vector<WorkerStats> stats() const override{
+     double elapsed = seconds_(Clock_::now() - startTime_);
+
+     std::vector<WorkerStats> v;
+
+     for(Counters_* c : counterVec_){
+       WorkerStats ws;
+       ws.tasksExecuted = c->tasksExecuted.load(std::memory_order_relaxed);
+       ws.tasksPushed = c->tasksPushed.load(std::memory_order_relaxed);
+       ws.stealAttempts = c->stealAttempts.load(std::memory_order_relaxed);
+       ws.steals = c->steals.load(std::memory_order_relaxed);
+       ws.remoteSteals = c->remoteSteals.load(std::memory_order_relaxed);
+       ws.numaNode = c->numaNode;
+       ws.peakQueueDepth = c->peakQueueDepth.load(std::memory_order_relaxed);
+       ws.idleTime = c->idleNs.load(std::memory_order_relaxed)/1e9;
+       ws.busyTime = elapsed > ws.idleTime ? elapsed - ws.idleTime : 0.0;
+       v.push_back(ws);
+     }
+
+     return v;
+   }
+
+   // pushes made by threads that are not workers of this pool
+   uint64_t externalPushes() const override{
+     return externalPushes_.load(std::memory_order_relaxed);
    }
 
    void start(size_t numThreads){
+     startTime_ = Clock_::now();
+     pid_ = getpid();
+     active_.store(numThreads, std::memory_order_relaxed);
+     live_.store(numThreads, std::memory_order_relaxed);
+
+     for(size_t i = 0; i < numThreads; ++i){
+       for(uint32_t l = 0; l < PRIORITY_LEVELS; ++l){
+         dequeVec_.push_back(new Deque_);
+         mailboxVec_.push_back(new Mailbox_(MAILBOX_CAPACITY));
+       }
+       counterVec_.push_back(new Counters_);
+
+       // workers are grouped by the NUMA node of the CPU they are pinned
+       // to, unpinned ones can run anywhere and form a single group
+       counterVec_[i]->numaNode = 
+         cpus_.empty() ? 0 : Affinity::numaNode(cpus_[i % cpus_.size()]);
+     }
+
+     // the groups in the order of their first worker
+     for(size_t i = 0; i < numThreads; ++i){
+       int node = counterVec_[i]->numaNode;
+       size_t g = 0;
+
+       while(g < groupVec_.size() && 
+             counterVec_[groupVec_[g][0]]->numaNode != node){
+         ++g;
+       }
+
+       if(g == groupVec_.size()){
+         groupVec_.emplace_back();
+       }
+       groupVec_[g].push_back(i);
+     }
+
+     // each worker's victims, those of its own group first
+     victimVec_.resize(numThreads);
+     for(size_t i = 0; i < numThreads; ++i){
+       Victims_& v = victimVec_[i];
+       int node = counterVec_[i]->numaNode;
+
+       for(size_t j = 0; j < numThreads; ++j){
+         if(j != i && counterVec_[j]->numaNode == node){
+           v.order.push_back(j);
+         }
+       }
+       v.local = v.order.size();
+
+       for(size_t j = 0; j < numThreads; ++j){
+         if(counterVec_[j]->numaNode != node){
+           v.order.push_back(j);
+         }
+       }
+     }
+
      for(size_t i = 0; i < numThreads; ++i){
-       threadVec_.push_back(new std::thread(&ThreadPool::run_, this));  
+       threadVec_.push_back(new std::thread(&ThreadPool::run_, this, i));  
      }
    }
 
-   void run_(){
+   void run_(size_t index){
+     Worker_& w = worker_();
+     w.pool = this;
+     w.index = index;
+     w.seed = index + 1;
+
+     if(!cpus_.empty()){
+       Affinity::pinCurrentThread(cpus_[index % cpus_.size()]);
+     }
+
+     Trace::nameThread(name_ + " " + std::to_string(index));
+
+#ifdef __linux__
+     if(niceness_ != 0){
+       setpriority(PRIO_PROCESS, pid_t(syscall(SYS_gettid)), niceness_);
+     }
+#endif
+
+     Counters_& c = *counterVec_[index];
+
      for(;;){
-       Queue::Item* item = queue_.get();
-       assert(item);
-       item->func(item->arg);
-       delete item;
+       if(stopping_.load(std::memory_order_acquire)){
+         break;
+       }
+
+       // only a worker that has to wait reads the clock. One beyond the
+       // number taking part parks as soon as nothing is left to take, any
+       // other once it has slept for idle_.parkAfterNs.
+       if(!sem_.tryAcquire()){
+         // frees the deque arrays this worker retired before it parks
+         Epoch::collect();
+         auto t = Clock_::now();
+
+         bool acquired = index < active_.load(std::memory_order_acquire) &&
+           sem_.acquire(idle_, idle_.parkAfterNs);
+
+         if(!acquired){
+           park_(index);
+         }
+
+         bump_(c.idleNs, std::chrono::duration_cast<std::chrono::nanoseconds>(
+           Clock_::now() - t).count());
+
+         if(!acquired){
+           continue;
+         }
+       }
+
+       // the semaphore count guarantees that an item is available
+       // somewhere, although another worker may be racing for it, or has
+       // been released by stop()
+       Queue::Item* item;
+       size_t passes = 0;
+       while(!(item = findWork_(index, ++passes))){
+         if(stopping_.load(std::memory_order_acquire)){
+           break;
+         }
+         std::this_thread::yield();
+       }
+
+       if(!item){
+         break;
+       }
+
+       runItem_(item);
+       TaskPool::release(item);
+       bump_(c.tasksExecuted);
      }
+
+     c.exited.store(true, std::memory_order_release);
+     live_.fetch_sub(1, std::memory_order_acq_rel);
    }
 
  private:
    using ThreadVec = std::vector<std::thread*>;
+   using Deque_ = ChaseLevDeque<Queue::Item*>;
+   using DequeVec = std::vector<Deque_*>;
+   using Mailbox_ = LockFreeQueue<Queue::Item*>;
+   using MailboxVec = std::vector<Mailbox_*>;
+
+   static const uint32_t MAILBOX_CAPACITY = 1024;
+
+   static const size_t MAILBOX_PATIENCE = 64;
+
+   struct Victims_{
+     std::vector<size_t> order;
+     size_t local = 0;
+   };
+
+   struct Worker_{
+     ThreadPool* pool = nullptr;
+     size_t index = 0;
+     uint32_t seed = 0;
+   };
+
+   using Clock_ = std::chrono::steady_clock;
+
+   struct Counters_{
+     std::atomic<uint64_t> tasksExecuted{0};
+     std::atomic<uint64_t> tasksPushed{0};
+     std::atomic<uint64_t> stealAttempts{0};
+     std::atomic<uint64_t> steals{0};
+     std::atomic<uint64_t> remoteSteals{0};
+     std::atomic<uint64_t> peakQueueDepth{0};
+     std::atomic<uint64_t> idleNs{0};
+     // 1 while the worker is parked, see park_()
+     std::atomic<int32_t> parked{0};
+     std::atomic<bool> exited{false};
+     int numaNode = 0;
+     char pad_[64];
+   };
+
+   using CounterVec = std::vector<Counters_*>;
+
+   // priorities 0 and 1 have their own level, higher ones share the top
+   // level within the deques
+   static const uint32_t PRIORITY_LEVELS = 3;
+
+   static uint32_t level_(uint32_t priority){
+     return priority < PRIORITY_LEVELS ? priority : PRIORITY_LEVELS - 1;
+   }
+
+   Deque_& deque_(size_t index, uint32_t priority){
+     return *dequeVec_[index * PRIORITY_LEVELS + level_(priority)];
+   }
+
+   Mailbox_& mailbox_(size_t index, uint32_t priority){
+     return *mailboxVec_[index * PRIORITY_LEVELS + level_(priority)];
+   }
+
+   // in the phase that the item was queued in
+   static void runItem_(Queue::Item* item){
+     UserRegion::TaskScope scope(item->region);
+     Trace::record(Trace::TaskBegin, item->region);
+     item->run();
+     Trace::record(Trace::TaskEnd);
+   }
+
+   // single writer, so a plain load and store rather than an atomic
+   // read-modify-write
+   static void bump_(std::atomic<uint64_t>& c, uint64_t n=1){
+     c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+   }
+
+   static double seconds_(Clock_::duration d){
+     return std::chrono::duration<double>(d).count();
+   }
+
+   static Worker_& worker_(){
+     static thread_local Worker_ worker;
+     return worker;
+   }
+
+   // sleeps until the worker takes part and wake_() is called for it or
+   // there is work, or the pool stops. The seq_cst store of parked and
+   // load of the semaphore count pair with the release and load of
+   // parked_ by the pushers, so either one sees the work or the pusher
+   // sees the worker.
+   void park_(size_t index){
+     std::atomic<int32_t>& p = counterVec_[index]->parked;
+
+     p.store(1, std::memory_order_seq_cst);
+     parked_.fetch_add(1, std::memory_order_seq_cst);
+
+     while(!stopping_.load(std::memory_order_seq_cst)){
+       if(index < active_.load(std::memory_order_seq_cst) &&
+          (p.load(std::memory_order_seq_cst) == 0 || sem_.count() > 0)){
+         break;
+       }
+
+       if(p.load(std::memory_order_seq_cst) == 1){
+         futexWait(&p, 1);
+         continue;
+       }
+
+       // woken while not taking part, looks again before it sleeps
+       p.store(1, std::memory_order_seq_cst);
+     }
+
+     p.store(0, std::memory_order_relaxed);
+     parked_.fetch_sub(1, std::memory_order_relaxed);
+   }
+
+   void wake_(size_t index){
+     std::atomic<int32_t>& p = counterVec_[index]->parked;
+
+     int32_t expected = 1;
+     if(p.compare_exchange_strong(expected, 0, std::memory_order_seq_cst)){
+       futexWake(&p, 1);
+     }
+   }
+
+   // one of the parked workers that take part, for a push of new work
+   void wakeOne_(){
+     size_t n = active_.load(std::memory_order_relaxed);
+
+     for(size_t i = 0; i < n; ++i){
+       if(counterVec_[i]->parked.load(std::memory_order_relaxed) == 1){
+         wake_(i);
+         return;
+       }
+     }
+   }
+
+   // the tasks are published with one semaphore release, unless the
+   // injection queue fills, when the workers are woken for what is in it
+   // before waiting for room
+   void push_(Task** items, size_t n){
+     Worker_& w = worker_();
+
+     Trace::record(Trace::Push, w.pool == this ? uint32_t(w.index) : 
+                   Trace::NONE, uint32_t(n));
+
+     if(w.pool == this){
+       Counters_& c = *counterVec_[w.index];
+       for(size_t i = 0; i < n; ++i){
+         uint64_t depth = deque_(w.index, items[i]->priority).push(items[i]);
+         bump_(c.tasksPushed);
+         if(depth > c.peakQueueDepth.load(std::memory_order_relaxed)){
+           c.peakQueueDepth.store(depth, std::memory_order_relaxed);
+         }
+       }
+     }
+     else{
+       size_t released = 0;
+       for(size_t i = 0; i < n;){
+         if(queue_.push(items[i])){
+           ++i;
+           continue;
+         }
+
+         sem_.release(int32_t(i - released));
+         released = i;
+         std::this_thread::yield();
+       }
+
+       externalPushes_.fetch_add(n, std::memory_order_relaxed);
+       n -= released;
+     }
+
+     sem_.release(int32_t(n));
+
+     if(parked_.load(std::memory_order_seq_cst) > 0){
+       wakeOne_();
+     }
+   }
+
+   // from the highest priority level down: LIFO from our own deque, our
+   // mailbox, the injection queue, then FIFO steals, from the workers of
+   // our own NUMA node before the others, and last the other mailboxes,
+   // from the MAILBOX_PATIENCE-th pass on, which gives their sleeping
+   // owners time to wake up for them. All in one guard so that every
+   // steal does not announce itself.
+   Queue::Item* findWork_(size_t index, size_t pass){
+     Epoch::Guard guard;
+
+     Queue::Item* item;
+
+     Counters_& c = *counterVec_[index];
+
+     Worker_& w = worker_();
+     w.seed = w.seed * 1103515245 + 12345;
+     size_t start = w.seed >> 16;
+
+     const Victims_& v = victimVec_[index];
+
+     for(uint32_t l = PRIORITY_LEVELS; l-- > 0;){
+       if(deque_(index, l).pop(item) || mailbox_(index, l).pop(item)){
+         return item;
+       }
+
+       item = queue_.tryGet(l);
+       if(item){
+         return item;
+       }
+
+       for(size_t i = 0; i < v.order.size(); ++i){
+         size_t victim = victim_(v, start, i);
+         bump_(c.stealAttempts);
+         if(deque_(victim, l).steal(item)){
+           bump_(c.steals);
+           Trace::record(Trace::Steal, uint32_t(victim));
+           if(i >= v.local){
+             bump_(c.remoteSteals);
+           }
+           return item;
+         }
+       }
+
+       for(size_t i = 0; pass >= MAILBOX_PATIENCE && i < v.order.size(); 
+           ++i){
+         size_t victim = victim_(v, start, i);
+         if(mailbox_(victim, l).pop(item)){
+           bump_(c.steals);
+           Trace::record(Trace::Steal, uint32_t(victim));
+           if(i >= v.local){
+             bump_(c.remoteSteals);
+           }
+           return item;
+         }
+       }
+     }
+
+     return nullptr;
+   }
+
+   // the i-th victim to try, the local and remote ones each rotated by
+   // the same random start
+   static size_t victim_(const Victims_& v, size_t start, size_t i){
+     if(i < v.local){
+       return v.order[(start + i) % v.local];
+     }
+
+     size_t remote = v.order.size() - v.local;
+     return v.order[v.local + (start + i - v.local) % remote];
+   }
 
    Queue queue_;
 
-   std::mutex mutex_;
+   IdleSemaphore sem_;
+
+   DequeVec dequeVec_;
+
+   MailboxVec mailboxVec_;
+
+   std::vector<Victims_> victimVec_;
+
+   std::vector<std::vector<size_t>> groupVec_;
+
+   std::atomic<size_t> groupNext_{0};
+
+   CounterVec counterVec_;
+
+   std::atomic<uint64_t> externalPushes_{0};
+
+   Clock_::time_point startTime_;
 
    ThreadVec threadVec_;
+
+   // the workers that take part, those parked in park_(), those that have
+   // not exited, and the process that started them
+   std::atomic<size_t> active_{0};
+
+   std::atomic<int32_t> parked_{0};
+
+   std::atomic<size_t> live_{0};
+
+   std::atomic<bool> stopping_{false};
+
+   pid_t pid_ = 0;
+
+   std::vector<int> cpus_;
+
+   IdlePolicy idle_;
+
+   std::string name_;
+
+   int niceness_;
  };
 
 } // namespace ares
@@ -0,0 +1,373 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_TRACE_H__
+#define __ARES_TRACE_H__
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace ares{
+
+// event tracing, enabled by setting ARES_TRACE to the path of a Chrome
+// trace (chrome://tracing, Perfetto) that is written at exit, in which
+// a %r is replaced by the rank of the process. Each thread records into
+// a ring of its own of ARES_TRACE_EVENTS events, 65536 by default, that
+// keeps the most recent ones, so recording takes no lock and costs a
+// branch when tracing is off.
+class Trace{
+public:
+  enum Event : uint32_t{
+    // a is the phase of the task, see UserRegion
+    TaskBegin,
+    TaskEnd,
+    // a is the worker pushed to, or NONE from outside the pool, b the
+    // number of tasks
+    Push,
+    // a is the victim
+    Steal,
+    BarrierBegin,
+    BarrierEnd,
+    // a is the peer rank, b the size in bytes
+    Send,
+    Receive,
+    // the edges of the task graph, drawn as flows: a is the id of the
+    // call, which is spawned, starts running, returns and is awaited
+    Spawn,
+    Run,
+    Return,
+    Join,
+    // a phase of ares_region_begin(), a is its id
+    RegionBegin,
+    RegionEnd
+  };
+
+  static const uint32_t NONE = UINT32_MAX;
+
+  static bool enabled(){
+    static const bool enabled = init_();
+    return enabled;
+  }
+
+  static void record(Event event, uint32_t a=0, uint32_t b=0){
+    if(enabled()){
+      ring_().record(event, a, b);
+    }
+  }
+
+  // names the calling thread in the trace
+  static void nameThread(const std::string& name){
+    if(enabled()){
+      Ring_& r = ring_();
+      std::lock_guard<std::mutex> lock(shared_().mutex);
+      r.name = name;
+    }
+  }
+
+  static void setRank(int rank){
+    shared_().rank.store(rank, std::memory_order_relaxed);
+  }
+
+  // names the phase id in the trace
+  static void nameRegion(uint32_t id, const std::string& name){
+    if(enabled()){
+      Shared_& shared = shared_();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      if(shared.regionNames.size() <= id){
+        shared.regionNames.resize(id + 1);
+      }
+      shared.regionNames[id] = escape_(name);
+    }
+  }
+
+  // writes what the rings hold, threads that are still recording may
+  // overwrite events while they are read
+  static void flush(){
+    Shared_& shared = shared_();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+
+    std::string path = shared.path;
+    size_t pos = path.find("%r");
+    if(pos != std::string::npos){
+      path.replace(pos, 2, std::to_string(
+        shared.rank.load(std::memory_order_relaxed)));
+    }
+
+    std::ofstream out(path);
+    if(!out){
+      return;
+    }
+
+    // ticks of the event clock per microsecond, from the elapsed time
+    double ticksPerUs = 1000.0;
+#if defined(__x86_64__) || defined(__i386__)
+    double ns = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - shared.startTime).count();
+    if(ns > 0){
+      ticksPerUs = (now_() - shared.startTicks) / ns * 1000;
+    }
+#endif
+
+    int pid = shared.rank.load(std::memory_order_relaxed);
+    pid = pid < 0 ? 0 : pid;
+
+    out << "{\"traceEvents\":[\n";
+
+    bool first = true;
+    for(size_t t = 0; t < shared.rings.size(); ++t){
+      Ring_& r = *shared.rings[t];
+
+      if(!r.name.empty()){
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\"," <<
+          "\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << t << 
+          ",\"args\":{\"name\":\"" << r.name << "\"}}";
+        first = false;
+      }
+
+      uint64_t end = r.count.load(std::memory_order_acquire);
+      uint64_t begin = end > r.events.size() ? end - r.events.size() : 0;
+
+      for(uint64_t i = begin; i < end; ++i){
+        const Event_& e = r.events[i & (r.events.size() - 1)];
+        double ts = (e.time - shared.startTicks) / ticksPerUs;
+
+        out << (first ? "" : ",\n");
+        first = false;
+
+        writeEvent_(out, e, ts, pid, t, shared.regionNames);
+      }
+    }
+
+    out << "\n]}\n";
+  }
+
+private:
+  struct Event_{
+    uint64_t time;
+    uint32_t event;
+    uint32_t a;
+    uint32_t b;
+  };
+
+  struct Ring_{
+    Ring_(size_t size)
+    : events(size){}
+
+    void record(Event event, uint32_t a, uint32_t b){
+      uint64_t n = count.load(std::memory_order_relaxed);
+      Event_& e = events[n & (events.size() - 1)];
+      e.time = now_();
+      e.event = event;
+      e.a = a;
+      e.b = b;
+      count.store(n + 1, std::memory_order_release);
+    }
+
+    std::vector<Event_> events;
+    std::atomic<uint64_t> count{0};
+    std::string name;
+  };
+
+  // rings outlive their threads, so that the trace of an exited thread
+  // is still written
+  struct Shared_{
+    std::mutex mutex;
+    std::vector<Ring_*> rings;
+    std::string path;
+    size_t ringSize = 0;
+    std::atomic<int> rank{-1};
+    uint64_t startTicks = 0;
+    std::chrono::steady_clock::time_point startTime;
+    std::vector<std::string> regionNames;
+  };
+
+  static Shared_& shared_(){
+    static Shared_* shared = new Shared_;
+    return *shared;
+  }
+
+  static bool init_(){
+    const char* s = getenv("ARES_TRACE");
+    if(!s || !*s){
+      return false;
+    }
+
+    Shared_& shared = shared_();
+    shared.path = s;
+
+    // a power of two, for the index mask
+    size_t n = 65536;
+    if(const char* e = getenv("ARES_TRACE_EVENTS")){
+      n = strtoull(e, nullptr, 10);
+    }
+    shared.ringSize = 1;
+    while(shared.ringSize < n){
+      shared.ringSize <<= 1;
+    }
+
+    shared.startTime = std::chrono::steady_clock::now();
+    shared.startTicks = now_();
+
+    atexit(flush);
+    return true;
+  }
+
+  static Ring_& ring_(){
+    static thread_local Ring_* ring = []{
+      Shared_& shared = shared_();
+      auto r = new Ring_(shared.ringSize);
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      shared.rings.push_back(r);
+      return r;
+    }();
+
+    return *ring;
+  }
+
+  // the TSC where there is one, which is cheaper to read than the clock
+  static uint64_t now_(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  // for a string of the trace's JSON
+  static std::string escape_(const std::string& str){
+    std::string s;
+    for(char c : str){
+      if(c == '"' || c == '\\'){
+        s += '\\';
+      }
+      s += c;
+    }
+    return s;
+  }
+
+  static void writeEvent_(std::ostream& out, const Event_& e, double ts,
+                          int pid, size_t tid,
+                          const std::vector<std::string>& regionNames){
+    static const char* names[] = {"task", "task", "push", "steal",
+                                  "barrier", "barrier", "send", "receive",
+                                  "spawn", "spawn", "join", "join",
+                                  "region", "region"};
+
+    static const char* phases[] = {"B", "E", "i", "i", "B", "E", "i", "i",
+                                   "s", "f", "s", "f", "B", "E"};
+
+    auto regionName = [&](uint32_t id){
+      return id < regionNames.size() ? regionNames[id] : std::string();
+    };
+
+    std::string name = names[e.event];
+    if(e.event == RegionBegin || e.event == RegionEnd){
+      std::string n = regionName(e.a);
+      if(!n.empty()){
+        name = n;
+      }
+    }
+
+    out << "{\"name\":\"" << name << "\",\"ph\":\"" <<
+      phases[e.event] << "\",\"ts\":" << std::fixed << ts <<
+      ",\"pid\":" << pid << ",\"tid\":" << tid;
+
+    switch(e.event){
+      case TaskBegin:
+        if(e.a != 0){
+          out << ",\"args\":{\"region\":\"" << regionName(e.a) << "\"}";
+        }
+        break;
+      case RegionBegin:
+      case RegionEnd:
+        out << ",\"cat\":\"region\"";
+        break;
+      case Push:
+        out << ",\"s\":\"t\",\"args\":{\"worker\":" << 
+          (e.a == NONE ? -1 : int64_t(e.a)) << ",\"tasks\":" << e.b << "}";
+        break;
+      case Steal:
+        out << ",\"s\":\"t\",\"args\":{\"victim\":" << e.a << "}";
+        break;
+      case Send:
+      case Receive:
+        out << ",\"s\":\"t\",\"args\":{\"peer\":" << int32_t(e.a) <<
+          ",\"bytes\":" << e.b << "}";
+        break;
+      case Spawn:
+      case Return:
+        out << ",\"cat\":\"task\",\"id\":" << e.a;
+        break;
+      case Run:
+      case Join:
+        out << ",\"cat\":\"task\",\"id\":" << e.a << ",\"bp\":\"e\"";
+        break;
+    }
+
+    out << "}";
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_TRACE_H__
@@ -0,0 +1,331 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+#ifndef __ARES_USER_REGION_H__
+#define __ARES_USER_REGION_H__
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Trace.h"
+
+namespace ares{
+
+// the phases that an application marks with ares_region_begin() and
+// ares_region_end(), such as "assemble" or "solve", which nest on each
+// thread. A task queued inside a phase carries it, see Task::region, so
+// the worker that runs it, and the tasks that it queues in turn, count
+// towards the phase too. With ARES_TRACE each phase is a span of the
+// thread that marked it and each task names its phase, with ARES_STATS,
+// ARES_STATS_INTERVAL or ARES_METRICS each phase is timed: its time
+// between begin and end on the threads that marked it, and its work,
+// that of the tasks run for it on any thread. Otherwise a begin or end
+// is a few stores to the thread's state.
+class UserRegion{
+public:
+  // phases past the capacity of the table are not told apart
+  static const uint32_t CAPACITY = 256;
+
+  // the id of no phase, that of code outside of all of them
+  static const uint32_t NONE = 0;
+
+  static bool timed(){
+    static const bool timed = getenv("ARES_STATS") || 
+      getenv("ARES_STATS_INTERVAL") || getenv("ARES_METRICS");
+    return timed;
+  }
+
+  // the id of the phase called name, the same for each call with the
+  // same name, which a pointer seen before finds without a lock
+  static uint32_t id(const char* name){
+    State_& s = state_();
+    CacheEntry_& c = s.cache[(reinterpret_cast<uintptr_t>(name) >> 3) %
+                             CACHE_SIZE];
+    if(c.name == name && strcmp(c.interned, name) == 0){
+      return c.id;
+    }
+
+    c.id = intern_(name);
+    if(c.id != NONE){
+      c.name = name;
+      c.interned = names_()[c.id].c_str();
+    }
+    return c.id;
+  }
+
+  static std::string name(uint32_t id){
+    Shared_& shared = shared_();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    return id < shared.numNames ? names_()[id] : std::string();
+  }
+
+  // the phase of the calling thread
+  static uint32_t current(){
+    return state_().current;
+  }
+
+  static void begin(uint32_t id){
+    State_& s = state_();
+
+    if(s.depth < MAX_DEPTH){
+      s.outer[s.depth] = s.current;
+      s.start[s.depth] = id != NONE && timed() ? ticks_() : 0;
+    }
+    ++s.depth;
+    s.current = id;
+
+    Trace::record(Trace::RegionBegin, id);
+  }
+
+  // an end without a begin is ignored
+  static void end(){
+    State_& s = state_();
+    if(s.depth == 0){
+      return;
+    }
+
+    uint32_t id = s.current;
+    --s.depth;
+
+    if(s.depth < MAX_DEPTH){
+      if(uint64_t start = s.start[s.depth]){
+        Counters_& c = counters_(s);
+        add_(c.calls[id], 1);
+        add_(c.ticks[id], ticks_() - start);
+      }
+      s.current = s.outer[s.depth];
+    }
+
+    Trace::record(Trace::RegionEnd, id);
+  }
+
+  // the calling thread runs a task queued in phase id until the scope
+  // ends, which counts as the phase's work
+  class TaskScope{
+  public:
+    TaskScope(uint32_t id)
+    : id_(id){
+      State_& s = state_();
+      outer_ = s.current;
+      s.current = id;
+      start_ = id != NONE && timed() ? ticks_() : 0;
+    }
+
+    ~TaskScope(){
+      State_& s = state_();
+      if(start_){
+        add_(counters_(s).work[id_], ticks_() - start_);
+      }
+      s.current = outer_;
+    }
+
+  private:
+    uint32_t id_;
+    uint32_t outer_;
+    uint64_t start_;
+  };
+
+  // calls f(name, calls, seconds, workSeconds) for each phase, summed
+  // over the threads
+  template<class F>
+  static void forEach(F&& f){
+    Shared_& shared = shared_();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+
+    double ticksPerSecond = ticksPerSecond_(shared);
+
+    for(uint32_t id = 1; id < shared.numNames; ++id){
+      uint64_t calls = 0;
+      uint64_t ticks = 0;
+      uint64_t work = 0;
+      for(Counters_* c : shared.counters){
+        calls += c->calls[id].load(std::memory_order_relaxed);
+        ticks += c->ticks[id].load(std::memory_order_relaxed);
+        work += c->work[id].load(std::memory_order_relaxed);
+      }
+
+      f(names_()[id], calls, ticks / ticksPerSecond, work / ticksPerSecond);
+    }
+  }
+
+private:
+  static const uint32_t MAX_DEPTH = 64;
+  static const size_t CACHE_SIZE = 16;
+
+  // a name seen before and its copy, which tells whether the name is
+  // still the same at that address
+  struct CacheEntry_{
+    const char* name;
+    const char* interned;
+    uint32_t id;
+  };
+
+  // only ever written by their thread, so they are added to without a
+  // read-modify-write and read by forEach() as they are
+  struct Counters_{
+    std::atomic<uint64_t> calls[CAPACITY];
+    std::atomic<uint64_t> ticks[CAPACITY];
+    std::atomic<uint64_t> work[CAPACITY];
+  };
+
+  // trivially constructed, so that a thread reaches its own without a
+  // guard
+  struct State_{
+    uint32_t current;
+    uint32_t depth;
+    uint32_t outer[MAX_DEPTH];
+    uint64_t start[MAX_DEPTH];
+    CacheEntry_ cache[CACHE_SIZE];
+    Counters_* counters;
+  };
+
+  // counters outlive their threads, so that the time of an exited one
+  // is still summed
+  struct Shared_{
+    std::mutex mutex;
+    // names_() holds CAPACITY, of which numNames are taken, id 0 by NONE
+    std::atomic<uint32_t> numNames{1};
+    std::vector<Counters_*> counters;
+    uint64_t startTicks = ticks_();
+    std::chrono::steady_clock::time_point startTime = 
+      std::chrono::steady_clock::now();
+  };
+
+  static Shared_& shared_(){
+    static Shared_* shared = new Shared_;
+    return *shared;
+  }
+
+  // sized once, so that a name is read without the lock once its id has
+  // been handed out
+  static std::string* names_(){
+    static std::string* names = new std::string[CAPACITY];
+    return names;
+  }
+
+  static State_& state_(){
+    static thread_local State_ state;
+    return state;
+  }
+
+  static uint32_t intern_(const char* name){
+    Shared_& shared = shared_();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+
+    std::string* names = names_();
+    uint32_t n = shared.numNames.load(std::memory_order_relaxed);
+    for(uint32_t id = 1; id < n; ++id){
+      if(names[id] == name){
+        return id;
+      }
+    }
+
+    if(n == CAPACITY){
+      return NONE;
+    }
+
+    names[n] = name;
+    shared.numNames.store(n + 1, std::memory_order_release);
+    Trace::nameRegion(n, name);
+    return n;
+  }
+
+  static Counters_& counters_(State_& s){
+    if(!s.counters){
+      s.counters = new Counters_();
+
+      Shared_& shared = shared_();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      shared.counters.push_back(s.counters);
+    }
+    return *s.counters;
+  }
+
+  static void add_(std::atomic<uint64_t>& counter, uint64_t n){
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+  // the TSC where there is one, as for Trace, never 0
+  static uint64_t ticks_(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc() | 1;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count() | 1;
+#endif
+  }
+
+  static double ticksPerSecond_(const Shared_& shared){
+#if defined(__x86_64__) || defined(__i386__)
+    double s = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - shared.startTime).count();
+    if(s > 0){
+      return (ticks_() - shared.startTicks) / s;
+    }
+#endif
+    return 1e9;
+  }
+};
+
+} // namespace ares
+
+#endif // __ARES_USER_REGION_H__
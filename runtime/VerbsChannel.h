@@ -0,0 +1,880 @@
+/*
+ * ###########################################################################
+ *  Copyright 2015-2016. Los Alamos National Security, LLC. This software was
+ *  produced under U.S. Government contract ??? (LA-CC-15-056) for Los
+ *  Alamos National Laboratory (LANL), which is operated by Los Alamos
+ *  National Security, LLC for the U.S. Department of Energy. The
+ *  U.S. Government has rights to use, reproduce, and distribute this
+ *  software.  NEITHER THE GOVERNMENT NOR LOS ALAMOS NATIONAL SECURITY,
+ *  LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY
+ *  FOR THE USE OF THIS SOFTWARE.  If software is modified to produce
+ *  derivative works, such modified software should be clearly marked,
+ *  so as not to confuse it with the version available from LANL.
+ *
+ *  Additionally, redistribution and use in source and binary forms,
+ *  with or without modification, are permitted provided that the
+ *  following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *
+ *    * Neither the name of Los Alamos National Security, LLC, Los
+ *      Alamos National Laboratory, LANL, the U.S. Government, nor the
+ *      names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ * ###########################################################################
+ *
+ * Notes
+ *
+ * #####
+ */
+
+
+#ifndef __ARES_VERBS_CHANNEL_H__
+#define __ARES_VERBS_CHANNEL_H__
+
+#include <infiniband/verbs.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "Channel.h"
+
+namespace ares{
+
+// the first port of an adapter that is up, opened once per process so
+// that memory registered with it can be used with any of the peers
+class VerbsDevice{
+public:
+  static VerbsDevice* get(){
+    static VerbsDevice* device = open_();
+    return device;
+  }
+
+  ibv_context* context() const{
+    return context_;
+  }
+
+  ibv_pd* pd() const{
+    return pd_;
+  }
+
+  uint8_t port() const{
+    return port_;
+  }
+
+  const ibv_port_attr& portAttr() const{
+    return portAttr_;
+  }
+
+  int gidIndex() const{
+    return gidIndex_;
+  }
+
+  const ibv_gid& gid() const{
+    return gid_;
+  }
+
+  // memory that peers may read and write with one-sided operations
+  ibv_mr* registerMemory(void* buf, size_t size){
+    ibv_mr* mr = ibv_reg_mr(pd_, buf, size, IBV_ACCESS_LOCAL_WRITE |
+                            IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ);
+    if(mr){
+      std::lock_guard<std::mutex> lock(mutex_);
+      regions_[uintptr_t(buf)] = mr;
+    }
+    return mr;
+  }
+
+  bool deregisterMemory(void* buf){
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto itr = regions_.find(uintptr_t(buf));
+    if(itr == regions_.end()){
+      return false;
+    }
+    ibv_dereg_mr(itr->second);
+    regions_.erase(itr);
+    return true;
+  }
+
+  // the registered region that holds all of buf, if any
+  ibv_mr* findMemory(const void* buf, size_t size){
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto itr = regions_.upper_bound(uintptr_t(buf));
+    if(itr == regions_.begin()){
+      return nullptr;
+    }
+    --itr;
+    ibv_mr* mr = itr->second;
+    uintptr_t start = uintptr_t(mr->addr);
+    if(uintptr_t(buf) + size > start + mr->length){
+      return nullptr;
+    }
+    return mr;
+  }
+
+private:
+  VerbsDevice(){}
+
+  // ARES_VERBS=0 keeps every peer on TCP, ARES_VERBS_DEVICE names the
+  // adapter and ARES_VERBS_GID the GID index on RoCE
+  static VerbsDevice* open_(){
+    const char* enabled = getenv("ARES_VERBS");
+    if(enabled && atoi(enabled) == 0){
+      return nullptr;
+    }
+
+    int n;
+    ibv_device** devices = ibv_get_device_list(&n);
+    if(!devices){
+      return nullptr;
+    }
+
+    const char* name = getenv("ARES_VERBS_DEVICE");
+    const char* gid = getenv("ARES_VERBS_GID");
+
+    VerbsDevice* device = nullptr;
+
+    for(int i = 0; i < n && !device; ++i){
+      if(name && strcmp(ibv_get_device_name(devices[i]), name) != 0){
+        continue;
+      }
+
+      ibv_context* context = ibv_open_device(devices[i]);
+      if(!context){
+        continue;
+      }
+
+      ibv_device_attr attr;
+      if(ibv_query_device(context, &attr) == 0){
+        for(uint8_t p = 1; p <= attr.phys_port_cnt && !device; ++p){
+          ibv_port_attr portAttr;
+          if(ibv_query_port(context, p, &portAttr) != 0 ||
+             portAttr.state != IBV_PORT_ACTIVE){
+            continue;
+          }
+
+          device = new VerbsDevice;
+          device->context_ = context;
+          device->port_ = p;
+          device->portAttr_ = portAttr;
+          device->gidIndex_ = gid ? atoi(gid) : 0;
+          ibv_query_gid(context, p, device->gidIndex_, &device->gid_);
+        }
+      }
+
+      if(!device){
+        ibv_close_device(context);
+      }
+    }
+
+    ibv_free_device_list(devices);
+
+    if(device){
+      device->pd_ = ibv_alloc_pd(device->context_);
+      if(!device->pd_){
+        ibv_close_device(device->context_);
+        delete device;
+        return nullptr;
+      }
+    }
+
+    return device;
+  }
+
+  ibv_context* context_ = nullptr;
+  ibv_pd* pd_ = nullptr;
+  uint8_t port_ = 0;
+  ibv_port_attr portAttr_;
+  int gidIndex_ = 0;
+  ibv_gid gid_;
+
+  std::mutex mutex_;
+  std::map<uintptr_t, ibv_mr*> regions_;
+};
+
+// a connection over a reliable connected queue pair, the byte stream
+// is sent in slots that the peer has receives posted for, which it
+// gives back as credits in the immediate data of its own sends, the
+// descriptor is that of the completion channel, which the progress
+// engine sees ready whenever a send or receive completes
+class VerbsChannel : public Channel{
+public:
+  // the remote side of a one-sided operation
+  struct RemoteMemory{
+    uint64_t addr;
+    uint32_t rkey;
+  };
+
+  ~VerbsChannel(){
+    if(qp_){
+      ibv_destroy_qp(qp_);
+    }
+    if(cq_){
+      ibv_destroy_cq(cq_);
+    }
+    if(compChannel_){
+      ibv_destroy_comp_channel(compChannel_);
+    }
+    if(sendMR_){
+      ibv_dereg_mr(sendMR_);
+    }
+    if(receiveMR_){
+      ibv_dereg_mr(receiveMR_);
+    }
+    for(auto& itr : zeroCopyRegions_){
+      ibv_dereg_mr(itr.mr);
+    }
+    free(sendSlots_);
+    free(receiveSlots_);
+  }
+
+  // sets up a queue pair with the peer on the other end of the connected
+  // socket fd, channel is null if either end has no adapter, in which
+  // case the socket is kept as it is, false if the handshake failed, in
+  // which case it is closed
+  static bool connect(int fd, Channel*& channel){
+    return handshake_(fd, true, channel);
+  }
+
+  static bool accept(int fd, Channel*& channel){
+    return handshake_(fd, false, channel);
+  }
+
+  ssize_t write(const iovec* iov, int n) override{
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_();
+
+    if(failed_){
+      errno = EPIPE;
+      return -1;
+    }
+
+    // the last credit is kept for giving credits back
+    if(sendCredits_ <= 1 || freeSendSlots_.empty()){
+      errno = EAGAIN;
+      return -1;
+    }
+
+    uint32_t slot = freeSendSlots_.back();
+    freeSendSlots_.pop_back();
+
+    char* buf = sendSlots_ + size_t(slot) * SLOT_SIZE;
+    size_t size = 0;
+    for(int i = 0; i < n && size < SLOT_SIZE; ++i){
+      size_t m = std::min(iov[i].iov_len, SLOT_SIZE - size);
+      memcpy(buf + size, iov[i].iov_base, m);
+      size += m;
+    }
+
+    if(!postSend_(buf, size, sendMR_->lkey, SEND_SLOT | slot)){
+      freeSendSlots_.push_back(slot);
+      errno = EPIPE;
+      return -1;
+    }
+
+    return size;
+  }
+
+  // a large piece is sent from where it is, registering the memory that
+  // holds it, so that only the receiver copies
+  ssize_t writeZeroCopy(const iovec* iov, int n) override{
+    if(iov[0].iov_len < ZERO_COPY_SIZE){
+      return write(iov, n);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    progress_();
+
+    if(failed_){
+      errno = EPIPE;
+      return -1;
+    }
+
+    if(sendCredits_ <= 1){
+      errno = EAGAIN;
+      return -1;
+    }
+
+    char* buf = static_cast<char*>(iov[0].iov_base);
+    size_t size = std::min(iov[0].iov_len, size_t(SLOT_SIZE));
+
+    ZeroCopyRegion* region = zeroCopyRegion_(buf, iov[0].iov_len);
+    if(!region){
+      lock.unlock();
+      return write(iov, n);
+    }
+
+    if(!postSend_(buf, size, region->mr->lkey, ZERO_COPY)){
+      errno = EPIPE;
+      return -1;
+    }
+
+    ++region->pending;
+    ++zeroCopySent_;
+
+    return size;
+  }
+
+  void poll() override{
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_();
+  }
+
+  bool zeroCopy() const override{
+    return true;
+  }
+
+  uint64_t zeroCopySent() const override{
+    return zeroCopySent_;
+  }
+
+  uint64_t zeroCopyDone() override{
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_();
+    return zeroCopyDone_;
+  }
+
+  ssize_t read(char* buf, size_t size) override{
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_();
+
+    if(received_.empty()){
+      if(failed_){
+        return 0;
+      }
+      errno = EAGAIN;
+      return -1;
+    }
+
+    Received& r = received_.front();
+    size = std::min(size, size_t(r.size - r.offset));
+    memcpy(buf, receiveSlots_ + size_t(r.slot) * SLOT_SIZE + r.offset, size);
+    r.offset += size;
+
+    if(r.offset == r.size){
+      postReceive_(r.slot);
+      received_.pop_front();
+      ++returnCredits_;
+      giveBackCredits_();
+    }
+
+    return size;
+  }
+
+  // writes size bytes of buf, which has to lie in memory registered with
+  // the device, to the peer's memory at remote, returning once done
+  bool put(const void* buf, size_t size, const RemoteMemory& remote){
+    return oneSided_(IBV_WR_RDMA_WRITE, const_cast<void*>(buf), size, remote);
+  }
+
+  bool get(void* buf, size_t size, const RemoteMemory& remote){
+    return oneSided_(IBV_WR_RDMA_READ, buf, size, remote);
+  }
+
+private:
+  static const size_t SLOT_SIZE = 64 * 1024;
+  static const uint32_t NUM_SLOTS = 64;
+  static const size_t ZERO_COPY_SIZE = 16 * 1024;
+  static const uint32_t MAGIC = 0x41524556;
+
+  // the kinds of work requests, in the top bits of their ids
+  static const uint64_t SEND_SLOT = 1ull << 60;
+  static const uint64_t RECEIVE_SLOT = 2ull << 60;
+  static const uint64_t ZERO_COPY = 3ull << 60;
+  static const uint64_t ONE_SIDED = 4ull << 60;
+  static const uint64_t CREDITS = 5ull << 60;
+  static const uint64_t KIND_MASK = 0xfull << 60;
+
+  struct Hello{
+    uint32_t magic;
+    uint32_t ok;
+    uint32_t qpn;
+    uint32_t psn;
+    uint16_t lid;
+    uint8_t gid[16];
+  };
+
+  struct Received{
+    uint32_t slot;
+    uint32_t size;
+    uint32_t offset;
+  };
+
+  // what is left of a message body from the first send made from it,
+  // deregistered as soon as none of its sends are pending, since the
+  // dispatcher may free it from then on
+  struct ZeroCopyRegion{
+    ibv_mr* mr;
+    uint32_t pending;
+  };
+
+  VerbsChannel(int compFD)
+  : Channel(compFD){}
+
+  static bool handshake_(int fd, bool connector, Channel*& channel){
+    channel = nullptr;
+
+    VerbsChannel* c = nullptr;
+    VerbsDevice* device = VerbsDevice::get();
+    if(device){
+      c = create_(device);
+    }
+
+    Hello local = {};
+    local.magic = MAGIC;
+    if(c){
+      local.ok = 1;
+      local.qpn = c->qp_->qp_num;
+      local.psn = c->psn_;
+      local.lid = device->portAttr().lid;
+      memcpy(local.gid, device->gid().raw, 16);
+    }
+
+    // the connector speaks first
+    Hello remote;
+    bool ok = connector ?
+      writeFully_(fd, &local, sizeof(local)) &&
+      readFully_(fd, &remote, sizeof(remote)) :
+      readFully_(fd, &remote, sizeof(remote)) &&
+      writeFully_(fd, &local, sizeof(local));
+
+    ok = ok && remote.magic == MAGIC;
+
+    if(!ok){
+      delete c;
+      ::close(fd);
+      return false;
+    }
+
+    if(!c || !remote.ok){
+      delete c;
+      return true;
+    }
+
+    // each end tells the other once its queue pair can receive
+    uint8_t ready = c->connect_(device, remote) ? 1 : 0;
+    uint8_t peerReady = 0;
+    ok = writeFully_(fd, &ready, 1) && readFully_(fd, &peerReady, 1);
+
+    if(!ok){
+      delete c;
+      ::close(fd);
+      return false;
+    }
+
+    if(!ready || !peerReady){
+      delete c;
+      return true;
+    }
+
+    // the queue pair carries everything from here on
+    ::close(fd);
+    channel = c;
+    return true;
+  }
+
+  static VerbsChannel* create_(VerbsDevice* device){
+    ibv_comp_channel* compChannel = ibv_create_comp_channel(device->context());
+    if(!compChannel){
+      return nullptr;
+    }
+
+    auto c = new VerbsChannel(compChannel->fd);
+    c->device_ = device;
+    c->compChannel_ = compChannel;
+
+    c->cq_ = ibv_create_cq(device->context(), CQ_SIZE, nullptr,
+                           compChannel, 0);
+    if(!c->cq_){
+      delete c;
+      return nullptr;
+    }
+
+    ibv_qp_init_attr init = {};
+    init.send_cq = c->cq_;
+    init.recv_cq = c->cq_;
+    init.qp_type = IBV_QPT_RC;
+    init.cap.max_send_wr = MAX_SENDS;
+    init.cap.max_recv_wr = NUM_SLOTS;
+    init.cap.max_send_sge = 1;
+    init.cap.max_recv_sge = 1;
+
+    c->qp_ = ibv_create_qp(device->pd(), &init);
+    if(!c->qp_){
+      delete c;
+      return nullptr;
+    }
+
+    size_t bytes = SLOT_SIZE * NUM_SLOTS;
+    if(posix_memalign((void**)&c->sendSlots_, 4096, bytes) != 0 ||
+       posix_memalign((void**)&c->receiveSlots_, 4096, bytes) != 0){
+      delete c;
+      return nullptr;
+    }
+
+    c->sendMR_ = ibv_reg_mr(device->pd(), c->sendSlots_, bytes,
+                            IBV_ACCESS_LOCAL_WRITE);
+    c->receiveMR_ = ibv_reg_mr(device->pd(), c->receiveSlots_, bytes,
+                               IBV_ACCESS_LOCAL_WRITE);
+    if(!c->sendMR_ || !c->receiveMR_){
+      delete c;
+      return nullptr;
+    }
+
+    for(uint32_t i = 0; i < NUM_SLOTS; ++i){
+      c->freeSendSlots_.push_back(i);
+    }
+
+    c->psn_ = lrand48() & 0xffffff;
+
+    return c;
+  }
+
+  bool connect_(VerbsDevice* device, const Hello& remote){
+    ibv_qp_attr attr = {};
+    attr.qp_state = IBV_QPS_INIT;
+    attr.pkey_index = 0;
+    attr.port_num = device->port();
+    attr.qp_access_flags = IBV_ACCESS_LOCAL_WRITE |
+      IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ;
+
+    if(ibv_modify_qp(qp_, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+                     IBV_QP_PORT | IBV_QP_ACCESS_FLAGS) != 0){
+      return false;
+    }
+
+    // the receives have to be there before the peer's first send
+    for(uint32_t i = 0; i < NUM_SLOTS; ++i){
+      if(!postReceive_(i)){
+        return false;
+      }
+    }
+
+    attr = {};
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = device->portAttr().active_mtu;
+    attr.dest_qp_num = remote.qpn;
+    attr.rq_psn = remote.psn;
+    attr.max_dest_rd_atomic = 16;
+    attr.min_rnr_timer = 12;
+    attr.ah_attr.dlid = remote.lid;
+    attr.ah_attr.port_num = device->port();
+
+    // RoCE is addressed by GID
+    if(device->portAttr().link_layer == IBV_LINK_LAYER_ETHERNET){
+      attr.ah_attr.is_global = 1;
+      memcpy(attr.ah_attr.grh.dgid.raw, remote.gid, 16);
+      attr.ah_attr.grh.sgid_index = device->gidIndex();
+      attr.ah_attr.grh.hop_limit = 64;
+    }
+
+    if(ibv_modify_qp(qp_, &attr, IBV_QP_STATE | IBV_QP_AV |
+                     IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+                     IBV_QP_MAX_DEST_RD_ATOMIC | 
+                     IBV_QP_MIN_RNR_TIMER) != 0){
+      return false;
+    }
+
+    attr = {};
+    attr.qp_state = IBV_QPS_RTS;
+    attr.timeout = 14;
+    attr.retry_cnt = 7;
+    attr.rnr_retry = 7;
+    attr.sq_psn = psn_;
+    attr.max_rd_atomic = 16;
+
+    if(ibv_modify_qp(qp_, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT |
+                     IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN |
+                     IBV_QP_MAX_QP_RD_ATOMIC) != 0){
+      return false;
+    }
+
+    return ibv_req_notify_cq(cq_, 0) == 0;
+  }
+
+  bool postReceive_(uint32_t slot){
+    ibv_sge sge;
+    sge.addr = uintptr_t(receiveSlots_ + size_t(slot) * SLOT_SIZE);
+    sge.length = SLOT_SIZE;
+    sge.lkey = receiveMR_->lkey;
+
+    ibv_recv_wr wr = {};
+    wr.wr_id = RECEIVE_SLOT | slot;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+
+    ibv_recv_wr* bad;
+    return ibv_post_recv(qp_, &wr, &bad) == 0;
+  }
+
+  // takes a credit and gives back those of the receives posted since
+  bool postSend_(void* buf, size_t size, uint32_t lkey, uint64_t id){
+    ibv_sge sge;
+    sge.addr = uintptr_t(buf);
+    sge.length = size;
+    sge.lkey = lkey;
+
+    ibv_send_wr wr = {};
+    wr.wr_id = id;
+    wr.sg_list = &sge;
+    wr.num_sge = size > 0 ? 1 : 0;
+    wr.opcode = IBV_WR_SEND_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl(returnCredits_);
+
+    ibv_send_wr* bad;
+    if(ibv_post_send(qp_, &wr, &bad) != 0){
+      return false;
+    }
+
+    --sendCredits_;
+    returnCredits_ = 0;
+    return true;
+  }
+
+  // without sends of its own to carry them, credits go back in an empty
+  // one once half of the slots are waiting for them
+  void giveBackCredits_(){
+    if(returnCredits_ >= NUM_SLOTS / 2 && sendCredits_ > 0){
+      postSend_(nullptr, 0, 0, CREDITS);
+    }
+  }
+
+  // consumes the events of the completion channel, rearms it and then
+  // handles all of the completions
+  void progress_(){
+    ibv_cq* cq;
+    void* context;
+    unsigned events = 0;
+    while(ibv_get_cq_event(compChannel_, &cq, &context) == 0){
+      ++events;
+    }
+    if(events > 0){
+      ibv_ack_cq_events(cq_, events);
+    }
+
+    ibv_req_notify_cq(cq_, 0);
+
+    ibv_wc wcs[32];
+    int n;
+    while((n = ibv_poll_cq(cq_, 32, wcs)) > 0){
+      for(int i = 0; i < n; ++i){
+        complete_(wcs[i]);
+      }
+    }
+  }
+
+  void complete_(const ibv_wc& wc){
+    if(wc.status != IBV_WC_SUCCESS){
+      failed_ = true;
+      if((wc.wr_id & KIND_MASK) == ONE_SIDED){
+        oneSidedDone_ = true;
+        oneSidedCond_.notify_all();
+      }
+      return;
+    }
+
+    uint64_t kind = wc.wr_id & KIND_MASK;
+
+    if(kind == RECEIVE_SLOT){
+      uint32_t slot = wc.wr_id & ~KIND_MASK;
+
+      if(wc.wc_flags & IBV_WC_WITH_IMM){
+        sendCredits_ += ntohl(wc.imm_data);
+      }
+
+      if(wc.byte_len > 0){
+        received_.push_back({slot, wc.byte_len, 0});
+      }
+      else{
+        postReceive_(slot);
+        ++returnCredits_;
+      }
+
+      // the credits just received may be what an empty send was waiting
+      // for
+      giveBackCredits_();
+    }
+    else if(kind == SEND_SLOT){
+      freeSendSlots_.push_back(uint32_t(wc.wr_id & ~KIND_MASK));
+    }
+    else if(kind == ZERO_COPY){
+      // sends complete in the order they were posted
+      ZeroCopyRegion& r = zeroCopyRegions_.front();
+      --r.pending;
+      ++zeroCopyDone_;
+      releaseZeroCopyRegions_();
+    }
+    else if(kind == ONE_SIDED){
+      oneSidedDone_ = true;
+      oneSidedCond_.notify_all();
+    }
+  }
+
+  ZeroCopyRegion* zeroCopyRegion_(char* buf, size_t size){
+    releaseZeroCopyRegions_();
+
+    if(!zeroCopyRegions_.empty()){
+      ZeroCopyRegion& r = zeroCopyRegions_.back();
+      char* start = static_cast<char*>(r.mr->addr);
+      if(buf >= start && buf + size <= start + r.mr->length){
+        return &r;
+      }
+    }
+
+    ibv_mr* mr = ibv_reg_mr(device_->pd(), buf, size, 0);
+    if(!mr){
+      return nullptr;
+    }
+
+    zeroCopyRegions_.push_back({mr, 0});
+    return &zeroCopyRegions_.back();
+  }
+
+  void releaseZeroCopyRegions_(){
+    while(!zeroCopyRegions_.empty() && 
+          zeroCopyRegions_.front().pending == 0){
+      ibv_dereg_mr(zeroCopyRegions_.front().mr);
+      zeroCopyRegions_.pop_front();
+    }
+  }
+
+  bool oneSided_(ibv_wr_opcode opcode, void* buf, size_t size,
+                 const RemoteMemory& remote){
+    ibv_mr* mr = device_->findMemory(buf, size);
+    if(!mr){
+      return false;
+    }
+
+    // one at a time, each one waits for its completion
+    std::lock_guard<std::mutex> oneSidedLock(oneSidedMutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    ibv_sge sge;
+    sge.addr = uintptr_t(buf);
+    sge.length = size;
+    sge.lkey = mr->lkey;
+
+    ibv_send_wr wr = {};
+    wr.wr_id = ONE_SIDED;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = opcode;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = remote.addr;
+    wr.wr.rdma.rkey = remote.rkey;
+
+    oneSidedDone_ = false;
+
+    ibv_send_wr* bad;
+    if(failed_ || ibv_post_send(qp_, &wr, &bad) != 0){
+      return false;
+    }
+
+    // only the engine takes the completions, which may include receives
+    // that it has to pass on
+    oneSidedCond_.wait(lock, [&]{
+      return oneSidedDone_;
+    });
+
+    return !failed_;
+  }
+
+  static bool writeFully_(int fd, const void* buf, size_t size){
+    auto p = static_cast<const char*>(buf);
+    while(size > 0){
+      ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+      if(n < 0 && errno == EINTR){
+        continue;
+      }
+      if(n <= 0){
+        return false;
+      }
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  static bool readFully_(int fd, void* buf, size_t size){
+    auto p = static_cast<char*>(buf);
+    while(size > 0){
+      ssize_t n = ::recv(fd, p, size, 0);
+      if(n < 0 && errno == EINTR){
+        continue;
+      }
+      if(n <= 0){
+        return false;
+      }
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  static const int CQ_SIZE = 512;
+  static const uint32_t MAX_SENDS = 256;
+
+  VerbsDevice* device_ = nullptr;
+  ibv_comp_channel* compChannel_ = nullptr;
+  ibv_cq* cq_ = nullptr;
+  ibv_qp* qp_ = nullptr;
+  uint32_t psn_ = 0;
+
+  std::mutex mutex_;
+  bool failed_ = false;
+
+  char* sendSlots_ = nullptr;
+  char* receiveSlots_ = nullptr;
+  ibv_mr* sendMR_ = nullptr;
+  ibv_mr* receiveMR_ = nullptr;
+  std::vector<uint32_t> freeSendSlots_;
+  std::deque<Received> received_;
+
+  // the peer has a receive posted for each of these
+  uint32_t sendCredits_ = NUM_SLOTS;
+  uint32_t returnCredits_ = 0;
+
+  std::deque<ZeroCopyRegion> zeroCopyRegions_;
+  uint64_t zeroCopySent_ = 0;
+  uint64_t zeroCopyDone_ = 0;
+
+  std::mutex oneSidedMutex_;
+  std::condition_variable oneSidedCond_;
+  bool oneSidedDone_ = false;
+};
+
+} // namespace ares
+
+#endif // __ARES_VERBS_CHANNEL_H__
@@ -64,323 +64,3516 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <poll.h>
 #include <errno.h>
 #include <unistd.h>
 #include <strings.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #include "CVSemaphore.h"
+#include "Bootstrap.h"
+#include "BufferPool.h"
+#include "Channel.h"
+#include "Compression.h"
+#include "Futex.h"
+#include "RegionProfile.h"
+#include "Trace.h"
+#include "ProgressEngine.h"
+
+#ifdef ARES_HAVE_IBVERBS
+#include "VerbsChannel.h"
+#endif
 
 namespace ares{
 
-class Channel{
-public:
-  virtual ~Channel(){}
-
-  virtual void send(char* buf, size_t size) = 0;
+// runs a ready task on the calling worker, returning 1, 0 if there is
+// none, or -1 if the thread is not a worker, installed by the runtime
+// once its pool has started
+inline std::atomic<int (*)()>& commHelper(){
+  static std::atomic<int (*)()> helper{nullptr};
+  return helper;
+}
+
+// one turn of a wait on cond under lock, which the caller repeats until
+// its condition holds. A worker runs another task with the lock released,
+// or with none ready waits briefly, so its core is not idle while a
+// message is in flight, any other thread blocks as before.
+inline void waitOrRun(std::unique_lock<std::mutex>& lock,
+                      std::condition_variable& cond){
+  int (*helper)() = commHelper().load(std::memory_order_acquire);
+  int ran = -1;
+
+  if(helper){
+    lock.unlock();
+    ran = helper();
+    lock.lock();
+  }
 
-  virtual void receive(char* buf, size_t size) = 0;
-};
+  if(ran < 0){
+    cond.wait(lock);
+  }
+  else if(ran == 0){
+    cond.wait_for(lock, std::chrono::microseconds(100));
+  }
+}
 
 class SocketChannel : public Channel{
 public:
   SocketChannel(int fd)
-  : fd_(fd){}
+  : Channel(fd){
+    // messages are written whole, so waiting to coalesce them only
+    // delays small ones such as barriers
+    int on = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+#ifdef SO_ZEROCOPY
+    zeroCopy_ = setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, 
+                           &on, sizeof(on)) == 0;
+#endif
+
+    // the kernel may refuse it without CAP_NET_ADMIN, which only costs
+    // the driver level polling
+#ifdef SO_BUSY_POLL
+    if(int usec = ProgressEngine::busyPoll()){
+      setsockopt(fd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+    }
+#endif
+  }
+
+  ~SocketChannel(){
+    ::close(fd_);
+  }
+
+  ssize_t write(const iovec* iov, int n) override{
+    return sendmsg_(iov, n, 0);
+  }
+
+  ssize_t read(char* buf, size_t size) override{
+    return ::recv(fd_, buf, size, 0);
+  }
+
+  // each sendmsg with MSG_ZEROCOPY is numbered by the kernel, from 0, in
+  // the completions it queues on the socket's error queue
+  ssize_t writeZeroCopy(const iovec* iov, int n) override{
+#ifdef MSG_ZEROCOPY
+    if(zeroCopy_){
+      ssize_t ret = sendmsg_(iov, n, MSG_ZEROCOPY);
+      if(ret >= 0){
+        ++zeroCopySent_;
+      }
+      return ret;
+    }
+#endif
+    return write(iov, n);
+  }
+
+  bool zeroCopy() const override{
+    return zeroCopy_;
+  }
+
+  bool compress() const override{
+    return true;
+  }
 
-  void send(char* buf, size_t size) override{
-    ::send(fd_, buf, size, 0);
+  uint64_t zeroCopySent() const override{
+    return zeroCopySent_;
   }
 
-  void receive(char* buf, size_t size) override{
-    ::recv(fd_, buf, size, 0);
+  uint64_t zeroCopyDone() override{
+#ifdef MSG_ZEROCOPY
+    for(;;){
+      char control[128];
+      msghdr msg = {};
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      if(::recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0){
+        break;
+      }
+
+      for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)){
+        auto err = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cm));
+        if(err->ee_errno == 0 && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY){
+          // ee_data is the last of the range of calls completed
+          zeroCopyDone_ = std::max(zeroCopyDone_, uint64_t(err->ee_data) + 1);
+        }
+      }
+    }
+#endif
+    return zeroCopyDone_;
   }
 
 private:
-  int fd_;
+  ssize_t sendmsg_(const iovec* iov, int n, int flags){
+    msghdr msg = {};
+    msg.msg_iov = const_cast<iovec*>(iov);
+    msg.msg_iovlen = n;
+    return ::sendmsg(fd_, &msg, flags | MSG_NOSIGNAL);
+  }
+
+  bool zeroCopy_ = false;
+  uint64_t zeroCopySent_ = 0;
+  uint64_t zeroCopyDone_ = 0;
 };
 
+// a named pipe between processes on the same host. Large owned buffers
+// are written with vmsplice(), which has the pipe refer to their pages
+// rather than copy them, so the reader's read() is the only copy made.
 class FIFOChannel : public Channel{
 public:
   FIFOChannel(int fd)
-  : fd_(fd){}
+  : Channel(fd){
+#ifdef F_SETPIPE_SZ
+    // the kernel caps what an unprivileged process may ask for at
+    // fs.pipe-max-size, the pipe otherwise keeps the size it has
+    if(int size = pipeSize_()){
+      fcntl(fd_, F_SETPIPE_SZ, size);
+    }
+#endif
+  }
 
   ~FIFOChannel(){
     ::close(fd_);
   }
 
-  void send(char* buf, size_t size) override{
-    ::write(fd_, buf, size);
+  ssize_t write(const iovec* iov, int n) override{
+    ssize_t ret = ::writev(fd_, iov, n);
+    if(ret > 0){
+      written_ += ret;
+    }
+    return ret;
+  }
+
+  ssize_t read(char* buf, size_t size) override{
+    return ::read(fd_, buf, size);
+  }
+
+#ifdef SPLICE_F_GIFT
+  // runs of pieces that are whole pages are gifted to the kernel, which
+  // buffers that will be freed rather than reused may be
+  ssize_t writeZeroCopy(const iovec* iov, int n) override{
+    ssize_t total = 0;
+
+    for(int i = 0; i < n;){
+      bool gift = wholePages_(iov[i]);
+      size_t size = iov[i].iov_len;
+      int j = i + 1;
+      while(j < n && wholePages_(iov[j]) == gift){
+        size += iov[j].iov_len;
+        ++j;
+      }
+
+      ssize_t ret = ::vmsplice(fd_, iov + i, j - i,
+                               SPLICE_F_NONBLOCK | (gift ? SPLICE_F_GIFT : 0));
+      if(ret < 0){
+        if(total == 0){
+          return -1;
+        }
+        break;
+      }
+
+      total += ret;
+      if(size_t(ret) < size){
+        break;
+      }
+      i = j;
+    }
+
+    written_ += total;
+    zeroCopyEnds_.push_back(written_);
+    ++zeroCopySent_;
+
+    return total;
+  }
+
+  bool zeroCopy() const override{
+    return true;
+  }
+
+  uint64_t zeroCopySent() const override{
+    return zeroCopySent_;
+  }
+
+  // the pages of a write are the caller's again once the reader has
+  // read past them, which is what has been written less what is still
+  // in the pipe
+  uint64_t zeroCopyDone() override{
+    int unread;
+    if(zeroCopyEnds_.empty() || ioctl(fd_, FIONREAD, &unread) < 0){
+      return zeroCopyDone_;
+    }
+
+    uint64_t taken = written_ - uint64_t(unread);
+    while(!zeroCopyEnds_.empty() && zeroCopyEnds_.front() <= taken){
+      zeroCopyEnds_.pop_front();
+      ++zeroCopyDone_;
+    }
+
+    return zeroCopyDone_;
+  }
+
+  // SPLICE_F_NONBLOCK only covers the pipe, a blocking fd blocks the
+  // engine until it has taken the bytes
+  ssize_t spliceTo(int fd, size_t size) override{
+    return ::splice(fd_, nullptr, fd, nullptr, size,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  }
+
+  bool canSplice() const override{
+    return true;
+  }
+#endif
+
+private:
+  // ARES_PIPE_SIZE is the bytes that each pipe is asked to hold, 1 MB
+  // by default, 0 to leave it as the kernel made it
+  static int pipeSize_(){
+    static int size = []{
+      const char* s = getenv("ARES_PIPE_SIZE");
+      return s ? atoi(s) : 1 << 20;
+    }();
+    return size;
+  }
+
+  static bool wholePages_(const iovec& iov){
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    return (uintptr_t(iov.iov_base) | iov.iov_len) % pageSize == 0;
+  }
+
+  // the bytes written to the pipe, and where each zero copy write that
+  // the reader has yet to read past ends in them
+  uint64_t written_ = 0;
+  std::deque<uint64_t> zeroCopyEnds_;
+  uint64_t zeroCopySent_ = 0;
+  uint64_t zeroCopyDone_ = 0;
+};
+
+// a connection between processes on the same host, through a pair of
+// single producer, single consumer rings in shared memory, the socket
+// that was connected first only carries a byte when one end waits for
+// the other, so that the progress engine sees it as ready
+class ShmChannel : public Channel{
+public:
+  ShmChannel(int fd, char* segment, size_t segmentSize, 
+             size_t capacity, bool connector)
+  : Channel(fd),
+  segment_(segment),
+  segmentSize_(segmentSize),
+  capacity_(capacity){
+    int on = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    Ring* rings = reinterpret_cast<Ring*>(segment_);
+    char* data = segment_ + 2 * sizeof(Ring);
+
+    // the connector writes the first ring
+    int out = connector ? 0 : 1;
+    out_ = &rings[out];
+    outData_ = data + out * capacity_;
+    in_ = &rings[1 - out];
+    inData_ = data + (1 - out) * capacity_;
+  }
+
+  ~ShmChannel(){
+    munmap(segment_, segmentSize_);
+    ::close(fd_);
+  }
+
+  ssize_t write(const iovec* iov, int n) override{
+    drain_();
+
+    uint64_t head = out_->head.load(std::memory_order_relaxed);
+    size_t room = capacity_ - (head - out_->tail.load());
+
+    if(room == 0){
+      // checked again after announcing it, or the reader may have just
+      // made room without ringing
+      out_->writerWaiting.store(1);
+      room = capacity_ - (head - out_->tail.load());
+      if(room == 0){
+        errno = EAGAIN;
+        return -1;
+      }
+      out_->writerWaiting.store(0);
+    }
+
+    size_t written = 0;
+    for(int i = 0; i < n && written < room; ++i){
+      size_t size = std::min(iov[i].iov_len, room - written);
+      copyIn_(head + written, static_cast<const char*>(iov[i].iov_base), size);
+      written += size;
+    }
+
+    out_->head.store(head + written);
+
+    if(out_->readerWaiting.exchange(0)){
+      ring_();
+    }
+
+    return written;
+  }
+
+  ssize_t read(char* buf, size_t size) override{
+    drain_();
+
+    uint64_t tail = in_->tail.load(std::memory_order_relaxed);
+    size_t available = in_->head.load() - tail;
+
+    // a busy polling reader finds the data without being rung
+    if(available == 0 && ProgressEngine::busyPoll()){
+      if(closed_){
+        return 0;
+      }
+      errno = EAGAIN;
+      return -1;
+    }
+
+    if(available == 0){
+      in_->readerWaiting.store(1);
+      available = in_->head.load() - tail;
+      if(available == 0){
+        if(closed_){
+          return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+      }
+      in_->readerWaiting.store(0);
+    }
+
+    size = std::min(size, available);
+    copyOut_(tail, buf, size);
+
+    in_->tail.store(tail + size);
+
+    if(in_->writerWaiting.exchange(0)){
+      ring_();
+    }
+
+    return size;
+  }
+
+  bool pending() const override{
+    return in_->head.load(std::memory_order_acquire) != 
+      in_->tail.load(std::memory_order_relaxed);
+  }
+
+  // offers the peer on the other end of the connected socket fd a
+  // segment, channel is one over it if the peer is on the same host and
+  // could map it and null if not, false if the handshake failed, in
+  // which case the socket is closed
+  static bool connect(int fd, Channel*& channel){
+    static std::atomic<int> counter(0);
+
+    channel = nullptr;
+
+    Hello hello = {};
+    hello.magic = MAGIC;
+    hello.capacity = ringCapacity_();
+    bootId_(hello.bootId);
+    snprintf(hello.name, sizeof(hello.name), "/ares-%d-%d", 
+             int(getpid()), counter++);
+
+    size_t size = segmentBytes_(hello.capacity);
+    char* segment = nullptr;
+
+    int shmFD = enabled_() ? 
+      shm_open(hello.name, O_RDWR | O_CREAT | O_EXCL, 0600) : -1;
+    if(shmFD >= 0){
+      if(ftruncate(shmFD, size) == 0){
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, 
+                       MAP_SHARED, shmFD, 0);
+        if(p != MAP_FAILED){
+          segment = static_cast<char*>(p);
+          new (segment) Ring[2];
+        }
+      }
+      close(shmFD);
+    }
+
+    if(!segment){
+      hello.name[0] = '\0';
+    }
+
+    uint8_t answer = 0;
+    bool ok = writeFully_(fd, &hello, sizeof(hello)) && 
+      readFully_(fd, &answer, 1);
+
+    // the peer has mapped it by now, if it was going to
+    if(segment){
+      shm_unlink(hello.name);
+
+      if(ok && answer == 1){
+        channel = new ShmChannel(fd, segment, size, hello.capacity, true);
+        return true;
+      }
+
+      munmap(segment, size);
+    }
+
+    if(!ok){
+      ::close(fd);
+    }
+
+    return ok;
   }
 
-  void receive(char* buf, size_t size) override{
-    ::read(fd_, buf, size);
+  // the other end of connect()
+  static bool accept(int fd, Channel*& channel){
+    channel = nullptr;
+
+    Hello hello;
+    if(!readFully_(fd, &hello, sizeof(hello)) || hello.magic != MAGIC){
+      ::close(fd);
+      return false;
+    }
+
+    char bootId[sizeof(hello.bootId)] = {};
+    bootId_(bootId);
+
+    char* segment = nullptr;
+    size_t size = segmentBytes_(hello.capacity);
+
+    bool valid = hello.capacity >= 4096 && 
+      (hello.capacity & (hello.capacity - 1)) == 0;
+
+    if(hello.name[0] && valid && enabled_() &&
+       strncmp(bootId, hello.bootId, sizeof(bootId)) == 0){
+      int shmFD = shm_open(hello.name, O_RDWR, 0600);
+      if(shmFD >= 0){
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, 
+                       MAP_SHARED, shmFD, 0);
+        if(p != MAP_FAILED){
+          segment = static_cast<char*>(p);
+        }
+        close(shmFD);
+      }
+    }
+
+    uint8_t answer = segment ? 1 : 0;
+    bool ok = writeFully_(fd, &answer, 1);
+
+    if(!ok){
+      if(segment){
+        munmap(segment, size);
+      }
+      ::close(fd);
+      return false;
+    }
+
+    if(segment){
+      channel = new ShmChannel(fd, segment, size, hello.capacity, false);
+    }
+
+    return true;
   }
 
 private:
-  int fd_;
+  static const uint32_t MAGIC = 0x41524553;
+
+
+  // shared by the two processes, each counter is only written by one
+  struct Ring{
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    alignas(64) std::atomic<uint32_t> readerWaiting{0};
+    std::atomic<uint32_t> writerWaiting{0};
+  };
+
+  struct Hello{
+    uint32_t magic;
+    uint32_t capacity;
+    char bootId[40];
+    char name[64];
+  };
+
+  // ARES_SHM=0 keeps local peers on TCP
+  static bool enabled_(){
+    const char* s = getenv("ARES_SHM");
+    return !s || atoi(s) != 0;
+  }
+
+  // the bytes of each ring, ARES_SHM_SIZE rounded up to a power of two
+  static uint32_t ringCapacity_(){
+    size_t size = 4 << 20;
+    if(const char* s = getenv("ARES_SHM_SIZE")){
+      size = std::max(size_t(atoll(s)), size_t(4096));
+    }
+
+    uint32_t capacity = 4096;
+    while(capacity < size && capacity < (1u << 30)){
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  static size_t segmentBytes_(size_t capacity){
+    return 2 * sizeof(Ring) + 2 * capacity;
+  }
+
+  // the same on processes of the same kernel
+  static void bootId_(char* id){
+    if(FILE* f = fopen("/proc/sys/kernel/random/boot_id", "r")){
+      size_t n = fread(id, 1, 36, f);
+      id[n] = '\0';
+      fclose(f);
+    }
+  }
+
+  // the handshake happens before the socket is made non-blocking
+  static bool writeFully_(int fd, const void* buf, size_t size){
+    auto p = static_cast<const char*>(buf);
+    while(size > 0){
+      ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+      if(n < 0 && errno == EINTR){
+        continue;
+      }
+      if(n <= 0){
+        return false;
+      }
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  static bool readFully_(int fd, void* buf, size_t size){
+    auto p = static_cast<char*>(buf);
+    while(size > 0){
+      ssize_t n = ::recv(fd, p, size, 0);
+      if(n < 0 && errno == EINTR){
+        continue;
+      }
+      if(n <= 0){
+        return false;
+      }
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+
+  void copyIn_(uint64_t pos, const char* buf, size_t size){
+    size_t offset = pos & (capacity_ - 1);
+    size_t first = std::min(size, capacity_ - offset);
+    memcpy(outData_ + offset, buf, first);
+    memcpy(outData_, buf + first, size - first);
+  }
+
+  void copyOut_(uint64_t pos, char* buf, size_t size){
+    size_t offset = pos & (capacity_ - 1);
+    size_t first = std::min(size, capacity_ - offset);
+    memcpy(buf, inData_ + offset, first);
+    memcpy(buf + first, inData_, size - first);
+  }
+
+  // a full socket buffer already wakes the peer
+  void ring_(){
+    char b = 0;
+    ::send(fd_, &b, 1, MSG_NOSIGNAL);
+  }
+
+  void drain_(){
+    char buf[64];
+    for(;;){
+      ssize_t n = ::recv(fd_, buf, sizeof(buf), 0);
+      if(n > 0){
+        continue;
+      }
+      if(n == 0){
+        closed_ = true;
+      }
+      else if(errno == EINTR){
+        continue;
+      }
+      return;
+    }
+  }
+
+  char* segment_;
+  size_t segmentSize_;
+  size_t capacity_;
+  Ring* out_;
+  char* outData_;
+  Ring* in_;
+  char* inData_;
+  bool closed_ = false;
 };
 
 enum class MessageType : uint8_t{
   None,
   Raw,
-  Barrier
-};
-
-class BarrierMessage{
-public:
-  static const MessageType type = MessageType::Barrier;
+  Barrier,
+  Stream,
+  Rank,
+  RemoteWrite,
+  RemoteRead,
+  RemoteDone,
+  Active,
+  Striped,
+  StripeChunk,
+  Credit,
+  ReadyToSend,
+  ReadyToReceive,
+  Rendezvous
 };
 
-class MessageBuffer{
+// the body of a stream message, handed to the receiver as soon as its
+// header has arrived and filled in fixed size chunks by the dispatcher,
+// which stops reading the connection while the receiver has not yet
+// taken the chunks it filled, so a message of any size is received in
+// bounded memory
+class MessageStream{
 public:
-  template<class M>
-  MessageBuffer(const M& msg, bool owned)
-  : type_(M::type), 
-  size_(sizeof(M)), 
-  owned_(owned){
-    buf_ = (char*)malloc(sizeof(M));
-    memcpy(buf_, &msg, sizeof(M));
+  static const size_t CHUNK_SIZE = 1 << 20;
+  static const size_t NUM_CHUNKS = 4;
+
+  // resume is called by the receiver once it frees a chunk that the
+  // dispatcher was waiting for
+  MessageStream(uint64_t size, std::function<void()> resume)
+  : size_(size),
+  resume_(std::move(resume)),
+  remaining_(size){
+    size_t n = std::min<uint64_t>(size, uint64_t(CHUNK_SIZE));
+    for(size_t i = 0; i < NUM_CHUNKS; ++i){
+      chunks_[i].data = n > 0 ? (char*)BufferPool::allocate(n) : nullptr;
+      chunks_[i].size = 0;
+    }
   }
 
-  MessageBuffer(char* buf, size_t size, bool owned)
-  : type_(MessageType::Raw), 
-    buf_(buf),
-    size_(size),
-    owned_(owned){}
+  static void* operator new(size_t size){
+    return BufferPool::allocate(size);
+  }
 
-  MessageBuffer(MessageType type, char* buf, size_t size, bool owned)
-  : type_(type), 
-    buf_(buf),
-    size_(size),
-    owned_(owned){}
+  static void operator delete(void* ptr){
+    BufferPool::release(ptr);
+  }
 
-  MessageBuffer(MessageType type, size_t size, bool owned)
-  : type_(type), 
-  size_(size), 
-  owned_(owned){
-    buf_ = (char*)malloc(size);
+  uint64_t size() const{
+    return size_;
   }
 
-  ~MessageBuffer(){
-    if(owned_){
-      free(buf_);
+  // room left in the chunk being filled, or null if all of the chunks
+  // are waiting for the receiver
+  char* space(size_t& size){
+    if(!filling_){
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(free_ == 0){
+        paused_ = true;
+        return nullptr;
+      }
+      --free_;
+      filling_ = true;
+
+      Chunk& chunk = chunks_[filled_ % NUM_CHUNKS];
+      chunk.size = std::min<uint64_t>(remaining_, uint64_t(CHUNK_SIZE));
+      fillOffset_ = 0;
     }
-  }
 
-  template<class T>
-  T* as(){
-    return reinterpret_cast<T*>(buf_);
+    Chunk& chunk = chunks_[filled_ % NUM_CHUNKS];
+    size = chunk.size - fillOffset_;
+    return chunk.data + fillOffset_;
   }
 
-  char* buffer(){
-    return buf_;
+  // records n bytes written to space(), true once the body is complete
+  bool fill(size_t n){
+    Chunk& chunk = chunks_[filled_ % NUM_CHUNKS];
+    fillOffset_ += n;
+    remaining_ -= n;
+
+    if(fillOffset_ == chunk.size){
+      filling_ = false;
+      ++filled_;
+      ready_.release();
+    }
+
+    return remaining_ == 0;
   }
 
-  uint32_t size() const{
-    return size_;
+  // the next chunk, valid until the following call, or null once the
+  // whole body has been read
+  char* next(size_t& size){
+    if(taken_ > 0){
+      bool resume;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++free_;
+        resume = paused_;
+        paused_ = false;
+      }
+
+      if(resume){
+        resume_();
+      }
+    }
+
+    if(offset_ == size_){
+      return nullptr;
+    }
+
+    ready_.acquire();
+
+    Chunk& chunk = chunks_[taken_++ % NUM_CHUNKS];
+    offset_ += chunk.size;
+    size = chunk.size;
+    return chunk.data;
   }
-  
-  MessageType type(){
-    return type_;
+
+  // both the dispatcher and the receiver release the stream
+  void release(){
+    if(refs_.fetch_sub(1) == 1){
+      for(Chunk& chunk : chunks_){
+        BufferPool::release(chunk.data);
+      }
+      delete this;
+    }
   }
 
 private:
-  MessageType type_;
-  char* buf_;
-  uint32_t size_;
-  bool owned_;
+  struct Chunk{
+    char* data;
+    size_t size;
+  };
+
+  uint64_t size_;
+  Chunk chunks_[NUM_CHUNKS];
+  std::function<void()> resume_;
+  std::atomic<int> refs_{2};
+
+  // the dispatcher's side
+  uint64_t remaining_;
+  uint64_t filled_ = 0;
+  size_t fillOffset_ = 0;
+  bool filling_ = false;
+
+  // the receiver's side
+  uint64_t offset_ = 0;
+  uint64_t taken_ = 0;
+  CVSemaphore ready_;
+
+  std::mutex mutex_;
+  size_t free_ = NUM_CHUNKS;
+  bool paused_ = false;
 };
 
-class MessageHandler{
+// a round of the dissemination barrier of the given epoch
+class BarrierMessage{
 public:
-  virtual bool handleMessage(MessageBuffer* msg) = 0;
+  static const MessageType type = MessageType::Barrier;
+
+  uint64_t epoch;
+  uint32_t round;
 };
 
-class MessageDispatcher{
+// the first message on each connection, a peer that does not have a
+// rank yet is assigned one in the reply. A rail above 0 marks one of
+// the extra connections to a peer that large messages are striped over.
+class RankMessage{
 public:
-  MessageDispatcher(MessageHandler* handler,
-                    Channel* sendChannel,
-                    Channel* receiveChannel)
-  : handler_(handler), 
-  sendChannel_(sendChannel),
-  receiveChannel_(receiveChannel){}
+  static const MessageType type = MessageType::Rank;
+
+  int32_t rank;
+  int32_t assigned;
+  int32_t rail = 0;
+  // the bytes of raw messages that the peer may have sent and this one
+  // not yet taken, 0 if it may send any number
+  uint32_t credits = 0;
+};
+
+// returns credits for raw messages that a receive or handler has taken
+class CreditMessage{
+public:
+  static const MessageType type = MessageType::Credit;
+
+  uint64_t bytes;
+};
+
+// sent on the first connection to a peer in place of a message that is
+// striped, where the message takes its place in the order of the others
+class StripeMessage{
+public:
+  static const MessageType type = MessageType::Striped;
+
+  uint64_t size;
+  uint32_t id;
+  uint32_t messageType;
+};
+
+// the start of each chunk of a striped message, which carries the
+// bytes from index * STRIPE_CHUNK, on any of the connections
+struct StripeChunk{
+  uint64_t size;
+  uint32_t id;
+  uint32_t index;
+};
+
+const uint64_t STRIPE_CHUNK = 1 << 19;
+
+// sent in place of a large raw message, which takes its place in the
+// order of the others, the body follows as a message of type Rendezvous
+// tagged with the id once the receiver has replied where it goes
+class ReadyToSendMessage{
+public:
+  static const MessageType type = MessageType::ReadyToSend;
+
+  uint64_t size;
+  uint32_t id;
+};
+
+// the reply to a ReadyToSendMessage once a receive has taken it
+class ReadyToReceiveMessage{
+public:
+  static const MessageType type = MessageType::ReadyToReceive;
+
+  uint32_t id;
+};
+
+// the start of the body of a remote write or read of peers that are not
+// connected over verbs, followed by the data written or read
+struct RemoteOp{
+  uint64_t addr;
+  uint64_t size;
+  uint64_t id;
+};
+
+// the traffic with one peer, counted with relaxed atomics on the path of
+// each message, the latencies are from a message arriving to it being
+// taken by a receive or handler
+class PeerCounters{
+public:
+  // bucket i holds the latencies under 2^i microseconds, the last one
+  // the rest
+  static const size_t LATENCY_BUCKETS = 24;
+
+  // a copy that is not updated
+  struct Snapshot{
+    uint64_t messagesSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t messagesReceived = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t peakQueueDepth = 0;
+    uint64_t latency[LATENCY_BUCKETS] = {};
+
+    void add(const Snapshot& s){
+      messagesSent += s.messagesSent;
+      bytesSent += s.bytesSent;
+      messagesReceived += s.messagesReceived;
+      bytesReceived += s.bytesReceived;
+      peakQueueDepth = std::max(peakQueueDepth, s.peakQueueDepth);
+      for(size_t i = 0; i < LATENCY_BUCKETS; ++i){
+        latency[i] += s.latency[i];
+      }
+    }
+  };
+
+  PeerCounters(){
+    for(auto& l : latency_){
+      l = 0;
+    }
+  }
+
+  void sent(uint64_t bytes){
+    add_(messagesSent_, 1);
+    add_(bytesSent_, bytes);
+  }
+
+  void received(uint64_t bytes){
+    add_(messagesReceived_, 1);
+    add_(bytesReceived_, bytes);
+  }
+
+  // only called under the send queue's lock
+  void queueDepth(uint64_t depth){
+    if(depth > peakQueueDepth_.load(std::memory_order_relaxed)){
+      peakQueueDepth_.store(depth, std::memory_order_relaxed);
+    }
+  }
+
+  void latency(std::chrono::steady_clock::duration d){
+    uint64_t us =
+      std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    size_t i = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    add_(latency_[std::min(i, LATENCY_BUCKETS - 1)], 1);
+  }
+
+  Snapshot snapshot() const{
+    Snapshot s;
+    s.messagesSent = messagesSent_.load(std::memory_order_relaxed);
+    s.bytesSent = bytesSent_.load(std::memory_order_relaxed);
+    s.messagesReceived = messagesReceived_.load(std::memory_order_relaxed);
+    s.bytesReceived = bytesReceived_.load(std::memory_order_relaxed);
+    s.peakQueueDepth = peakQueueDepth_.load(std::memory_order_relaxed);
+    for(size_t i = 0; i < LATENCY_BUCKETS; ++i){
+      s.latency[i] = latency_[i].load(std::memory_order_relaxed);
+    }
+    return s;
+  }
+
+private:
+  static void add_(std::atomic<uint64_t>& counter, uint64_t n){
+    counter.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> messagesSent_{0};
+  std::atomic<uint64_t> bytesSent_{0};
+  std::atomic<uint64_t> messagesReceived_{0};
+  std::atomic<uint64_t> bytesReceived_{0};
+  std::atomic<uint64_t> peakQueueDepth_{0};
+  std::atomic<uint64_t> latency_[LATENCY_BUCKETS];
+};
+
+class MessageBuffer;
+class MessageDispatcher;
+
+// a non-blocking send completes once its buffer has been written out and
+// can be reused, a receive once a matching message has arrived
+class CommRequest{
+public:
+  // a posted receive
+  CommRequest(int rank, uint32_t tag)
+  : rank_(rank),
+  tag_(tag){}
+
+  // a receive posted into size bytes of buf, which a large message is
+  // read into as it arrives
+  CommRequest(int rank, uint32_t tag, char* buf, uint64_t size)
+  : rank_(rank),
+  tag_(tag),
+  buf_(buf),
+  capacity_(size){}
+
+  // a receive posted into fd, which a large message is spliced to as it
+  // arrives on a channel that can
+  CommRequest(int rank, uint32_t tag, int fd)
+  : rank_(rank),
+  tag_(tag),
+  file_(fd){}
+
+  CommRequest(){}
+
+  bool matches(int source, uint32_t tag) const{
+    return tag == tag_ && (rank_ < 0 || rank_ == source);
+  }
+
+  // the buffer of a receive posted into one, null otherwise
+  char* buffer() const{
+    return buf_;
+  }
+
+  uint64_t capacity() const{
+    return capacity_;
+  }
+
+  // the descriptor of a receive posted into one, -1 otherwise
+  int file() const{
+    return file_;
+  }
+
+  bool test(){
+    return done_.load(std::memory_order_acquire);
+  }
+
+  // the received message, if any, spinning for it while the engines busy
+  // poll, the lock is still taken so complete() is done with the request
+  MessageBuffer* wait(){
+    if(ProgressEngine::busyPoll()){
+      uint32_t spins = 0;
+      while(!done_.load(std::memory_order_acquire)){
+        spinWait(spins);
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!done_.load(std::memory_order_relaxed)){
+      waitOrRun(lock, cond_);
+    }
+    return msg_;
+  }
+
+  // called on the thread that completes the request, right away if it
+  // already has
+  void onComplete(std::function<void()> func){
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(!done_){
+      func_ = std::move(func);
+      return;
+    }
+    lock.unlock();
+    func();
+  }
+
+  // the request may be waited for and deleted once the lock is released,
+  // so it is not touched after that
+  void complete(MessageBuffer* msg = nullptr){
+    std::function<void()> func;
+
+    mutex_.lock();
+    msg_ = msg;
+    done_ = true;
+    func.swap(func_);
+    cond_.notify_all();
+    mutex_.unlock();
+
+    if(func){
+      func();
+    }
+  }
+
+private:
+  int rank_ = -1;
+  uint32_t tag_ = 0;
+  char* buf_ = nullptr;
+  uint64_t capacity_ = 0;
+  int file_ = -1;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::atomic<bool> done_{false};
+  MessageBuffer* msg_ = nullptr;
+  std::function<void()> func_;
+};
+
+class MessageBuffer{
+public:
+  // typed messages are small and are kept in the buffer itself
+  template<class M>
+  MessageBuffer(const M& msg, bool owned)
+  : type_(M::type), 
+  buf_(inline_),
+  size_(sizeof(M)), 
+  owned_(false){
+    static_assert(sizeof(M) <= INLINE_SIZE, "message too large");
+    memcpy(buf_, &msg, sizeof(M));
+  }
+
+  MessageBuffer(char* buf, uint64_t size, bool owned)
+  : type_(MessageType::Raw), 
+    buf_(buf),
+    size_(size),
+    owned_(owned){}
+
+  MessageBuffer(MessageType type, char* buf, uint64_t size, bool owned)
+  : type_(type), 
+    buf_(buf),
+    size_(size),
+    owned_(owned){}
+
+  // a received message, whose buffer is recycled through the pool
+  MessageBuffer(MessageType type, uint64_t size)
+  : type_(type), 
+  buf_((char*)BufferPool::allocate(size)),
+  size_(size), 
+  owned_(false),
+  pooled_(true){}
+
+  // a body gathered from n segments of the caller's memory, which are
+  // written from where they are and must not change until the message is
+  // done with. More than MAX_SEGMENTS are copied into one buffer.
+  MessageBuffer(MessageType type, const iovec* segments, size_t n)
+  : type_(type),
+  buf_(nullptr),
+  size_(0),
+  owned_(false){
+    for(size_t i = 0; i < n; ++i){
+      size_ += segments[i].iov_len;
+    }
+
+    numSegments_ = uint32_t(n);
+    segments_ = 
+      static_cast<iovec*>(BufferPool::allocate(n * sizeof(iovec)));
+    memcpy(segments_, segments, n * sizeof(iovec));
+
+    if(n > MAX_SEGMENTS){
+      gather();
+    }
+  }
+
+  // the same with a small prefix, kept in the buffer itself, ahead of
+  // the segments
+  MessageBuffer(MessageType type, const void* prefix, size_t prefixSize,
+                const iovec* segments, size_t n)
+  : type_(type),
+  buf_(nullptr),
+  size_(prefixSize),
+  owned_(false){
+    assert(prefixSize <= INLINE_SIZE);
+    memcpy(inline_, prefix, prefixSize);
+
+    for(size_t i = 0; i < n; ++i){
+      size_ += segments[i].iov_len;
+    }
+
+    numSegments_ = uint32_t(n + 1);
+    segments_ = static_cast<iovec*>(
+      BufferPool::allocate(numSegments_ * sizeof(iovec)));
+    segments_[0] = {inline_, prefixSize};
+    memcpy(segments_ + 1, segments, n * sizeof(iovec));
+
+    if(numSegments_ > MAX_SEGMENTS){
+      gather();
+    }
+  }
+
+  ~MessageBuffer(){
+    if(owned_){
+      free(buf_);
+    }
+    else if(pooled_){
+      BufferPool::release(buf_);
+    }
+
+    if(segments_){
+      BufferPool::release(segments_);
+    }
+
+    if(request_){
+      request_->complete();
+    }
+  }
+
+  // messages are queued and received at a steady rate, so the buffers
+  // themselves are recycled too
+  static void* operator new(size_t size){
+    return BufferPool::allocate(size);
+  }
+
+  static void operator delete(void* ptr){
+    BufferPool::release(ptr);
+  }
+
+  template<class T>
+  T* as(){
+    return reinterpret_cast<T*>(buf_);
+  }
+
+  char* buffer(){
+    return buf_;
+  }
+
+  uint64_t size() const{
+    return size_;
+  }
+
+  // the body of a message of type Stream
+  MessageStream* stream(){
+    return reinterpret_cast<MessageStream*>(buf_);
+  }
+  
+  MessageType type(){
+    return type_;
+  }
+
+  void setType(MessageType type){
+    type_ = type;
+  }
+
+  // the descriptor that the body of a rendezvous is spliced to rather
+  // than read into the buffer, -1 if none or if splicing it failed
+  int file() const{
+    return file_;
+  }
+
+  void setFile(int fd){
+    file_ = fd;
+  }
+
+  bool owned() const{
+    return owned_;
+  }
+
+  uint32_t tag() const{
+    return tag_;
+  }
+
+  void setTag(uint32_t tag){
+    tag_ = tag;
+  }
+
+  // the rank of the sender of a received message
+  int source() const{
+    return source_;
+  }
+
+  void setSource(int source){
+    source_ = source;
+  }
+
+  bool compressed() const{
+    return compressed_;
+  }
+
+  // a body compressed with Compression, preceded by its size uncompressed
+  void setCompressed(bool compressed){
+    compressed_ = compressed;
+  }
+
+  // drops the tail of the buffer
+  void shrink(uint64_t size){
+    assert(size <= size_);
+    size_ = size;
+  }
+
+  // completed once the message is done with, which for a message being
+  // sent is once it has been written
+  void setRequest(CommRequest* request){
+    request_ = request;
+  }
+
+  // links the messages of a dispatcher's send queue
+  MessageBuffer* next() const{
+    return next_;
+  }
+
+  void setNext(MessageBuffer* next){
+    next_ = next;
+  }
+
+  // the place of the message among those sent to its dispatcher
+  uint64_t sequence() const{
+    return sequence_;
+  }
+
+  void setSequence(uint64_t sequence){
+    sequence_ = sequence;
+  }
+
+  // when a received message arrived, counted by counters once taken
+  void setArrival(PeerCounters* counters){
+    counters_ = counters;
+    arrival_ = std::chrono::steady_clock::now();
+  }
+
+  // a receive or handler has taken the message, which returns its
+  // credits to the sender
+  void taken(){
+    if(counters_){
+      counters_->latency(std::chrono::steady_clock::now() - arrival_);
+      counters_ = nullptr;
+    }
+
+    if(creditor_){
+      returnCredits_();
+    }
+  }
+
+  // a received message that the sender spent bytes of its credits on
+  void setCredits(MessageDispatcher* creditor, uint64_t bytes){
+    creditor_ = creditor;
+    credits_ = bytes;
+  }
+
+  // hands the buffer over to the caller, leaving this one empty, a
+  // received buffer is then released with BufferPool::release()
+  char* take(){
+    char* buf = buf_;
+    buf_ = nullptr;
+    size_ = 0;
+    owned_ = false;
+    pooled_ = false;
+    return buf;
+  }
+
+  // the segments of a gathered body, none once it is in one buffer
+  uint32_t numSegments() const{
+    return numSegments_;
+  }
+
+  const iovec* segments() const{
+    return segments_;
+  }
+
+  // copies a gathered body into one buffer from the pool, for what
+  // has to see it contiguous
+  void gather(){
+    if(!segments_){
+      return;
+    }
+
+    buf_ = (char*)BufferPool::allocate(size_);
+    pooled_ = true;
+
+    char* pos = buf_;
+    for(uint32_t i = 0; i < numSegments_; ++i){
+      memcpy(pos, segments_[i].iov_base, segments_[i].iov_len);
+      pos += segments_[i].iov_len;
+    }
+
+    BufferPool::release(segments_);
+    segments_ = nullptr;
+    numSegments_ = 0;
+  }
+
+  // the body the first time, null after that, the buffer stays owned
+  // by the message
+  char* consume(uint64_t& size){
+    if(consumed_){
+      return nullptr;
+    }
+    consumed_ = true;
+    size = size_;
+    return buf_;
+  }
+
+  // the header of an owned buffer written with zero copy, which the
+  // kernel may read until it reports the message sent, so it is kept
+  // with the message rather than in the dispatcher's batch
+  char* header(){
+    assert(owned_);
+    return inline_;
+  }
+
+  // the most segments that a body is written from
+  static const size_t MAX_SEGMENTS = 16;
+
+private:
+  static const size_t INLINE_SIZE = 16;
+
+  inline void returnCredits_();
+
+  MessageType type_;
+  char* buf_;
+  uint64_t size_;
+  bool owned_;
+  iovec* segments_ = nullptr;
+  uint32_t numSegments_ = 0;
+  bool pooled_ = false;
+  bool consumed_ = false;
+  bool compressed_ = false;
+  uint32_t tag_ = 0;
+  int source_ = -1;
+  int file_ = -1;
+  CommRequest* request_ = nullptr;
+  PeerCounters* counters_ = nullptr;
+  std::chrono::steady_clock::time_point arrival_;
+  MessageDispatcher* creditor_ = nullptr;
+  uint64_t credits_ = 0;
+  MessageBuffer* next_ = nullptr;
+  uint64_t sequence_ = 0;
+  char inline_[INLINE_SIZE];
+};
+
+class MessageHandler{
+public:
+  // returns true if the message was handled and can be deleted, false if
+  // the handler has kept it
+  virtual bool handleMessage(MessageDispatcher* dispatcher,
+                             MessageBuffer* msg) = 0;
+
+  // called on the engine thread once a bounded send queue has written
+  // messages out, see MessageDispatcher::full()
+  virtual void drained(){}
+
+  // the buffer that the body of rendezvous id of size bytes is read
+  // into, null to receive it like any other message
+  virtual MessageBuffer* rendezvousBuffer(MessageDispatcher* dispatcher,
+                                          uint32_t id, uint64_t size){
+    return nullptr;
+  }
+};
+
+// moves the messages of one connection, on the thread of its progress
+// engine: queued messages are written and incoming ones read as far as
+// the descriptors allow, then resumed at the next event
+class MessageDispatcher : public ProgressEngine::Handler{
+public:
+  MessageDispatcher(MessageHandler* handler,
+                    Channel* sendChannel,
+                    Channel* receiveChannel)
+  : handler_(handler), 
+  sendChannel_(sendChannel),
+  receiveChannel_(receiveChannel){}
+
+  ~MessageDispatcher(){
+    if(engine_){
+      close_();
+    }
+
+    if(receiveChannel_ != sendChannel_){
+      delete receiveChannel_;
+    }
+    delete sendChannel_;
+  }
+
+  void start(ProgressEngine* engine){
+    engine_ = engine;
+
+    if(sendChannel_ == receiveChannel_){
+      engine_->add(this, sendChannel_->fd(), EPOLLIN | EPOLLOUT);
+    }
+    else{
+      engine_->add(this, receiveChannel_->fd(), EPOLLIN);
+      engine_->add(this, sendChannel_->fd(), EPOLLOUT);
+    }
+
+    // data may have arrived before the descriptors were added
+    engine_->wake(this);
+  }
+
+  void handleEvent() override{
+    if(closed_){
+      return;
+    }
+
+    sendChannel_->poll();
+    if(receiveChannel_ != sendChannel_){
+      receiveChannel_->poll();
+    }
+
+    flushSend_();
+    pumpReceive_();
+  }
+
+  bool pending() override{
+    return receiveChannel_->pending();
+  }
+
+  // messages queued before the dispatcher starts are sent once it does
+  void send(MessageBuffer* msg){
+    if(size_t threshold = Compression::threshold()){
+      if(msg->type() == MessageType::Raw && msg->size() >= threshold &&
+         sendChannel_->compress()){
+        msg = compress_(msg);
+      }
+    }
+
+    counters_.sent(msg->size());
+    Trace::record(Trace::Send, uint32_t(rank_), uint32_t(msg->size()));
+
+    pendingBytes_.fetch_add(HEADER_SIZE + msg->size(),
+                            std::memory_order_relaxed);
+    pendingMessages_.fetch_add(1, std::memory_order_relaxed);
+
+    // the sequence keeps the order of sends that threads make one after
+    // the other, a send that happens before another takes a lower one
+    msg->setSequence(nextSequence_.fetch_add(1, std::memory_order_relaxed));
+
+    // pushed without a lock to the lane of the calling thread, so that
+    // senders on different threads do not contend on one line
+    std::atomic<MessageBuffer*>& lane = lanes_[lane_()].head;
+    MessageBuffer* head = lane.load(std::memory_order_relaxed);
+    do{
+      msg->setNext(head);
+    } while(!lane.compare_exchange_weak(head, msg,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+
+    if(engine_){
+      engine_->wake(this);
+    }
+  }
+
+  Channel* channel(){
+    return sendChannel_;
+  }
+
+  // whether a body received may be spliced to a descriptor
+  bool canSplice() const{
+    return receiveChannel_->canSplice();
+  }
+
+  // the rank of the peer, -1 until it is known
+  int rank() const{
+    return rank_;
+  }
+
+  void setRank(int rank){
+    rank_ = rank;
+  }
+
+  // 0 for the first connection to a peer, the index of a rail otherwise
+  int rail() const{
+    return rail_;
+  }
+
+  void setRail(int rail){
+    rail_ = rail;
+  }
+
+  PeerCounters::Snapshot counters() const{
+    return counters_.snapshot();
+  }
+
+  // messages waiting to be written, as of the engine's last look
+  size_t queueDepth() const{
+    return queueDepth_.load(std::memory_order_relaxed);
+  }
+
+  // the messages sent and not yet written out, or for zero copy not yet
+  // released by the kernel, and their bytes with the headers
+  size_t queuedMessages() const{
+    return pendingMessages_.load(std::memory_order_relaxed);
+  }
+
+  size_t queuedBytes() const{
+    return pendingBytes_.load(std::memory_order_relaxed);
+  }
+
+  // ARES_SEND_QUEUE_BYTES and ARES_SEND_QUEUE_MESSAGES bound what is
+  // queued to a connection, see full(), unbounded if unset or 0
+  static size_t maxQueuedBytes(){
+    static size_t bytes = []{
+      const char* s = getenv("ARES_SEND_QUEUE_BYTES");
+      return s ? size_t(atoll(s)) : size_t(0);
+    }();
+    return bytes;
+  }
+
+  static size_t maxQueuedMessages(){
+    static size_t n = []{
+      const char* s = getenv("ARES_SEND_QUEUE_MESSAGES");
+      return s ? size_t(atoll(s)) : size_t(0);
+    }();
+    return n;
+  }
+
+  static bool bounded(){
+    return maxQueuedBytes() > 0 || maxQueuedMessages() > 0;
+  }
+
+  // true if a message of size bytes would take the queue over its
+  // bounds, one on its own is let through whatever its size
+  bool full(uint64_t size) const{
+    size_t messages = queuedMessages();
+    if(messages == 0){
+      return false;
+    }
+
+    size_t maxBytes = maxQueuedBytes();
+    size_t maxMessages = maxQueuedMessages();
+    return (maxBytes > 0 && queuedBytes() + HEADER_SIZE + size > maxBytes) ||
+      (maxMessages > 0 && messages >= maxMessages);
+  }
+
+  // ARES_CREDITS is the bytes of raw messages that a peer may send this
+  // process over a connection before it has taken them, granted when the
+  // connection starts, 0 or unset to not limit them, see credit()
+  static uint32_t grantedCredits(){
+    static uint32_t bytes = []{
+      const char* s = getenv("ARES_CREDITS");
+      return s ? uint32_t(std::min<long long>(atoll(s), UINT32_MAX)) :
+        uint32_t(0);
+    }();
+    return bytes;
+  }
+
+  // the credits that the peer granted, set on the engine thread as its
+  // first message arrives, raw messages wait in the queue while they
+  // are spent
+  void setCredits(uint32_t bytes){
+    if(bytes > 0 && creditWindow_ == 0){
+      creditWindow_ = bytes;
+      credits_ = bytes;
+    }
+  }
+
+  // called on the thread that takes a message that the peer spent
+  // credits on, which go back to it once a quarter of the grant is owed
+  // or all that it sent has been taken, so it is not left waiting
+  void credit(uint64_t bytes){
+    uint64_t owed = creditsOwed_.fetch_add(bytes) + bytes;
+    size_t left = untaken_.fetch_sub(1) - 1;
+
+    if(owed >= grantedCredits()/4 || left == 0){
+      owed = creditsOwed_.exchange(0);
+      if(owed > 0){
+        CreditMessage cm;
+        cm.bytes = owed;
+        send(new MessageBuffer(cm, true));
+      }
+    }
+  }
+
+private:
+  // 8 bytes of body size, the message type and a 4 byte tag
+  static const size_t HEADER_SIZE = 13;
+
+  // smaller messages are cheaper to copy than to pin
+  static const uint64_t ZERO_COPY_SIZE = 64 * 1024;
+
+  // zero copy buffers held before sending waits for the kernel
+  static const size_t MAX_ZERO_COPY_PENDING = 64;
+
+  // messages written together in one call
+  static const size_t MAX_BATCH = 32;
+
+  // marks the type of a compressed message in its header
+  static const uint8_t COMPRESSED = 0x80;
+
+  // marks a message that credits were spent on
+  static const uint8_t CREDITED = 0x40;
+
+  using Clock = std::chrono::steady_clock;
+
+  enum class ReceiveState{
+    Header,
+    Body,
+    Stream,
+    Splice
+  };
+
+  static bool wouldBlock_(){
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+
+  // done on the sending thread, so compressing one message overlaps
+  // with the engine writing the ones before it, the message is replaced
+  // by one with the compressed body unless that is no smaller
+  MessageBuffer* compress_(MessageBuffer* msg){
+    msg->gather();
+    uint64_t size = msg->size();
+    size_t bound = Compression::bound(size);
+
+    auto c = new MessageBuffer(msg->type(), 8 + bound);
+    size_t n = Compression::compress(msg->buffer(), size, c->buffer() + 8,
+                                     bound);
+    if(n == 0 || 8 + n >= size){
+      delete c;
+      return msg;
+    }
+
+    memcpy(c->buffer(), &size, 8);
+    c->shrink(8 + n);
+    c->setTag(msg->tag());
+    c->setCompressed(true);
+
+    // a non-blocking send completes, its buffer is not needed any more
+    delete msg;
+
+    return c;
+  }
+
+  MessageBuffer* decompress_(MessageBuffer* c){
+    uint64_t size;
+    memcpy(&size, c->buffer(), 8);
+
+    auto msg = new MessageBuffer(c->type(), size);
+    msg->setTag(c->tag());
+
+    bool ok = Compression::decompress(c->buffer() + 8, c->size() - 8,
+                                      msg->buffer(), size);
+    delete c;
+
+    if(!ok){
+      fprintf(stderr, "ares: dropping a message that failed to "
+              "decompress\n");
+      delete msg;
+      return nullptr;
+    }
+
+    return msg;
+  }
+
+  void close_(){
+    closed_ = true;
+    engine_->remove(receiveChannel_->fd());
+    if(sendChannel_ != receiveChannel_){
+      engine_->remove(sendChannel_->fd());
+    }
+    engine_->cancel(this);
+  }
+
+  // ARES_COALESCE_BYTES is how much of what is queued goes out in one
+  // write, 64 KiB by default
+  static size_t coalesceBytes_(){
+    static size_t bytes = []{
+      const char* s = getenv("ARES_COALESCE_BYTES");
+      return s ? std::max<size_t>(atoll(s), 1) : 64 * 1024;
+    }();
+    return bytes;
+  }
+
+  // ARES_COALESCE_USEC is how long fewer bytes than that may wait for
+  // more messages, by default they are sent as soon as the engine gets
+  // to them with whatever was queued meanwhile
+  static Clock::duration coalesceDelay_(){
+    static Clock::duration delay = []{
+      const char* s = getenv("ARES_COALESCE_USEC");
+      return std::chrono::microseconds(s ? atoll(s) : 0);
+    }();
+    return delay;
+  }
+
+  // a large buffer the runtime owns is handed to the kernel and freed
+  // once it reports that it has sent it
+  bool zeroCopy_(MessageBuffer* msg){
+    return msg->owned() && msg->size() >= ZERO_COPY_SIZE &&
+      sendChannel_->zeroCopy();
+  }
+
+  // the lane that the calling thread sends on, the same for each
+  // dispatcher. Threads beyond NUM_LANES share them.
+  static size_t lane_(){
+    static std::atomic<size_t> next{0};
+    static thread_local size_t lane =
+      next.fetch_add(1, std::memory_order_relaxed) % NUM_LANES;
+    return lane;
+  }
+
+  // moves what the senders pushed to their lanes to the end of the
+  // engine's own queue, in the order it was sent. A message that has
+  // its sequence but has not been pushed yet holds back the ones after
+  // it, until its sender pushes it and wakes the engine.
+  void takeIncoming_(){
+    for(Lane_& lane : lanes_){
+      if(!lane.head.load(std::memory_order_relaxed)){
+        continue;
+      }
+
+      MessageBuffer* msg = 
+        lane.head.exchange(nullptr, std::memory_order_acquire);
+      for(; msg; msg = msg->next()){
+        unordered_.push_back(msg);
+      }
+    }
+
+    if(unordered_.empty()){
+      return;
+    }
+
+    std::sort(unordered_.begin(), unordered_.end(),
+              [](MessageBuffer* a, MessageBuffer* b){
+                return a->sequence() < b->sequence();
+              });
+
+    size_t n = 0;
+    while(n < unordered_.size() && 
+          unordered_[n]->sequence() == nextQueued_){
+      ++n;
+      ++nextQueued_;
+    }
+
+    if(n == 0){
+      return;
+    }
+
+    if(!queueHead_){
+      firstQueued_ = Clock::now();
+    }
+
+    for(size_t i = 0; i < n; ++i){
+      MessageBuffer* msg = unordered_[i];
+      msg->setNext(nullptr);
+      queuedBytes_ += HEADER_SIZE + msg->size();
+      ++queued_;
+
+      if(queueTail_){
+        queueTail_->setNext(msg);
+      }
+      else{
+        queueHead_ = msg;
+      }
+      queueTail_ = msg;
+    }
+
+    unordered_.erase(unordered_.begin(), unordered_.begin() + n);
+
+    counters_.queueDepth(queued_);
+    queueDepth_.store(queued_, std::memory_order_relaxed);
+  }
+
+  MessageBuffer* popQueued_(){
+    MessageBuffer* msg = queueHead_;
+    queueHead_ = msg->next();
+    if(!queueHead_){
+      queueTail_ = nullptr;
+    }
+    msg->setNext(nullptr);
+
+    queuedBytes_ -= HEADER_SIZE + msg->size();
+    --queued_;
+    return msg;
+  }
+
+  // takes queued messages up to the coalescing limits, a zero copy one
+  // goes in a batch of its own
+  bool takeBatch_(){
+    takeIncoming_();
+
+    if(!queueHead_){
+      return false;
+    }
+
+    if(queuedBytes_ < coalesceBytes_() && 
+       coalesceDelay_() > Clock::duration::zero()){
+      Clock::time_point deadline = firstQueued_ + coalesceDelay_();
+      if(Clock::now() < deadline){
+        if(deadline != wakeAt_){
+          wakeAt_ = deadline;
+          engine_->wakeAt(this, deadline);
+        }
+        return false;
+      }
+    }
+
+    size_t bytes = 0;
+    zeroCopyBatch_ = false;
+    numPieces_ = 0;
+    sendPiece_ = 0;
+
+    while(queueHead_ && batch_.size() < MAX_BATCH){
+      MessageBuffer* msg = queueHead_;
+      uint64_t size = msg->size();
+      bool zeroCopy = zeroCopy_(msg);
+
+      if(!batch_.empty() && 
+         (zeroCopy || bytes + HEADER_SIZE + size > coalesceBytes_())){
+        break;
+      }
+
+      // the rest of the queue waits behind a raw message until the peer
+      // returns enough credits, unless none are out
+      bool credited = creditWindow_ > 0 && msg->type() == MessageType::Raw;
+      if(credited){
+        int64_t cost = int64_t(HEADER_SIZE + size);
+        if(credits_ < cost && credits_ < int64_t(creditWindow_)){
+          break;
+        }
+        credits_ -= cost;
+      }
+
+      popQueued_();
+
+      char* header = zeroCopy ? msg->header() : sendHeaders_[batch_.size()];
+      memcpy(header, &size, 8);
+      header[8] = char(uint8_t(msg->type()) |
+                       (msg->compressed() ? COMPRESSED : 0) |
+                       (credited ? CREDITED : 0));
+      uint32_t tag = msg->tag();
+      memcpy(header + 9, &tag, 4);
+
+      sendIov_[numPieces_++] = {header, HEADER_SIZE};
+      if(uint32_t n = msg->numSegments()){
+        memcpy(sendIov_ + numPieces_, msg->segments(), n * sizeof(iovec));
+        numPieces_ += n;
+      }
+      else if(size > 0){
+        sendIov_[numPieces_++] = {msg->buffer(), size};
+      }
+
+      batch_.push_back(msg);
+      bytes += HEADER_SIZE + size;
+
+      if(zeroCopy){
+        zeroCopyBatch_ = true;
+        break;
+      }
+    }
+
+    // what is left waits from now
+    firstQueued_ = Clock::now();
+    queueDepth_.store(queued_, std::memory_order_relaxed);
+
+    return !batch_.empty();
+  }
+
+  void finishBatch_(){
+    if(zeroCopyBatch_){
+      for(MessageBuffer* msg : batch_){
+        zeroCopyPending_.emplace_back(sendChannel_->zeroCopySent(), msg);
+      }
+    }
+    else{
+      for(MessageBuffer* msg : batch_){
+        written_(msg);
+      }
+      drained_();
+    }
+    batch_.clear();
+  }
+
+  // done with a message sent, which leaves the queue
+  void written_(MessageBuffer* msg){
+    pendingBytes_.fetch_sub(HEADER_SIZE + msg->size(),
+                            std::memory_order_relaxed);
+    pendingMessages_.fetch_sub(1, std::memory_order_relaxed);
+    delete msg;
+  }
+
+  void drained_(){
+    if(bounded()){
+      handler_->drained();
+    }
+  }
+
+  void flushSend_(){
+    for(;;){
+      reclaimZeroCopy_();
+
+      if(batch_.empty()){
+        // more completions arrive as events on the socket
+        if(zeroCopyPending_.size() >= MAX_ZERO_COPY_PENDING){
+          return;
+        }
+
+        if(!takeBatch_()){
+          return;
+        }
+      }
+
+      iovec* iov = sendIov_ + sendPiece_;
+      int n = numPieces_ - sendPiece_;
+
+      ssize_t ret = zeroCopyBatch_ ? sendChannel_->writeZeroCopy(iov, n) :
+        sendChannel_->write(iov, n);
+
+      if(ret < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        if(wouldBlock_()){
+          return;
+        }
+        // the connection is gone, so are the messages
+        zeroCopyBatch_ = false;
+        finishBatch_();
+        continue;
+      }
+
+      size_t done = ret;
+      while(sendPiece_ < numPieces_ && done >= sendIov_[sendPiece_].iov_len){
+        done -= sendIov_[sendPiece_].iov_len;
+        ++sendPiece_;
+      }
+
+      if(sendPiece_ < numPieces_){
+        iovec& p = sendIov_[sendPiece_];
+        p.iov_base = static_cast<char*>(p.iov_base) + done;
+        p.iov_len -= done;
+        continue;
+      }
+
+      finishBatch_();
+    }
+  }
+
+  void reclaimZeroCopy_(){
+    if(zeroCopyPending_.empty()){
+      return;
+    }
+
+    uint64_t done = sendChannel_->zeroCopyDone();
+
+    bool any = false;
+    while(!zeroCopyPending_.empty() && 
+          zeroCopyPending_.front().first <= done){
+      written_(zeroCopyPending_.front().second);
+      zeroCopyPending_.pop_front();
+      any = true;
+    }
+
+    if(any){
+      drained_();
+    }
+  }
+
+  void pumpReceive_(){
+    // where the rest of a body goes once splicing it has failed
+    char discard[4096];
+
+    for(;;){
+      char* buf;
+      size_t size;
+
+      switch(receiveState_){
+        case ReceiveState::Header:
+          buf = receiveHeader_ + received_;
+          size = HEADER_SIZE - received_;
+          break;
+        case ReceiveState::Body:
+          buf = receiving_->buffer() + received_;
+          size = receiving_->size() - received_;
+          break;
+        case ReceiveState::Stream:
+          // resumed by the receiver once it frees a chunk
+          buf = receiving_->stream()->space(size);
+          if(!buf){
+            return;
+          }
+          break;
+        case ReceiveState::Splice:
+          buf = discard;
+          size = receiving_->size() - received_;
+          break;
+      }
+
+      ssize_t ret;
+      if(receiveState_ == ReceiveState::Splice && receiving_->file() >= 0){
+        ret = receiveChannel_->spliceTo(receiving_->file(), size);
+
+        // the descriptor failed, the message ends with what it took
+        if(ret < 0 && errno != EINTR && !wouldBlock_()){
+          spliced_ = received_;
+          receiving_->setFile(-1);
+          continue;
+        }
+      }
+      else{
+        if(receiveState_ == ReceiveState::Splice){
+          size = std::min(size, sizeof(discard));
+        }
+        ret = receiveChannel_->read(buf, size);
+      }
+
+      if(ret <= 0){
+        if(ret < 0 && errno == EINTR){
+          continue;
+        }
+        if(ret < 0 && wouldBlock_()){
+          return;
+        }
+        close_();
+        return;
+      }
+
+      switch(receiveState_){
+        case ReceiveState::Header:
+          received_ += ret;
+          if(received_ == HEADER_SIZE){
+            received_ = 0;
+            startMessage_();
+          }
+          break;
+        case ReceiveState::Body:
+          received_ += ret;
+          if(received_ == receiving_->size()){
+            received_ = 0;
+            finishMessage_();
+          }
+          break;
+        case ReceiveState::Stream:
+          if(receiving_->stream()->fill(ret)){
+            receiving_->stream()->release();
+            receiving_ = nullptr;
+            receiveState_ = ReceiveState::Header;
+          }
+          break;
+        case ReceiveState::Splice:
+          received_ += ret;
+          if(received_ == receiving_->size()){
+            if(receiving_->file() < 0){
+              receiving_->shrink(spliced_);
+            }
+            received_ = 0;
+            finishMessage_();
+          }
+          break;
+      }
+    }
+  }
+
+  void startMessage_(){
+    uint64_t size;
+    memcpy(&size, receiveHeader_, 8);
+    uint8_t typeFlags = receiveHeader_[8];
+    MessageType type = MessageType(typeFlags & ~(COMPRESSED | CREDITED));
+    receiveCompressed_ = typeFlags & COMPRESSED;
+    receiveCredits_ = typeFlags & CREDITED ? HEADER_SIZE + size : 0;
+    uint32_t tag;
+    memcpy(&tag, receiveHeader_ + 9, 4);
+
+    // the receiver reads a stream while the rest of it arrives
+    if(type == MessageType::Stream){
+      auto stream = new MessageStream(size, [this]{
+        engine_->wake(this);
+      });
+
+      receiving_ = new MessageBuffer(type, reinterpret_cast<char*>(stream),
+                                     size, false);
+      receiving_->setTag(tag);
+      deliver_(receiving_);
+
+      if(size == 0){
+        stream->release();
+        receiving_ = nullptr;
+        return;
+      }
+
+      receiveState_ = ReceiveState::Stream;
+      return;
+    }
+
+    // the body of a rendezvous goes straight to where its receive wants
+    // it, with no buffer in between
+    if(type == MessageType::Rendezvous){
+      receiving_ = handler_->rendezvousBuffer(this, tag, size);
+    }
+
+    // a body to be spliced on a channel that cannot is read in full
+    if(receiving_ && receiving_->file() >= 0 && !canSplice()){
+      delete receiving_;
+      receiving_ = nullptr;
+    }
+
+    if(!receiving_){
+      receiving_ = new MessageBuffer(type, size);
+    }
+    receiving_->setTag(tag);
+
+    if(size == 0){
+      finishMessage_();
+      return;
+    }
+
+    receiveState_ = receiving_->file() >= 0 ? ReceiveState::Splice :
+      ReceiveState::Body;
+  }
+
+  void finishMessage_(){
+    MessageBuffer* msg = receiving_;
+    receiving_ = nullptr;
+    receiveState_ = ReceiveState::Header;
+
+    if(receiveCompressed_ && !(msg = decompress_(msg))){
+      if(receiveCredits_ > 0){
+        untaken_.fetch_add(1);
+        credit(receiveCredits_);
+      }
+      return;
+    }
+
+    if(receiveCredits_ > 0){
+      untaken_.fetch_add(1);
+      msg->setCredits(this, receiveCredits_);
+    }
+
+    deliver_(msg);
+  }
+
+  void deliver_(MessageBuffer* msg){
+    if(msg->type() == MessageType::Credit){
+      // the queue is flushed before the connection is read
+      credits_ += msg->as<CreditMessage>()->bytes;
+      engine_->wake(this);
+      delete msg;
+      return;
+    }
+
+    msg->setSource(rank_);
+    counters_.received(msg->size());
+    Trace::record(Trace::Receive, uint32_t(rank_), uint32_t(msg->size()));
+    msg->setArrival(&counters_);
+
+    if(handler_->handleMessage(this, msg)){
+      delete msg;
+    }
+  }
+
+  MessageHandler* handler_;
+  Channel* sendChannel_;
+  Channel* receiveChannel_;
+  ProgressEngine* engine_ = nullptr;
+  bool closed_ = false;
+  int rank_ = -1;
+  int rail_ = 0;
+  PeerCounters counters_;
+
+  static const size_t NUM_LANES = 32;
+  static const size_t CACHE_LINE = 64;
+
+  // the messages a sender pushed, newest first, on a line of their own
+  struct Lane_{
+    std::atomic<MessageBuffer*> head{nullptr};
+    char pad[CACHE_LINE - sizeof(std::atomic<MessageBuffer*>)];
+  };
+
+  // pushed to by the senders
+  Lane_ lanes_[NUM_LANES];
+  std::atomic<uint64_t> nextSequence_{0};
+  std::atomic<size_t> queueDepth_{0};
+  std::atomic<size_t> pendingBytes_{0};
+  std::atomic<size_t> pendingMessages_{0};
+
+  // the credits that the peer granted and those left, on the engine
+  // thread, and what this end owes the peer for the messages taken
+  uint32_t creditWindow_ = 0;
+  int64_t credits_ = 0;
+  std::atomic<uint64_t> creditsOwed_{0};
+  std::atomic<size_t> untaken_{0};
+
+  // the messages the engine has taken from the lanes ahead of one that
+  // is still to be pushed, and the sequence of the next one to queue
+  std::vector<MessageBuffer*> unordered_;
+  uint64_t nextQueued_ = 0;
+
+  // the engine's queue of messages to send, linked through them
+  MessageBuffer* queueHead_ = nullptr;
+  MessageBuffer* queueTail_ = nullptr;
+  size_t queued_ = 0;
+  size_t queuedBytes_ = 0;
+  Clock::time_point firstQueued_;
+  Clock::time_point wakeAt_;
+
+  // the engine's sending state, the batch being written
+  std::vector<MessageBuffer*> batch_;
+  char sendHeaders_[MAX_BATCH][HEADER_SIZE];
+  iovec sendIov_[MAX_BATCH * (1 + MessageBuffer::MAX_SEGMENTS)];
+  int sendPiece_ = 0;
+  int numPieces_ = 0;
+  bool zeroCopyBatch_ = false;
+  std::deque<std::pair<uint64_t, MessageBuffer*>> zeroCopyPending_;
+
+  // the engine's receiving state
+  ReceiveState receiveState_ = ReceiveState::Header;
+  char receiveHeader_[HEADER_SIZE];
+  bool receiveCompressed_ = false;
+  uint64_t receiveCredits_ = 0;
+  uint64_t received_ = 0;
+  uint64_t spliced_ = 0;
+  MessageBuffer* receiving_ = nullptr;
+};
+
+void MessageBuffer::returnCredits_(){
+  creditor_->credit(credits_);
+  creditor_ = nullptr;
+}
+
+// a process of a group addressed by rank, each of its connections leads
+// to a peer whose rank is exchanged when the connection starts, received
+// messages are queued by the rank of their sender and their tag
+class Communicator : public MessageHandler{
+public:
+  // receives from any peer
+  static const int ANY_RANK = -1;
+
+  Communicator(){
+    if(const char* r = getenv("ARES_RANK")){
+      rank_ = atoi(r);
+      Trace::setRank(rank_);
+      RegionProfile::setRank(rank_);
+    }
+  }
+
+  virtual ~Communicator(){
+    for(MessageDispatcher* h : dispatchers_){
+      delete h;
+    }
+
+    Published_* p = published_.load(std::memory_order_acquire);
+    while(p){
+      Published_* next = p->next;
+      delete p;
+      p = next;
+    }
+
+    for(auto& itr : pushes_){
+      delete itr.second;
+    }
+  }
+
+  void addDispatcher(MessageDispatcher* dispatcher){
+    // the rank has to be the first message the peer receives
+    RankMessage rm;
+    rm.rank = rank_;
+    rm.assigned = -1;
+    rm.rail = dispatcher->rail();
+    rm.credits = MessageDispatcher::grantedCredits();
+    dispatcher->send(new MessageBuffer(rm, true));
+
+    dispatcher->start(ProgressEngine::next());
+
+    dispatchersMutex_.lock();
+    dispatchers_.push_back(dispatcher);
+    published_.store(new Published_{dispatcher,
+                                    published_.load(std::memory_order_relaxed)},
+                     std::memory_order_release);
+    dispatchersMutex_.unlock();
+  }
+
+  int rank() const{
+    return rank_;
+  }
+
+  // takes over a message on the engine thread it arrived on, so it must
+  // not block
+  using InlineHandler = std::function<void(MessageBuffer*)>;
+
+  // messages of type are handed to handler rather than handled as they
+  // are by default, set before connecting
+  void setHandler(MessageType type, InlineHandler handler){
+    typeHandlers_[uint8_t(type)] = std::move(handler);
+  }
+
+  // raw messages with tag are handed to handler ahead of posted and
+  // blocking receives, a null handler removes it
+  void setTagHandler(uint32_t tag, InlineHandler handler){
+    std::lock_guard<std::mutex> lock(receiveMutex_);
+    if(handler){
+      tagHandlers_[tag] = std::move(handler);
+    }
+    else{
+      tagHandlers_.erase(tag);
+    }
+  }
+
+  size_t groupSize() const{
+    return groupSize_;
+  }
+
+  struct PeerStats{
+    int rank;
+    size_t queueDepth;
+    size_t queuedBytes;
+    PeerCounters::Snapshot counters;
+  };
+
+  // by rank, a peer connected more than once has its connections added.
+  // The connections are walked without the lock that sends take, so
+  // that the stats can be polled while they run.
+  std::vector<PeerStats> peerStats(){
+    std::map<int, PeerStats> peers;
+
+    for(Published_* p = published_.load(std::memory_order_acquire); p;
+        p = p->next){
+      MessageDispatcher* d = p->dispatcher;
+      auto itr = peers.find(d->rank());
+      if(itr == peers.end()){
+        itr = peers.emplace(d->rank(), PeerStats{d->rank(), 0, 0, {}}).first;
+      }
+      itr->second.queueDepth += d->queueDepth();
+      itr->second.queuedBytes += d->queuedBytes();
+      itr->second.counters.add(d->counters());
+    }
+
+    std::vector<PeerStats> v;
+    for(auto& itr : peers){
+      v.push_back(itr.second);
+    }
+    return v;
+  }
+
+  // called on the sending thread when a send finds the bounded queue
+  // to rank full, with what is queued to it, true has the message sent
+  // anyway, false fails the send
+  using SendFullHandler = bool (*)(int rank, size_t bytes, size_t messages);
+
+  // what a send that may fail does when the queue is full, ARES_SEND_FULL
+  // is block, the default, or fail, a handler takes the place of either
+  enum class SendFull{
+    Block,
+    Fail
+  };
+
+  static SendFull sendFull(){
+    static SendFull mode = []{
+      const char* s = getenv("ARES_SEND_FULL");
+      return s && strcmp(s, "fail") == 0 ? SendFull::Fail : SendFull::Block;
+    }();
+    return mode;
+  }
+
+  void setSendFullHandler(SendFullHandler handler){
+    sendFullHandler_.store(handler, std::memory_order_release);
+  }
+
+  // sends to the first peer that connected, waiting while its queue is
+  // full
+  void send(MessageBuffer* buf){
+    MessageDispatcher* dispatcher = dispatcher_();
+    admit_(dispatcher->rank(), &dispatcher, 1, buf->size(), false);
+    dispatcher->send(buf);
+  }
+
+  // waits until the peer of rank has connected and its queue has room,
+  // raw messages of at least ARES_STRIPE bytes to a peer with rails are
+  // striped over them
+  void send(int rank, uint32_t tag, MessageBuffer* buf){
+    send_(rank, tag, buf, false);
+  }
+
+  // the same, but once the queue is full does as sendFull() says,
+  // false if the send failed, buf is then still the caller's
+  bool trySend(MessageBuffer* buf){
+    MessageDispatcher* dispatcher = dispatcher_();
+    if(!admit_(dispatcher->rank(), &dispatcher, 1, buf->size(), true)){
+      return false;
+    }
+    dispatcher->send(buf);
+    return true;
+  }
+
+  bool trySend(int rank, uint32_t tag, MessageBuffer* buf){
+    return send_(rank, tag, buf, true);
+  }
+
+  // the messages queued to the connections of rank and their bytes, see
+  // MessageDispatcher::queuedBytes()
+  void sendQueue(int rank, size_t& bytes, size_t& messages){
+    bytes = 0;
+    messages = 0;
+
+    std::lock_guard<std::mutex> lock(dispatchersMutex_);
+    for(MessageDispatcher* d : dispatchers_){
+      if(d->rank() == rank){
+        bytes += d->queuedBytes();
+        messages += d->queuedMessages();
+      }
+    }
+  }
+
+  void drained() override{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sendWaiters_.load() > 0){
+      std::lock_guard<std::mutex> lock(sendMutex_);
+      sendCond_.notify_all();
+    }
+  }
+
+  MessageBuffer* receive(){
+    return receive(ANY_RANK, 0);
+  }
+
+  MessageBuffer* receive(int rank, uint32_t tag){
+    std::unique_lock<std::mutex> lock(receiveMutex_);
+
+    for(;;){
+      if(rank == ANY_RANK){
+        for(auto& itr : received_){
+          if(itr.first.second == tag && !itr.second.empty()){
+            return fetch_(lock, pop_(itr.second));
+          }
+        }
+      }
+      else{
+        auto itr = received_.find({rank, tag});
+        if(itr != received_.end() && !itr->second.empty()){
+          return fetch_(lock, pop_(itr->second));
+        }
+      }
+
+      // a busy polling engine hands the message over without a wake up
+      if(ProgressEngine::busyPoll()){
+        uint64_t seen = receivedCount_.load(std::memory_order_relaxed);
+        lock.unlock();
+        uint32_t spins = 0;
+        while(receivedCount_.load(std::memory_order_acquire) == seen){
+          spinWait(spins);
+        }
+        lock.lock();
+        continue;
+      }
+
+      waitOrRun(lock, receiveCond_);
+    }
+  }
+
+  // completes request with the next message from rank with tag, right
+  // away if there is one, otherwise it takes the message before
+  // receive() does. A request posted into a buffer that a rendezvous
+  // fits in has the body read into it.
+  void postReceive(CommRequest* request, int rank, uint32_t tag){
+    std::unique_lock<std::mutex> lock(receiveMutex_);
+
+    MessageBuffer* msg = nullptr;
+
+    for(auto& itr : received_){
+      if(request->matches(itr.first.first, itr.first.second) &&
+         !itr.second.empty()){
+        msg = pop_(itr.second);
+        break;
+      }
+    }
+
+    if(!msg){
+      posted_.push_back(request);
+      return;
+    }
+
+    lock.unlock();
+    complete_(request, msg);
+  }
+
+  void createdConnection(){
+    ++numConnections_;
+  }
+
+  virtual bool isListener() = 0; 
+
+  void barrier(){
+    arrive();
+    wait();
+  }
+
+  // in round k of the dissemination barrier, each rank signals the one
+  // 2^k after it and waits for the one 2^k before it, so all of them
+  // have arrived after log2(groupSize) rounds, which are carried on by
+  // the engine threads as the signals arrive
+  void arrive(){
+    assert(groupSize_ > 0 && "the group has not been initialized");
+
+    if(barrierPeers_.size() < rounds_){
+      for(uint32_t k = 0; k < rounds_; ++k){
+        int peer = (rank_ + (1 << k)) % groupSize_;
+        barrierPeers_.push_back(dispatcherFor_(peer));
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(barrierMutex_);
+    assert(completed_ == arrived_ && "arrived again without waiting");
+
+    ++arrived_;
+    round_ = 0;
+
+    if(rounds_ > 0){
+      signalBarrier_(0);
+    }
+
+    advanceBarrier_();
+  }
+
+  void wait(){
+    std::unique_lock<std::mutex> lock(barrierMutex_);
+    while(completed_ != arrived_){
+      waitOrRun(lock, barrierCond_);
+    }
+  }
+
+  void init(size_t groupSize){
+    assert(groupSize_ == 0);
+    assert(rank_ >= 0 && size_t(rank_) < groupSize);
+
+    groupSize_ = groupSize;
+
+    rounds_ = 0;
+    while((size_t(1) << rounds_) < groupSize){
+      ++rounds_;
+    }
+  }
+
+  bool handleMessage(MessageDispatcher* dispatcher,
+                     MessageBuffer* msg) override{
+    if(InlineHandler& handler = typeHandlers_[uint8_t(msg->type())]){
+      handler(msg);
+      return false;
+    }
+
+    switch(msg->type()){
+      case MessageType::Barrier:{
+        auto bm = msg->as<BarrierMessage>();
+        std::lock_guard<std::mutex> lock(barrierMutex_);
+        barrierRounds_[bm->epoch] |= 1u << bm->round;
+        advanceBarrier_();
+        return true;
+      }
+      case MessageType::Rank:{
+        addRank_(dispatcher, *msg->as<RankMessage>());
+        return true;
+      }
+      case MessageType::RemoteWrite:
+      case MessageType::RemoteRead:
+        serveRemote_(dispatcher, msg);
+        return true;
+      case MessageType::RemoteDone:
+        completeRemote_(msg);
+        return true;
+      case MessageType::Striped:
+        receiveStriped_(msg);
+        return true;
+      case MessageType::StripeChunk:
+        receiveChunk_(msg);
+        return true;
+      case MessageType::ReadyToReceive:
+        sendRendezvous_(dispatcher, msg->as<ReadyToReceiveMessage>()->id);
+        return true;
+      case MessageType::Rendezvous:
+        finishRendezvous_(msg);
+        return false;
+      default:
+        queueOrdered_(msg);
+        return false;
+    }
+  }
+
+  // writes size bytes of buf to addr in the memory of rank, returning
+  // once they are there, over verbs if the peer is connected that way,
+  // otherwise the peer's engine copies them
+  bool put(int rank, const void* buf, size_t size, uint64_t addr,
+           uint32_t rkey){
+    if(rank == rank_){
+      memcpy(reinterpret_cast<void*>(addr), buf, size);
+      return true;
+    }
+
+    MessageDispatcher* dispatcher = dispatcherFor_(rank);
+
+#ifdef ARES_HAVE_IBVERBS
+    if(auto c = dynamic_cast<VerbsChannel*>(dispatcher->channel())){
+      return c->put(buf, size, {addr, rkey});
+    }
+#endif
+
+    return remote_(dispatcher, MessageType::RemoteWrite,
+                   const_cast<void*>(buf), size, addr);
+  }
+
+  MessageBuffer* rendezvousBuffer(MessageDispatcher* dispatcher,
+                                  uint32_t id, uint64_t size) override{
+    std::lock_guard<std::mutex> lock(rendezvousMutex_);
+    auto itr = pulls_.find({dispatcher->rank(), id});
+    if(itr == pulls_.end() || !itr->second.msg ||
+       itr->second.msg->size() != size){
+      return nullptr;
+    }
+
+    MessageBuffer* msg = itr->second.msg;
+    itr->second.msg = nullptr;
+    return msg;
+  }
+
+  bool get(int rank, void* buf, size_t size, uint64_t addr, uint32_t rkey){
+    if(rank == rank_){
+      memcpy(buf, reinterpret_cast<void*>(addr), size);
+      return true;
+    }
+
+    MessageDispatcher* dispatcher = dispatcherFor_(rank);
+
+#ifdef ARES_HAVE_IBVERBS
+    if(auto c = dynamic_cast<VerbsChannel*>(dispatcher->channel())){
+      return c->get(buf, size, {addr, rkey});
+    }
+#endif
+
+    return remote_(dispatcher, MessageType::RemoteRead, buf, size, addr);
+  }
+
+protected:
+  // a listener that was not given a rank is the first of the group
+  void setDefaultRank(){
+    int none = -1;
+    rank_.compare_exchange_strong(none, 0);
+  }
+
+  // waits until both this process and the peer of dispatcher have ranks
+  void waitForRanks(MessageDispatcher* dispatcher){
+    std::unique_lock<std::mutex> lock(ranksMutex_);
+    ranksCond_.wait(lock, [&]{
+      return rank_ >= 0 && dispatcher->rank() >= 0;
+    });
+  }
+
+  // waits until the peers of count ranks have connected, false if they
+  // have not by the deadline
+  bool waitForPeers(size_t count,
+                    std::chrono::steady_clock::time_point deadline){
+    std::unique_lock<std::mutex> lock(ranksMutex_);
+    return ranksCond_.wait_until(lock, deadline, [&]{
+      return ranks_.size() >= count;
+    });
+  }
+
+  // called on the sending thread for a rank that is not connected yet, a
+  // communicator that connects on demand starts connecting to it here
+  virtual void connectOnDemand(int rank){}
+
+  // an extra connection to the peer of rank, made once the first one
+  // has been, which large messages are striped over
+  void addRail(int rank, MessageDispatcher* dispatcher){
+    std::lock_guard<std::mutex> lock(ranksMutex_);
+    dispatcher->setRank(rank);
+    rails_[rank].push_back(dispatcher);
+  }
+
+private:
+  using MessageDispatcherVec = std::vector<MessageDispatcher*>;
+  using RankTagPair = std::pair<int, uint32_t>;
+  using MessageQueue = std::deque<MessageBuffer*>;
+
+  // connections are added from the engine threads as they are accepted
+  MessageDispatcher* dispatcher_(){
+    std::lock_guard<std::mutex> lock(dispatchersMutex_);
+    return dispatchers_[0];
+  }
+
+  // waits until the peer of rank has connected
+  MessageDispatcher* dispatcherFor_(int rank){
+    if(rank >= 0 && rank < int(NUM_FAST_RANKS)){
+      if(MessageDispatcher* d = 
+         fastRanks_[rank].load(std::memory_order_acquire)){
+        return d;
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(ranksMutex_);
+    auto itr = ranks_.find(rank);
+    if(itr == ranks_.end()){
+      lock.unlock();
+      connectOnDemand(rank);
+      lock.lock();
+    }
+
+    ranksCond_.wait(lock, [&]{
+      itr = ranks_.find(rank);
+      return itr != ranks_.end();
+    });
+    return itr->second;
+  }
+
+  void signalBarrier_(uint32_t round){
+    BarrierMessage bm;
+    bm.epoch = arrived_;
+    bm.round = round;
+    barrierPeers_[round]->send(new MessageBuffer(bm, true));
+  }
+
+  // moves on to the next round for each one whose signal has arrived,
+  // a peer may be one epoch ahead, so its signals are kept by epoch
+  void advanceBarrier_(){
+    if(completed_ == arrived_){
+      return;
+    }
+
+    uint32_t& received = barrierRounds_[arrived_];
+
+    while(round_ < rounds_ && (received & (1u << round_))){
+      if(++round_ < rounds_){
+        signalBarrier_(round_);
+      }
+    }
+
+    if(round_ == rounds_){
+      barrierRounds_.erase(arrived_);
+      completed_ = arrived_;
+      barrierCond_.notify_all();
+    }
+  }
+
+  void addRank_(MessageDispatcher* dispatcher, const RankMessage& rm){
+    std::lock_guard<std::mutex> lock(ranksMutex_);
+
+    dispatcher->setCredits(rm.credits);
+
+    // the rank of a rail is known on both ends, the connecting one has
+    // added it already
+    if(rm.rail > 0 || dispatcher->rail() > 0){
+      if(dispatcher->rail() == 0){
+        dispatcher->setRail(rm.rail);
+        dispatcher->setRank(rm.rank);
+        rails_[rm.rank].push_back(dispatcher);
+      }
+      return;
+    }
+
+    if(rm.assigned >= 0){
+      rank_ = rm.assigned;
+      Trace::setRank(rank_);
+      RegionProfile::setRank(rank_);
+    }
+
+    int rank = rm.rank;
+
+    if(rank < 0){
+      assert(rank_ >= 0 && "neither end of a connection has a rank");
+
+      while(rank_ == nextRank_ || ranks_.find(nextRank_) != ranks_.end()){
+        ++nextRank_;
+      }
+      rank = nextRank_++;
+
+      RankMessage reply;
+      reply.rank = rank_;
+      reply.assigned = rank;
+      dispatcher->send(new MessageBuffer(reply, true));
+    }
+
+    // two peers connecting to each other on demand at once end up with
+    // two connections, each keeps sending on the first it saw so the
+    // order of its messages is kept
+    dispatcher->setRank(rank);
+    if(ranks_.emplace(rank, dispatcher).second && 
+       rank < int(NUM_FAST_RANKS)){
+      fastRanks_[rank].store(dispatcher, std::memory_order_release);
+    }
+    ranksCond_.notify_all();
+  }
+
+  // the receiver keeps the buffer, so it is copied into one from the pool
+  void sendSelf_(MessageBuffer* buf){
+    buf->gather();
+    MessageType type = buf->type();
+    if(type == MessageType::Stream){
+      type = MessageType::Raw;
+    }
+
+    uint64_t size = buf->size();
+    auto msg = new MessageBuffer(type, size);
+    memcpy(msg->buffer(), buf->buffer(), size);
+    msg->setTag(buf->tag());
+    msg->setSource(rank_);
+    delete buf;
+
+    if(InlineHandler& handler = typeHandlers_[uint8_t(type)]){
+      handler(msg);
+      return;
+    }
+
+    queueReceived_(msg);
+  }
+
+  bool send_(int rank, uint32_t tag, MessageBuffer* buf, bool mayFail){
+    buf->setTag(tag);
+
+    if(rank == rank_){
+      sendSelf_(buf);
+      return true;
+    }
+
+    MessageDispatcher* dispatcher = dispatcherFor_(rank);
+
+    if(buf->type() == MessageType::Raw && buf->size() >= stripeSize_()){
+      std::vector<MessageDispatcher*> rails = railsFor_(rank);
+      if(!rails.empty()){
+        rails.insert(rails.begin(), dispatcher);
+        if(!admit_(rank, rails.data(), rails.size(), 
+                   buf->size() / rails.size(), mayFail)){
+          return false;
+        }
+        sendStriped_(rails, buf);
+        return true;
+      }
+    }
+
+    if(!admit_(rank, &dispatcher, 1, buf->size(), mayFail)){
+      return false;
+    }
+
+    if(buf->type() == MessageType::Raw && rendezvousSize_() > 0 &&
+       buf->size() >= rendezvousSize_()){
+      sendReadyToSend_(dispatcher, buf);
+      return true;
+    }
+
+    dispatcher->send(buf);
+    return true;
+  }
+
+  // ARES_RENDEZVOUS is the size from which a raw message waits for the
+  // receiver to take it before its body is sent, which is then read
+  // into the buffer that the receive was posted into, 256 KB by default,
+  // 0 to always send the body right away
+  static uint64_t rendezvousSize_(){
+    static uint64_t size = []{
+      const char* s = getenv("ARES_RENDEZVOUS");
+      return s ? uint64_t(atoll(s)) : uint64_t(256 * 1024);
+    }();
+    return size;
+  }
+
+  // the message is held until the receiver replies to the header that
+  // goes in its place
+  void sendReadyToSend_(MessageDispatcher* dispatcher, MessageBuffer* buf){
+    uint32_t id = nextRendezvous_.fetch_add(1, std::memory_order_relaxed);
+
+    {
+      std::lock_guard<std::mutex> lock(rendezvousMutex_);
+      pushes_[id] = buf;
+    }
+
+    ReadyToSendMessage rm;
+    rm.size = buf->size();
+    rm.id = id;
+    auto header = new MessageBuffer(rm, true);
+    header->setTag(buf->tag());
+    dispatcher->send(header);
+  }
+
+  // on the engine thread, the receiver has taken the header
+  void sendRendezvous_(MessageDispatcher* dispatcher, uint32_t id){
+    MessageBuffer* msg;
+    {
+      std::lock_guard<std::mutex> lock(rendezvousMutex_);
+      auto itr = pushes_.find(id);
+      assert(itr != pushes_.end());
+      msg = itr->second;
+      pushes_.erase(itr);
+    }
+
+    msg->setType(MessageType::Rendezvous);
+    msg->setTag(id);
+    dispatcher->send(msg);
+  }
+
+  // a rendezvous that a receive has taken, whose body is read into the
+  // buffer of request if it fits, spliced to its descriptor if it has
+  // one and the connection can, otherwise read into one from the pool.
+  // Without a request the body is received like any other message once
+  // it has arrived.
+  void pull_(MessageBuffer* rts, CommRequest* request){
+    auto rm = rts->as<ReadyToSendMessage>();
+    uint64_t size = rm->size;
+    uint32_t id = rm->id;
+    int source = rts->source();
+
+    MessageDispatcher* dispatcher = dispatcherFor_(source);
+
+    MessageBuffer* target;
+    if(request && request->buffer() && size <= request->capacity()){
+      target = new MessageBuffer(MessageType::Rendezvous, request->buffer(),
+                                 size, false);
+    }
+    else if(request && request->file() >= 0 && dispatcher->canSplice()){
+      target = new MessageBuffer(MessageType::Rendezvous, nullptr, size,
+                                 false);
+      target->setFile(request->file());
+    }
+    else{
+      target = new MessageBuffer(MessageType::Rendezvous, size);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(rendezvousMutex_);
+      pulls_[{source, id}] = {target, request, rts->tag()};
+    }
+
+    delete rts;
+
+    ReadyToReceiveMessage reply;
+    reply.id = id;
+    dispatcher->send(new MessageBuffer(reply, true));
+  }
+
+  // on the engine thread, the body has been read into the buffer that
+  // rendezvousBuffer() gave, or into another if it did not fit
+  void finishRendezvous_(MessageBuffer* msg){
+    Pull_ pull;
+    {
+      std::lock_guard<std::mutex> lock(rendezvousMutex_);
+      auto itr = pulls_.find({msg->source(), msg->tag()});
+      assert(itr != pulls_.end());
+      pull = itr->second;
+      pulls_.erase(itr);
+    }
+
+    delete pull.msg;
+
+    msg->setType(MessageType::Raw);
+    msg->setTag(pull.tag);
+
+    if(!pull.request){
+      queueReceived_(msg);
+      return;
+    }
+
+    msg->taken();
+    pull.request->complete(msg);
+  }
+
+  // the message a receive took, which for a rendezvous is asked for and
+  // waited for
+  MessageBuffer* fetch_(std::unique_lock<std::mutex>& lock, 
+                        MessageBuffer* msg){
+    if(msg->type() != MessageType::ReadyToSend){
+      return msg;
+    }
+
+    lock.unlock();
+
+    CommRequest request;
+    pull_(msg, &request);
+    return request.wait();
+  }
+
+  void complete_(CommRequest* request, MessageBuffer* msg){
+    if(msg->type() == MessageType::ReadyToSend){
+      pull_(msg, request);
+      return;
+    }
+    request->complete(msg);
+  }
+
+  // true once each of the n connections has room for size bytes, which
+  // a send that may not fail waits for. An engine thread does not wait,
+  // the queue would only drain once it returns.
+  bool admit_(int rank, MessageDispatcher* const* dispatchers, size_t n,
+              uint64_t size, bool mayFail){
+    if(!MessageDispatcher::bounded()){
+      return true;
+    }
+
+    auto full = [&]{
+      for(size_t i = 0; i < n; ++i){
+        if(dispatchers[i]->full(size)){
+          return true;
+        }
+      }
+      return false;
+    };
+
+    if(!full()){
+      return true;
+    }
+
+    if(mayFail){
+      if(SendFullHandler handler = 
+         sendFullHandler_.load(std::memory_order_acquire)){
+        size_t bytes = 0;
+        size_t messages = 0;
+        for(size_t i = 0; i < n; ++i){
+          bytes += dispatchers[i]->queuedBytes();
+          messages += dispatchers[i]->queuedMessages();
+        }
+        return handler(rank, bytes, messages);
+      }
+
+      if(sendFull() == SendFull::Fail){
+        return false;
+      }
+    }
 
-  ~MessageDispatcher(){
-    delete sendChannel_;
-    delete receiveChannel_;
-  }
+    if(ProgressEngine::onEngine()){
+      return true;
+    }
 
-  void setSendThread(std::thread* t){
-    sendThread_ = t;
-  }
+    // counted first, so the engine either sees the waiter or the waiter
+    // sees the room the engine made
+    ++sendWaiters_;
+    {
+      std::unique_lock<std::mutex> lock(sendMutex_);
+      while(full()){
+        waitOrRun(lock, sendCond_);
+      }
+    }
+    --sendWaiters_;
 
-  void setReceiveThread(std::thread* t){
-    receiveThread_ = t;
+    return true;
   }
 
-  void runSend(){
-    for(;;){
-      sendSem_.acquire();
-      sendMutex_.lock();
-      MessageBuffer* msg = sendQueue_.front();
-      sendQueue_.pop_front();
-      sendMutex_.unlock();
-
-      uint32_t size = msg->size();
-      char sbuf[5];
-      memcpy(sbuf, &size, 4);
-      sbuf[4] = char(msg->type());
-      sendChannel_->send(sbuf, 5);
-      sendChannel_->send(msg->buffer(), size);
-
-      delete msg;
-    }
+  // ARES_STRIPE is the size from which a message to a peer with rails
+  // is striped, 2 MB by default
+  static uint64_t stripeSize_(){
+    static uint64_t size = []{
+      const char* s = getenv("ARES_STRIPE");
+      return s ? uint64_t(atoll(s)) : uint64_t(4 * STRIPE_CHUNK);
+    }();
+    return size;
   }
 
-  void runReceive(){
-    for(;;){
-      char sbuf[5];
-      receiveChannel_->receive(sbuf, 5);
-      uint32_t size = *((uint32_t*)sbuf);
-      MessageType type = MessageType(sbuf[4]);
+  MessageDispatcherVec railsFor_(int rank){
+    std::lock_guard<std::mutex> lock(ranksMutex_);
+    auto itr = rails_.find(rank);
+    return itr != rails_.end() ? itr->second : MessageDispatcherVec();
+  }
 
-      MessageBuffer* msg = new MessageBuffer(type, size, false);
-      receiveChannel_->receive(msg->buffer(), size);
+  // the chunks of a striped message not yet written, it is done with,
+  // which completes its request, once all of them are
+  struct StripeSend{
+    MessageBuffer* msg;
+    std::atomic<uint32_t> pending;
+  };
 
-      if(handler_->handleMessage(msg)){
-        delete msg;
-        continue;
+  // the header goes on the first rail, in order with the other
+  // messages, then chunk i on rail i modulo their number. Each chunk
+  // refers to the bytes of buf, which are not copied.
+  void sendStriped_(const MessageDispatcherVec& rails, MessageBuffer* buf){
+    uint64_t size = buf->size();
+    uint32_t numChunks = uint32_t((size + STRIPE_CHUNK - 1) / STRIPE_CHUNK);
+    uint32_t id = nextStripe_.fetch_add(1, std::memory_order_relaxed);
+
+    StripeMessage sm;
+    sm.size = size;
+    sm.id = id;
+    sm.messageType = uint32_t(buf->type());
+    auto header = new MessageBuffer(sm, true);
+    header->setTag(buf->tag());
+    rails[0]->send(header);
+
+    iovec whole = {buf->buffer(), size};
+    const iovec* segments = buf->numSegments() ? buf->segments() : &whole;
+
+    auto stripe = new StripeSend;
+    stripe->msg = buf;
+    stripe->pending = numChunks;
+
+    std::vector<iovec> pieces;
+    uint32_t segment = 0;
+    uint64_t segmentOffset = 0;
+
+    for(uint32_t i = 0; i < numChunks; ++i){
+      uint64_t left = std::min(STRIPE_CHUNK, size - i * STRIPE_CHUNK);
+      pieces.clear();
+
+      while(left > 0){
+        const iovec& seg = segments[segment];
+        uint64_t n = std::min<uint64_t>(left, seg.iov_len - segmentOffset);
+        if(n > 0){
+          pieces.push_back({static_cast<char*>(seg.iov_base) + segmentOffset,
+                            n});
+        }
+        left -= n;
+        segmentOffset += n;
+        if(segmentOffset == seg.iov_len){
+          ++segment;
+          segmentOffset = 0;
+        }
       }
 
-      receiveMutex_.lock();
-      receiveQueue_.push_back(msg);
-      receiveMutex_.unlock();
-      receiveSem_.release();
+      StripeChunk chunk = {size, id, i};
+      auto msg = new MessageBuffer(MessageType::StripeChunk, &chunk,
+                                   sizeof(chunk), pieces.data(),
+                                   pieces.size());
+      msg->setTag(buf->tag());
+
+      auto request = new CommRequest;
+      request->onComplete([request, stripe]{
+        delete request;
+        if(stripe->pending.fetch_sub(1, std::memory_order_acq_rel) == 1){
+          delete stripe->msg;
+          delete stripe;
+        }
+      });
+      msg->setRequest(request);
+
+      rails[i % rails.size()]->send(msg);
     }
   }
 
-  void send(MessageBuffer* msg){
-    sendMutex_.lock();
-    sendQueue_.push_back(msg);
-    sendMutex_.unlock();
-    sendSem_.release();
-  }
+  // a striped message being put together from its chunks, which may
+  // arrive before its header
+  struct StripeReceive{
+    uint32_t id;
+    MessageBuffer* msg;
+    uint32_t pending;
+    bool header;
+  };
 
-  MessageBuffer* receive(){
-    receiveSem_.acquire();
-    receiveMutex_.lock();
-    MessageBuffer* msg = receiveQueue_.front();
-    receiveQueue_.pop_front();
-    receiveMutex_.unlock();
-    return msg;
+  StripeReceive* stripeReceive_(int source, uint32_t id, uint64_t size){
+    StripeReceive*& r = stripes_[{source, id}];
+    if(!r){
+      r = new StripeReceive;
+      r->id = id;
+      r->msg = new MessageBuffer(MessageType::Raw, size);
+      r->pending = uint32_t((size + STRIPE_CHUNK - 1) / STRIPE_CHUNK);
+      r->header = false;
+    }
+    return r;
   }
 
-private:
-  std::thread* sendThread_;
-  std::thread* receiveThread_;
-  Channel* sendChannel_;
-  Channel* receiveChannel_;
+  // a message held behind a striped one, or the striped one itself
+  struct Held{
+    StripeReceive* stripe;
+    MessageBuffer* msg;
+  };
 
-  CVSemaphore sendSem_;
-  std::mutex sendMutex_;
-  std::deque<MessageBuffer*> sendQueue_;
-  
-  CVSemaphore receiveSem_;
-  std::mutex receiveMutex_;
-  std::deque<MessageBuffer*> receiveQueue_;
+  // the messages of source after the header wait behind it until the
+  // striped message is complete
+  void receiveStriped_(MessageBuffer* msg){
+    auto sm = msg->as<StripeMessage>();
+    int source = msg->source();
 
-  MessageHandler* handler_;
-};
+    std::lock_guard<std::mutex> lock(stripeMutex_);
 
-class Communicator : public MessageHandler{
-public:
-  class Barrier{
-  public:
-    Barrier(int n)
-    : sem_(n){}
+    StripeReceive* r = stripeReceive_(source, sm->id, sm->size);
+    r->header = true;
+    r->msg->setTag(msg->tag());
+    r->msg->setSource(source);
 
-    void release(){
-      sem_.release();
+    std::deque<Held>& held = held_[source];
+    if(held.empty()){
+      numHeld_.fetch_add(1, std::memory_order_acq_rel);
     }
+    held.push_back({r, nullptr});
+    releaseHeld_(source);
+  }
 
-    void acquire(){
-      sem_.acquire();
+  // chunks are copied in on the engine thread of the rail that they
+  // arrived on, so that the rails are put together in parallel
+  void receiveChunk_(MessageBuffer* msg){
+    StripeChunk chunk;
+    memcpy(&chunk, msg->buffer(), sizeof(chunk));
+    int source = msg->source();
+
+    StripeReceive* r;
+    {
+      std::lock_guard<std::mutex> lock(stripeMutex_);
+      r = stripeReceive_(source, chunk.id, chunk.size);
     }
 
-  private:
-    CVSemaphore sem_;
-  };
+    memcpy(r->msg->buffer() + chunk.index * STRIPE_CHUNK,
+           msg->buffer() + sizeof(chunk), msg->size() - sizeof(chunk));
 
-  virtual ~Communicator(){
-    for(MessageDispatcher* h : dispatchers_){
-      delete h;
+    std::lock_guard<std::mutex> lock(stripeMutex_);
+    if(--r->pending == 0 && r->header){
+      releaseHeld_(source);
     }
   }
 
-  void addDispatcher(MessageDispatcher* dispatcher){
-    dispatchers_.push_back(dispatcher);
+  // called with the lock, queues what is no longer behind a striped
+  // message that is yet to be complete
+  void releaseHeld_(int source){
+    std::deque<Held>& held = held_[source];
 
-    auto sendThread = new std::thread(&MessageDispatcher::runSend, dispatcher);
-    dispatcher->setSendThread(sendThread);
+    while(!held.empty()){
+      Held h = held.front();
 
-    auto receiveThread = new std::thread(&MessageDispatcher::runReceive, dispatcher);
-    dispatcher->setReceiveThread(receiveThread);
-  }
+      if(h.stripe){
+        StripeReceive* r = h.stripe;
+        if(r->pending > 0){
+          return;
+        }
 
-  void send(MessageBuffer* buf){
-    dispatchers_[0]->send(buf);
+        stripes_.erase({source, r->id});
+        h.msg = r->msg;
+        delete r;
+      }
+
+      held.pop_front();
+      queueReceived_(h.msg);
+    }
+
+    held_.erase(source);
+    numHeld_.fetch_sub(1, std::memory_order_acq_rel);
   }
 
-  MessageBuffer* receive(){
-    return dispatchers_[0]->receive();
+  // queued in the order that the peer sent them, so behind a striped
+  // message that came before, right away if none is held
+  void queueOrdered_(MessageBuffer* msg){
+    if(numHeld_.load(std::memory_order_acquire) == 0){
+      queueReceived_(msg);
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(stripeMutex_);
+    auto itr = held_.find(msg->source());
+    if(itr == held_.end()){
+      queueReceived_(msg);
+      return;
+    }
+    itr->second.push_back({nullptr, msg});
   }
 
-  void createdConnection(){
-    ++numConnections_;
+  // receives posted for the message, first come first served, have it
+  // before the queue
+  void queueReceived_(MessageBuffer* msg){
+    receiveMutex_.lock();
+
+    // a stream's body has yet to arrive, which the handler cannot wait
+    // for, that of a rendezvous is asked for and handled once it has
+    bool rendezvous = msg->type() == MessageType::ReadyToSend;
+    if(!tagHandlers_.empty() && 
+       (msg->type() == MessageType::Raw || rendezvous)){
+      auto itr = tagHandlers_.find(msg->tag());
+      if(itr != tagHandlers_.end()){
+        InlineHandler handler = itr->second;
+        receiveMutex_.unlock();
+        msg->taken();
+        if(rendezvous){
+          pull_(msg, nullptr);
+        }
+        else{
+          handler(msg);
+        }
+        return;
+      }
+    }
+
+    for(auto itr = posted_.begin(); itr != posted_.end(); ++itr){
+      CommRequest* request = *itr;
+      if(request->matches(msg->source(), msg->tag())){
+        posted_.erase(itr);
+        receiveMutex_.unlock();
+        msg->taken();
+        complete_(request, msg);
+        return;
+      }
+    }
+
+    received_[{msg->source(), msg->tag()}].push_back(msg);
+    receivedCount_.fetch_add(1, std::memory_order_release);
+    receiveMutex_.unlock();
+    receiveCond_.notify_all();
   }
 
-  virtual bool isListener() = 0; 
+  // a remote operation waiting for the peer to complete it
+  struct PendingRemote{
+    void* buf;
+    bool done;
+  };
 
-  void barrier(){
-    assert(barrier_);
+  bool remote_(MessageDispatcher* dispatcher, MessageType type, void* buf,
+               size_t size, uint64_t addr){
+    bool write = type == MessageType::RemoteWrite;
 
-    BarrierMessage bm;
-    auto msg = new MessageBuffer(bm, true);
+    auto msg = new MessageBuffer(type, sizeof(RemoteOp) + (write ? size : 0));
+    RemoteOp* op = msg->as<RemoteOp>();
+    op->addr = addr;
+    op->size = size;
+
+    if(write){
+      memcpy(op + 1, buf, size);
+    }
+
+    PendingRemote pending = {buf, false};
+
+    std::unique_lock<std::mutex> lock(remoteMutex_);
+    op->id = nextRemote_++;
+    remotes_[op->id] = &pending;
+    lock.unlock();
+
+    dispatcher->send(msg);
 
-    send(msg);
+    lock.lock();
+    remoteCond_.wait(lock, [&]{
+      return pending.done;
+    });
 
-    barrier_->acquire();
+    return true;
   }
 
-  void init(size_t groupSize){
-    assert(!barrier_);
-    barrier_ = new Barrier(2 - (int)groupSize);
+  // the key is the address itself for peers that are not on verbs
+  void serveRemote_(MessageDispatcher* dispatcher, MessageBuffer* msg){
+    RemoteOp* op = msg->as<RemoteOp>();
+    char* addr = reinterpret_cast<char*>(op->addr);
+
+    bool write = msg->type() == MessageType::RemoteWrite;
+    if(write){
+      memcpy(addr, op + 1, op->size);
+    }
+
+    auto reply = new MessageBuffer(MessageType::RemoteDone, 
+                                   sizeof(RemoteOp) + (write ? 0 : op->size));
+    RemoteOp* done = reply->as<RemoteOp>();
+    *done = *op;
+
+    if(!write){
+      memcpy(done + 1, addr, op->size);
+    }
+
+    dispatcher->send(reply);
   }
 
-  bool handleMessage(MessageBuffer* msg) override{
-    switch(msg->type()){
-      case MessageType::Barrier:{
-        auto bm = msg->as<BarrierMessage>();
-        assert(barrier_);
-        barrier_->release();
-        return true;
-      }
-      default:
-        return false;
+  void completeRemote_(MessageBuffer* msg){
+    RemoteOp* op = msg->as<RemoteOp>();
+
+    std::lock_guard<std::mutex> lock(remoteMutex_);
+    auto itr = remotes_.find(op->id);
+    assert(itr != remotes_.end());
+
+    // a read carries the data back
+    if(msg->size() > sizeof(RemoteOp)){
+      memcpy(itr->second->buf, op + 1, op->size);
     }
+
+    itr->second->done = true;
+    remotes_.erase(itr);
+    remoteCond_.notify_all();
   }
 
-private:
-  using MessageDispatcherVec = std::vector<MessageDispatcher*>;
+  static MessageBuffer* pop_(MessageQueue& queue){
+    MessageBuffer* msg = queue.front();
+    queue.pop_front();
+    msg->taken();
+    return msg;
+  }
 
+  std::mutex dispatchersMutex_;
   MessageDispatcherVec dispatchers_;
-  Barrier* barrier_ = nullptr;
+
+  // the dispatchers again, as a list that is only ever prepended to,
+  // for peerStats()
+  struct Published_{
+    MessageDispatcher* dispatcher;
+    Published_* next;
+  };
+
+  std::atomic<Published_*> published_{nullptr};
   size_t numConnections_ = 0;
+  size_t groupSize_ = 0;
+
+  std::atomic<int> rank_{-1};
+  std::mutex ranksMutex_;
+  std::condition_variable ranksCond_;
+  std::unordered_map<int, MessageDispatcher*> ranks_;
+  int nextRank_ = 1;
+
+  // the connections of the lower ranks, which a send finds without
+  // taking ranksMutex_. A rank keeps its first connection.
+  static const size_t NUM_FAST_RANKS = 1024;
+  std::atomic<MessageDispatcher*> fastRanks_[NUM_FAST_RANKS] = {};
+
+  std::mutex receiveMutex_;
+  std::condition_variable receiveCond_;
+  std::atomic<uint64_t> receivedCount_{0};
+  std::map<RankTagPair, MessageQueue> received_;
+  std::deque<CommRequest*> posted_;
+
+  InlineHandler typeHandlers_[256];
+  std::unordered_map<uint32_t, InlineHandler> tagHandlers_;
+
+  uint32_t rounds_ = 0;
+  MessageDispatcherVec barrierPeers_;
+  std::mutex barrierMutex_;
+  std::condition_variable barrierCond_;
+  uint64_t arrived_ = 0;
+  uint64_t completed_ = 0;
+  uint32_t round_ = 0;
+  std::unordered_map<uint64_t, uint32_t> barrierRounds_;
+
+  std::mutex remoteMutex_;
+  std::condition_variable remoteCond_;
+  uint64_t nextRemote_ = 0;
+  std::unordered_map<uint64_t, PendingRemote*> remotes_;
+
+  std::atomic<SendFullHandler> sendFullHandler_{nullptr};
+  std::atomic<size_t> sendWaiters_{0};
+  std::mutex sendMutex_;
+  std::condition_variable sendCond_;
+
+  std::unordered_map<int, MessageDispatcherVec> rails_;
+  std::atomic<uint32_t> nextStripe_{0};
+  std::mutex stripeMutex_;
+  std::map<std::pair<int, uint32_t>, StripeReceive*> stripes_;
+  std::unordered_map<int, std::deque<Held>> held_;
+  std::atomic<size_t> numHeld_{0};
+
+  // a rendezvous that a receive has taken and whose body is on its way,
+  // by the rank of the sender and the id
+  struct Pull_{
+    MessageBuffer* msg;
+    CommRequest* request;
+    uint32_t tag;
+  };
+
+  std::mutex rendezvousMutex_;
+  std::atomic<uint32_t> nextRendezvous_{0};
+  std::unordered_map<uint32_t, MessageBuffer*> pushes_;
+  std::map<std::pair<int, uint32_t>, Pull_> pulls_;
 };
 
-class SocketCommunicator : public Communicator{
+class SocketCommunicator : public Communicator,
+                           public ProgressEngine::Handler{
 public:
   SocketCommunicator(){}
 
+  ~SocketCommunicator(){
+    if(listenEngine_){
+      listenEngine_->remove(listenFD_);
+      close(listenFD_);
+    }
+  }
+
   bool listen(int port){
     listenFD_ = socket(PF_INET, SOCK_STREAM, 0);
     
@@ -395,6 +3588,9 @@ public:
                SO_REUSEADDR,
                &so_reuseaddr,
                sizeof(so_reuseaddr));
+
+    // accepted sockets inherit the buffer sizes
+    setBuffers_(listenFD_);
     
     sockaddr_in addr;
     
@@ -411,70 +3607,129 @@ public:
       return false;
     }
     
-    port_ = port;
+    // port 0 has the kernel pick one
+    socklen_t len = sizeof(addr);
+    getsockname(listenFD_, (sockaddr*)&addr, &len);
+    port_ = ntohs(addr.sin_port);
 
-    auto t = new std::thread(&SocketCommunicator::accept_, this);
+    setDefaultRank();
+
+    fcntl(listenFD_, F_SETFL, fcntl(listenFD_, F_GETFL) | O_NONBLOCK);
+
+    // connections are accepted by an engine rather than a thread of their own
+    listenEngine_ = ProgressEngine::next();
+    listenEngine_->add(this, listenFD_, EPOLLIN);
 
     return true;
   }
 
+  // retries until ARES_CONNECT_TIMEOUT seconds have passed, 30 by
+  // default, so a peer may start listening after this one connects
   bool connect(const std::string& host, int port){
-    hostent* h;
-    h = gethostbyname(host.c_str());
-    if(!h){
-      return false;
+    auto deadline = Clock::now() + connectTimeout_();
+    auto backoff = std::chrono::milliseconds(int(MIN_BACKOFF));
+
+    for(;;){
+      int fd = dial_(host, port);
+      if(fd >= 0){
+        return connected_(fd, host, port);
+      }
+
+      if(!retry_(backoff, deadline)){
+        return false;
+      }
     }
-    
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    
-    if(fd < 0){
+  }
+
+  // the processes of a group each listen on a port of their own, which
+  // they publish through the directory dir, and connect to the ranks
+  // below theirs in parallel, ARES_RANK gives each its rank, with
+  // ARES_LAZY_CONNECT set a connection is made the first time this
+  // process sends to a peer rather than up front
+  bool bootstrap(const std::string& dir, size_t groupSize){
+    assert(rank() >= 0 && "ARES_RANK is needed to bootstrap");
+
+    if(!listen(0)){
       return false;
     }
-    
-    int reuseOn = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseOn, sizeof(reuseOn));
-    
-    sockaddr_in addr;
-    bzero((char*)&addr, sizeof(addr));
-    addr.sin_family = AF_INET;
-    bcopy((char*)h->h_addr,
-          (char*)&addr.sin_addr.s_addr,
-          h->h_length);
-    addr.sin_port = htons(port);
-    
-    if(::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
-      return false;
+
+    bootstrap_.reset(new Bootstrap(dir));
+    bootstrap_->publish(rank(), hostName_(), port_);
+
+    init(groupSize);
+
+    lazy_ = getenv("ARES_LAZY_CONNECT") != nullptr;
+    if(lazy_){
+      return true;
     }
-    
-    auto channel = new SocketChannel(fd);
-    auto dispatcher = new MessageDispatcher(this, channel, channel);
 
-    addDispatcher(dispatcher);
+    auto deadline = Clock::now() + connectTimeout_();
 
-    return true;
+    int below = rank();
+    std::atomic<int> next(0);
+    std::atomic<bool> ok(true);
+
+    auto connectBelow = [&]{
+      for(int r = next++; r < below; r = next++){
+        if(!connectRank_(r, deadline)){
+          ok = false;
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < std::min(size_t(below), connectThreads_()); ++i){
+      threads.emplace_back(connectBelow);
+    }
+
+    for(auto& t : threads){
+      t.join();
+    }
+
+    // the ranks above connect to this one
+    return ok && waitForPeers(groupSize - 1, deadline);
   }
 
-  void accept_(){
+  void connectOnDemand(int rank) override{
+    if(!lazy_){
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(connectMutex_);
+      if(!connecting_.insert(rank).second){
+        return;
+      }
+    }
+
+    if(!connectRank_(rank, Clock::now() + connectTimeout_())){
+      fprintf(stderr, "ares: could not connect to rank %d\n", rank);
+    }
+  }
+
+  void handleEvent() override{
     for(;;){
-      int opts = fcntl(listenFD_, F_GETFL);
-      opts &= ~O_NONBLOCK;
-      
-      fcntl(listenFD_, F_SETFL, opts);
-      
       sockaddr addr;
       socklen_t len = sizeof(sockaddr);
             
       int fd = ::accept(listenFD_, &addr, &len);
       
       if(fd < 0){
-        continue;
+        if(errno == EINTR || errno == ECONNABORTED){
+          continue;
+        }
+        return;
       }
       
       int reuseOn = 1;
       setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, 
                  &reuseOn, sizeof(reuseOn));
 
-      auto channel = new SocketChannel(fd);
+      Channel* channel = createChannel_(fd, false);
+      if(!channel){
+        continue;
+      }
+
       auto dispatcher = new MessageDispatcher(this, channel, channel);
 
       addDispatcher(dispatcher);
@@ -488,8 +3743,268 @@ public:
   }
 
 private:
+  using Clock = std::chrono::steady_clock;
+
+  // seconds that the blocking handshakes wait for the peer
+  static const int HANDSHAKE_TIMEOUT = 5;
+
+  // milliseconds between attempts to connect, doubling from the first
+  static const int MIN_BACKOFF = 10;
+  static const int MAX_BACKOFF = 1000;
+
+  static Clock::duration connectTimeout_(){
+    static int seconds = []{
+      const char* s = getenv("ARES_CONNECT_TIMEOUT");
+      return s ? atoi(s) : 30;
+    }();
+    return std::chrono::seconds(seconds);
+  }
+
+  // ARES_CONNECT_THREADS connections are made at once when bootstrapping
+  static size_t connectThreads_(){
+    static size_t n = []{
+      const char* s = getenv("ARES_CONNECT_THREADS");
+      return s ? size_t(std::max(atoi(s), 1)) : size_t(16);
+    }();
+    return n;
+  }
+
+  // ARES_HOST is the name peers reach this one by
+  static std::string hostName_(){
+    if(const char* h = getenv("ARES_HOST")){
+      return h;
+    }
+
+    char name[256];
+    if(gethostname(name, sizeof(name)) != 0){
+      return "localhost";
+    }
+    name[sizeof(name) - 1] = '\0';
+    return name;
+  }
+
+  // ARES_RAILS is the number of connections made to each peer, 1 by
+  // default, large messages are striped over them
+  static size_t rails_(){
+    static size_t n = []{
+      const char* s = getenv("ARES_RAILS");
+      return s ? size_t(std::max(atoi(s), 1)) : size_t(1);
+    }();
+    return n;
+  }
+
+  // ARES_RAIL_ADDRS is a comma separated list of local addresses that
+  // rail i is bound to the i-th of, modulo their number, to spread the
+  // rails over several adapters
+  static const std::vector<std::string>& railAddrs_(){
+    static std::vector<std::string> addrs = []{
+      std::vector<std::string> v;
+      const char* s = getenv("ARES_RAIL_ADDRS");
+      if(s){
+        std::istringstream istr(s);
+        std::string a;
+        while(std::getline(istr, a, ',')){
+          if(!a.empty()){
+            v.push_back(a);
+          }
+        }
+      }
+      return v;
+    }();
+    return addrs;
+  }
+
+  // a connected socket, -1 with errno set if not
+  static int dial_(const std::string& host, int port, size_t rail = 0){
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* result;
+    int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(),
+                             &hints, &result);
+    if(status != 0){
+      errno = status == EAI_AGAIN ? EAGAIN : EINVAL;
+      return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    
+    if(fd >= 0){
+      int reuseOn = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseOn, sizeof(reuseOn));
+
+      // before connecting, so the window scale is negotiated for them
+      setBuffers_(fd);
+
+      const std::vector<std::string>& addrs = railAddrs_();
+      if(!addrs.empty()){
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        inet_pton(AF_INET, addrs[rail % addrs.size()].c_str(),
+                  &local.sin_addr);
+        ::bind(fd, (const sockaddr*)&local, sizeof(local));
+      }
+
+      if(::connect(fd, result->ai_addr, result->ai_addrlen) < 0){
+        int error = errno;
+        close(fd);
+        fd = -1;
+        errno = error;
+      }
+    }
+
+    freeaddrinfo(result);
+    return fd;
+  }
+
+  // waits before the next attempt if the last one failed in a way that
+  // could pass, and there is time for it
+  static bool retry_(std::chrono::milliseconds& backoff,
+                     Clock::time_point deadline){
+    switch(errno){
+      case ECONNREFUSED:
+      case ECONNRESET:
+      case ETIMEDOUT:
+      case EHOSTUNREACH:
+      case ENETUNREACH:
+      case EAGAIN:
+      case EINTR:
+        break;
+      default:
+        return false;
+    }
+
+    if(Clock::now() + backoff > deadline){
+      return false;
+    }
+
+    std::this_thread::sleep_for(backoff);
+    backoff = std::min(backoff * 2,
+                       std::chrono::milliseconds(int(MAX_BACKOFF)));
+    return true;
+  }
+
+  // the rails are connected once the first connection has the ranks
+  // of both ends, a peer is still reached without those that fail
+  bool connected_(int fd, const std::string& host, int port){
+    Channel* channel = createChannel_(fd, true);
+    if(!channel){
+      return false;
+    }
+
+    auto dispatcher = new MessageDispatcher(this, channel, channel);
+
+    addDispatcher(dispatcher);
+    waitForRanks(dispatcher);
+
+    for(size_t r = 1; r < rails_(); ++r){
+      int railFD = dial_(host, port, r);
+      Channel* rail = railFD >= 0 ? createChannel_(railFD, true) : nullptr;
+      if(!rail){
+        fprintf(stderr, "ares: could not connect rail %zu to rank %d\n",
+                r, dispatcher->rank());
+        break;
+      }
+
+      auto d = new MessageDispatcher(this, rail, rail);
+      d->setRail(int(r));
+      addRail(dispatcher->rank(), d);
+      addDispatcher(d);
+    }
+
+    return true;
+  }
+
+  // the endpoint is looked up again on each attempt, the one found may
+  // have been left by an earlier run of a peer that has not restarted yet
+  bool connectRank_(int rank, Clock::time_point deadline){
+    auto backoff = std::chrono::milliseconds(int(MIN_BACKOFF));
+
+    for(;;){
+      std::string host;
+      int port;
+      if(!bootstrap_->lookup(rank, host, port, deadline)){
+        return false;
+      }
+
+      int fd = dial_(host, port);
+      if(fd >= 0){
+        if(connected_(fd, host, port)){
+          return true;
+        }
+        errno = ECONNRESET;
+      }
+
+      if(!retry_(backoff, deadline)){
+        return false;
+      }
+    }
+  }
+
+  // ARES_SOCKET_BUFFER sets the kernel's send and receive buffer sizes,
+  // left unset they are tuned by the kernel, which setting them disables
+  static void setBuffers_(int fd){
+    static int size = []{
+      const char* s = getenv("ARES_SOCKET_BUFFER");
+      return s ? atoi(s) : 0;
+    }();
+
+    if(size > 0){
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+  }
+
+  static void setTimeout_(int fd, int seconds){
+    timeval tv = {seconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+
+  // peers on this host are moved to shared memory, others to a verbs
+  // queue pair if both ends have an adapter, the rest stay on TCP
+  static Channel* createChannel_(int fd, bool connector){
+    setTimeout_(fd, HANDSHAKE_TIMEOUT);
+
+    Channel* channel;
+    bool ok = connector ? ShmChannel::connect(fd, channel) :
+      ShmChannel::accept(fd, channel);
+
+    if(!ok){
+      return nullptr;
+    }
+
+    if(channel){
+      setTimeout_(fd, 0);
+      return channel;
+    }
+
+#ifdef ARES_HAVE_IBVERBS
+    // the socket is closed once the queue pair is connected
+    ok = connector ? VerbsChannel::connect(fd, channel) :
+      VerbsChannel::accept(fd, channel);
+
+    if(!ok){
+      return nullptr;
+    }
+
+    if(channel){
+      return channel;
+    }
+#endif
+
+    setTimeout_(fd, 0);
+    return new SocketChannel(fd);
+  }
+
   int port_ = -1;
   int listenFD_ = -1;
+  ProgressEngine* listenEngine_ = nullptr;
+
+  std::unique_ptr<Bootstrap> bootstrap_;
+  bool lazy_ = false;
+  std::mutex connectMutex_;
+  std::set<int> connecting_;
 };
 
 class FIFOCommunicator : public Communicator{
@@ -497,22 +4012,26 @@ public:
   FIFOCommunicator(){}
 
   bool listen(const std::string& sendPath, const std::string& receivePath){
-    int status = mkfifo(sendPath.c_str(), S_IWUSR|S_IRUSR);
-    assert(status == 0);
-
-    status = mkfifo(receivePath.c_str(), S_IWUSR|S_IRUSR);
-    assert(status == 0);
+    if(!makeFIFO_(sendPath) || !makeFIFO_(receivePath)){
+      return false;
+    }
 
     int sendFD = open(sendPath.c_str(), O_WRONLY);
-    assert(sendFD > 0);
+    if(sendFD < 0){
+      return false;
+    }
 
     int receiveFD = open(receivePath.c_str(), O_RDONLY);
-    assert(receiveFD > 0);
+    if(receiveFD < 0){
+      close(sendFD);
+      return false;
+    }
 
     auto sendChannel = new FIFOChannel(sendFD);
     auto receiveChannel = new FIFOChannel(receiveFD);
     auto dispatcher = new MessageDispatcher(this, sendChannel, receiveChannel);
 
+    setDefaultRank();
     addDispatcher(dispatcher);
 
     isListener_ = true;
@@ -524,16 +4043,22 @@ public:
 
   bool connect(const std::string& sendPath, const std::string& receivePath){
     int receiveFD = open(receivePath.c_str(), O_RDONLY);
-    assert(receiveFD > 0);
+    if(receiveFD < 0){
+      return false;
+    }
 
     int sendFD = open(sendPath.c_str(), O_WRONLY);
-    assert(sendFD > 0);
+    if(sendFD < 0){
+      close(receiveFD);
+      return false;
+    }
 
     auto sendChannel = new FIFOChannel(sendFD);
     auto receiveChannel = new FIFOChannel(receiveFD);
     auto dispatcher = new MessageDispatcher(this, sendChannel, receiveChannel);
 
     addDispatcher(dispatcher);
+    waitForRanks(dispatcher);
 
     isListener_ = false;
 
@@ -545,6 +4070,17 @@ public:
   }
 
 private:
+  // one left by an earlier run that did not clean up is used again
+  static bool makeFIFO_(const std::string& path){
+    if(mkfifo(path.c_str(), S_IWUSR|S_IRUSR) == 0){
+      return true;
+    }
+
+    struct stat st;
+    return errno == EEXIST && stat(path.c_str(), &st) == 0 &&
+      S_ISFIFO(st.st_mode);
+  }
+
   bool isListener_ = false;
 };
 
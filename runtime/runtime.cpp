@@ -49,29 +49,78 @@
  * #####
  */
 
-//#define USE_ARGO_BOTS 1
+// default for ARES_SERIAL_THRESHOLD, roughly the cost of queuing and
+// awaiting a range in body instructions
+#ifndef ARES_SERIAL_THRESHOLD_DEFAULT
+#define ARES_SERIAL_THRESHOLD_DEFAULT 20000
+#endif
 
 #include <iostream>
 #include <cmath>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <vector>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <functional>
 #include <cassert>
+#include <cstring>
 #include <deque>
 #include <queue>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-#ifdef USE_ARGO_BOTS
-#include "ArgoPool.h"
-#else
 #include "ThreadPool.h"
+#include "Offload.h"
+
+#ifdef ARES_HAVE_ARGOBOTS
+#include "ArgoPool.hpp"
+#endif
+
+#ifdef ARES_HAVE_CTHREADPOOL
+#include "ThpoolExecutor.h"
+#endif
+
+#ifdef ARES_HAVE_KOKKOS
+#include "KokkosExecutor.h"
+#endif
+
+#ifdef ARES_HAVE_OPENMP
+#include "OpenMPExecutor.h"
 #endif
 
+#include "Allocator.h"
 #include "Barrier.h"
+#include "FramePool.h"
+#include "IOService.h"
+#include "Inspector.h"
+#include "Latch.h"
+#include "MemoTable.h"
+#include "MemoryAccount.h"
+#include "Metrics.h"
+#include "Partitioning.h"
+#include "PerfCounters.h"
+#include "Scratch.h"
+#include "RegionProfile.h"
+#include "TaskSpan.h"
+#include "Trace.h"
+#include "UserRegion.h"
 
 #include "communication.h"
 
+#include "ares/runtime.h"
+#include "ares/thpool.h"
+
 using namespace std;
 using namespace ares;
 
@@ -82,27 +131,81 @@ namespace{
 
   mutex _logMutex;
 
-  static const size_t NUM_THREADS = 32;
 
+  // completes after exactly count calls to release()
   class Synch{
   public:
     Synch(int count)
-    : sem_(1 - count){}
+    : count_(count > 0 ? count : 0),
+    latch_(count > 0 ? 1 : 0),
+    done_(count <= 0){}
 
+    // the continuations are started before the latch opens, so that a
+    // waiter which then deletes the synch cannot race with them
     void release(){
-      sem_.release();
+      if(count_.fetch_sub(1, memory_order_acq_rel) != 1){
+        return;
+      }
+
+      vector<function<void()>> fs;
+
+      mutex_.lock();
+      done_ = true;
+      fs.swap(continuations_);
+      mutex_.unlock();
+
+      for(auto& f : fs){
+        f();
+      }
+
+      latch_.countDown();
+    }
+
+    // completes again after count releases, once it has and its waiter
+    // has returned, with no continuations left to run
+    void reset(int count){
+      count_.store(count > 0 ? count : 0, memory_order_relaxed);
+      done_ = count <= 0;
+      latch_.reset(count > 0 ? 1 : 0);
+    }
+
+    // n more releases to complete after, only while one is still due
+    void add(int n){
+      count_.fetch_add(n, memory_order_relaxed);
     }
 
     void await(){
-      sem_.acquire();
+      latch_.wait();
     }
 
     bool tryAwait(){
-      return sem_.tryAcquire();
+      return latch_.tryWait();
+    }
+
+    // where the paths of the task graph that release it arrive
+    TaskSpan::Join& join(){
+      return join_;
+    }
+
+    // runs f once all releases have happened, right away if they have
+    void then(const function<void()>& f){
+      mutex_.lock();
+      if(done_){
+        mutex_.unlock();
+        f();
+        return;
+      }
+      continuations_.push_back(f);
+      mutex_.unlock();
     }
 
   private:
-    CVSemaphore sem_;
+    atomic<int> count_;
+    Latch latch_;
+    mutex mutex_;
+    bool done_;
+    vector<function<void()>> continuations_;
+    TaskSpan::Join join_;
   };
 
   struct FuncArg{
@@ -116,172 +219,5089 @@ namespace{
     void* args;
   };
 
-  struct TaskArg{
-    TaskArg(Synch* futureSync)
-      : futureSync(futureSync){}
+  // the synch and partials of a lowered reduce, kept between its runs in
+  // a static slot per call site, laid out as { i8*, i8* } for HLIR. A
+  // run takes it out of the slot and puts it back, so runs of the same
+  // site that overlap get one of their own.
+  struct ReduceContext{
+    ReduceContext()
+      : synch(new Synch(1)),
+      partials(nullptr),
+      bytes(0){}
 
-    Synch* futureSync;
-    uint32_t depth;
+    ~ReduceContext(){
+      delete synch;
+      Allocator::release(partials);
+    }
+
+    Synch* synch;
+    void* partials;
+    uint64_t bytes;
   };
 
-#ifdef USE_ARGO_BOTS
-  ArgoPool* _threadPool = new ArgoPool;
-#else
-  ThreadPool* _threadPool = new ThreadPool(NUM_THREADS);
-#endif
+  // kinds of construct an outlined body was lowered from
+  enum RegionKind{
+    REGION_PARALLEL_FOR = 1,
+    REGION_PARALLEL_REDUCE = 2,
+    REGION_PARALLEL_SCAN = 3,
+    REGION_TASK = 4
+  };
 
-  Communicator* _communicator = nullptr;
+  // static descriptor of a construct emitted by HLIR alongside its body,
+  // laid out as { i8*, i8*, i32, i32, i32 }. It may be null, the file is
+  // empty and the line 0 when the source location is not known. stack is
+  // the bytes of stack that the tasks of a task function were given a
+  // hint of, 0 if none.
+  struct RegionDesc{
+    const char* name;
+    const char* file;
+    uint32_t line;
+    uint32_t kind;
+    uint32_t stack;
+  };
 
-} // namespace
+  // the KB of Task::stack that a hint of bytes rounds up to
+  inline uint16_t taskStackKB(uint32_t bytes){
+    return uint16_t(min((uint64_t(bytes) + 1023) >> 10, uint64_t(UINT16_MAX)));
+  }
 
-extern "C"{
+  // the counters of a region are keyed by its descriptor if it has one,
+  // with the low bit set to tell it apart from a body's address
+  inline const void* regionKey(FuncPtr func, const RegionDesc* region){
+    if(region){
+      return reinterpret_cast<const void*>(
+        reinterpret_cast<uintptr_t>(region) | 1);
+    }
 
-  void* __ares_alloc(uint64_t bytes){
-    return malloc(bytes);
+    return reinterpret_cast<const void*>(func);
   }
 
-  void __ares_free(void* ptr){
-    free(ptr);
+  const RegionDesc* regionDesc(const void* key){
+    auto k = reinterpret_cast<uintptr_t>(key);
+    return k & 1 ? reinterpret_cast<const RegionDesc*>(k & ~uintptr_t(1)) :
+      nullptr;
   }
 
-  void* __ares_create_synch(uint32_t count){
-    return new Synch(count);
+  // runs the outlined body of a region, with ARES_PERF_COUNTERS the
+  // hardware counters are attributed to it
+  inline void runRegion(FuncPtr func, const RegionDesc* region, void* arg){
+    PerfCounters::Scope scope(regionKey(func, region));
+    func(arg);
   }
 
-  void* __ares_create_barrier(uint32_t count){
-    return new Barrier(count);
-  }
+  // a queued function with its FuncArg first, so that the body is passed
+  // the FuncArg as usual, for running it through runRegion()
+  struct FuncRegion{
+    FuncRegion(Synch* synch, int n, void* args, FuncPtr func,
+               const RegionDesc* region)
+      : arg(synch, n, args),
+      func(func),
+      region(region){}
 
-  void __ares_wait_barrier(void* barrier){
-    auto b = static_cast<Barrier*>(barrier);
-    b->wait();
-  }
+    FuncArg arg;
+    FuncPtr func;
+    const RegionDesc* region;
+  };
 
-  void __ares_delete_barrier(void* barrier){
-    auto b = static_cast<Barrier*>(barrier);
-    delete b;
+  void runFuncRegion(void* arg){
+    auto r = static_cast<FuncRegion*>(arg);
+    runRegion(r->func, r->region, &r->arg);
   }
 
-  void __ares_queue_func(void* synch, void* args, void* fp,
-                         uint32_t index, uint32_t priority){
-    _threadPool->push(reinterpret_cast<FuncPtr>(fp),
-      new FuncArg(reinterpret_cast<Synch*>(synch), index, args), priority);
-  }
+  // header of the struct.func_args of a spawned task call, depth is the
+  // number of spawning tasks above it
+  struct TaskArg{
+    TaskArg(Synch* futureSync)
+      : futureSync(futureSync){}
 
-  void __ares_finish_func(void* arg){
-    auto a = reinterpret_cast<FuncArg*>(arg);
-    a->synch->release();
-    delete a;
-  }
+    Synch* futureSync;
+    uint32_t depth;
+  };
 
-  void __ares_signal_synch(void* sync){
-    auto s = reinterpret_cast<Synch*>(sync);
-    s->release();
-  }
+  // the future of a spawned task call is kept in the same pooled frame,
+  // just ahead of its args. The frame is released once both the task has
+  // returned and the caller has dropped it, usually after reading the
+  // result, or right after queueing when the result is unused. The call
+  // is run by whichever of the worker that picks up its task and the
+  // caller awaiting it claims it first. Its task is pushed once pending,
+  // the queueing itself and one per unfinished dependence, drops to 0.
+  //
+  // A frame may also be on the caller's stack, when HLIR found that the
+  // caller awaits the call before it returns. It is never released, the
+  // caller instead waits for the task to drop its reference as well.
+  //
+  // The frame of a call of a memoized task is shared, the memo table
+  // and each caller that found it there hold a reference, and any of
+  // them may await it.
+  struct TaskFuture{
+    TaskFuture(bool stack)
+      : synch(1),
+      refs(2),
+      pending(1),
+      claimed(false),
+      stack(stack),
+      shared(false),
+      func(nullptr),
+      region(nullptr),
+      task(nullptr),
+      group(nullptr),
+      place(-1){}
 
-  void __ares_await_synch(void* synch){
-    auto s = reinterpret_cast<Synch*>(synch);
-    s->await();
-    delete s;
+    Synch synch;
+    atomic<int> refs;
+    atomic<int> pending;
+    atomic<bool> claimed;
+    bool stack;
+    bool shared;
+    FuncPtr func;
+    const RegionDesc* region;
+    Task* task;
+    Synch* group;
+    // the worker group the call is queued to, -1 for any
+    int32_t place;
+    // where it was spawned in the task graph and where the calls it
+    // depends on returned
+    TaskSpan::Edge edge;
+    TaskSpan::Join deps;
+  };
+
+  const size_t TASK_FUTURE_SIZE = 
+    (sizeof(TaskFuture) + FramePool::ALIGN - 1) & ~(FramePool::ALIGN - 1);
+
+  TaskFuture* taskFuture(TaskArg* args){
+    return reinterpret_cast<TaskFuture*>(
+      reinterpret_cast<char*>(args) - TASK_FUTURE_SIZE);
   }
 
-  void __ares_task_queue(void* funcPtr, void* argsPtr){
-    auto func = reinterpret_cast<FuncPtr>(funcPtr);
-    auto args = reinterpret_cast<TaskArg*>(argsPtr);
-    args->futureSync = new Synch(1);
-    _threadPool->push(func, args, 0);
+  void dropTaskFuture(TaskFuture* f){
+    if(f->refs.fetch_sub(1, memory_order_acq_rel) == 1 && !f->stack){
+      f->~TaskFuture();
+      FramePool::release(f);
+    }
   }
 
-  void __ares_task_await_future(void* argsPtr){
-    auto args = reinterpret_cast<TaskArg*>(argsPtr);
-    args->futureSync->await();
+  void dropTaskFrame(TaskArg* args){
+    dropTaskFuture(taskFuture(args));
   }
 
-  bool __ares_task_try_await_future(void* argsPtr){
-    auto args = reinterpret_cast<TaskArg*>(argsPtr);
-    return args->futureSync->tryAwait();
+  // dependence bits passed by HLIR for the pointer arguments of a task
+  // call, taken from the constness of the parameters
+  enum TaskDependence{
+    TASK_DEP_IN = 1,
+    TASK_DEP_OUT = 2
+  };
+
+  // the last call spawned that writes each address and the calls spawned
+  // since that read it, a call that writes it waits for all of them and
+  // one that only reads it for the writer. Dependences are only tracked
+  // among the calls spawned by the same caller, which is always running
+  // on one thread, so that a call cannot come to wait on its own parent.
+  struct TaskDeps{
+    struct Region{
+      TaskFuture* writer = nullptr;
+      vector<TaskFuture*> readers;
+    };
+
+    ~TaskDeps(){
+      for(auto& itr : regions){
+        if(itr.second.writer){
+          dropTaskFuture(itr.second.writer);
+        }
+        for(TaskFuture* r : itr.second.readers){
+          dropTaskFuture(r);
+        }
+      }
+    }
+
+    unordered_map<void*, Region> regions;
+  };
+
+  // dependences of the calls spawned by the task call the calling thread
+  // is running, or by the thread itself outside of tasks
+  TaskDeps*& taskDeps(){
+    static thread_local TaskDeps* deps = nullptr;
+    return deps;
   }
 
-  void __ares_task_release_future(void* argsPtr){
-    auto args = reinterpret_cast<TaskArg*>(argsPtr);
-    args->futureSync->release();
+  // the shared frames of the calls of memoized tasks, see __ares_task_memo()
+  MemoTable& memoTable(){
+    static MemoTable table;
+    return table;
   }
 
-  void __ares_thread_yield(){
-#ifdef USE_ARGO_BOTS
-    _threadPool->yield();
-#else
-    assert(false && "unable to yield");
-#endif
+  // an ares::TaskGroup, its synch is released by each call spawned in it
+  // and once by its wait, prev is the group it was opened in
+  struct TaskGroupState{
+    TaskGroupState(Synch* prev)
+      : synch(1),
+      prev(prev){}
+
+    Synch synch;
+    Synch* prev;
+  };
+
+  // the ares::TaskGroup that the calls spawned by the calling thread
+  // join, if any, from the task call it is running or outside of tasks
+  Synch*& taskGroup(){
+    static thread_local Synch* group = nullptr;
+    return group;
   }
 
-  void __ares_debug(){
-    np(9);
+  // depth of the task the calling thread is running, 0 outside of tasks
+  uint32_t& taskDepth(){
+    static thread_local uint32_t depth = 0;
+    return depth;
   }
 
-  void __ares_debug_ptr(void* ptr){
+  // queues the calls the thread has bundled, see TaskBundle
+  void flushTaskBundle();
+
+  // spawned calls are run with their depth set, a thread that helps
+  // while waiting runs calls nested within another
+  void runTaskCall(TaskFuture* f, TaskArg* args){
+    uint32_t& depth = taskDepth();
+    uint32_t prev = depth;
+
+    TaskDeps*& deps = taskDeps();
+    TaskDeps* prevDeps = deps;
+
+    Synch*& group = taskGroup();
+    Synch* prevGroup = group;
+
+    depth = args->depth;
+    deps = nullptr;
+    group = nullptr;
+
+    Synch* joined = f->group;
+
+    bool graph = TaskSpan::enabled();
+    if(graph){
+      TaskSpan::begin(f->edge, f->deps.path());
+    }
+
+    runRegion(f->func, f->region, args);
+
+    flushTaskBundle();
+    delete deps;
+
+    depth = prev;
+    deps = prevDeps;
+    group = prevGroup;
+
+    if(joined){
+      if(graph){
+        TaskSpan::arrive(joined->join());
+      }
+      joined->release();
+    }
+
+    if(graph){
+      TaskSpan::finish();
+    }
   }
 
-  void __ares_debug_i32(int32_t x){
-    np(x);
+  // a future built by the HLIRFuture combinators. Every handle is used
+  // exactly once, by an await or as the input of a combinator, and the
+  // producer holds a reference until it has released the synch.
+  struct Future{
+    Future(int count, int refs)
+      : synch(count),
+      refs(refs){}
+
+    Synch synch;
+    atomic<int> refs;
+  };
+
+  void dropFuture(Future* f){
+    if(f->refs.fetch_sub(1, memory_order_acq_rel) == 1){
+      delete f;
+    }
   }
 
-  void __ares_debug_f32(float x){
-    np(x);
+  // runs the continuation of a future, then completes its own
+  struct Continuation{
+    static void run(void* arg){
+      auto c = static_cast<Continuation*>(arg);
+      c->func(c->args);
+      c->future->synch.release();
+      dropFuture(c->future);
+    }
+
+    FuncPtr func;
+    void* args;
+    Future* future;
+  };
+
+  // the result of when_any and how many inputs still refer to it
+  struct AnyState{
+    Future* future;
+    atomic<bool> fired;
+    atomic<int> refs;
+  };
+
+  // the queued task of a spawned call, the call may already have been
+  // claimed and run by its caller
+  void runTask(void* arg){
+    auto args = static_cast<TaskArg*>(arg);
+    TaskFuture* f = taskFuture(args);
+
+    if(!f->claimed.exchange(true, memory_order_acq_rel)){
+      runTaskCall(f, args);
+    }
+
+    dropTaskFrame(args);
   }
 
-} // extern "C"
+  // layout must match the struct.range_args passed by HLIR to a lowered
+  // parallel for body, which runs the iterations [begin, end)
+  struct RangeArg{
+    RangeArg(uint32_t begin, uint32_t end, void* args)
+      : begin(begin),
+      end(end),
+      args(args){}
 
-namespace ares{
+    uint32_t begin;
+    uint32_t end;
+    void* args;
+  };
 
-  bool ares_listen(int port){
-    assert(!_communicator);
-    auto c = new SocketCommunicator;
-    _communicator = c;
-    return c->listen(port);
+  // the args of the range whose chunk the thread runs, which identify
+  // the range for __ares_cancel(), and those of the cancelled ranges,
+  // only looked up while there are any
+  thread_local void* _rangeArgs = nullptr;
+
+  atomic<size_t> _numCancelled{0};
+  mutex _cancelMutex;
+  unordered_set<void*> _cancelled;
+
+  bool rangeCancelled(void* args){
+    if(_numCancelled.load(memory_order_acquire) == 0){
+      return false;
+    }
+
+    lock_guard<mutex> lock(_cancelMutex);
+    return _cancelled.count(args) > 0;
   }
 
-  bool ares_listen(const std::string& sendPath, const std::string& receivePath){
-    assert(!_communicator);
-    auto c = new FIFOCommunicator;
-    _communicator = c;
-    return c->listen(sendPath, receivePath);
+  // a range is queued uncancelled, though its args are reused by the
+  // next run of the same Forall
+  void resetCancel(void* args){
+    if(_numCancelled.load(memory_order_acquire) == 0){
+      return;
+    }
+
+    lock_guard<mutex> lock(_cancelMutex);
+    if(_cancelled.erase(args) > 0){
+      _numCancelled.fetch_sub(1, memory_order_release);
+    }
   }
 
-  bool ares_connect(const char* host, int port){
-    assert(!_communicator);
-    auto c = new SocketCommunicator;
-    _communicator = c;
-    return c->connect(host, port);  
+  // runs the iterations [begin, end) of the body of a range, timed for
+  // the region profile with ARES_PROFILE, or none if it was cancelled
+  inline void runRangeChunk(FuncPtr func, const RegionDesc* region,
+                            uint32_t begin, uint32_t end, void* args){
+    if(rangeCancelled(args)){
+      return;
+    }
+
+    RangeArg ra(begin, end, args);
+
+    void* outer = _rangeArgs;
+    _rangeArgs = args;
+
+    if(!region || (!RegionProfile::enabled() && !RegionMetrics::enabled())){
+      runRegion(func, region, &ra);
+      _rangeArgs = outer;
+      return;
+    }
+
+    auto t0 = chrono::steady_clock::now();
+    runRegion(func, region, &ra);
+    auto t = chrono::steady_clock::now() - t0;
+
+    _rangeArgs = outer;
+
+    uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(t).count();
+
+    if(RegionProfile::enabled()){
+      RegionProfile::chunk(region, end - begin, ns);
+    }
+
+    if(RegionMetrics::enabled()){
+      RegionMetrics::chunk(region, end - begin, ns);
+    }
   }
 
-  bool ares_connect(const std::string& sendPath, const std::string& receivePath){
-    assert(!_communicator);
-    auto c = new FIFOCommunicator;
-    _communicator = c;
-    return c->connect(sendPath, receivePath);  
+  // a launch of the range [start, end) of region, for the profile
+  inline void profileLaunch(void* region, uint32_t start, uint32_t end){
+    if(region && RegionProfile::enabled()){
+      auto r = static_cast<const RegionDesc*>(region);
+      RegionProfile::launch(r, r->kind, r->file, r->line, end - start);
+    }
   }
 
-  void ares_send(char* buf, size_t size){
-    auto msg = new MessageBuffer(MessageType::Raw, buf, size, true);
-    _communicator->send(msg);
+  enum class Schedule{
+    Static,
+    Dynamic,
+    Guided,
+    Affinity,
+    Tune
+  };
+
+  // chunk policy for range tasks, read once from ARES_SCHEDULE, which
+  // takes the form: static|dynamic|guided|affinity|tune[,chunk].
+  // Affinity splits each Forall into one static chunk per worker that
+  // goes to that worker, so a range touches the same memory from the
+  // same worker every time step. Tune has the grain of each region found
+  // by a GrainTuner, for the Foralls that have no grain or schedule.
+  struct ScheduleConfig{
+    ScheduleConfig()
+      : schedule(Schedule::Static),
+      chunk(0){
+
+      const char* s = getenv("ARES_SCHEDULE");
+      if(!s){
+        return;
+      }
+
+      string str = s;
+      size_t pos = str.find(',');
+      string kind = str.substr(0, pos);
+
+      if(kind == "dynamic"){
+        schedule = Schedule::Dynamic;
+      }
+      else if(kind == "guided"){
+        schedule = Schedule::Guided;
+      }
+      else if(kind == "affinity"){
+        schedule = Schedule::Affinity;
+      }
+      else if(kind == "tune"){
+        schedule = Schedule::Tune;
+      }
+      else{
+        assert(kind == "static" && "invalid ARES_SCHEDULE");
+      }
+
+      if(pos != string::npos){
+        chunk = atoi(str.c_str() + pos + 1);
+      }
+    }
+
+    Schedule schedule;
+    uint32_t chunk;
+  };
+
+  const ScheduleConfig& scheduleConfig(){
+    static ScheduleConfig config;
+    return config;
   }
 
-  char* ares_receive(size_t& size){
-    MessageBuffer* msg = _communicator->receive();
-    size = msg->size();
-    char* buf = msg->buffer();
-    return buf;
+  // lowered reductions, read once from ARES_REDUCE, which takes the form:
+  // fast|deterministic[,block][,compensated]. In the deterministic mode
+  // the partials are blocks of a fixed number of iterations, so the
+  // result does not depend on the number of workers.
+  struct ReduceConfig{
+    ReduceConfig()
+      : blockSize(0),
+      compensated(false){
+
+      const char* s = getenv("ARES_REDUCE");
+      if(!s){
+        return;
+      }
+
+      string str = s;
+      size_t pos = str.find(',');
+      string kind = str.substr(0, pos);
+
+      if(kind == "fast"){
+        return;
+      }
+
+      assert(kind == "deterministic" && "invalid ARES_REDUCE");
+
+      blockSize = 4096;
+
+      while(pos != string::npos){
+        size_t next = str.find(',', pos + 1);
+        string opt = str.substr(pos + 1, next - pos - 1);
+
+        if(opt == "compensated"){
+          compensated = true;
+        }
+        else if(!opt.empty()){
+          blockSize = strtoull(opt.c_str(), nullptr, 10);
+          assert(blockSize > 0 && "invalid ARES_REDUCE block size");
+        }
+
+        pos = next;
+      }
+    }
+
+    uint64_t blockSize;
+    bool compensated;
+  };
+
+  const ReduceConfig& reduceConfig(){
+    static ReduceConfig config;
+    return config;
   }
 
-  void ares_init_comm(size_t groupSize){
-    assert(_communicator);
-    _communicator->init(groupSize);
+  // a lowered Forall whose iterations times estimated body cost is below
+  // this runs inline on the caller, read once from ARES_SERIAL_THRESHOLD,
+  // 0 always queues
+  uint64_t serialThreshold(){
+    static uint64_t threshold = []{
+      const char* s = getenv("ARES_SERIAL_THRESHOLD");
+      return s ? strtoull(s, nullptr, 10) : 
+        uint64_t(ARES_SERIAL_THRESHOLD_DEFAULT);
+    }();
+
+    return threshold;
   }
 
-  void ares_barrier(){
-    assert(_communicator);
-    _communicator->barrier();
+  Executor* threadPool();
+
+  // the workers that ran the chunks of a static launch of each region,
+  // which the chunks of its later launches over the same range are
+  // mailed to, so that a chunk that a thief took stays with the thief,
+  // which touched its part of the data first. Others only take them
+  // from the mailbox once they have run out of work.
+  class ChunkAffinity{
+  public:
+    // the owners of the numChunks chunks of [start, end) of region, an
+    // owner -1 if the chunk did not run on a worker, empty if the region
+    // was last launched over another range or split another way
+    static vector<int32_t> owners(const RegionDesc* region, uint32_t start,
+                                  uint32_t end, uint32_t numChunks){
+      lock_guard<mutex> lock(mutex_());
+
+      auto itr = map_().find(region);
+      if(itr == map_().end()){
+        return {};
+      }
+
+      const Entry_& e = itr->second;
+      if(e.start != start || e.end != end || e.owners.size() != numChunks){
+        return {};
+      }
+
+      return e.owners;
+    }
+
+    static void record(const RegionDesc* region, uint32_t start,
+                       uint32_t end, vector<int32_t>&& owners){
+      lock_guard<mutex> lock(mutex_());
+      map_()[region] = Entry_{start, end, move(owners)};
+    }
+
+  private:
+    struct Entry_{
+      uint32_t start;
+      uint32_t end;
+      vector<int32_t> owners;
+    };
+
+    static mutex& mutex_(){
+      static mutex m;
+      return m;
+    }
+
+    static unordered_map<const RegionDesc*, Entry_>& map_(){
+      static unordered_map<const RegionDesc*, Entry_> m;
+      return m;
+    }
+  };
+
+  class RangeJob{
+  public:
+    struct Chunk{
+      Chunk(RangeJob* job, uint32_t index)
+        : job(job),
+        index(index){}
+
+      RangeJob* job;
+      uint32_t index;
+    };
+
+    RangeJob(Synch* synch, FuncPtr func, const RegionDesc* region,
+             void* args, uint32_t start, uint32_t end, uint32_t numWorkers,
+             Schedule schedule, uint32_t chunk)
+      : synch_(synch),
+      func_(func),
+      region_(region),
+      args_(args),
+      start_(start),
+      end_(end),
+      schedule_(schedule),
+      next_(start){
+
+      uint32_t n = end - start;
+      uint32_t numTasks = n < numWorkers ? n : numWorkers;
+
+      if(chunk > 0){
+        chunk_ = chunk;
+      }
+      else if(schedule_ == Schedule::Dynamic){
+        chunk_ = n/(numTasks * 8);
+      }
+      else{
+        chunk_ = 1;
+      }
+
+      if(chunk_ == 0){
+        chunk_ = 1;
+      }
+
+      numTasks_ = numTasks;
+      pending_ = numTasks;
+    }
+
+    uint32_t numTasks() const{
+      return numTasks_;
+    }
+
+    // chunk i is always the same part of the range
+    bool isStatic() const{
+      return schedule_ == Schedule::Static || 
+        schedule_ == Schedule::Affinity;
+    }
+
+    // the chunks are to note the workers they run on, for ChunkAffinity
+    void recordOwners(){
+      owners_.assign(numTasks_, -1);
+    }
+
+    static void run(void* arg){
+      auto c = static_cast<Chunk*>(arg);
+      RangeJob* job = c->job;
+
+      uint32_t begin;
+      uint32_t end;
+
+      if(job->isStatic()){
+        if(!job->owners_.empty()){
+          job->owners_[c->index] = threadPool()->workerIndex();
+        }
+
+        job->staticRange_(c->index, begin, end);
+        runRangeChunk(job->func_, job->region_, begin, end, job->args_);
+      }
+      else{
+        while(job->nextRange_(begin, end)){
+          runRangeChunk(job->func_, job->region_, begin, end, job->args_);
+        }
+      }
+
+      job->finish_();
+    }
+
+  private:
+    void staticRange_(uint32_t index, uint32_t& begin, uint32_t& end){
+      uint32_t n = end_ - start_;
+      uint32_t q = n / numTasks_;
+      uint32_t r = n % numTasks_;
+
+      begin = start_ + index * q + (index < r ? index : r);
+      end = begin + q + (index < r ? 1 : 0);
+    }
+
+    bool nextRange_(uint32_t& begin, uint32_t& end){
+      if(schedule_ == Schedule::Dynamic){
+        begin = next_.fetch_add(chunk_);
+        if(begin >= end_){
+          return false;
+        }
+
+        end = begin + chunk_;
+        end = end > end_ || end < begin ? end_ : end;
+        return true;
+      }
+
+      // guided: hand out a shrinking fraction of the remaining iterations
+      uint32_t current = next_.load();
+
+      for(;;){
+        if(current >= end_){
+          return false;
+        }
+
+        uint32_t size = (end_ - current)/(2 * numTasks_);
+        if(size < chunk_){
+          size = chunk_;
+        }
+
+        uint32_t n = end_ - current < size ? end_ - current : size;
+
+        if(next_.compare_exchange_weak(current, current + n)){
+          begin = current;
+          end = current + n;
+          return true;
+        }
+      }
+    }
+
+    void finish_(){
+      if(--pending_ == 0){
+        if(!owners_.empty()){
+          ChunkAffinity::record(region_, start_, end_, move(owners_));
+        }
+
+        synch_->release();
+        delete this;
+      }
+    }
+
+    Synch* synch_;
+    FuncPtr func_;
+    const RegionDesc* region_;
+    void* args_;
+    uint32_t start_;
+    uint32_t end_;
+    uint32_t chunk_;
+    uint32_t numTasks_;
+    Schedule schedule_;
+    atomic<uint32_t> next_;
+    atomic<uint32_t> pending_;
+    vector<int32_t> owners_;
+  };
+
+  // worker pool settings, read once from the environment:
+  //   ARES_BACKEND      the executor tasks are run on: threads, the
+  //                     default, argobots, cthreads, kokkos and openmp
+  //                     if the runtime was built with them, or one added
+  //                     by registerExecutor()
+  //   ARES_NUM_THREADS  number of workers, defaults to the number of CPUs
+  //                     in the process affinity mask
+  //   ARES_BIND         none|compact|scatter worker-to-core pinning
+  //   ARES_IDLE         latency|balanced|power, how long idle workers
+  //                     spin before parking, defaults to balanced, or
+  //                     power when the workers occupy every CPU
+  //   ARES_IDLE_PARK    seconds an idle worker sleeps before it parks
+  //                     until a push needs it, never by default
+  struct PoolConfig{
+    PoolConfig()
+      : backend("threads"),
+      numThreads(0),
+      bind(BindPolicy::None),
+      idle(IdlePolicy::Balanced){
+
+      if(const char* s = getenv("ARES_BACKEND")){
+        backend = s;
+      }
+
+      if(const char* s = getenv("ARES_NUM_THREADS")){
+        numThreads = atoi(s);
+      }
+
+      size_t numCpus = Affinity::allowedCpus().size();
+
+      if(numThreads == 0){
+        numThreads = numCpus;
+      }
+
+      if(numThreads == 0){
+        numThreads = 1;
+      }
+
+      if(const char* s = getenv("ARES_BIND")){
+        string str = s;
+        if(str == "compact"){
+          bind = BindPolicy::Compact;
+        }
+        else if(str == "scatter"){
+          bind = BindPolicy::Scatter;
+        }
+        else{
+          assert(str == "none" && "invalid ARES_BIND");
+        }
+      }
+
+      if(const char* s = getenv("ARES_IDLE")){
+        string str = s;
+        if(str == "latency"){
+          idle = IdlePolicy(IdlePolicy::Latency);
+        }
+        else if(str == "power"){
+          idle = IdlePolicy(IdlePolicy::Power);
+        }
+        else{
+          assert(str == "balanced" && "invalid ARES_IDLE");
+        }
+      }
+      else if(numThreads >= numCpus){
+        // no core is left for the thread that queues work, spinning
+        // workers would only delay it
+        idle = IdlePolicy(IdlePolicy::Power);
+      }
+
+      if(const char* s = getenv("ARES_IDLE_PARK")){
+        double seconds = atof(s);
+        idle.parkAfterNs = seconds > 0.0 ? int64_t(seconds * 1e9) : -1;
+      }
+    }
+
+    string backend;
+    size_t numThreads;
+    BindPolicy bind;
+    IdlePolicy idle;
+  };
+
+  // the pool is created on first use so that linking against the
+  // runtime does not start any threads. Set once the pool has been
+  // started, the stats API reads it so that asking for stats does not
+  // start the pool.
+  atomic<Executor*> _startedPool{nullptr};
+
+  // a named pool of its own that the constructs of the threads that
+  // entered it are queued to, its workers' pushes staying in it
+  struct Arena{
+    Arena(const string& name, size_t maxConcurrency, int niceness)
+    : name(name),
+    pool(maxConcurrency, {}, PoolConfig().idle, name, niceness){}
+
+    string name;
+    ThreadPool pool;
+  };
+
+  mutex _arenaMutex;
+
+  // never destroyed, a worker still in a task at exit keeps its pool
+  map<string, unique_ptr<Arena>>& _arenas = 
+    *new map<string, unique_ptr<Arena>>;
+
+  // the arena the calling thread entered, if any
+  thread_local Arena* _arena = nullptr;
+
+  void printStatsAtExit(){
+    ares_print_runtime_stats(cerr);
+  }
+
+  // the workers end before the statics that their tasks may use are
+  // destroyed
+  void stopPoolAtExit(){
+    if(Executor* pool = _startedPool.load()){
+      pool->stop();
+    }
+
+    lock_guard<mutex> lock(_arenaMutex);
+    for(auto& a : _arenas){
+      a.second->pool.stop();
+    }
+  }
+
+  // ARES_STATS_INTERVAL has the stats printed every that many seconds by
+  // a thread of its own, from when the pool or communicator starts
+  void startStatsDump(){
+    static once_flag once;
+    call_once(once, []{
+      const char* s = getenv("ARES_STATS_INTERVAL");
+      double interval = s ? atof(s) : 0.0;
+      if(interval <= 0.0){
+        return;
+      }
+
+      thread([=]{
+        for(;;){
+          this_thread::sleep_for(chrono::duration<double>(interval));
+          ares_print_runtime_stats(cerr);
+        }
+      }).detach();
+    });
+  }
+
+  void startMetricsServer();
+
+  map<string, ExecutorFactory>& executorFactories(){
+    static map<string, ExecutorFactory> factories;
+    return factories;
+  }
+
+  Executor* createExecutor(const PoolConfig& config){
+#ifdef ARES_HAVE_ARGOBOTS
+    if(config.backend == "argobots"){
+      return new ArgoPool(config.numThreads);
+    }
+#endif
+
+#ifdef ARES_HAVE_CTHREADPOOL
+    if(config.backend == "cthreads"){
+      return new ThpoolExecutor(config.numThreads);
+    }
+#endif
+
+#ifdef ARES_HAVE_KOKKOS
+    if(config.backend == "kokkos"){
+      return new KokkosExecutor(config.numThreads);
+    }
+#endif
+
+#ifdef ARES_HAVE_OPENMP
+    if(config.backend == "openmp"){
+      return new OpenMPExecutor(config.numThreads);
+    }
+#endif
+
+    auto& factories = executorFactories();
+    auto itr = factories.find(config.backend);
+    if(itr != factories.end()){
+      return itr->second(config.numThreads);
+    }
+
+    if(config.backend != "threads"){
+      cerr << "ares: unknown or unavailable ARES_BACKEND " << 
+        config.backend << ", using threads" << endl;
+    }
+
+    vector<int> cpus;
+    if(config.bind != BindPolicy::None){
+      cpus = Affinity::bindOrder(config.bind);
+    }
+
+    return new ThreadPool(config.numThreads, cpus, config.idle);
+  }
+
+  // the pool of the calling thread's arena, or that it is a worker of,
+  // or the one started from the environment
+  Executor* threadPool(){
+    if(Arena* a = _arena){
+      return &a->pool;
+    }
+
+    if(ThreadPool* p = ThreadPool::current()){
+      return p;
+    }
+
+    static Executor* pool = []{
+      PoolConfig config;
+
+      Executor* p = createExecutor(config);
+      _startedPool = p;
+
+      // a worker waiting on a receive or barrier runs others' tasks
+      commHelper().store([]{
+        Executor* pool = threadPool();
+        if(pool->workerIndex() < 0){
+          return -1;
+        }
+        return pool->tryRunOne() ? 1 : 0;
+      }, memory_order_release);
+
+      // registered first, so the stats are printed before it runs
+      atexit(stopPoolAtExit);
+
+      if(getenv("ARES_STATS")){
+        atexit(printStatsAtExit);
+      }
+      startStatsDump();
+      startMetricsServer();
+
+      return p;
+    }();
+
+    return pool;
+  }
+
+  // the task calls spawned one after another by a task call, which are
+  // queued together as the task of one bundle, chained through their
+  // next. A bundle is run in order by the worker that takes it, which
+  // first splits off its back half as another bundle whenever the
+  // workers have run out of queued work, so that the calls spread again
+  // once there is too little of it. The calls are bundled up to
+  // ARES_TASK_BUNDLE of them, 1 by default, which turns it off, and a
+  // bundle is queued full, at a spawn ARES_TASK_BUNDLE_NS after its
+  // first, 10 us by default, and whenever the task call that spawns
+  // them waits or returns. Calls spawned outside of task calls, whose
+  // threads may go on to wait on something the runtime does not see,
+  // are queued singly.
+  struct TaskBundle{
+    Task* head = nullptr;
+    Task* tail = nullptr;
+    uint32_t n = 0;
+    uint32_t priority = 0;
+    chrono::steady_clock::time_point first;
+  };
+
+  // the args of a bundle's own task
+  struct TaskBundleArg{
+    TaskBundleArg(Task* head, uint32_t n)
+      : head(head),
+      n(n){}
+
+    Task* head;
+    uint32_t n;
+  };
+
+  struct TaskBundleConfig{
+    uint32_t size = 1;
+    int64_t windowNs = 10000;
+  };
+
+  const TaskBundleConfig& taskBundleConfig(){
+    static TaskBundleConfig config = []{
+      TaskBundleConfig c;
+
+      if(const char* s = getenv("ARES_TASK_BUNDLE")){
+        c.size = max(1, atoi(s));
+      }
+
+      if(const char* s = getenv("ARES_TASK_BUNDLE_NS")){
+        c.windowNs = atoll(s);
+      }
+
+      return c;
+    }();
+
+    return config;
+  }
+
+  TaskBundle& taskBundle(){
+    static thread_local TaskBundle bundle;
+    return bundle;
+  }
+
+  void runTaskBundle(void* arg);
+
+  void pushTaskBundle(Task* head, uint32_t n, uint32_t priority){
+    if(n == 1){
+      threadPool()->push(head);
+      return;
+    }
+
+    Task* task = TaskPool::allocate(runTaskBundle, nullptr, priority);
+    task->emplace<TaskBundleArg>(head, n);
+
+    // the bundle runs its tasks on its own stack
+    Task* t = head;
+    for(uint32_t i = 0; i < n; ++i, t = t->next){
+      task->stack = max(task->stack, t->stack);
+    }
+
+    threadPool()->push(task);
+  }
+
+  void runTaskBundle(void* arg){
+    auto b = static_cast<TaskBundleArg*>(arg);
+    Executor* pool = threadPool();
+
+    Task* t = b->head;
+    uint32_t n = b->n;
+
+    while(t){
+      if(n > 1 && pool->starving()){
+        uint32_t keep = n/2;
+
+        Task* last = t;
+        for(uint32_t i = 1; i < keep; ++i){
+          last = last->next;
+        }
+
+        pushTaskBundle(last->next, n - keep, t->priority);
+        last->next = nullptr;
+        n = keep;
+      }
+
+      Task* next = t->next;
+      t->next = nullptr;
+      t->run();
+      TaskPool::release(t);
+
+      t = next;
+      --n;
+    }
+  }
+
+  void flushTaskBundle(){
+    TaskBundle& b = taskBundle();
+    if(b.n == 0){
+      return;
+    }
+
+    pushTaskBundle(b.head, b.n, b.priority);
+    b.head = nullptr;
+    b.tail = nullptr;
+    b.n = 0;
+  }
+
+  void bundleTask(Task* task){
+    const TaskBundleConfig& config = taskBundleConfig();
+    TaskBundle& b = taskBundle();
+
+    if(b.n > 0 &&
+       (task->priority != b.priority || chrono::duration_cast<
+          chrono::nanoseconds>(chrono::steady_clock::now() - b.first)
+        .count() > config.windowNs)){
+      flushTaskBundle();
+    }
+
+    task->next = nullptr;
+
+    if(b.n == 0){
+      b.head = task;
+      b.priority = task->priority;
+      b.first = chrono::steady_clock::now();
+    }
+    else{
+      b.tail->next = task;
+    }
+
+    b.tail = task;
+
+    if(++b.n >= config.size){
+      flushTaskBundle();
+    }
+  }
+
+  // takes task out of the thread's bundle if it is still there
+  bool takeBackBundled(Task* task){
+    TaskBundle& b = taskBundle();
+
+    Task* prev = nullptr;
+    for(Task* t = b.head; t; prev = t, t = t->next){
+      if(t != task){
+        continue;
+      }
+
+      if(prev){
+        prev->next = t->next;
+      }
+      else{
+        b.head = t->next;
+      }
+
+      if(b.tail == t){
+        b.tail = prev;
+      }
+
+      t->next = nullptr;
+      --b.n;
+      return true;
+    }
+
+    return false;
+  }
+
+  // pushes the task of a spawned call once it has been queued and its
+  // dependences have completed, its spawner may bundle it
+  void startTaskCall(TaskFuture* f, bool spawner=false){
+    if(f->pending.fetch_sub(1, memory_order_acq_rel) == 1){
+      if(f->place >= 0){
+        threadPool()->pushToGroup(f->task, f->place);
+      }
+      else if(spawner && taskBundleConfig().size > 1 && taskDepth() > 0){
+        bundleTask(f->task);
+      }
+      else{
+        threadPool()->push(f->task);
+      }
+    }
+  }
+
+  // task calls deeper than this run sequentially, read once from
+  // ARES_TASK_DEPTH. The default gives a binary recursion around 16
+  // tasks per worker.
+  uint32_t taskCutoff(){
+    static uint32_t cutoff = []{
+      const char* s = getenv("ARES_TASK_DEPTH");
+      if(s){
+        return uint32_t(strtoul(s, nullptr, 10));
+      }
+
+      uint32_t n = threadPool()->numThreads();
+      uint32_t d = 4;
+      while(n > 1){
+        n = (n + 1)/2;
+        ++d;
+      }
+
+      return d;
+    }();
+
+    return cutoff;
+  }
+
+  // a whole iteration space published as one task. Whoever runs a range
+  // larger than the grain splits off its upper half as a new task, which
+  // idle workers steal, and keeps the lower half, so the submitter does
+  // one push and the splits are spread across the workers
+  class SplitJob{
+  public:
+    struct Range{
+      Range(SplitJob* job, uint32_t begin, uint32_t end)
+        : job(job),
+        begin(begin),
+        end(end){}
+
+      SplitJob* job;
+      uint32_t begin;
+      uint32_t end;
+    };
+
+    SplitJob(Synch* synch, FuncPtr func, const RegionDesc* region,
+             void* args, uint32_t n, uint32_t grain, uint32_t priority)
+      : synch_(synch),
+      func_(func),
+      region_(region),
+      args_(args),
+      grain_(grain),
+      priority_(priority),
+      remaining_(n){}
+
+    static Task* createTask(SplitJob* job, uint32_t begin, uint32_t end){
+      Task* task = TaskPool::allocate(SplitJob::run, nullptr, job->priority_);
+      task->emplace<Range>(job, begin, end);
+      return task;
+    }
+
+    static void run(void* arg){
+      auto r = static_cast<Range*>(arg);
+      SplitJob* job = r->job;
+      uint32_t begin = r->begin;
+      uint32_t end = r->end;
+
+      auto pool = threadPool();
+
+      while(end - begin > job->grain_){
+        uint32_t mid = begin + (end - begin)/2;
+        pool->push(createTask(job, mid, end));
+        end = mid;
+      }
+
+      runRangeChunk(job->func_, job->region_, begin, end, job->args_);
+
+      job->finish_(end - begin);
+    }
+
+  private:
+    // counts iterations rather than tasks so that splitting needs no
+    // extra atomic operations
+    void finish_(uint32_t n){
+      if(remaining_.fetch_sub(n) == n){
+        synch_->release();
+        delete this;
+      }
+    }
+
+    Synch* synch_;
+    FuncPtr func_;
+    const RegionDesc* region_;
+    void* args_;
+    uint32_t grain_;
+    uint32_t priority_;
+    atomic<uint32_t> remaining_;
+  };
+
+  Communicator* _communicator = nullptr;
+
+  // indexed by the tag of an active message
+  vector<ActiveHandler> _activeHandlers;
+  mutex _activeMutex;
+
+  void runActive(void* arg){
+    auto msg = *static_cast<MessageBuffer**>(arg);
+
+    _activeMutex.lock();
+    assert(msg->tag() < _activeHandlers.size() && "unknown active handler");
+    ActiveHandler handler = _activeHandlers[msg->tag()];
+    _activeMutex.unlock();
+
+    handler(msg->source(), msg->buffer(), msg->size());
+    delete msg;
+  }
+
+  // an active message arrives on an engine thread and runs as a task
+  void setupCommunicator(Communicator* c){
+    c->setHandler(MessageType::Active, [](MessageBuffer* msg){
+      Task* task = TaskPool::allocate(runActive, nullptr, 1);
+      task->emplace<MessageBuffer*>(msg);
+      threadPool()->push(task);
+    });
+
+    _communicator = c;
+    startStatsDump();
+    startMetricsServer();
+  }
+
+  // a label value of the Prometheus text format
+  string metricLabel(const string& s){
+    string r;
+    for(char c : s){
+      if(c == '\\' || c == '"'){
+        r += '\\';
+      }
+      r += c == '\n' ? 'n' : c;
+    }
+    return r;
+  }
+
+  void metricHeader(ostream& ostr, const char* name, const char* type,
+                    const char* help){
+    ostr << "# HELP " << name << " " << help << "\n# TYPE " << name << " " <<
+      type << "\n";
+  }
+
+  // what ARES_METRICS serves: the workers' counters, the traffic with
+  // each peer and the time in each region's chunks. All of them are read
+  // from relaxed atomics, without a lock that the workers or the sends
+  // take.
+  string renderMetrics(){
+    using WorkerStats = Executor::WorkerStats;
+
+    ostringstream ostr;
+    ostr.precision(12);
+
+    Executor* pool = _startedPool;
+    vector<WorkerStats> workers;
+    if(pool){
+      workers = pool->stats();
+    }
+
+    using Field = uint64_t WorkerStats::*;
+
+    const tuple<const char*, const char*, Field> counters[] = {
+      make_tuple("ares_worker_tasks_executed_total",
+                 "Tasks the worker has run", &WorkerStats::tasksExecuted),
+      make_tuple("ares_worker_tasks_pushed_total",
+                 "Tasks the worker has queued", &WorkerStats::tasksPushed),
+      make_tuple("ares_worker_steal_attempts_total",
+                 "Times the worker looked for a task to steal",
+                 &WorkerStats::stealAttempts),
+      make_tuple("ares_worker_steals_total",
+                 "Tasks the worker has stolen", &WorkerStats::steals),
+      make_tuple("ares_worker_remote_steals_total",
+                 "Tasks the worker has stolen from another NUMA node",
+                 &WorkerStats::remoteSteals)
+    };
+
+    for(auto& c : counters){
+      metricHeader(ostr, get<0>(c), "counter", get<1>(c));
+      for(size_t i = 0; i < workers.size(); ++i){
+        ostr << get<0>(c) << "{worker=\"" << i << "\",node=\"" <<
+          workers[i].numaNode << "\"} " << workers[i].*get<2>(c) << "\n";
+      }
+    }
+
+    metricHeader(ostr, "ares_worker_peak_queue_depth", "gauge",
+                 "Most tasks the worker's queue has held");
+    for(size_t i = 0; i < workers.size(); ++i){
+      ostr << "ares_worker_peak_queue_depth{worker=\"" << i << "\"} " <<
+        workers[i].peakQueueDepth << "\n";
+    }
+
+    metricHeader(ostr, "ares_worker_idle_seconds_total", "counter",
+                 "Time the worker has waited for tasks");
+    for(size_t i = 0; i < workers.size(); ++i){
+      ostr << "ares_worker_idle_seconds_total{worker=\"" << i << "\"} " <<
+        workers[i].idleTime << "\n";
+    }
+
+    metricHeader(ostr, "ares_worker_busy_seconds_total", "counter",
+                 "Time the worker has run or looked for tasks");
+    for(size_t i = 0; i < workers.size(); ++i){
+      ostr << "ares_worker_busy_seconds_total{worker=\"" << i << "\"} " <<
+        workers[i].busyTime << "\n";
+    }
+
+    // as in ares_print_runtime_stats(), since the pool started
+    uint64_t executed = 0;
+    uint64_t maxExecuted = 0;
+    for(const WorkerStats& ws : workers){
+      executed += ws.tasksExecuted;
+      maxExecuted = max(maxExecuted, ws.tasksExecuted);
+    }
+
+    double mean = workers.empty() ? 0.0 : double(executed)/workers.size();
+
+    metricHeader(ostr, "ares_imbalance", "gauge",
+                 "Tasks run by the busiest worker over the mean");
+    ostr << "ares_imbalance " << (mean > 0 ? maxExecuted/mean : 1.0) << "\n";
+
+    metricHeader(ostr, "ares_external_pushes_total", "counter",
+                 "Tasks queued by threads outside the pool");
+    ostr << "ares_external_pushes_total " <<
+      (pool ? pool->externalPushes() : 0) << "\n";
+
+    Allocator::Stats as = Allocator::stats();
+    metricHeader(ostr, "ares_allocator_mapped_bytes", "gauge",
+                 "Bytes of the large blocks mapped by __ares_alloc()");
+    ostr << "ares_allocator_mapped_bytes " << as.mappedBytes << "\n";
+
+    const pair<const char*, MemoryAccount::Category> memory[] = {
+      {"queue_items", MemoryAccount::QueueItems},
+      {"task_frames", MemoryAccount::TaskFrames},
+      {"partials", MemoryAccount::Partials},
+      {"messages", MemoryAccount::Messages},
+      {"stacks", MemoryAccount::Stacks}
+    };
+
+    metricHeader(ostr, "ares_memory_bytes", "gauge",
+                 "Bytes in use of the runtime's own allocations");
+    for(auto& m : memory){
+      ostr << "ares_memory_bytes{category=\"" << m.first << "\"} " <<
+        MemoryAccount::bytes(m.second) << "\n";
+    }
+
+    metricHeader(ostr, "ares_memory_inlined_spawns_total", "counter",
+                 "Task calls run inline because of a memory limit");
+    ostr << "ares_memory_inlined_spawns_total " <<
+      MemoryAccount::inlinedSpawns() << "\n";
+
+    vector<Communicator::PeerStats> peers;
+    if(_communicator){
+      peers = _communicator->peerStats();
+    }
+
+    using PeerField = uint64_t PeerCounters::Snapshot::*;
+
+    const tuple<const char*, const char*, PeerField> peerCounters[] = {
+      make_tuple("ares_peer_messages_sent_total", "Messages sent to the peer",
+                 &PeerCounters::Snapshot::messagesSent),
+      make_tuple("ares_peer_sent_bytes_total", "Bytes sent to the peer",
+                 &PeerCounters::Snapshot::bytesSent),
+      make_tuple("ares_peer_messages_received_total",
+                 "Messages received from the peer",
+                 &PeerCounters::Snapshot::messagesReceived),
+      make_tuple("ares_peer_received_bytes_total",
+                 "Bytes received from the peer",
+                 &PeerCounters::Snapshot::bytesReceived)
+    };
+
+    for(auto& c : peerCounters){
+      metricHeader(ostr, get<0>(c), "counter", get<1>(c));
+      for(const Communicator::PeerStats& ps : peers){
+        ostr << get<0>(c) << "{peer=\"" << ps.rank << "\"} " <<
+          ps.counters.*get<2>(c) << "\n";
+      }
+    }
+
+    metricHeader(ostr, "ares_peer_queue_depth", "gauge",
+                 "Messages waiting to be written to the peer");
+    for(const Communicator::PeerStats& ps : peers){
+      ostr << "ares_peer_queue_depth{peer=\"" << ps.rank << "\"} " <<
+        ps.queueDepth << "\n";
+    }
+
+    metricHeader(ostr, "ares_peer_queued_bytes", "gauge",
+                 "Bytes waiting to be written to the peer");
+    for(const Communicator::PeerStats& ps : peers){
+      ostr << "ares_peer_queued_bytes{peer=\"" << ps.rank << "\"} " <<
+        ps.queuedBytes << "\n";
+    }
+
+    // the buckets are powers of two of microseconds, the last the rest
+    metricHeader(ostr, "ares_peer_receive_latency_us", "histogram",
+                 "Time from a message arriving to its receive or handler");
+    for(const Communicator::PeerStats& ps : peers){
+      uint64_t count = 0;
+
+      for(size_t i = 0; i < PeerCounters::LATENCY_BUCKETS; ++i){
+        count += ps.counters.latency[i];
+
+        ostr << "ares_peer_receive_latency_us_bucket{peer=\"" << ps.rank <<
+          "\",le=\"";
+        if(i + 1 < PeerCounters::LATENCY_BUCKETS){
+          ostr << (uint64_t(1) << i);
+        }
+        else{
+          ostr << "+Inf";
+        }
+        ostr << "\"} " << count << "\n";
+      }
+
+      ostr << "ares_peer_receive_latency_us_count{peer=\"" << ps.rank <<
+        "\"} " << count << "\n";
+    }
+
+    // only regions that HLIR passed a descriptor for are timed
+    ostringstream chunks;
+    ostringstream iterations;
+    ostringstream seconds;
+
+    RegionMetrics::forEach([&](const void* desc, uint64_t numChunks,
+                               uint64_t numIterations, uint64_t ns){
+      auto r = static_cast<const RegionDesc*>(desc);
+
+      string labels = "{region=\"" + metricLabel(r->name) + "\",file=\"" +
+        metricLabel(r->file) + "\",line=\"" + to_string(r->line) + "\"} ";
+
+      chunks << "ares_region_chunks_total" << labels << numChunks << "\n";
+      iterations << "ares_region_iterations_total" << labels <<
+        numIterations << "\n";
+      seconds << "ares_region_seconds_total" << labels << ns/1e9 << "\n";
+    });
+
+    metricHeader(ostr, "ares_region_chunks_total", "counter",
+                 "Chunks of the region that have run");
+    ostr << chunks.str();
+
+    metricHeader(ostr, "ares_region_iterations_total", "counter",
+                 "Iterations of the region that have run");
+    ostr << iterations.str();
+
+    metricHeader(ostr, "ares_region_seconds_total", "counter",
+                 "Time in the chunks of the region, summed over the workers");
+    ostr << seconds.str();
+
+    metricHeader(ostr, "ares_region_dropped_chunks_total", "counter",
+                 "Chunks of regions that did not fit the region table");
+    ostr << "ares_region_dropped_chunks_total " << RegionMetrics::dropped() <<
+      "\n";
+
+    ostringstream phaseSeconds;
+    ostringstream phaseWork;
+
+    UserRegion::forEach([&](const string& name, uint64_t calls, 
+                            double time, double work){
+      string labels = "{phase=\"" + metricLabel(name) + "\"} ";
+      phaseSeconds << "ares_phase_seconds_total" << labels << time << "\n";
+      phaseWork << "ares_phase_work_seconds_total" << labels << work << "\n";
+    });
+
+    metricHeader(ostr, "ares_phase_seconds_total", "counter",
+                 "Time in the phase on the threads that marked it");
+    ostr << phaseSeconds.str();
+
+    metricHeader(ostr, "ares_phase_work_seconds_total", "counter",
+                 "Time in the tasks queued in the phase, summed over the "
+                 "threads");
+    ostr << phaseWork.str();
+
+    return ostr.str();
+  }
+
+  // ARES_METRICS serves the metrics on a TCP port of the loopback
+  // interface, or a Unix socket as unix:path, from when the pool or the
+  // communicator starts
+  void startMetricsServer(){
+    static once_flag once;
+    call_once(once, []{
+      const char* s = getenv("ARES_METRICS");
+      if(!s || !*s){
+        return;
+      }
+
+      if(!MetricsServer::start(s, renderMetrics)){
+        cerr << "ares: could not serve ARES_METRICS on " << s << endl;
+      }
+    });
+  }
+
+  // a process of a larger group both listens for and connects to peers
+  SocketCommunicator* socketCommunicator(){
+    if(!_communicator){
+      setupCommunicator(new SocketCommunicator);
+    }
+
+    auto c = dynamic_cast<SocketCommunicator*>(_communicator);
+    assert(c && "sockets and FIFOs cannot be mixed");
+    return c;
+  }
+
+  // a worker blocked on a synch keeps executing queued tasks until it
+  // completes, so nested waits do not tie up the OS threads of the pool
+  void waitFor(Synch* s){
+    Executor* pool = threadPool();
+
+    flushTaskBundle();
+
+    if(pool->workerIndex() >= 0){
+      size_t idle = 0;
+
+      while(!s->tryAwait()){
+        if(pool->tryRunOne()){
+          // what it ran may have bundled calls of its own
+          flushTaskBundle();
+          idle = 0;
+        }
+        else if(++idle < 64){
+          cpuRelax();
+        }
+        else{
+          pool->yield();
+        }
+      }
+
+      return;
+    }
+
+    s->await();
+  }
+
+  // a call that no worker has started yet is run by the caller right
+  // away, rather than helping with unrelated work until it is stolen
+  void awaitTaskCall(TaskArg* args){
+    TaskFuture* f = taskFuture(args);
+
+    // the usual case of awaiting the last spawn also takes its task back,
+    // so that it does not linger in the deque. That of a shared frame may
+    // already have been taken back and reused by another of its callers.
+    Task* task = f->task;
+    if(!f->shared &&
+       (takeBackBundled(task) || threadPool()->tryTakeBack(task))){
+      TaskPool::release(task);
+      runTaskCall(f, args);
+      dropTaskFrame(args);
+      return;
+    }
+
+    // one still waiting for its dependences is left to them
+    if(f->pending.load(memory_order_acquire) == 0 &&
+       !f->claimed.exchange(true, memory_order_acq_rel)){
+      runTaskCall(f, args);
+      return;
+    }
+
+    waitFor(args->futureSync);
+  }
+
+  // a snapshot file is a header then the chunks of the data in order,
+  // each a uint64_t of the bytes stored for it then those bytes, fewer
+  // than the chunk when it was compressed
+  const char SNAPSHOT_MAGIC[8] = {'A', 'R', 'E', 'S', 'S', 'N', 'P', '1'};
+  const size_t SNAPSHOT_CHUNK = size_t(64) << 20;
+
+  // copies above this are split into blocks across the workers
+  const size_t SNAPSHOT_COPY_BLOCK = size_t(4) << 20;
+
+  struct SnapshotHeader{
+    char magic[8];
+    uint64_t bytes;
+    uint64_t chunk;
+  };
+
+  // completes when the write has, the caller and the I/O thread each
+  // hold a reference
+  struct SnapshotState{
+    SnapshotState()
+    : synch(1),
+    refs(2),
+    ok(false){}
+
+    Synch synch;
+    atomic<int> refs;
+    bool ok;
+  };
+
+  void dropSnapshot(SnapshotState* s){
+    if(s->refs.fetch_sub(1, memory_order_acq_rel) == 1){
+      delete s;
+    }
+  }
+
+  void parallelCopy(char* dst, const char* src, size_t bytes){
+    if(bytes < 2*SNAPSHOT_COPY_BLOCK){
+      memcpy(dst, src, bytes);
+      return;
+    }
+
+    struct Block{
+      char* dst;
+      const char* src;
+      size_t size;
+      Synch* synch;
+    };
+
+    size_t numBlocks = (bytes + SNAPSHOT_COPY_BLOCK - 1)/SNAPSHOT_COPY_BLOCK;
+    vector<Block> blocks(numBlocks);
+    Synch synch(static_cast<int>(numBlocks));
+
+    Executor* pool = threadPool();
+
+    for(size_t i = 0; i < numBlocks; ++i){
+      size_t offset = i*SNAPSHOT_COPY_BLOCK;
+      blocks[i].dst = dst + offset;
+      blocks[i].src = src + offset;
+      blocks[i].size = min(SNAPSHOT_COPY_BLOCK, bytes - offset);
+      blocks[i].synch = &synch;
+
+      Task* task = TaskPool::allocate([](void* arg){
+        auto b = static_cast<Block*>(arg);
+        memcpy(b->dst, b->src, b->size);
+        b->synch->release();
+      }, &blocks[i], 1);
+
+      pool->push(task);
+    }
+
+    waitFor(&synch);
+  }
+
+  bool writeAll(int fd, const char* buf, size_t size){
+    while(size > 0){
+      ssize_t n = write(fd, buf, size);
+      if(n < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        return false;
+      }
+
+      buf += n;
+      size -= n;
+    }
+
+    return true;
+  }
+
+  bool readAll(int fd, char* buf, size_t size){
+    while(size > 0){
+      ssize_t n = read(fd, buf, size);
+      if(n < 0 && errno == EINTR){
+        continue;
+      }
+      if(n <= 0){
+        return false;
+      }
+
+      buf += n;
+      size -= n;
+    }
+
+    return true;
+  }
+
+  // writes to a temporary file that replaces path once it is on disk,
+  // so that a crash mid-write leaves the previous snapshot
+  bool writeSnapshot(const char* data, size_t bytes, const string& path,
+                     bool compress){
+    string tmp = path + ".tmp";
+
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+      return false;
+    }
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.bytes = bytes;
+    header.chunk = SNAPSHOT_CHUNK;
+
+    bool ok = writeAll(fd, reinterpret_cast<const char*>(&header),
+                       sizeof(header));
+
+    vector<char> out(compress ? SNAPSHOT_CHUNK : 0);
+
+    for(size_t offset = 0; ok && offset < bytes; offset += SNAPSHOT_CHUNK){
+      size_t size = min(SNAPSHOT_CHUNK, bytes - offset);
+      const char* chunk = data + offset;
+
+      // stored as is unless it compresses to less
+      uint64_t stored = compress ?
+        Compression::compress(chunk, size, out.data(), size - 1) : 0;
+
+      if(stored == 0){
+        stored = size;
+      }
+      else{
+        chunk = out.data();
+      }
+
+      ok = writeAll(fd, reinterpret_cast<const char*>(&stored),
+                    sizeof(stored)) && writeAll(fd, chunk, stored);
+    }
+
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0){
+      unlink(tmp.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  bool readSnapshot(const string& path, char* data, size_t bytes){
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+      return false;
+    }
+
+    SnapshotHeader header;
+    bool ok = readAll(fd, reinterpret_cast<char*>(&header), sizeof(header)) &&
+      memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+      header.bytes == bytes && header.chunk > 0;
+
+    vector<char> in;
+
+    for(size_t offset = 0; ok && offset < bytes; offset += header.chunk){
+      size_t size = min(size_t(header.chunk), bytes - offset);
+
+      uint64_t stored;
+      ok = readAll(fd, reinterpret_cast<char*>(&stored), sizeof(stored)) &&
+        stored <= size;
+
+      if(!ok){
+        break;
+      }
+
+      if(stored == size){
+        ok = readAll(fd, data + offset, size);
+      }
+      else{
+        in.resize(stored);
+        ok = readAll(fd, in.data(), stored) &&
+          Compression::decompress(in.data(), stored, data + offset, size);
+      }
+    }
+
+    close(fd);
+    return ok;
+  }
+
+  // installed by a JIT with __ares_set_forall_specializer(), it is
+  // asked for a body specialized on the args of each range queued
+  using ForallSpecializer = void* (*)(void* fp, void* args,
+                                      const void* region);
+
+  atomic<ForallSpecializer> _forallSpecializer{nullptr};
+
+  // the body that runs a range of fp over args, fp itself unless a
+  // specializer has compiled one for them
+  inline void* specializedBody(void* fp, void* args, void* region){
+    ForallSpecializer f = _forallSpecializer.load(memory_order_acquire);
+
+    if(f){
+      if(void* sfp = f(fp, args, region)){
+        return sfp;
+      }
+    }
+
+    return fp;
+  }
+
+  // queues [start, end) as one RangeJob chunk per worker under schedule,
+  // or for only width of them if that is not 0
+  void queueChunks(void* synch, void* args, void* fp, uint32_t start,
+                   uint32_t end, Schedule schedule, uint32_t chunk,
+                   uint32_t priority, void* region, uint32_t width=0){
+    auto s = reinterpret_cast<Synch*>(synch);
+
+    if(start >= end){
+      s->release();
+      return;
+    }
+
+    auto pool = threadPool();
+
+    resetCancel(args);
+    fp = specializedBody(fp, args, region);
+    profileLaunch(region, start, end);
+
+    auto job = new RangeJob(s, reinterpret_cast<FuncPtr>(fp),
+                            static_cast<const RegionDesc*>(region), args,
+                            start, end, width ? width : pool->numThreads(),
+                            schedule, chunk);
+
+    uint32_t numTasks = job->numTasks();
+    vector<Task*> tasks(numTasks);
+    for(uint32_t i = 0; i < numTasks; ++i){
+      tasks[i] = TaskPool::allocate(RangeJob::run, nullptr, priority);
+      tasks[i]->emplace<RangeJob::Chunk>(job, i);
+    }
+
+    // chunk i goes back to the worker that ran it at the launch that was
+    // noted, or else is meant for worker i and notes where it ran, as it
+    // does again while a worker that no longer takes part, or one that
+    // ran more than its share of them, would be given them
+    vector<int32_t> owners;
+    if(job->isStatic() && region){
+      owners = ChunkAffinity::owners(static_cast<const RegionDesc*>(region),
+                                     start, end, numTasks);
+    }
+
+    size_t numWorkers = pool->numThreads();
+    size_t share = (numTasks + numWorkers - 1)/numWorkers;
+    vector<uint32_t> load(owners.empty() ? 0 : numWorkers);
+
+    for(int32_t w : owners){
+      if(w < 0 || size_t(w) >= numWorkers || ++load[w] > share){
+        owners.clear();
+        break;
+      }
+    }
+
+    if(!owners.empty()){
+      for(uint32_t i = 0; i < numTasks; ++i){
+        pool->pushToWorker(tasks[i], size_t(owners[i]));
+      }
+    }
+    else if(job->isStatic()){
+      if(region){
+        job->recordOwners();
+      }
+      pool->pushToWorkers(tasks.data(), numTasks);
+    }
+    else{
+      pool->pushRange(tasks.data(), numTasks);
+    }
+  }
+
+  // the work a task of a schedule::auto_() range is sized to, in ns
+  const double AUTO_GRAIN_NS = 20000;
+
+  // the grain of the ranges of a schedule::auto_() Forall, from the time
+  // per iteration measured over its earlier runs, but never coarser than
+  // the default grain, so that expensive, imbalanced bodies are split
+  // finely and cheap ones are not split into more tasks than usual
+  class AutoGrain{
+  public:
+    uint32_t grain(uint32_t n, uint32_t numWorkers) const{
+      uint32_t coarsest = n/(numWorkers * 8);
+      if(coarsest == 0){
+        coarsest = 1;
+      }
+
+      double ns = nsPerIteration_.load(memory_order_relaxed);
+      if(ns <= 0.0){
+        return coarsest;
+      }
+
+      double g = AUTO_GRAIN_NS/ns;
+      if(g < 1.0){
+        return 1;
+      }
+
+      return g < coarsest ? uint32_t(g) : coarsest;
+    }
+
+    // the work of a run is its wall time on all of the workers, which
+    // includes the overhead of too fine a grain
+    void record(uint32_t n, uint32_t numWorkers, double seconds){
+      double ns = seconds * 1e9 * numWorkers / n;
+      double prev = nsPerIteration_.load(memory_order_relaxed);
+      nsPerIteration_.store(prev > 0.0 ? 0.75 * prev + 0.25 * ns : ns,
+                            memory_order_relaxed);
+    }
+
+  private:
+    atomic<double> nsPerIteration_{0.0};
+  };
+
+  // one per region, or body if it has no region
+  AutoGrain& autoGrain(const void* key){
+    static mutex mutex;
+    static unordered_map<const void*, AutoGrain> grains;
+
+    lock_guard<std::mutex> lock(mutex);
+    return grains[key];
+  }
+
+  // the runs that a GrainTuner probes each candidate grain for, the
+  // number of candidates, the slowdown of the chosen one past which it
+  // counts a run as drifting, the drifting runs in a row that have the
+  // candidates probed again, and the runs after which they are anyway
+  const uint32_t TUNE_PROBES = 2;
+  const uint32_t TUNE_CANDIDATES = 8;
+  const double TUNE_DRIFT = 0.2;
+  const uint32_t TUNE_DRIFT_RUNS = 4;
+  const uint32_t TUNE_REPROBE = 1000;
+
+  // regions start on a page, the unit their partitions are placed in
+  const size_t REGION_PAGE_SIZE = 4096;
+
+  // the grain of a tuned Forall, learned online from the wall time of
+  // its runs. Candidate k splits a range into numWorkers * 2^k blocks.
+  // The first runs probe each candidate TUNE_PROBES times, then the one
+  // with the least time per iteration is used until it drifts or is due
+  // to be probed again. Runs may overlap, each is recorded against the
+  // round of probing that it was started in.
+  class GrainTuner{
+  public:
+    struct Ticket{
+      uint32_t round;
+      uint32_t candidate;
+      bool probe;
+    };
+
+    uint32_t grain(uint32_t n, uint32_t numWorkers, Ticket& ticket){
+      lock_guard<mutex> lock(mutex_);
+
+      ticket.round = round_;
+      ticket.probe = issued_ < TUNE_CANDIDATES * TUNE_PROBES;
+
+      if(ticket.probe){
+        ticket.candidate = issued_++ / TUNE_PROBES;
+      }
+      else{
+        ticket.candidate = best_;
+      }
+
+      uint64_t blocks = uint64_t(numWorkers) << ticket.candidate;
+      uint64_t g = n / blocks;
+      return g > 0 ? uint32_t(g) : 1;
+    }
+
+    void record(const Ticket& ticket, uint32_t n, double seconds){
+      lock_guard<mutex> lock(mutex_);
+
+      if(ticket.round != round_){
+        return;
+      }
+
+      double ns = seconds * 1e9 / n;
+
+      if(ticket.probe){
+        double& t = times_[ticket.candidate];
+        t = t > 0.0 && t < ns ? t : ns;
+
+        if(++recorded_ < TUNE_CANDIDATES * TUNE_PROBES){
+          return;
+        }
+
+        for(uint32_t k = 0; k < TUNE_CANDIDATES; ++k){
+          if(times_[k] < times_[best_]){
+            best_ = k;
+          }
+        }
+
+        baseline_ = times_[best_];
+        runs_ = 0;
+        drifting_ = 0;
+        return;
+      }
+
+      if(recorded_ < TUNE_CANDIDATES * TUNE_PROBES){
+        return;
+      }
+
+      drifting_ = ns > baseline_ * (1.0 + TUNE_DRIFT) ? drifting_ + 1 : 0;
+
+      if(drifting_ >= TUNE_DRIFT_RUNS || ++runs_ >= TUNE_REPROBE){
+        reprobe_();
+      }
+    }
+
+  private:
+    void reprobe_(){
+      ++round_;
+      issued_ = 0;
+      recorded_ = 0;
+      for(double& t : times_){
+        t = 0.0;
+      }
+    }
+
+    mutex mutex_;
+    uint32_t round_ = 0;
+    uint32_t issued_ = 0;
+    uint32_t recorded_ = 0;
+    double times_[TUNE_CANDIDATES] = {};
+    uint32_t best_ = 0;
+    double baseline_ = 0.0;
+    uint32_t runs_ = 0;
+    uint32_t drifting_ = 0;
+  };
+
+  // one per region, or body if it has no region
+  GrainTuner& grainTuner(const void* key){
+    static mutex mutex;
+    static unordered_map<const void*, GrainTuner> tuners;
+
+    lock_guard<std::mutex> lock(mutex);
+    return tuners[key];
+  }
+
+  // the grain of a run of [start, end) of the tuned Forall fp, whose
+  // time is recorded once synch completes
+  uint32_t tunedGrain(void* synch, void* fp, void* region, uint32_t start,
+                      uint32_t end){
+    GrainTuner& tuner = grainTuner(region ? region : fp);
+
+    uint32_t n = end - start;
+    GrainTuner::Ticket ticket;
+    uint32_t grain = tuner.grain(n, threadPool()->numThreads(), ticket);
+
+    auto t0 = chrono::steady_clock::now();
+
+    reinterpret_cast<Synch*>(synch)->then([&tuner, ticket, n, t0]{
+      auto t = chrono::steady_clock::now() - t0;
+      tuner.record(ticket, n, chrono::duration<double>(t).count());
+    });
+
+    return grain;
+  }
+
+  // the slowdown over the fastest width that a narrower one may have and
+  // still be chosen, so that workers are only given up where adding them
+  // no longer helps
+  const double THROTTLE_SLACK = 0.05;
+
+  // the workers that a bandwidth throttled Forall runs on, learned online
+  // from the wall time of its runs like the grain of a GrainTuner.
+  // Candidate k runs a range on numWorkers * (TUNE_CANDIDATES - k) /
+  // TUNE_CANDIDATES of them, rounded up, and the narrowest within
+  // THROTTLE_SLACK of the fastest is used until it drifts, is due to be
+  // probed again or the pool is resized. A memory bound region that
+  // saturates at a fraction of the workers so leaves the rest idle.
+  class WidthTuner{
+  public:
+    struct Ticket{
+      uint32_t round;
+      uint32_t candidate;
+      bool probe;
+    };
+
+    uint32_t width(uint32_t numWorkers, Ticket& ticket){
+      lock_guard<mutex> lock(mutex_);
+
+      if(numWorkers != numWorkers_){
+        numWorkers_ = numWorkers;
+        reprobe_();
+      }
+
+      ticket.round = round_;
+      ticket.probe = issued_ < TUNE_CANDIDATES * TUNE_PROBES;
+
+      if(ticket.probe){
+        ticket.candidate = issued_++ / TUNE_PROBES;
+      }
+      else{
+        ticket.candidate = best_;
+      }
+
+      return width_(ticket.candidate);
+    }
+
+    void record(const Ticket& ticket, uint32_t n, double seconds){
+      lock_guard<mutex> lock(mutex_);
+
+      if(ticket.round != round_){
+        return;
+      }
+
+      double ns = seconds * 1e9 / n;
+
+      if(ticket.probe){
+        double& t = times_[ticket.candidate];
+        t = t > 0.0 && t < ns ? t : ns;
+
+        if(++recorded_ < TUNE_CANDIDATES * TUNE_PROBES){
+          return;
+        }
+
+        double fastest = times_[0];
+        for(uint32_t k = 1; k < TUNE_CANDIDATES; ++k){
+          fastest = times_[k] < fastest ? times_[k] : fastest;
+        }
+
+        best_ = 0;
+        for(uint32_t k = 0; k < TUNE_CANDIDATES; ++k){
+          if(times_[k] <= fastest * (1.0 + THROTTLE_SLACK)){
+            best_ = k;
+          }
+        }
+
+        baseline_ = times_[best_];
+        chosen_ = width_(best_);
+        runs_ = 0;
+        drifting_ = 0;
+        return;
+      }
+
+      if(recorded_ < TUNE_CANDIDATES * TUNE_PROBES){
+        return;
+      }
+
+      drifting_ = ns > baseline_ * (1.0 + TUNE_DRIFT) ? drifting_ + 1 : 0;
+
+      if(drifting_ >= TUNE_DRIFT_RUNS || ++runs_ >= TUNE_REPROBE){
+        reprobe_();
+      }
+    }
+
+    // the width last chosen, 0 while the first probes run
+    uint32_t chosen(){
+      lock_guard<mutex> lock(mutex_);
+      return chosen_;
+    }
+
+  private:
+    uint32_t width_(uint32_t candidate) const{
+      uint32_t c = TUNE_CANDIDATES;
+      uint32_t w = (numWorkers_ * (c - candidate) + c - 1) / c;
+      return w > 0 ? w : 1;
+    }
+
+    void reprobe_(){
+      ++round_;
+      issued_ = 0;
+      recorded_ = 0;
+      for(double& t : times_){
+        t = 0.0;
+      }
+    }
+
+    mutex mutex_;
+    uint32_t numWorkers_ = 0;
+    uint32_t round_ = 0;
+    uint32_t issued_ = 0;
+    uint32_t recorded_ = 0;
+    double times_[TUNE_CANDIDATES] = {};
+    uint32_t best_ = 0;
+    uint32_t chosen_ = 0;
+    double baseline_ = 0.0;
+    uint32_t runs_ = 0;
+    uint32_t drifting_ = 0;
+  };
+
+  mutex _widthTunerMutex;
+  unordered_map<const void*, WidthTuner> _widthTuners;
+
+  // one per region key, which the region stats are looked up by
+  WidthTuner& widthTuner(const void* key){
+    lock_guard<mutex> lock(_widthTunerMutex);
+    return _widthTuners[key];
+  }
+
+  // the workers a throttled region runs on, 0 if it is not throttled
+  uint32_t throttledWidth(const void* key){
+    lock_guard<mutex> lock(_widthTunerMutex);
+    auto itr = _widthTuners.find(key);
+    return itr != _widthTuners.end() ? itr->second.chosen() : 0;
+  }
+
+  // Foralls without a grain or schedule run on only as many workers as
+  // help them, read once from ARES_THROTTLE
+  bool throttleEnabled(){
+    static bool enabled = []{
+      const char* s = getenv("ARES_THROTTLE");
+      return s && strcmp(s, "0") != 0;
+    }();
+
+    return enabled;
+  }
+
+  // queues a run of [start, end) of the throttled Forall fp as dynamic
+  // chunks on the width of its WidthTuner, whose time is recorded once
+  // synch completes
+  void queueThrottled(void* synch, void* args, void* fp, uint32_t start,
+                      uint32_t end, uint32_t priority, void* region){
+    const void* key = regionKey(reinterpret_cast<FuncPtr>(fp),
+                                static_cast<const RegionDesc*>(region));
+    WidthTuner& tuner = widthTuner(key);
+
+    uint32_t n = end - start;
+    WidthTuner::Ticket ticket;
+    uint32_t width = tuner.width(threadPool()->numThreads(), ticket);
+
+    auto t0 = chrono::steady_clock::now();
+
+    reinterpret_cast<Synch*>(synch)->then([&tuner, ticket, n, t0]{
+      auto t = chrono::steady_clock::now() - t0;
+      tuner.record(ticket, n, chrono::duration<double>(t).count());
+    });
+
+    queueChunks(synch, args, fp, start, end, Schedule::Dynamic,
+                scheduleConfig().chunk, priority, region, width);
+  }
+
+} // namespace
+
+namespace ares{
+
+  void registerExecutor(const string& name, ExecutorFactory factory){
+    executorFactories()[name] = factory;
+  }
+
+} // namespace ares
+
+// the jobs of one ares_threadpool on the shared pool. Each queued job
+// holds a reference, so that the last one to finish can still signal a
+// waiter that goes on to destroy the pool.
+struct ares_thpool_{
+  using Func = void* (*)(void*);
+
+  struct Job{
+    ares_thpool_* pool;
+    Func func;
+    void* arg;
+  };
+
+  ares_thpool_()
+  : refs_(1),
+  pending_(0),
+  working_(0),
+  paused_(false){}
+
+  void add(Func func, void** args, size_t n){
+    refs_.fetch_add(int64_t(n), memory_order_relaxed);
+    pending_.fetch_add(int64_t(n), memory_order_relaxed);
+
+    vector<Task*> tasks(n);
+    for(size_t i = 0; i < n; ++i){
+      tasks[i] = TaskPool::allocate(run_, new Job{this, func, args[i]}, 1);
+    }
+
+    mutex_.lock();
+    if(paused_){
+      held_.insert(held_.end(), tasks.begin(), tasks.end());
+      mutex_.unlock();
+      return;
+    }
+    mutex_.unlock();
+
+    threadPool()->pushRange(tasks.data(), n);
+  }
+
+  // a worker runs other tasks meanwhile, like waitFor()
+  void wait(){
+    Executor* pool = threadPool();
+
+    if(pool->workerIndex() >= 0){
+      while(pending_.load(memory_order_acquire) > 0){
+        if(!pool->tryRunOne()){
+          cpuRelax();
+        }
+      }
+      return;
+    }
+
+    unique_lock<mutex> lock(mutex_);
+    done_.wait(lock, [&]{
+      return pending_.load(memory_order_acquire) == 0;
+    });
+  }
+
+  void pause(){
+    lock_guard<mutex> lock(mutex_);
+    paused_ = true;
+  }
+
+  void resume(){
+    vector<Task*> tasks;
+
+    mutex_.lock();
+    paused_ = false;
+    tasks.swap(held_);
+    mutex_.unlock();
+
+    threadPool()->pushRange(tasks.data(), tasks.size());
+  }
+
+  int working() const{
+    return working_.load(memory_order_relaxed);
+  }
+
+  void release(){
+    if(refs_.fetch_sub(1, memory_order_acq_rel) == 1){
+      delete this;
+    }
+  }
+
+private:
+  static void run_(void* arg){
+    auto job = static_cast<Job*>(arg);
+    ares_thpool_* p = job->pool;
+
+    p->working_.fetch_add(1, memory_order_relaxed);
+    job->func(job->arg);
+    p->working_.fetch_sub(1, memory_order_relaxed);
+    delete job;
+
+    if(p->pending_.fetch_sub(1, memory_order_acq_rel) == 1){
+      lock_guard<mutex> lock(p->mutex_);
+      p->done_.notify_all();
+    }
+
+    p->release();
+  }
+
+  atomic<int64_t> refs_;
+  atomic<int64_t> pending_;
+  atomic<int> working_;
+  mutex mutex_;
+  condition_variable done_;
+  bool paused_;
+  vector<Task*> held_;
+};
+
+extern "C"{
+
+  void* __ares_alloc(uint64_t bytes){
+    return Allocator::allocate(bytes);
+  }
+
+  // align is a power of two, for buffers such as per-worker partials
+  // that should start on a cache line. Freed with __ares_free().
+  void* __ares_alloc_aligned(uint64_t bytes, uint64_t align){
+    return Allocator::allocateAligned(bytes, align);
+  }
+
+  void __ares_free(void* ptr){
+    Allocator::release(ptr);
+  }
+
+  // a buffer of partitions of blockBytes each, partition i first touched
+  // by a worker of group i % numGroups(), so that its pages are local to
+  // the node that __ares_task_place() queues its tasks on. Freed with
+  // __ares_free().
+  void* __ares_region_alloc(uint64_t bytes, uint64_t blockBytes){
+    void* buf = Allocator::allocateAligned(bytes, REGION_PAGE_SIZE);
+    if(bytes == 0 || blockBytes == 0){
+      return buf;
+    }
+
+    struct Block{
+      char* begin;
+      uint64_t size;
+      Synch* synch;
+    };
+
+    uint64_t numBlocks = (bytes + blockBytes - 1)/blockBytes;
+    vector<Block> blocks(numBlocks);
+    Synch synch(static_cast<int>(numBlocks));
+
+    Executor* pool = threadPool();
+
+    for(uint64_t i = 0; i < numBlocks; ++i){
+      uint64_t offset = i*blockBytes;
+      blocks[i].begin = static_cast<char*>(buf) + offset;
+      blocks[i].size = min(blockBytes, bytes - offset);
+      blocks[i].synch = &synch;
+
+      Task* task = TaskPool::allocate([](void* arg){
+        auto b = static_cast<Block*>(arg);
+        memset(b->begin, 0, b->size);
+        b->synch->release();
+      }, &blocks[i], 1);
+
+      pool->pushToGroup(task, i);
+    }
+
+    waitFor(&synch);
+    return buf;
+  }
+
+  // ares::atomic_add(), where the compiler did not lower it
+  void __ares_atomic_add_i32(int32_t* x, int32_t v){
+    __atomic_fetch_add(x, v, __ATOMIC_RELAXED);
+  }
+
+  void __ares_atomic_add_u32(uint32_t* x, uint32_t v){
+    __atomic_fetch_add(x, v, __ATOMIC_RELAXED);
+  }
+
+  void __ares_atomic_add_i64(int64_t* x, int64_t v){
+    __atomic_fetch_add(x, v, __ATOMIC_RELAXED);
+  }
+
+  void __ares_atomic_add_u64(uint64_t* x, uint64_t v){
+    __atomic_fetch_add(x, v, __ATOMIC_RELAXED);
+  }
+
+  void __ares_atomic_add_f32(float* x, float v){
+    float old;
+    __atomic_load(x, &old, __ATOMIC_RELAXED);
+
+    float sum;
+    do{
+      sum = old + v;
+    } while(!__atomic_compare_exchange(x, &old, &sum, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  }
+
+  void __ares_atomic_add_f64(double* x, double v){
+    double old;
+    __atomic_load(x, &old, __ATOMIC_RELAXED);
+
+    double sum;
+    do{
+      sum = old + v;
+    } while(!__atomic_compare_exchange(x, &old, &sum, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  }
+
+  // ares::cancel(), outside of a range it does nothing
+  void __ares_cancel(){
+    void* args = _rangeArgs;
+    if(!args){
+      return;
+    }
+
+    lock_guard<mutex> lock(_cancelMutex);
+    if(_cancelled.insert(args).second){
+      _numCancelled.fetch_add(1, memory_order_release);
+    }
+  }
+
+  bool __ares_cancelled(){
+    return _rangeArgs && rangeCancelled(_rangeArgs);
+  }
+
+  // ares::scratch(), a block of the calling thread's scratch arena
+  void* __ares_scratch(uint64_t bytes){
+    return Scratch::allocate(bytes);
+  }
+
+  // lowered bodies that call ares::scratch() take a mark on entry and
+  // release it on return, and around each iteration that allocates
+  uint64_t __ares_scratch_mark(){
+    return Scratch::mark();
+  }
+
+  void __ares_scratch_release(uint64_t mark){
+    Scratch::release(mark);
+  }
+
+  void* __ares_create_synch(uint32_t count){
+    return new Synch(count);
+  }
+
+  // the context of the reduce at site, with room for bytes of partials
+  // aligned to a cache line and its synch armed for one release
+  void* __ares_reduce_context(void** site, uint64_t bytes){
+    auto ctx = static_cast<ReduceContext*>(
+      __atomic_exchange_n(site, nullptr, __ATOMIC_ACQUIRE));
+
+    if(!ctx){
+      ctx = new ReduceContext;
+    }
+
+    if(ctx->bytes < bytes){
+      Allocator::release(ctx->partials);
+      ctx->partials = Allocator::allocateAligned(bytes, 64);
+      ctx->bytes = bytes;
+    }
+
+    return ctx;
+  }
+
+  // waits for the range queued with the context's synch, which is then
+  // armed again for the next one
+  void __ares_reduce_await(void* context){
+    auto ctx = static_cast<ReduceContext*>(context);
+    waitFor(ctx->synch);
+    ctx->synch->reset(1);
+  }
+
+  // puts the context back at site, or frees it if another run of the
+  // site has put its own back meanwhile
+  void __ares_reduce_release(void** site, void* context){
+    void* empty = nullptr;
+    if(!__atomic_compare_exchange_n(site, &empty, context, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+      delete static_cast<ReduceContext*>(context);
+    }
+  }
+
+  void* __ares_create_barrier(uint32_t count){
+    return new Barrier(count);
+  }
+
+  void __ares_wait_barrier(void* barrier){
+    auto b = static_cast<Barrier*>(barrier);
+    Trace::record(Trace::BarrierBegin);
+    b->wait();
+    Trace::record(Trace::BarrierEnd);
+  }
+
+  // the two halves of __ares_wait_barrier()
+  int32_t __ares_arrive_barrier(void* barrier){
+    return static_cast<Barrier*>(barrier)->arrive();
+  }
+
+  void __ares_depart_barrier(void* barrier, int32_t token){
+    Trace::record(Trace::BarrierBegin);
+    static_cast<Barrier*>(barrier)->wait(token);
+    Trace::record(Trace::BarrierEnd);
+  }
+
+  void __ares_delete_barrier(void* barrier){
+    auto b = static_cast<Barrier*>(barrier);
+    delete b;
+  }
+
+  // region is the RegionDesc of the construct fp was outlined from, in
+  // this and the other queueing calls, or null
+  void __ares_queue_func(void* synch, void* args, void* fp,
+                         uint32_t index, uint32_t priority, void* region){
+    if(PerfCounters::enabled()){
+      Task* task = TaskPool::allocate(runFuncRegion, nullptr, priority);
+      task->emplace<FuncRegion>(reinterpret_cast<Synch*>(synch), index, args,
+                                reinterpret_cast<FuncPtr>(fp),
+                                static_cast<const RegionDesc*>(region));
+      threadPool()->push(task);
+      return;
+    }
+
+    Task* task =
+      TaskPool::allocate(reinterpret_cast<FuncPtr>(fp), nullptr, priority);
+    task->emplace<FuncArg>(reinterpret_cast<Synch*>(synch), index, args);
+    threadPool()->push(task);
+  }
+
+  void __ares_queue_chunks(void* synch, void* args, void* fp,
+                           uint32_t start, uint32_t end, uint32_t priority,
+                           void* region){
+    const ScheduleConfig& config = scheduleConfig();
+    queueChunks(synch, args, fp, start, end, config.schedule, config.chunk,
+                priority, region);
+  }
+
+  // grain is the largest range a task runs without splitting, 0 picks
+  // one from the ARES_SCHEDULE chunk or the number of workers
+  void __ares_queue_range(void* synch, void* args, void* fp,
+                          uint32_t start, uint32_t end,
+                          uint32_t grain, uint32_t priority, void* region){
+    if(scheduleConfig().schedule == Schedule::Affinity){
+      __ares_queue_chunks(synch, args, fp, start, end, priority, region);
+      return;
+    }
+
+    if(grain == 0 && start < end && throttleEnabled() &&
+       scheduleConfig().schedule != Schedule::Tune){
+      queueThrottled(synch, args, fp, start, end, priority, region);
+      return;
+    }
+
+    auto s = reinterpret_cast<Synch*>(synch);
+
+    if(start >= end){
+      s->release();
+      return;
+    }
+
+    auto pool = threadPool();
+
+    resetCancel(args);
+    fp = specializedBody(fp, args, region);
+    profileLaunch(region, start, end);
+
+    uint32_t n = end - start;
+
+    if(grain == 0 && scheduleConfig().schedule == Schedule::Tune){
+      grain = tunedGrain(synch, fp, region, start, end);
+    }
+
+    if(grain == 0){
+      grain = scheduleConfig().chunk;
+    }
+
+    if(grain == 0){
+      grain = n/(pool->numThreads() * 8);
+    }
+
+    if(grain == 0){
+      grain = 1;
+    }
+
+    auto desc = static_cast<const RegionDesc*>(region);
+
+    auto runChunk = [=](uint32_t begin, uint32_t end){
+      runRangeChunk(reinterpret_cast<FuncPtr>(fp), desc, begin, end, args);
+    };
+
+    if(pool->runRange(start, end, grain, runChunk)){
+      s->release();
+      return;
+    }
+
+    auto job = new SplitJob(s, reinterpret_cast<FuncPtr>(fp), desc, args,
+                            n, grain, priority);
+
+    pool->push(SplitJob::createTask(job, start, end));
+  }
+
+  // f is called with the body, args and region descriptor of each range
+  // before it is queued and returns the body to run in place of it, or
+  // null to keep it. Null uninstalls it.
+  void __ares_set_forall_specializer(void* (*f)(void* fp, void* args,
+                                                const void* region)){
+    _forallSpecializer.store(f, memory_order_release);
+  }
+
+  // the FuncArg lives in the task's inline storage, which is recycled by
+  // the worker once the function returns
+  void __ares_finish_func(void* arg){
+    auto a = reinterpret_cast<FuncArg*>(arg);
+    a->synch->release();
+  }
+
+  void __ares_signal_synch(void* sync){
+    auto s = reinterpret_cast<Synch*>(sync);
+    s->release();
+  }
+
+  void __ares_await_synch(void* synch){
+    auto s = reinterpret_cast<Synch*>(synch);
+    waitFor(s);
+    delete s;
+  }
+
+  // queues the range once the synch after has completed, or right away
+  // if it is null, without blocking the caller
+  void __ares_queue_range_after(void* after, void* synch, void* args,
+                                void* fp, uint32_t start, uint32_t end,
+                                uint32_t grain, uint32_t priority,
+                                void* region){
+    if(!after){
+      __ares_queue_range(synch, args, fp, start, end, grain, priority,
+                         region);
+      return;
+    }
+
+    reinterpret_cast<Synch*>(after)->then([=]{
+      __ares_queue_range(synch, args, fp, start, end, grain, priority,
+                         region);
+    });
+  }
+
+  // queues the range of a Forall with a schedule: 1 static, one block
+  // per worker, 2 dynamic and 3 guided with chunk as their chunk or
+  // minimum, 0 picking one, 4 auto, splitting with the grain of
+  // AutoGrain, 5 tune, splitting with the grain of a GrainTuner, and 0
+  // as __ares_queue_range() with a grain of chunk. It is queued once
+  // after has completed if that is not null.
+  void __ares_queue_scheduled(void* after, void* synch, void* args,
+                              void* fp, uint32_t start, uint32_t end,
+                              uint32_t schedule, uint32_t chunk,
+                              uint32_t priority, void* region){
+    if(after){
+      reinterpret_cast<Synch*>(after)->then([=]{
+        __ares_queue_scheduled(nullptr, synch, args, fp, start, end,
+                               schedule, chunk, priority, region);
+      });
+      return;
+    }
+
+    switch(schedule){
+    case 1:
+      queueChunks(synch, args, fp, start, end, Schedule::Static, chunk,
+                  priority, region);
+      return;
+    case 2:
+      queueChunks(synch, args, fp, start, end, Schedule::Dynamic, chunk,
+                  priority, region);
+      return;
+    case 3:
+      queueChunks(synch, args, fp, start, end, Schedule::Guided, chunk,
+                  priority, region);
+      return;
+    case 4:
+      break;
+    case 5:
+      if(start < end){
+        chunk = tunedGrain(synch, fp, region, start, end);
+      }
+      __ares_queue_range(synch, args, fp, start, end, chunk, priority,
+                         region);
+      return;
+    default:
+      __ares_queue_range(synch, args, fp, start, end, chunk, priority,
+                         region);
+      return;
+    }
+
+    auto s = reinterpret_cast<Synch*>(synch);
+
+    if(start >= end){
+      s->release();
+      return;
+    }
+
+    AutoGrain& ag = autoGrain(region ? region : fp);
+
+    uint32_t n = end - start;
+    uint32_t numWorkers = threadPool()->numThreads();
+    uint32_t grain = ag.grain(n, numWorkers);
+
+    auto t0 = chrono::steady_clock::now();
+
+    s->then([&ag, n, numWorkers, t0]{
+      auto t = chrono::steady_clock::now() - t0;
+      ag.record(n, numWorkers, chrono::duration<double>(t).count());
+    });
+
+    __ares_queue_range(synch, args, fp, start, end, grain, priority, region);
+  }
+
+  // waits for the synch held by an ares::Completion, if any
+  void __ares_wait_completion(void* handle){
+    ares_wait_completion(reinterpret_cast<void**>(handle));
+  }
+
+  // allocates the args of a spawned task call, with its future
+  void* __ares_task_alloc(uint64_t bytes){
+    void* frame = FramePool::allocate(TASK_FUTURE_SIZE + bytes);
+    auto f = new (frame) TaskFuture(false);
+
+    auto args = reinterpret_cast<TaskArg*>(
+      static_cast<char*>(frame) + TASK_FUTURE_SIZE);
+    args->futureSync = &f->synch;
+
+    return args;
+  }
+
+  // the bytes ahead of the args in the frame of a spawned task call
+  uint64_t __ares_task_frame_size(){
+    return TASK_FUTURE_SIZE;
+  }
+
+  // sets up a frame of __ares_task_frame_size() and more bytes that the
+  // caller allocated on its stack, aligned to 16, and returns its args
+  void* __ares_task_init(void* frame){
+    auto f = new (frame) TaskFuture(true);
+
+    auto args = reinterpret_cast<TaskArg*>(
+      static_cast<char*>(frame) + TASK_FUTURE_SIZE);
+    args->futureSync = &f->synch;
+
+    return args;
+  }
+
+  // drops the caller's reference to the frame of a spawned task call. A
+  // frame on the stack is left once the task has dropped its own, which
+  // a worker still holding the claimed task may do after the result is
+  // in, so the caller helps with other tasks meanwhile.
+  void __ares_task_free(void* argsPtr){
+    TaskFuture* f = taskFuture(reinterpret_cast<TaskArg*>(argsPtr));
+    if(!f->stack){
+      dropTaskFuture(f);
+      return;
+    }
+
+    Executor* pool = threadPool();
+    bool worker = pool->workerIndex() >= 0;
+    size_t idle = 0;
+
+    flushTaskBundle();
+    f->refs.fetch_sub(1, memory_order_acq_rel);
+
+    while(f->refs.load(memory_order_acquire) != 0){
+      if(worker && pool->tryRunOne()){
+        idle = 0;
+      }
+      else if(++idle < 64){
+        cpuRelax();
+      }
+      else if(worker){
+        pool->yield();
+      }
+      else{
+        this_thread::yield();
+      }
+    }
+
+    f->~TaskFuture();
+  }
+
+  void __ares_task_queue(void* funcPtr, void* argsPtr, uint32_t priority,
+                         void* region){
+    auto func = reinterpret_cast<FuncPtr>(funcPtr);
+    auto args = reinterpret_cast<TaskArg*>(argsPtr);
+    args->depth = taskDepth() + 1;
+    TaskFuture* f = taskFuture(args);
+
+    bool graph = TaskSpan::enabled();
+    if(graph){
+      f->edge = TaskSpan::spawn(threadPool()->workerIndex() < 0);
+    }
+
+    f->func = func;
+    f->region = static_cast<const RegionDesc*>(region);
+    f->task = TaskPool::allocate(runTask, args, priority);
+    if(f->region){
+      f->task->stack = taskStackKB(f->region->stack);
+    }
+
+    f->group = taskGroup();
+    if(f->group){
+      f->group->add(1);
+    }
+
+    startTaskCall(f, true);
+
+    if(graph){
+      TaskSpan::spawned();
+    }
+  }
+
+  // makes a spawned call wait for the calls its caller spawned before it
+  // that conflict on addr. Called after __ares_task_alloc() and before
+  // __ares_task_queue().
+  void __ares_task_depend(void* argsPtr, void* addr, uint32_t mode){
+    TaskFuture* f = taskFuture(reinterpret_cast<TaskArg*>(argsPtr));
+
+    TaskDeps*& deps = taskDeps();
+    if(!deps){
+      deps = new TaskDeps;
+    }
+
+    TaskDeps::Region& r = deps->regions[addr];
+
+    auto after = [&](TaskFuture* p){
+      if(p == f){
+        return;
+      }
+
+      f->pending.fetch_add(1, memory_order_relaxed);
+
+      // run by p as it returns, or right away, while p is still held
+      p->synch.then([=]{
+        if(TaskSpan::enabled()){
+          f->deps.arrive(p->synch.join().path());
+        }
+        startTaskCall(f);
+      });
+    };
+
+    if(r.writer){
+      after(r.writer);
+    }
+
+    if(mode & TASK_DEP_OUT){
+      for(TaskFuture* p : r.readers){
+        after(p);
+        dropTaskFuture(p);
+      }
+      r.readers.clear();
+
+      if(r.writer && r.writer != f){
+        dropTaskFuture(r.writer);
+        r.writer = nullptr;
+      }
+
+      if(r.writer != f){
+        f->refs.fetch_add(1, memory_order_relaxed);
+        r.writer = f;
+      }
+    }
+    else if(r.writer != f && 
+            find(r.readers.begin(), r.readers.end(), f) == r.readers.end()){
+      f->refs.fetch_add(1, memory_order_relaxed);
+      r.readers.push_back(f);
+    }
+  }
+
+  // queues a spawned call on the worker group of partition, where
+  // __ares_region_alloc() placed it. Called after __ares_task_alloc() and
+  // before __ares_task_queue().
+  void __ares_task_place(void* argsPtr, uint32_t partition){
+    TaskFuture* f = taskFuture(reinterpret_cast<TaskArg*>(argsPtr));
+    f->place = int32_t(partition % threadPool()->numGroups());
+  }
+
+  // the frame that a call of the memoized task func shares with the
+  // calls made before it with the same size bytes of arguments at key,
+  // that of the first of them, which the caller awaits as its own after
+  // argsPtr was released, or argsPtr itself, which the caller queues as
+  // usual. Called after __ares_task_alloc() and before the dependences
+  // of argsPtr. The table holds a reference to the frames it keeps, and
+  // with it their results, until ares_task_memo_clear().
+  void* __ares_task_memo(void* argsPtr, void* func, void* key,
+                         uint64_t size){
+    TaskFuture* f = taskFuture(reinterpret_cast<TaskArg*>(argsPtr));
+    f->shared = true;
+    f->refs.fetch_add(1, memory_order_relaxed);
+
+    void* shared = memoTable().claim(func, key, size, argsPtr,
+      [](void* found){
+        taskFuture(static_cast<TaskArg*>(found))->refs.fetch_add(
+          1, memory_order_relaxed);
+      });
+
+    if(shared != argsPtr){
+      f->~TaskFuture();
+      FramePool::release(f);
+    }
+
+    return shared;
+  }
+
+  // non-zero if a task call made here should be spawned, otherwise the
+  // lowered call runs the sequential version of the function, as it
+  // does while the runtime's memory is over a limit
+  uint32_t __ares_task_spawn(){
+    if(taskDepth() >= taskCutoff()){
+      return 0;
+    }
+
+    if(MemoryAccount::overLimit()){
+      MemoryAccount::inlined();
+      return 0;
+    }
+
+    return 1;
+  }
+
+  // the caller holds its reference to the frame throughout
+  void __ares_task_await_future(void* argsPtr){
+    auto args = reinterpret_cast<TaskArg*>(argsPtr);
+
+    if(!TaskSpan::enabled()){
+      awaitTaskCall(args);
+      return;
+    }
+
+    TaskSpan::awaitBegin(threadPool()->workerIndex() < 0);
+    awaitTaskCall(args);
+    TaskSpan::awaitEnd(args->futureSync->join(), taskFuture(args)->edge.id);
+  }
+
+  bool __ares_task_try_await_future(void* argsPtr){
+    auto args = reinterpret_cast<TaskArg*>(argsPtr);
+    flushTaskBundle();
+    return args->futureSync->tryAwait();
+  }
+
+  // the last thing the wrapper of a spawned call does
+  void __ares_task_release_future(void* argsPtr){
+    auto args = reinterpret_cast<TaskArg*>(argsPtr);
+    if(TaskSpan::enabled()){
+      TaskSpan::end(args->futureSync->join());
+    }
+    args->futureSync->release();
+  }
+
+  // a future that completes after count calls to __ares_future_release,
+  // each of which holds a reference until it has released
+  void* __ares_future_create(uint32_t count){
+    return new Future(count, count + 1);
+  }
+
+  void __ares_future_release(void* future){
+    auto f = static_cast<Future*>(future);
+    f->synch.release();
+    dropFuture(f);
+  }
+
+  void __ares_future_await(void* future){
+    auto f = static_cast<Future*>(future);
+    waitFor(&f->synch);
+    dropFuture(f);
+  }
+
+  // queues func(args) once future has completed, without blocking, and
+  // returns the future of that call
+  void* __ares_future_then(void* future, void* fp, void* args,
+                           uint32_t priority){
+    auto f = static_cast<Future*>(future);
+    auto r = new Future(1, 2);
+
+    auto func = reinterpret_cast<FuncPtr>(fp);
+
+    f->synch.then([=]{
+      Task* task = TaskPool::allocate(Continuation::run, nullptr, priority);
+      Continuation* c = task->emplace<Continuation>();
+      c->func = func;
+      c->args = args;
+      c->future = r;
+      threadPool()->push(task);
+    });
+
+    dropFuture(f);
+
+    return r;
+  }
+
+  void* __ares_future_when_all(void** futures, uint32_t n){
+    auto r = new Future(n, n + 1);
+
+    for(uint32_t i = 0; i < n; ++i){
+      auto f = static_cast<Future*>(futures[i]);
+      f->synch.then([=]{
+        r->synch.release();
+        dropFuture(r);
+      });
+      dropFuture(f);
+    }
+
+    return r;
+  }
+
+  void* __ares_future_when_any(void** futures, uint32_t n){
+    auto r = new Future(n > 0 ? 1 : 0, 2);
+
+    auto state = new AnyState;
+    state->future = r;
+    state->fired = false;
+    state->refs = n;
+
+    for(uint32_t i = 0; i < n; ++i){
+      auto f = static_cast<Future*>(futures[i]);
+      f->synch.then([=]{
+        if(!state->fired.exchange(true, memory_order_acq_rel)){
+          r->synch.release();
+          dropFuture(r);
+        }
+        if(state->refs.fetch_sub(1, memory_order_acq_rel) == 1){
+          delete state;
+        }
+      });
+      dropFuture(f);
+    }
+
+    if(n == 0){
+      dropFuture(r);
+      delete state;
+    }
+
+    return r;
+  }
+
+  // lowered sends and receives, the split-phase ones release future once
+  // buf can be reused or holds the message, which is copied into it by a
+  // task rather than on the engine thread
+  // as ares_isend(), but a lowered send has no way to fail, so it waits
+  // for room in the send queue whatever ARES_SEND_FULL says
+  static CommRequest* sendLowered(int rank, uint32_t tag, void* buf,
+                                  uint64_t size){
+    auto request = new CommRequest;
+    auto msg = new MessageBuffer(MessageType::Raw, static_cast<char*>(buf),
+                                 size, false);
+    msg->setRequest(request);
+    _communicator->send(rank, tag, msg);
+    return request;
+  }
+
+  void __ares_comm_send(int32_t rank, uint32_t tag, void* buf,
+                        uint64_t size){
+    size_t n;
+    ares_wait(sendLowered(rank, tag, buf, size), n);
+  }
+
+  void __ares_comm_isend(int32_t rank, uint32_t tag, void* buf,
+                         uint64_t size, void* future){
+    CommRequest* request = sendLowered(rank, tag, buf, size);
+    request->onComplete([=]{
+      size_t n;
+      ares_wait(request, n);
+      __ares_future_release(future);
+    });
+  }
+
+  // posted into the variable received, so a large message is read
+  // straight into it
+  void __ares_comm_receive(int32_t rank, uint32_t tag, void* buf,
+                           uint64_t size){
+    size_t n;
+    ares_wait(ares_recv_into(rank, tag, static_cast<char*>(buf), size), n);
+  }
+
+  void __ares_comm_ireceive(int32_t rank, uint32_t tag, void* buf,
+                            uint64_t size, void* future){
+    CommRequest* request = 
+      ares_recv_into(rank, tag, static_cast<char*>(buf), size);
+    ares_on_complete(request, [=]{
+      size_t n;
+      ares_wait(request, n);
+      __ares_future_release(future);
+    });
+  }
+
+  void __ares_comm_barrier(){
+    ares_barrier();
+  }
+
+  // as the above over a team, team is the ares::CommTeam and rank a team
+  // rank
+  void __ares_comm_team_send(void* team, int32_t rank, uint32_t tag,
+                             void* buf, uint64_t size){
+    auto t = static_cast<CommTeam*>(team);
+    __ares_comm_send(ares_team_world_rank(t, rank), tag, buf, size);
+  }
+
+  void __ares_comm_team_isend(void* team, int32_t rank, uint32_t tag,
+                              void* buf, uint64_t size, void* future){
+    auto t = static_cast<CommTeam*>(team);
+    __ares_comm_isend(ares_team_world_rank(t, rank), tag, buf, size, future);
+  }
+
+  void __ares_comm_team_receive(void* team, int32_t rank, uint32_t tag,
+                                void* buf, uint64_t size){
+    auto t = static_cast<CommTeam*>(team);
+    __ares_comm_receive(ares_team_world_rank(t, rank), tag, buf, size);
+  }
+
+  void __ares_comm_team_ireceive(void* team, int32_t rank, uint32_t tag,
+                                 void* buf, uint64_t size, void* future){
+    auto t = static_cast<CommTeam*>(team);
+    __ares_comm_ireceive(ares_team_world_rank(t, rank), tag, buf, size,
+                         future);
+  }
+
+  void __ares_comm_team_barrier(void* team){
+    ares_team_barrier(static_cast<CommTeam*>(team));
+  }
+
+  // the share of this rank of a distributed Forall, which the lowered
+  // Forall runs as the local indices below the count returned, dist is
+  // the ares::Distribution
+  uint32_t __ares_distribute_range(void* dist, uint32_t start, uint32_t end,
+                                   uint32_t* base, uint32_t* stride){
+    RangeShare share = 
+      ares_share(*static_cast<Distribution*>(dist), start, end);
+
+    *base = share.base;
+    *stride = share.stride;
+    return share.count;
+  }
+
+  // runs an offloaded Forall on the GPU, 0 if the caller has to queue it
+  // instead, see Offload::launch()
+  uint32_t __ares_offload_range(void* ptx, void* args, uint64_t argsSize,
+                                void* ptrOffsets, uint32_t numPtrs,
+                                uint32_t start, uint32_t end){
+    return Offload::get().launch(static_cast<const char*>(ptx), args, 
+                                 argsSize,
+                                 static_cast<const uint32_t*>(ptrOffsets),
+                                 numPtrs, start, end);
+  }
+
+  // starts an offloaded Forall on the GPU and returns where the part the
+  // caller queues begins, see Offload::split()
+  uint32_t __ares_offload_split(void* ptx, void* args, uint64_t argsSize,
+                                void* ptrOffsets, uint32_t numPtrs,
+                                uint32_t start, uint32_t end){
+    return Offload::get().split(static_cast<const char*>(ptx), args,
+                                argsSize,
+                                static_cast<const uint32_t*>(ptrOffsets),
+                                numPtrs, start, end);
+  }
+
+  // waits for the GPU's part of a split Forall once the host's has run
+  void __ares_offload_join(){
+    Offload::get().join();
+  }
+
+  // number of workers in the pool, used to size lowered reductions
+  uint32_t __ares_num_threads(){
+    return threadPool()->numThreads();
+  }
+
+  // non-zero if the calling thread is a worker of the pool, used by
+  // nested reductions to avoid spreading over a pool that is already busy
+  uint32_t __ares_in_worker(){
+    return threadPool()->workerIndex() >= 0;
+  }
+
+  // iterations per partial of a lowered reduction, 0 for one partial
+  // per worker
+  uint64_t __ares_reduce_block_size(){
+    return reduceConfig().blockSize;
+  }
+
+  // non-zero if floating point sums are accumulated with compensation
+  uint32_t __ares_reduce_compensated(){
+    return reduceConfig().compensated;
+  }
+
+  uint64_t __ares_serial_threshold(){
+    return serialThreshold();
+  }
+
+  void __ares_thread_yield(){
+    threadPool()->yield();
+  }
+
+  ares_threadpool ares_thpool_init(int num_threads){
+    return new ares_thpool_;
+  }
+
+  int ares_thpool_add_work(ares_threadpool pool, void* (*function_p)(void*),
+                           void* arg_p){
+    if(!pool){
+      return -1;
+    }
+
+    pool->add(function_p, &arg_p, 1);
+    return 0;
+  }
+
+  int ares_thpool_add_work_batch(ares_threadpool pool,
+                                 void* (*function_p)(void*), void** args,
+                                 size_t n){
+    if(!pool){
+      return -1;
+    }
+
+    pool->add(function_p, args, n);
+    return 0;
+  }
+
+  void ares_thpool_wait(ares_threadpool pool){
+    pool->wait();
+  }
+
+  void ares_thpool_pause(ares_threadpool pool){
+    pool->pause();
+  }
+
+  void ares_thpool_resume(ares_threadpool pool){
+    pool->resume();
+  }
+
+  void ares_thpool_destroy(ares_threadpool pool){
+    if(!pool){
+      return;
+    }
+
+    pool->resume();
+    pool->wait();
+    pool->release();
+  }
+
+  int ares_thpool_num_threads_working(ares_threadpool pool){
+    return pool->working();
+  }
+
+  void __ares_debug(){
+    np(9);
+  }
+
+  void __ares_debug_ptr(void* ptr){
+  }
+
+  void __ares_debug_i32(int32_t x){
+    np(x);
+  }
+
+  void __ares_debug_f32(float x){
+    np(x);
+  }
+
+} // extern "C"
+
+namespace ares{
+
+  bool ares_listen(int port){
+    return socketCommunicator()->listen(port);
+  }
+
+  bool ares_listen(const std::string& sendPath, const std::string& receivePath){
+    assert(!_communicator);
+    auto c = new FIFOCommunicator;
+    setupCommunicator(c);
+    return c->listen(sendPath, receivePath);
+  }
+
+  bool ares_connect(const char* host, int port){
+    return socketCommunicator()->connect(host, port);  
+  }
+
+  bool ares_bootstrap(const char* dir, size_t groupSize){
+    return socketCommunicator()->bootstrap(dir, groupSize);
+  }
+
+  bool ares_connect(const std::string& sendPath, const std::string& receivePath){
+    assert(!_communicator);
+    auto c = new FIFOCommunicator;
+    setupCommunicator(c);
+    return c->connect(sendPath, receivePath);  
+  }
+
+  // a message that was not sent is freed with its buffer
+  static bool sent(MessageBuffer* msg, bool ok){
+    if(!ok){
+      delete msg;
+    }
+    return ok;
+  }
+
+  bool ares_send(char* buf, size_t size){
+    auto msg = new MessageBuffer(MessageType::Raw, buf, size, true);
+    return sent(msg, _communicator->trySend(msg));
+  }
+
+  bool ares_send(int rank, uint32_t tag, char* buf, size_t size){
+    auto msg = new MessageBuffer(MessageType::Raw, buf, size, true);
+    return sent(msg, _communicator->trySend(rank, tag, msg));
+  }
+
+  bool ares_send_stream(char* buf, size_t size){
+    auto msg = new MessageBuffer(MessageType::Stream, buf, size, true);
+    return sent(msg, _communicator->trySend(msg));
+  }
+
+  bool ares_send_stream(int rank, uint32_t tag, char* buf, size_t size){
+    auto msg = new MessageBuffer(MessageType::Stream, buf, size, true);
+    return sent(msg, _communicator->trySend(rank, tag, msg));
+  }
+
+  // the buffer comes from the pool, a stream is gathered into one
+  static char* receiveBody(MessageBuffer* msg, size_t& size){
+    size = msg->size();
+
+    if(msg->type() != MessageType::Stream){
+      char* buf = msg->take();
+      delete msg;
+      return buf;
+    }
+
+    MessageStream* stream = msg->stream();
+    char* buf = (char*)BufferPool::allocate(size);
+
+    size_t offset = 0;
+    size_t n;
+    while(char* chunk = stream->next(n)){
+      memcpy(buf + offset, chunk, n);
+      offset += n;
+    }
+
+    stream->release();
+    delete msg;
+
+    return buf;
+  }
+
+  char* ares_receive(size_t& size){
+    return receiveBody(_communicator->receive(), size);
+  }
+
+  char* ares_receive(int rank, uint32_t tag, size_t& size){
+    return receiveBody(_communicator->receive(rank, tag), size);
+  }
+
+  void ares_release(char* buf){
+    BufferPool::release(buf);
+  }
+
+  void* ares_receive_stream(size_t& size){
+    MessageBuffer* msg = _communicator->receive();
+    size = msg->size();
+    return msg;
+  }
+
+  void* ares_receive_stream(int rank, uint32_t tag, size_t& size){
+    MessageBuffer* msg = _communicator->receive(rank, tag);
+    size = msg->size();
+    return msg;
+  }
+
+  // a message that was not sent as a stream is a single chunk
+  char* ares_stream_next(void* stream, size_t& size){
+    auto msg = static_cast<MessageBuffer*>(stream);
+
+    if(msg->type() == MessageType::Stream){
+      if(char* chunk = msg->stream()->next(size)){
+        return chunk;
+      }
+      msg->stream()->release();
+      delete msg;
+      return nullptr;
+    }
+
+    uint64_t n;
+    if(char* buf = msg->consume(n)){
+      size = n;
+      return buf;
+    }
+
+    delete msg;
+    return nullptr;
+  }
+
+  // the request is only completed by a message that was sent, it is set
+  // before the send as the message may be written out at once
+  static CommRequest* isent(MessageBuffer* msg, CommRequest* request,
+                            bool ok){
+    if(!ok){
+      msg->setRequest(nullptr);
+      delete msg;
+      delete request;
+      return nullptr;
+    }
+    return request;
+  }
+
+  CommRequest* ares_isend(int rank, uint32_t tag, const char* buf,
+                          size_t size){
+    auto request = new CommRequest;
+    auto msg = new MessageBuffer(MessageType::Raw, const_cast<char*>(buf),
+                                 size, false);
+    msg->setRequest(request);
+    return isent(msg, request, _communicator->trySend(rank, tag, msg));
+  }
+
+  CommRequest* ares_isendv(int rank, uint32_t tag,
+                           const CommSegment* segments, size_t n){
+    iovec local[MessageBuffer::MAX_SEGMENTS];
+    vector<iovec> more;
+    iovec* iov = local;
+
+    if(n > MessageBuffer::MAX_SEGMENTS){
+      more.resize(n);
+      iov = more.data();
+    }
+
+    for(size_t i = 0; i < n; ++i){
+      iov[i].iov_base = const_cast<void*>(segments[i].data);
+      iov[i].iov_len = segments[i].size;
+    }
+
+    auto request = new CommRequest;
+    auto msg = new MessageBuffer(MessageType::Raw, iov, n);
+    msg->setRequest(request);
+    return isent(msg, request, _communicator->trySend(rank, tag, msg));
+  }
+
+  CommRequest* ares_irecv(int rank, uint32_t tag){
+    auto request = new CommRequest(rank, tag);
+    _communicator->postReceive(request, rank, tag);
+    return request;
+  }
+
+  CommRequest* ares_recv_into(int rank, uint32_t tag, char* buf,
+                              size_t size){
+    auto request = new CommRequest(rank, tag, buf, size);
+    _communicator->postReceive(request, rank, tag);
+    return request;
+  }
+
+  CommRequest* ares_recv_to_fd(int rank, uint32_t tag, int fd){
+    auto request = new CommRequest(rank, tag, fd);
+    _communicator->postReceive(request, rank, tag);
+    return request;
+  }
+
+  // the body of a received message written to fd, if it was not spliced
+  // there already, returning the bytes that fd took
+  static size_t writeBody(MessageBuffer* msg, int fd){
+    if(msg->type() != MessageType::Stream && !msg->buffer()){
+      size_t size = msg->size();
+      delete msg;
+      return size;
+    }
+
+    size_t size;
+    char* buf = receiveBody(msg, size);
+
+    size_t written = 0;
+    while(written < size){
+      ssize_t ret = ::write(fd, buf + written, size - written);
+      if(ret < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        break;
+      }
+      written += ret;
+    }
+
+    ares_release(buf);
+    return written;
+  }
+
+  bool ares_test(CommRequest* request){
+    return request->test();
+  }
+
+  char* ares_wait(CommRequest* request, size_t& size){
+    MessageBuffer* msg = request->wait();
+    char* into = request->buffer();
+    uint64_t capacity = request->capacity();
+    int file = request->file();
+    delete request;
+
+    if(!msg){
+      size = 0;
+      return nullptr;
+    }
+
+    if(file >= 0){
+      size = writeBody(msg, file);
+      return nullptr;
+    }
+
+    char* buf = receiveBody(msg, size);
+
+    // a rendezvous was read in place, anything else is copied
+    if(into && buf != into){
+      assert(size <= capacity && "message larger than the receive buffer");
+      size = min<uint64_t>(size, capacity);
+      memcpy(into, buf, size);
+      ares_release(buf);
+      buf = into;
+    }
+
+    return buf;
+  }
+
+  void ares_waitall(size_t n, CommRequest** requests, char** bufs,
+                    size_t* sizes){
+    for(size_t i = 0; i < n; ++i){
+      size_t size;
+      char* buf = ares_wait(requests[i], size);
+
+      if(bufs){
+        bufs[i] = buf;
+        sizes[i] = size;
+      }
+    }
+  }
+
+  static void runFunction(void* arg){
+    auto func = static_cast<function<void()>*>(arg);
+    (*func)();
+    func->~function();
+  }
+
+  // the request is completed on an engine thread, which only queues the
+  // task
+  void ares_on_complete(CommRequest* request, function<void()> func){
+    request->onComplete([func]{
+      Task* task = TaskPool::allocate(runFunction, nullptr, 0);
+      task->emplace<function<void()>>(func);
+      threadPool()->push(task);
+    });
+  }
+
+  uint32_t ares_register_handler(ActiveHandler handler){
+    lock_guard<mutex> lock(_activeMutex);
+    _activeHandlers.push_back(handler);
+    return _activeHandlers.size() - 1;
+  }
+
+  void ares_spawn(int rank, uint32_t handler, const void* args, size_t size){
+    auto msg = new MessageBuffer(MessageType::Active, size);
+    memcpy(msg->buffer(), args, size);
+    _communicator->send(rank, handler, msg);
+  }
+
+  void ares_on_message(uint32_t tag, InlineMessageHandler handler){
+    assert(_communicator);
+
+    if(!handler){
+      _communicator->setTagHandler(tag, nullptr);
+      return;
+    }
+
+    _communicator->setTagHandler(tag, [handler](MessageBuffer* msg){
+      handler(msg->source(), msg->tag(), msg->buffer(), msg->size());
+      delete msg;
+    });
+  }
+
+  void ares_on_send_full(SendFullHandler handler){
+    assert(_communicator);
+    _communicator->setSendFullHandler(handler);
+  }
+
+  void ares_send_queue(int rank, size_t& bytes, size_t& messages){
+    assert(_communicator);
+    _communicator->sendQueue(rank, bytes, messages);
+  }
+
+  int ares_rank(){
+    assert(_communicator);
+    return _communicator->rank();
+  }
+
+  void ares_init_comm(size_t groupSize){
+    assert(_communicator);
+    _communicator->init(groupSize);
+  }
+
+  size_t ares_group_size(){
+    size_t size = _communicator ? _communicator->groupSize() : 1;
+    return size > 0 ? size : 1;
+  }
+
+  void ares_barrier(){
+    assert(_communicator);
+    _communicator->barrier();
+  }
+
+  void ares_barrier_arrive(){
+    assert(_communicator);
+    _communicator->arrive();
+  }
+
+  void ares_barrier_wait(){
+    assert(_communicator);
+    _communicator->wait();
+  }
+
+  // the tags of the collectives of a group, from the first of its own
+  enum : uint32_t{
+    BCAST_TAG,
+    ALLREDUCE_TAG,
+    ALLGATHER_TAG,
+    BARRIER_TAG,
+    GROUP_TAGS
+  };
+
+  // the whole group has the first tags, then each team those of its id
+  const uint32_t TEAM_TAG = ARES_COLLECTIVE_TAG + 0x100;
+  const uint32_t MAX_TEAMS = (0xffffffff - TEAM_TAG + 1) / GROUP_TAGS;
+
+  // larger reductions go around a ring, which moves each element only
+  // twice rather than log2(n) times
+  const size_t RING_ALLREDUCE_SIZE = 1 << 16;
+
+  // the caller's buffer is reused as soon as the collective returns
+  static void sendCopy(int rank, uint32_t tag, const void* buf, size_t size){
+    auto msg = new MessageBuffer(MessageType::Raw, size);
+    memcpy(msg->buffer(), buf, size);
+    _communicator->send(rank, tag, msg);
+  }
+
+  static void receiveInto(int rank, uint32_t tag, void* buf, size_t size){
+    MessageBuffer* msg = _communicator->receive(rank, tag);
+    assert(msg->size() == size);
+    memcpy(buf, msg->buffer(), size);
+    delete msg;
+  }
+
+  template<class T>
+  static void combine(T* out, const T* in, size_t count, CommOp op){
+    switch(op){
+      case CommOp::Sum:
+        for(size_t i = 0; i < count; ++i){
+          out[i] += in[i];
+        }
+        break;
+      case CommOp::Min:
+        for(size_t i = 0; i < count; ++i){
+          out[i] = in[i] < out[i] ? in[i] : out[i];
+        }
+        break;
+      case CommOp::Max:
+        for(size_t i = 0; i < count; ++i){
+          out[i] = in[i] > out[i] ? in[i] : out[i];
+        }
+        break;
+    }
+  }
+
+  static size_t typeSize(CommType type){
+    switch(type){
+      case CommType::Int32:
+      case CommType::UInt32:
+      case CommType::Float:
+        return 4;
+      default:
+        return 8;
+    }
+  }
+
+  static void combine(void* out, const void* in, size_t count,
+                      CommType type, CommOp op){
+    switch(type){
+      case CommType::Int32:
+        combine((int32_t*)out, (const int32_t*)in, count, op);
+        break;
+      case CommType::UInt32:
+        combine((uint32_t*)out, (const uint32_t*)in, count, op);
+        break;
+      case CommType::Int64:
+        combine((int64_t*)out, (const int64_t*)in, count, op);
+        break;
+      case CommType::UInt64:
+        combine((uint64_t*)out, (const uint64_t*)in, count, op);
+        break;
+      case CommType::Float:
+        combine((float*)out, (const float*)in, count, op);
+        break;
+      case CommType::Double:
+        combine((double*)out, (const double*)in, count, op);
+        break;
+    }
+  }
+
+  // receives the value of rank and combines buf with it, the lower rank
+  // always comes first so that both ends compute the same result
+  static void receiveCombine(int rank, uint32_t tag, void* buf, size_t count,
+                             CommType type, CommOp op){
+    MessageBuffer* msg = _communicator->receive(rank, tag);
+    assert(msg->size() == count * typeSize(type));
+
+    if(rank < _communicator->rank()){
+      combine(msg->buffer(), buf, count, type, op);
+      memcpy(buf, msg->buffer(), msg->size());
+    }
+    else{
+      combine(buf, msg->buffer(), count, type, op);
+    }
+
+    delete msg;
+  }
+
+  // the members of a collective, ranks[i] is the rank of the i-th, all
+  // of the group in order if ranks is null, me is this process, its
+  // messages take the tags from tags on
+  struct CommGroup{
+    const int* ranks;
+    int size;
+    int me;
+    uint32_t tags;
+
+    int operator[](int i) const{
+      return ranks ? ranks[i] : i;
+    }
+  };
+
+  static CommGroup wholeGroup(){
+    return {nullptr, int(_communicator->groupSize()), _communicator->rank(),
+            ARES_COLLECTIVE_TAG};
+  }
+
+  static CommGroup subgroup(const vector<int>& ranks,
+                            uint32_t tags = ARES_COLLECTIVE_TAG){
+    auto itr = find(ranks.begin(), ranks.end(), _communicator->rank());
+    return {ranks.data(), int(ranks.size()), int(itr - ranks.begin()), tags};
+  }
+
+  // a binomial tree rooted at member root, so the last member has it
+  // after log2(n) steps
+  static void treeBcast(const CommGroup& g, int root, void* buf, size_t size){
+    int n = g.size;
+    int rank = (g.me - root + n) % n;
+    uint32_t tag = g.tags + BCAST_TAG;
+
+    int mask = 1;
+    while(mask < n){
+      if(rank & mask){
+        receiveInto(g[(rank - mask + root) % n], tag, buf, size);
+        break;
+      }
+      mask <<= 1;
+    }
+
+    for(mask >>= 1; mask > 0; mask >>= 1){
+      if(rank + mask < n){
+        sendCopy(g[(rank + mask + root) % n], tag, buf, size);
+      }
+    }
+  }
+
+  // the same tree the other way, member 0 ends up with the reduction
+  static void treeReduce(const CommGroup& g, void* buf, size_t count,
+                         CommType type, CommOp op){
+    size_t size = count * typeSize(type);
+    uint32_t tag = g.tags + ALLREDUCE_TAG;
+
+    for(int mask = 1; mask < g.size; mask <<= 1){
+      if(g.me & mask){
+        sendCopy(g[g.me - mask], tag, buf, size);
+        return;
+      }
+      if(g.me + mask < g.size){
+        receiveCombine(g[g.me + mask], tag, buf, count, type, op);
+      }
+    }
+  }
+
+  // reduce-scatter then allgather around the ring, each member ends up
+  // reducing one block and passes it on
+  static void ringAllreduce(const CommGroup& g, char* buf, size_t count,
+                            CommType type, CommOp op){
+    int n = g.size;
+    int rank = g.me;
+    int next = g[(rank + 1) % n];
+    int prev = g[(rank + n - 1) % n];
+    size_t elementSize = typeSize(type);
+    uint32_t tag = g.tags + ALLREDUCE_TAG;
+
+    auto blockStart = [&](int b){
+      return count * b / n;
+    };
+
+    auto blockCount = [&](int b){
+      return blockStart(b + 1) - blockStart(b);
+    };
+
+    for(int step = 0; step < n - 1; ++step){
+      int sendBlock = (rank - step + n) % n;
+      int receiveBlock = (rank - step - 1 + n) % n;
+
+      sendCopy(next, tag, buf + blockStart(sendBlock) * elementSize,
+               blockCount(sendBlock) * elementSize);
+
+      MessageBuffer* msg = _communicator->receive(prev, tag);
+      combine(buf + blockStart(receiveBlock) * elementSize, msg->buffer(),
+              blockCount(receiveBlock), type, op);
+      delete msg;
+    }
+
+    for(int step = 0; step < n - 1; ++step){
+      int sendBlock = (rank + 1 - step + n) % n;
+      int receiveBlock = (rank - step + n) % n;
+
+      sendCopy(next, tag, buf + blockStart(sendBlock) * elementSize,
+               blockCount(sendBlock) * elementSize);
+
+      receiveInto(prev, tag, buf + blockStart(receiveBlock) * elementSize,
+                  blockCount(receiveBlock) * elementSize);
+    }
+  }
+
+  // recursive doubling, where the members past the largest power of two
+  // first fold their values into a partner and get the result back last
+  static void doublingAllreduce(const CommGroup& g, void* buf, size_t count,
+                                CommType type, CommOp op){
+    int n = g.size;
+    int rank = g.me;
+    size_t size = count * typeSize(type);
+    uint32_t tag = g.tags + ALLREDUCE_TAG;
+
+    int p2 = 1;
+    while(p2 * 2 <= n){
+      p2 *= 2;
+    }
+    int extra = n - p2;
+
+    // of the first 2 * extra members, the even ones sit out the exchange
+    int vrank;
+    if(rank < 2 * extra){
+      if(rank % 2 == 0){
+        sendCopy(g[rank + 1], tag, buf, size);
+        receiveInto(g[rank + 1], tag, buf, size);
+        return;
+      }
+      receiveCombine(g[rank - 1], tag, buf, count, type, op);
+      vrank = rank / 2;
+    }
+    else{
+      vrank = rank - extra;
+    }
+
+    auto realRank = [&](int v){
+      return g[v < extra ? v * 2 + 1 : v + extra];
+    };
+
+    for(int mask = 1; mask < p2; mask <<= 1){
+      int partner = realRank(vrank ^ mask);
+      sendCopy(partner, tag, buf, size);
+      receiveCombine(partner, tag, buf, count, type, op);
+    }
+
+    if(rank < 2 * extra){
+      sendCopy(g[rank - 1], tag, buf, size);
+    }
+  }
+
+  static void groupAllreduce(const CommGroup& g, void* buf, size_t count,
+                             CommType type, CommOp op){
+    if(g.size == 1){
+      return;
+    }
+
+    if(count * typeSize(type) >= RING_ALLREDUCE_SIZE &&
+       count >= size_t(g.size)){
+      ringAllreduce(g, (char*)buf, count, type, op);
+      return;
+    }
+
+    doublingAllreduce(g, buf, count, type, op);
+  }
+
+  // the ranks of each node, the lowest of which leads it
+  struct NodeLayout{
+    // the ranks of this one, in order
+    vector<int> local;
+    // the leader of each node, in order
+    vector<int> leaders;
+    // the index in leaders of the node of each rank
+    vector<int> node;
+  };
+
+  // ARES_NODE names the node of this process, ARES_HOST or the host name
+  // by default
+  static string nodeName(){
+    if(const char* s = getenv("ARES_NODE")){
+      return s;
+    }
+
+    if(const char* s = getenv("ARES_HOST")){
+      return s;
+    }
+
+    char name[256];
+    if(gethostname(name, sizeof(name)) != 0){
+      return "localhost";
+    }
+    name[sizeof(name) - 1] = '\0';
+    return name;
+  }
+
+  // found with an allgather of the node names by the first collective
+  // that needs it, null if the collectives do not go by node: when
+  // ARES_HIER_COLLECTIVES=0, or every node has one rank, or there is one
+  // node, whose ranks are all connected over shared memory
+  static const NodeLayout* nodeLayout(){
+    static const size_t NAME_SIZE = 64;
+
+    static size_t groupSize = 0;
+    static unique_ptr<NodeLayout> layout;
+
+    size_t n = _communicator->groupSize();
+    if(groupSize == n){
+      return layout.get();
+    }
+
+    static bool enabled = []{
+      const char* s = getenv("ARES_HIER_COLLECTIVES");
+      return !s || atoi(s) != 0;
+    }();
+
+    groupSize = n;
+    layout.reset();
+
+    if(!enabled){
+      return nullptr;
+    }
+
+    char name[NAME_SIZE] = {};
+    strncpy(name, nodeName().c_str(), NAME_SIZE - 1);
+
+    vector<char> names(n * NAME_SIZE);
+    ares_allgather(name, NAME_SIZE, names.data());
+
+    unique_ptr<NodeLayout> l(new NodeLayout);
+    l->node.resize(n);
+
+    map<string, int> nodes;
+    for(size_t r = 0; r < n; ++r){
+      string s(&names[r * NAME_SIZE]);
+      auto itr = nodes.find(s);
+      if(itr == nodes.end()){
+        itr = nodes.emplace(s, int(l->leaders.size())).first;
+        l->leaders.push_back(int(r));
+      }
+      l->node[r] = itr->second;
+    }
+
+    int mine = l->node[_communicator->rank()];
+    for(size_t r = 0; r < n; ++r){
+      if(l->node[r] == mine){
+        l->local.push_back(int(r));
+      }
+    }
+
+    if(l->leaders.size() > 1 && l->leaders.size() < n){
+      layout = move(l);
+    }
+
+    return layout.get();
+  }
+
+  // over the leaders of the nodes first, with the root in place of the
+  // leader of its own, then down the tree of each node
+  void ares_bcast(int root, void* buf, size_t size){
+    assert(_communicator);
+
+    if(_communicator->groupSize() == 1){
+      return;
+    }
+
+    const NodeLayout* layout = nodeLayout();
+    if(!layout){
+      treeBcast(wholeGroup(), root, buf, size);
+      return;
+    }
+
+    int rank = _communicator->rank();
+    int rootNode = layout->node[root];
+    int node = layout->node[rank];
+    int leader = node == rootNode ? root : layout->leaders[node];
+
+    if(rank == leader){
+      vector<int> leaders = layout->leaders;
+      leaders[rootNode] = root;
+      treeBcast(subgroup(leaders), rootNode, buf, size);
+    }
+
+    const vector<int>& local = layout->local;
+    int localRoot = int(find(local.begin(), local.end(), leader) - 
+                        local.begin());
+    treeBcast(subgroup(local), localRoot, buf, size);
+  }
+
+  // reduced within each node to its leader, across the leaders, then
+  // broadcast within each node, so only the leaders' messages leave
+  // the nodes
+  void ares_allreduce(void* buf, size_t count, CommType type, CommOp op){
+    assert(_communicator);
+
+    if(_communicator->groupSize() == 1 || count == 0){
+      return;
+    }
+
+    const NodeLayout* layout = nodeLayout();
+    if(!layout){
+      groupAllreduce(wholeGroup(), buf, count, type, op);
+      return;
+    }
+
+    CommGroup local = subgroup(layout->local);
+    treeReduce(local, buf, count, type, op);
+
+    if(local.me == 0){
+      groupAllreduce(subgroup(layout->leaders), buf, count, type, op);
+    }
+
+    treeBcast(local, 0, buf, count * typeSize(type));
+  }
+
+  // around the ring, each member passes on the block it received last
+  static void groupAllgather(const CommGroup& g, const void* in, size_t size,
+                             void* out){
+    int n = g.size;
+    int rank = g.me;
+    int next = g[(rank + 1) % n];
+    int prev = g[(rank + n - 1) % n];
+    uint32_t tag = g.tags + ALLGATHER_TAG;
+    char* blocks = (char*)out;
+
+    memcpy(blocks + rank * size, in, size);
+
+    for(int step = 0; step < n - 1; ++step){
+      int sendBlock = (rank - step + n) % n;
+      int receiveBlock = (rank - step - 1 + n) % n;
+
+      sendCopy(next, tag, blocks + sendBlock * size, size);
+      receiveInto(prev, tag, blocks + receiveBlock * size, size);
+    }
+  }
+
+  void ares_allgather(const void* in, size_t size, void* out){
+    assert(_communicator);
+    groupAllgather(wholeGroup(), in, size, out);
+  }
+
+  // dissemination with empty messages, member i signals i + 2^k and
+  // waits for i - 2^k in round k
+  static void groupBarrier(const CommGroup& g){
+    int n = g.size;
+    uint32_t tag = g.tags + BARRIER_TAG;
+
+    for(int k = 1; k < n; k <<= 1){
+      _communicator->send(g[(g.me + k) % n], tag,
+                          new MessageBuffer(MessageType::Raw, 0));
+      delete _communicator->receive(g[(g.me - k + n) % n], tag);
+    }
+  }
+
+  // the members of a team in the order of their team ranks and this
+  // process's, whose collectives take the tags of id
+  class CommTeam{
+  public:
+    CommTeam(vector<int> ranks, uint32_t id)
+    : ranks_(move(ranks)),
+    id_(id){
+      auto itr = find(ranks_.begin(), ranks_.end(), _communicator->rank());
+      me_ = int(itr - ranks_.begin());
+    }
+
+    int rank() const{
+      return me_;
+    }
+
+    int size() const{
+      return int(ranks_.size());
+    }
+
+    // the rank in the whole group of team rank r, any rank stays any rank
+    int worldRank(int r) const{
+      return r == ARES_ANY_RANK ? r : ranks_[r];
+    }
+
+    uint32_t id() const{
+      return id_;
+    }
+
+    CommGroup group() const{
+      return {ranks_.data(), size(), me_, TEAM_TAG + id_ * GROUP_TAGS};
+    }
+
+  private:
+    vector<int> ranks_;
+    int me_;
+    uint32_t id_;
+  };
+
+  // the next team id that this process has not seen, agreed on by the
+  // members of a team as the highest of theirs, so the teams that a
+  // process is in all have ids of their own
+  static uint32_t _nextTeamId = 1;
+
+  CommTeam* ares_team_world(){
+    assert(_communicator);
+
+    static CommTeam* world = []{
+      vector<int> ranks(_communicator->groupSize());
+      for(size_t r = 0; r < ranks.size(); ++r){
+        ranks[r] = int(r);
+      }
+      return new CommTeam(move(ranks), 0);
+    }();
+
+    return world;
+  }
+
+  CommTeam* ares_team_split(CommTeam* parent, int color, int key){
+    assert(parent);
+
+    CommGroup g = parent->group();
+
+    uint32_t id = _nextTeamId;
+    groupAllreduce(g, &id, 1, CommType::UInt32, CommOp::Max);
+    assert(id < MAX_TEAMS && "out of team ids");
+    _nextTeamId = id + 1;
+
+    int32_t mine[2] = {color, key};
+    vector<int32_t> all(2 * g.size);
+    groupAllgather(g, mine, sizeof(mine), all.data());
+
+    if(color < 0){
+      return nullptr;
+    }
+
+    // by key, then by rank in the parent
+    vector<pair<int32_t, int>> members;
+    for(int r = 0; r < g.size; ++r){
+      if(all[2 * r] == color){
+        members.emplace_back(all[2 * r + 1], r);
+      }
+    }
+    sort(members.begin(), members.end());
+
+    vector<int> ranks;
+    for(auto& m : members){
+      ranks.push_back(parent->worldRank(m.second));
+    }
+
+    return new CommTeam(move(ranks), id);
+  }
+
+  void ares_team_free(CommTeam* team){
+    if(team != ares_team_world()){
+      delete team;
+    }
+  }
+
+  int ares_team_rank(CommTeam* team){
+    return team->rank();
+  }
+
+  int ares_team_size(CommTeam* team){
+    return team->size();
+  }
+
+  int ares_team_world_rank(CommTeam* team, int rank){
+    return team->worldRank(rank);
+  }
+
+  void ares_team_barrier(CommTeam* team){
+    groupBarrier(team->group());
+  }
+
+  void ares_team_bcast(CommTeam* team, int root, void* buf, size_t size){
+    treeBcast(team->group(), root, buf, size);
+  }
+
+  void ares_team_allreduce(CommTeam* team, void* buf, size_t count,
+                           CommType type, CommOp op){
+    if(count > 0){
+      groupAllreduce(team->group(), buf, count, type, op);
+    }
+  }
+
+  void ares_team_allgather(CommTeam* team, const void* in, size_t size,
+                           void* out){
+    groupAllgather(team->group(), in, size, out);
+  }
+
+  bool ares_team_send(CommTeam* team, int rank, uint32_t tag, char* buf,
+                      size_t size){
+    return ares_send(team->worldRank(rank), tag, buf, size);
+  }
+
+  char* ares_team_receive(CommTeam* team, int rank, uint32_t tag,
+                          size_t& size){
+    return ares_receive(team->worldRank(rank), tag, size);
+  }
+
+  bool ares_register_memory(void* buf, size_t size, RemoteMemoryKey& key){
+    key.addr = uintptr_t(buf);
+    key.rkey = 0;
+
+#ifdef ARES_HAVE_IBVERBS
+    if(VerbsDevice* device = VerbsDevice::get()){
+      ibv_mr* mr = device->registerMemory(buf, size);
+      if(!mr){
+        return false;
+      }
+      key.rkey = mr->rkey;
+    }
+#endif
+
+    return true;
+  }
+
+  void ares_deregister_memory(void* buf){
+#ifdef ARES_HAVE_IBVERBS
+    if(VerbsDevice* device = VerbsDevice::get()){
+      device->deregisterMemory(buf);
+    }
+#endif
+  }
+
+  bool ares_put(int rank, const void* buf, size_t size,
+                const RemoteMemoryKey& key, size_t offset){
+    assert(_communicator);
+    return _communicator->put(rank, buf, size, key.addr + offset, key.rkey);
+  }
+
+  bool ares_get(int rank, void* buf, size_t size,
+                const RemoteMemoryKey& key, size_t offset){
+    assert(_communicator);
+    return _communicator->get(rank, buf, size, key.addr + offset, key.rkey);
+  }
+  RangeShare ares_share(const Distribution& distribution, uint32_t start,
+                        uint32_t end, int rank){
+    size_t size = _communicator ? _communicator->groupSize() : 1;
+    if(size == 0){
+      size = 1;
+    }
+
+    assert(rank >= 0 && size_t(rank) < size && "rank outside of the group");
+
+    uint32_t n = end > start ? end - start : 0;
+
+    RangeShare share;
+
+    if(!distribution.partitioner && !distribution.offsets &&
+       distribution.partition == Partition::Cyclic){
+      share.base = start + rank;
+      share.stride = size;
+      share.count = uint32_t(rank) < n ? (n - rank + size - 1) / size : 0;
+      share.readStart = start;
+      share.readEnd = start + n;
+      return share;
+    }
+
+    uint32_t s;
+    uint32_t e;
+
+    if(distribution.offsets){
+      s = start + std::min(distribution.offsets[rank], n);
+      e = start + std::min(distribution.offsets[rank + 1], n);
+      assert(s <= e && "invalid share");
+    }
+    else if(distribution.partitioner){
+      distribution.partitioner(start, start + n, rank, size, s, e);
+      assert(s <= e && "invalid share");
+    }
+    else{
+      uint32_t q = n / size;
+      uint32_t r = n % size;
+      s = start + rank * q + std::min(uint32_t(rank), r);
+      e = s + q + (uint32_t(rank) < r ? 1 : 0);
+    }
+
+    share.base = s;
+    share.stride = 1;
+    share.count = e - s;
+    share.readStart = s - std::min(s - start, distribution.ghost);
+    share.readEnd = e + std::min(start + n - e, distribution.ghost);
+
+    return share;
+  }
+
+  RangeShare ares_share(const Distribution& distribution, uint32_t start,
+                        uint32_t end){
+    return ares_share(distribution, start, end, 
+                      _communicator ? _communicator->rank() : 0);
+  }
+
+
+  RuntimeStats ares_runtime_stats(){
+    RuntimeStats stats;
+    stats.externalPushes = 0;
+
+    Allocator::Stats as = Allocator::stats();
+    stats.allocator.mappedBlocks = as.mappedBlocks;
+    stats.allocator.mappedBytes = as.mappedBytes;
+    stats.allocator.hugetlbBytes = as.hugetlbBytes;
+    stats.allocator.hugetlbFallbacks = as.hugetlbFallbacks;
+    stats.allocator.lockedBytes = as.lockedBytes;
+    stats.allocator.transparentHugeBytes = as.transparentHugeBytes;
+
+    stats.memory.queueItems = MemoryAccount::bytes(MemoryAccount::QueueItems);
+    stats.memory.taskFrames = MemoryAccount::bytes(MemoryAccount::TaskFrames);
+    stats.memory.partials = MemoryAccount::bytes(MemoryAccount::Partials);
+    stats.memory.messages = MemoryAccount::bytes(MemoryAccount::Messages);
+    stats.memory.stacks = MemoryAccount::bytes(MemoryAccount::Stacks);
+    stats.memory.peak = MemoryAccount::peak();
+    stats.memory.limit = MemoryAccount::limit(MemoryAccount::NUM_CATEGORIES);
+    stats.memory.inlinedSpawns = MemoryAccount::inlinedSpawns();
+
+    if(_communicator){
+      for(auto& ps : _communicator->peerStats()){
+        const PeerCounters::Snapshot& c = ps.counters;
+
+        RuntimePeerStats rs;
+        rs.rank = ps.rank;
+        rs.messagesSent = c.messagesSent;
+        rs.bytesSent = c.bytesSent;
+        rs.messagesReceived = c.messagesReceived;
+        rs.bytesReceived = c.bytesReceived;
+        rs.queueDepth = ps.queueDepth;
+        rs.queuedBytes = ps.queuedBytes;
+        rs.peakQueueDepth = c.peakQueueDepth;
+        rs.latency.assign(c.latency, c.latency + 
+                          PeerCounters::LATENCY_BUCKETS);
+        stats.peers.push_back(rs);
+      }
+    }
+
+    for(auto& p : PerfCounters::totals()){
+      const PerfCounters::Totals& t = p.second;
+
+      RuntimeRegionStats rs;
+
+      Dl_info info;
+      if(const RegionDesc* r = regionDesc(p.first)){
+        ostringstream ostr;
+        ostr << r->name;
+        if(r->file[0]){
+          ostr << " (" << r->file << ":" << r->line << ")";
+        }
+        rs.name = ostr.str();
+      }
+      else if(dladdr(p.first, &info) && info.dli_sname){
+        rs.name = info.dli_sname;
+      }
+      else{
+        ostringstream ostr;
+        ostr << p.first;
+        rs.name = ostr.str();
+      }
+
+      rs.calls = t.calls;
+      rs.time = t.ns/1e9;
+      rs.cycles = t.counts[PerfCounters::Cycles];
+      rs.instructions = t.counts[PerfCounters::Instructions];
+      rs.cacheReferences = t.counts[PerfCounters::CacheReferences];
+      rs.cacheMisses = t.counts[PerfCounters::CacheMisses];
+      rs.workers = throttledWidth(p.first);
+      stats.regions.push_back(rs);
+    }
+
+    sort(stats.regions.begin(), stats.regions.end(),
+         [](const RuntimeRegionStats& a, const RuntimeRegionStats& b){
+           return a.time > b.time;
+         });
+
+    UserRegion::forEach([&](const string& name, uint64_t calls, 
+                            double time, double work){
+      stats.userRegions.push_back({name, calls, time, work});
+    });
+
+    Executor* pool = _startedPool;
+    if(!pool){
+      return stats;
+    }
+
+    for(auto& ws : pool->stats()){
+      RuntimeWorkerStats rs;
+      rs.tasksExecuted = ws.tasksExecuted;
+      rs.tasksPushed = ws.tasksPushed;
+      rs.stealAttempts = ws.stealAttempts;
+      rs.steals = ws.steals;
+      rs.remoteSteals = ws.remoteSteals;
+      rs.numaNode = ws.numaNode;
+      rs.peakQueueDepth = ws.peakQueueDepth;
+      rs.idleTime = ws.idleTime;
+      rs.busyTime = ws.busyTime;
+      stats.workers.push_back(rs);
+    }
+
+    stats.externalPushes = pool->externalPushes();
+
+    return stats;
+  }
+
+  // plans by the connectivity they were made from
+  struct PlanKey{
+    const uint32_t* neighbors;
+    const uint32_t* offsets;
+    uint32_t arity;
+    uint32_t n;
+
+    bool operator<(const PlanKey& k) const{
+      return tie(neighbors, offsets, arity, n) <
+        tie(k.neighbors, k.offsets, k.arity, k.n);
+    }
+  };
+
+  static mutex _planMutex;
+  static map<PlanKey, unique_ptr<IterationPlan>> _plans;
+
+  class BlockPartitioner : public GraphPartitioner{
+  public:
+    void partition(const PartitionGraph& graph, uint32_t parts,
+                   uint32_t* part) override{
+      Partitioning::block(graph.n, graph.weights, parts, part);
+    }
+  };
+
+  // without coordinates as the block partitioner
+  class RcbPartitioner : public GraphPartitioner{
+  public:
+    void partition(const PartitionGraph& graph, uint32_t parts,
+                   uint32_t* part) override{
+      if(!graph.coords || graph.dim == 0){
+        Partitioning::block(graph.n, graph.weights, parts, part);
+        return;
+      }
+
+      Partitioning::rcb(graph.n, graph.coords, graph.dim, graph.weights,
+                        parts, part);
+    }
+  };
+
+  class MultilevelPartitioner : public GraphPartitioner{
+  public:
+    void partition(const PartitionGraph& graph, uint32_t parts,
+                   uint32_t* part) override{
+      Partitioning::multilevel(graph.n, graph.offsets, graph.neighbors,
+                               graph.weights, parts, part);
+    }
+  };
+
+  static mutex _partitionerMutex;
+
+  // the partitioners of ares_partition() by name, with the built-in ones
+  map<string, PartitionerFactory>& partitionerFactories(){
+    static map<string, PartitionerFactory> factories = {
+      {"block", []() -> GraphPartitioner*{ return new BlockPartitioner; }},
+      {"rcb", []() -> GraphPartitioner*{ return new RcbPartitioner; }},
+      {"multilevel",
+       []() -> GraphPartitioner*{ return new MultilevelPartitioner; }}
+    };
+
+    return factories;
+  }
+
+  template<class Row>
+  static const IterationPlan& inspect(const PlanKey& key, Row&& row){
+    lock_guard<mutex> lock(_planMutex);
+
+    unique_ptr<IterationPlan>& plan = _plans[key];
+    if(!plan){
+      plan.reset(new IterationPlan);
+      Inspector::plan(key.neighbors, key.n, row,
+                      threadPool()->numThreads(), plan->order, plan->chunks);
+    }
+
+    return *plan;
+  }
+
+  const IterationPlan& ares_inspect(const uint32_t* offsets,
+                                    const uint32_t* neighbors, uint32_t n){
+    return inspect({neighbors, offsets, 0, n},
+                   [=](uint32_t i, uint64_t& begin, uint64_t& end){
+                     begin = offsets[i];
+                     end = offsets[i + 1];
+                   });
+  }
+
+  const IterationPlan& ares_inspect(const uint32_t* neighbors,
+                                    uint32_t arity, uint32_t n){
+    return inspect({neighbors, nullptr, arity, n},
+                   [=](uint32_t i, uint64_t& begin, uint64_t& end){
+                     begin = uint64_t(i) * arity;
+                     end = begin + arity;
+                   });
+  }
+
+  // releases the plans of neighbors, which no Forall may still be running
+  void ares_inspect_forget(const uint32_t* neighbors){
+    lock_guard<mutex> lock(_planMutex);
+
+    for(auto itr = _plans.begin(); itr != _plans.end(); ){
+      if(itr->first.neighbors == neighbors){
+        itr = _plans.erase(itr);
+      }
+      else{
+        ++itr;
+      }
+    }
+  }
+  void ares_register_partitioner(const char* name,
+                                 PartitionerFactory factory){
+    lock_guard<mutex> lock(_partitionerMutex);
+    partitionerFactories()[name] = factory;
+  }
+
+  GraphPartition ares_partition(const PartitionGraph& graph,
+                                const char* name, uint32_t parts){
+    if(parts == 0){
+      parts = _communicator ? uint32_t(_communicator->groupSize()) : 1;
+      parts = max(parts, 1u);
+    }
+
+    static string defaultName = []{
+      const char* s = getenv("ARES_PARTITIONER");
+      return string(s ? s : "multilevel");
+    }();
+
+    if(!name){
+      name = defaultName.c_str();
+    }
+
+    PartitionerFactory factory;
+    {
+      lock_guard<mutex> lock(_partitionerMutex);
+      auto& factories = partitionerFactories();
+      auto itr = factories.find(name);
+      if(itr == factories.end()){
+        cerr << "ares: unknown partitioner " << name << 
+          ", using multilevel" << endl;
+        itr = factories.find("multilevel");
+      }
+      factory = itr->second;
+    }
+
+    uint32_t n = graph.n;
+
+    GraphPartition p;
+    p.part.resize(n);
+
+    unique_ptr<GraphPartitioner> partitioner(factory());
+    partitioner->partition(graph, parts, p.part.data());
+
+    // a stable counting sort by share
+    p.offsets.assign(parts + 1, 0);
+    for(uint32_t v = 0; v < n; ++v){
+      assert(p.part[v] < parts && "vertex outside of the parts");
+      ++p.offsets[p.part[v] + 1];
+    }
+
+    for(uint32_t r = 0; r < parts; ++r){
+      p.offsets[r + 1] += p.offsets[r];
+    }
+
+    vector<uint32_t> fill(p.offsets.begin(), p.offsets.end() - 1);
+    p.index.resize(n);
+    p.order.resize(n);
+
+    vector<double> weights(parts, 0.0);
+    double total = 0.0;
+
+    for(uint32_t v = 0; v < n; ++v){
+      uint32_t i = fill[p.part[v]]++;
+      p.index[v] = i;
+      p.order[i] = v;
+
+      double w = graph.weights ? graph.weights[v] : 1.0;
+      weights[p.part[v]] += w;
+      total += w;
+    }
+
+    p.cutEdges = 0;
+    for(uint32_t v = 0; v < n; ++v){
+      for(uint32_t k = graph.offsets[v]; k < graph.offsets[v + 1]; ++k){
+        uint32_t u = graph.neighbors[k];
+        if(u < n && p.part[u] != p.part[v]){
+          ++p.cutEdges;
+        }
+      }
+    }
+
+    double heaviest = *max_element(weights.begin(), weights.end());
+    p.imbalance = total > 0.0 ? heaviest * parts / total : 1.0;
+
+    return p;
+  }
+
+  vector<uint32_t> ares_partition_halo(const PartitionGraph& graph,
+                                       const GraphPartition& partition,
+                                       int rank){
+    vector<uint32_t> halo;
+
+    uint32_t begin = partition.offsets[rank];
+    uint32_t end = partition.offsets[rank + 1];
+
+    for(uint32_t i = begin; i < end; ++i){
+      uint32_t v = partition.order[i];
+      for(uint32_t k = graph.offsets[v]; k < graph.offsets[v + 1]; ++k){
+        uint32_t u = graph.neighbors[k];
+        if(u < graph.n && partition.part[u] != uint32_t(rank)){
+          halo.push_back(partition.index[u]);
+        }
+      }
+    }
+
+    sort(halo.begin(), halo.end());
+    halo.erase(unique(halo.begin(), halo.end()), halo.end());
+
+    return halo;
+  }
+
+
+  size_t ares_num_workers(){
+    return threadPool()->maxThreads();
+  }
+
+  size_t ares_set_num_workers(size_t n){
+    return threadPool()->setNumThreads(n);
+  }
+
+  size_t ares_active_workers(){
+    return threadPool()->numThreads();
+  }
+
+  void* ares_arena(const string& name, size_t maxConcurrency,
+                   uint32_t priority){
+    lock_guard<mutex> lock(_arenaMutex);
+
+    unique_ptr<Arena>& a = _arenas[name];
+
+    if(!a){
+      if(maxConcurrency == 0){
+        maxConcurrency = PoolConfig().numThreads;
+      }
+
+      // lower priorities are nicer to the other threads of the process,
+      // a higher one needs the privilege to raise it
+      int niceness = priority == 0 ? 10 : priority == 1 ? 0 : -5;
+
+      a.reset(new Arena(name, maxConcurrency, niceness));
+    }
+
+    return a.get();
+  }
+
+  void* ares_arena_enter(void* arena){
+    Arena* prev = _arena;
+    _arena = static_cast<Arena*>(arena);
+    return prev;
+  }
+
+  void ares_arena_enqueue(void* arena, void (*f)(void*), void* arg,
+                          uint32_t priority){
+    static_cast<Arena*>(arena)->pool.push(f, arg, priority);
+  }
+
+  size_t ares_arena_max_concurrency(void* arena){
+    return static_cast<Arena*>(arena)->pool.maxThreads();
+  }
+
+  int ares_worker_index(){
+    return threadPool()->workerIndex();
+  }
+
+  uint64_t ares_scratch_mark(){
+    return Scratch::mark();
+  }
+
+  void ares_scratch_release(uint64_t mark){
+    Scratch::release(mark);
+  }
+
+  void ares_region_begin(const char* name){
+    UserRegion::begin(UserRegion::id(name));
+  }
+
+  void ares_region_end(){
+    UserRegion::end();
+  }
+
+  void* ares_task_group_begin(){
+    Synch*& group = taskGroup();
+    auto g = new TaskGroupState(group);
+    group = &g->synch;
+    return g;
+  }
+
+  void ares_task_group_wait(void* handle){
+    auto g = static_cast<TaskGroupState*>(handle);
+
+    taskGroup() = g->prev;
+
+    bool graph = TaskSpan::enabled();
+    if(graph){
+      TaskSpan::awaitBegin(threadPool()->workerIndex() < 0);
+    }
+
+    g->synch.release();
+    waitFor(&g->synch);
+
+    if(graph){
+      TaskSpan::awaitEnd(g->synch.join(), 0);
+    }
+
+    delete g;
+  }
+
+  size_t ares_task_memo_clear(){
+    return memoTable().clear([](void* args){
+      dropTaskFrame(static_cast<TaskArg*>(args));
+    });
+  }
+
+  void ares_wait_completion(void** handle){
+    if(*handle){
+      __ares_await_synch(*handle);
+      *handle = nullptr;
+    }
+  }
+
+  void ares_set_memory_limit(uint64_t bytes){
+    MemoryAccount::setLimit(MemoryAccount::NUM_CATEGORIES, bytes);
+  }
+
+  void ares_set_memory_limit(MemoryCategory category, uint64_t bytes){
+    MemoryAccount::setLimit(MemoryAccount::Category(category), bytes);
+  }
+
+  bool ares_offload_map(void* ptr, size_t bytes){
+    return Offload::get().map(ptr, bytes);
+  }
+
+  void ares_offload_unmap(void* ptr){
+    Offload::get().unmap(ptr);
+  }
+
+  void ares_offload_update_host(void* ptr){
+    Offload::get().update(ptr, true);
+  }
+
+  void ares_offload_update_device(void* ptr){
+    Offload::get().update(ptr, false);
+  }
+
+  bool ares_offload_enter(void* ptr, size_t bytes, OffloadAccess access){
+    return Offload::get().enter(ptr, bytes, static_cast<uint32_t>(access));
+  }
+
+  bool ares_offload_share(void* ptr, size_t bytes){
+    return Offload::get().share(ptr, bytes);
+  }
+
+  void ares_offload_exit(void* ptr){
+    Offload::get().exit(ptr);
+  }
+
+  void ares_offload_wait(void* ptr){
+    Offload::get().wait(ptr);
+  }
+
+  void* ares_snapshot(const void* data, size_t bytes, const std::string& path,
+                      bool compress){
+    auto state = new SnapshotState;
+
+    // the copy is what lets the caller go on writing data
+    char* copy = static_cast<char*>(Allocator::allocate(bytes));
+    if(!copy){
+      state->synch.release();
+      dropSnapshot(state);
+      return state;
+    }
+
+    parallelCopy(copy, static_cast<const char*>(data), bytes);
+
+    IOService::get().submit([=]{
+      state->ok = writeSnapshot(copy, bytes, path, compress);
+      Allocator::release(copy);
+      state->synch.release();
+      dropSnapshot(state);
+    });
+
+    return state;
+  }
+
+  bool ares_snapshot_ready(void* snapshot){
+    return static_cast<SnapshotState*>(snapshot)->synch.tryAwait();
+  }
+
+  bool ares_snapshot_wait(void* snapshot){
+    auto state = static_cast<SnapshotState*>(snapshot);
+    waitFor(&state->synch);
+
+    bool ok = state->ok;
+    dropSnapshot(state);
+    return ok;
+  }
+
+  bool ares_snapshot_read(const std::string& path, void* data, size_t bytes){
+    return readSnapshot(path, static_cast<char*>(data), bytes);
+  }
+
+  // the bound in microseconds of the latency that fraction of the
+  // messages were taken within, 0 if there were none
+  static uint64_t latencyBound(const vector<uint64_t>& latency,
+                               double fraction){
+    uint64_t total = 0;
+    for(uint64_t n : latency){
+      total += n;
+    }
+
+    uint64_t count = 0;
+    for(size_t i = 0; i < latency.size(); ++i){
+      count += latency[i];
+      if(count > 0 && count >= fraction * total){
+        return uint64_t(1) << i;
+      }
+    }
+    return 0;
+  }
+
+  static void printPeerStats(ostream& ostr, const RuntimeStats& stats){
+    ostr << setw(6) << "peer" << setw(12) << "sent" <<
+      setw(14) << "sent(B)" << setw(12) << "received" <<
+      setw(14) << "received(B)" << setw(8) << "queue" <<
+      setw(12) << "queue(B)" << setw(8) << "peak" << setw(10) << "p50(us)" <<
+      setw(10) << "p99(us)" << endl;
+
+    for(const RuntimePeerStats& ps : stats.peers){
+      ostr << setw(6) << ps.rank << setw(12) << ps.messagesSent <<
+        setw(14) << ps.bytesSent << setw(12) << ps.messagesReceived <<
+        setw(14) << ps.bytesReceived << setw(8) << ps.queueDepth <<
+        setw(12) << ps.queuedBytes << setw(8) << ps.peakQueueDepth <<
+        setw(10) << latencyBound(ps.latency, 0.5) <<
+        setw(10) << latencyBound(ps.latency, 0.99) << endl;
+    }
+  }
+
+  // instructions per cycle, cache misses per thousand instructions and
+  // the bandwidth the misses amount to in cache lines per second of the
+  // region's threads, a low IPC with a high MPKI marks a memory bound one
+  static void printRegionStats(ostream& ostr, const RuntimeStats& stats){
+    ostr << setw(24) << "region" << setw(10) << "calls" <<
+      setw(10) << "time(s)" << setw(8) << "IPC" << setw(8) << "miss%" <<
+      setw(8) << "MPKI" << setw(10) << "GB/s" << setw(8) << "workers" <<
+      endl;
+
+    for(const RuntimeRegionStats& rs : stats.regions){
+      double ipc = rs.cycles ? double(rs.instructions)/rs.cycles : 0.0;
+      double miss = rs.cacheReferences ? 
+        100.0*rs.cacheMisses/rs.cacheReferences : 0.0;
+      double mpki = rs.instructions ? 
+        1000.0*rs.cacheMisses/rs.instructions : 0.0;
+      double bandwidth = rs.time > 0 ? rs.cacheMisses*64/rs.time/1e9 : 0.0;
+
+      ostr << setw(24) << rs.name << setw(10) << rs.calls << 
+        fixed << setprecision(3) << setw(10) << rs.time << 
+        setprecision(2) << setw(8) << ipc << setw(8) << miss << 
+        setw(8) << mpki << setw(10) << bandwidth << setw(8) << 
+        rs.workers << endl;
+    }
+
+    ostr.unsetf(ios::floatfield);
+  }
+
+  // the time of a phase on the threads that marked it, then the work
+  // that it queued, which runs in parallel with that time
+  static void printUserRegionStats(ostream& ostr, const RuntimeStats& stats){
+    ostr << setw(24) << "phase" << setw(10) << "calls" <<
+      setw(10) << "time(s)" << setw(10) << "work(s)" << endl;
+
+    for(const RuntimeUserRegionStats& us : stats.userRegions){
+      ostr << setw(24) << us.name << setw(10) << us.calls <<
+        fixed << setprecision(3) << setw(10) << us.time <<
+        setw(10) << us.work << endl;
+    }
+
+    ostr.unsetf(ios::floatfield);
+  }
+
+  // one line per worker, then totals. The imbalance is the busiest
+  // worker's task count over the mean, 1 is a perfect balance. Then one
+  // line per peer, whose latencies are bounds of powers of two, one per
+  // region with hardware counters and one per phase.
+  void ares_print_runtime_stats(ostream& ostr){
+    RuntimeStats stats = ares_runtime_stats();
+
+    ostr << "ares runtime stats: " << stats.workers.size() << " workers, " <<
+      stats.externalPushes << " external pushes" << endl;
+
+    const RuntimeAllocatorStats& as = stats.allocator;
+    if(as.mappedBlocks > 0 || as.hugetlbFallbacks > 0){
+      ostr << "allocator: " << as.mappedBlocks << " mapped blocks, " <<
+        (as.mappedBytes >> 20) << " MB, " << (as.hugetlbBytes >> 20) <<
+        " MB hugetlb, " << as.hugetlbFallbacks << " fallbacks, " <<
+        (as.lockedBytes >> 20) << " MB locked, " <<
+        (as.transparentHugeBytes >> 20) << " MB transparent huge pages" <<
+        endl;
+    }
+
+    const RuntimeMemoryStats& ms = stats.memory;
+    ostr << "memory: " << (ms.queueItems >> 10) << " KB queue items, " <<
+      (ms.taskFrames >> 10) << " KB task frames, " << (ms.partials >> 10) <<
+      " KB partials, " << (ms.messages >> 10) << " KB messages, " <<
+      (ms.stacks >> 10) << " KB stacks, " << (ms.peak >> 10) << " KB peak";
+    if(ms.limit > 0){
+      ostr << ", " << (ms.limit >> 10) << " KB limit, " << ms.inlinedSpawns <<
+        " spawns inlined";
+    }
+    ostr << endl;
+
+    if(!stats.peers.empty()){
+      printPeerStats(ostr, stats);
+    }
+
+    if(!stats.regions.empty()){
+      printRegionStats(ostr, stats);
+    }
+    else if(PerfCounters::enabled() && !PerfCounters::available()){
+      ostr << "ARES_PERF_COUNTERS is set, but the hardware counters " <<
+        "could not be opened" << endl;
+    }
+
+    if(!stats.userRegions.empty()){
+      printUserRegionStats(ostr, stats);
+    }
+
+    if(stats.workers.empty()){
+      return;
+    }
+
+    ostr << setw(6) << "worker" << setw(6) << "node" <<
+      setw(12) << "executed" << setw(12) << "pushed" <<
+      setw(12) << "steals" << setw(12) << "remote" <<
+      setw(12) << "attempts" << setw(8) << "peak" <<
+      setw(10) << "busy(s)" << setw(10) << "idle(s)" << endl;
+
+    RuntimeWorkerStats total = {0, 0, 0, 0, 0, 0, 0, 0.0, 0.0};
+    uint64_t maxExecuted = 0;
+
+    for(size_t i = 0; i < stats.workers.size(); ++i){
+      const RuntimeWorkerStats& ws = stats.workers[i];
+
+      ostr << setw(6) << i << setw(6) << ws.numaNode <<
+        setw(12) << ws.tasksExecuted << setw(12) << ws.tasksPushed <<
+        setw(12) << ws.steals << setw(12) << ws.remoteSteals <<
+        setw(12) << ws.stealAttempts << setw(8) << ws.peakQueueDepth <<
+        fixed << setprecision(3) <<
+        setw(10) << ws.busyTime << setw(10) << ws.idleTime << endl;
+
+      total.tasksExecuted += ws.tasksExecuted;
+      total.tasksPushed += ws.tasksPushed;
+      total.steals += ws.steals;
+      total.remoteSteals += ws.remoteSteals;
+      total.stealAttempts += ws.stealAttempts;
+      total.busyTime += ws.busyTime;
+      total.idleTime += ws.idleTime;
+
+      if(ws.peakQueueDepth > total.peakQueueDepth){
+        total.peakQueueDepth = ws.peakQueueDepth;
+      }
+
+      if(ws.tasksExecuted > maxExecuted){
+        maxExecuted = ws.tasksExecuted;
+      }
+    }
+
+    ostr << setw(6) << "total" << setw(6) << "" <<
+      setw(12) << total.tasksExecuted << setw(12) << total.tasksPushed <<
+      setw(12) << total.steals << setw(12) << total.remoteSteals <<
+      setw(12) << total.stealAttempts << setw(8) << total.peakQueueDepth <<
+      setw(10) << total.busyTime << setw(10) << total.idleTime << endl;
+
+    double mean = double(total.tasksExecuted)/stats.workers.size();
+
+    ostr << "imbalance: " << setprecision(2) <<
+      (mean > 0 ? maxExecuted/mean : 1.0) << endl;
+
+    ostr.unsetf(ios::floatfield);
   }
 
 } // namespace ares
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ares/algorithm.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 1 << 20;
+
+int main(int argc, char** argv){
+  mt19937 gen(7);
+
+  vector<uint32_t> a(SIZE);
+  for(uint32_t& x : a){
+    x = gen() % (SIZE/4);
+  }
+
+  vector<uint32_t> sorted = a;
+  parallel_sort(sorted.begin(), sorted.end());
+
+  vector<uint32_t> expected = a;
+  sort(expected.begin(), expected.end());
+
+  bool ok = sorted == expected;
+
+  // not trivially copyable, and with many equal keys
+  vector<string> s(SIZE/8);
+  for(string& x : s){
+    x = to_string(gen() % 100);
+  }
+
+  vector<string> ss = s;
+  parallel_sort(ss.begin(), ss.end(), greater<string>());
+  sort(s.begin(), s.end(), greater<string>());
+  ok = ok && ss == s;
+
+  auto u = parallel_unique(sorted.begin(), sorted.end());
+  auto eu = unique(expected.begin(), expected.end());
+  ok = ok && u - sorted.begin() == eu - expected.begin() &&
+    equal(sorted.begin(), u, expected.begin());
+
+  auto even = [](uint32_t x){ return x % 2 == 0; };
+
+  vector<uint32_t> p = a;
+  auto pp = parallel_stable_partition(p.begin(), p.end(), even);
+  vector<uint32_t> ep = a;
+  auto epp = stable_partition(ep.begin(), ep.end(), even);
+  ok = ok && pp - p.begin() == epp - ep.begin() && p == ep;
+
+  vector<uint32_t> c(SIZE);
+  auto ce = parallel_copy_if(a.begin(), a.end(), c.begin(), even);
+  vector<uint32_t> ec(SIZE);
+  auto ece = copy_if(a.begin(), a.end(), ec.begin(), even);
+  ok = ok && ce - c.begin() == ece - ec.begin() && c == ec;
+
+  uint64_t sum = parallel_transform_reduce(a.begin(), a.end(), uint64_t(0),
+    [](uint64_t x, uint64_t y){ return x + y; },
+    [](uint32_t x){ return uint64_t(x) * x; });
+
+  uint64_t esum = 0;
+  for(uint32_t x : a){
+    esum += uint64_t(x) * x;
+  }
+  ok = ok && sum == esum;
+
+  cout << "unique = " << u - sorted.begin() << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
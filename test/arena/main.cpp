@@ -0,0 +1,68 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <ares/arena.h>
+#include <ares/parallel.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 100000;
+
+int main(int argc, char** argv){
+  task_arena background("background", 1, Priority::Low);
+  task_arena solver("solver", 2);
+
+  // a long task that would hold up a worker of a shared pool
+  atomic<bool> started(false);
+  atomic<bool> done(false);
+
+  background.enqueue([&]{
+    started = true;
+    this_thread::sleep_for(chrono::milliseconds(500));
+    done = true;
+  });
+
+  while(!started){
+    this_thread::yield();
+  }
+
+  vector<double> a(SIZE);
+  bool isolated = true;
+
+  double sum = solver.execute([&]{
+    isolated = ares_active_workers() == 2;
+
+    parallel_for(0, SIZE, [&](uint32_t i){
+      a[i] = i;
+      if(ares_worker_index() < 0){
+        isolated = false;
+      }
+    });
+
+    return parallel_reduce(0, SIZE, 0.0, [&](uint32_t i){
+      return a[i];
+    });
+  });
+
+  // the solver's loops finished without waiting for the long task
+  bool overlapped = !done;
+
+  bool named = task_arena("solver").max_concurrency() == 2 &&
+    ares_num_workers() >= 1;
+
+  while(!done){
+    this_thread::yield();
+  }
+
+  bool ok = sum == double(SIZE) * (SIZE - 1)/2 && isolated && overlapped &&
+    named;
+
+  cout << "sum = " << sum << ", isolated = " << isolated <<
+    ", overlapped = " << overlapped << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
@@ -41,5 +41,13 @@ int main(int argc, char** argv){
 
   cout << "past barrier 2" << endl;
 
+  ares_barrier_arrive();
+
+  cout << "arrived at barrier 3" << endl;
+
+  ares_barrier_wait();
+
+  cout << "past barrier 3" << endl;
+
   return 0;
 }
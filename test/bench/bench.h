@@ -0,0 +1,17 @@
+#ifndef __ARES_BENCH_H__
+#define __ARES_BENCH_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// the benchmarks of the lowered constructs, in lowered.cpp, each returns
+// the seconds that one of its iters runs took on average
+
+double forallTime(float* a, uint32_t n, size_t iters);
+
+double reduceTime(const float* a, uint32_t n, size_t iters, float& sum);
+
+// n is the argument of the task fib(), result its return value
+double fibTime(int n, size_t iters, int& result);
+
+#endif // __ARES_BENCH_H__
@@ -0,0 +1,60 @@
+#include <chrono>
+
+#include <ares/frontend.h>
+
+#include "bench.h"
+
+using namespace std;
+using namespace ares;
+
+using Clock = chrono::steady_clock;
+
+static double since(Clock::time_point start, size_t iters){
+  return chrono::duration<double>(Clock::now() - start).count() / iters;
+}
+
+task int fib(int i){
+  if(i <= 1){
+    return i;
+  }
+
+  return fib(i - 1) + fib(i - 2);
+}
+
+double forallTime(float* a, uint32_t n, size_t iters){
+  auto start = Clock::now();
+
+  for(size_t k = 0; k < iters; ++k){
+    for(auto i : Forall(0, n)){
+      a[i] = a[i]*0.5f + 1.0f;
+    }
+  }
+
+  return since(start, iters);
+}
+
+double reduceTime(const float* a, uint32_t n, size_t iters, float& sum){
+  auto start = Clock::now();
+
+  for(size_t k = 0; k < iters; ++k){
+    float s = 0.0f;
+
+    for(auto i : ReduceAll(0, n, s)){
+      s += a[i];
+    }
+
+    sum += s;
+  }
+
+  return since(start, iters);
+}
+
+double fibTime(int n, size_t iters, int& result){
+  auto start = Clock::now();
+
+  for(size_t k = 0; k < iters; ++k){
+    result = fib(n);
+  }
+
+  return since(start, iters);
+}
@@ -0,0 +1,453 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <ares/runtime.h>
+
+#include "bench.h"
+
+using namespace std;
+using namespace ares;
+
+// the entry points that HLIR lowers Forall and friends to
+extern "C"{
+  void* __ares_create_synch(uint32_t count);
+  void __ares_await_synch(void* synch);
+  void __ares_finish_func(void* arg);
+  void __ares_queue_func(void* synch, void* args, void* fp,
+                         uint32_t index, uint32_t priority, void* region);
+  void __ares_queue_range(void* synch, void* args, void* fp,
+                          uint32_t start, uint32_t end,
+                          uint32_t grain, uint32_t priority, void* region);
+}
+
+// the argument the runtime passes the body of a range
+struct RangeArg{
+  uint32_t begin;
+  uint32_t end;
+  void* args;
+};
+
+using Clock = chrono::steady_clock;
+
+const uint32_t PING_TAG = 1;
+const uint32_t PONG_TAG = 2;
+const uint32_t DONE_TAG = 3;
+
+struct Options{
+  vector<size_t> threads;
+  vector<string> only;
+  size_t reps = 5;
+  int port = 17345;
+  bool quick = false;
+
+  bool selected(const string& name) const{
+    return only.empty() || find(only.begin(), only.end(), name) != only.end();
+  }
+};
+
+double since(Clock::time_point start){
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// one JSON object per line, with the median, min and max over the reps,
+// params are the members that identify the measurement
+void report(const string& bench, const string& params, const string& unit,
+            vector<double> samples){
+  sort(samples.begin(), samples.end());
+
+  cout << "{\"bench\": \"" << bench << "\", " << params <<
+    ", \"unit\": \"" << unit << "\", \"median\": " <<
+    samples[samples.size()/2] << ", \"min\": " << samples.front() <<
+    ", \"max\": " << samples.back() << ", \"reps\": " << samples.size() <<
+    "}" << endl;
+}
+
+string threadsParam(size_t threads){
+  return "\"threads\": " + to_string(threads);
+}
+
+void emptyBody(void* arg){
+  __ares_finish_func(arg);
+}
+
+void scaleBody(void* arg){
+  auto r = static_cast<RangeArg*>(arg);
+  auto a = static_cast<float*>(r->args);
+
+  for(uint32_t i = r->begin; i < r->end; ++i){
+    a[i] = a[i]*0.5f + 1.0f;
+  }
+}
+
+// queues n empty tasks and waits for all of them
+void benchSpawn(const Options& o, size_t threads){
+  uint32_t n = o.quick ? 1 << 12 : 1 << 16;
+
+  vector<double> samples;
+
+  for(size_t r = 0; r <= o.reps; ++r){
+    auto start = Clock::now();
+
+    void* synch = __ares_create_synch(n);
+    for(uint32_t i = 0; i < n; ++i){
+      __ares_queue_func(synch, nullptr, reinterpret_cast<void*>(emptyBody),
+                        i, 1, nullptr);
+    }
+    __ares_await_synch(synch);
+
+    // the first run starts the pool
+    if(r > 0){
+      samples.push_back(n/since(start));
+    }
+  }
+
+  report("spawn", threadsParam(threads), "tasks/s", samples);
+}
+
+// one range of n, split no further than grain, 0 letting the runtime
+// choose
+void benchGrain(const Options& o, size_t threads){
+  uint32_t n = o.quick ? 1 << 18 : 1 << 22;
+  vector<float> a(n, 1.0f);
+
+  for(uint32_t grain : {0, 1 << 6, 1 << 10, 1 << 14, 1 << 18}){
+    vector<double> samples;
+
+    for(size_t r = 0; r <= o.reps; ++r){
+      auto start = Clock::now();
+
+      void* synch = __ares_create_synch(1);
+      __ares_queue_range(synch, a.data(), reinterpret_cast<void*>(scaleBody),
+                         0, n, grain, 1, nullptr);
+      __ares_await_synch(synch);
+
+      if(r > 0){
+        samples.push_back(since(start)*1e6);
+      }
+    }
+
+    report("forall_grain", threadsParam(threads) + ", \"n\": " +
+           to_string(n) + ", \"grain\": " + to_string(grain), "us", samples);
+  }
+}
+
+void benchForall(const Options& o, size_t threads){
+  for(uint32_t n : {1 << 10, 1 << 16, 1 << 22}){
+    if(o.quick && n > 1 << 18){
+      continue;
+    }
+
+    vector<float> a(n, 1.0f);
+    size_t iters = max(size_t(1), size_t(1 << 24)/n);
+
+    vector<double> samples;
+    forallTime(a.data(), n, 1);
+
+    for(size_t r = 0; r < o.reps; ++r){
+      samples.push_back(forallTime(a.data(), n, iters)*1e6);
+    }
+
+    report("forall", threadsParam(threads) + ", \"n\": " + to_string(n),
+           "us", samples);
+  }
+}
+
+void benchReduce(const Options& o, size_t threads){
+  for(uint32_t n : {1 << 10, 1 << 16, 1 << 20}){
+    if(o.quick && n > 1 << 18){
+      continue;
+    }
+
+    vector<float> a(n, 1.0f);
+    size_t iters = max(size_t(1), size_t(1 << 24)/n);
+
+    vector<double> samples;
+    float sum = 0.0f;
+    reduceTime(a.data(), n, 1, sum);
+
+    for(size_t r = 0; r < o.reps; ++r){
+      samples.push_back(reduceTime(a.data(), n, iters, sum)*1e6);
+    }
+
+    report("reduce", threadsParam(threads) + ", \"n\": " + to_string(n),
+           "us", samples);
+  }
+}
+
+// every call of fib() is a task, fib(n) makes 2 fib(n + 1) - 1 of them
+void benchFib(const Options& o, size_t threads){
+  int n = o.quick ? 20 : 27;
+
+  uint64_t f0 = 0;
+  uint64_t f1 = 1;
+  for(int i = 0; i <= n; ++i){
+    uint64_t f2 = f0 + f1;
+    f0 = f1;
+    f1 = f2;
+  }
+
+  uint64_t calls = 2*f0 - 1;
+
+  vector<double> samples;
+  int result;
+  fibTime(n, 1, result);
+
+  for(size_t r = 0; r < o.reps; ++r){
+    samples.push_back(calls/fibTime(n, 1, result));
+  }
+
+  report("fib", threadsParam(threads) + ", \"n\": " + to_string(n),
+         "tasks/s", samples);
+}
+
+// the benchmarks of one process with the pool at its number of threads
+void runLocal(const Options& o, size_t threads){
+  if(o.selected("spawn")){
+    benchSpawn(o, threads);
+  }
+
+  if(o.selected("forall_grain")){
+    benchGrain(o, threads);
+  }
+
+  if(o.selected("forall")){
+    benchForall(o, threads);
+  }
+
+  if(o.selected("reduce")){
+    benchReduce(o, threads);
+  }
+
+  if(o.selected("fib")){
+    benchFib(o, threads);
+  }
+}
+
+// half the round trip of each size between ranks 0 and 1, which
+// reports it, then the latency of the barrier across both
+void runComm(const Options& o, const string& transport){
+  ares_init_comm(2);
+  ares_barrier();
+
+  int rank = ares_rank();
+  int peer = 1 - rank;
+
+  string base = "\"transport\": \"" + transport + "\"";
+
+  if(o.selected("pingpong")){
+    for(size_t size = 8; size <= (o.quick ? 1 << 15 : 1 << 21); size *= 8){
+      size_t iters =
+        max(size_t(10), min(size_t(1000), (size_t(64) << 20)/size));
+
+      vector<double> latency;
+      vector<double> bandwidth;
+
+      for(size_t r = 0; r <= o.reps; ++r){
+        ares_barrier();
+        auto start = Clock::now();
+
+        for(size_t k = 0; k < iters; ++k){
+          size_t n;
+
+          if(rank == 0){
+            ares_send(peer, PING_TAG, static_cast<char*>(malloc(size)), size);
+            ares_release(ares_receive(peer, PONG_TAG, n));
+          }
+          else{
+            ares_release(ares_receive(peer, PING_TAG, n));
+            ares_send(peer, PONG_TAG, static_cast<char*>(malloc(size)), size);
+          }
+        }
+
+        double oneWay = since(start)/iters/2;
+
+        if(r > 0){
+          latency.push_back(oneWay*1e6);
+          bandwidth.push_back(size/oneWay/1e6);
+        }
+      }
+
+      if(rank == 0){
+        string params = base + ", \"bytes\": " + to_string(size);
+        report("pingpong_latency", params, "us", latency);
+        report("pingpong_bandwidth", params, "MB/s", bandwidth);
+      }
+    }
+  }
+
+  if(o.selected("barrier")){
+    size_t iters = o.quick ? 100 : 1000;
+    vector<double> samples;
+
+    for(size_t r = 0; r <= o.reps; ++r){
+      auto start = Clock::now();
+
+      for(size_t k = 0; k < iters; ++k){
+        ares_barrier();
+      }
+
+      if(r > 0){
+        samples.push_back(since(start)/iters*1e6);
+      }
+    }
+
+    if(rank == 0){
+      report("barrier", base, "us", samples);
+    }
+  }
+
+  // the sends are queued, so neither rank exits before the other has
+  // received everything it sent
+  size_t n;
+  ares_wait(ares_isend(peer, DONE_TAG, "", 1), n);
+  ares_release(ares_receive(peer, DONE_TAG, n));
+}
+
+// the runtime reads its configuration once, so each configuration is
+// run in a process of its own, forked before this one has started it
+pid_t spawn(const function<void()>& f){
+  cout.flush();
+
+  pid_t pid = fork();
+  if(pid == 0){
+    f();
+    exit(0);
+  }
+
+  return pid;
+}
+
+bool join(pid_t pid){
+  int status;
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+    WEXITSTATUS(status) == 0;
+}
+
+bool runPair(const Options& o, const string& transport){
+  string a = "/tmp/ares_bench." + to_string(getpid()) + ".0";
+  string b = "/tmp/ares_bench." + to_string(getpid()) + ".1";
+
+  bool fifo = transport == "fifo";
+
+  if(fifo){
+    mkfifo(a.c_str(), S_IWUSR|S_IRUSR);
+    mkfifo(b.c_str(), S_IWUSR|S_IRUSR);
+  }
+
+  pid_t listener = spawn([&]{
+    if(fifo ? !ares_listen(a, b) : !ares_listen(o.port)){
+      exit(1);
+    }
+    runComm(o, transport);
+  });
+
+  pid_t connector = spawn([&]{
+    if(fifo ? !ares_connect(b, a) : !ares_connect("localhost", o.port)){
+      exit(1);
+    }
+    runComm(o, transport);
+  });
+
+  bool ok = join(listener);
+  ok = join(connector) && ok;
+
+  if(fifo){
+    unlink(a.c_str());
+    unlink(b.c_str());
+  }
+
+  return ok;
+}
+
+vector<string> split(const string& str){
+  vector<string> v;
+  istringstream istr(str);
+
+  string s;
+  while(getline(istr, s, ',')){
+    v.push_back(s);
+  }
+
+  return v;
+}
+
+void usage(){
+  cerr << "usage: ares_bench [--threads n,...] [--only name,...] " <<
+    "[--reps n] [--port n] [--quick]" << endl <<
+    "benchmarks: spawn forall_grain forall reduce fib pingpong barrier" <<
+    endl;
+}
+
+int main(int argc, char** argv){
+  Options o;
+
+  for(int i = 1; i < argc; ++i){
+    string arg = argv[i];
+    bool more = i + 1 < argc;
+
+    if(arg == "--threads" && more){
+      for(const string& s : split(argv[++i])){
+        o.threads.push_back(atoi(s.c_str()));
+      }
+    }
+    else if(arg == "--only" && more){
+      o.only = split(argv[++i]);
+    }
+    else if(arg == "--reps" && more){
+      o.reps = max(1, atoi(argv[++i]));
+    }
+    else if(arg == "--port" && more){
+      o.port = atoi(argv[++i]);
+    }
+    else if(arg == "--quick"){
+      o.quick = true;
+    }
+    else{
+      usage();
+      return 1;
+    }
+  }
+
+  // by default powers of two up to the number of CPUs, and that number
+  if(o.threads.empty()){
+    size_t numCpus = max(1u, thread::hardware_concurrency());
+
+    for(size_t t = 1; t < numCpus; t *= 2){
+      o.threads.push_back(t);
+    }
+    o.threads.push_back(numCpus);
+  }
+
+  bool ok = true;
+
+  for(size_t threads : o.threads){
+    ok = join(spawn([&]{
+      setenv("ARES_NUM_THREADS", to_string(threads).c_str(), 1);
+      runLocal(o, threads);
+    })) && ok;
+  }
+
+  if(o.selected("pingpong") || o.selected("barrier")){
+    for(const char* transport : {"fifo", "socket"}){
+      ok = runPair(o, transport) && ok;
+    }
+  }
+
+  if(!ok){
+    cerr << "ares_bench: a benchmark failed" << endl;
+  }
+
+  return ok ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include <cassert>
 
@@ -9,15 +10,68 @@
 using namespace std;
 using namespace ares;
 
+// large enough to be sent by rendezvous
+const size_t BULK_SIZE = 1 << 20;
+
+void greet(int source, void* args, size_t size){
+  cout << "rank " << ares_rank() << ": " << static_cast<char*>(args) <<
+    " from " << source << endl;
+}
+
 int main(int argc, char** argv){
   assert(argc == 2);
 
+  uint32_t greetHandler = ares_register_handler(greet);
+
   string type = argv[1];
 
   if(type == "listen"){
     ares_listen("f1", "f2");
     char* buf = strdup("testmsg");
     ares_send(buf, strlen(buf) + 1);
+
+    size_t size;
+    char* reply = ares_receive(1, 7, size);
+    cout << "rank " << ares_rank() << ": " << reply << endl;
+    ares_release(reply);
+
+    CommRequest* request = ares_irecv(ARES_ANY_RANK, 8);
+    reply = ares_wait(request, size);
+    cout << "rank " << ares_rank() << ": " << reply << endl;
+    ares_release(reply);
+
+    // one posted before it is sent and one after, both read in place
+    char* bulk = new char[2 * BULK_SIZE];
+    request = ares_recv_into(1, 9, bulk, BULK_SIZE);
+    char* into = ares_wait(request, size);
+    assert(into == bulk && size == BULK_SIZE);
+
+    sleep(1);
+    request = ares_recv_into(1, 10, bulk + BULK_SIZE, BULK_SIZE);
+    ares_wait(request, size);
+
+    size_t ok = 0;
+    for(size_t i = 0; i < 2 * BULK_SIZE; ++i){
+      ok += bulk[i] == char(i % BULK_SIZE % 251);
+    }
+    cout << "rank " << ares_rank() << ": bulk ok = " <<
+      (ok == 2 * BULK_SIZE) << endl;
+
+    // spliced from the pipe to a file
+    FILE* file = tmpfile();
+    request = ares_recv_to_fd(1, 11, fileno(file));
+    ares_wait(request, size);
+
+    memset(bulk, 0, BULK_SIZE);
+    rewind(file);
+    ok = fread(bulk, 1, BULK_SIZE, file) == BULK_SIZE && size == BULK_SIZE;
+    for(size_t i = 0; i < BULK_SIZE; ++i){
+      ok = ok && bulk[i] == char(i % 251);
+    }
+    fclose(file);
+    cout << "rank " << ares_rank() << ": file ok = " << ok << endl;
+
+    delete[] bulk;
     sleep(1);
   }
   else if(type == "connect"){
@@ -25,7 +79,36 @@ int main(int argc, char** argv){
     size_t size;
     char* buf = ares_receive(size);
     cout << buf << endl;
-    sleep(1);
+    ares_release(buf);
+
+    char* reply = strdup("reply");
+    ares_send(0, 7, reply, strlen(reply) + 1);
+
+    const char* later = "non-blocking reply";
+    CommRequest* request = ares_isend(0, 8, later, strlen(later) + 1);
+    ares_wait(request, size);
+
+    const char* active = "active message";
+    ares_spawn(0, greetHandler, active, strlen(active) + 1);
+
+    char* bulk = static_cast<char*>(malloc(BULK_SIZE));
+    for(size_t i = 0; i < BULK_SIZE; ++i){
+      bulk[i] = char(i % 251);
+    }
+    request = ares_isend(0, 9, bulk, BULK_SIZE);
+    ares_wait(request, size);
+    ares_send(0, 10, bulk, BULK_SIZE);
+
+    // whole pages, which are gifted to the pipe
+    void* pages;
+    posix_memalign(&pages, 4096, BULK_SIZE);
+    for(size_t i = 0; i < BULK_SIZE; ++i){
+      static_cast<char*>(pages)[i] = char(i % 251);
+    }
+    ares_send(0, 11, static_cast<char*>(pages), BULK_SIZE);
+
+    // held here until the receive for it is posted
+    sleep(2);
   }
   else{
     assert(false);
@@ -0,0 +1,100 @@
+#include <cstdlib>
+#include <string>
+
+#include <ares/parallel.h>
+
+#include "compare.h"
+
+using namespace std;
+using namespace ares;
+
+// the entry points that a task call is lowered to
+extern "C"{
+  void __ares_finish_func(void* arg);
+  void __ares_queue_func(void* synch, void* args, void* fp,
+                         uint32_t index, uint32_t priority, void* region);
+}
+
+namespace{
+
+// the argument the runtime passes a task
+struct FuncArg{
+  void* synch;
+  uint32_t n;
+  void* args;
+};
+
+struct FibArgs{
+  int n;
+  uint64_t result;
+};
+
+uint64_t aresFib(int n);
+
+void fibTask(void* arg){
+  auto f = static_cast<FibArgs*>(static_cast<FuncArg*>(arg)->args);
+  f->result = aresFib(f->n);
+  __ares_finish_func(arg);
+}
+
+// both calls are queued and awaited, as the lowering of a task fib()
+// that returns fib(n - 1) + fib(n - 2) does
+uint64_t aresFib(int n){
+  if(n < 2){
+    return n;
+  }
+
+  FibArgs args[2] = {{n - 1, 0}, {n - 2, 0}};
+
+  void* synch = __ares_create_synch(2);
+  for(uint32_t k = 0; k < 2; ++k){
+    __ares_queue_func(synch, &args[k], reinterpret_cast<void*>(fibTask), k,
+                      1, nullptr);
+  }
+  __ares_await_synch(synch);
+
+  return args[0].result + args[1].result;
+}
+
+// parallel_for() and parallel_reduce() on the runtime's pool, with its
+// default schedule
+class AresRuntime : public Runtime{
+public:
+  void start(size_t threads) override{
+    // read when the pool starts, which the first range does
+    setenv("ARES_NUM_THREADS", to_string(threads).c_str(), 1);
+    parallel_for(1, [](uint32_t){});
+  }
+
+  void scale(float* a, uint32_t n) override{
+    parallel_for(n, [=](uint32_t i){
+      a[i] = a[i] * 0.5f + 1.0f;
+    });
+  }
+
+  double sum(const float* a, uint32_t n) override{
+    return parallel_reduce(0, n, 0.0, [=](uint32_t i){
+      return double(a[i]);
+    }, [](double x, double y){
+      return x + y;
+    });
+  }
+
+  uint64_t fib(int n) override{
+    return aresFib(n);
+  }
+
+  void stencil(const double* in, double* out, uint32_t n) override{
+    parallel_for(1, n - 1, [=](uint32_t i){
+      for(uint32_t j = 1; j < n - 1; ++j){
+        out[i * n + j] = stencilPoint(in, n, i, j);
+      }
+    });
+  }
+};
+
+} // end namespace
+
+Runtime* createAresRuntime(){
+  return new AresRuntime;
+}
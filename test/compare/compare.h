@@ -0,0 +1,54 @@
+#ifndef __ARES_COMPARE_H__
+#define __ARES_COMPARE_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// the kernels that ares_compare times on each runtime. Each runtime
+// runs them its own way, the harness times and checks them the same way
+// for all of them.
+class Runtime{
+public:
+  virtual ~Runtime(){}
+
+  // starts the runtime with threads workers, before anything is timed
+  virtual void start(size_t threads) = 0;
+
+  // a[i] = a[i] * 0.5f + 1.0f for each i in [0, n)
+  virtual void scale(float* a, uint32_t n) = 0;
+
+  // the sum of a[0, n), accumulated in double
+  virtual double sum(const float* a, uint32_t n) = 0;
+
+  // whether the runtime has the tasks that fib() needs
+  virtual bool hasFib() const{
+    return true;
+  }
+
+  // fib(n), every call but that of fib(n) itself a task in the runtimes
+  // other than the serial one
+  virtual uint64_t fib(int n) = 0;
+
+  // one Jacobi step of the n x n grid in into out, each interior point
+  // the average of its four neighbours, the boundary left as it is
+  virtual void stencil(const double* in, double* out, uint32_t n) = 0;
+};
+
+// one point of stencil(), which all of the runtimes compute the same way
+inline double stencilPoint(const double* in, uint32_t n, uint32_t i,
+                           uint32_t j){
+  return 0.25 * (in[(i - 1) * n + j] + in[(i + 1) * n + j] +
+                 in[i * n + j - 1] + in[i * n + j + 1]);
+}
+
+Runtime* createSerialRuntime();
+
+Runtime* createAresRuntime();
+
+Runtime* createThpoolRuntime();
+
+#ifdef ARES_HAVE_KOKKOS
+Runtime* createKokkosRuntime();
+#endif
+
+#endif // __ARES_COMPARE_H__
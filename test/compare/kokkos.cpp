@@ -0,0 +1,64 @@
+#include <Kokkos_Core.hpp>
+
+#include "compare.h"
+
+namespace{
+
+using Space = Kokkos::DefaultHostExecutionSpace;
+using Policy = Kokkos::RangePolicy<Space>;
+
+// the host execution space Kokkos was built with, OpenMP or Threads
+class KokkosRuntime : public Runtime{
+public:
+  ~KokkosRuntime(){
+    if(Space::is_initialized()){
+      Kokkos::finalize();
+    }
+  }
+
+  void start(size_t threads) override{
+    Kokkos::InitArguments args;
+    args.num_threads = int(threads);
+    Kokkos::initialize(args);
+  }
+
+  void scale(float* a, uint32_t n) override{
+    Kokkos::parallel_for(Policy(0, n), [=](int i){
+      a[i] = a[i] * 0.5f + 1.0f;
+    });
+  }
+
+  double sum(const float* a, uint32_t n) override{
+    double s = 0.0;
+
+    Kokkos::parallel_reduce(Policy(0, n), [=](int i, double& partial){
+      partial += a[i];
+    }, s);
+
+    return s;
+  }
+
+  // the task policy of this Kokkos is experimental and not built for
+  // the host spaces by default
+  bool hasFib() const override{
+    return false;
+  }
+
+  uint64_t fib(int n) override{
+    return 0;
+  }
+
+  void stencil(const double* in, double* out, uint32_t n) override{
+    Kokkos::parallel_for(Policy(1, n - 1), [=](int i){
+      for(uint32_t j = 1; j < n - 1; ++j){
+        out[i * n + j] = stencilPoint(in, n, uint32_t(i), j);
+      }
+    });
+  }
+};
+
+} // end namespace
+
+Runtime* createKokkosRuntime(){
+  return new KokkosRuntime;
+}
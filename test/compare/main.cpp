@@ -0,0 +1,362 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "compare.h"
+
+using namespace std;
+
+using Clock = chrono::steady_clock;
+
+struct Options{
+  vector<size_t> threads;
+  vector<string> runtimes;
+  vector<string> only;
+  size_t reps = 5;
+  bool quick = false;
+
+  bool selected(const string& name) const{
+    return only.empty() || find(only.begin(), only.end(), name) != only.end();
+  }
+};
+
+struct RuntimeEntry{
+  const char* name;
+  Runtime* (*create)();
+};
+
+const RuntimeEntry runtimes[] = {
+  {"serial", createSerialRuntime},
+  {"ares", createAresRuntime},
+  {"thpool", createThpoolRuntime},
+#ifdef ARES_HAVE_KOKKOS
+  {"kokkos", createKokkosRuntime},
+#endif
+};
+
+double since(Clock::time_point start){
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// the same lines as ares_bench, with the runtime as another member
+void report(const string& bench, const string& params, const string& unit,
+            vector<double> samples){
+  sort(samples.begin(), samples.end());
+
+  cout << "{\"bench\": \"" << bench << "\", " << params <<
+    ", \"unit\": \"" << unit << "\", \"median\": " <<
+    samples[samples.size()/2] << ", \"min\": " << samples.front() <<
+    ", \"max\": " << samples.back() << ", \"reps\": " << samples.size() <<
+    "}" << endl;
+}
+
+// the seconds one of iters calls of f took on average, for each rep,
+// after a call that is not timed
+vector<double> sample(const Options& o, size_t iters,
+                      const function<void()>& f){
+  f();
+
+  vector<double> samples;
+
+  for(size_t r = 0; r < o.reps; ++r){
+    auto start = Clock::now();
+
+    for(size_t k = 0; k < iters; ++k){
+      f();
+    }
+
+    samples.push_back(since(start)/iters);
+  }
+
+  return samples;
+}
+
+vector<double> scaled(vector<double> samples, double factor){
+  for(double& s : samples){
+    s *= factor;
+  }
+  return samples;
+}
+
+void fail(const string& runtime, const string& bench){
+  cerr << "ares_compare: " << runtime << " computed a wrong " << bench <<
+    endl;
+  exit(1);
+}
+
+void benchForall(const Options& o, Runtime& rt, const string& params,
+                 const string& name){
+  for(uint32_t n : {1 << 10, 1 << 16, 1 << 22}){
+    if(o.quick && n > 1 << 18){
+      continue;
+    }
+
+    vector<float> a(n, 1.0f);
+    size_t iters = max(size_t(1), size_t(1 << 24)/n);
+
+    auto samples = sample(o, iters, [&]{
+      rt.scale(a.data(), n);
+    });
+
+    // every element went through as many steps towards 2
+    if(count(a.begin(), a.end(), a[0]) != n || !(a[0] > 1.0f)){
+      fail(name, "forall");
+    }
+
+    report("forall", params + ", \"n\": " + to_string(n), "us",
+           scaled(samples, 1e6));
+  }
+}
+
+void benchReduce(const Options& o, Runtime& rt, const string& params,
+                 const string& name){
+  for(uint32_t n : {1 << 10, 1 << 16, 1 << 20}){
+    if(o.quick && n > 1 << 18){
+      continue;
+    }
+
+    vector<float> a(n, 1.0f);
+    size_t iters = max(size_t(1), size_t(1 << 24)/n);
+
+    double sum = 0.0;
+    auto samples = sample(o, iters, [&]{
+      sum = rt.sum(a.data(), n);
+    });
+
+    if(sum != n){
+      fail(name, "reduce");
+    }
+
+    report("reduce", params + ", \"n\": " + to_string(n), "us",
+           scaled(samples, 1e6));
+  }
+}
+
+// fib(n) makes 2 fib(n + 1) - 1 calls
+void benchFib(const Options& o, Runtime& rt, const string& params,
+              const string& name){
+  if(!rt.hasFib()){
+    return;
+  }
+
+  int n = o.quick ? 20 : 27;
+
+  uint64_t f0 = 0;
+  uint64_t f1 = 1;
+  for(int i = 0; i < n; ++i){
+    uint64_t f2 = f0 + f1;
+    f0 = f1;
+    f1 = f2;
+  }
+
+  uint64_t expected = f0;
+  uint64_t calls = 2*f1 - 1;
+
+  uint64_t result = 0;
+  auto samples = sample(o, 1, [&]{
+    result = rt.fib(n);
+  });
+
+  if(result != expected){
+    fail(name, "fib");
+  }
+
+  for(double& s : samples){
+    s = calls/s;
+  }
+
+  report("fib", params + ", \"n\": " + to_string(n), "calls/s", samples);
+}
+
+// steps of a grid that is hot along one edge and cold elsewhere, the
+// first of which is also taken serially to check the runtime's
+void benchStencil(const Options& o, Runtime& rt, const string& params,
+                  const string& name){
+  for(uint32_t n : {256, 1024, 2048}){
+    if(o.quick && n > 1024){
+      continue;
+    }
+
+    vector<double> a(n * n, 0.0);
+    fill(a.begin(), a.begin() + n, 100.0);
+    vector<double> b = a;
+
+    vector<double> expected = a;
+    unique_ptr<Runtime> serial(createSerialRuntime());
+    serial->stencil(a.data(), expected.data(), n);
+
+    rt.stencil(a.data(), b.data(), n);
+    if(b != expected){
+      fail(name, "stencil");
+    }
+
+    size_t iters = max(size_t(1), size_t(1 << 24)/(n * n));
+
+    auto samples = sample(o, iters, [&]{
+      rt.stencil(a.data(), b.data(), n);
+      a.swap(b);
+    });
+
+    report("stencil", params + ", \"n\": " + to_string(n), "us",
+           scaled(samples, 1e6));
+  }
+}
+
+// the kernels on one runtime at one number of threads
+void runRuntime(const Options& o, const RuntimeEntry& entry,
+                size_t threads){
+  unique_ptr<Runtime> rt(entry.create());
+  rt->start(threads);
+
+  string params = "\"runtime\": \"" + string(entry.name) +
+    "\", \"threads\": " + to_string(threads);
+
+  if(o.selected("forall")){
+    benchForall(o, *rt, params, entry.name);
+  }
+
+  if(o.selected("reduce")){
+    benchReduce(o, *rt, params, entry.name);
+  }
+
+  if(o.selected("fib")){
+    benchFib(o, *rt, params, entry.name);
+  }
+
+  if(o.selected("stencil")){
+    benchStencil(o, *rt, params, entry.name);
+  }
+}
+
+// each runtime is run in a process of its own, so that the workers of
+// one do not compete with those of the next
+pid_t spawn(const function<void()>& f){
+  cout.flush();
+
+  pid_t pid = fork();
+  if(pid == 0){
+    f();
+    cout.flush();
+    _exit(0);
+  }
+
+  return pid;
+}
+
+bool join(pid_t pid){
+  int status;
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+    WEXITSTATUS(status) == 0;
+}
+
+vector<string> split(const string& str){
+  vector<string> v;
+  istringstream istr(str);
+
+  string s;
+  while(getline(istr, s, ',')){
+    v.push_back(s);
+  }
+
+  return v;
+}
+
+void usage(){
+  cerr << "usage: ares_compare [--runtimes name,...] [--threads n,...] " <<
+    "[--only name,...] [--reps n] [--quick]" << endl << "runtimes:";
+
+  for(const RuntimeEntry& entry : runtimes){
+    cerr << " " << entry.name;
+  }
+
+  cerr << endl << "benchmarks: forall reduce fib stencil" << endl;
+}
+
+int main(int argc, char** argv){
+  Options o;
+
+  for(int i = 1; i < argc; ++i){
+    string arg = argv[i];
+    bool more = i + 1 < argc;
+
+    if(arg == "--runtimes" && more){
+      o.runtimes = split(argv[++i]);
+    }
+    else if(arg == "--threads" && more){
+      for(const string& s : split(argv[++i])){
+        o.threads.push_back(max(1, atoi(s.c_str())));
+      }
+    }
+    else if(arg == "--only" && more){
+      o.only = split(argv[++i]);
+    }
+    else if(arg == "--reps" && more){
+      o.reps = max(1, atoi(argv[++i]));
+    }
+    else if(arg == "--quick"){
+      o.quick = true;
+    }
+    else{
+      usage();
+      return 1;
+    }
+  }
+
+  for(const string& name : o.runtimes){
+    auto itr = find_if(begin(runtimes), end(runtimes),
+                       [&](const RuntimeEntry& e){ return name == e.name; });
+    if(itr == end(runtimes)){
+      usage();
+      return 1;
+    }
+  }
+
+  // by default powers of two up to the number of CPUs, and that number
+  if(o.threads.empty()){
+    size_t numCpus = max(1u, thread::hardware_concurrency());
+
+    for(size_t t = 1; t < numCpus; t *= 2){
+      o.threads.push_back(t);
+    }
+    o.threads.push_back(numCpus);
+  }
+
+  bool ok = true;
+
+  for(const RuntimeEntry& entry : runtimes){
+    if(!o.runtimes.empty() &&
+       find(o.runtimes.begin(), o.runtimes.end(), entry.name) ==
+       o.runtimes.end()){
+      continue;
+    }
+
+    // the serial baseline runs once
+    bool serial = string(entry.name) == "serial";
+
+    for(size_t threads : o.threads){
+      ok = join(spawn([&]{
+        runRuntime(o, entry, serial ? 1 : threads);
+      })) && ok;
+
+      if(serial){
+        break;
+      }
+    }
+  }
+
+  if(!ok){
+    cerr << "ares_compare: a benchmark failed" << endl;
+  }
+
+  return ok ? 0 : 1;
+}
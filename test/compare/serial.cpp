@@ -0,0 +1,48 @@
+#include "compare.h"
+
+namespace{
+
+uint64_t serialFib(int n){
+  if(n < 2){
+    return n;
+  }
+  return serialFib(n - 1) + serialFib(n - 2);
+}
+
+// the baseline the speedups of the others are taken against
+class SerialRuntime : public Runtime{
+public:
+  void start(size_t threads) override{}
+
+  void scale(float* a, uint32_t n) override{
+    for(uint32_t i = 0; i < n; ++i){
+      a[i] = a[i] * 0.5f + 1.0f;
+    }
+  }
+
+  double sum(const float* a, uint32_t n) override{
+    double s = 0.0;
+    for(uint32_t i = 0; i < n; ++i){
+      s += a[i];
+    }
+    return s;
+  }
+
+  uint64_t fib(int n) override{
+    return serialFib(n);
+  }
+
+  void stencil(const double* in, double* out, uint32_t n) override{
+    for(uint32_t i = 1; i < n - 1; ++i){
+      for(uint32_t j = 1; j < n - 1; ++j){
+        out[i * n + j] = stencilPoint(in, n, i, j);
+      }
+    }
+  }
+};
+
+} // end namespace
+
+Runtime* createSerialRuntime(){
+  return new SerialRuntime;
+}
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// the vendored c-thread-pool, which the runtime library has built in,
+// its header is plain C
+extern "C"{
+#include <thpool.h>
+}
+
+#include "compare.h"
+
+using namespace std;
+
+namespace{
+
+// a range is split into this many jobs per thread, as many as the
+// blocks of a parallel_reduce() of the runtime
+const uint32_t JOBS_PER_THREAD = 4;
+
+class ThpoolRuntime;
+
+// the range of a job and the body that runs it
+struct Job{
+  uint32_t begin;
+  uint32_t end;
+  void (*body)(ThpoolRuntime* r, uint32_t begin, uint32_t end, size_t job);
+  ThpoolRuntime* runtime;
+  size_t index;
+};
+
+void* runJob(void* arg){
+  auto j = static_cast<Job*>(arg);
+  j->body(j->runtime, j->begin, j->end, j->index);
+  return nullptr;
+}
+
+atomic<uint64_t> fibSum;
+threadpool fibPool;
+
+// thpool_wait() cannot be called from a job, so rather than waiting
+// for its two calls, a call queues both and the leaves add up the result
+void* fibJob(void* arg){
+  int n = int(reinterpret_cast<intptr_t>(arg));
+
+  if(n < 2){
+    fibSum.fetch_add(n, memory_order_relaxed);
+    return nullptr;
+  }
+
+  thpool_add_work(fibPool, fibJob, reinterpret_cast<void*>(intptr_t(n - 1)));
+  thpool_add_work(fibPool, fibJob, reinterpret_cast<void*>(intptr_t(n - 2)));
+
+  return nullptr;
+}
+
+class ThpoolRuntime : public Runtime{
+public:
+  ~ThpoolRuntime(){
+    if(pool_){
+      thpool_destroy(pool_);
+    }
+  }
+
+  void start(size_t threads) override{
+    pool_ = thpool_init(int(threads));
+    jobs_.resize(threads * JOBS_PER_THREAD);
+    partials_.resize(jobs_.size());
+  }
+
+  void scale(float* a, uint32_t n) override{
+    scaleArray_ = a;
+
+    run(0, n, [](ThpoolRuntime* r, uint32_t begin, uint32_t end, size_t){
+      float* a = r->scaleArray_;
+      for(uint32_t i = begin; i < end; ++i){
+        a[i] = a[i] * 0.5f + 1.0f;
+      }
+    });
+  }
+
+  double sum(const float* a, uint32_t n) override{
+    sumArray_ = a;
+
+    size_t used = run(0, n, [](ThpoolRuntime* r, uint32_t begin,
+                               uint32_t end, size_t job){
+      const float* a = r->sumArray_;
+      double s = 0.0;
+      for(uint32_t i = begin; i < end; ++i){
+        s += a[i];
+      }
+      r->partials_[job] = s;
+    });
+
+    double s = 0.0;
+    for(size_t k = 0; k < used; ++k){
+      s += partials_[k];
+    }
+    return s;
+  }
+
+  uint64_t fib(int n) override{
+    if(n < 2){
+      return n;
+    }
+
+    fibSum = 0;
+    fibPool = pool_;
+    fibJob(reinterpret_cast<void*>(intptr_t(n)));
+    thpool_wait(pool_);
+
+    return fibSum;
+  }
+
+  void stencil(const double* in, double* out, uint32_t n) override{
+    stencilIn_ = in;
+    stencilOut_ = out;
+    stencilN_ = n;
+
+    run(1, n - 1, [](ThpoolRuntime* r, uint32_t begin, uint32_t end, size_t){
+      uint32_t n = r->stencilN_;
+      for(uint32_t i = begin; i < end; ++i){
+        for(uint32_t j = 1; j < n - 1; ++j){
+          r->stencilOut_[i * n + j] = stencilPoint(r->stencilIn_, n, i, j);
+        }
+      }
+    });
+  }
+
+private:
+  // queues [start, end) as up to jobs_.size() jobs of body, waits for
+  // them and returns how many there were. A job reads the operands of
+  // its kernel from the members below.
+  size_t run(uint32_t start, uint32_t end,
+             void (*body)(ThpoolRuntime*, uint32_t, uint32_t, size_t)){
+    uint32_t n = end - start;
+    uint32_t size =
+      max(uint32_t(1), uint32_t((n + jobs_.size() - 1)/jobs_.size()));
+    size_t used = 0;
+
+    for(uint32_t begin = start; begin < end; begin += size, ++used){
+      jobs_[used] = {begin, min(end, begin + size), body, this, used};
+      thpool_add_work(pool_, runJob, &jobs_[used]);
+    }
+
+    thpool_wait(pool_);
+
+    return used;
+  }
+
+  threadpool pool_ = nullptr;
+  vector<Job> jobs_;
+  vector<double> partials_;
+
+  float* scaleArray_ = nullptr;
+  const float* sumArray_ = nullptr;
+  const double* stencilIn_ = nullptr;
+  double* stencilOut_ = nullptr;
+  uint32_t stencilN_ = 0;
+};
+
+} // end namespace
+
+Runtime* createThpoolRuntime(){
+  return new ThpoolRuntime;
+}
@@ -0,0 +1,56 @@
+#include <iostream>
+
+#include <ares/concurrent_map.h>
+#include <ares/parallel.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 200000;
+const uint32_t KEYS = 5000;
+const uint32_t BLOCKS = 64;
+
+int main(int argc, char** argv){
+  // the unique keys, inserted directly
+  concurrent_map<uint32_t, uint32_t> unique(1 << 10);
+
+  parallel_for(0, SIZE, [&](uint32_t i){
+    unique.insert(i % KEYS, i % KEYS);
+  });
+
+  bool ok = unique.size() == KEYS;
+  for(uint32_t k = 0; k < KEYS; ++k){
+    uint32_t* v = unique.find(k);
+    ok = ok && v && *v == k;
+  }
+  ok = ok && !unique.find(KEYS);
+
+  // a sparse accumulation, through a buffer per block
+  concurrent_map<uint64_t, uint64_t> counts(1 << 8);
+
+  parallel_for(0, BLOCKS, [&](uint32_t b){
+    concurrent_map<uint64_t, uint64_t>::buffer buf(512);
+
+    for(uint32_t i = b; i < SIZE; i += BLOCKS){
+      buf.insert(uint64_t(i % KEYS) << 32, 1);
+
+      if(buf.full()){
+        counts.merge(buf, [](uint64_t& v, uint64_t x){ v += x; });
+      }
+    }
+
+    counts.merge(buf, [](uint64_t& v, uint64_t x){ v += x; });
+  });
+
+  uint64_t total = 0;
+  counts.for_each([&](uint64_t k, uint64_t v){
+    ok = ok && v == SIZE/KEYS;
+    total += v;
+  });
+
+  ok = ok && counts.size() == KEYS && total == SIZE;
+
+  cout << "keys = " << counts.size() << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#include <iostream>
+#include <cstdint>
+#include <string>
+
+#include <unistd.h>
+
+#include <ares/field.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t WIDTH = 1000;
+const uint32_t HEIGHT = 600;
+
+int main(int argc, char** argv){
+  Field<double, 2> a({HEIGHT, WIDTH}, 1.0);
+  Field<double, 2> b({HEIGHT, WIDTH});
+  Field<float> small(100, 2.0f, schedule::static_(), FieldAlign::CacheLine);
+
+  bool aligned =
+    reinterpret_cast<uintptr_t>(a.data()) % Field<double, 2>::HUGE_PAGE == 0 &&
+    reinterpret_cast<uintptr_t>(small.data()) % 64 == 0 &&
+    small.alignment() == 64;
+
+  // a time step over the same static schedule that first touched them
+  for(int step = 0; step < 4; ++step){
+    const double* src = a.data();
+    double* dst = b.data();
+
+    parallel_for(0, HEIGHT * WIDTH, [&](uint32_t i){
+      dst[i] = src[i] * 2.0;
+    }, schedule::static_());
+
+    a.swap(b);
+  }
+
+  double sum = parallel_reduce(0, HEIGHT * WIDTH, 0.0, [&](uint32_t i){
+    return a[i];
+  });
+
+  bool indexed = a(HEIGHT - 1, WIDTH - 1) == 16.0 &&
+    &a(1, 2) == &a[WIDTH + 2] && a.extent(0) == HEIGHT &&
+    a.extent(1) == WIDTH && small[99] == 2.0f;
+
+  // written through one mapping of a file and read back through another,
+  // as a restart would
+  string path = "/tmp/ares_field." + to_string(getpid());
+  bool restarted;
+
+  {
+    Field<double, 2> m(path, {HEIGHT, WIDTH});
+    parallel_for(0, HEIGHT * WIDTH, [&](uint32_t i){
+      m[i] = a[i] + i;
+    }, schedule::static_());
+    m.flush_async();
+  }
+
+  {
+    Field<double, 2> m(path, {HEIGHT, WIDTH});
+    restarted = m.mapped() && m.flush() &&
+      m(HEIGHT - 1, WIDTH - 1) == 16.0 + HEIGHT * WIDTH - 1;
+    m.evict();
+    restarted = restarted && m[3] == 19.0;
+  }
+
+  unlink(path.c_str());
+
+  // a snapshot taken before a step and restored after it
+  Snapshot snap = a.snapshot(path, true);
+
+  parallel_for(0, HEIGHT * WIDTH, [&](uint32_t i){
+    a[i] = 0.0;
+  }, schedule::static_());
+
+  bool snapshotted = snap.wait() && a.restore(path) && a[5] == 16.0;
+
+  unlink(path.c_str());
+
+  // steps of a 1-D average that swap rather than copy back
+  double_buffer<float> db(8, 1.0f);
+  db.current()[0] = 9.0f;
+  const float* first = db.current().data();
+
+  for(int step = 0; step < 3; ++step){
+    db.step([](const Field<float>& h, Field<float>& hNext){
+      parallel_for(0, uint32_t(h.size()), [&](uint32_t i){
+        hNext[i] = i == 0 ? h[i] : 0.5f * (h[i - 1] + h[i]);
+      });
+    });
+  }
+
+  bool swapped = db.current().data() != first && db.next().data() == first &&
+    db.current()[3] == 2.0f && db.current()[4] == 1.0f;
+
+  cout << "sum = " << sum << ", aligned = " << aligned <<
+    ", indexed = " << indexed << ", restarted = " << restarted <<
+    ", snapshotted = " << snapshotted << ", swapped = " << swapped << endl;
+
+  return sum == 16.0 * HEIGHT * WIDTH && aligned && indexed && restarted &&
+    snapshotted && swapped ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+#include <iostream>
+#include <vector>
+
+#include <ares/frontend.h>
+
+using namespace std;
+using namespace ares;
+
+struct Particle{
+  float x;
+  float v;
+};
+
+int main(int argc, char** argv){
+  vector<Particle> particles(1000);
+
+  for(auto i : Forall(0, particles.size())){
+    particles[i].x = i;
+    particles[i].v = 0.5f;
+  }
+
+  for(auto& p : Each(particles)){
+    p.x += p.v;
+  }
+
+  // a sub-range by its iterators
+  vector<float> x(particles.size());
+
+  for(auto i : Forall(0, x.size())){
+    x[i] = particles[i].x;
+  }
+
+  for(auto& xi : Each(x.begin() + 500, x.end())){
+    xi = -xi;
+  }
+
+  float sum = 0.0f;
+  for(float xi : x){
+    sum += xi;
+  }
+
+  // indices past 2^32
+  vector<uint64_t> offsets(4);
+  uint64_t* o = offsets.data();
+
+  for(auto i : Forall64(uint64_t(1) << 32, (uint64_t(1) << 32) + 4)){
+    o[i - (uint64_t(1) << 32)] = i;
+  }
+
+  cout << "x[0] = " << x[0] << " x[999] = " << x[999] << " sum = " << sum <<
+    endl;
+
+  for(uint64_t oi : offsets){
+    cout << oi << endl;
+  }
+
+  return 0;
+}
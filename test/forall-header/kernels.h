@@ -0,0 +1,39 @@
+#ifndef __ARES_TEST_KERNELS_H__
+#define __ARES_TEST_KERNELS_H__
+
+#include <ares/frontend.h>
+
+// the kernels are included by main.cpp and scale.cpp, so each is
+// lowered in both
+
+namespace kernels{
+
+  using Range = ares::Forall;
+
+  inline void axpy(float a, const float* x, float* y, size_t n){
+    for(auto i : ares::Forall(0, n)){
+      y[i] += a*x[i];
+    }
+  }
+
+  template<typename T>
+  T sum(const T* x, size_t n){
+    T s = 0;
+
+    for(auto i : ares::ReduceAll(0, n, s)){
+      s += x[i];
+    }
+
+    return s;
+  }
+
+  template<typename T>
+  void fill(T* x, size_t n, T v){
+    for(auto i : Range(0, n)){
+      x[i] = v;
+    }
+  }
+
+} // end namespace kernels
+
+#endif // __ARES_TEST_KERNELS_H__
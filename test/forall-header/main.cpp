@@ -0,0 +1,25 @@
+#include <iostream>
+
+#include "kernels.h"
+
+using namespace std;
+
+const size_t SIZE = 1000;
+
+void scale(float* x, size_t n);
+
+int main(int argc, char** argv){
+  float x[SIZE];
+  float y[SIZE];
+
+  scale(x, SIZE);
+
+  kernels::fill(y, SIZE, 1.0f);
+  kernels::axpy(0.5f, x, y, SIZE);
+
+  // x is all 3 and y all 2.5
+  cout << "sum x = " << kernels::sum(x, SIZE) << endl;
+  cout << "sum y = " << kernels::sum(y, SIZE) << endl;
+
+  return 0;
+}
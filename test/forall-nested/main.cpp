@@ -10,6 +10,7 @@ const size_t SIZE = 10;
 int main(int argc, char** argv){
   float A[SIZE];
   float B[SIZE][SIZE];
+  float C[SIZE][SIZE];
 
   for(auto i : Forall(0, SIZE)){
     A[i] = i;
@@ -19,11 +20,19 @@ int main(int argc, char** argv){
     }
   }
 
+  // perfectly nested, collapsed into a single loop over SIZE * SIZE
+  for(auto i : Forall(0, SIZE)){
+    for(auto j : Forall(0, SIZE)){
+      C[i][j] = B[i][j] * 2;
+    }
+  }
+
   for(size_t i = 0; i < SIZE; ++i){
     cout << "A[" << i << "] = " << A[i] << endl;
     
     for(size_t j = 0; j < SIZE; ++j){
-      cout << "B[" << i << "][" << j << "] = " << B[i][j] << endl;
+      cout << "B[" << i << "][" << j << "] = " << B[i][j] << 
+        " C[" << i << "][" << j << "] = " << C[i][j] << endl;
     }
   }
 
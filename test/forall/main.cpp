@@ -21,8 +21,89 @@ int main(int argc, char** argv){
     A[i] += B[i];
   }
 
+  // the second loop is queued behind the first without blocking
+  float C[SIZE];
+
+  Completion init;
+  Completion update;
+
+  for(auto i : Forall(0, SIZE, init)){
+    C[i] = 2*i;
+  }
+
+  for(auto i : Forall(0, SIZE, update, init, Priority::High)){
+    C[i] += 1;
+  }
+
+  update.wait();
+
+  // a single process runs all of a distributed range
+  float D[SIZE];
+
+  for(auto i : Forall(0, SIZE, Distribute(Partition::Cyclic))){
+    D[i] = A[i] + 1;
+  }
+
+  // the odd indices only, then each block as a sub-range
+  float E[SIZE];
+
+  for(auto i : Forall(0, SIZE, 2)){
+    E[i] = 0;
+  }
+
+  for(auto i : Forall(1, SIZE, 2)){
+    E[i] = 1;
+  }
+
+  for(auto r : Forall::blocked(SIZE, 16)){
+    for(uint32_t i = r.begin; i < r.end; ++i){
+      E[i] += r.begin;
+    }
+  }
+
+  // per-loop schedules
+  for(auto i : Forall(0, SIZE, schedule::static_())){
+    E[i] *= 2;
+  }
+
+  for(auto i : Forall(0, SIZE, schedule::dynamic(8), Priority::High)){
+    E[i] += 1;
+  }
+
+  for(auto i : Forall(0, SIZE, schedule::guided())){
+    E[i] -= 1;
+  }
+
+  for(auto i : Forall(0, SIZE, schedule::auto_())){
+    E[i] /= 2;
+  }
+
+  // a scratch block for each iteration, and a count for each worker
+  float F[SIZE];
+  WorkerLocal<uint32_t> counts(0);
+
+  for(auto i : Forall(0, SIZE)){
+    float* t = static_cast<float*>(scratch(4 * sizeof(float)));
+
+    for(size_t k = 0; k < 4; ++k){
+      t[k] = A[i] * k;
+    }
+
+    F[i] = t[0] + t[1] + t[2] + t[3];
+    ++counts.local();
+  }
+
+  uint32_t total = 0;
+  for(size_t w = 0; w < counts.size(); ++w){
+    total += counts[w];
+  }
+
+  cout << "iterations counted: " << total << endl;
+
   for(size_t i = 0; i < SIZE; ++i){
-    cout << "A[" << i << "] = " << A[i] << endl;
+    cout << "A[" << i << "] = " << A[i] << " C[" << i << "] = " << C[i] <<
+      " D[" << i << "] = " << D[i] << " E[" << i << "] = " << E[i] <<
+      " F[" << i << "] = " << F[i] << endl;
   }
 
   return 0;
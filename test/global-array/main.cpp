@@ -0,0 +1,48 @@
+#include <iostream>
+#include <vector>
+
+#include <ares/global_array.h>
+#include <ares/parallel.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 10000;
+
+int main(int argc, char** argv){
+  // a single rank owns all of the array
+  ares_listen(9878);
+  ares_init_comm(1);
+
+  GlobalArray<double> a(SIZE);
+
+  parallel_for(a.localStart(), a.localEnd(), [&](uint32_t i){
+    a.local(i) = 2.0 * i;
+  });
+
+  vector<double> range(100);
+  a.get(50, 100, range.data());
+
+  bool ok = a.owner(SIZE - 1) == ares_rank() && range[0] == 100.0 &&
+    range[99] == 298.0;
+
+  // irregular accesses, batched per owner
+  vector<uint32_t> indices = {9999, 3, 3, 512};
+  vector<double> ones(indices.size(), 1.0);
+  a.accumulate(indices, ones.data());
+
+  vector<double> values(indices.size());
+  a.get(indices, values.data());
+
+  ok = ok && values[0] == 19999.0 && values[1] == 8.0 && values[2] == 8.0 &&
+    values[3] == 1025.0;
+
+  vector<double> minus(2, -1.0);
+  a.put({0, 1}, minus.data());
+  a.accumulate(0, 2, ones.data(), CommOp::Max);
+  ok = ok && a.local(0) == 1.0 && a.local(1) == 1.0;
+
+  cout << "value = " << values[3] << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
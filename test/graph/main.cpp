@@ -0,0 +1,112 @@
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include <ares/graph.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 10000;
+const uint32_t STEPS = 200;
+
+// a step of a 1-D diffusion and the change it made, serially
+double serial(vector<double>& h, vector<double>& hNext){
+  double change = 0.0;
+
+  for(uint32_t s = 0; s < STEPS; ++s){
+    change = 0.0;
+
+    for(uint32_t i = 1; i < SIZE - 1; ++i){
+      hNext[i] = 0.25 * h[i - 1] + 0.5 * h[i] + 0.25 * h[i + 1];
+      change += fabs(hNext[i] - h[i]);
+    }
+
+    h.swap(hNext);
+  }
+
+  return change;
+}
+
+int main(int argc, char** argv){
+  vector<double> h(SIZE, 0.0);
+  vector<double> hNext(SIZE, 0.0);
+  h[SIZE/2] = 1000.0;
+  h[0] = hNext[0] = 1.0;
+
+  vector<double> sh = h;
+  vector<double> shNext = hNext;
+  double expected = serial(sh, shNext);
+
+  TaskGraph step;
+  double change = 0.0;
+
+  {
+    graph_capture capture(step);
+
+    capture.forall(1, SIZE - 1, [&](uint32_t i){
+      hNext[i] = 0.25 * h[i - 1] + 0.5 * h[i] + 0.25 * h[i + 1];
+    });
+
+    capture.reduce(1, SIZE - 1, change, 0.0, [&](uint32_t i, double& c){
+      c += fabs(hNext[i] - h[i]);
+    }, [](double& a, double b){
+      a += b;
+    });
+
+    capture.task([&]{
+      h.swap(hNext);
+    });
+  }
+
+  // the graph runs nothing until it is launched
+  bool captured = step.size() == 3 && h[1] == 0.0;
+
+  for(uint32_t s = 0; s < STEPS; ++s){
+    step.launch();
+  }
+
+  bool replayed = h == sh && fabs(change - expected) <= 1e-9 * expected;
+
+  // two independent fills, each of its own array, joined by a sum
+  vector<uint32_t> a(SIZE);
+  vector<uint32_t> b(SIZE);
+  uint64_t total = 0;
+
+  TaskGraph dag;
+
+  {
+    graph_capture capture(dag);
+
+    uint32_t fillA = capture.forall(0, SIZE, [&](uint32_t i){
+      a[i] = i;
+    }, 64);
+
+    capture.after({});
+    uint32_t fillB = capture.forall(0, SIZE, [&](uint32_t i){
+      b[i] = 2 * i;
+    });
+
+    capture.after({fillA, fillB});
+    capture.reduce(0, SIZE, total, uint64_t(0), [&](uint32_t i, uint64_t& t){
+      t += a[i] + b[i];
+    }, [](uint64_t& x, uint64_t y){
+      x += y;
+    });
+  }
+
+  bool joined = true;
+
+  for(int r = 0; r < 10; ++r){
+    total = 1;
+    dag.launch();
+    joined = joined && total == 3 * (uint64_t(SIZE) * (SIZE - 1)/2);
+  }
+
+  bool ok = captured && replayed && joined;
+
+  cout << "change = " << change << ", captured = " << captured <<
+    ", joined = " << joined << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#include <iostream>
+
+#include <ares/frontend.h>
+#include <ares/halo.h>
+
+using namespace std;
+using namespace ares;
+
+const int WIDTH = 16;
+const int HEIGHT = 8;
+
+int main(int argc, char** argv){
+  // a single rank of a periodic grid is its own neighbor on every side
+  ares_listen(9876);
+  ares_init_comm(1);
+
+  GridDecomposition grid(WIDTH, HEIGHT, 1, 1, ares_rank());
+  HaloField<float> h(grid);
+
+  for(int y = 0; y < h.height(); ++y){
+    for(int x = 0; x < h.width(); ++x){
+      h(x, y) = y * WIDTH + x;
+    }
+  }
+
+  h.startExchange();
+
+  // the interior does not read the ghosts, so it is averaged meanwhile
+  Box in = h.interior();
+  float sum = 0.0f;
+
+  for(int y = in.y0; y < in.y1; ++y){
+    for(int x = in.x0; x < in.x1; ++x){
+      sum += h(x - 1, y) + h(x + 1, y);
+    }
+  }
+
+  h.finishExchange();
+
+  cout << "interior sum = " << sum << endl;
+
+  for(int y = -1; y <= h.height(); ++y){
+    cout << h(-1, y) << " " << h(h.width(), y) << endl;
+  }
+
+  return 0;
+}
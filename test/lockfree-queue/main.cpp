@@ -0,0 +1,113 @@
+#include <iostream>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <LockFreeQueue.h>
+
+using namespace std;
+using namespace ares;
+
+const size_t ITEMS = 1000000;
+
+// the injection queue before it was lock-free, for comparison
+class LockedQueue{
+public:
+  bool push(uint64_t value){
+    lock_guard<mutex> lock(mutex_);
+    queue_.push_back(value);
+    return true;
+  }
+
+  bool pop(uint64_t& value){
+    lock_guard<mutex> lock(mutex_);
+    if(queue_.empty()){
+      return false;
+    }
+    value = queue_.front();
+    queue_.pop_front();
+    return true;
+  }
+
+private:
+  mutex mutex_;
+  deque<uint64_t> queue_;
+};
+
+// each producer pushes its share of 1 to ITEMS, which the consumers add
+// up, every item is seen once if the sum comes out right
+template<class Q>
+double run(Q& q, size_t producers, size_t consumers, bool& ok){
+  atomic<uint64_t> sum(0);
+  atomic<size_t> popped(0);
+
+  auto start = chrono::steady_clock::now();
+
+  vector<thread> threads;
+  for(size_t p = 0; p < producers; ++p){
+    threads.emplace_back([&, p]{
+      for(uint64_t i = p + 1; i <= ITEMS; i += producers){
+        while(!q.push(i)){
+          this_thread::yield();
+        }
+      }
+    });
+  }
+
+  for(size_t c = 0; c < consumers; ++c){
+    threads.emplace_back([&]{
+      uint64_t local = 0;
+      size_t n = 0;
+      while(popped.load(memory_order_relaxed) < ITEMS){
+        uint64_t value;
+        if(q.pop(value)){
+          local += value;
+          ++n;
+          popped.fetch_add(1, memory_order_relaxed);
+        }
+        else{
+          this_thread::yield();
+        }
+      }
+      sum += local;
+    });
+  }
+
+  for(auto& t : threads){
+    t.join();
+  }
+
+  double seconds = 
+    chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  ok = ok && sum == uint64_t(ITEMS) * (ITEMS + 1) / 2;
+
+  return ITEMS / seconds / 1e6;
+}
+
+int main(int argc, char** argv){
+  bool ok = true;
+
+  for(size_t threads : {1, 2, 4, 8}){
+    LockFreeQueue<uint64_t> lockFree(4096);
+    LockedQueue locked;
+
+    double a = run(lockFree, threads, threads, ok);
+    double b = run(locked, threads, threads, ok);
+
+    cout << threads << " producers and consumers: lock-free " << a << 
+      " M items/s, locked " << b << " M items/s" << endl;
+  }
+
+  LockFreeQueue<uint64_t> small(2);
+  uint64_t v;
+  ok = ok && small.push(1) && small.push(2) && !small.push(3) &&
+    small.pop(v) && v == 1 && small.push(3) && small.pop(v) && v == 2 &&
+    small.pop(v) && v == 3 && !small.pop(v) && small.empty();
+
+  cout << (ok ? "ok" : "FAILED") << endl;
+
+  return ok ? 0 : 1;
+}
@@ -1,163 +1,338 @@
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <ares/frontend.h>
+#include <ares/stencil.h>
 
 using namespace std;
 using namespace ares;
 
+using Clock = chrono::steady_clock;
+
 const float MAX_TEMP = 100.0f;
-const size_t TIME_STEPS = 100;
-const int MESH_DIM = 128;
 
-int resolve(int d, int dim){
-  if(d < 0){
-    return dim - (-d % dim);
-  }
-  else if(d < dim){
-    return d;
-  }
-  else{
-    return d % dim;
+// the floating point operations of one call of update(), and the bytes
+// that a time step has to move at least for each cell: h and mask read,
+// h_next written
+const double FLOPS_PER_CELL = 18;
+const double BYTES_PER_CELL = 12;
+
+struct Options{
+  uint32_t dim = 128;
+  uint32_t steps = 100;
+  uint32_t tileX = 64;
+  uint32_t tileY = 8;
+  bool tiled = false;
+  uint32_t depth = 0;
+  vector<size_t> threads;
+  bool weak = false;
+  bool serial = true;
+};
+
+struct Coefficients{
+  Coefficients(uint32_t dim){
+    float dx = 10.0f / dim;
+    float dy = 10.0f / dim;
+    float alpha = 0.00001f;
+
+    dt = 0.5f * (dx * dx + dy * dy)/4.0f/alpha;
+    u = 0.001f;
+    halfInvDx = 0.5f / dx;
+    alphaInvDx2 = alpha / (dx * dx);
+    alphaInvDy2 = alpha / (dy * dy);
   }
-}
 
-struct Position{
-  int x;
-  int y;
+  float dt;
+  float u;
+  float halfInvDx;
+  float alphaInvDx2;
+  float alphaInvDy2;
 };
 
-class Mesh{
+// the next temperature of a cell from its own, those of its west, east,
+// south and north neighbours, and its mask
+inline float update(float tc, float tw, float te, float ts, float tn,
+                    float m, const Coefficients& c){
+  float ddx = (te - tw) * c.halfInvDx;
+  float d2dx2 = (te + tw - 2.0f * tc) * c.alphaInvDx2;
+  float d2dy2 = (tn + ts - 2.0f * tc) * c.alphaInvDy2;
+
+  return m * c.dt * (d2dx2 + d2dy2 - m * c.u * ddx) + tc;
+}
+
+// the next temperature of cell (x, y) of a w * h mesh, which wraps
+// around in x. The first and last rows are held at MAX_TEMP by a mask
+// of 0, neighbours are found without division.
+inline float update(const float* temp, const float* mask, uint32_t w,
+                    uint32_t h, uint32_t x, uint32_t y,
+                    const Coefficients& c){
+  uint32_t i = y * w + x;
+
+  return update(temp[i], temp[x == 0 ? i + w - 1 : i - 1],
+                temp[x == w - 1 ? i + 1 - w : i + 1],
+                temp[y == 0 ? i : i - w], temp[y == h - 1 ? i : i + w],
+                mask[i], c);
+}
+
+class HeatMesh{
 public:
-  Mesh(int width, int height)
+  HeatMesh(uint32_t width, uint32_t height)
   : width_(width),
-  height_(height){}
+  height_(height),
+  h_(width * height),
+  hNext_(width * height),
+  mask_(width * height){}
 
-  int width(){
+  uint32_t width() const{
     return width_;
   }
 
-  int height(){
-    return width_;
+  uint32_t height() const{
+    return height_;
   }
 
-  int numCells(){
+  uint32_t numCells() const{
     return width_ * height_;
   }
 
-  Position position(int i){
-    Position p;
-    p.x = i / width_;
-    p.y = i % height_;
-    return p;
+  float* h(){
+    return h_.data();
   }
 
-  Position shift(const Position& p, int dx, int dy){
-    Position ps;
-    ps.x = resolve(p.x, width_);
-    ps.y = resolve(p.y, height_);
-
-    return ps;
+  void init(){
+    uint32_t w = width_;
+    uint32_t last = (height_ - 1) * width_;
+    float* h = h_.data();
+    float* hNext = hNext_.data();
+    float* mask = mask_.data();
+
+    for(auto i : Forall(numCells())){
+      bool edge = i < w || i >= last;
+      h[i] = edge ? MAX_TEMP : 0.0f;
+      hNext[i] = h[i];
+      mask[i] = edge ? 0.0f : 1.0f;
+    }
   }
 
-private:
-  int width_;
-  int height_;
-};
+  // the time steps as tiled Foralls, swapping the fields after each one
+  // rather than copying h_next back
+  void run(uint32_t steps, uint32_t tileX, uint32_t tileY){
+    uint32_t w = width_;
+    uint32_t hgt = height_;
+    const float* mask = mask_.data();
+    Coefficients c(width_);
 
-template<class T>
-class Field{
-public:
-  T& operator()(const Position& p){
-    return (*this)(p.x, p.y);
-  }
+    for(uint32_t s = 0; s < steps; ++s){
+      const float* h = h_.data();
+      float* hNext = hNext_.data();
 
-  T& operator()(int x, int y){
-    int xn = resolve(x, width_);
-    int yn = resolve(y, height_);
-    return data_[yn * width_ + xn];
-  }
+      for(auto q : Forall2D(w, hgt, tileX, tileY)){
+        hNext[q.y * w + q.x] = update(h, mask, w, hgt, q.x, q.y, c);
+      }
 
-  T& operator[](int i){
-    return data_[i];
+      h_.swap(hNext_);
+    }
   }
 
-  void init(Mesh& m){
-    width_ = m.width();
-    height_ = m.height();
-    data_ = new T[width_ * height_];
+  // the same steps depth at a time on tiles that stay in cache, the
+  // mesh wrapping around in x and its rows clamped in y as in update()
+  void runBlocked(uint32_t steps, uint32_t depth, uint32_t tileX,
+                  uint32_t tileY){
+    uint32_t w = width_;
+    const float* mask = mask_.data();
+    Coefficients c(width_);
+
+    Stencil2D stencil(width_, height_, 1, StencilBoundary::Periodic,
+                      StencilBoundary::Clamp, depth, tileX, tileY);
+
+    float* h = stencil.run(h_.data(), hNext_.data(), steps,
+                           [&](const StencilView<float>& v){
+      return update(v(0, 0), v(-1, 0), v(1, 0), v(0, -1), v(0, 1),
+                    mask[v.y() * w + v.x()], c);
+    });
+
+    if(h != h_.data()){
+      h_.swap(hNext_);
+    }
   }
 
-private:
-  int width_;
-  int height_;
-  T* data_;
-}; 
+  void runSerial(uint32_t steps){
+    Coefficients c(width_);
 
-class HeatMesh : public Mesh{
-public:
-  HeatMesh(int width, int height)
-  : Mesh(width, height){}
+    for(uint32_t s = 0; s < steps; ++s){
+      for(uint32_t y = 0; y < height_; ++y){
+        for(uint32_t x = 0; x < width_; ++x){
+          hNext_[y * width_ + x] =
+            update(h_.data(), mask_.data(), width_, height_, x, y, c);
+        }
+      }
 
-  void init(){
-    h.init(*this);
-    h_next.init(*this);
-    mask.init(*this);
+      h_.swap(hNext_);
+    }
   }
 
-  Field<float> h;
-  Field<float> h_next;
-  Field<float> mask; 
+private:
+  uint32_t width_;
+  uint32_t height_;
+  vector<float> h_;
+  vector<float> hNext_;
+  vector<float> mask_;
 };
 
-int main(int argc, char** argv){
-  HeatMesh m(MESH_DIM, MESH_DIM);
+double since(Clock::time_point start){
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+void runMesh(const Options& o, size_t threads){
+  uint32_t dim = o.dim;
+
+  // the cells per thread stay the same when weak scaling
+  if(o.weak){
+    dim = uint32_t(lround(o.dim * sqrt(double(threads))));
+  }
+
+  HeatMesh m(dim, dim);
   m.init();
 
-  for(auto i : Forall(m.numCells())){
-    auto p = m.position(i);
+  auto start = Clock::now();
+  if(o.depth > 0){
+    m.runBlocked(o.steps, o.depth, o.tiled ? o.tileX : 128,
+                 o.tiled ? o.tileY : 64);
+  }
+  else{
+    m.run(o.steps, o.tileX, o.tileY);
+  }
+  double t = since(start);
+
+  double cells = double(m.numCells()) * o.steps;
+
+  if(threads == 0){
+    threads = max(size_t(1), ares_runtime_stats().workers.size());
+  }
+
+  cout << "threads " << threads << ", mesh " << dim << "x" << dim <<
+    ", steps " << o.steps;
 
-    m.h[i] = 0.0f;
-    m.h_next[i] = 0.0f;
-    m.mask[i] = 1.0;
+  if(o.depth > 0){
+    cout << ", depth " << o.depth;
+  }
+
+  cout << ": " << t << " s, " <<
+    cells * FLOPS_PER_CELL / t / 1e9 << " GFLOP/s, " <<
+    cells * BYTES_PER_CELL / t / 1e9 << " GB/s";
+
+  if(o.serial){
+    HeatMesh sm(dim, dim);
+    sm.init();
+
+    start = Clock::now();
+    sm.runSerial(o.steps);
+    double ts = since(start);
 
-    if(p.y == 0 || p.y == m.height() - 1){
-      m.h[i] = MAX_TEMP;
-      m.h_next[i] = MAX_TEMP;
-      m.mask[i] = 0.0;
+    float diff = 0.0f;
+    for(uint32_t i = 0; i < m.numCells(); ++i){
+      diff = max(diff, fabs(m.h()[i] - sm.h()[i]));
     }
+
+    cout << ", serial " << ts << " s, speedup " << ts / t <<
+      ", max difference " << diff;
   }
 
-  const float dx    = 10.0f / MESH_DIM;
-  const float dy    = 10.0f / MESH_DIM;
-  const float alpha = 0.00001f;
-  const float dt    = 0.5f * (dx * dx+ dy * dy)/4.0f/alpha;
-  float u = 0.001f;
+  cout << endl;
+}
+
+bool parseTile(const string& s, uint32_t& x, uint32_t& y){
+  size_t pos = s.find('x');
+  if(pos == string::npos){
+    return false;
+  }
 
-  for(size_t i = 0; i < TIME_STEPS; ++i){
-    
-    for(auto i : Forall(m.numCells())){
-      auto p = m.position(i);
-      auto pw = m.shift(p, -1, 0); 
-      auto pe = m.shift(p, 1, 0); 
-      auto pn = m.shift(p, 0, 1); 
-      auto ps = m.shift(p, 0, -1); 
+  x = atoi(s.c_str());
+  y = atoi(s.c_str() + pos + 1);
+  return x > 0 && y > 0;
+}
 
-      float ddx = 0.5 * m.h(pe) - m.h(pw)/dx;
+void usage(){
+  cerr << "usage: mesh [--dim n] [--steps n] [--tile XxY] [--depth n] " <<
+    "[--threads n,...] [--weak] [--no-serial]" << endl;
+}
 
-      float d2dx2 = m.h(pn) - 2.0f * m.h(p) + m.h(pw);
-      d2dx2 /= dx * dx;
+int main(int argc, char** argv){
+  Options o;
 
-      float d2dy2 = m.h(pn) - 2.0f * m.h(p) + m.h(ps);
-      d2dy2 /= dy * dy;
+  for(int i = 1; i < argc; ++i){
+    string arg = argv[i];
+    bool more = i + 1 < argc;
 
-      m.h_next(p) = m.mask(p) * dt * 
-        (alpha * (d2dx2 + d2dy2) - m.mask(p) * u * ddx) + m.h(p);
+    if(arg == "--dim" && more){
+      o.dim = max(3, atoi(argv[++i]));
+    }
+    else if(arg == "--steps" && more){
+      o.steps = atoi(argv[++i]);
+    }
+    else if(arg == "--tile" && more){
+      if(!parseTile(argv[++i], o.tileX, o.tileY)){
+        usage();
+        return 1;
+      }
+      o.tiled = true;
+    }
+    else if(arg == "--depth" && more){
+      o.depth = atoi(argv[++i]);
+    }
+    else if(arg == "--threads" && more){
+      istringstream istr(argv[++i]);
+      string s;
+      while(getline(istr, s, ',')){
+        o.threads.push_back(max(1, atoi(s.c_str())));
+      }
+    }
+    else if(arg == "--weak"){
+      o.weak = true;
     }
+    else if(arg == "--no-serial"){
+      o.serial = false;
+    }
+    else{
+      usage();
+      return 1;
+    }
+  }
+
+  if(o.threads.empty()){
+    runMesh(o, 0);
+    return 0;
+  }
+
+  // the pool size is read once, so each thread count is run in a
+  // process of its own, forked before this one has started the pool
+  bool ok = true;
 
-    for(auto i : Forall(m.numCells())){
-      m.h[i] = m.h_next[i];
+  for(size_t threads : o.threads){
+    cout.flush();
+
+    pid_t pid = fork();
+    if(pid == 0){
+      setenv("ARES_NUM_THREADS", to_string(threads).c_str(), 1);
+      runMesh(o, threads);
+      exit(0);
     }
+
+    int status;
+    ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+      WEXITSTATUS(status) == 0 && ok;
   }
 
-  return 0;
+  return ok ? 0 : 1;
 }
@@ -0,0 +1,113 @@
+#include <iostream>
+#include <vector>
+
+#include <ares/parallel.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 100000;
+
+int main(int argc, char** argv){
+  vector<double> a(SIZE);
+
+  parallel_for(SIZE, [&](uint32_t i){
+    a[i] = i;
+  });
+
+  parallel_for(0, SIZE, [&](uint32_t i){
+    a[i] *= 2;
+  }, schedule::guided());
+
+  // enough runs for the tuner to probe all of its grains
+  for(uint32_t step = 0; step < 40; ++step){
+    parallel_for(0, SIZE, [&](uint32_t i){
+      a[i] += step % 2 ? -1.0 : 1.0;
+    }, schedule::tune());
+  }
+
+  double sum = parallel_reduce(0, SIZE, 0.0, [&](uint32_t i){
+    return a[i];
+  });
+
+  double max = parallel_reduce(0, SIZE, 0.0, [&](uint32_t i){
+    return a[i];
+  }, [](double x, double y){
+    return x > y ? x : y;
+  });
+
+  // a ring whose cells are numbered out of order, each reading its two
+  // neighbours through the connectivity, run from the inspector's plan
+  vector<uint32_t> id(SIZE);
+  for(uint32_t i = 0; i < SIZE; ++i){
+    id[i] = uint32_t((uint64_t(i) * 7919) % SIZE);
+  }
+
+  vector<uint32_t> neighbors(2 * SIZE);
+  for(uint32_t i = 0; i < SIZE; ++i){
+    neighbors[2 * id[i]] = id[(i + 1) % SIZE];
+    neighbors[2 * id[i] + 1] = id[(i + SIZE - 1) % SIZE];
+  }
+
+  vector<double> b(SIZE);
+  const IterationPlan& plan = ares_inspect(neighbors.data(), 2, SIZE);
+
+  for(int step = 0; step < 2; ++step){
+    parallel_for(ares_inspect(neighbors.data(), 2, SIZE), [&](uint32_t i){
+      b[i] = a[neighbors[2 * i]] + a[neighbors[2 * i + 1]];
+    });
+  }
+
+  bool planned = &plan == &ares_inspect(neighbors.data(), 2, SIZE);
+  for(uint32_t i = 0; i < SIZE; ++i){
+    planned = planned &&
+      b[i] == a[neighbors[2 * i]] + a[neighbors[2 * i + 1]];
+  }
+
+  // a search cancels the chunks that have not started once it found one
+  atomic<uint32_t> tested(0);
+  uint32_t found = parallel_find_if(0, SIZE, [&](uint32_t i){
+    ++tested;
+    return a[i] == 20.0;
+  });
+
+  bool searched = found == 10 && tested < SIZE &&
+    parallel_find_if(0, SIZE, [&](uint32_t i){ return a[i] < 0.0; }) == SIZE;
+
+  // scatter adds into a few bins
+  vector<float> bins(4, 0.0f);
+  uint64_t total = 0;
+  parallel_for(0, SIZE, [&](uint32_t i){
+    atomic_add(bins[i % 4], 1.0f);
+    atomic_add(total, uint64_t(i));
+  });
+
+  bool added = total == uint64_t(SIZE) * (SIZE - 1)/2;
+  for(float f : bins){
+    added = added && f == SIZE/4;
+  }
+
+  // the same loops on a single worker, then on all of them again
+  size_t workers = ares_num_workers();
+  bool resized = ares_set_num_workers(1) == 1 && ares_active_workers() == 1;
+
+  for(size_t n : {size_t(1), workers}){
+    ares_set_num_workers(n);
+
+    parallel_for(0, SIZE, [&](uint32_t i){
+      b[i] = a[i];
+    }, schedule::static_());
+
+    resized = resized && ares_active_workers() == n &&
+      parallel_reduce(0, SIZE, 0.0, [&](uint32_t i){
+        return b[i];
+      }) == sum;
+  }
+
+  cout << "sum = " << sum << ", max = " << max << ", planned = " <<
+    planned << ", searched = " << searched << ", added = " << added <<
+    ", resized = " << resized << endl;
+
+  return sum == double(SIZE) * (SIZE - 1) && max == 2.0 * (SIZE - 1) &&
+    planned && searched && added && resized ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <atomic>
+#include <vector>
+
+#include <ares/pipeline.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 100000;
+const uint32_t TOKENS = 8;
+
+struct Chunk{
+  uint32_t index;
+  vector<uint64_t> values;
+};
+
+int main(int argc, char** argv){
+  Pipeline<Chunk> p(TOKENS);
+
+  atomic<uint32_t> inFlight(0);
+  atomic<uint32_t> maxInFlight(0);
+
+  uint32_t next = 0;
+  vector<uint64_t> out;
+  bool ordered = true;
+
+  p.parallel([&](Chunk& c){
+    uint32_t n = inFlight.fetch_add(1) + 1;
+    uint32_t m = maxInFlight.load();
+    while(n > m && !maxInFlight.compare_exchange_weak(m, n)){}
+
+    for(uint64_t& v : c.values){
+      v *= v;
+    }
+  })
+  .parallel([&](Chunk& c){
+    inFlight.fetch_sub(1);
+    return c.index % 3 != 0;
+  })
+  .serial([&](Chunk& c){
+    ordered = ordered && (out.empty() || c.values[0] > out.back());
+    out.push_back(c.values[0]);
+  });
+
+  p.run([&](Chunk& c){
+    if(next == SIZE){
+      return false;
+    }
+
+    c.index = next++;
+    c.values.assign(4, c.index);
+    return true;
+  });
+
+  // the dropped items skip the last stage
+  bool ok = ordered && out.size() == SIZE - (SIZE + 2)/3 &&
+    maxInFlight.load() <= TOKENS;
+
+  cout << "out = " << out.size() << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,38 @@
+#include <iostream>
+#include <cmath>
+
+#include <ares/frontend.h>
+
+using namespace std;
+using namespace ares;
+
+const size_t SIZE = 10;
+
+int main(int argc, char** argv){
+  float M[SIZE][SIZE];
+
+  for(size_t i = 0; i < SIZE; ++i){
+    for(size_t j = 0; j < SIZE; ++j){
+      M[i][j] = i + j * 0.1;
+    }
+  }
+
+  float norms[SIZE];
+  float scale = 2.0;
+
+  for(auto i : Forall(0, SIZE)){
+    float sum = 0.0;
+
+    for(auto j : ReduceAll(0, SIZE, sum)){
+      sum += scale * M[i][j] * M[i][j];
+    }
+
+    norms[i] = sqrt(sum);
+  }
+
+  for(size_t i = 0; i < SIZE; ++i){
+    cout << "norms[" << i << "] = " << norms[i] << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <iostream>
+
+#include <ares/frontend.h>
+
+using namespace std;
+using namespace ares;
+
+const size_t SIZE = 100;
+
+struct MinMax{
+  float min;
+  float max;
+};
+
+void combine(MinMax& a, const MinMax& b){
+  a.min = b.min < a.min ? b.min : a.min;
+  a.max = b.max > a.max ? b.max : a.max;
+}
+
+int main(int argc, char** argv){
+
+  float values[SIZE];
+
+  for(size_t i = 0; i < SIZE; ++i){
+    values[i] = (i * 37) % SIZE;
+  }
+
+  float minValue = 0.0;
+
+  for(auto i : ReduceAll(0, SIZE, minValue, ReduceOp::Min)){
+    if(values[i] < minValue){
+      minValue = values[i];
+    }
+  }
+
+  float maxValue = 0.0;
+
+  for(auto i : ReduceAll(0, SIZE, maxValue, ReduceOp::Max)){
+    if(values[i] > maxValue){
+      maxValue = values[i];
+    }
+  }
+
+  bool positive = false;
+
+  for(auto i : ReduceAll(0, SIZE, positive, ReduceOp::And)){
+    positive = positive && values[i] >= 0.0;
+  }
+
+  uint32_t bits = 0;
+
+  for(auto i : ReduceAll(0, SIZE, bits)){
+    bits |= 1 << (i % 32);
+  }
+
+  float mass = 0.0;
+  double energy = 0.0;
+  uint32_t count = 0;
+
+  for(auto i : ReduceAll(0, SIZE, mass, energy, count)){
+    mass += values[i];
+    energy += 0.5 * values[i] * values[i];
+    ++count;
+  }
+
+  MinMax range = {1e9, -1e9};
+
+  for(auto i : ReduceAll(0, SIZE, range, combine)){
+    combine(range, MinMax{values[i], values[i]});
+  }
+
+  uint32_t histogram[10];
+
+  for(auto i : ReduceAll(0, SIZE, histogram)){
+    histogram[uint32_t(values[i]) / 10] += 1;
+  }
+
+  // too large for a copy per partial, so it is updated atomically
+  double weights[SIZE * 1000];
+
+  for(auto i : ReduceAll(0, SIZE, weights)){
+    weights[(i * 7919) % (SIZE * 1000)] += values[i];
+  }
+
+  // a relaxation step that computes its own residual in the same pass
+  float next[SIZE];
+  float residual = 0.0;
+  float largest = 0.0;
+
+  for(auto i : Forall(SIZE, reduction(residual))){
+    next[i] = 0.5 * values[i];
+    residual += values[i] - next[i];
+  }
+
+  for(auto i : Forall(SIZE, reduction(largest, ReduceOp::Max))){
+    next[i] += 1.0;
+    if(next[i] > largest){
+      largest = next[i];
+    }
+  }
+
+  cout << "min = " << minValue << endl;
+  cout << "max = " << maxValue << endl;
+  cout << "positive = " << positive << endl;
+  cout << "bits = " << hex << bits << dec << endl;
+  cout << "mass = " << mass << " energy = " << energy <<
+    " count = " << count << endl;
+  cout << "residual = " << residual << " largest = " << largest << endl;
+  cout << "range = " << range.min << " " << range.max << endl;
+
+  for(size_t i = 0; i < 10; ++i){
+    cout << "histogram[" << i << "] = " << histogram[i] << endl;
+  }
+
+  cout << "weights[7919] = " << weights[7919] << endl;
+
+  return 0;
+}
@@ -19,5 +19,17 @@ int main(int argc, char** argv){
 
   cout << "sum = " << sum << endl;
 
+  // a Forall that only adds to a scalar is compiled as a reduction of it,
+  // starting from the value it held
+  float total = 1.0;
+  uint32_t count = 0;
+
+  for(auto i : Forall(SIZE)){
+    total += x;
+    ++count;
+  }
+
+  cout << "total = " << total << ", count = " << count << endl;
+
   return 0;
 }
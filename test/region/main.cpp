@@ -0,0 +1,76 @@
+#include <iostream>
+#include <vector>
+
+#include <ares/region.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 10000;
+const uint32_t STEPS = 200;
+
+// a step of a 1-D diffusion then the sum of the new values, serially
+double serial(vector<double>& h, vector<double>& hNext){
+  double total = 0.0;
+
+  for(uint32_t s = 0; s < STEPS; ++s){
+    for(uint32_t i = 1; i < SIZE - 1; ++i){
+      hNext[i] = 0.25 * h[i - 1] + 0.5 * h[i] + 0.25 * h[i + 1];
+    }
+    h.swap(hNext);
+  }
+
+  for(double x : h){
+    total += x;
+  }
+
+  return total;
+}
+
+int main(int argc, char** argv){
+  vector<double> h(SIZE, 0.0);
+  vector<double> hNext(SIZE, 0.0);
+  h[SIZE/2] = 1000.0;
+  h[0] = hNext[0] = 1.0;
+
+  vector<double> sh = h;
+  vector<double> shNext = hNext;
+  double expected = serial(sh, shNext);
+
+  vector<double> partial;
+  double total = 0.0;
+
+  // the time loop runs in the region, each step a forall and a barrier
+  parallel_region([&](ParallelRegion& r){
+    r.single([&]{
+      partial.assign(r.size(), 0.0);
+    });
+
+    for(uint32_t s = 0; s < STEPS; ++s){
+      r.forall(1, SIZE - 1, [&](uint32_t i){
+        hNext[i] = 0.25 * h[i - 1] + 0.5 * h[i] + 0.25 * h[i + 1];
+      });
+
+      r.single([&]{
+        h.swap(hNext);
+      });
+    }
+
+    r.forall_nowait(0, SIZE, [&](uint32_t i){
+      partial[r.rank()] += h[i];
+    });
+    r.barrier();
+
+    r.single([&]{
+      for(double p : partial){
+        total += p;
+      }
+    });
+  });
+
+  bool ok = h == sh && total > 0.999 * expected && total < 1.001 * expected;
+
+  cout << "total = " << total << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <ares/remote.h>
+
+using namespace std;
+using namespace ares;
+
+const int PORT = 9879;
+const uint64_t SIZE = 1 << 16;
+const uint64_t LEAF = 1 << 10;
+
+RemoteFunction<uint64_t, uint64_t, uint64_t>* sum;
+
+// the sum of [lo, hi), halved until it is small, each half that is
+// passed on run by the other rank
+uint64_t sumRange(uint64_t lo, uint64_t hi){
+  if(hi - lo <= LEAF){
+    uint64_t s = 0;
+    for(uint64_t i = lo; i < hi; ++i){
+      s += i;
+    }
+    return s;
+  }
+
+  uint64_t mid = lo + (hi - lo)/2;
+
+  RemoteFuture<uint64_t> upper = sum->spawn(1 - ares_rank(), mid, hi);
+  uint64_t lower = sumRange(lo, mid);
+
+  return lower + upper.get();
+}
+
+vector<uint32_t> iota(uint32_t n, string& label){
+  vector<uint32_t> v(n);
+  std::iota(v.begin(), v.end(), 1);
+  label = to_string(ares_rank());
+  return v;
+}
+
+// both ranks make the same functions, in the same order, before either
+// spawns one
+bool run(){
+  RemoteFunction<uint64_t, uint64_t, uint64_t> s(sumRange);
+  sum = &s;
+
+  RemoteFunction<string, uint32_t> named([](uint32_t n){
+    string label;
+    vector<uint32_t> v = iota(n, label);
+    return label + ":" + to_string(accumulate(v.begin(), v.end(), 0u));
+  });
+
+  RemoteFunction<vector<uint32_t>, uint32_t> numbers([](uint32_t n){
+    string label;
+    return iota(n, label);
+  });
+
+  ares_init_comm(2);
+  ares_barrier();
+
+  bool ok = true;
+
+  if(ares_rank() == 0){
+    ok = s.spawn(1, 0, SIZE).get() == SIZE * (SIZE - 1)/2;
+    ok = ok && named.spawn(1, 100).get() == "1:5050";
+    ok = ok && named.spawn(0, 10).get() == "0:55";
+    ok = ok && numbers.spawn(1, 1000).get().back() == 1000;
+
+    cout << "sum = " << s.spawn(1, 0, SIZE).get() << ", ok = " << ok << endl;
+  }
+
+  // the answers of rank 1 have all been received once rank 0 is here
+  ares_barrier();
+
+  return ok;
+}
+
+int main(int argc, char** argv){
+  cout.flush();
+
+  pid_t pid = fork();
+  if(pid == 0){
+    _exit(ares_connect("localhost", PORT) && run() ? 0 : 1);
+  }
+
+  bool ok = ares_listen(PORT) && run();
+
+  int status;
+  ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+    WEXITSTATUS(status) == 0 && ok;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+
+#include <ares/frontend.h>
+
+using namespace std;
+using namespace ares;
+
+const size_t SIZE = 100;
+
+int main(int argc, char** argv){
+
+  uint32_t counts[SIZE];
+
+  for(size_t i = 0; i < SIZE; ++i){
+    counts[i] = i % 4;
+  }
+
+  // CSR style offsets, offsets[i] is the sum of the counts before i
+  uint32_t offsets[SIZE];
+  uint32_t total = 0;
+
+  for(auto i : ScanAll(0, SIZE, total, offsets, ScanKind::Exclusive)){
+    total += counts[i];
+  }
+
+  double values[SIZE];
+
+  for(size_t i = 0; i < SIZE; ++i){
+    values[i] = i * 0.5;
+  }
+
+  double sums[SIZE];
+  double sum = 0.0;
+
+  for(auto i : ScanAll(0, SIZE, sum, sums)){
+    sum += values[i];
+  }
+
+  double peaks[SIZE];
+  double peak = -1.0;
+
+  for(auto i : ScanAll(0, SIZE, peak, peaks, ReduceOp::Max)){
+    if(values[(i * 37) % SIZE] > peak){
+      peak = values[(i * 37) % SIZE];
+    }
+  }
+
+  for(size_t i = 0; i < SIZE; i += 10){
+    cout << i << ": offset = " << offsets[i] << " sum = " << sums[i] <<
+      " peak = " << peaks[i] << endl;
+  }
+
+  cout << "total = " << total << " sum = " << sum <<
+    " peak = " << peak << endl;
+
+  return 0;
+}
@@ -0,0 +1,54 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <ares/serialize.h>
+
+using namespace std;
+using namespace ares;
+
+struct Header{
+  uint32_t step;
+  double time;
+};
+
+int main(int argc, char** argv){
+  // a single rank sends to itself
+  ares_listen(9877);
+  ares_init_comm(1);
+
+  vector<double> field(10000);
+  for(size_t i = 0; i < field.size(); ++i){
+    field[i] = i * 0.5;
+  }
+
+  vector<int32_t> ids = {3, 1, 4, 1, 5};
+
+  MessageWriter writer;
+  writer << Header{7, 0.25} << 'x' << field << string("mesh") << ids;
+  writer.send(ares_rank(), 1);
+
+  MessageReader reader(ares_rank(), 1);
+
+  Header h;
+  char c;
+  reader >> h >> c;
+  MessageView<double> f = reader.view<double>();
+
+  string name;
+  vector<int32_t> rids;
+  reader >> name >> rids;
+
+  bool ok = h.step == 7 && h.time == 0.25 && c == 'x' &&
+    f.size() == field.size() && name == "mesh" && rids == ids &&
+    reader.remaining() == 0 &&
+    reinterpret_cast<uintptr_t>(f.data()) % alignof(double) == 0;
+
+  for(size_t i = 0; ok && i < f.size(); ++i){
+    ok = f[i] == field[i];
+  }
+
+  cout << "size = " << writer.size() << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+#include <iostream>
+
+#include <ares/soa.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 100000;
+
+struct Particle{
+  double x, y, z;
+  double vx, vy, vz;
+  double ax, ay, az;
+  double mass;
+  float charge;
+  int cell;
+};
+
+ARES_SOA(Particle, x, y, z, vx, vy, vz, ax, ay, az, mass, charge, cell)
+
+int main(int argc, char** argv){
+  soa_vector<Particle> p;
+
+  for(uint32_t i = 0; i < SIZE; ++i){
+    Particle pi = {};
+    pi.x = i;
+    pi.vx = 1.0;
+    pi.cell = int(i % 7);
+    p.push_back(pi);
+  }
+
+  p.resize(SIZE + 10);
+
+  // a step touches only the arrays of x and vx
+  for(int step = 0; step < 3; ++step){
+    parallel_for(0, uint32_t(p.size()), [&](uint32_t i){
+      p[i].x += p[i].vx;
+    });
+  }
+
+  double sum = parallel_reduce(0, uint32_t(p.size()), 0.0, [&](uint32_t i){
+    return p[i].x;
+  });
+
+  p[SIZE] = p[7];
+  Particle q = p[SIZE];
+
+  bool ok = sum == double(SIZE) * (SIZE - 1) / 2 + 3.0 * SIZE &&
+    q.x == 10.0 && q.cell == 0 && p.data().x[SIZE] == 10.0 &&
+    reinterpret_cast<uintptr_t>(p.data().cell) % 64 == 0;
+
+  cout << "sum = " << sum << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,361 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <ares/sparse.h>
+
+using namespace std;
+using namespace ares;
+
+using Clock = chrono::steady_clock;
+
+// the vectors of an spmm()
+const uint32_t SPMM_K = 8;
+
+struct Options{
+  vector<string> paths;
+  size_t reps = 5;
+  bool quick = false;
+};
+
+struct Entry{
+  uint32_t row;
+  uint32_t col;
+  double value;
+};
+
+double since(Clock::time_point start){
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// the same lines as ares_bench, with the matrix as another member
+void report(const string& bench, const string& params, const string& unit,
+            vector<double> samples){
+  sort(samples.begin(), samples.end());
+
+  cout << "{\"bench\": \"" << bench << "\", " << params <<
+    ", \"unit\": \"" << unit << "\", \"median\": " <<
+    samples[samples.size()/2] << ", \"min\": " << samples.front() <<
+    ", \"max\": " << samples.back() << ", \"reps\": " << samples.size() <<
+    "}" << endl;
+}
+
+void fail(const string& matrix, const string& bench){
+  cerr << "ares_sparse: " << bench << " of " << matrix <<
+    " computed a wrong result" << endl;
+  exit(1);
+}
+
+CsrMatrix<double> toCsr(uint32_t rows, uint32_t cols, vector<Entry>& entries){
+  sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){
+    return make_tuple(a.row, a.col) < make_tuple(b.row, b.col);
+  });
+
+  CsrMatrix<double> a;
+  a.rows = rows;
+  a.cols = cols;
+  a.offsets.assign(rows + 1, 0);
+
+  for(const Entry& e : entries){
+    ++a.offsets[e.row + 1];
+    a.columns.push_back(e.col);
+    a.values.push_back(e.value);
+  }
+
+  for(uint32_t r = 0; r < rows; ++r){
+    a.offsets[r + 1] += a.offsets[r];
+  }
+
+  return a;
+}
+
+// a coordinate Matrix Market file, as SuiteSparse distributes them, of
+// real, integer or pattern entries, general or with the upper triangle
+// of a symmetric or skew-symmetric matrix left out
+CsrMatrix<double> readMatrixMarket(const string& path){
+  ifstream istr(path);
+  if(!istr){
+    cerr << "ares_sparse: cannot open " << path << endl;
+    exit(1);
+  }
+
+  string line;
+  getline(istr, line);
+
+  istringstream header(line);
+  string banner, object, format, field, symmetry;
+  header >> banner >> object >> format >> field >> symmetry;
+
+  if(banner != "%%MatrixMarket" || object != "matrix" ||
+     format != "coordinate" || field == "complex"){
+    cerr << "ares_sparse: " << path <<
+      " is not a real coordinate Matrix Market matrix" << endl;
+    exit(1);
+  }
+
+  while(getline(istr, line) && (line.empty() || line[0] == '%')){}
+
+  uint64_t rows, cols, n;
+  istringstream sizes(line);
+  if(!(sizes >> rows >> cols >> n)){
+    cerr << "ares_sparse: " << path << " has no sizes" << endl;
+    exit(1);
+  }
+
+  bool pattern = field == "pattern";
+  bool symmetric = symmetry == "symmetric" || symmetry == "hermitian";
+  bool skew = symmetry == "skew-symmetric";
+
+  vector<Entry> entries;
+  entries.reserve(symmetric || skew ? 2 * n : n);
+
+  for(uint64_t k = 0; k < n; ++k){
+    uint64_t r, c;
+    double v = 1.0;
+    if(!(istr >> r >> c) || (!pattern && !(istr >> v)) || r < 1 ||
+       r > rows || c < 1 || c > cols){
+      cerr << "ares_sparse: " << path << " has a bad entry " << k << endl;
+      exit(1);
+    }
+
+    entries.push_back({uint32_t(r - 1), uint32_t(c - 1), v});
+    if((symmetric || skew) && r != c){
+      entries.push_back({uint32_t(c - 1), uint32_t(r - 1), skew ? -v : v});
+    }
+  }
+
+  return toCsr(uint32_t(rows), uint32_t(cols), entries);
+}
+
+// rows whose lengths fall off as a power of their rank, shuffled, as
+// the degrees of a web or social graph do: a few rows hold a large part
+// of the nonzeros and most have one or two
+CsrMatrix<double> powerLaw(uint32_t n){
+  mt19937 rng(17);
+  uniform_int_distribution<uint32_t> column(0, n - 1);
+  uniform_real_distribution<double> value(-1.0, 1.0);
+
+  vector<uint32_t> ranks(n);
+  for(uint32_t r = 0; r < n; ++r){
+    ranks[r] = r;
+  }
+  shuffle(ranks.begin(), ranks.end(), rng);
+
+  vector<Entry> entries;
+  for(uint32_t r = 0; r < n; ++r){
+    uint32_t length =
+      max(uint32_t(1), uint32_t(n/4/pow(ranks[r] + 1.0, 1.2)));
+    for(uint32_t k = 0; k < length; ++k){
+      entries.push_back({r, column(rng), value(rng)});
+    }
+  }
+
+  return toCsr(n, n, entries);
+}
+
+// the 5 point Laplacian of an m x m grid, whose rows are all but
+// the same length
+CsrMatrix<double> laplacian(uint32_t m){
+  vector<Entry> entries;
+
+  for(uint32_t i = 0; i < m; ++i){
+    for(uint32_t j = 0; j < m; ++j){
+      uint32_t r = i * m + j;
+      entries.push_back({r, r, 4.0});
+      if(i > 0){
+        entries.push_back({r, r - m, -1.0});
+      }
+      if(i + 1 < m){
+        entries.push_back({r, r + m, -1.0});
+      }
+      if(j > 0){
+        entries.push_back({r, r - 1, -1.0});
+      }
+      if(j + 1 < m){
+        entries.push_back({r, r + 1, -1.0});
+      }
+    }
+  }
+
+  return toCsr(m * m, m * m, entries);
+}
+
+void serialSpmm(const CsrMatrix<double>& a, const double* x, double* y,
+                uint32_t k){
+  for(uint32_t r = 0; r < a.rows; ++r){
+    for(uint32_t j = 0; j < k; ++j){
+      double s = 0.0;
+      for(uint32_t i = a.offsets[r]; i < a.offsets[r + 1]; ++i){
+        s += a.values[i] * x[size_t(a.columns[i]) * k + j];
+      }
+      y[size_t(r) * k + j] = s;
+    }
+  }
+}
+
+// a Forall over the rows, as the kernel is written without sparse.h
+void rowSpmm(const CsrMatrix<double>& a, const double* x, double* y,
+             uint32_t k){
+  parallel_for(0, a.rows, [&](uint32_t r){
+    double* yr = y + size_t(r) * k;
+    for(uint32_t j = 0; j < k; ++j){
+      yr[j] = 0.0;
+    }
+    for(uint32_t i = a.offsets[r]; i < a.offsets[r + 1]; ++i){
+      const double* xr = x + size_t(a.columns[i]) * k;
+      for(uint32_t j = 0; j < k; ++j){
+        yr[j] += a.values[i] * xr[j];
+      }
+    }
+  });
+}
+
+// the sums are taken in another order than the serial ones
+bool near(const vector<double>& y, const vector<double>& expected){
+  for(size_t i = 0; i < y.size(); ++i){
+    if(!(fabs(y[i] - expected[i]) <= 1e-9 * (1.0 + fabs(expected[i])))){
+      return false;
+    }
+  }
+  return true;
+}
+
+// checks y = f(), then times it over the reps, in GFLOP/s of the
+// 2 flops of each product
+void run(const Options& o, const string& bench, const string& params,
+         const string& matrix, double flops, const vector<double>& expected,
+         vector<double>& y, const function<void()>& f){
+  fill(y.begin(), y.end(), 0.0);
+  f();
+
+  if(!near(y, expected)){
+    fail(matrix, bench);
+  }
+
+  size_t iters = max(size_t(1), size_t(1e8/flops));
+
+  vector<double> samples;
+  for(size_t r = 0; r < o.reps; ++r){
+    auto start = Clock::now();
+    for(size_t k = 0; k < iters; ++k){
+      f();
+    }
+    samples.push_back(flops * iters/since(start) * 1e-9);
+  }
+
+  report(bench, params, "GFLOP/s", samples);
+}
+
+void benchMatrix(const Options& o, const string& matrix,
+                 const CsrMatrix<double>& a){
+  uint32_t nnz = a.nnz();
+
+  uint32_t longest = 0;
+  for(uint32_t r = 0; r < a.rows; ++r){
+    longest = max(longest, a.offsets[r + 1] - a.offsets[r]);
+  }
+
+  string params = "\"matrix\": \"" + matrix + "\", \"rows\": " +
+    to_string(a.rows) + ", \"nnz\": " + to_string(nnz) +
+    ", \"longest\": " + to_string(longest);
+
+  vector<double> x(size_t(a.cols) * SPMM_K);
+  for(size_t i = 0; i < x.size(); ++i){
+    x[i] = 1.0 + double(i % 7)/8;
+  }
+
+  double flops = 2.0 * nnz;
+
+  vector<double> expected(a.rows);
+  serialSpmm(a, x.data(), expected.data(), 1);
+
+  vector<double> y(a.rows);
+
+  run(o, "spmv-rows", params, matrix, flops, expected, y, [&]{
+    rowSpmm(a, x.data(), y.data(), 1);
+  });
+
+  run(o, "spmv-merge", params, matrix, flops, expected, y, [&]{
+    spmv(a, x.data(), y.data());
+  });
+
+  // ELL only where the padding at most doubles the nonzeros
+  bool ell = uint64_t(longest) * a.rows <= 2 * uint64_t(nnz);
+  EllMatrix<double> e;
+  if(ell){
+    e = to_ell(a);
+    run(o, "spmv-ell", params, matrix, flops, expected, y, [&]{
+      spmv(e, x.data(), y.data());
+    });
+  }
+
+  expected.resize(size_t(a.rows) * SPMM_K);
+  serialSpmm(a, x.data(), expected.data(), SPMM_K);
+  y.resize(expected.size());
+
+  string spmmParams = params + ", \"k\": " + to_string(SPMM_K);
+
+  run(o, "spmm-rows", spmmParams, matrix, flops * SPMM_K, expected, y, [&]{
+    rowSpmm(a, x.data(), y.data(), SPMM_K);
+  });
+
+  run(o, "spmm-merge", spmmParams, matrix, flops * SPMM_K, expected, y, [&]{
+    spmm(a, x.data(), y.data(), SPMM_K);
+  });
+
+  if(ell){
+    run(o, "spmm-ell", spmmParams, matrix, flops * SPMM_K, expected, y, [&]{
+      spmm(e, x.data(), y.data(), SPMM_K);
+    });
+  }
+}
+
+void usage(){
+  cerr << "usage: ares_sparse [--reps n] [--quick] [matrix.mtx ...]" <<
+    endl << "without matrices, a generated power law and Laplacian are run"
+    << endl;
+}
+
+int main(int argc, char** argv){
+  Options o;
+
+  for(int i = 1; i < argc; ++i){
+    string arg = argv[i];
+    bool more = i + 1 < argc;
+
+    if(arg == "--reps" && more){
+      o.reps = max(1, atoi(argv[++i]));
+    }
+    else if(arg == "--quick"){
+      o.quick = true;
+    }
+    else if(!arg.empty() && arg[0] != '-'){
+      o.paths.push_back(arg);
+    }
+    else{
+      usage();
+      return 1;
+    }
+  }
+
+  if(o.paths.empty()){
+    benchMatrix(o, "powerlaw", powerLaw(o.quick ? 1 << 13 : 1 << 18));
+    benchMatrix(o, "laplacian", laplacian(o.quick ? 128 : 1024));
+  }
+
+  for(const string& path : o.paths){
+    string name = path.substr(path.find_last_of('/') + 1);
+    benchMatrix(o, name, readMatrixMarket(path));
+  }
+
+  return 0;
+}
@@ -0,0 +1,38 @@
+#include <iostream>
+
+#include <ares/frontend.h>
+
+using namespace std;
+using namespace ares;
+
+const size_t SIZE = 64;
+
+// each call fills its own block, nothing is returned to wait on
+task void fill(float* a, size_t begin, size_t end){
+  for(size_t i = begin; i < end; ++i){
+    a[i] = i * 0.5f;
+  }
+}
+
+int main(int argc, char** argv){
+  float a[SIZE];
+
+  {
+    TaskGroup group;
+
+    for(size_t b = 0; b < SIZE; b += 8){
+      fill(a, b, b + 8);
+    }
+
+    group.wait();
+  }
+
+  float sum = 0.0f;
+  for(size_t i = 0; i < SIZE; ++i){
+    sum += a[i];
+  }
+
+  cout << "sum = " << sum << endl;
+
+  return 0;
+}
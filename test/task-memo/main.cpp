@@ -0,0 +1,23 @@
+#include <iostream>
+#include <cstdint>
+
+using namespace std;
+
+// each fib(i) runs once, the other calls made with i share its result,
+// so that this returns rather than making 2 fib(n + 1) - 1 calls
+__attribute__((annotate("ares_memoize")))
+task uint64_t fib(int i){
+  if(i <= 1){
+    return i;
+  }
+
+  return fib(i - 1) + fib(i - 2);
+}
+
+int main(int argc, char** argv){
+  uint64_t f = fib(80);
+
+  cout << "f = " << f << ", ok = " << (f == 23416728348467685ull) << endl;
+
+  return 0;
+}
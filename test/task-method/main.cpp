@@ -0,0 +1,57 @@
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+class Tree{
+public:
+  Tree(int depth)
+  : depth_(depth){}
+
+  // the calls on the two subtrees are spawned, each reads its own Tree
+  task int count() const{
+    if(depth_ == 0){
+      return 1;
+    }
+
+    Tree left(depth_ - 1);
+    Tree right(depth_ - 1);
+
+    return left.count() + right.count() + 1;
+  }
+
+private:
+  int depth_;
+};
+
+task int checked(int i){
+  if(i < 0){
+    throw runtime_error("negative");
+  }
+
+  return i*2;
+}
+
+int main(int argc, char** argv){
+  Tree t(6);
+  cout << "nodes = " << t.count() << endl;
+
+  int base = 10;
+  auto add = [=](int i) task {
+    return base + i;
+  };
+
+  int a = add(1);
+  int b = add(2);
+  cout << "sum = " << a + b << endl;
+
+  // called with invoke, the serial path keeps its handler
+  try{
+    cout << "checked = " << checked(21) << endl;
+  }
+  catch(const exception& e){
+    cout << "error: " << e.what() << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include <ares/thpool.h>
+
+#define SIZE 10000
+
+static threadpool pool;
+static double a[SIZE];
+
+void* square(void* arg){
+  size_t i = (size_t)(uintptr_t)arg;
+  a[i] = (double)i * i;
+  return NULL;
+}
+
+// a job that adds the upper half of its range as another job, which
+// thpool_wait() has to wait for too
+void* split(void* arg){
+  size_t n = (size_t)(uintptr_t)arg;
+  if(n > 1){
+    thpool_add_work(pool, split, (void*)(uintptr_t)(n / 2));
+  }
+  a[n] += 1.0;
+  return NULL;
+}
+
+int main(int argc, char** argv){
+  pool = thpool_init(4);
+
+  for(size_t i = 0; i < SIZE / 2; ++i){
+    thpool_add_work(pool, square, (void*)(uintptr_t)i);
+  }
+
+  void* args[SIZE / 2];
+  for(size_t i = 0; i < SIZE / 2; ++i){
+    args[i] = (void*)(uintptr_t)(SIZE / 2 + i);
+  }
+  thpool_add_work_batch(pool, square, args, SIZE / 2);
+
+  thpool_wait(pool);
+
+  thpool_pause(pool);
+  thpool_add_work(pool, split, (void*)(uintptr_t)(SIZE / 2));
+  thpool_resume(pool);
+  thpool_wait(pool);
+
+  thpool_destroy(pool);
+
+  double sum = 0.0;
+  for(size_t i = 0; i < SIZE; ++i){
+    sum += a[i];
+  }
+
+  // the squares, and one more for each index that split() visited
+  printf("sum: %.0f\n", sum);
+
+  return 0;
+}
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <atomic>
+#include <vector>
+
+#include <ares/wavefront.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t NX = 1000;
+const uint32_t NY = 700;
+
+int main(int argc, char** argv){
+  // an upwind sweep, each point from the one to its left and the one
+  // above it, which the serial sweep computes in the same order
+  vector<double> a((NX + 1) * (NY + 1), 1.0);
+  vector<double> expected = a;
+
+  auto point = [](vector<double>& v, uint32_t x, uint32_t y){
+    double* p = v.data() + (y + 1) * (NX + 1) + x + 1;
+    *p = 0.5 * p[-1] + 0.25 * *(p - (NX + 1)) + 1.0;
+  };
+
+  for(uint32_t y = 0; y < NY; ++y){
+    for(uint32_t x = 0; x < NX; ++x){
+      point(expected, x, y);
+    }
+  }
+
+  Wavefront2D(NX, NY, 64, 16).run([&](Index2D i){
+    point(a, i.x, i.y);
+  });
+
+  bool ok = a == expected;
+
+  // every tile once, after the tiles to its left and above it
+  vector<atomic<uint32_t>> done((NX + 63)/64 * ((NY + 15)/16));
+  for(auto& d : done){
+    d.store(0);
+  }
+
+  uint32_t tx = (NX + 63)/64;
+  atomic<bool> ordered(true);
+
+  Wavefront2D(NX, NY, 64, 16).tiles([&](const Tile2D& t){
+    uint32_t x = t.x0/64;
+    uint32_t y = t.y0/16;
+
+    if((x > 0 && done[y * tx + x - 1].load() != 1) ||
+       (y > 0 && done[(y - 1) * tx + x].load() != 1)){
+      ordered.store(false);
+    }
+
+    done[y * tx + x].fetch_add(1);
+  });
+
+  for(auto& d : done){
+    ok = ok && d.load() == 1;
+  }
+  ok = ok && ordered.load();
+
+  cout << "a = " << a.back() << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}
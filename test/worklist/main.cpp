@@ -0,0 +1,72 @@
+#include <iostream>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include <ares/worklist.h>
+
+using namespace std;
+using namespace ares;
+
+const uint32_t SIZE = 100000;
+const uint32_t DEGREE = 4;
+const uint32_t UNSEEN = UINT32_MAX;
+
+int main(int argc, char** argv){
+  // a ring with chords
+  vector<uint32_t> neighbors(SIZE * DEGREE);
+  for(uint32_t i = 0; i < SIZE; ++i){
+    neighbors[i * DEGREE] = (i + 1) % SIZE;
+    neighbors[i * DEGREE + 1] = (i + SIZE - 1) % SIZE;
+    neighbors[i * DEGREE + 2] = (i * 7919u) % SIZE;
+    neighbors[i * DEGREE + 3] = (i / 2 + 31) % SIZE;
+  }
+
+  vector<atomic<bool>> seen(SIZE);
+  for(auto& b : seen){
+    b.store(false);
+  }
+  seen[0].store(true);
+
+  atomic<uint32_t> visits(0);
+
+  // a vertex is pushed by whoever sees it first
+  parallel_while(vector<uint32_t>{0}, [&](uint32_t& v, Worklist<uint32_t>& w){
+    visits.fetch_add(1);
+
+    for(uint32_t k = 0; k < DEGREE; ++k){
+      uint32_t u = neighbors[v * DEGREE + k];
+      if(!seen[u].load() && !seen[u].exchange(true)){
+        w.push(u);
+      }
+    }
+  });
+
+  vector<bool> expected(SIZE);
+  deque<uint32_t> q{0};
+  expected[0] = true;
+  uint32_t reached = 1;
+
+  while(!q.empty()){
+    uint32_t v = q.front();
+    q.pop_front();
+
+    for(uint32_t k = 0; k < DEGREE; ++k){
+      uint32_t u = neighbors[v * DEGREE + k];
+      if(!expected[u]){
+        expected[u] = true;
+        ++reached;
+        q.push_back(u);
+      }
+    }
+  }
+
+  bool ok = visits.load() == reached;
+  for(uint32_t i = 0; i < SIZE; ++i){
+    ok = ok && seen[i].load() == expected[i];
+  }
+
+  cout << "visits = " << visits.load() << ", ok = " << ok << endl;
+
+  return ok ? 0 : 1;
+}